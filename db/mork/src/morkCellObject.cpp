@@ -252,8 +252,10 @@ NS_IMETHODIMP morkCellObject::SetYarn(nsIMdbEnv* mev, const mdbYarn* inYarn) {
       morkStore* store = row->GetRowSpaceStore(ev);
       if (store) {
         cell->SetYarn(ev, inYarn, store);
-        if (row->IsRowClean() && store->mStore_CanDirty)
-          row->MaybeDirtySpaceStoreAndRow();
+        if (store->mStore_CanDirty && row->MaybeDirtySpaceStoreAndRow(ev)) {
+          cell->SetCellDirty();
+          if (!row->IsRowRewrite()) row->NoteRowSetCol(ev, cell->GetColumn());
+        }
       }
     } else
       ev->NilPointerError();
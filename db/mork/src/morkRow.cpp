@@ -60,11 +60,18 @@ void morkRow::NoteRowAddCol(morkEnv* ev, mork_column inColumn) {
     mork_delta newDelta;
     morkDelta_Init(newDelta, inColumn, morkChange_kAdd);
 
-    if (newDelta != mRow_Delta)  // not repeating existing data?
+    if (newDelta != mRow_Delta && !this->IsRowPartial())  // not repeating?
     {
       if (this->HasRowDelta())  // already have one change recorded?
-        this->SetRowRewrite();  // just plan to write all row cells
-      else
+      {
+        if (this->GetDeltaChange() == morkChange_kCut)
+          this->SetRowRewrite();  // just plan to write all row cells
+        else {
+          // added cells are marked dirty, so only those need writing:
+          this->SetRowPartial();
+          this->ClearRowDelta();
+        }
+      } else
         this->SetRowDelta(inColumn, morkChange_kAdd);
     }
   } else
@@ -78,7 +85,8 @@ void morkRow::NoteRowCutCol(morkEnv* ev, mork_column inColumn) {
 
     if (newDelta != mRow_Delta)  // not repeating existing data?
     {
-      if (this->HasRowDelta())  // already have one change recorded?
+      // a partial row cannot say which cells were cut:
+      if (this->HasRowDelta() || this->IsRowPartial())
         this->SetRowRewrite();  // just plan to write all row cells
       else
         this->SetRowDelta(inColumn, morkChange_kCut);
@@ -89,10 +97,23 @@ void morkRow::NoteRowCutCol(morkEnv* ev, mork_column inColumn) {
 
 void morkRow::NoteRowSetCol(morkEnv* ev, mork_column inColumn) {
   if (!this->IsRowRewrite()) {
-    if (this->HasRowDelta())  // already have one change recorded?
-      this->SetRowRewrite();  // just plan to write all row cells
-    else
-      this->SetRowDelta(inColumn, morkChange_kSet);
+    mork_delta newDelta;
+    morkDelta_Init(newDelta, inColumn, morkChange_kSet);
+
+    if (newDelta != mRow_Delta && !this->IsRowPartial())  // not repeating?
+    {
+      if (this->HasRowDelta())  // already have one change recorded?
+      {
+        if (this->GetDeltaChange() == morkChange_kCut)
+          this->SetRowRewrite();  // just plan to write all row cells
+        else {
+          // set cells are marked dirty too, so only those need writing:
+          this->SetRowPartial();
+          this->ClearRowDelta();
+        }
+      } else
+        this->SetRowDelta(inColumn, morkChange_kSet);
+    }
   } else
     this->ClearRowDelta();
 }
@@ -174,7 +195,7 @@ void morkRow::InitRow(morkEnv* ev, const mdbOid* inOid, morkRowSpace* ioSpace,
 
         if (inLength) mRow_Cells = ioPool->NewCells(ev, inLength, zone);
 
-        if (this->MaybeDirtySpaceStoreAndRow())  // new row might dirty store
+        if (this->MaybeDirtySpaceStoreAndRow(ev))  // new row might dirty store
         {
           this->SetRowRewrite();
           this->NoteRowSetAll(ev);
@@ -324,7 +345,7 @@ void morkRow::TakeCells(morkEnv* ev, morkCell* ioVector, mork_fill inVecLength,
   }
 }
 
-mork_bool morkRow::MaybeDirtySpaceStoreAndRow() {
+mork_bool morkRow::MaybeDirtySpaceStoreAndRow(morkEnv* ev) {
   morkRowSpace* rowSpace = mRow_Space;
   if (rowSpace) {
     morkStore* store = rowSpace->mSpace_Store;
@@ -334,6 +355,17 @@ mork_bool morkRow::MaybeDirtySpaceStoreAndRow() {
     }
 
     if (rowSpace->mSpace_CanDirty) {
+      if (this->IsRowClean())  // first change since the last commit?
+      {
+        // cells dirty from now on are exactly those changed before commit:
+        morkCell* cells = mRow_Cells;
+        if (cells) {
+          morkCell* end = cells + mRow_Length;
+          --cells;  // prepare for preincrement:
+          while (++cells < end) cells->SetCellClean();
+        }
+        rowSpace->NoteDirtyRow(ev, this);
+      }
       this->SetRowDirty();
       rowSpace->SetRowSpaceDirty();
       return morkBool_kTrue;
@@ -350,7 +382,7 @@ morkCell* morkRow::NewCell(morkEnv* ev, mdb_column inColumn, mork_pos* outPos,
   morkPool* pool = ioStore->StorePool();
   morkZone* zone = &ioStore->mStore_Zone;
 
-  mork_bool canDirty = this->MaybeDirtySpaceStoreAndRow();
+  mork_bool canDirty = this->MaybeDirtySpaceStoreAndRow(ev);
 
   if (pool->AddRowCells(ev, this, length + 1, zone)) {
     morkCell* cell = mRow_Cells + length;
@@ -467,7 +499,7 @@ void morkRow::EmptyAllCells(morkEnv* ev) {
   if (cells) {
     morkStore* store = this->GetRowSpaceStore(ev);
     if (store) {
-      if (this->MaybeDirtySpaceStoreAndRow()) {
+      if (this->MaybeDirtySpaceStoreAndRow(ev)) {
         this->SetRowRewrite();
         this->NoteRowSetAll(ev);
       }
@@ -508,7 +540,7 @@ void morkRow::cut_all_index_entries(morkEnv* ev) {
 void morkRow::CutAllColumns(morkEnv* ev) {
   morkStore* store = this->GetRowSpaceStore(ev);
   if (store) {
-    if (this->MaybeDirtySpaceStoreAndRow()) {
+    if (this->MaybeDirtySpaceStoreAndRow(ev)) {
       this->SetRowRewrite();
       this->NoteRowSetAll(ev);
     }
@@ -526,7 +558,7 @@ void morkRow::SetRow(morkEnv* ev, const morkRow* inSourceRow) {
   morkStore* store = this->GetRowSpaceStore(ev);
   morkStore* srcStore = inSourceRow->GetRowSpaceStore(ev);
   if (store && srcStore) {
-    if (this->MaybeDirtySpaceStoreAndRow()) {
+    if (this->MaybeDirtySpaceStoreAndRow(ev)) {
       this->SetRowRewrite();
       this->NoteRowSetAll(ev);
     }
@@ -602,7 +634,7 @@ void morkRow::OnZeroRowGcUse(morkEnv* ev)
 void morkRow::DirtyAllRowContent(morkEnv* ev) {
   MORK_USED_1(ev);
 
-  if (this->MaybeDirtySpaceStoreAndRow()) {
+  if (this->MaybeDirtySpaceStoreAndRow(ev)) {
     this->SetRowRewrite();
     this->NoteRowSetAll(ev);
   }
@@ -639,7 +671,7 @@ void morkRow::CutColumn(morkEnv* ev, mdb_column inColumn) {
   if (cell) {
     morkStore* store = this->GetRowSpaceStore(ev);
     if (store) {
-      if (this->MaybeDirtySpaceStoreAndRow() && !this->IsRowRewrite())
+      if (this->MaybeDirtySpaceStoreAndRow(ev) && !this->IsRowRewrite())
         this->NoteRowCutCol(ev, inColumn);
 
       morkRowSpace* rowSpace = mRow_Space;
@@ -726,8 +758,10 @@ void morkRow::AddColumn(morkEnv* ev, mdb_column inColumn, const mdbYarn* inYarn,
         if (oldCell)  // we changed a pre-existing cell in the row?
         {
           ++mRow_Seed;
-          if (this->MaybeDirtySpaceStoreAndRow() && !this->IsRowRewrite())
-            this->NoteRowAddCol(ev, inColumn);
+          if (this->MaybeDirtySpaceStoreAndRow(ev)) {
+            cell->SetCellDirty();
+            if (!this->IsRowRewrite()) this->NoteRowAddCol(ev, inColumn);
+          }
         }
 
         if (map)  // inColumn is indexed by row space?
@@ -29,6 +29,7 @@ class nsIMdbCell;
 #define morkRow_kNotedBit ((mork_u1)(1 << 0))   /* space has change notes */
 #define morkRow_kRewriteBit ((mork_u1)(1 << 1)) /* must rewrite all cells */
 #define morkRow_kDirtyBit ((mork_u1)(1 << 2))   /* row has been changed */
+#define morkRow_kPartialBit ((mork_u1)(1 << 3)) /* write only dirty cells */
 
 class morkRow {  // row of cells
 
@@ -70,6 +71,7 @@ class morkRow {  // row of cells
   void SetRowNoted() { mRow_Flags |= morkRow_kNotedBit; }
   void SetRowRewrite() { mRow_Flags |= morkRow_kRewriteBit; }
   void SetRowDirty() { mRow_Flags |= morkRow_kDirtyBit; }
+  void SetRowPartial() { mRow_Flags |= morkRow_kPartialBit; }
 
   void ClearRowNoted() { mRow_Flags &= (mork_u1)~morkRow_kNotedBit; }
   void ClearRowRewrite() { mRow_Flags &= (mork_u1)~morkRow_kRewriteBit; }
@@ -84,6 +86,10 @@ class morkRow {  // row of cells
     return (mRow_Flags & morkRow_kRewriteBit) != 0;
   }
 
+  mork_bool IsRowPartial() const {
+    return (mRow_Flags & morkRow_kPartialBit) != 0;
+  }
+
   mork_bool IsRowClean() const { return (mRow_Flags & morkRow_kDirtyBit) == 0; }
 
   mork_bool IsRowDirty() const { return (mRow_Flags & morkRow_kDirtyBit) != 0; }
@@ -105,7 +111,7 @@ class morkRow {  // row of cells
   mork_u2 AddRowGcUse(morkEnv* ev);
   mork_u2 CutRowGcUse(morkEnv* ev);
 
-  mork_bool MaybeDirtySpaceStoreAndRow();
+  mork_bool MaybeDirtySpaceStoreAndRow(morkEnv* ev);
 
  public:  // internal row methods
   void cut_all_index_entries(morkEnv* ev);
@@ -97,7 +97,12 @@ morkRowSpace::morkRowSpace(morkEnv* ev, const morkUsage& inUsage,
       mRowSpace_NextRowId(1)
 
       ,
-      mRowSpace_IndexCount(0) {
+      mRowSpace_IndexCount(0),
+      mRowSpace_DirtyRows(ev, morkUsage::kMember, (nsIMdbHeap*)0,
+                          morkRowSpace_kStartDirtyRowsSize, ioSlotHeap),
+      mRowSpace_DirtyRowsLost(morkBool_kFalse) {
+  mRowSpace_Pad[0] = mRowSpace_Pad[1] = mRowSpace_Pad[2] = 0;
+
   morkAtomRowMap** cache = mRowSpace_IndexCache;
   morkAtomRowMap** cacheEnd = cache + morkRowSpace_kPrimeCacheSize;
   while (cache < cacheEnd)
@@ -125,6 +130,7 @@ morkRowSpace::morkRowSpace(morkEnv* ev, const morkUsage& inUsage,
     }
 
     mRowSpace_Tables.CloseMorkNode(ev);
+    mRowSpace_DirtyRows.CloseMorkNode(ev);
 
     morkStore* store = mSpace_Store;
     if (store) this->CutAllRows(ev, &store->mStore_Pool);
@@ -158,6 +164,32 @@ morkRowSpace::morkRowSpace(morkEnv* ev, const morkUsage& inUsage,
   ev->NewError("row ID is -1");
 }
 
+void morkRowSpace::NoteDirtyRow(morkEnv* ev, morkRow* ioRow) {
+  if (!mRowSpace_DirtyRowsLost) {
+    mork_fill fill = mRowSpace_DirtyRows.Length();
+    mork_num most = mRowSpace_Rows.MapFill() / morkRowSpace_kDirtyRowsDivisor;
+    if (fill < morkRowSpace_kStartDirtyRowsSize || fill < most) {
+      if (mRowSpace_DirtyRows.AppendSlot(ev, ioRow) < 0)
+        mRowSpace_DirtyRowsLost = morkBool_kTrue;
+    } else  // walking every row costs about the same now
+    {
+      mRowSpace_DirtyRows.CutAllSlots(ev);
+      mRowSpace_DirtyRowsLost = morkBool_kTrue;
+    }
+  }
+}
+
+void morkRowSpace::ForgetDirtyRow(morkEnv* ev, morkRow* ioRow) {
+  mork_fill fill = mRowSpace_DirtyRows.Length();
+  if (fill && mRowSpace_DirtyRows.At(fill - 1) == ioRow)  // noted last?
+    mRowSpace_DirtyRows.CutSlot(ev, fill - 1);
+}
+
+void morkRowSpace::CutAllDirtyRows(morkEnv* ev) {
+  if (mRowSpace_DirtyRows.Length()) mRowSpace_DirtyRows.CutAllSlots(ev);
+  mRowSpace_DirtyRowsLost = morkBool_kFalse;
+}
+
 ///*static*/ void
 // morkRowSpace::ExpectAutoIdOnlyError(morkEnv* ev)
 //{
@@ -485,8 +517,10 @@ morkRow* morkRowSpace::NewRowWithOid(morkEnv* ev, const mdbOid* inOid) {
           outRow = row;
           mork_rid rid = inOid->mOid_Id;
           if (mRowSpace_NextRowId <= rid) mRowSpace_NextRowId = rid + 1;
-        } else
+        } else {
+          this->ForgetDirtyRow(ev, row);
           pool->ZapRow(ev, row, &store->mStore_Zone);
+        }
 
         if (this->IsRowSpaceClean() && store->mStore_CanDirty)
           this->MaybeDirtyStoreAndSpace();  // InitRow() does already
@@ -514,8 +548,10 @@ morkRow* morkRowSpace::NewRow(morkEnv* ev) {
 
           if (ev->Good() && mRowSpace_Rows.AddRow(ev, row))
             outRow = row;
-          else
+          else {
+            this->ForgetDirtyRow(ev, row);
             pool->ZapRow(ev, row, &store->mStore_Zone);
+          }
 
           if (this->IsRowSpaceClean() && store->mStore_CanDirty)
             this->MaybeDirtyStoreAndSpace();  // InitRow() does already
@@ -47,6 +47,9 @@
 #define morkRowSpace_kMaxIndexCount 8   /* no more indexes than this */
 #define morkRowSpace_kPrimeCacheSize 17 /* should be prime number */
 
+#define morkRowSpace_kStartDirtyRowsSize 16 /* initial dirty rows capacity */
+#define morkRowSpace_kDirtyRowsDivisor 4    /* most rows noted: fill/this */
+
 class morkAtomRowMap;
 
 /*| morkRowSpace:
@@ -93,6 +96,14 @@ class morkRowSpace : public morkSpace {  //
 
   morkDeque mRowSpace_TablesByPriority[morkPriority_kCount];
 
+  // rows that became dirty since the last commit, so an incremental commit
+  // need not visit every row in mRowSpace_Rows to find them.  Once more
+  // than a quarter of all rows are dirty, the list is dropped and the next
+  // commit walks the whole map instead (mRowSpace_DirtyRowsLost):
+  morkArray mRowSpace_DirtyRows;  // array of morkRow pointers
+  mork_bool mRowSpace_DirtyRowsLost;  // not every dirty row is listed?
+  mork_u1 mRowSpace_Pad[3];           // for u4 alignment
+
  public:  // more specific dirty methods for row space:
   void SetRowSpaceDirty() { this->SetNodeDirty(); }
   void SetRowSpaceClean() { this->SetNodeClean(); }
@@ -100,6 +111,16 @@ class morkRowSpace : public morkSpace {  //
   mork_bool IsRowSpaceClean() const { return this->IsNodeClean(); }
   mork_bool IsRowSpaceDirty() const { return this->IsNodeDirty(); }
 
+ public:  // tracking rows that became dirty since the last commit:
+  void NoteDirtyRow(morkEnv* ev, morkRow* ioRow);
+  // NoteDirtyRow() is called by morkRow when a clean row becomes dirty.
+  void ForgetDirtyRow(morkEnv* ev, morkRow* ioRow);
+  // ForgetDirtyRow() removes a row about to be destroyed from the list.
+  void CutAllDirtyRows(morkEnv* ev);
+  // CutAllDirtyRows() is called after all dirty rows have been written.
+
+  mork_bool CanListDirtyRows() const { return !mRowSpace_DirtyRowsLost; }
+
   // { ===== begin morkNode interface =====
  public:  // morkNode virtual methods
   virtual void CloseMorkNode(
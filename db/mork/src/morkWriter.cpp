@@ -968,38 +968,43 @@ void morkWriter::WriteAllStoreTables(morkEnv* ev) {
           if (ev->Good()) {
             mWriter_TableRowScope = 0;  // ensure no table context now
 
+            if (mWriter_Incremental && space->CanListDirtyRows()) {
+              // only rows dirtied since the last commit need visiting:
+              morkArray* dirtyRows = &space->mRowSpace_DirtyRows;
+              mork_fill fill = dirtyRows->Length();
+              for (mork_pos pos = 0; pos < (mork_pos)fill && ev->Good();
+                   ++pos) {
+                morkRow* row = (morkRow*)dirtyRows->At(pos);
+                if (row && row->IsRow())
+                  this->PutDirtyRow(ev, row);
+                else
+                  row->NonRowTypeWarning(ev);
+              }
+            } else {
 #ifdef MORK_ENABLE_PROBE_MAPS
-            morkRowProbeMapIter* ri = &mWriter_RowSpaceRowsIter;
+              morkRowProbeMapIter* ri = &mWriter_RowSpaceRowsIter;
 #else  /*MORK_ENABLE_PROBE_MAPS*/
-            morkRowMapIter* ri = &mWriter_RowSpaceRowsIter;
+              morkRowMapIter* ri = &mWriter_RowSpaceRowsIter;
 #endif /*MORK_ENABLE_PROBE_MAPS*/
-            ri->InitRowMapIter(ev, &space->mRowSpace_Rows);
+              ri->InitRowMapIter(ev, &space->mRowSpace_Rows);
 
-            morkRow* row = 0;  // old row in the map
+              morkRow* row = 0;  // old row in the map
 
-            for (c = ri->FirstRow(ev, &row); c && ev->Good();
-                 c = ri->NextRow(ev, &row)) {
-              if (row && row->IsRow()) {
-                // later we should also check that table use count is nonzero:
-                if (row->IsRowDirty())  // && row->IsRowUsed() ??
-                {
-                  mWriter_BeVerbose = ev->mEnv_BeVerbose;
-                  if (this->PutRowDict(ev, row)) {
-                    if (ev->Good() && mWriter_DidStartDict) {
-                      this->EndDict(ev);
-                      if (mWriter_LineSize < 32 && ev->Good())
-                        mWriter_SuppressDirtyRowNewline = morkBool_kTrue;
-                    }
-
-                    if (ev->Good()) this->PutRow(ev, row);
-                  }
-                  mWriter_BeVerbose = ev->mEnv_BeVerbose;
-                }
-              } else
-                row->NonRowTypeWarning(ev);
+              for (c = ri->FirstRow(ev, &row); c && ev->Good();
+                   c = ri->NextRow(ev, &row)) {
+                if (row && row->IsRow())
+                  this->PutDirtyRow(ev, row);
+                else
+                  row->NonRowTypeWarning(ev);
+              }
+              ri->CloseMapIter(ev);
             }
-            ri->CloseMapIter(ev);
           }
+          // rows left dirty by an error must be found by the next commit:
+          if (ev->Good())
+            space->CutAllDirtyRows(ev);
+          else
+            space->mRowSpace_DirtyRowsLost = morkBool_kTrue;
         } else
           space->NonRowSpaceTypeError(ev);
       } else
@@ -1008,6 +1013,24 @@ void morkWriter::WriteAllStoreTables(morkEnv* ev) {
   }
 }
 
+void morkWriter::PutDirtyRow(morkEnv* ev, morkRow* ioRow) {
+  // later we should also check that table use count is nonzero:
+  if (ioRow->IsRowDirty())  // && ioRow->IsRowUsed() ??
+  {
+    mWriter_BeVerbose = ev->mEnv_BeVerbose;
+    if (this->PutRowDict(ev, ioRow)) {
+      if (ev->Good() && mWriter_DidStartDict) {
+        this->EndDict(ev);
+        if (mWriter_LineSize < 32 && ev->Good())
+          mWriter_SuppressDirtyRowNewline = morkBool_kTrue;
+      }
+
+      if (ev->Good()) this->PutRow(ev, ioRow);
+    }
+    mWriter_BeVerbose = ev->mEnv_BeVerbose;
+  }
+}
+
 mork_bool morkWriter::OnStoreRowSpacesTables(morkEnv* ev) {
   morkStream* stream = mWriter_Stream;
   if (mWriter_LineSize) stream->PutLineBreak(ev);
@@ -1713,14 +1736,21 @@ mork_bool morkWriter::PutVerboseCell(morkEnv* ev, morkCell* ioCell,
   return ev->Good();
 }
 
-mork_bool morkWriter::PutVerboseRowCells(morkEnv* ev, morkRow* ioRow) {
+mork_bool morkWriter::PutVerboseRowCells(morkEnv* ev, morkRow* ioRow,
+                                         mork_bool inOnlyDirty) {
   morkCell* cells = ioRow->mRow_Cells;
   if (cells) {
     morkCell* end = cells + ioRow->mRow_Length;
     --cells;  // prepare for preincrement:
     while (++cells < end && ev->Good()) {
+      if (inOnlyDirty)  // cells merge into the row already in the file?
+      {
+        // an empty dirty cell must still replace the old value:
+        if (cells->IsCellDirty())
+          this->PutVerboseCell(ev, cells, /*inWithVal*/ morkBool_kTrue);
+      }
       // note we prefer to avoid writing cells here with no value:
-      if (cells->GetAtom())  // does cell have any value?
+      else if (cells->GetAtom())  // does cell have any value?
         this->PutVerboseCell(ev, cells, /*inWithVal*/ morkBool_kTrue);
     }
   }
@@ -1806,14 +1836,21 @@ mork_bool morkWriter::PutCell(morkEnv* ev, morkCell* ioCell,
   return ev->Good();
 }
 
-mork_bool morkWriter::PutRowCells(morkEnv* ev, morkRow* ioRow) {
+mork_bool morkWriter::PutRowCells(morkEnv* ev, morkRow* ioRow,
+                                  mork_bool inOnlyDirty) {
   morkCell* cells = ioRow->mRow_Cells;
   if (cells) {
     morkCell* end = cells + ioRow->mRow_Length;
     --cells;  // prepare for preincrement:
     while (++cells < end && ev->Good()) {
+      if (inOnlyDirty)  // cells merge into the row already in the file?
+      {
+        // an empty dirty cell must still replace the old value:
+        if (cells->IsCellDirty())
+          this->PutCell(ev, cells, /*inWithVal*/ morkBool_kTrue);
+      }
       // note we prefer to avoid writing cells here with no value:
-      if (cells->GetAtom())  // does cell have any value?
+      else if (cells->GetAtom())  // does cell have any value?
         this->PutCell(ev, cells, /*inWithVal*/ morkBool_kTrue);
     }
   }
@@ -1901,10 +1938,13 @@ mork_bool morkWriter::PutRow(morkEnv* ev, morkRow* ioRow) {
           this->PutCell(ev, cell, withVal);
       } else  // put entire row?
       {
+        // a partial row only needs the cells changed since the last commit:
+        mork_bool onlyDirty =
+            (!rowRewrite && mWriter_Incremental && ioRow->IsRowPartial());
         if (mWriter_BeVerbose)
-          this->PutVerboseRowCells(ev, ioRow);  // write all, verbosely
+          this->PutVerboseRowCells(ev, ioRow, onlyDirty);  // verbosely
         else
-          this->PutRowCells(ev, ioRow);  // write all, hex notation
+          this->PutRowCells(ev, ioRow, onlyDirty);  // hex notation
       }
 
       stream->Putc(ev, ']');  // end row
@@ -288,8 +288,10 @@ class morkWriter : public morkNode {  // row iterator
  public:  // writing node content second pass
   mork_bool PutTable(morkEnv* ev, morkTable* ioTable);
   mork_bool PutRow(morkEnv* ev, morkRow* ioRow);
-  mork_bool PutRowCells(morkEnv* ev, morkRow* ioRow);
-  mork_bool PutVerboseRowCells(morkEnv* ev, morkRow* ioRow);
+  mork_bool PutRowCells(morkEnv* ev, morkRow* ioRow, mork_bool inOnlyDirty);
+  mork_bool PutVerboseRowCells(morkEnv* ev, morkRow* ioRow,
+                               mork_bool inOnlyDirty);
+  // inOnlyDirty writes just the dirty cells of a row that is not rewritten
 
   mork_bool PutCell(morkEnv* ev, morkCell* ioCell, mork_bool inWithVal);
   mork_bool PutVerboseCell(morkEnv* ev, morkCell* ioCell, mork_bool inWithVal);
@@ -310,6 +312,7 @@ class morkWriter : public morkNode {  // row iterator
   // than the entire atom's size, since only part goes on a last line).
 
   void WriteAllStoreTables(morkEnv* ev);
+  void PutDirtyRow(morkEnv* ev, morkRow* ioRow);  // dict then row, if dirty
   void WriteAtomSpaceAsDict(morkEnv* ev, morkAtomSpace* ioSpace);
 
   void WriteTokenToTokenMetaCell(morkEnv* ev, mork_token inCol,
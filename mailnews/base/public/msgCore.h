@@ -28,6 +28,11 @@ class nsIMsgFolder;
 #define SUMMARY_SUFFIX8 ".msf"
 #define SUMMARY_SUFFIX_LENGTH 4
 
+/*
+ * The suffix added to the summary file name for its message id index.
+ */
+#define SUMMARY_INDEX_SUFFIX u".idx"
+
 /*
  * The suffix we use for folder subdirectories.
  */
@@ -56,6 +56,9 @@ class nsMsgSearchBoolExpression {
 
   // accessors
 
+  // the search term of a leaf node, or null for a non-leaf node
+  nsIMsgSearchTerm *GetTerm() const { return m_term; }
+
   // Offline
   static nsMsgSearchBoolExpression *AddSearchTerm(
       nsMsgSearchBoolExpression *aOrigExpr, nsIMsgSearchTerm *aNewTerm,
@@ -14,6 +14,7 @@
 #include "nsIMsgSearchSession.h"
 #include "nsCOMPtr.h"
 #include "nsIWeakReferenceUtils.h"
+#include "nsIThreadPool.h"
 
 class nsMsgSearchScopeTerm : public nsIMsgSearchScopeTerm {
  public:
@@ -36,6 +37,8 @@ class nsMsgSearchScopeTerm : public nsIMsgSearchScopeTerm {
   nsCOMPtr<nsIInputStream> m_inputStream;  // for message bodies
   nsWeakPtr m_searchSession;
   bool m_searchServer;
+  // set by the session when offline scopes may evaluate headers on a pool
+  nsCOMPtr<nsIThreadPool> m_searchPool;
 
  private:
   virtual ~nsMsgSearchScopeTerm();
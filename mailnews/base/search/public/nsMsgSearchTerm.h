@@ -32,7 +32,24 @@ class nsMsgSearchTerm : public nsIMsgSearchTerm {
   nsresult DeStream(char *, int16_t length);
   nsresult DeStreamNew(char *, int16_t length);
 
-  nsresult GetLocalTimes(PRTime, PRTime, PRExplodedTime &, PRExplodedTime &);
+  static nsresult GetLocalTimes(PRTime, PRTime, PRExplodedTime &,
+                                PRExplodedTime &);
+
+  // The comparisons behind MatchDate, MatchAge, MatchSize, MatchStatus and
+  // MatchPriority, for values copied out of a term. They touch no XPCOM
+  // objects, so they may run on any thread.
+  static nsresult CompareDate(nsMsgSearchOpValue aOp, PRTime aValue,
+                              PRTime dateToMatch, bool *pResult);
+  static nsresult CompareAge(nsMsgSearchOpValue aOp, int32_t aValue,
+                             PRTime msgDate, bool *pResult);
+  static nsresult CompareSize(nsMsgSearchOpValue aOp, uint32_t aValue,
+                              uint32_t sizeToMatch, bool *pResult);
+  static nsresult CompareStatus(nsMsgSearchOpValue aOp, uint32_t aValue,
+                                uint32_t statusToMatch, bool *pResult);
+  static nsresult ComparePriority(nsMsgSearchOpValue aOp,
+                                  nsMsgPriorityValue aValue,
+                                  nsMsgPriorityValue priorityToMatch,
+                                  bool *pResult);
 
   bool IsBooleanOpAND() {
     return m_booleanOp == nsMsgSearchBooleanOp::BooleanAND ? true : false;
@@ -11,7 +11,9 @@
 #include "nsMsgLocalSearch.h"
 #include "nsIStreamListener.h"
 #include "nsMsgSearchBoolExpression.h"
+#include "nsMsgSearchProgram.h"
 #include "nsMsgSearchTerm.h"
+#include "nsMsgSearchScopeTerm.h"
 #include "nsMsgResultElement.h"
 #include "nsIDBFolderInfo.h"
 #include "nsIArray.h"
@@ -25,6 +27,7 @@
 #include "nsMsgMessageFlags.h"
 #include "nsMsgUtils.h"
 #include "nsIMsgFolder.h"
+#include "nsThreadUtils.h"
 
 extern "C" {
 extern int MK_MSG_SEARCH_STATUS;
@@ -241,7 +244,7 @@ NS_IMPL_ISUPPORTS_INHERITED(nsMsgSearchOfflineMail, nsMsgSearchAdapter,
 
 nsMsgSearchOfflineMail::nsMsgSearchOfflineMail(nsIMsgSearchScopeTerm *scope,
                                                nsIArray *termList)
-    : nsMsgSearchAdapter(scope, termList) {}
+    : nsMsgSearchAdapter(scope, termList), m_searchedAllHeaders(false) {}
 
 nsMsgSearchOfflineMail::~nsMsgSearchOfflineMail() {
   // Database should have been closed when the scope term finished.
@@ -642,7 +645,6 @@ nsresult nsMsgSearchOfflineMail::Search(bool *aDone) {
   NS_ENSURE_ARG(aDone);
   nsresult dbErr = NS_OK;
   nsCOMPtr<nsIMsgDBHdr> msgDBHdr;
-  nsMsgSearchBoolExpression *expressionTree = nullptr;
 
   const uint32_t kTimeSliceInMS = 200;
 
@@ -654,9 +656,33 @@ nsresult nsMsgSearchOfflineMail::Search(bool *aDone) {
 
   // Reparsing is unnecessary or completed
   if (NS_SUCCEEDED(err)) {
-    if (!m_listContext)
+    if (!m_listContext && !m_searchedAllHeaders)
       dbErr = m_db->ReverseEnumerateMessages(getter_AddRefs(m_listContext));
-    if (NS_SUCCEEDED(dbErr) && m_listContext) {
+    // Compile the terms once for the whole scope rather than once per time
+    // slice, and look up the folder charset only once.
+    if (NS_SUCCEEDED(dbErr) && !m_program) {
+      nsMsgSearchBoolExpression *expressionTree = nullptr;
+      uint32_t initialPos = 0;
+      uint32_t count;
+      m_searchTerms->GetLength(&count);
+      dbErr = ConstructExpressionTree(m_searchTerms, count, initialPos,
+                                      &expressionTree);
+      if (NS_SUCCEEDED(dbErr)) {
+        nsAutoString nullCharset, folderCharset;
+        GetSearchCharsets(nullCharset, folderCharset);
+        m_program = new nsMsgSearchProgram(
+            expressionTree, NS_ConvertUTF16toUTF8(folderCharset));
+        if (m_program->CanEvaluateSnapshots())
+          m_searchPool =
+              static_cast<nsMsgSearchScopeTerm *>(m_scope)->m_searchPool;
+      }
+      delete expressionTree;
+    }
+    // Without a message list or a program there is nothing to search.
+    if (NS_FAILED(dbErr)) {
+      err = dbErr;
+      *aDone = true;
+    } else if (m_listContext) {
       PRIntervalTime startTime = PR_IntervalNow();
       while (!*aDone)  // we'll break out of the loop after kTimeSliceInMS
                        // milliseconds
@@ -671,17 +697,18 @@ nsresult nsMsgSearchOfflineMail::Search(bool *aDone) {
           *aDone = true;  //###phil dbErr is dropped on the floor. just note
                           // that we did have an error so we'll clean up later
         else {
+          // Is this message a hit? Add search hits to the results list
           bool match = false;
-          nsAutoString nullCharset, folderCharset;
-          GetSearchCharsets(nullCharset, folderCharset);
-          NS_ConvertUTF16toUTF8 charset(folderCharset);
-          // Is this message a hit?
-          err = MatchTermsForSearch(msgDBHdr, m_searchTerms, charset.get(),
-                                    m_scope, m_db, &expressionTree, &match);
-          // Add search hits to the results list
-          if (NS_SUCCEEDED(err) && match) {
-            AddResultElement(msgDBHdr);
+          if (m_searchPool) {
+            QueueSnapshot(msgDBHdr);
+          } else {
+            err = m_program->Evaluate(msgDBHdr, m_scope, m_db, &match);
+            if (NS_FAILED(err)) {
+              *aDone = true;
+              break;
+            }
           }
+          if (match) AddResultElement(msgDBHdr);
           PRIntervalTime elapsedTime = PR_IntervalNow() - startTime;
           // check if more than kTimeSliceInMS milliseconds have elapsed in this
           // time slice started
@@ -689,12 +716,22 @@ nsresult nsMsgSearchOfflineMail::Search(bool *aDone) {
         }
       }
     }
+    // Hits from the pool are reported a batch at a time, in the order the
+    // headers were read; the scope is done once the last batch is reported.
+    if (m_searchPool && NS_SUCCEEDED(err)) {
+      if (*aDone) {
+        m_searchedAllHeaders = true;
+        m_listContext = nullptr;
+        DispatchBatch();
+      }
+      bool allReported = false;
+      err = ReportEvaluatedBatches(&allReported);
+      *aDone = NS_FAILED(err) || (allReported && m_searchedAllHeaders);
+    }
   } else
     *aDone = true;  // we couldn't open up the DB. This is an unrecoverable
                     // error so mark the scope as done.
 
-  delete expressionTree;
-
   // in the past an error here would cause an "infinite" search because the url
   // would continue to run... i.e. if we couldn't open the database, it returns
   // an error code but the caller of this function says, oh, we did not finish
@@ -703,6 +740,66 @@ nsresult nsMsgSearchOfflineMail::Search(bool *aDone) {
   return err;
 }
 
+// Headers are handed to the pool this many at a time.
+static const uint32_t kSnapshotsPerBatch = 128;
+
+void nsMsgSearchOfflineMail::QueueSnapshot(nsIMsgDBHdr *aMsgHdr) {
+  if (!m_batch) {
+    m_batch = new nsMsgSearchProgram::Batch();
+    m_batch->mSnapshots.SetCapacity(kSnapshotsPerBatch);
+  }
+  m_program->TakeSnapshot(aMsgHdr, *m_batch->mSnapshots.AppendElement());
+  if (m_batch->mSnapshots.Length() >= kSnapshotsPerBatch) DispatchBatch();
+}
+
+void nsMsgSearchOfflineMail::DispatchBatch() {
+  if (!m_batch) return;
+  RefPtr<nsMsgSearchProgram> program = m_program;
+  RefPtr<nsMsgSearchProgram::Batch> batch = m_batch.forget();
+  m_pendingBatches.AppendElement(batch);
+  nsresult rv = m_searchPool->Dispatch(
+      NS_NewRunnableFunction("nsMsgSearchOfflineMail::DispatchBatch",
+                             [program, batch]() { batch->Evaluate(program); }),
+      NS_DISPATCH_NORMAL);
+  // The pool is shutting down; evaluate the batch here instead.
+  if (NS_FAILED(rv)) batch->Evaluate(program);
+}
+
+// Reports the hits of the batches at the front of the queue that have been
+// evaluated. Sets *aAllReported if no batches are left.
+nsresult nsMsgSearchOfflineMail::ReportEvaluatedBatches(bool *aAllReported) {
+  *aAllReported = false;
+  while (m_db && !m_pendingBatches.IsEmpty() &&
+         m_pendingBatches[0]->mEvaluated) {
+    RefPtr<nsMsgSearchProgram::Batch> batch = m_pendingBatches[0];
+    m_pendingBatches.RemoveElementAt(0);
+    for (uint32_t i = 0; i < batch->mResults.Length() && m_db; i++) {
+      nsMsgSearchProgram::SnapshotResult result = batch->mResults[i];
+      if (result == nsMsgSearchProgram::kSnapshotNoMatch) continue;
+      nsCOMPtr<nsIMsgDBHdr> msgDBHdr;
+      m_db->GetMsgHdrForKey(batch->mSnapshots[i].mKey,
+                            getter_AddRefs(msgDBHdr));
+      if (!msgDBHdr) continue;
+      // Undecided headers had a value that has to be decoded first.
+      bool match = result == nsMsgSearchProgram::kSnapshotMatch;
+      if (!match) {
+        nsresult rv = m_program->Evaluate(msgDBHdr, m_scope, m_db, &match);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+      if (match) AddResultElement(msgDBHdr);
+    }
+  }
+  *aAllReported = m_pendingBatches.IsEmpty();
+  return NS_OK;
+}
+
+void nsMsgSearchOfflineMail::CancelBatches() {
+  // Batches already on the pool stop at the next snapshot.
+  if (m_program) m_program->Cancel();
+  m_batch = nullptr;
+  m_pendingBatches.Clear();
+}
+
 void nsMsgSearchOfflineMail::CleanUpScope() {
   // Let go of the DB when we're done with it so we don't kill the db cache
   if (m_db) {
@@ -710,6 +807,10 @@ void nsMsgSearchOfflineMail::CleanUpScope() {
     m_db->Close(false);
   }
   m_db = nullptr;
+  CancelBatches();
+  m_program = nullptr;
+  m_searchPool = nullptr;
+  m_searchedAllHeaders = false;
 
   if (m_scope) m_scope->CloseInputStream();
 }
@@ -729,6 +830,7 @@ NS_IMETHODIMP nsMsgSearchOfflineMail::AddResultElement(nsIMsgDBHdr *pHeaders) {
 
 NS_IMETHODIMP
 nsMsgSearchOfflineMail::Abort() {
+  CancelBatches();
   // Let go of the DB when we're done with it so we don't kill the db cache
   if (m_db) m_db->Close(true /* commit in case we downloaded new headers */);
   m_db = nullptr;
@@ -14,6 +14,9 @@
 // inherit base implementation
 #include "nsMsgSearchAdapter.h"
 #include "nsISimpleEnumerator.h"
+#include "nsIThreadPool.h"
+#include "nsMsgSearchProgram.h"
+#include "nsTArray.h"
 
 class nsIMsgDBHdr;
 class nsIMsgSearchScopeTerm;
@@ -70,6 +73,19 @@ class nsMsgSearchOfflineMail : public nsMsgSearchAdapter,
 
   nsCOMPtr<nsIMsgDatabase> m_db;
   nsCOMPtr<nsISimpleEnumerator> m_listContext;
+  // the search terms compiled for this scope; built on the first time slice.
+  // Batches on the pool hold a reference too, so it may outlive the scope.
+  RefPtr<nsMsgSearchProgram> m_program;
+  // If the session gave us a pool and the program can use snapshots, headers
+  // are snapshotted here and evaluated on the pool in batches.
+  nsCOMPtr<nsIThreadPool> m_searchPool;
+  RefPtr<nsMsgSearchProgram::Batch> m_batch;  // being filled
+  nsTArray<RefPtr<nsMsgSearchProgram::Batch>> m_pendingBatches;
+  bool m_searchedAllHeaders;
+  void QueueSnapshot(nsIMsgDBHdr *aMsgHdr);
+  void DispatchBatch();
+  nsresult ReportEvaluatedBatches(bool *aAllReported);
+  void CancelBatches();
   void CleanUpScope();
 };
 
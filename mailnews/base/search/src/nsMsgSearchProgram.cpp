@@ -0,0 +1,596 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "msgCore.h"
+#include "nsMsgSearchProgram.h"
+#include "nsMsgSearchBoolExpression.h"
+#include "nsMsgLocalSearch.h"
+#include "nsIMsgSearchTerm.h"
+#include "nsMsgSearchTerm.h"
+#include "nsIMsgSearchValue.h"
+#include "nsIMsgHdr.h"
+#include "nsMsgMessageFlags.h"
+#include "nsUnicharUtils.h"
+#include "nsCRTGlue.h"
+#include "nsThreadUtils.h"
+#include "mozilla/MathAlgorithms.h"
+#include <algorithm>
+
+// Relative cost of evaluating a term, used to order the operands of an AND or
+// OR run. Terms of the same cost keep their order.
+enum {
+  kCheapTerm = 0,     // numbers and flags kept on the header
+  kStringTerm = 1,    // strings kept on the header
+  kExpensiveTerm = 2  // reads the message store, or unknown
+};
+
+static inline uint8_t LowerCaseAscii(uint8_t c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Compares aLength bytes of aText against an already lower case needle.
+static bool EqualsLowerCase(const char *aText, const char *aLowerCase,
+                            uint32_t aLength) {
+  for (uint32_t i = 0; i < aLength; i++) {
+    if (LowerCaseAscii(aText[i]) != uint8_t(aLowerCase[i])) return false;
+  }
+  return true;
+}
+
+// A header value matches its decoded form when it is printable ASCII without
+// RFC 2047 encoded words, so the raw bytes can be compared directly.
+static bool IsPlainHeader(const nsACString &aValue) {
+  const char *cur = aValue.BeginReading();
+  const char *end = aValue.EndReading();
+  for (; cur < end; cur++) {
+    if (*cur < 0x20 || *cur > 0x7E) return false;
+    if (*cur == '=' && cur + 1 < end && cur[1] == '?') return false;
+  }
+  return true;
+}
+
+static uint32_t TermCost(nsIMsgSearchTerm *aTerm) {
+  bool matchAll = false;
+  aTerm->GetMatchAll(&matchAll);
+  if (matchAll) return kCheapTerm;
+
+  nsMsgSearchAttribValue attrib;
+  aTerm->GetAttrib(&attrib);
+  switch (attrib) {
+    case nsMsgSearchAttrib::Date:
+    case nsMsgSearchAttrib::AgeInDays:
+    case nsMsgSearchAttrib::Size:
+    case nsMsgSearchAttrib::Priority:
+    case nsMsgSearchAttrib::MsgStatus:
+    case nsMsgSearchAttrib::HasAttachmentStatus:
+    case nsMsgSearchAttrib::Label:
+    case nsMsgSearchAttrib::Uint32HdrProperty:
+    case nsMsgSearchAttrib::FolderFlag:
+      return kCheapTerm;
+    case nsMsgSearchAttrib::Sender:
+    case nsMsgSearchAttrib::Subject:
+    case nsMsgSearchAttrib::To:
+    case nsMsgSearchAttrib::CC:
+    case nsMsgSearchAttrib::ToOrCC:
+    case nsMsgSearchAttrib::AllAddresses:
+    case nsMsgSearchAttrib::Keywords:
+    case nsMsgSearchAttrib::JunkStatus:
+    case nsMsgSearchAttrib::JunkPercent:
+    case nsMsgSearchAttrib::JunkScoreOrigin:
+    case nsMsgSearchAttrib::HdrProperty:
+      return kStringTerm;
+    default:
+      // Body, arbitrary headers and custom terms.
+      return kExpensiveTerm;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Per header cache of the values the fast steps look at.
+//-----------------------------------------------------------------------------
+
+class nsMsgSearchProgram::HeaderFields {
+ public:
+  HeaderFields(nsIMsgDBHdr *aHdr, const nsACString &aDefaultCharset)
+      : mHdr(aHdr), mDefaultCharset(aDefaultCharset), mLoaded(0) {}
+
+  uint32_t Flags() {
+    if (!(mLoaded & kFlagsField)) {
+      mHdr->GetFlags(&mFlags);
+      mLoaded |= kFlagsField;
+    }
+    return mFlags;
+  }
+
+  PRTime Date() {
+    if (!(mLoaded & kDateField)) {
+      mHdr->GetDate(&mDate);
+      mLoaded |= kDateField;
+    }
+    return mDate;
+  }
+
+  uint32_t Size() {
+    if (!(mLoaded & kSizeField)) {
+      mHdr->GetMessageSize(&mSize);
+      mLoaded |= kSizeField;
+    }
+    return mSize;
+  }
+
+  nsMsgPriorityValue Priority() {
+    if (!(mLoaded & kPriorityField)) {
+      mHdr->GetPriority(&mPriority);
+      mLoaded |= kPriorityField;
+    }
+    return mPriority;
+  }
+
+  // The raw value of a header field, as the database keeps it.
+  const nsCString &Get(HeaderField aField) {
+    nsCString &value = mValues[mozilla::CountTrailingZeroes32(aField)];
+    if (!(mLoaded & aField)) {
+      switch (aField) {
+        case kSubjectField:
+          mHdr->GetSubject(getter_Copies(value));
+          break;
+        case kAuthorField:
+          mHdr->GetAuthor(getter_Copies(value));
+          break;
+        case kRecipientsField:
+          mHdr->GetRecipients(getter_Copies(value));
+          break;
+        case kCcListField:
+          mHdr->GetCcList(getter_Copies(value));
+          break;
+        case kBccListField:
+          mHdr->GetBccList(getter_Copies(value));
+          break;
+        default:
+          MOZ_ASSERT_UNREACHABLE("not a string field");
+      }
+      mLoaded |= aField;
+    }
+    return value;
+  }
+
+  // UTF-7 is the one charset we may see where plain ASCII isn't literal.
+  bool HasUTF7Charset() {
+    if (!(mLoaded & kCharsetField)) {
+      nsCString charset;
+      mHdr->GetCharset(getter_Copies(charset));
+      if (charset.IsEmpty()) charset = mDefaultCharset;
+      mUTF7 = charset.LowerCaseEqualsLiteral("utf-7");
+      mLoaded |= kCharsetField;
+    }
+    return mUTF7;
+  }
+
+ private:
+  nsIMsgDBHdr *mHdr;
+  const nsACString &mDefaultCharset;
+  uint32_t mLoaded;  // HeaderField bits
+  uint32_t mFlags;
+  PRTime mDate;
+  uint32_t mSize;
+  nsMsgPriorityValue mPriority;
+  bool mUTF7;
+  nsCString mValues[kNumStringFields];
+};
+
+const nsCString &nsMsgSearchProgram::Snapshot::Get(HeaderField aField) const {
+  return mValues[mozilla::CountTrailingZeroes32(aField)];
+}
+
+//-----------------------------------------------------------------------------
+// Needle matching
+//-----------------------------------------------------------------------------
+
+void nsMsgSearchProgram::Step::SetNeedle(const nsACString &aLowerCaseNeedle) {
+  mNeedle = aLowerCaseNeedle;
+  uint32_t length = mNeedle.Length();
+  // Skips are capped to fit a byte; a shorter skip is always safe.
+  memset(mSkip, std::min<uint32_t>(length, 255), sizeof(mSkip));
+  for (uint32_t i = 0; i + 1 < length; i++)
+    mSkip[uint8_t(mNeedle[i])] = std::min<uint32_t>(length - 1 - i, 255);
+}
+
+// Boyer-Moore-Horspool, folding the haystack to lower case as it goes.
+bool nsMsgSearchProgram::Step::FoundIn(const nsACString &aHaystack) const {
+  uint32_t needleLength = mNeedle.Length();
+  uint32_t haystackLength = aHaystack.Length();
+  if (needleLength > haystackLength) return false;
+
+  const char *haystack = aHaystack.BeginReading();
+  const char *needle = mNeedle.get();
+  uint8_t last = uint8_t(needle[needleLength - 1]);
+  for (uint32_t pos = 0; pos <= haystackLength - needleLength;) {
+    uint8_t c = LowerCaseAscii(haystack[pos + needleLength - 1]);
+    if (c == last && EqualsLowerCase(haystack + pos, needle, needleLength - 1))
+      return true;
+    pos += mSkip[c];
+  }
+  return false;
+}
+
+bool nsMsgSearchProgram::Step::Matches(const nsACString &aHaystack) const {
+  uint32_t needleLength = mNeedle.Length();
+  uint32_t haystackLength = aHaystack.Length();
+  const char *haystack = aHaystack.BeginReading();
+  switch (mOp) {
+    case nsMsgSearchOp::Contains:
+      return FoundIn(aHaystack);
+    case nsMsgSearchOp::DoesntContain:
+      return !FoundIn(aHaystack);
+    case nsMsgSearchOp::Is:
+    case nsMsgSearchOp::Isnt:
+      return (needleLength == haystackLength &&
+              EqualsLowerCase(haystack, mNeedle.get(), needleLength)) ==
+             (mOp == nsMsgSearchOp::Is);
+    case nsMsgSearchOp::BeginsWith:
+      return needleLength <= haystackLength &&
+             EqualsLowerCase(haystack, mNeedle.get(), needleLength);
+    case nsMsgSearchOp::EndsWith:
+      return needleLength <= haystackLength &&
+             EqualsLowerCase(haystack + haystackLength - needleLength,
+                             mNeedle.get(), needleLength);
+    case nsMsgSearchOp::IsEmpty:
+      return aHaystack.IsEmpty();
+    case nsMsgSearchOp::IsntEmpty:
+      return !aHaystack.IsEmpty();
+  }
+  MOZ_ASSERT_UNREACHABLE("string step with a non string operator");
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Compilation
+//-----------------------------------------------------------------------------
+
+nsMsgSearchProgram::nsMsgSearchProgram(nsMsgSearchBoolExpression *aExpression,
+                                       const nsACString &aDefaultCharset)
+    : mFields(0),
+      mCanEvaluateSnapshots(true),
+      mCancelled(false),
+      mDefaultCharset(aDefaultCharset) {
+  mEntry = aExpression ? Compile(aExpression, kAccept, kReject) : kAccept;
+}
+
+nsMsgSearchProgram::~nsMsgSearchProgram() {}
+
+void nsMsgSearchProgram::CollectOperands(
+    nsMsgSearchBoolExpression *aExpression, nsMsgSearchBooleanOperator aBoolOp,
+    nsTArray<nsMsgSearchBoolExpression *> &aOperands) {
+  if (!aExpression) return;
+  if (!aExpression->GetTerm() && aExpression->m_boolOp == aBoolOp &&
+      (aExpression->m_leftChild || aExpression->m_rightChild)) {
+    CollectOperands(aExpression->m_leftChild, aBoolOp, aOperands);
+    CollectOperands(aExpression->m_rightChild, aBoolOp, aOperands);
+    return;
+  }
+  aOperands.AppendElement(aExpression);
+}
+
+uint32_t nsMsgSearchProgram::Cost(nsMsgSearchBoolExpression *aExpression) {
+  if (!aExpression) return kCheapTerm;
+  if (aExpression->GetTerm()) return TermCost(aExpression->GetTerm());
+  return std::max(Cost(aExpression->m_leftChild),
+                  Cost(aExpression->m_rightChild));
+}
+
+// Emits the steps for aExpression, last operand first, so that every step
+// already knows where to go next. Returns the index of the entry step, or
+// one of the targets if the expression is decided without evaluating a term.
+uint32_t nsMsgSearchProgram::Compile(nsMsgSearchBoolExpression *aExpression,
+                                     uint32_t aOnTrue, uint32_t aOnFalse) {
+  if (aExpression->GetTerm())
+    return EmitTerm(aExpression->GetTerm(), aOnTrue, aOnFalse);
+
+  // An empty expression is vacuously true, as in OfflineEvaluate.
+  if (!aExpression->m_leftChild && !aExpression->m_rightChild) return aOnTrue;
+
+  bool isAnd = aExpression->m_boolOp == nsMsgSearchBooleanOp::BooleanAND;
+  AutoTArray<nsMsgSearchBoolExpression *, 8> operands;
+  CollectOperands(aExpression, aExpression->m_boolOp, operands);
+
+  // Stable insertion sort by cost; runs are short.
+  AutoTArray<uint32_t, 8> costs;
+  for (uint32_t i = 0; i < operands.Length(); i++) {
+    nsMsgSearchBoolExpression *operand = operands[i];
+    uint32_t cost = Cost(operand);
+    uint32_t j = i;
+    for (; j > 0 && costs[j - 1] > cost; j--) operands[j] = operands[j - 1];
+    operands[j] = operand;
+    costs.InsertElementAt(j, cost);
+  }
+
+  uint32_t next = isAnd ? aOnTrue : aOnFalse;
+  for (uint32_t i = operands.Length(); i-- > 0;) {
+    next = isAnd ? Compile(operands[i], next, aOnFalse)
+                 : Compile(operands[i], aOnTrue, next);
+  }
+  return next;
+}
+
+uint32_t nsMsgSearchProgram::EmitTerm(nsIMsgSearchTerm *aTerm,
+                                      uint32_t aOnTrue, uint32_t aOnFalse) {
+  bool matchAll = false;
+  aTerm->GetMatchAll(&matchAll);
+  if (matchAll) return aOnTrue;
+
+  Step *step = mSteps.AppendElement();
+  step->mTerm = new nsMainThreadPtrHolder<nsIMsgSearchTerm>(
+      "nsMsgSearchProgram::Step::mTerm", aTerm);
+  aTerm->GetAttrib(&step->mAttrib);
+  aTerm->GetOp(&step->mOp);
+  step->mKind = kGenericStep;
+  step->mFields = 0;
+  step->mOnTrue = aOnTrue;
+  step->mOnFalse = aOnFalse;
+  step->mValue = 0;
+
+  switch (step->mAttrib) {
+    case nsMsgSearchAttrib::Date:
+    case nsMsgSearchAttrib::AgeInDays:
+    case nsMsgSearchAttrib::Size:
+    case nsMsgSearchAttrib::Priority:
+    case nsMsgSearchAttrib::MsgStatus:
+    case nsMsgSearchAttrib::HasAttachmentStatus: {
+      nsCOMPtr<nsIMsgSearchValue> value;
+      aTerm->GetValue(getter_AddRefs(value));
+      if (!value) break;
+      step->mKind = kNumericStep;
+      switch (step->mAttrib) {
+        case nsMsgSearchAttrib::Date: {
+          PRTime date;
+          value->GetDate(&date);
+          step->mValue = date;
+          step->mFields = kDateField;
+          break;
+        }
+        case nsMsgSearchAttrib::AgeInDays: {
+          int32_t age;
+          value->GetAge(&age);
+          step->mValue = age;
+          step->mFields = kDateField;
+          break;
+        }
+        case nsMsgSearchAttrib::Size: {
+          uint32_t size;
+          value->GetSize(&size);
+          step->mValue = size;
+          step->mFields = kSizeField;
+          break;
+        }
+        case nsMsgSearchAttrib::Priority: {
+          nsMsgPriorityValue priority;
+          value->GetPriority(&priority);
+          step->mValue = priority;
+          step->mFields = kPriorityField;
+          break;
+        }
+        default: {
+          uint32_t status;
+          value->GetStatus(&status);
+          step->mValue = status;
+          step->mFields = kFlagsField;
+          break;
+        }
+      }
+      break;
+    }
+    case nsMsgSearchAttrib::Subject:
+      step->mKind = kSubjectStep;
+      step->mFields = kSubjectField;
+      break;
+    case nsMsgSearchAttrib::Sender:
+      step->mFields = kAuthorField;
+      break;
+    case nsMsgSearchAttrib::To:
+      step->mFields = kRecipientsField;
+      break;
+    case nsMsgSearchAttrib::CC:
+      step->mFields = kCcListField;
+      break;
+    case nsMsgSearchAttrib::ToOrCC:
+      step->mFields = kRecipientsField | kCcListField;
+      break;
+    case nsMsgSearchAttrib::AllAddresses:
+      step->mFields = kRecipientsField | kCcListField | kAuthorField |
+                      kBccListField;
+      break;
+  }
+
+  // Address terms other than Contains parse the addresses out of the header,
+  // so only Contains can look at the raw value.
+  if (step->mFields && step->mKind == kGenericStep &&
+      step->mOp == nsMsgSearchOp::Contains)
+    step->mKind = kAddressesStep;
+
+  if (step->mKind == kSubjectStep || step->mKind == kAddressesStep) {
+    bool fast = false;
+    switch (step->mOp) {
+      case nsMsgSearchOp::IsEmpty:
+      case nsMsgSearchOp::IsntEmpty:
+        fast = true;
+        break;
+      case nsMsgSearchOp::Contains:
+      case nsMsgSearchOp::DoesntContain:
+      case nsMsgSearchOp::Is:
+      case nsMsgSearchOp::Isnt:
+      case nsMsgSearchOp::BeginsWith:
+      case nsMsgSearchOp::EndsWith: {
+        nsCOMPtr<nsIMsgSearchValue> value;
+        nsAutoString needle;
+        aTerm->GetValue(getter_AddRefs(value));
+        if (value) value->GetStr(needle);
+        // Unicode case folding can map non-ASCII characters onto ASCII ones,
+        // so only ASCII needles can be compared bytewise.
+        if (!needle.IsEmpty() && NS_IsAscii(needle.get())) {
+          ToLowerCase(needle);
+          step->SetNeedle(NS_LossyConvertUTF16toASCII(needle));
+          fast = true;
+        }
+        break;
+      }
+    }
+    if (!fast) step->mKind = kGenericStep;
+  }
+
+  switch (step->mKind) {
+    case kGenericStep:
+      step->mFields = 0;
+      mCanEvaluateSnapshots = false;
+      break;
+    case kSubjectStep:
+      step->mFields |= kFlagsField | kCharsetField;
+      break;
+    case kAddressesStep:
+      step->mFields |= kCharsetField;
+      break;
+    default:
+      break;
+  }
+  mFields |= step->mFields;
+
+  return mSteps.Length() - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Evaluation
+//-----------------------------------------------------------------------------
+
+template <class Fields>
+bool nsMsgSearchProgram::MatchStep(const Step &aStep, Fields &aFields,
+                                   bool *aResult) const {
+  switch (aStep.mKind) {
+    case kNumericStep: {
+      nsresult rv;
+      switch (aStep.mAttrib) {
+        case nsMsgSearchAttrib::Date:
+          rv = nsMsgSearchTerm::CompareDate(aStep.mOp, PRTime(aStep.mValue),
+                                            aFields.Date(), aResult);
+          break;
+        case nsMsgSearchAttrib::AgeInDays:
+          rv = nsMsgSearchTerm::CompareAge(aStep.mOp, int32_t(aStep.mValue),
+                                           aFields.Date(), aResult);
+          break;
+        case nsMsgSearchAttrib::Size:
+          rv = nsMsgSearchTerm::CompareSize(aStep.mOp, uint32_t(aStep.mValue),
+                                            aFields.Size(), aResult);
+          break;
+        case nsMsgSearchAttrib::Priority:
+          rv = nsMsgSearchTerm::ComparePriority(
+              aStep.mOp, nsMsgPriorityValue(aStep.mValue), aFields.Priority(),
+              aResult);
+          break;
+        default:
+          rv = nsMsgSearchTerm::CompareStatus(
+              aStep.mOp, uint32_t(aStep.mValue), aFields.Flags(), aResult);
+          break;
+      }
+      return NS_SUCCEEDED(rv);
+    }
+    case kSubjectStep: {
+      if (aFields.HasUTF7Charset()) return false;
+      const nsCString &subject = aFields.Get(kSubjectField);
+      if (!IsPlainHeader(subject)) return false;
+      // The database strips "Re: " from replies; searches still see it.
+      if (aFields.Flags() & nsMsgMessageFlags::HasRe) {
+        nsAutoCString reSubject(NS_LITERAL_CSTRING("Re: ") + subject);
+        *aResult = aStep.Matches(reSubject);
+      } else {
+        *aResult = aStep.Matches(subject);
+      }
+      return true;
+    }
+    case kAddressesStep: {
+      if (aFields.HasUTF7Charset()) return false;
+      // The term matches if any of the fields contains the needle, so a
+      // field that can't be compared raw only matters if no other hits.
+      bool decided = true;
+      for (uint32_t i = 0; i < kNumStringFields; i++) {
+        HeaderField field = HeaderField(1 << i);
+        if (!(aStep.mFields & field)) continue;
+        const nsCString &value = aFields.Get(field);
+        if (!IsPlainHeader(value))
+          decided = false;
+        else if (aStep.FoundIn(value)) {
+          *aResult = true;
+          return true;
+        }
+      }
+      *aResult = false;
+      return decided;
+    }
+    default:
+      return false;
+  }
+}
+
+nsresult nsMsgSearchProgram::Evaluate(nsIMsgDBHdr *aMsgToMatch,
+                                      nsIMsgSearchScopeTerm *aScope,
+                                      nsIMsgDatabase *aDb, bool *aResult) {
+  NS_ENSURE_ARG_POINTER(aResult);
+  *aResult = false;
+  HeaderFields fields(aMsgToMatch, mDefaultCharset);
+  uint32_t current = mEntry;
+  while (current != kAccept && current != kReject) {
+    const Step &step = mSteps[current];
+    bool result = false;
+    if (!MatchStep(step, fields, &result)) {
+      nsresult rv = nsMsgSearchOfflineMail::ProcessSearchTerm(
+          aMsgToMatch, step.mTerm.get(), mDefaultCharset.get(), aScope, aDb,
+          EmptyCString(), false, &result);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    current = result ? step.mOnTrue : step.mOnFalse;
+  }
+  *aResult = current == kAccept;
+  return NS_OK;
+}
+
+//-----------------------------------------------------------------------------
+// Snapshots
+//-----------------------------------------------------------------------------
+
+void nsMsgSearchProgram::TakeSnapshot(nsIMsgDBHdr *aMsgToMatch,
+                                      Snapshot &aSnapshot) const {
+  MOZ_ASSERT(NS_IsMainThread());
+  HeaderFields fields(aMsgToMatch, mDefaultCharset);
+  aMsgToMatch->GetMessageKey(&aSnapshot.mKey);
+  aSnapshot.mFlags = (mFields & kFlagsField) ? fields.Flags() : 0;
+  aSnapshot.mDate = (mFields & kDateField) ? fields.Date() : 0;
+  aSnapshot.mSize = (mFields & kSizeField) ? fields.Size() : 0;
+  aSnapshot.mPriority =
+      (mFields & kPriorityField) ? fields.Priority() : nsMsgPriority::notSet;
+  aSnapshot.mUTF7 = (mFields & kCharsetField) && fields.HasUTF7Charset();
+  for (uint32_t i = 0; i < kNumStringFields; i++) {
+    HeaderField field = HeaderField(1 << i);
+    if (mFields & field) aSnapshot.mValues[i] = fields.Get(field);
+  }
+}
+
+nsMsgSearchProgram::SnapshotResult nsMsgSearchProgram::EvaluateSnapshot(
+    const Snapshot &aSnapshot) const {
+  MOZ_ASSERT(mCanEvaluateSnapshots);
+  uint32_t current = mEntry;
+  while (current != kAccept && current != kReject) {
+    const Step &step = mSteps[current];
+    bool result = false;
+    if (!MatchStep(step, aSnapshot, &result)) return kSnapshotUndecided;
+    current = result ? step.mOnTrue : step.mOnFalse;
+  }
+  return current == kAccept ? kSnapshotMatch : kSnapshotNoMatch;
+}
+
+void nsMsgSearchProgram::Batch::Evaluate(nsMsgSearchProgram *aProgram) {
+  mResults.SetCapacity(mSnapshots.Length());
+  for (const Snapshot &snapshot : mSnapshots) {
+    if (aProgram->IsCancelled()) break;
+    mResults.AppendElement(aProgram->EvaluateSnapshot(snapshot));
+  }
+  mEvaluated = true;
+}
@@ -0,0 +1,186 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef _nsMsgSearchProgram_H
+#define _nsMsgSearchProgram_H
+
+#include "nsMsgSearchCore.h"
+#include "MailNewsTypes.h"
+#include "mozilla/Atomics.h"
+#include "nsProxyRelease.h"
+#include "nsString.h"
+#include "nsTArray.h"
+
+class nsIMsgDBHdr;
+class nsIMsgDatabase;
+class nsIMsgSearchScopeTerm;
+class nsIMsgSearchTerm;
+class nsMsgSearchBoolExpression;
+
+/**
+ * nsMsgSearchProgram is the offline search expression tree compiled once per
+ * scope into a flat branch program. Every step evaluates one search term and
+ * jumps to the next step depending on the result, so evaluating a header
+ * needs neither recursion nor the term list.
+ *
+ * Operands of an AND or OR run are reordered so that cheap terms (dates,
+ * sizes, flags) run before string terms, which in turn run before terms that
+ * have to read the message store. String terms on the subject and address
+ * headers keep a pre-lowered ASCII needle that is matched straight against
+ * the raw header bytes when those are plain ASCII. Everything else goes
+ * through nsMsgSearchOfflineMail::ProcessSearchTerm as before.
+ *
+ * Programs made only of such numeric and string steps can also evaluate
+ * snapshots of headers on any thread; see Snapshot.
+ */
+class nsMsgSearchProgram final {
+ public:
+  NS_INLINE_DECL_THREADSAFE_REFCOUNTING(nsMsgSearchProgram)
+
+  /**
+   * @param aExpression     the expression tree to compile; the program keeps
+   *                        its own references to the terms, so the tree can
+   *                        be deleted afterwards. May be null.
+   * @param aDefaultCharset charset used for headers that don't have one.
+   */
+  nsMsgSearchProgram(nsMsgSearchBoolExpression *aExpression,
+                     const nsACString &aDefaultCharset);
+
+  // Sets *aResult to whether the header matches the compiled expression.
+  // Fails, with *aResult false, if a term can't be evaluated.
+  nsresult Evaluate(nsIMsgDBHdr *aMsgToMatch, nsIMsgSearchScopeTerm *aScope,
+                    nsIMsgDatabase *aDb, bool *aResult);
+
+  // Header values the steps read.
+  enum HeaderField : uint16_t {
+    kSubjectField = 1 << 0,
+    kAuthorField = 1 << 1,
+    kRecipientsField = 1 << 2,
+    kCcListField = 1 << 3,
+    kBccListField = 1 << 4,
+    kNumStringFields = 5,  // the fields above are strings
+    kFlagsField = 1 << 5,
+    kDateField = 1 << 6,
+    kSizeField = 1 << 7,
+    kPriorityField = 1 << 8,
+    kCharsetField = 1 << 9
+  };
+
+  /**
+   * The values of a header that the program reads, copied out of the
+   * database on the main thread so the program can be evaluated elsewhere.
+   */
+  struct Snapshot {
+    nsMsgKey mKey;
+    uint32_t mFlags;
+    uint32_t mSize;
+    nsMsgPriorityValue mPriority;
+    PRTime mDate;
+    bool mUTF7;
+    nsCString mValues[kNumStringFields];
+
+    uint32_t Flags() const { return mFlags; }
+    PRTime Date() const { return mDate; }
+    uint32_t Size() const { return mSize; }
+    nsMsgPriorityValue Priority() const { return mPriority; }
+    bool HasUTF7Charset() const { return mUTF7; }
+    const nsCString &Get(HeaderField aField) const;
+  };
+
+  enum SnapshotResult : uint8_t {
+    kSnapshotNoMatch,
+    kSnapshotMatch,
+    // The snapshot holds a header value that needs decoding first; evaluate
+    // the header itself on the main thread.
+    kSnapshotUndecided
+  };
+
+  // A batch of snapshots queued for evaluation on another thread.
+  class Batch final {
+   public:
+    NS_INLINE_DECL_THREADSAFE_REFCOUNTING(Batch)
+
+    Batch() : mEvaluated(false) {}
+
+    nsTArray<Snapshot> mSnapshots;
+    nsTArray<SnapshotResult> mResults;  // set by Evaluate, per snapshot
+    mozilla::Atomic<bool> mEvaluated;
+
+    // Fills in mResults and sets mEvaluated. May run on any thread.
+    void Evaluate(nsMsgSearchProgram *aProgram);
+
+   private:
+    ~Batch() {}
+  };
+
+  // True if no step needs the header itself, so snapshots can be used.
+  bool CanEvaluateSnapshots() const { return mCanEvaluateSnapshots; }
+  // Main thread only.
+  void TakeSnapshot(nsIMsgDBHdr *aMsgToMatch, Snapshot &aSnapshot) const;
+  // Any thread.
+  SnapshotResult EvaluateSnapshot(const Snapshot &aSnapshot) const;
+
+  // Stops queued batches from being evaluated; they report no results.
+  void Cancel() { mCancelled = true; }
+  bool IsCancelled() const { return mCancelled; }
+
+ private:
+  ~nsMsgSearchProgram();
+
+  enum StepKind : uint8_t {
+    kGenericStep,   // ProcessSearchTerm
+    kNumericStep,   // date, size, priority or flags, straight from the header
+    kSubjectStep,   // needle against the subject
+    kAddressesStep  // needle contained in any of the address fields
+  };
+
+  struct Step {
+    // Terms are plain XPCOM objects; only the main thread touches them.
+    nsMainThreadPtrHandle<nsIMsgSearchTerm> mTerm;
+    nsMsgSearchAttribValue mAttrib;
+    nsMsgSearchOpValue mOp;
+    StepKind mKind;
+    uint16_t mFields;  // HeaderField bits read by the step
+    uint32_t mOnTrue;
+    uint32_t mOnFalse;
+    // The term's value, for numeric steps.
+    int64_t mValue;
+    // Lower case ASCII needle and its Horspool skip table, for string steps.
+    nsCString mNeedle;
+    uint8_t mSkip[256];
+
+    void SetNeedle(const nsACString &aLowerCaseNeedle);
+    bool FoundIn(const nsACString &aHaystack) const;
+    bool Matches(const nsACString &aHaystack) const;
+  };
+
+  class HeaderFields;
+
+  static const uint32_t kAccept = UINT32_MAX;
+  static const uint32_t kReject = UINT32_MAX - 1;
+
+  uint32_t Compile(nsMsgSearchBoolExpression *aExpression, uint32_t aOnTrue,
+                   uint32_t aOnFalse);
+  uint32_t EmitTerm(nsIMsgSearchTerm *aTerm, uint32_t aOnTrue,
+                    uint32_t aOnFalse);
+  static void CollectOperands(nsMsgSearchBoolExpression *aExpression,
+                              nsMsgSearchBooleanOperator aBoolOp,
+                              nsTArray<nsMsgSearchBoolExpression *> &aOperands);
+  static uint32_t Cost(nsMsgSearchBoolExpression *aExpression);
+
+  // Evaluates a numeric or string step against HeaderFields or a Snapshot.
+  // Returns false if the step couldn't be decided without decoding.
+  template <class Fields>
+  bool MatchStep(const Step &aStep, Fields &aFields, bool *aResult) const;
+
+  nsTArray<Step> mSteps;
+  uint32_t mEntry;
+  uint16_t mFields;  // HeaderField bits read by all steps
+  bool mCanEvaluateSnapshots;
+  mozilla::Atomic<bool> mCancelled;
+  nsCString mDefaultCharset;
+};
+
+#endif
@@ -22,6 +22,10 @@
 #include "nsComponentManagerUtils.h"
 #include "nsServiceManagerUtils.h"
 #include "nsAutoPtr.h"
+#include "nsIPrefBranch.h"
+#include "nsIPrefService.h"
+#include "nsThreadUtils.h"
+#include <algorithm>
 
 NS_IMPL_ISUPPORTS(nsMsgSearchSession, nsIMsgSearchSession, nsIUrlListener,
                   nsISupportsWeakReference)
@@ -32,6 +36,8 @@ nsMsgSearchSession::nsMsgSearchSession() {
   m_handlingError = false;
   m_expressionTree = nullptr;
   m_searchPaused = false;
+  m_parallelScopes = 1;
+  m_nextParallelScope = 0;
   m_termList = nsArray::Create();
   NS_ASSERTION(m_termList,
                "Failed to allocate a nsIMutableArray for m_termList");
@@ -240,6 +246,14 @@ NS_IMETHODIMP nsMsgSearchSession::InterruptSearch() {
     // m_idxRunningScope = m_scopeList.Length() so it will make us not run
     // another url
   }
+  // Scopes searched in parallel have already been counted as started.
+  for (nsMsgSearchScopeTerm *scope : m_runningScopes) {
+    if (scope->m_adapter) scope->m_adapter->Abort();
+    EnableFolderNotifications(scope, true);
+    ReleaseFolderDBRef(scope);
+  }
+  m_runningScopes.Clear();
+  ShutdownSearchPool();
   if (m_backgroundTimer) {
     m_backgroundTimer->Cancel();
     NotifyListenersDone(NS_MSG_SEARCH_INTERRUPTED);
@@ -339,6 +353,51 @@ nsresult nsMsgSearchSession::Initialize() {
     rv = scopeTerm->InitializeAdapter(m_termList);
   }
 
+  // Offline scopes only need the main thread to read their databases, so a
+  // few of them can be searched at once, with their terms evaluated on a
+  // thread pool. Anything that runs urls is searched one scope at a time.
+  m_runningScopes.Clear();
+  m_nextParallelScope = 0;
+  m_parallelScopes = 1;
+  bool allOffline = true;
+  for (uint32_t i = 0; i < m_scopeList.Length() && allOffline; i++) {
+    switch (m_scopeList[i]->m_attribute) {
+      case nsMsgSearchScope::offlineMail:
+      case nsMsgSearchScope::onlineManual:
+      case nsMsgSearchScope::localNews:
+      case nsMsgSearchScope::localNewsJunk:
+      case nsMsgSearchScope::localNewsBody:
+      case nsMsgSearchScope::localNewsJunkBody:
+        break;
+      default:
+        allOffline = false;
+    }
+  }
+  if (NS_SUCCEEDED(rv) && allOffline) {
+    int32_t threads = 2;
+    int32_t parallelScopes = 4;
+    nsCOMPtr<nsIPrefBranch> prefBranch =
+        do_GetService(NS_PREFSERVICE_CONTRACTID);
+    if (prefBranch) {
+      prefBranch->GetIntPref("mailnews.search.threads", &threads);
+      prefBranch->GetIntPref("mailnews.search.parallel_scopes",
+                             &parallelScopes);
+    }
+    if (threads > 0 && !m_searchPool) {
+      m_searchPool = do_CreateInstance("@mozilla.org/thread-pool;1");
+      if (m_searchPool) {
+        m_searchPool->SetName(NS_LITERAL_CSTRING("MsgSearch"));
+        m_searchPool->SetIdleThreadLimit(1);
+      }
+    }
+    if (threads > 0 && m_searchPool) {
+      m_searchPool->SetThreadLimit(threads);
+      for (nsMsgSearchScopeTerm *scope : m_scopeList)
+        scope->m_searchPool = m_searchPool;
+      m_parallelScopes = std::max(parallelScopes, 1);
+    }
+  }
+
   return rv;
 }
 
@@ -410,8 +469,10 @@ void nsMsgSearchSession::TimerCallback(nsITimer *aTimer, void *aClosure) {
     searchSession->m_backgroundTimer = nullptr;
     if (searchSession->m_idxRunningScope < searchSession->m_scopeList.Length())
       searchSession->DoNextSearch();
-    else
+    else {
+      if (done) searchSession->ShutdownSearchPool();
       searchSession->NotifyListenersDone(NS_OK);
+    }
   }
 }
 
@@ -492,12 +553,26 @@ nsMsgSearchScopeTerm *nsMsgSearchSession::GetRunningScope() {
 }
 
 nsresult nsMsgSearchSession::TimeSlice(bool *aDone) {
-  // we only do serial for now.
+  if (m_parallelScopes > 1) return TimeSliceParallel(aDone);
   return TimeSliceSerial(aDone);
 }
 
+void nsMsgSearchSession::ShutdownSearchPool() {
+  if (!m_searchPool) return;
+  for (nsMsgSearchScopeTerm *scope : m_scopeList) scope->m_searchPool = nullptr;
+  // Shutdown spins the event loop, which our callers may not expect, so do it
+  // from a runnable of its own.
+  nsCOMPtr<nsIThreadPool> pool = m_searchPool.forget();
+  NS_DispatchToMainThread(
+      NS_NewRunnableFunction("nsMsgSearchSession::ShutdownSearchPool",
+                             [pool]() { pool->Shutdown(); }));
+}
+
 void nsMsgSearchSession::ReleaseFolderDBRef() {
-  nsMsgSearchScopeTerm *scope = GetRunningScope();
+  ReleaseFolderDBRef(GetRunningScope());
+}
+
+void nsMsgSearchSession::ReleaseFolderDBRef(nsMsgSearchScopeTerm *scope) {
   if (!scope) return;
 
   bool isOpen = false;
@@ -550,8 +625,48 @@ nsresult nsMsgSearchSession::TimeSliceSerial(bool *aDone) {
   return rv;
 }
 
+nsresult nsMsgSearchSession::TimeSliceParallel(bool *aDone) {
+  // This version of TimeSlice keeps up to m_parallelScopes offline scopes
+  // running and gives each of them a time slice in turn. Their adapters hand
+  // the headers to m_searchPool, so while the pool evaluates the terms for
+  // one scope, the main thread can read the headers of the next.
+
+  NS_ENSURE_ARG_POINTER(aDone);
+
+  while (m_runningScopes.Length() < m_parallelScopes &&
+         m_idxRunningScope < m_scopeList.Length()) {
+    nsMsgSearchScopeTerm *scope = m_scopeList[m_idxRunningScope++];
+    EnableFolderNotifications(scope, false);
+    m_runningScopes.AppendElement(scope);
+  }
+  if (m_runningScopes.IsEmpty()) {
+    *aDone = true;
+    return NS_OK;
+  }
+
+  if (m_nextParallelScope >= m_runningScopes.Length()) m_nextParallelScope = 0;
+  RefPtr<nsMsgSearchScopeTerm> scope = m_runningScopes[m_nextParallelScope];
+  bool scopeDone = false;
+  nsresult rv = scope->TimeSlice(&scopeDone);
+  if (scopeDone || NS_FAILED(rv)) {
+    EnableFolderNotifications(scope, true);
+    ReleaseFolderDBRef(scope);
+    m_runningScopes.RemoveElementAt(m_nextParallelScope);
+  } else {
+    m_nextParallelScope++;
+  }
+
+  *aDone = m_runningScopes.IsEmpty() &&
+           m_idxRunningScope >= m_scopeList.Length();
+  return rv;
+}
+
 void nsMsgSearchSession::EnableFolderNotifications(bool aEnable) {
-  nsMsgSearchScopeTerm *scope = GetRunningScope();
+  EnableFolderNotifications(GetRunningScope(), aEnable);
+}
+
+void nsMsgSearchSession::EnableFolderNotifications(nsMsgSearchScopeTerm *scope,
+                                                   bool aEnable) {
   if (scope) {
     nsCOMPtr<nsIMsgFolder> folder;
     scope->GetFolder(getter_AddRefs(folder));
@@ -12,6 +12,7 @@
 #include "nsIUrlListener.h"
 #include "nsIMsgWindow.h"
 #include "nsITimer.h"
+#include "nsIThreadPool.h"
 #include "nsIMutableArray.h"
 #include "nsCOMArray.h"
 #include "nsWeakReference.h"
@@ -46,7 +47,10 @@ class nsMsgSearchSession : public nsIMsgSearchSession,
   nsresult GetNextUrl();
   nsresult NotifyListenersDone(nsresult status);
   void EnableFolderNotifications(bool aEnable);
+  void EnableFolderNotifications(nsMsgSearchScopeTerm *aScope, bool aEnable);
   void ReleaseFolderDBRef();
+  void ReleaseFolderDBRef(nsMsgSearchScopeTerm *aScope);
+  void ShutdownSearchPool();
 
   nsTArray<RefPtr<nsMsgSearchScopeTerm>> m_scopeList;
   nsCOMPtr<nsIMutableArray> m_termList;
@@ -77,7 +81,8 @@ class nsMsgSearchSession : public nsIMsgSearchSession,
   static void TimerCallback(nsITimer *aTimer, void *aClosure);
   // support for searching multiple scopes in serial
   nsresult TimeSliceSerial(bool *aDone);
-  nsresult TimeSliceParallel();
+  // support for searching several offline scopes at once
+  nsresult TimeSliceParallel(bool *aDone);
 
   nsMsgSearchAttribValue m_sortAttribute;
   uint32_t m_idxRunningScope;
@@ -86,6 +91,12 @@ class nsMsgSearchSession : public nsIMsgSearchSession,
   nsCOMPtr<nsITimer> m_backgroundTimer;
   bool m_searchPaused;
   nsMsgSearchBoolExpression *m_expressionTree;
+  // how many offline scopes TimeSliceParallel keeps running; 1 is serial
+  uint32_t m_parallelScopes;
+  nsTArray<RefPtr<nsMsgSearchScopeTerm>> m_runningScopes;
+  uint32_t m_nextParallelScope;  // the running scope to get the next slice
+  // evaluates the terms of the running offline scopes
+  nsCOMPtr<nsIThreadPool> m_searchPool;
 };
 
 #endif
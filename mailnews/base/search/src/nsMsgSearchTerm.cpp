@@ -1103,16 +1103,16 @@ nsresult nsMsgSearchTerm::GetLocalTimes(PRTime a, PRTime b,
   return NS_OK;
 }
 
-nsresult nsMsgSearchTerm::MatchDate(PRTime dateToMatch, bool *pResult) {
+nsresult nsMsgSearchTerm::CompareDate(nsMsgSearchOpValue aOp, PRTime aValue,
+                                      PRTime dateToMatch, bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
 
   nsresult rv = NS_OK;
   bool result = false;
 
   PRExplodedTime tmToMatch, tmThis;
-  if (NS_SUCCEEDED(
-          GetLocalTimes(dateToMatch, m_value.u.date, tmToMatch, tmThis))) {
-    switch (m_operator) {
+  if (NS_SUCCEEDED(GetLocalTimes(dateToMatch, aValue, tmToMatch, tmThis))) {
+    switch (aOp) {
       case nsMsgSearchOp::IsBefore:
         if (tmToMatch.tm_year < tmThis.tm_year ||
             (tmToMatch.tm_year == tmThis.tm_year &&
@@ -1146,21 +1146,26 @@ nsresult nsMsgSearchTerm::MatchDate(PRTime dateToMatch, bool *pResult) {
   return rv;
 }
 
-nsresult nsMsgSearchTerm::MatchAge(PRTime msgDate, bool *pResult) {
+nsresult nsMsgSearchTerm::MatchDate(PRTime dateToMatch, bool *pResult) {
+  return CompareDate(m_operator, m_value.u.date, dateToMatch, pResult);
+}
+
+nsresult nsMsgSearchTerm::CompareAge(nsMsgSearchOpValue aOp, int32_t aValue,
+                                     PRTime msgDate, bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
 
   bool result = false;
   nsresult rv = NS_OK;
 
   PRTime now = PR_Now();
-  PRTime cutOffDay = now - m_value.u.age * PR_USEC_PER_DAY;
+  PRTime cutOffDay = now - aValue * PR_USEC_PER_DAY;
 
-  bool cutOffDayInTheFuture = m_value.u.age < 0;
+  bool cutOffDayInTheFuture = aValue < 0;
 
   // So now cutOffDay is the PRTime cut-off point.
   // Any msg with a time less than that will be past the age.
 
-  switch (m_operator) {
+  switch (aOp) {
     case nsMsgSearchOp::IsGreaterThan:  // is older than, or more in the future
       if ((!cutOffDayInTheFuture && msgDate < cutOffDay) ||
           (cutOffDayInTheFuture && msgDate > cutOffDay))
@@ -1190,7 +1195,12 @@ nsresult nsMsgSearchTerm::MatchAge(PRTime msgDate, bool *pResult) {
   return rv;
 }
 
-nsresult nsMsgSearchTerm::MatchSize(uint32_t sizeToMatch, bool *pResult) {
+nsresult nsMsgSearchTerm::MatchAge(PRTime msgDate, bool *pResult) {
+  return CompareAge(m_operator, m_value.u.age, msgDate, pResult);
+}
+
+nsresult nsMsgSearchTerm::CompareSize(nsMsgSearchOpValue aOp, uint32_t aValue,
+                                      uint32_t sizeToMatch, bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
 
   nsresult rv = NS_OK;
@@ -1204,15 +1214,15 @@ nsresult nsMsgSearchTerm::MatchSize(uint32_t sizeToMatch, bool *pResult) {
 
   sizeToMatchKB /= 1024;
 
-  switch (m_operator) {
+  switch (aOp) {
     case nsMsgSearchOp::IsGreaterThan:
-      if (sizeToMatchKB > m_value.u.size) result = true;
+      if (sizeToMatchKB > aValue) result = true;
       break;
     case nsMsgSearchOp::IsLessThan:
-      if (sizeToMatchKB < m_value.u.size) result = true;
+      if (sizeToMatchKB < aValue) result = true;
       break;
     case nsMsgSearchOp::Is:
-      if (sizeToMatchKB == m_value.u.size) result = true;
+      if (sizeToMatchKB == aValue) result = true;
       break;
     default:
       rv = NS_ERROR_FAILURE;
@@ -1222,6 +1232,10 @@ nsresult nsMsgSearchTerm::MatchSize(uint32_t sizeToMatch, bool *pResult) {
   return rv;
 }
 
+nsresult nsMsgSearchTerm::MatchSize(uint32_t sizeToMatch, bool *pResult) {
+  return CompareSize(m_operator, m_value.u.size, sizeToMatch, pResult);
+}
+
 nsresult nsMsgSearchTerm::MatchJunkStatus(const char *aJunkScore,
                                           bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
@@ -1338,15 +1352,17 @@ nsresult nsMsgSearchTerm::MatchLabel(nsMsgLabelValue aLabelValue,
 
 // MatchStatus () is not only used for nsMsgMessageFlags but also for
 // nsMsgFolderFlags (both being 'unsigned long')
-nsresult nsMsgSearchTerm::MatchStatus(uint32_t statusToMatch, bool *pResult) {
+nsresult nsMsgSearchTerm::CompareStatus(nsMsgSearchOpValue aOp,
+                                        uint32_t aValue, uint32_t statusToMatch,
+                                        bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
 
   nsresult rv = NS_OK;
-  bool matches = (statusToMatch & m_value.u.msgStatus);
+  bool matches = (statusToMatch & aValue);
 
   // nsMsgSearchOp::Is and nsMsgSearchOp::Isnt are intentionally used as
   // Contains and DoesntContain respectively, for legacy reasons.
-  switch (m_operator) {
+  switch (aOp) {
     case nsMsgSearchOp::Is:
       break;
     case nsMsgSearchOp::Isnt:
@@ -1362,6 +1378,11 @@ nsresult nsMsgSearchTerm::MatchStatus(uint32_t statusToMatch, bool *pResult) {
   return rv;
 }
 
+nsresult nsMsgSearchTerm::MatchStatus(uint32_t statusToMatch, bool *pResult) {
+  return CompareStatus(m_operator, m_value.u.msgStatus, statusToMatch,
+                       pResult);
+}
+
 /*
  * MatchKeyword Logic table (*pResult: + is true, - is false)
  *
@@ -1483,8 +1504,10 @@ nsresult nsMsgSearchTerm::MatchKeyword(const nsACString &keywordList,
   return NS_ERROR_FAILURE;
 }
 
-nsresult nsMsgSearchTerm::MatchPriority(nsMsgPriorityValue priorityToMatch,
-                                        bool *pResult) {
+nsresult nsMsgSearchTerm::ComparePriority(nsMsgSearchOpValue aOp,
+                                          nsMsgPriorityValue aValue,
+                                          nsMsgPriorityValue priorityToMatch,
+                                          bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
 
   nsresult rv = NS_OK;
@@ -1494,9 +1517,9 @@ nsresult nsMsgSearchTerm::MatchPriority(nsMsgPriorityValue priorityToMatch,
   // integer compare operators
   int p1 = (priorityToMatch == nsMsgPriority::none) ? (int)nsMsgPriority::normal
                                                     : (int)priorityToMatch;
-  int p2 = (int)m_value.u.priority;
+  int p2 = (int)aValue;
 
-  switch (m_operator) {
+  switch (aOp) {
     case nsMsgSearchOp::IsHigherThan:
       if (p1 > p2) result = true;
       break;
@@ -1517,6 +1540,12 @@ nsresult nsMsgSearchTerm::MatchPriority(nsMsgPriorityValue priorityToMatch,
   return rv;
 }
 
+nsresult nsMsgSearchTerm::MatchPriority(nsMsgPriorityValue priorityToMatch,
+                                        bool *pResult) {
+  return ComparePriority(m_operator, m_value.u.priority, priorityToMatch,
+                         pResult);
+}
+
 // match a custom search term
 NS_IMETHODIMP nsMsgSearchTerm::MatchCustom(nsIMsgDBHdr *aHdr, bool *pResult) {
   NS_ENSURE_ARG_POINTER(pResult);
@@ -16,6 +16,9 @@
 #include "MailNewsTypes2.h"
 #include "nsMsgUtils.h"
 #include "nsQuickSort.h"
+#include "nsMsgViewSorter.h"
+#include "prsystem.h"
+#include "mozilla/Preferences.h"
 #include "nsIMsgImapMailFolder.h"
 #include "nsImapCore.h"
 #include "nsMsgFolderFlags.h"
@@ -72,6 +75,21 @@ mozilla::nsDateFormatSelector nsMsgDBView::m_dateFormatToday =
 
 static const uint32_t kMaxNumSortColumns = 2;
 
+// Author and recipient sort keys come from the address book when addresses
+// are condensed, and mail.displayname.version gets bumped whenever an address
+// book changes; see FetchAuthor().
+static bool gShowCondensedAddresses = false;
+static int32_t gDisplayNameVersion = 0;
+
+// Views at least this big are sorted by SortLargeView(), on this many
+// threads, or one per processor if it's 0.
+static int32_t gLargeSortThreshold = 20000;
+static int32_t gLargeSortThreads = 0;
+static bool gPrefsCached = false;
+
+// Sort key cache columns for keys built from address book display names.
+static const uint32_t kDisplayNameColumn = 0x200;
+
 static void GetCachedName(const nsCString &unparsedString,
                           int32_t displayVersion, nsACString &cachedName);
 
@@ -134,6 +152,7 @@ nsMsgDBView::nsMsgDBView() {
   mNumMessagesRemainingInBatch = 0;
   mShowSizeInLines = false;
   mSortThreadsByRoot = false;
+  m_sortKeyDisplayNameVersion = 0;
 
   // mCommandsNeedDisablingBecauseOfSelection - A boolean that tell us if we
   // needed to disable commands because of what's selected. If we're offline
@@ -148,6 +167,19 @@ nsMsgDBView::nsMsgDBView() {
     InitDisplayFormats();
   }
 
+  if (!gPrefsCached) {
+    mozilla::Preferences::AddBoolVarCache(&gShowCondensedAddresses,
+                                          "mail.showCondensedAddresses");
+    mozilla::Preferences::AddIntVarCache(&gDisplayNameVersion,
+                                         "mail.displayname.version");
+    mozilla::Preferences::AddIntVarCache(&gLargeSortThreshold,
+                                         "mailnews.view.large_sort_threshold",
+                                         20000);
+    mozilla::Preferences::AddIntVarCache(&gLargeSortThreads,
+                                         "mailnews.view.large_sort_threads", 0);
+    gPrefsCached = true;
+  }
+
   InitLabelStrings();
   gInstanceCount++;
 }
@@ -2226,6 +2258,7 @@ nsMsgDBView::Close() {
   if (mTree) mTree->RowCountChanged(0, -oldSize);
 
   ClearHdrCache();
+  m_sortKeyCache.Clear();
   if (m_db) {
     m_db->RemoveListener(this);
     m_db = nullptr;
@@ -4228,11 +4261,6 @@ int32_t nsMsgDBView::SecondaryCompare(nsMsgKey key1, nsIMsgFolder *folder1,
   // matching, we don't recurse.
   if (comparisonContext->isSecondarySort) return key1 > key2;
 
-  nsCOMPtr<nsIMsgDBHdr> hdr1, hdr2;
-  nsresult rv = folder1->GetMessageHeader(key1, getter_AddRefs(hdr1));
-  NS_ENSURE_SUCCESS(rv, 0);
-  rv = folder2->GetMessageHeader(key2, getter_AddRefs(hdr2));
-  NS_ENSURE_SUCCESS(rv, 0);
   IdKey EntryInfo1, EntryInfo2;
 
   uint16_t maxLen;
@@ -4253,11 +4281,12 @@ int32_t nsMsgDBView::SecondaryCompare(nsMsgKey key1, nsIMsgFolder *folder1,
   // In this case, we can return 0 right away since
   // it is the value returned in the default case of
   // switch (fieldType) statement below.
-  rv = GetFieldTypeAndLenForSort(sortType, &maxLen, &fieldType, colHandler);
+  nsresult rv =
+      GetFieldTypeAndLenForSort(sortType, &maxLen, &fieldType, colHandler);
   NS_ENSURE_SUCCESS(rv, 0);
 
-  hdr1->GetMessageKey(&EntryInfo1.id);
-  hdr2->GetMessageKey(&EntryInfo2.id);
+  EntryInfo1.id = key1;
+  EntryInfo2.id = key2;
 
   // Set up new viewSortInfo data for our secondary comparison.
   viewSortInfo ctx = *comparisonContext;
@@ -4267,20 +4296,27 @@ int32_t nsMsgDBView::SecondaryCompare(nsMsgKey key1, nsIMsgFolder *folder1,
   // The comparison functions expect to be sorting pointers to entries.
   const void *pValue1 = &EntryInfo1, *pValue2 = &EntryInfo2;
 
+  // The headers are only fetched if their keys aren't cached already.
   switch (fieldType) {
     case kCollationKey:
-      rv = GetCollationKey(hdr1, sortType, EntryInfo1.key, colHandler);
-      NS_ASSERTION(NS_SUCCEEDED(rv), "failed to create collation key");
-      rv = GetCollationKey(hdr2, sortType, EntryInfo2.key, colHandler);
-      NS_ASSERTION(NS_SUCCEEDED(rv), "failed to create collation key");
+      rv = GetSortCollationKey(nsMsgViewIndex_None, key1, folder1, sortType,
+                               colHandler, EntryInfo1.key);
+      NS_ENSURE_SUCCESS(rv, 0);
+      rv = GetSortCollationKey(nsMsgViewIndex_None, key2, folder2, sortType,
+                               colHandler, EntryInfo2.key);
+      NS_ENSURE_SUCCESS(rv, 0);
       return FnSortIdKey(&pValue1, &pValue2, &ctx);
     case kU32:
       if (sortType == nsMsgViewSortType::byId) {
         EntryInfo1.dword = EntryInfo1.id;
         EntryInfo2.dword = EntryInfo2.id;
       } else {
-        GetLongField(hdr1, sortType, &EntryInfo1.dword, colHandler);
-        GetLongField(hdr2, sortType, &EntryInfo2.dword, colHandler);
+        rv = GetSortValue(nsMsgViewIndex_None, key1, folder1, sortType,
+                          colHandler, &EntryInfo1.dword);
+        NS_ENSURE_SUCCESS(rv, 0);
+        rv = GetSortValue(nsMsgViewIndex_None, key2, folder2, sortType,
+                          colHandler, &EntryInfo2.dword);
+        NS_ENSURE_SUCCESS(rv, 0);
       }
       return FnSortIdUint32(&pValue1, &pValue2, &ctx);
     default:
@@ -4288,6 +4324,113 @@ int32_t nsMsgDBView::SecondaryCompare(nsMsgKey key1, nsIMsgFolder *folder1,
   }
 }
 
+// Returns the m_sortKeyCache column for sort keys of type sortType, or 0 if
+// those keys can't be cached: either because they depend on more than the
+// header itself (custom columns, folder and account names, tag names, and
+// the thread dates used when sorting threads by their newest message), or
+// because they are free to compute (byId). Keys built from address book
+// display names are dropped whenever the address book changes.
+uint32_t nsMsgDBView::GetSortKeyCacheColumn(nsMsgViewSortTypeValue sortType,
+                                            nsIMsgFolder *folder) {
+  if (!folder) return 0;
+
+  switch (sortType) {
+    case nsMsgViewSortType::byCustom:
+    case nsMsgViewSortType::byAccount:
+    case nsMsgViewSortType::byLocation:
+    case nsMsgViewSortType::byTags:
+    case nsMsgViewSortType::byThread:
+    case nsMsgViewSortType::byId:
+    case nsMsgViewSortType::byNone:
+      return 0;
+    case nsMsgViewSortType::byDate:
+    case nsMsgViewSortType::byReceived:
+      if (m_viewFlags & nsMsgViewFlagsType::kThreadedDisplay &&
+          !(m_viewFlags & nsMsgViewFlagsType::kGroupBySort) &&
+          !mSortThreadsByRoot)
+        return 0;
+      break;
+    case nsMsgViewSortType::bySize:
+      // Lines and bytes get separate columns.
+      if (mShowSizeInLines) return sortType | 0x100;
+      break;
+    case nsMsgViewSortType::byAuthor:
+    case nsMsgViewSortType::byRecipient:
+    case nsMsgViewSortType::byCorrespondent:
+      if (!gShowCondensedAddresses) break;
+      if (m_sortKeyDisplayNameVersion != gDisplayNameVersion) {
+        m_sortKeyCache.ClearColumn(nsMsgViewSortType::byAuthor |
+                                   kDisplayNameColumn);
+        m_sortKeyCache.ClearColumn(nsMsgViewSortType::byRecipient |
+                                   kDisplayNameColumn);
+        m_sortKeyCache.ClearColumn(nsMsgViewSortType::byCorrespondent |
+                                   kDisplayNameColumn);
+        m_sortKeyDisplayNameVersion = gDisplayNameVersion;
+      }
+      return sortType | kDisplayNameColumn;
+    default:
+      break;
+  }
+  return sortType;
+}
+
+// Gets the numeric sort key for a message, from m_sortKeyCache if we have it.
+// Otherwise the header is fetched, through the view index if it's valid, or
+// through the folder.
+nsresult nsMsgDBView::GetSortValue(nsMsgViewIndex index, nsMsgKey key,
+                                   nsIMsgFolder *folder,
+                                   nsMsgViewSortTypeValue sortType,
+                                   nsIMsgCustomColumnHandler *colHandler,
+                                   uint32_t *result) {
+  uint32_t column = GetSortKeyCacheColumn(sortType, folder);
+  if (column && m_sortKeyCache.GetValue(column, folder, key, result))
+    return NS_OK;
+
+  nsCOMPtr<nsIMsgDBHdr> msgHdr;
+  nsresult rv = (index != nsMsgViewIndex_None)
+                    ? GetMsgHdrForViewIndex(index, getter_AddRefs(msgHdr))
+                    : folder->GetMessageHeader(key, getter_AddRefs(msgHdr));
+  NS_ASSERTION(NS_SUCCEEDED(rv) && msgHdr, "header not found");
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = GetLongField(msgHdr, sortType, result, colHandler);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (column) m_sortKeyCache.PutValue(column, folder, key, *result);
+  return NS_OK;
+}
+
+// Like GetSortValue(), for sort keys that are collation keys.
+nsresult nsMsgDBView::GetSortCollationKey(nsMsgViewIndex index, nsMsgKey key,
+                                          nsIMsgFolder *folder,
+                                          nsMsgViewSortTypeValue sortType,
+                                          nsIMsgCustomColumnHandler *colHandler,
+                                          nsTArray<uint8_t> &result) {
+  uint32_t column = GetSortKeyCacheColumn(sortType, folder);
+  if (column && m_sortKeyCache.GetCollationKey(column, folder, key, result))
+    return NS_OK;
+
+  nsCOMPtr<nsIMsgDBHdr> msgHdr;
+  nsresult rv = (index != nsMsgViewIndex_None)
+                    ? GetMsgHdrForViewIndex(index, getter_AddRefs(msgHdr))
+                    : folder->GetMessageHeader(key, getter_AddRefs(msgHdr));
+  NS_ASSERTION(NS_SUCCEEDED(rv) && msgHdr, "header not found");
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = GetCollationKey(msgHdr, sortType, result, colHandler);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (column) m_sortKeyCache.PutCollationKey(column, folder, key, result);
+  return NS_OK;
+}
+
+// Called when a header changes, so its cached sort keys are recomputed the
+// next time we sort.
+void nsMsgDBView::InvalidateSortKeys(nsIMsgDBHdr *msgHdr) {
+  if (!msgHdr) return;
+  nsCOMPtr<nsIMsgFolder> folder;
+  nsMsgKey msgKey;
+  msgHdr->GetFolder(getter_AddRefs(folder));
+  msgHdr->GetMessageKey(&msgKey);
+  if (folder) m_sortKeyCache.Invalidate(folder, msgKey);
+}
+
 NS_IMETHODIMP nsMsgDBView::Sort(nsMsgViewSortTypeValue sortType,
                                 nsMsgViewSortOrderValue sortOrder) {
   EnsureCustomColumnsValid();
@@ -4384,6 +4527,9 @@ NS_IMETHODIMP nsMsgDBView::Sort(nsMsgViewSortTypeValue sortType,
     if (!dbToUse) return NS_ERROR_FAILURE;
   }
 
+  if (gLargeSortThreshold > 0 && arraySize >= uint32_t(gLargeSortThreshold))
+    return SortLargeView(sortType, sortOrder, fieldType, colHandler);
+
   viewSortInfo qsPrivateData;
   qsPrivateData.view = this;
   qsPrivateData.isSecondarySort = false;
@@ -4405,11 +4551,8 @@ NS_IMETHODIMP nsMsgDBView::Sort(nsMsgViewSortTypeValue sortType,
         info->bits = m_flags[i];
         info->dword = 0;
         info->folder = folders ? folders->ObjectAt(i) : m_folder.get();
-        nsCOMPtr<nsIMsgDBHdr> msgHdr;
-        rv = GetMsgHdrForViewIndex(i, getter_AddRefs(msgHdr));
-        NS_ASSERTION(NS_SUCCEEDED(rv) && msgHdr, "header not found");
-        NS_ENSURE_SUCCESS(rv, rv);
-        rv = GetCollationKey(msgHdr, sortType, info->key, colHandler);
+        rv = GetSortCollationKey(i, info->id, info->folder, sortType,
+                                 colHandler, info->key);
         NS_ENSURE_SUCCESS(rv, rv);
       }
       // Perform the sort.
@@ -4441,11 +4584,8 @@ NS_IMETHODIMP nsMsgDBView::Sort(nsMsgViewSortTypeValue sortType,
         if (sortType == nsMsgViewSortType::byId) {
           info->dword = info->id;  // No msgHdr required.
         } else {
-          nsCOMPtr<nsIMsgDBHdr> msgHdr;
-          rv = GetMsgHdrForViewIndex(i, getter_AddRefs(msgHdr));
-          NS_ASSERTION(NS_SUCCEEDED(rv) && msgHdr, "header not found");
-          NS_ENSURE_SUCCESS(rv, rv);
-          rv = GetLongField(msgHdr, sortType, &info->dword, colHandler);
+          rv = GetSortValue(i, info->id, info->folder, sortType, colHandler,
+                            &info->dword);
           NS_ENSURE_SUCCESS(rv, rv);
         }
       }
@@ -4469,6 +4609,106 @@ NS_IMETHODIMP nsMsgDBView::Sort(nsMsgViewSortTypeValue sortType,
   }
 }
 
+// Sort() for views with many rows. All the sort keys are extracted first,
+// so that the sort itself doesn't call back into the view; numeric keys are
+// then radix sorted, and collation keys are merge sorted on several threads.
+// The resulting order is the one the comparison functions define, with ties
+// on the secondary sort broken by message key.
+nsresult nsMsgDBView::SortLargeView(nsMsgViewSortTypeValue sortType,
+                                    nsMsgViewSortOrderValue sortOrder,
+                                    eFieldType fieldType,
+                                    nsIMsgCustomColumnHandler *colHandler) {
+  uint32_t arraySize = GetSize();
+  nsCOMArray<nsIMsgFolder> *folders = GetFolders();
+  nsresult rv;
+
+  nsMsgViewSortKeys primaryKeys(fieldType == kCollationKey,
+                                sortOrder == nsMsgViewSortOrder::ascending);
+  primaryKeys.SetCapacity(arraySize);
+  nsTArray<uint8_t> collationKey;
+  for (uint32_t i = 0; i < arraySize; ++i) {
+    nsIMsgFolder *folder = folders ? folders->ObjectAt(i) : m_folder.get();
+    if (fieldType == kCollationKey) {
+      rv = GetSortCollationKey(i, m_keys[i], folder, sortType, colHandler,
+                               collationKey);
+      NS_ENSURE_SUCCESS(rv, rv);
+      primaryKeys.AppendCollationKey(collationKey);
+    } else {
+      uint32_t value = m_keys[i];  // byId needs no msgHdr.
+      if (sortType != nsMsgViewSortType::byId) {
+        rv = GetSortValue(i, m_keys[i], folder, sortType, colHandler, &value);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+      primaryKeys.AppendValue(value);
+    }
+  }
+
+  // The secondary sort, as SecondaryCompare() would do it.
+  mozilla::UniquePtr<nsMsgViewSortKeys> secondaryKeys;
+  nsIMsgCustomColumnHandler *secondaryColHandler = nullptr;
+  if (m_secondarySort == nsMsgViewSortType::byCustom &&
+      m_sortColumns.Length() > 1)
+    secondaryColHandler = m_sortColumns[1].mColHandler;
+  uint16_t maxLen;
+  eFieldType secondaryFieldType;
+  if (m_secondarySort != sortType &&
+      NS_SUCCEEDED(GetFieldTypeAndLenForSort(m_secondarySort, &maxLen,
+                                             &secondaryFieldType,
+                                             secondaryColHandler))) {
+    secondaryKeys = mozilla::MakeUnique<nsMsgViewSortKeys>(
+        secondaryFieldType == kCollationKey,
+        m_secondarySortOrder == nsMsgViewSortOrder::ascending);
+    secondaryKeys->SetCapacity(arraySize);
+    for (uint32_t i = 0; i < arraySize; ++i) {
+      nsIMsgFolder *folder = folders ? folders->ObjectAt(i) : m_folder.get();
+      if (secondaryFieldType == kCollationKey) {
+        rv = GetSortCollationKey(i, m_keys[i], folder, m_secondarySort,
+                                 secondaryColHandler, collationKey);
+        NS_ENSURE_SUCCESS(rv, rv);
+        secondaryKeys->AppendCollationKey(collationKey);
+      } else {
+        uint32_t value = m_keys[i];
+        if (m_secondarySort != nsMsgViewSortType::byId) {
+          rv = GetSortValue(i, m_keys[i], folder, m_secondarySort,
+                            secondaryColHandler, &value);
+          NS_ENSURE_SUCCESS(rv, rv);
+        }
+        secondaryKeys->AppendValue(value);
+      }
+    }
+  }
+
+  nsTArray<uint32_t> rows;
+  rows.SetCapacity(arraySize);
+  for (uint32_t i = 0; i < arraySize; ++i) rows.AppendElement(i);
+  uint32_t numThreads = gLargeSortThreads > 0
+                            ? gLargeSortThreads
+                            : std::max(PR_GetNumberOfProcessors(), 1);
+  MsgViewSortRows(primaryKeys, secondaryKeys.get(), m_keys, numThreads, rows);
+
+  // Now update the view state to reflect the new order.
+  nsTArray<nsMsgKey> keys;
+  nsTArray<uint32_t> flags;
+  nsCOMArray<nsIMsgFolder> sortedFolders;
+  keys.SetCapacity(arraySize);
+  flags.SetCapacity(arraySize);
+  for (uint32_t i = 0; i < arraySize; ++i) {
+    keys.AppendElement(m_keys[rows[i]]);
+    flags.AppendElement(m_flags[rows[i]]);
+    if (folders) sortedFolders.AppendObject(folders->ObjectAt(rows[i]));
+  }
+  m_keys.SwapElements(keys);
+  m_flags.SwapElements(flags);
+  if (folders) {
+    for (uint32_t i = 0; i < arraySize; ++i)
+      folders->ReplaceObjectAt(sortedFolders[i], i);
+  }
+  m_sortType = sortType;
+  m_sortOrder = sortOrder;
+  m_sortValid = true;
+  return NS_OK;
+}
+
 nsMsgViewIndex nsMsgDBView::GetIndexOfFirstDisplayedKeyInThread(
     nsIMsgThread *threadHdr, bool allowDummy) {
   nsMsgViewIndex retIndex = nsMsgViewIndex_None;
@@ -5812,6 +6052,8 @@ NS_IMETHODIMP
 nsMsgDBView::OnHdrFlagsChanged(nsIMsgDBHdr *aHdrChanged, uint32_t aOldFlags,
                                uint32_t aNewFlags,
                                nsIDBChangeListener *aInstigator) {
+  InvalidateSortKeys(aHdrChanged);
+
   // If we're not the instigator, update flags if this key is in our view.
   if (aInstigator != this) {
     NS_ENSURE_ARG_POINTER(aHdrChanged);
@@ -5850,6 +6092,7 @@ nsMsgDBView::OnHdrFlagsChanged(nsIMsgDBHdr *aHdrChanged, uint32_t aOldFlags,
 NS_IMETHODIMP
 nsMsgDBView::OnHdrDeleted(nsIMsgDBHdr *aHdrChanged, nsMsgKey aParentKey,
                           int32_t aFlags, nsIDBChangeListener *aInstigator) {
+  InvalidateSortKeys(aHdrChanged);
   nsMsgViewIndex deletedIndex = FindHdr(aHdrChanged);
   if (IsValidIndex(deletedIndex)) {
     // Check if this message is currently selected. If it is, tell the frontend
@@ -5881,6 +6124,7 @@ nsMsgDBView::OnHdrPropertyChanged(nsIMsgDBHdr *aHdrToChange, bool aPreChange,
   if (aPreChange) return NS_OK;
 
   if (aHdrToChange) {
+    InvalidateSortKeys(aHdrToChange);
     nsMsgViewIndex index = FindHdr(aHdrToChange);
     if (index != nsMsgViewIndex_None)
       NoteChange(index, 1, nsMsgViewNotificationCode::changed);
@@ -5905,6 +6149,7 @@ nsMsgDBView::OnAnnouncerGoingAway(nsIDBChangeAnnouncer *instigator) {
 
   int32_t saveSize = GetSize();
   ClearHdrCache();
+  m_sortKeyCache.Clear();
 
   // This is important, because the tree will ask us for our
   // row count, which get determine from the number of keys.
@@ -28,6 +28,7 @@
 #include "nsTHashtable.h"
 #include "nsHashKeys.h"
 #include "nsIMsgCustomColumnHandler.h"
+#include "nsMsgViewSortKeyCache.h"
 #include "nsAutoPtr.h"
 #include "nsIWeakReferenceUtils.h"
 #include "nsSimpleEnumerator.h"
@@ -351,6 +352,22 @@ class nsMsgDBView : public nsIMsgDBView,
   nsresult GetCollationKey(nsIMsgDBHdr *msgHdr, nsMsgViewSortTypeValue sortType,
                            nsTArray<uint8_t> &result,
                            nsIMsgCustomColumnHandler *colHandler = nullptr);
+  uint32_t GetSortKeyCacheColumn(nsMsgViewSortTypeValue sortType,
+                                 nsIMsgFolder *folder);
+  nsresult GetSortValue(nsMsgViewIndex index, nsMsgKey key,
+                        nsIMsgFolder *folder, nsMsgViewSortTypeValue sortType,
+                        nsIMsgCustomColumnHandler *colHandler,
+                        uint32_t *result);
+  nsresult GetSortCollationKey(nsMsgViewIndex index, nsMsgKey key,
+                               nsIMsgFolder *folder,
+                               nsMsgViewSortTypeValue sortType,
+                               nsIMsgCustomColumnHandler *colHandler,
+                               nsTArray<uint8_t> &result);
+  void InvalidateSortKeys(nsIMsgDBHdr *msgHdr);
+  nsresult SortLargeView(nsMsgViewSortTypeValue sortType,
+                         nsMsgViewSortOrderValue sortOrder,
+                         eFieldType fieldType,
+                         nsIMsgCustomColumnHandler *colHandler);
   nsresult GetLongField(nsIMsgDBHdr *msgHdr, nsMsgViewSortTypeValue sortType,
                         uint32_t *result,
                         nsIMsgCustomColumnHandler *colHandler = nullptr);
@@ -420,6 +437,12 @@ class nsMsgDBView : public nsIMsgDBView,
   nsCOMPtr<nsIMsgDBHdr> m_cachedHdr;
   nsMsgKey m_cachedMsgKey;
 
+  // Sort keys of the messages we've sorted, by column.
+  nsMsgViewSortKeyCache m_sortKeyCache;
+  // mail.displayname.version when the display name columns of
+  // m_sortKeyCache were filled in.
+  int32_t m_sortKeyDisplayNameVersion;
+
   // We need to store the message key for the message we are currently
   // displaying to ensure we don't try to redisplay the same message just
   // because the selection changed (i.e. after a sort).
@@ -94,6 +94,7 @@ void nsFolderCompactState::CleanupTempFilesAfterError() {
   GetSummaryFileLocation(m_file, getter_AddRefs(summaryFile));
   m_file->Remove(false);
   summaryFile->Remove(false);
+  RemoveSummaryIndexFile(summaryFile);
 }
 
 nsresult nsFolderCompactState::BuildMessageURI(const char *baseURI,
@@ -453,6 +454,10 @@ nsresult nsFolderCompactState::FinishCompact() {
   NS_ENSURE_SUCCESS(rv, rv);
   nsAutoCString dbName;
   oldSummaryFile->GetNativeLeafName(dbName);
+  // The compacted db is saved without a message id index, so the old
+  // summary's index goes with it.
+  nsCOMPtr<nsIFile> oldIndexFile;
+  GetSummaryIndexFile(oldSummaryFile, getter_AddRefs(oldIndexFile));
   nsAutoCString folderName;
   path->GetNativeLeafName(folderName);
 
@@ -542,6 +547,7 @@ nsresult nsFolderCompactState::FinishCompact() {
     }
     // We don't want any temporarily renamed summary file to lie around
     if (tempSummaryFile) tempSummaryFile->Remove(false);
+    if (msfRenameSucceeded && oldIndexFile) oldIndexFile->Remove(false);
   }
 
   NS_WARNING_ASSERTION(msfRenameSucceeded, "compact failed");
@@ -227,6 +227,7 @@ nsMsgQuickSearchDBView::OnHdrPropertyChanged(nsIMsgDBHdr *aHdrChanged,
 
   NS_ENSURE_ARG_POINTER(aStatus);
   NS_ENSURE_ARG_POINTER(aHdrChanged);
+  if (!aPreChange) InvalidateSortKeys(aHdrChanged);
 
   nsMsgViewIndex index = FindHdr(aHdrChanged);
   if (index == nsMsgViewIndex_None)  // message does not appear in view
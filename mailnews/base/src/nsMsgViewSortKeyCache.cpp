@@ -0,0 +1,175 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "msgCore.h"
+#include "nsMsgViewSortKeyCache.h"
+
+// Don't bother compacting a column until this many slots have gone stale.
+static const uint32_t kMinStaleSlotsToCompact = 1024;
+// Past these, the cache starts over rather than keep growing.
+static const int32_t kMaxFolders = 1024;
+static const uint32_t kMaxSlotsPerColumn = 1 << 20;
+static const uint32_t kMaxKeyBufferSize = 32 * 1024 * 1024;
+
+nsMsgViewSortKeyCache::nsMsgViewSortKeyCache() {}
+
+nsMsgViewSortKeyCache::~nsMsgViewSortKeyCache() {}
+
+nsMsgViewSortKeyCache::Column *nsMsgViewSortKeyCache::FindColumn(
+    uint32_t aColumn, bool aCreate) {
+  MOZ_ASSERT(aColumn, "0 is not a valid sort key column");
+  for (uint32_t i = 0; i < m_columns.Length(); i++) {
+    if (m_columns[i]->mId == aColumn) return m_columns[i].get();
+  }
+  if (!aCreate) return nullptr;
+  return m_columns.AppendElement(mozilla::MakeUnique<Column>(aColumn))->get();
+}
+
+bool nsMsgViewSortKeyCache::GetRowKey(nsIMsgFolder *aFolder, nsMsgKey aKey,
+                                      bool aCreate, uint64_t *aRowKey) {
+  int32_t folderIndex = m_folders.IndexOf(aFolder);
+  if (folderIndex < 0) {
+    if (!aCreate) return false;
+    if (m_folders.Count() >= kMaxFolders) Clear();
+    folderIndex = m_folders.Count();
+    m_folders.AppendObject(aFolder);
+  }
+  *aRowKey = (uint64_t(folderIndex) << 32) | aKey;
+  return true;
+}
+
+bool nsMsgViewSortKeyCache::GetValue(uint32_t aColumn, nsIMsgFolder *aFolder,
+                                     nsMsgKey aKey, uint32_t *aValue) {
+  uint64_t rowKey;
+  Column *column = FindColumn(aColumn, false);
+  uint32_t slot;
+  if (!column || !GetRowKey(aFolder, aKey, false, &rowKey) ||
+      !column->mSlots.Get(rowKey, &slot))
+    return false;
+  *aValue = column->mValues[slot];
+  return true;
+}
+
+void nsMsgViewSortKeyCache::PutValue(uint32_t aColumn, nsIMsgFolder *aFolder,
+                                     nsMsgKey aKey, uint32_t aValue) {
+  uint64_t rowKey;
+  // The row key first, since that may clear the cache.
+  GetRowKey(aFolder, aKey, true, &rowKey);
+  Column *column = FindColumn(aColumn, true);
+  uint32_t slot;
+  if (column->mSlots.Get(rowKey, &slot)) {
+    column->mValues[slot] = aValue;
+    return;
+  }
+  MakeRoom(column, 0);
+  column->mSlots.Put(rowKey, column->mValues.Length());
+  column->mValues.AppendElement(aValue);
+}
+
+bool nsMsgViewSortKeyCache::GetCollationKey(uint32_t aColumn,
+                                            nsIMsgFolder *aFolder,
+                                            nsMsgKey aKey,
+                                            nsTArray<uint8_t> &aCollationKey) {
+  uint64_t rowKey;
+  Column *column = FindColumn(aColumn, false);
+  uint32_t slot;
+  if (!column || !GetRowKey(aFolder, aKey, false, &rowKey) ||
+      !column->mSlots.Get(rowKey, &slot))
+    return false;
+  aCollationKey.ReplaceElementsAt(
+      0, aCollationKey.Length(),
+      column->mKeyBuffer.Elements() + column->mValues[slot],
+      column->mKeyLengths[slot]);
+  return true;
+}
+
+void nsMsgViewSortKeyCache::PutCollationKey(
+    uint32_t aColumn, nsIMsgFolder *aFolder, nsMsgKey aKey,
+    const nsTArray<uint8_t> &aCollationKey) {
+  uint64_t rowKey;
+  GetRowKey(aFolder, aKey, true, &rowKey);
+  Column *column = FindColumn(aColumn, true);
+  // Collation keys don't get overwritten in place since their length may
+  // change; the old one just goes stale.
+  InvalidateSlot(column, rowKey);
+  MakeRoom(column, aCollationKey.Length());
+  column->mSlots.Put(rowKey, column->mValues.Length());
+  column->mValues.AppendElement(column->mKeyBuffer.Length());
+  column->mKeyLengths.SetLength(column->mValues.Length());
+  column->mKeyLengths.LastElement() = aCollationKey.Length();
+  column->mKeyBuffer.AppendElements(aCollationKey);
+}
+
+void nsMsgViewSortKeyCache::InvalidateSlot(Column *aColumn, uint64_t aRowKey) {
+  if (!aColumn->mSlots.Remove(aRowKey)) return;
+  if (++aColumn->mStaleSlots >= kMinStaleSlotsToCompact &&
+      aColumn->mStaleSlots > aColumn->mSlots.Count())
+    Compact(aColumn);
+}
+
+void nsMsgViewSortKeyCache::Invalidate(nsIMsgFolder *aFolder, nsMsgKey aKey) {
+  uint64_t rowKey;
+  if (!GetRowKey(aFolder, aKey, false, &rowKey)) return;
+  for (uint32_t i = 0; i < m_columns.Length(); i++)
+    InvalidateSlot(m_columns[i].get(), rowKey);
+}
+
+// Makes sure a column has room for one more slot, with a collation key of
+// aKeyLength bytes: stale slots are compacted away, and if that isn't enough
+// the column is emptied.
+void nsMsgViewSortKeyCache::MakeRoom(Column *aColumn, uint32_t aKeyLength) {
+  if (aColumn->mValues.Length() < kMaxSlotsPerColumn &&
+      aColumn->mKeyBuffer.Length() + aKeyLength <= kMaxKeyBufferSize)
+    return;
+  if (aColumn->mStaleSlots) Compact(aColumn);
+  if (aColumn->mValues.Length() < kMaxSlotsPerColumn &&
+      aColumn->mKeyBuffer.Length() + aKeyLength <= kMaxKeyBufferSize)
+    return;
+  aColumn->mSlots.Clear();
+  aColumn->mValues.Clear();
+  aColumn->mKeyLengths.Clear();
+  aColumn->mKeyBuffer.Clear();
+  aColumn->mStaleSlots = 0;
+}
+
+void nsMsgViewSortKeyCache::ClearColumn(uint32_t aColumn) {
+  for (uint32_t i = 0; i < m_columns.Length(); i++) {
+    if (m_columns[i]->mId == aColumn) {
+      m_columns.RemoveElementAt(i);
+      return;
+    }
+  }
+}
+
+// Rewrites the arrays of a column without its stale slots.
+void nsMsgViewSortKeyCache::Compact(Column *aColumn) {
+  bool hasCollationKeys = !aColumn->mKeyLengths.IsEmpty();
+  nsTArray<uint32_t> values;
+  nsTArray<uint32_t> keyLengths;
+  nsTArray<uint8_t> keyBuffer;
+  values.SetCapacity(aColumn->mSlots.Count());
+  for (auto iter = aColumn->mSlots.Iter(); !iter.Done(); iter.Next()) {
+    uint32_t slot = iter.Data();
+    iter.Data() = values.Length();
+    if (hasCollationKeys) {
+      values.AppendElement(keyBuffer.Length());
+      keyLengths.AppendElement(aColumn->mKeyLengths[slot]);
+      keyBuffer.AppendElements(
+          aColumn->mKeyBuffer.Elements() + aColumn->mValues[slot],
+          aColumn->mKeyLengths[slot]);
+    } else {
+      values.AppendElement(aColumn->mValues[slot]);
+    }
+  }
+  aColumn->mValues.SwapElements(values);
+  aColumn->mKeyLengths.SwapElements(keyLengths);
+  aColumn->mKeyBuffer.SwapElements(keyBuffer);
+  aColumn->mStaleSlots = 0;
+}
+
+void nsMsgViewSortKeyCache::Clear() {
+  m_columns.Clear();
+  m_folders.Clear();
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef _nsMsgViewSortKeyCache_H_
+#define _nsMsgViewSortKeyCache_H_
+
+#include "MailNewsTypes.h"
+#include "nsCOMArray.h"
+#include "nsDataHashtable.h"
+#include "nsHashKeys.h"
+#include "nsIMsgFolder.h"
+#include "nsTArray.h"
+#include "mozilla/UniquePtr.h"
+
+// Per-view cache of the sort keys of messages, so that changing the sort
+// column back and forth doesn't have to fetch every header from the db and
+// build a new collation key for it each time.
+//
+// Keys are stored per sort column in columnar form: numeric values in a
+// uint32_t array, and collation keys packed into one contiguous byte buffer
+// with an offset and length per message. The view invalidates the entries of
+// a message when the message changes, and they get filled in again the next
+// time the view sorts on that column. The cache is bounded: a column that
+// fills up, or the whole cache once it has seen too many folders, is dropped
+// and starts over.
+class nsMsgViewSortKeyCache {
+ public:
+  nsMsgViewSortKeyCache();
+  ~nsMsgViewSortKeyCache();
+
+  // aColumn identifies the sort column (and whatever view state the key
+  // depends on), and must not be 0.
+  bool GetValue(uint32_t aColumn, nsIMsgFolder *aFolder, nsMsgKey aKey,
+                uint32_t *aValue);
+  void PutValue(uint32_t aColumn, nsIMsgFolder *aFolder, nsMsgKey aKey,
+                uint32_t aValue);
+  bool GetCollationKey(uint32_t aColumn, nsIMsgFolder *aFolder, nsMsgKey aKey,
+                       nsTArray<uint8_t> &aCollationKey);
+  void PutCollationKey(uint32_t aColumn, nsIMsgFolder *aFolder, nsMsgKey aKey,
+                       const nsTArray<uint8_t> &aCollationKey);
+
+  // Drops the cached keys of a message, in all columns.
+  void Invalidate(nsIMsgFolder *aFolder, nsMsgKey aKey);
+  // Drops all the cached keys of a column.
+  void ClearColumn(uint32_t aColumn);
+  void Clear();
+
+ protected:
+  struct Column {
+    explicit Column(uint32_t aId) : mId(aId), mStaleSlots(0) {}
+    uint32_t mId;
+    // Message -> index into mValues (and mKeyLengths).
+    nsDataHashtable<nsUint64HashKey, uint32_t> mSlots;
+    // The numeric key, or the offset of the collation key in mKeyBuffer.
+    nsTArray<uint32_t> mValues;
+    nsTArray<uint32_t> mKeyLengths;
+    nsTArray<uint8_t> mKeyBuffer;
+    // Slots no longer referenced from mSlots.
+    uint32_t mStaleSlots;
+  };
+
+  Column *FindColumn(uint32_t aColumn, bool aCreate);
+  bool GetRowKey(nsIMsgFolder *aFolder, nsMsgKey aKey, bool aCreate,
+                 uint64_t *aRowKey);
+  void InvalidateSlot(Column *aColumn, uint64_t aRowKey);
+  void MakeRoom(Column *aColumn, uint32_t aKeyLength);
+  void Compact(Column *aColumn);
+
+  nsTArray<mozilla::UniquePtr<Column>> m_columns;
+  // Folders seen so far; a message is identified by the index of its folder
+  // in here together with its key.
+  nsCOMArray<nsIMsgFolder> m_folders;
+};
+
+#endif
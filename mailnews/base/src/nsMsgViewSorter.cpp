@@ -0,0 +1,297 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "msgCore.h"
+#include "nsMsgViewSorter.h"
+#include "nsComponentManagerUtils.h"
+#include "nsIObserver.h"
+#include "nsIObserverService.h"
+#include "nsIThreadPool.h"
+#include "nsThreadUtils.h"
+#include "mozilla/Monitor.h"
+#include "mozilla/Services.h"
+#include "mozilla/StaticPtr.h"
+#include <algorithm>
+
+using mozilla::Monitor;
+using mozilla::MonitorAutoLock;
+
+nsMsgViewSortKeys::nsMsgViewSortKeys(bool aCollationKeys, bool aAscending)
+    : mCollationKeys(aCollationKeys), mAscending(aAscending) {}
+
+void nsMsgViewSortKeys::SetCapacity(uint32_t aRows) {
+  mValues.SetCapacity(aRows);
+  if (mCollationKeys) mKeyLengths.SetCapacity(aRows);
+}
+
+void nsMsgViewSortKeys::AppendValue(uint32_t aValue) {
+  MOZ_ASSERT(!mCollationKeys);
+  mValues.AppendElement(aValue);
+}
+
+void nsMsgViewSortKeys::AppendCollationKey(const nsTArray<uint8_t> &aKey) {
+  MOZ_ASSERT(mCollationKeys);
+  mValues.AppendElement(mKeyBuffer.Length());
+  mKeyLengths.AppendElement(aKey.Length());
+  mKeyBuffer.AppendElements(aKey);
+}
+
+int nsMsgViewSortKeys::Compare(uint32_t aRow1, uint32_t aRow2) const {
+  int result;
+  if (mCollationKeys) {
+    // Raw collation keys are compared bytewise, which is also what
+    // nsIMsgDatabase::CompareCollationKeys does; we can't call that here
+    // since we may be on a worker thread.
+    uint32_t len1 = mKeyLengths[aRow1];
+    uint32_t len2 = mKeyLengths[aRow2];
+    result = memcmp(mKeyBuffer.Elements() + mValues[aRow1],
+                    mKeyBuffer.Elements() + mValues[aRow2],
+                    std::min(len1, len2));
+    if (!result) result = (len1 > len2) - (len1 < len2);
+  } else {
+    result = (mValues[aRow1] > mValues[aRow2]) -
+             (mValues[aRow1] < mValues[aRow2]);
+  }
+  return mAscending ? result : -result;
+}
+
+// Orders rows by all the sort criteria; see MsgViewSortRows().
+class RowComparator {
+ public:
+  RowComparator(const nsMsgViewSortKeys &aPrimary,
+                const nsMsgViewSortKeys *aSecondary,
+                const nsTArray<nsMsgKey> &aIds)
+      : mPrimary(aPrimary), mSecondary(aSecondary), mIds(aIds) {}
+
+  bool operator()(uint32_t aRow1, uint32_t aRow2) const {
+    int result = mPrimary.Compare(aRow1, aRow2);
+    if (!result && mSecondary) result = mSecondary->Compare(aRow1, aRow2);
+    if (result) return result < 0;
+    if (mIds[aRow1] != mIds[aRow2]) return mIds[aRow1] < mIds[aRow2];
+    return aRow1 < aRow2;
+  }
+
+ private:
+  const nsMsgViewSortKeys &mPrimary;
+  const nsMsgViewSortKeys *mSecondary;
+  const nsTArray<nsMsgKey> &mIds;
+};
+
+// One stable LSD radix sort pass over aRows, by the 11-bit digit of aKeys
+// at aShift. Returns false (and leaves aRows alone) if every row has the
+// same digit there.
+template <typename KeyFunc>
+static bool RadixPass(nsTArray<uint32_t> &aRows, nsTArray<uint32_t> &aTemp,
+                      KeyFunc aKey, uint32_t aShift) {
+  const uint32_t kBuckets = 1 << 11;
+  uint32_t counts[kBuckets] = {0};
+  uint32_t length = aRows.Length();
+  for (uint32_t i = 0; i < length; i++)
+    counts[(aKey(aRows[i]) >> aShift) & (kBuckets - 1)]++;
+  if (counts[(aKey(aRows[0]) >> aShift) & (kBuckets - 1)] == length)
+    return false;
+
+  uint32_t total = 0;
+  for (uint32_t b = 0; b < kBuckets; b++) {
+    uint32_t count = counts[b];
+    counts[b] = total;
+    total += count;
+  }
+  aTemp.SetLength(length);
+  for (uint32_t i = 0; i < length; i++) {
+    uint32_t row = aRows[i];
+    aTemp[counts[(aKey(row) >> aShift) & (kBuckets - 1)]++] = row;
+  }
+  aRows.SwapElements(aTemp);
+  return true;
+}
+
+template <typename KeyFunc>
+static void RadixSortRows(nsTArray<uint32_t> &aRows, nsTArray<uint32_t> &aTemp,
+                          KeyFunc aKey) {
+  for (uint32_t shift = 0; shift < 32; shift += 11)
+    RadixPass(aRows, aTemp, aKey, shift);
+}
+
+struct SortChunk {
+  uint32_t *mBegin;
+  uint32_t *mMiddle;
+  uint32_t *mEnd;
+  uint32_t *mOut;
+  const RowComparator *mComparator;
+};
+
+static void SortChunkThreadFunc(void *aArg) {
+  SortChunk *chunk = static_cast<SortChunk *>(aArg);
+  std::stable_sort(chunk->mBegin, chunk->mEnd, *chunk->mComparator);
+}
+
+static void MergeChunkThreadFunc(void *aArg) {
+  SortChunk *chunk = static_cast<SortChunk *>(aArg);
+  std::merge(chunk->mBegin, chunk->mMiddle, chunk->mMiddle, chunk->mEnd,
+             chunk->mOut, *chunk->mComparator);
+}
+
+// Worker threads shared by all views, so that a sort doesn't have to start
+// threads of its own. Created on first use, and shut down with XPCOM.
+static mozilla::StaticRefPtr<nsIThreadPool> sSortPool;
+
+class SortPoolShutdownObserver final : public nsIObserver {
+ public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_NSIOBSERVER
+
+ private:
+  ~SortPoolShutdownObserver() {}
+};
+
+NS_IMPL_ISUPPORTS(SortPoolShutdownObserver, nsIObserver)
+
+NS_IMETHODIMP
+SortPoolShutdownObserver::Observe(nsISupports *aSubject, const char *aTopic,
+                                  const char16_t *aData) {
+  if (sSortPool) {
+    sSortPool->Shutdown();
+    sSortPool = nullptr;
+  }
+  return NS_OK;
+}
+
+static nsIThreadPool *GetSortPool() {
+  MOZ_ASSERT(NS_IsMainThread());
+  if (sSortPool) return sSortPool;
+
+  nsCOMPtr<nsIObserverService> observerService =
+      mozilla::services::GetObserverService();
+  if (!observerService) return nullptr;
+  nsCOMPtr<nsIThreadPool> pool =
+      do_CreateInstance("@mozilla.org/thread-pool;1");
+  if (!pool) return nullptr;
+  pool->SetName(NS_LITERAL_CSTRING("MsgViewSort"));
+  // The calling thread sorts a chunk too.
+  pool->SetThreadLimit(kMsgViewSortMaxThreads - 1);
+  pool->SetIdleThreadLimit(kMsgViewSortMaxThreads - 1);
+  nsresult rv = observerService->AddObserver(new SortPoolShutdownObserver(),
+                                             "xpcom-shutdown-threads", false);
+  if (NS_FAILED(rv)) {
+    pool->Shutdown();
+    return nullptr;
+  }
+  sSortPool = pool;
+  return sSortPool;
+}
+
+// Runs aFunc on each chunk, on the sort pool except for the last one, which
+// runs on the calling thread, and waits for all of them. If the pool isn't
+// available, or won't take a chunk, that chunk runs on the calling thread
+// too.
+static void RunOnThreads(nsTArray<SortChunk> &aChunks,
+                         void (*aFunc)(void *)) {
+  uint32_t count = aChunks.Length();
+  if (!count) return;
+  nsIThreadPool *pool = count > 1 ? GetSortPool() : nullptr;
+  Monitor monitor("MsgViewSortRows");
+  uint32_t pending = 0;
+  for (uint32_t i = 0; i + 1 < count; i++) {
+    SortChunk *chunk = &aChunks[i];
+    if (pool) {
+      nsCOMPtr<nsIRunnable> task = NS_NewRunnableFunction(
+          "MsgViewSortRows", [chunk, aFunc, &monitor, &pending]() {
+            aFunc(chunk);
+            MonitorAutoLock lock(monitor);
+            if (!--pending) lock.Notify();
+          });
+      {
+        MonitorAutoLock lock(monitor);
+        pending++;
+      }
+      if (NS_SUCCEEDED(pool->Dispatch(task, NS_DISPATCH_NORMAL))) continue;
+      MonitorAutoLock lock(monitor);
+      pending--;
+    }
+    aFunc(chunk);
+  }
+  aFunc(&aChunks[count - 1]);
+  MonitorAutoLock lock(monitor);
+  while (pending) lock.Wait();
+}
+
+static void ParallelMergeSortRows(nsTArray<uint32_t> &aRows,
+                                  nsTArray<uint32_t> &aTemp,
+                                  const RowComparator &aComparator,
+                                  uint32_t aNumThreads) {
+  uint32_t length = aRows.Length();
+  uint32_t numChunks = std::max(1U, std::min(aNumThreads, length / 1024));
+
+  // Sort the chunks independently...
+  nsTArray<SortChunk> chunks;
+  AutoTArray<uint32_t, 9> bounds;
+  for (uint32_t i = 0; i <= numChunks; i++)
+    bounds.AppendElement(uint64_t(length) * i / numChunks);
+  for (uint32_t i = 0; i < numChunks; i++) {
+    SortChunk *chunk = chunks.AppendElement();
+    chunk->mBegin = aRows.Elements() + bounds[i];
+    chunk->mMiddle = nullptr;
+    chunk->mEnd = aRows.Elements() + bounds[i + 1];
+    chunk->mOut = nullptr;
+    chunk->mComparator = &aComparator;
+  }
+  RunOnThreads(chunks, SortChunkThreadFunc);
+
+  // ...then merge neighbouring runs pairwise until only one is left.
+  aTemp.SetLength(length);
+  while (bounds.Length() > 2) {
+    AutoTArray<uint32_t, 9> mergedBounds;
+    chunks.Clear();
+    uint32_t i = 0;
+    for (; i + 2 < bounds.Length(); i += 2) {
+      SortChunk *chunk = chunks.AppendElement();
+      chunk->mBegin = aRows.Elements() + bounds[i];
+      chunk->mMiddle = aRows.Elements() + bounds[i + 1];
+      chunk->mEnd = aRows.Elements() + bounds[i + 2];
+      chunk->mOut = aTemp.Elements() + bounds[i];
+      chunk->mComparator = &aComparator;
+      mergedBounds.AppendElement(bounds[i]);
+    }
+    // An odd run out is copied over as is.
+    if (i + 1 < bounds.Length()) {
+      memcpy(aTemp.Elements() + bounds[i], aRows.Elements() + bounds[i],
+             (bounds[i + 1] - bounds[i]) * sizeof(uint32_t));
+      mergedBounds.AppendElement(bounds[i]);
+    }
+    mergedBounds.AppendElement(length);
+    RunOnThreads(chunks, MergeChunkThreadFunc);
+    aRows.SwapElements(aTemp);
+    bounds.SwapElements(mergedBounds);
+  }
+}
+
+void MsgViewSortRows(const nsMsgViewSortKeys &aPrimary,
+                     const nsMsgViewSortKeys *aSecondary,
+                     const nsTArray<nsMsgKey> &aIds, uint32_t aNumThreads,
+                     nsTArray<uint32_t> &aRows) {
+  if (aRows.Length() < 2) return;
+
+  nsTArray<uint32_t> temp;
+  if (!aPrimary.HasCollationKeys() &&
+      !(aSecondary && aSecondary->HasCollationKeys())) {
+    // Least significant criterion first; every pass is stable. The row index
+    // criterion comes for free, since the rows start out in order.
+    RadixSortRows(aRows, temp, [&aIds](uint32_t aRow) { return aIds[aRow]; });
+    if (aSecondary)
+      RadixSortRows(aRows, temp, [aSecondary](uint32_t aRow) {
+        return aSecondary->OrderedValue(aRow);
+      });
+    RadixSortRows(aRows, temp, [&aPrimary](uint32_t aRow) {
+      return aPrimary.OrderedValue(aRow);
+    });
+    return;
+  }
+
+  RowComparator comparator(aPrimary, aSecondary, aIds);
+  ParallelMergeSortRows(
+      aRows, temp, comparator,
+      std::min(std::max(aNumThreads, 1U), kMsgViewSortMaxThreads));
+}
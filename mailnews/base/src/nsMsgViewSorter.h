@@ -0,0 +1,58 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef _nsMsgViewSorter_H_
+#define _nsMsgViewSorter_H_
+
+#include "MailNewsTypes.h"
+#include "nsTArray.h"
+
+// The sort keys of every row of a view for one sort column, extracted up
+// front so that sorting doesn't have to call back into the view or the db,
+// and can run off the main thread.
+class nsMsgViewSortKeys {
+ public:
+  nsMsgViewSortKeys(bool aCollationKeys, bool aAscending);
+
+  void SetCapacity(uint32_t aRows);
+  void AppendValue(uint32_t aValue);
+  void AppendCollationKey(const nsTArray<uint8_t> &aKey);
+
+  bool HasCollationKeys() const { return mCollationKeys; }
+  uint32_t Length() const { return mValues.Length(); }
+
+  // Compares two rows, taking the sort direction into account.
+  int Compare(uint32_t aRow1, uint32_t aRow2) const;
+  // The numeric key of a row, transformed so that ascending order of the
+  // result is the sort order of the column.
+  uint32_t OrderedValue(uint32_t aRow) const {
+    return mAscending ? mValues[aRow] : ~mValues[aRow];
+  }
+
+ protected:
+  bool mCollationKeys;
+  bool mAscending;
+  // The numeric keys, or the offsets of the collation keys in mKeyBuffer.
+  nsTArray<uint32_t> mValues;
+  nsTArray<uint32_t> mKeyLengths;
+  nsTArray<uint8_t> mKeyBuffer;
+};
+
+// Sort engine for large views. Sorts aRows, which must hold the row indices
+// 0..n-1 on entry, by aPrimary, then aSecondary if it is not null, then by
+// ascending aIds, and finally by row index. That is a total order, so the
+// result is the same as that of a stable sort.
+//
+// If there are only numeric keys, the rows are radix sorted. Otherwise they
+// are merge sorted, on up to aNumThreads threads (at most
+// kMsgViewSortMaxThreads), which come from a thread pool shared by all views.
+// Must be called on the main thread.
+static const uint32_t kMsgViewSortMaxThreads = 8;
+void MsgViewSortRows(const nsMsgViewSortKeys &aPrimary,
+                     const nsMsgViewSortKeys *aSecondary,
+                     const nsTArray<nsMsgKey> &aIds, uint32_t aNumThreads,
+                     nsTArray<uint32_t> &aRows);
+
+#endif
@@ -147,6 +147,7 @@ nsMsgXFVirtualFolderDBView::OnHdrPropertyChanged(
 
   NS_ENSURE_ARG_POINTER(aStatus);
   NS_ENSURE_ARG_POINTER(aHdrChanged);
+  if (!aPreChange) InvalidateSortKeys(aHdrChanged);
 
   nsMsgViewIndex index = FindHdr(aHdrChanged);
   // Message does not appear in view.
@@ -0,0 +1,144 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/*
+ * Tests offline search of plain ASCII headers, which are matched without
+ * being decoded, against encoded ones, which are decoded as before, and
+ * checks that reordering the terms of a boolean run doesn't change results.
+ */
+
+/* import-globals-from ../../../test/resources/messageGenerator.js */
+load("../../../resources/messageGenerator.js");
+
+var Contains = Ci.nsMsgSearchOp.Contains;
+var DoesntContain = Ci.nsMsgSearchOp.DoesntContain;
+var Is = Ci.nsMsgSearchOp.Is;
+var Isnt = Ci.nsMsgSearchOp.Isnt;
+var BeginsWith = Ci.nsMsgSearchOp.BeginsWith;
+var EndsWith = Ci.nsMsgSearchOp.EndsWith;
+var IsGreaterThan = Ci.nsMsgSearchOp.IsGreaterThan;
+
+var Subject = Ci.nsMsgSearchAttrib.Subject;
+var Sender = Ci.nsMsgSearchAttrib.Sender;
+var ToOrCC = Ci.nsMsgSearchAttrib.ToOrCC;
+var Size = Ci.nsMsgSearchAttrib.Size;
+
+var gInbox;
+
+add_task(function setupMessages() {
+  localAccountUtils.loadLocalMailAccount();
+  gInbox = localAccountUtils.inboxFolder;
+
+  let generator = new MessageGenerator();
+  let alice = ["Alice Zq", "zq-alice@example.invalid"];
+  let report = generator.makeMessage({
+    subject: "Quarterly Report",
+    from: alice,
+  });
+  let messages = [
+    report,
+    // "Quarterly Überblick", only visible after decoding.
+    generator.makeMessage({
+      subject: "=?UTF-8?B?UXVhcnRlcmx5IMOcYmVyYmxpY2s=?=",
+    }),
+    generator.makeMessage({ subject: "Lunch plans", from: alice }),
+    // Stored as "Quarterly Report" with the HasRe flag.
+    generator.makeMessage({ inReplyTo: report }),
+  ];
+  addMessagesToFolder(messages, gInbox);
+  Assert.equal(gInbox.getTotalMessages(false), 4);
+});
+
+/**
+ * Runs an offline search of the inbox and resolves with the hit count.
+ *
+ * @param aTerms  array of [attrib, op, string value, booleanAnd,
+ *                beginsGrouping, endsGrouping]
+ */
+function search(aTerms) {
+  return new Promise(resolve => {
+    let hits = 0;
+    let session = Cc["@mozilla.org/messenger/searchSession;1"].createInstance(
+      Ci.nsIMsgSearchSession
+    );
+    session.addScopeTerm(Ci.nsMsgSearchScope.offlineMail, gInbox);
+    for (let [attrib, op, str, and, begins, ends] of aTerms) {
+      let term = session.createTerm();
+      term.attrib = attrib;
+      let value = term.value;
+      value.attrib = attrib;
+      if (attrib == Size) {
+        value.size = str;
+      } else {
+        value.str = str;
+      }
+      term.value = value;
+      term.op = op;
+      term.booleanAnd = and;
+      term.beginsGrouping = !!begins;
+      term.endsGrouping = !!ends;
+      session.appendTerm(term);
+    }
+    session.registerListener({
+      onSearchHit(dbHdr, folder) {
+        hits++;
+      },
+      onSearchDone(status) {
+        resolve(hits);
+      },
+      onNewSearch() {
+        hits = 0;
+      },
+    });
+    session.search(null);
+  });
+}
+
+add_task(async function testSingleTerms() {
+  let tests = [
+    [Subject, Contains, "QUARTERLY", 3],
+    [Subject, DoesntContain, "quarterly", 1],
+    [Subject, BeginsWith, "quarterly", 2],
+    [Subject, BeginsWith, "re: quarterly", 1],
+    [Subject, EndsWith, "REPORT", 2],
+    [Subject, Is, "quarterly report", 1],
+    [Subject, Isnt, "quarterly report", 3],
+    [Subject, Contains, "überblick", 1],
+    [Subject, Contains, "berblick", 1],
+    [Sender, Contains, "ZQ-ALICE@", 2],
+    [ToOrCC, Contains, "zq-alice", 1],
+  ];
+  for (let [attrib, op, str, count] of tests) {
+    Assert.equal(await search([[attrib, op, str, true]]), count, str);
+  }
+});
+
+add_task(async function testReorderedRuns() {
+  // Subject contains "quarterly" && Size > 0 || From contains "zq-alice"
+  Assert.equal(
+    await search([
+      [Subject, Contains, "quarterly", true],
+      [Size, IsGreaterThan, 0, true],
+      [Sender, Contains, "zq-alice", false],
+    ]),
+    4
+  );
+  // (Subject contains "lunch" || Subject contains "report") && Size > 0
+  Assert.equal(
+    await search([
+      [Subject, Contains, "lunch", true, true, false],
+      [Subject, Contains, "report", false, false, true],
+      [Size, IsGreaterThan, 0, true],
+    ]),
+    3
+  );
+  // Subject contains "lunch" && Size > 1000000 (KB), which rejects early.
+  Assert.equal(
+    await search([
+      [Subject, Contains, "lunch", true],
+      [Size, IsGreaterThan, 1000000, true],
+    ]),
+    0
+  );
+});
@@ -0,0 +1,114 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that searching several offline folders at once, with the terms
+ * evaluated on the search thread pool (mailnews.search.threads), finds the
+ * same messages as searching them one at a time on the main thread.
+ */
+
+var kFolderCount = 5;
+var kMessagesPerFolder = 300; // more than one batch per folder
+
+var gFolders = [];
+var gExpected = [];
+
+add_task(function setupFolders() {
+  localAccountUtils.loadLocalMailAccount();
+  for (let f = 0; f < kFolderCount; f++) {
+    let folder = localAccountUtils.rootFolder.createLocalSubfolder("f" + f);
+    let db = folder.msgDatabase;
+    for (let i = 0; i < kMessagesPerFolder; i++) {
+      let hdr = db.CreateNewHdr(i + 1);
+      // Every tenth subject is "Überblick", which needs decoding first.
+      hdr.subject =
+        i % 10 ? "Subject " + (i % 37) : "=?UTF-8?B?w5xiZXJibGljaw==?=";
+      hdr.author = "Author " + (i % 11) + " <a" + f + "@example.invalid>";
+      hdr.messageSize = 1024 * (1 + ((i * 13) % 5));
+      db.AddNewHdrToDB(hdr, false);
+    }
+    db.Close(true);
+    gFolders.push(folder);
+  }
+});
+
+/**
+ * Searches all the folders and resolves with the "folder:key" of every hit,
+ * sorted.
+ *
+ * @param aTerms  array of [attrib, op, value]; values of Size terms are sizes
+ */
+function search(aTerms) {
+  return new Promise(resolve => {
+    let hits = [];
+    let session = Cc["@mozilla.org/messenger/searchSession;1"].createInstance(
+      Ci.nsIMsgSearchSession
+    );
+    for (let folder of gFolders) {
+      session.addScopeTerm(Ci.nsMsgSearchScope.offlineMail, folder);
+    }
+    for (let [attrib, op, str] of aTerms) {
+      let term = session.createTerm();
+      term.attrib = attrib;
+      let value = term.value;
+      value.attrib = attrib;
+      if (attrib == Ci.nsMsgSearchAttrib.Size) {
+        value.size = str;
+      } else {
+        value.str = str;
+      }
+      term.value = value;
+      term.op = op;
+      term.booleanAnd = true;
+      session.appendTerm(term);
+    }
+    session.registerListener({
+      onSearchHit(dbHdr, folder) {
+        hits.push(folder.name + ":" + dbHdr.messageKey);
+      },
+      onSearchDone(status) {
+        resolve(hits.sort());
+      },
+      onNewSearch() {
+        hits = [];
+      },
+    });
+    session.search(null);
+  });
+}
+
+var kSearches = [
+  [[Ci.nsMsgSearchAttrib.Subject, Ci.nsMsgSearchOp.Contains, "subject 1"]],
+  [[Ci.nsMsgSearchAttrib.Subject, Ci.nsMsgSearchOp.Contains, "berblick"]],
+  [
+    [Ci.nsMsgSearchAttrib.Sender, Ci.nsMsgSearchOp.Contains, "author 3"],
+    [Ci.nsMsgSearchAttrib.Size, Ci.nsMsgSearchOp.IsGreaterThan, 2],
+  ],
+  // Non-ASCII needles are only matched on the main thread.
+  [[Ci.nsMsgSearchAttrib.Subject, Ci.nsMsgSearchOp.Contains, "überblick"]],
+];
+
+add_task(async function testSerial() {
+  Services.prefs.setIntPref("mailnews.search.threads", 0);
+  for (let terms of kSearches) {
+    gExpected.push(await search(terms));
+  }
+  Assert.equal(gExpected[0].length, kFolderCount * 80);
+  Assert.equal(gExpected[1].length, kFolderCount * 30);
+  Assert.deepEqual(gExpected[3], gExpected[1]);
+});
+
+add_task(async function testParallel() {
+  Services.prefs.setIntPref("mailnews.search.threads", 2);
+  for (let parallelScopes of [1, 2, kFolderCount]) {
+    Services.prefs.setIntPref(
+      "mailnews.search.parallel_scopes",
+      parallelScopes
+    );
+    for (let i = 0; i < kSearches.length; i++) {
+      Assert.deepEqual(await search(kSearches[i]), gExpected[i]);
+    }
+  }
+  Services.prefs.clearUserPref("mailnews.search.threads");
+  Services.prefs.clearUserPref("mailnews.search.parallel_scopes");
+});
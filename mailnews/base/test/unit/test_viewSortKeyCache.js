@@ -0,0 +1,93 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that the sort keys nsMsgDBView caches for a view are dropped when a
+ * message changes: a view sorted again after a change to the subject, date
+ * or flags of a message puts it where its new value belongs.
+ */
+
+var kCount = 5;
+
+var gCommandUpdater = {
+  updateCommandStatus() {},
+  displayMessageChanged(aFolder, aSubject, aKeywords) {},
+  updateNextMessageAfterDelete() {},
+  summarizeSelection() {
+    return false;
+  },
+};
+
+function makeFolder() {
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder("sortKeys");
+  let db = folder.msgDatabase;
+  for (let i = 0; i < kCount; i++) {
+    let hdr = db.CreateNewHdr(i + 1);
+    hdr.subject = "Subject " + i;
+    hdr.author = "Author <a@example.invalid>";
+    hdr.date = (1500000000 + i * 3600) * 1000000;
+    hdr.flags = Ci.nsMsgMessageFlags.Marked;
+    db.AddNewHdrToDB(hdr, false);
+  }
+  return folder;
+}
+
+function openView(aFolder) {
+  let view = Cc["@mozilla.org/messenger/msgdbview;1?type=threaded"].createInstance(
+    Ci.nsIMsgDBView
+  );
+  view.init(null, null, gCommandUpdater);
+  view.open(
+    aFolder,
+    Ci.nsMsgViewSortType.byId,
+    Ci.nsMsgViewSortOrder.ascending,
+    Ci.nsMsgViewFlagsType.kNone,
+    {}
+  );
+  return view;
+}
+
+// Sorts by message key first, so the view really sorts by aSortType again
+// rather than keeping its order.
+function sortedKeys(aView, aSortType) {
+  aView.sort(Ci.nsMsgViewSortType.byId, Ci.nsMsgViewSortOrder.ascending);
+  aView.sort(aSortType, Ci.nsMsgViewSortOrder.ascending);
+  let keys = [];
+  for (let i = 0; i < aView.rowCount; i++) {
+    keys.push(aView.getKeyAt(i));
+  }
+  return keys;
+}
+
+function run_test() {
+  localAccountUtils.loadLocalMailAccount();
+  let folder = makeFolder();
+  let db = folder.msgDatabase;
+  let view = openView(folder);
+
+  // Each change moves message 1 from the front of the view to its end.
+  let changes = [
+    [
+      Ci.nsMsgViewSortType.bySubject,
+      hdr => db.setStringPropertyByHdr(hdr, "subject", "Subject 9"),
+    ],
+    [
+      Ci.nsMsgViewSortType.byDate,
+      hdr => db.setUint32PropertyByHdr(hdr, "date", 1600000000),
+    ],
+    [
+      Ci.nsMsgViewSortType.byFlagged,
+      hdr => db.MarkHdrMarked(hdr, false, null),
+    ],
+  ];
+  for (let [sortType, change] of changes) {
+    let keys = sortedKeys(view, sortType);
+    Assert.equal(keys[0], 1);
+
+    change(db.GetMsgHdrForKey(1));
+    keys = sortedKeys(view, sortType);
+    Assert.equal(keys.length, kCount);
+    Assert.equal(keys[kCount - 1], 1);
+  }
+  view.close();
+}
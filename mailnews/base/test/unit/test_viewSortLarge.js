@@ -0,0 +1,124 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that the sort engine nsMsgDBView uses for large views
+ * (mailnews.view.large_sort_threshold) orders messages the same way as the
+ * regular sort, and the same way on several threads as on one. The folders
+ * are big enough to be merge sorted in several chunks of 1024 rows or more,
+ * and not a multiple of that.
+ */
+
+var kFolderSizes = [2500, 5000];
+var kThreads = 8;
+
+var kSortTypes = [
+  [Ci.nsMsgViewSortType.byDate, hdr => hdr.date],
+  [Ci.nsMsgViewSortType.bySize, hdr => hdr.messageSize],
+  [Ci.nsMsgViewSortType.byPriority, hdr => hdr.priority],
+  [Ci.nsMsgViewSortType.bySubject, hdr => hdr.subject],
+  [Ci.nsMsgViewSortType.byAuthor, hdr => hdr.author],
+];
+
+var gCommandUpdater = {
+  updateCommandStatus() {},
+  displayMessageChanged(aFolder, aSubject, aKeywords) {},
+  updateNextMessageAfterDelete() {},
+  summarizeSelection() {
+    return false;
+  },
+};
+
+function makeFolder(aName, aCount) {
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder(aName);
+  let db = folder.msgDatabase;
+  // Few distinct values per column, so that the secondary sort and the
+  // message key tie-break both matter.
+  for (let i = 0; i < aCount; i++) {
+    let hdr = db.CreateNewHdr(i + 1);
+    hdr.subject = "Subject " + ((i * 7919) % 97);
+    hdr.author = "Author " + ((i * 104729) % 53) + " <a@example.invalid>";
+    hdr.date = (1500000000 + ((i * 31) % 1009) * 3600) * 1000000;
+    hdr.messageSize = 1000 + ((i * 13) % 211);
+    hdr.priority = 1 + (i % 6);
+    db.AddNewHdrToDB(hdr, false);
+  }
+  return folder;
+}
+
+function openView(aFolder) {
+  let view = Cc["@mozilla.org/messenger/msgdbview;1?type=threaded"].createInstance(
+    Ci.nsIMsgDBView
+  );
+  view.init(null, null, gCommandUpdater);
+  view.open(
+    aFolder,
+    Ci.nsMsgViewSortType.byId,
+    Ci.nsMsgViewSortOrder.ascending,
+    Ci.nsMsgViewFlagsType.kNone,
+    {}
+  );
+  return view;
+}
+
+// Sorts with the large view engine on aThreads threads if it's given, else
+// with the regular sort.
+function sortedKeys(aFolder, aSecondary, aSortType, aSortOrder, aThreads) {
+  Services.prefs.setIntPref(
+    "mailnews.view.large_sort_threshold",
+    aThreads ? 1 : 0
+  );
+  Services.prefs.setIntPref("mailnews.view.large_sort_threads", aThreads || 0);
+  let view = openView(aFolder);
+  view.sort(aSecondary, Ci.nsMsgViewSortOrder.descending);
+  view.sort(aSortType, aSortOrder);
+  let keys = [];
+  for (let i = 0; i < view.rowCount; i++) {
+    keys.push(view.getKeyAt(i));
+  }
+  view.close();
+  return keys;
+}
+
+function checkFolder(aFolder, aSize) {
+  let db = aFolder.msgDatabase;
+  // The regular sort doesn't break all ties consistently, so compare what
+  // the rows were sorted on rather than the message keys.
+  let sortValues = (aKeys, aValue) =>
+    aKeys.map(key => {
+      let hdr = db.GetMsgHdrForKey(key);
+      return aValue(hdr) + "|" + hdr.priority;
+    });
+  for (let [sortType, value] of kSortTypes) {
+    for (let sortOrder of [
+      Ci.nsMsgViewSortOrder.ascending,
+      Ci.nsMsgViewSortOrder.descending,
+    ]) {
+      let sort = aThreads =>
+        sortedKeys(
+          aFolder,
+          Ci.nsMsgViewSortType.byPriority,
+          sortType,
+          sortOrder,
+          aThreads
+        );
+      let regular = sort(0);
+      let single = sort(1);
+      let parallel = sort(kThreads);
+      Assert.equal(parallel.length, aSize);
+      Assert.deepEqual(sortValues(single, value), sortValues(regular, value));
+      // The engine's order is total, so the keys have to be the same.
+      Assert.deepEqual(parallel, single);
+    }
+  }
+}
+
+function run_test() {
+  localAccountUtils.loadLocalMailAccount();
+
+  for (let size of kFolderSizes) {
+    checkFolder(makeFolder("sort" + size, size), size);
+  }
+  Services.prefs.clearUserPref("mailnews.view.large_sort_threshold");
+  Services.prefs.clearUserPref("mailnews.view.large_sort_threads");
+}
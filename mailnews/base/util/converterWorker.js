@@ -274,7 +274,7 @@ function isSBD(name) {
  */
 function isFileToCopy(name) {
   let ext4 = name.substr(-4);
-  if (ext4 == ".msf" || ext4 == ".dat") {
+  if (ext4 == ".msf" || ext4 == ".dat" || name.endsWith(".msf.idx")) {
     return true;
   }
   return false;
@@ -283,14 +283,14 @@ function isFileToCopy(name) {
 /**
  * Check if file is an mbox.
  * (actually we can't really tell if it's an mbox or not just from the name.
- * we just assume it is, if it's not .msf or .dat).
+ * we just assume it is, if it's not .msf, .msf.idx or .dat).
  *
  * @param {String} name     - Name of file to check.
  * @returns {Boolean}       - true if file is an mbox
  */
 function isMBoxName(name) {
   let ext4 = name.substr(-4);
-  if (ext4 == ".msf" || ext4 == ".dat") {
+  if (ext4 == ".msf" || ext4 == ".dat" || name.endsWith(".msf.idx")) {
     return false;
   }
   // Assume all other files are mbox.
@@ -20,6 +20,7 @@ var log = Log4Moz.getConfiguredLogger("mailnews.database.dbcache");
 /**
  */
 var DBCACHE_INTERVAL_DEFAULT_MS = 60000; // 1 minute
+var PREWARM_INTERVAL_MS = 50;
 
 /* :::::::: The Module ::::::::::::::: */
 
@@ -32,6 +33,11 @@ var msgDBCacheManager = {
 
   _dbService: null,
 
+  _prewarmTimer: null,
+
+  // Databases still being opened by prewarm().
+  _prewarmDBs: [],
+
   /**
    * This is called on startup
    */
@@ -50,6 +56,7 @@ var msgDBCacheManager = {
     Services.obs.addObserver(this, "quit-application-granted");
 
     this.startPeriodicCheck();
+    this.prewarm();
 
     this._initialized = true;
   },
@@ -70,6 +77,8 @@ var msgDBCacheManager = {
       case "quit-application-granted":
         Services.obs.removeObserver(this, "quit-application-granted");
         this.stopPeriodicCheck();
+        this._stopPrewarm();
+        this._recordRecentDBs();
         break;
     }
   },
@@ -105,10 +114,101 @@ var msgDBCacheManager = {
     }
   },
 
+  /**
+   * Starts opening the DBs of the folders recorded by _recordRecentDBs,
+   * all at once, so their summaries are parsed in parallel on the db open
+   * thread pool. Each DB is handed to its folder once it's open.
+   */
+  prewarm() {
+    let uris;
+    try {
+      uris = JSON.parse(
+        Services.prefs.getStringPref("mail.db.prewarm_folders")
+      );
+    } catch (ex) {
+      return;
+    }
+    let count = Services.prefs.getIntPref("mail.db.prewarm_count");
+    for (let uri of uris.slice(0, count)) {
+      let folder = MailServices.folderLookup.getFolderForURL(uri);
+      if (!folder || folder.databaseOpen) {
+        continue;
+      }
+      try {
+        this._prewarmDBs.push(this._dbService.asyncOpenFolderDB(folder, false));
+        log.debug("Prewarming DB for folder: " + folder.name);
+      } catch (ex) {
+        // Missing or out of date summaries are left for the folder to rebuild.
+      }
+    }
+    if (this._prewarmDBs.length == 0) {
+      return;
+    }
+    this._prewarmTimer = Cc["@mozilla.org/timer;1"].createInstance(Ci.nsITimer);
+    this._prewarmTimer.initWithCallback(
+      () => this._openMorePrewarmDBs(),
+      PREWARM_INTERVAL_MS,
+      Ci.nsITimer.TYPE_REPEATING_SLACK
+    );
+  },
+
+  _openMorePrewarmDBs() {
+    this._prewarmDBs = this._prewarmDBs.filter(db => {
+      try {
+        if (!this._dbService.openMore(db, 0)) {
+          return true;
+        }
+        if (!db.folder.databaseOpen) {
+          db.folder.msgDatabase = db;
+        }
+      } catch (ex) {
+        log.debug("Couldn't prewarm DB for folder: " + db.folder.name);
+      }
+      return false;
+    });
+    if (this._prewarmDBs.length == 0) {
+      this._stopPrewarm();
+    }
+  },
+
+  _stopPrewarm() {
+    if (this._prewarmTimer) {
+      this._prewarmTimer.cancel();
+      this._prewarmTimer = null;
+    }
+    this._prewarmDBs = [];
+  },
+
+  /**
+   * Remembers the folders of the most recently used DBs, for prewarm() to
+   * open at the next startup.
+   */
+  _recordRecentDBs() {
+    let count = Services.prefs.getIntPref("mail.db.prewarm_count");
+    let cachedDBs = this._dbService.openDBs;
+    let dbs = [];
+    for (let i = 0; i < cachedDBs.length; i++) {
+      let db = cachedDBs.queryElementAt(i, Ci.nsIMsgDatabase);
+      if (db.folder && db.folder.databaseOpen) {
+        dbs.push(db);
+      }
+    }
+    dbs.sort((a, b) => b.lastUseTime - a.lastUseTime);
+    let uris = dbs.slice(0, count).map(db => db.folder.URI);
+    Services.prefs.setStringPref(
+      "mail.db.prewarm_folders",
+      JSON.stringify(uris)
+    );
+  },
+
   /**
    * Checks if any DBs need to be closed due to inactivity or too many of them open.
    */
   checkCachedDBs() {
+    // Record the recent DBs before closing any, in case we don't get to see
+    // them at shutdown.
+    this._recordRecentDBs();
+
     let idleLimit = Services.prefs.getIntPref("mail.db.idle_limit");
     let maxOpenDBs = Services.prefs.getIntPref("mail.db.max_open");
 
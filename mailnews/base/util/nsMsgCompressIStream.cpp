@@ -73,6 +73,25 @@ nsresult nsMsgCompressIStream::DoInflation() {
   return NS_OK;
 }
 
+// Inflates the next piece of data, reading more from the wrapped stream if
+// the last piece has been inflated completely. This may leave m_dataleft 0
+// if the data read doesn't complete a block.
+nsresult nsMsgCompressIStream::ReadAndInflate() {
+  if (!m_inflateAgain) {
+    uint32_t bytesRead;
+    nsresult rv =
+        m_iStream->Read(m_zbuf.get(), (uint32_t)BUFFER_SIZE, &bytesRead);
+    // a non-blocking stream that is empty for now isn't an error.
+    if (rv == NS_BASE_STREAM_WOULD_BLOCK) return rv;
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (!bytesRead) return NS_BASE_STREAM_CLOSED;
+    m_zstream.next_in = (Bytef *)m_zbuf.get();
+    m_zstream.avail_in = bytesRead;
+  }
+
+  return DoInflation();
+}
+
 /* void close (); */
 NS_IMETHODIMP nsMsgCompressIStream::Close() { return CloseWithStatus(NS_OK); }
 
@@ -115,6 +134,21 @@ NS_IMETHODIMP nsMsgCompressIStream::Available(uint64_t *aResult) {
     return NS_OK;
   }
 
+  // A non-blocking stream can't be read any further than what has arrived,
+  // so inflate that now and give the exact count, which may well be 0.
+  bool nonBlocking = false;
+  m_iStream->IsNonBlocking(&nonBlocking);
+  if (nonBlocking) {
+    uint64_t rawAvailable = 0;
+    while (!m_dataleft && NS_SUCCEEDED(m_iStream->Available(&rawAvailable)) &&
+           rawAvailable) {
+      nsresult rv = ReadAndInflate();
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    *aResult = m_dataleft;
+    return NS_OK;
+  }
+
   // this value isn't accurate, but will give a good true/false
   // indication for idle purposes, and next read will fill
   // m_dataleft, so we'll have an accurate count for the next call.
@@ -145,18 +179,8 @@ NS_IMETHODIMP nsMsgCompressIStream::Read(char *aBuf, uint32_t aCount,
   // possible that multiple inflate passes will be required to
   // consume all of m_zbuf.
   while (!m_dataleft) {
-    // get some more data if we don't already have any
-    if (!m_inflateAgain) {
-      uint32_t bytesRead;
-      nsresult rv =
-          m_iStream->Read(m_zbuf.get(), (uint32_t)BUFFER_SIZE, &bytesRead);
-      NS_ENSURE_SUCCESS(rv, rv);
-      if (!bytesRead) return NS_BASE_STREAM_CLOSED;
-      m_zstream.next_in = (Bytef *)m_zbuf.get();
-      m_zstream.avail_in = bytesRead;
-    }
-
-    nsresult rv = DoInflation();
+    nsresult rv = ReadAndInflate();
+    if (rv == NS_BASE_STREAM_WOULD_BLOCK) return rv;
     NS_ENSURE_SUCCESS(rv, rv);
   }
 
@@ -194,6 +218,8 @@ NS_IMETHODIMP nsMsgCompressIStream::AsyncWait(nsIInputStreamCallback *callback,
 
 /* boolean isNonBlocking (); */
 NS_IMETHODIMP nsMsgCompressIStream::IsNonBlocking(bool *aNonBlocking) {
+  // we block exactly when the wrapped stream does.
+  if (m_iStream) return m_iStream->IsNonBlocking(aNonBlocking);
   *aNonBlocking = false;
   return NS_OK;
 }
@@ -23,6 +23,7 @@ class NS_MSG_BASE nsMsgCompressIStream final : public nsIAsyncInputStream {
  protected:
   ~nsMsgCompressIStream();
   nsresult DoInflation();
+  nsresult ReadAndInflate();
   nsCOMPtr<nsIInputStream> m_iStream;
   mozilla::UniquePtr<char[]> m_zbuf;
   mozilla::UniquePtr<char[]> m_databuf;
@@ -3357,6 +3357,7 @@ NS_IMETHODIMP nsMsgDBFolder::DeleteStorage() {
     rv = summaryFile->Remove(false);
     NS_ENSURE_SUCCESS(rv, rv);
   }
+  RemoveSummaryIndexFile(summaryFile);
 
   // Ask the msgStore to delete the actual storage (mbox, maildir or whatever
   // else may be supported in future).
@@ -3794,6 +3795,7 @@ NS_IMETHODIMP nsMsgDBFolder::Rename(const nsAString &aNewName,
     rv = oldPathFile->MoveTo(nullptr, newDiskName);
   if (NS_SUCCEEDED(rv)) {
     newDiskName.AppendLiteral(SUMMARY_SUFFIX);
+    RenameSummaryIndexFile(oldSummaryFile, newDiskName);
     oldSummaryFile->MoveTo(nullptr, newDiskName);
   } else {
     ThrowAlertMsg("folderRenameFailed", msgWindow);
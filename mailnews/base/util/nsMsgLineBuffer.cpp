@@ -249,6 +249,72 @@ void nsMsgLineStreamBuffer::ClearBuffer() {
   m_numBytesInBuffer = 0;
 }
 
+// Reads what's available from aInputStream into the end of the buffer, or
+// half the buffer size if the stream is blocking. Sets *aStartOfNewData to
+// the data read. Returns false if the buffer couldn't be grown.
+bool nsMsgLineStreamBuffer::ReadFromStream(nsIInputStream *aInputStream,
+                                           char **aStartOfNewData,
+                                           uint32_t *aNumBytesCopied,
+                                           nsresult *prv) {
+  char *startOfLine = m_dataBuffer + m_startPos;
+  *aStartOfNewData = startOfLine + m_numBytesInBuffer;
+  *aNumBytesCopied = 0;
+
+  nsresult rv;
+  uint64_t numBytesInStream = 0;
+  bool nonBlockingStream;
+  aInputStream->IsNonBlocking(&nonBlockingStream);
+  rv = aInputStream->Available(&numBytesInStream);
+  if (NS_FAILED(rv)) {
+    if (prv) *prv = rv;
+    return false;
+  }
+  if (!nonBlockingStream && numBytesInStream == 0)  // if no data available,
+    numBytesInStream = m_dataBufferSize / 2;        // ask for half the data
+                                                    // buffer size.
+
+  // if the number of bytes we want to read from the stream, is greater than
+  // the number of bytes left in our buffer, then we need to shift the start
+  // pos and its contents down to the beginning of m_dataBuffer...
+  uint32_t numFreeBytesInBuffer =
+      m_dataBufferSize - m_startPos - m_numBytesInBuffer;
+  if (numBytesInStream >= numFreeBytesInBuffer) {
+    if (m_startPos) {
+      memmove(m_dataBuffer, startOfLine, m_numBytesInBuffer);
+      // make sure the end of the buffer is terminated
+      m_dataBuffer[m_numBytesInBuffer] = '\0';
+      m_startPos = 0;
+      startOfLine = m_dataBuffer;
+      numFreeBytesInBuffer = m_dataBufferSize - m_numBytesInBuffer;
+    }
+    // If we didn't make enough space (or any), grow the buffer
+    if (numBytesInStream >= numFreeBytesInBuffer) {
+      int64_t growBy = (numBytesInStream - numFreeBytesInBuffer) * 2 + 1;
+      // GrowBuffer cannot handle over 4GB size.
+      if (m_dataBufferSize + growBy > PR_UINT32_MAX) return false;
+      // try growing buffer by twice as much as we need.
+      nsresult rv = GrowBuffer(m_dataBufferSize + growBy);
+      // if we can't grow the buffer, we have to bail.
+      if (NS_FAILED(rv)) return false;
+      startOfLine = m_dataBuffer;
+      numFreeBytesInBuffer += growBy;
+    }
+    NS_ASSERTION(m_startPos == 0, "m_startPos should be 0 .....");
+  }
+
+  uint32_t numBytesToCopy = /* leave one for a null terminator */
+      std::min(uint64_t(numFreeBytesInBuffer - 1), numBytesInStream);
+  *aStartOfNewData = startOfLine + m_numBytesInBuffer;
+  if (numBytesToCopy > 0) {
+    // read the data into the end of our data buffer
+    rv = aInputStream->Read(*aStartOfNewData, numBytesToCopy, aNumBytesCopied);
+    if (prv) *prv = rv;
+    m_numBytesInBuffer += *aNumBytesCopied;
+    m_dataBuffer[m_startPos + m_numBytesInBuffer] = '\0';
+  }
+  return true;
+}
+
 // aInputStream - the input stream we want to read a line from
 // aPauseForMoreData is returned as true if the stream does not yet contain a
 // line and we must wait for more data to come into the stream. Note to people
@@ -275,77 +341,26 @@ char *nsMsgLineStreamBuffer::ReadNextLine(nsIInputStream *aInputStream,
   char *endOfLine = nullptr;
   char *startOfLine = m_dataBuffer + m_startPos;
 
+  // The buffer holds the data as read, NULs included, so that ReadNextBytes
+  // can hand it out unchanged.
   if (m_numBytesInBuffer > 0)  // any data in our internal buffer?
-    endOfLine = PL_strchr(startOfLine, m_lineToken);  // see if we already
-                                                      // have a line ending...
+    endOfLine = (char *)memchr(startOfLine, m_lineToken,
+                               m_numBytesInBuffer);  // see if we already
+                                                     // have a line ending...
 
   // it's possible that we got here before the first time we receive data from
   // the server so aInputStream will be nullptr...
   if (!endOfLine && aInputStream)  // get some more data from the server
   {
-    nsresult rv;
-    uint64_t numBytesInStream = 0;
-    uint32_t numBytesCopied = 0;
-    bool nonBlockingStream;
-    aInputStream->IsNonBlocking(&nonBlockingStream);
-    rv = aInputStream->Available(&numBytesInStream);
-    if (NS_FAILED(rv)) {
-      if (prv) *prv = rv;
-      aNumBytesInLine = 0;
+    char *startOfNewData;
+    uint32_t numBytesCopied;
+    if (!ReadFromStream(aInputStream, &startOfNewData, &numBytesCopied, prv))
       return nullptr;
-    }
-    if (!nonBlockingStream && numBytesInStream == 0)  // if no data available,
-      numBytesInStream = m_dataBufferSize / 2;        // ask for half the data
-                                                      // buffer size.
-
-    // if the number of bytes we want to read from the stream, is greater than
-    // the number of bytes left in our buffer, then we need to shift the start
-    // pos and its contents down to the beginning of m_dataBuffer...
-    uint32_t numFreeBytesInBuffer =
-        m_dataBufferSize - m_startPos - m_numBytesInBuffer;
-    if (numBytesInStream >= numFreeBytesInBuffer) {
-      if (m_startPos) {
-        memmove(m_dataBuffer, startOfLine, m_numBytesInBuffer);
-        // make sure the end of the buffer is terminated
-        m_dataBuffer[m_numBytesInBuffer] = '\0';
-        m_startPos = 0;
-        startOfLine = m_dataBuffer;
-        numFreeBytesInBuffer = m_dataBufferSize - m_numBytesInBuffer;
-      }
-      // If we didn't make enough space (or any), grow the buffer
-      if (numBytesInStream >= numFreeBytesInBuffer) {
-        int64_t growBy = (numBytesInStream - numFreeBytesInBuffer) * 2 + 1;
-        // GrowBuffer cannot handle over 4GB size.
-        if (m_dataBufferSize + growBy > PR_UINT32_MAX) return nullptr;
-        // try growing buffer by twice as much as we need.
-        nsresult rv = GrowBuffer(m_dataBufferSize + growBy);
-        // if we can't grow the buffer, we have to bail.
-        if (NS_FAILED(rv)) return nullptr;
-        startOfLine = m_dataBuffer;
-        numFreeBytesInBuffer += growBy;
-      }
-      NS_ASSERTION(m_startPos == 0, "m_startPos should be 0 .....");
-    }
-
-    uint32_t numBytesToCopy = /* leave one for a null terminator */
-        std::min(uint64_t(numFreeBytesInBuffer - 1), numBytesInStream);
-    if (numBytesToCopy > 0) {
-      // read the data into the end of our data buffer
-      char *startOfNewData = startOfLine + m_numBytesInBuffer;
-      rv = aInputStream->Read(startOfNewData, numBytesToCopy, &numBytesCopied);
-      if (prv) *prv = rv;
-      uint32_t i;
-      for (i = 0; i < numBytesCopied; i++)  // replace nulls with spaces
-      {
-        if (!startOfNewData[i]) startOfNewData[i] = ' ';
-      }
-      m_numBytesInBuffer += numBytesCopied;
-      m_dataBuffer[m_startPos + m_numBytesInBuffer] = '\0';
-
-      // okay, now that we've tried to read in more data from the stream,
-      // look for another end of line character in the new data
-      endOfLine = PL_strchr(startOfNewData, m_lineToken);
-    }
+    startOfLine = m_dataBuffer + m_startPos;
+    // okay, now that we've tried to read in more data from the stream,
+    // look for another end of line character in the new data
+    if (numBytesCopied > 0)
+      endOfLine = (char *)memchr(startOfNewData, m_lineToken, numBytesCopied);
   }
 
   // okay, now check again for endOfLine.
@@ -369,6 +384,10 @@ char *nsMsgLineStreamBuffer::ReadNextLine(nsIInputStream *aInputStream,
 
     memcpy(newLine, startOfLine,
            aNumBytesInLine);  // copy the string into the new line buffer
+    for (uint32_t i = 0; i < aNumBytesInLine; i++)  // replace nulls with spaces
+    {
+      if (!newLine[i]) newLine[i] = ' ';
+    }
     if (addLineTerminator) {
       memcpy(newLine + aNumBytesInLine, MSG_LINEBREAK, MSG_LINEBREAK_LEN);
       aNumBytesInLine += MSG_LINEBREAK_LEN;
@@ -393,7 +412,42 @@ char *nsMsgLineStreamBuffer::ReadNextLine(nsIInputStream *aInputStream,
                    // buffer yet...need to wait for more data...
 }
 
+char *nsMsgLineStreamBuffer::ReadNextBytes(nsIInputStream *aInputStream,
+                                           uint32_t aMaxBytes,
+                                           uint32_t &aNumBytes,
+                                           bool &aPauseForMoreData,
+                                           nsresult *prv) {
+  if (prv) *prv = NS_OK;
+  aPauseForMoreData = false;
+  aNumBytes = 0;
+
+  if (!m_numBytesInBuffer && aInputStream) {
+    char *startOfNewData;
+    uint32_t numBytesCopied;
+    if (!ReadFromStream(aInputStream, &startOfNewData, &numBytesCopied, prv))
+      return nullptr;
+  }
+  if (!m_numBytesInBuffer || !aMaxBytes) {
+    aPauseForMoreData = true;
+    return nullptr;
+  }
+
+  aNumBytes = std::min(aMaxBytes, m_numBytesInBuffer);
+  char *newBytes = (char *)PR_Malloc(aNumBytes + 1);
+  if (!newBytes) {
+    aNumBytes = 0;
+    aPauseForMoreData = true;
+    return nullptr;
+  }
+  memcpy(newBytes, m_dataBuffer + m_startPos, aNumBytes);
+  newBytes[aNumBytes] = '\0';
+
+  m_numBytesInBuffer -= aNumBytes;
+  m_startPos = m_numBytesInBuffer ? m_startPos + aNumBytes : 0;
+  return newBytes;
+}
+
 bool nsMsgLineStreamBuffer::NextLineAvailable() {
   return (m_numBytesInBuffer > 0 &&
-          PL_strchr(m_dataBuffer + m_startPos, m_lineToken));
+          memchr(m_dataBuffer + m_startPos, m_lineToken, m_numBytesInBuffer));
 }
@@ -101,12 +101,20 @@ class NS_MSG_BASE nsMsgLineStreamBuffer {
   char *ReadNextLine(nsIInputStream *aInputStream, uint32_t &aNumBytesInLine,
                      bool &aPauseForMoreData, nsresult *rv = nullptr,
                      bool addLineTerminator = false);
+  // Like ReadNextLine, but returns up to aMaxBytes of the data as it came,
+  // whether or not it ends a line, and without replacing NULs. The returned
+  // buffer is NUL terminated, and must be freed using PR_Free.
+  char *ReadNextBytes(nsIInputStream *aInputStream, uint32_t aMaxBytes,
+                      uint32_t &aNumBytes, bool &aPauseForMoreData,
+                      nsresult *rv = nullptr);
   nsresult GrowBuffer(uint32_t desiredSize);
   void ClearBuffer();
   bool NextLineAvailable();
 
  private:
   virtual ~nsMsgLineStreamBuffer();
+  bool ReadFromStream(nsIInputStream *aInputStream, char **aStartOfNewData,
+                      uint32_t *aNumBytesCopied, nsresult *prv);
 
  protected:
   bool m_eatCRLFs;
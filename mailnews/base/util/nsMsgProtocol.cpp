@@ -56,6 +56,7 @@ static char16_t *FormatStringWithHostNameByName(const char16_t *stringName,
 nsMsgProtocol::nsMsgProtocol(nsIURI *aURL) {
   m_flags = 0;
   m_readCount = 0;
+  m_readSegmentSize = 0;
   mLoadFlags = 0;
   m_socketIsOpen = false;
   mContentLength = -1;
@@ -458,7 +459,8 @@ nsresult nsMsgProtocol::LoadUrl(nsIURI *aURL, nsISupports *aConsumer) {
       if (m_transport) {
         // open buffered, asynchronous input stream
         nsCOMPtr<nsIInputStream> stream;
-        rv = m_transport->OpenInputStream(0, 0, 0, getter_AddRefs(stream));
+        rv = m_transport->OpenInputStream(0, m_readSegmentSize, 0,
+                                          getter_AddRefs(stream));
         if (NS_FAILED(rv)) return rv;
 
         // m_readCount can be -1 which means "read as much as we can".
@@ -1131,6 +1133,7 @@ nsMsgAsyncWriteProtocol::nsMsgAsyncWriteProtocol(nsIURI *aURL)
   mSuspendedReadBytes = 0;
   mSuspendedRead = false;
   mInsertPeriodRequired = false;
+  mDotStuffPostData = true;
   mGenerateProgressNotifications = false;
   mSuspendedReadBytesPostPeriod = 0;
   mFilePostHelper = nullptr;
@@ -1214,8 +1217,10 @@ nsresult nsMsgAsyncWriteProtocol::UpdateSuspendedReadBytes(
 }
 
 nsresult nsMsgAsyncWriteProtocol::PostDataFinished() {
-  nsresult rv = SendData("." CRLF);
-  if (NS_FAILED(rv)) return rv;
+  if (mDotStuffPostData) {
+    nsresult rv = SendData("." CRLF);
+    if (NS_FAILED(rv)) return rv;
+  }
   mGenerateProgressNotifications = false;
   mPostDataStream = nullptr;
   return NS_OK;
@@ -1244,7 +1249,8 @@ nsresult nsMsgAsyncWriteProtocol::ProcessIncomingPostData(nsIInputStream *inStr,
     while (count > 0) {
       bool found = false;
       uint32_t offset = 0;
-      bufferInputStr->Search("\012.", true, &found, &offset);  // LF.
+      if (mDotStuffPostData)
+        bufferInputStr->Search("\012.", true, &found, &offset);  // LF.
 
       if (!found || offset > count) {
         // push this data into the output stream
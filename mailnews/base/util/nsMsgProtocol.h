@@ -147,6 +147,8 @@ class NS_MSG_BASE nsMsgProtocol : public nsIStreamListener,
   uint32_t m_flags;     // used to store flag information
   // uint32_t  m_startPosition;
   int64_t m_readCount;
+  // segment size of the pipe OpenFileSocket reads through; 0 for the default
+  uint32_t m_readSegmentSize;
 
   nsCOMPtr<nsIFile>
       m_tempMsgFile;  // we currently have a hack where displaying a msg
@@ -219,6 +221,9 @@ class NS_MSG_BASE nsMsgAsyncWriteProtocol : public nsMsgProtocol,
   bool mSuspendedRead;
   bool mInsertPeriodRequired;  // do we need to insert a '.' as part of the
                                // unblocking process
+  bool mDotStuffPostData;  // quote leading '.'s and end the post with a '.'
+                           // line; protocols that frame the data some other
+                           // way (SMTP BDAT) clear this before posting.
 
   nsresult ProcessIncomingPostData(nsIInputStream *inStr, uint32_t count);
   nsresult UnblockPostReader();
@@ -1229,6 +1229,43 @@ nsresult GetSummaryFileLocation(nsIFile *fileLocation,
   return NS_OK;
 }
 
+nsresult GetSummaryIndexFile(nsIFile *summaryFile, nsIFile **indexFile) {
+  NS_ENSURE_ARG_POINTER(summaryFile);
+  nsCOMPtr<nsIFile> newIndexFile;
+  nsresult rv = summaryFile->Clone(getter_AddRefs(newIndexFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoString fileName;
+  rv = newIndexFile->GetLeafName(fileName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  fileName.AppendLiteral(SUMMARY_INDEX_SUFFIX);
+  rv = newIndexFile->SetLeafName(fileName);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  newIndexFile.forget(indexFile);
+  return NS_OK;
+}
+
+void RemoveSummaryIndexFile(nsIFile *summaryFile) {
+  nsCOMPtr<nsIFile> indexFile;
+  if (NS_SUCCEEDED(GetSummaryIndexFile(summaryFile, getter_AddRefs(indexFile))))
+    indexFile->Remove(false);
+}
+
+void RenameSummaryIndexFile(nsIFile *summaryFile,
+                            const nsAString &newSummaryName) {
+  nsCOMPtr<nsIFile> indexFile;
+  if (NS_FAILED(GetSummaryIndexFile(summaryFile, getter_AddRefs(indexFile))))
+    return;
+  bool exists = false;
+  if (NS_FAILED(indexFile->Exists(&exists)) || !exists) return;
+
+  nsAutoString newName(newSummaryName);
+  newName.AppendLiteral(SUMMARY_INDEX_SUFFIX);
+  // an index left behind is ignored, but it may as well not be there
+  if (NS_FAILED(indexFile->MoveTo(nullptr, newName))) indexFile->Remove(false);
+}
+
 void MsgGenerateNowStr(nsACString &nowStr) {
   char dateBuf[100];
   dateBuf[0] = '\0';
@@ -183,6 +183,15 @@ NS_MSG_BASE void MsgGenerateNowStr(nsACString &nowStr);
 NS_MSG_BASE nsresult GetSummaryFileLocation(nsIFile *fileLocation,
                                             nsIFile **summaryLocation);
 
+// The message id index of a summary file is kept next to it, e.g.
+// "Inbox.msf.idx", and has to be removed or renamed along with it. Renaming
+// has to happen before the summary file itself is moved.
+NS_MSG_BASE nsresult GetSummaryIndexFile(nsIFile *summaryFile,
+                                         nsIFile **indexFile);
+NS_MSG_BASE void RemoveSummaryIndexFile(nsIFile *summaryFile);
+NS_MSG_BASE void RenameSummaryIndexFile(nsIFile *summaryFile,
+                                        const nsAString &newSummaryName);
+
 // Gets a special directory and appends the supplied file name onto it.
 NS_MSG_BASE nsresult GetSpecialDirectoryWithFileName(const char *specialDirName,
                                                      const char *fileName,
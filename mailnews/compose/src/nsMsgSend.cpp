@@ -3037,13 +3037,22 @@ nsresult nsMsgComposeAndSend::DeliverFileAsMail() {
     // if the sendProgress isn't set, let's use the member variable.
     if (!msgStatus) msgStatus = mStatusFeedback;
 
+    // Messages from the Outbox may have to wait for a connection to the
+    // server; any other one is sent right away.
     nsCOMPtr<nsIURI> runningUrl;
-    rv = smtpService->SendMailMessage(
-        mTempFile, buf, mUserIdentity, mCompFields->GetFrom(), mSmtpPassword,
-        deliveryListener, msgStatus, callbacks, mCompFields->GetDSN(),
-        getter_AddRefs(runningUrl), getter_AddRefs(mRunningRequest));
+    if (m_deliver_mode == nsMsgSendUnsent)
+      rv = smtpService->SendUnsentMailMessage(
+          mTempFile, buf, mUserIdentity, mCompFields->GetFrom(), mSmtpPassword,
+          deliveryListener, msgStatus, callbacks, mCompFields->GetDSN(),
+          getter_AddRefs(runningUrl), getter_AddRefs(mRunningRequest));
+    else
+      rv = smtpService->SendMailMessage(
+          mTempFile, buf, mUserIdentity, mCompFields->GetFrom(), mSmtpPassword,
+          deliveryListener, msgStatus, callbacks, mCompFields->GetDSN(),
+          getter_AddRefs(runningUrl), getter_AddRefs(mRunningRequest));
     // set envid on the returned URL
     if (NS_SUCCEEDED(rv)) {
+      if (!mRunningRequest) mQueuedUrl = runningUrl;
       nsCOMPtr<nsISmtpUrl> smtpUrl(do_QueryInterface(runningUrl, &rv));
       if (NS_SUCCEEDED(rv))
         smtpUrl->SetDsnEnvid(nsDependentCString(mCompFields->GetMessageId()));
@@ -4370,7 +4379,14 @@ nsresult nsMsgComposeAndSend::Abort() {
   if (mRunningRequest) {
     mRunningRequest->Cancel(NS_ERROR_ABORT);
     mRunningRequest = nullptr;
+  } else if (mQueuedUrl) {
+    // The server stops it, whether it's still queued or running by now.
+    nsCOMPtr<nsISmtpUrl> smtpUrl(do_QueryInterface(mQueuedUrl));
+    nsCOMPtr<nsISmtpServer> smtpServer;
+    if (smtpUrl) smtpUrl->GetSmtpServer(getter_AddRefs(smtpServer));
+    if (smtpServer) smtpServer->CancelUrl(mQueuedUrl, NS_ERROR_ABORT);
   }
+  mQueuedUrl = nullptr;
 
   if (mCopyObj) {
     nsCOMPtr<nsIMsgCopyService> copyService =
@@ -300,6 +300,8 @@ class nsMsgComposeAndSend : public nsIMsgSend,
   nsCOMPtr<nsIMsgSendListener> mListener;
   nsCOMPtr<nsIMsgStatusFeedback> mStatusFeedback;
   nsCOMPtr<nsIRequest> mRunningRequest;
+  // An Outbox message queued for a connection has no request yet.
+  nsCOMPtr<nsIURI> mQueuedUrl;
   bool mSendMailAlso;
   nsCOMPtr<nsIFile>
       mReturnFile;  // a holder for file spec's to be returned to caller
@@ -45,6 +45,10 @@ NS_IMPL_ISUPPORTS(nsMsgSendLater, nsIMsgSendLater, nsIFolderListener,
 nsMsgSendLater::nsMsgSendLater() {
   mSendingMessages = false;
   mTimerSet = false;
+  mMessagesInFlight = 0;
+  mMaxMessagesInFlight = 1;
+  mSpooling = false;
+  mEndStatus = NS_OK;
   mTotalSentSuccessfully = 0;
   mTotalSendCount = 0;
   mLeftoverBuffer = nullptr;
@@ -196,6 +200,7 @@ nsMsgSendLater::OnStopRequest(nsIRequest *request, nsresult status) {
   }
 
   if (mOutFile) mOutFile->Close();
+  mSpooling = false;
 
   // See if we succeeded on reading the message from the message store?
   //
@@ -209,7 +214,11 @@ nsMsgSendLater::OnStopRequest(nsIRequest *request, nsresult status) {
 
     // If the send operation failed..try the next one...
     if (NS_FAILED(rv)) {
-      rv = StartNextMailFileSend(rv);
+      FinishMessage(mTotalSendCount, rv);
+    } else if (mSendingMessages) {
+      // Spool the next message while this one is being sent, unless the send
+      // has already ended.
+      rv = StartNextMailFileSend(NS_OK);
       if (NS_FAILED(rv))
         EndSendMessages(rv, nullptr, mTotalSendCount, mTotalSentSuccessfully);
     }
@@ -229,9 +238,8 @@ nsMsgSendLater::OnStopRequest(nsIRequest *request, nsresult status) {
 
     // Getting the data failed, but we will still keep trying to send the
     // rest...
-    rv = StartNextMailFileSend(status);
-    if (NS_FAILED(rv))
-      EndSendMessages(rv, nullptr, mTotalSendCount, mTotalSentSuccessfully);
+    FinishMessage(mTotalSendCount, status);
+    rv = NS_OK;
   }
 
   return rv;
@@ -358,8 +366,12 @@ nsMsgSendLater::OnStartRequest(nsIRequest *request) { return NS_OK; }
 NS_IMPL_ISUPPORTS(SendOperationListener, nsIMsgSendListener,
                   nsIMsgCopyServiceListener)
 
-SendOperationListener::SendOperationListener(nsMsgSendLater *aSendLater)
-    : mSendLater(aSendLater) {}
+SendOperationListener::SendOperationListener(nsMsgSendLater *aSendLater,
+                                             nsIMsgDBHdr *aMessage,
+                                             uint32_t aMessageNumber)
+    : mSendLater(aSendLater),
+      mMessage(aMessage),
+      mMessageNumber(aMessageNumber) {}
 
 SendOperationListener::~SendOperationListener(void) {}
 
@@ -404,7 +416,8 @@ NS_IMETHODIMP
 SendOperationListener::OnStopSending(const char *aMsgID, nsresult aStatus,
                                      const char16_t *aMsg,
                                      nsIFile *returnFile) {
-  if (mSendLater && !mSendLater->OnSendStepFinished(aStatus))
+  if (mSendLater &&
+      !mSendLater->OnSendStepFinished(aStatus, mMessage, mMessageNumber))
     mSendLater = nullptr;
 
   return NS_OK;
@@ -435,7 +448,7 @@ SendOperationListener::GetMessageId(nsACString &messageId) {
 NS_IMETHODIMP
 SendOperationListener::OnStopCopy(nsresult aStatus) {
   if (mSendLater) {
-    mSendLater->OnCopyStepFinished(aStatus);
+    mSendLater->OnCopyStepFinished(aStatus, mMessageNumber);
     mSendLater = nullptr;
   }
 
@@ -493,7 +506,8 @@ nsresult nsMsgSendLater::CompleteMailFileSend() {
 #endif
 
   // Create the listener for the send operation...
-  RefPtr<SendOperationListener> sendListener = new SendOperationListener(this);
+  RefPtr<SendOperationListener> sendListener =
+      new SendOperationListener(this, mMessage, mTotalSendCount);
 
   rv = pMsgSend->SendMessageFile(
       identity, mAccountKey,
@@ -508,13 +522,20 @@ nsresult nsMsgSendLater::CompleteMailFileSend() {
 }
 
 nsresult nsMsgSendLater::StartNextMailFileSend(nsresult prevStatus) {
+  // We'll be called again once the message being read has been handed over.
+  if (mSpooling) return NS_OK;
+
   bool hasMoreElements = false;
   if ((!mEnumerator) ||
       NS_FAILED(mEnumerator->HasMoreElements(&hasMoreElements)) ||
       !hasMoreElements) {
-    // Notify that this message has finished being sent.
-    NotifyListenersOnProgress(mTotalSendCount, mMessagesToSend.Count(), 100,
-                              100);
+    // Wait for the messages still being sent.
+    if (mMessagesInFlight) return NS_OK;
+
+    // There was nothing to send, but listeners still expect the progress.
+    if (!mTotalSendCount)
+      NotifyListenersOnProgress(mTotalSendCount, mMessagesToSend.Count(), 100,
+                                100);
 
     // EndSendMessages resets everything for us
     EndSendMessages(prevStatus, nullptr, mTotalSendCount,
@@ -525,11 +546,8 @@ nsresult nsMsgSendLater::StartNextMailFileSend(nsresult prevStatus) {
     return NS_OK;
   }
 
-  // If we've already sent a message, and are sending more, send out a progress
-  // update with 100% for both send and copy as we must have finished by now.
-  if (mTotalSendCount)
-    NotifyListenersOnProgress(mTotalSendCount, mMessagesToSend.Count(), 100,
-                              100);
+  // The next message has to wait until one of those being sent is done.
+  if (mMessagesInFlight >= mMaxMessagesInFlight) return NS_OK;
 
   nsCOMPtr<nsISupports> currentItem;
   nsresult rv = mEnumerator->GetNext(getter_AddRefs(currentItem));
@@ -580,10 +598,16 @@ nsresult nsMsgSendLater::StartNextMailFileSend(nsresult prevStatus) {
 
   // Now, get our stream listener interface and plug it into the DisplayMessage
   // operation
+  ++mMessagesInFlight;
+  mSpooling = true;
   nsCOMPtr<nsIURI> dummyNull;
   rv = messageService->DisplayMessage(
       messageURI.get(), static_cast<nsIStreamListener *>(this), nullptr,
       nullptr, nullptr, getter_AddRefs(dummyNull));
+  if (NS_FAILED(rv)) {
+    --mMessagesInFlight;
+    mSpooling = false;
+  }
 
   return rv;
 }
@@ -752,6 +776,16 @@ nsresult nsMsgSendLater::InternalSendMessages(bool aUserInitiated,
   mSendingMessages = true;
   mTotalSentSuccessfully = 0;
   mTotalSendCount = 0;
+  mMessagesInFlight = 0;
+  mSpooling = false;
+  mEndStatus = NS_OK;
+
+  int32_t maxMessagesInFlight = 4;
+  nsCOMPtr<nsIPrefBranch> prefs(do_GetService(NS_PREFSERVICE_CONTRACTID));
+  if (prefs)
+    prefs->GetIntPref("mailnews.sendLater.maxMessagesInFlight",
+                      &maxMessagesInFlight);
+  mMaxMessagesInFlight = maxMessagesInFlight < 1 ? 1 : maxMessagesInFlight;
 
   // Notify the listeners that we are starting a send.
   NotifyListenersOnStartSending(mMessagesToSend.Count());
@@ -759,18 +793,18 @@ nsresult nsMsgSendLater::InternalSendMessages(bool aUserInitiated,
   return StartNextMailFileSend(NS_OK);
 }
 
-nsresult nsMsgSendLater::SetOrigMsgDisposition() {
-  if (!mMessage) return NS_ERROR_NULL_POINTER;
+nsresult nsMsgSendLater::SetOrigMsgDisposition(nsIMsgDBHdr *aMessage) {
+  if (!aMessage) return NS_ERROR_NULL_POINTER;
 
-  // We're finished sending a queued message. We need to look at mMessage
+  // We're finished sending a queued message. We need to look at aMessage
   // and see if we need to set replied/forwarded
   // flags for the original message that this message might be a reply to
   // or forward of.
   nsCString originalMsgURIs;
   nsCString queuedDisposition;
-  mMessage->GetStringProperty(ORIG_URI_PROPERTY,
+  aMessage->GetStringProperty(ORIG_URI_PROPERTY,
                               getter_Copies(originalMsgURIs));
-  mMessage->GetStringProperty(QUEUED_DISPOSITION_PROPERTY,
+  aMessage->GetStringProperty(QUEUED_DISPOSITION_PROPERTY,
                               getter_Copies(queuedDisposition));
   if (!queuedDisposition.IsEmpty()) {
     nsTArray<nsCString> uriArray;
@@ -798,8 +832,8 @@ nsresult nsMsgSendLater::SetOrigMsgDisposition() {
   return NS_OK;
 }
 
-nsresult nsMsgSendLater::DeleteCurrentMessage() {
-  if (!mMessage) {
+nsresult nsMsgSendLater::DeleteMessage(nsIMsgDBHdr *aMessage) {
+  if (!aMessage) {
     NS_ERROR("nsMsgSendLater: Attempt to delete an already deleted message");
     return NS_OK;
   }
@@ -810,7 +844,7 @@ nsresult nsMsgSendLater::DeleteCurrentMessage() {
 
   if (!mMessageFolder) return NS_ERROR_UNEXPECTED;
 
-  msgArray->InsertElementAt(mMessage, 0);
+  msgArray->InsertElementAt(aMessage, 0);
 
   nsresult rv;
   nsCOMPtr<nsIMsgFolder> folder = do_QueryReferent(mMessageFolder, &rv);
@@ -819,8 +853,8 @@ nsresult nsMsgSendLater::DeleteCurrentMessage() {
                               false /*allowUndo*/);
   if (NS_FAILED(rv)) return NS_ERROR_FAILURE;
 
-  // Null out the message so we don't try and delete it again.
-  mMessage = nullptr;
+  // Null out the message being spooled so we don't try and delete it again.
+  if (mMessage == aMessage) mMessage = nullptr;
 
   return NS_OK;
 }
@@ -1172,10 +1206,11 @@ void nsMsgSendLater::NotifyListenersOnProgress(uint32_t aCurrentMessage,
 }
 
 void nsMsgSendLater::NotifyListenersOnMessageSendError(uint32_t aCurrentMessage,
+                                                       nsIMsgDBHdr *aMessage,
                                                        nsresult aStatus,
                                                        const char16_t *aMsg) {
   NOTIFY_LISTENERS(OnMessageSendError,
-                   (aCurrentMessage, mMessage, aStatus, aMsg));
+                   (aCurrentMessage, aMessage, aStatus, aMsg));
 }
 
 /**
@@ -1185,6 +1220,19 @@ void nsMsgSendLater::NotifyListenersOnMessageSendError(uint32_t aCurrentMessage,
 void nsMsgSendLater::EndSendMessages(nsresult aStatus, const char16_t *aMsg,
                                      uint32_t aTotalTried,
                                      uint32_t aSuccessful) {
+  // Messages that are still being sent will end the send once they are done,
+  // but no new ones should be started. The first failure is what gets
+  // reported then.
+  if (mMessagesInFlight) {
+    mEnumerator = nullptr;
+    if (NS_FAILED(aStatus) && NS_SUCCEEDED(mEndStatus)) mEndStatus = aStatus;
+    return;
+  }
+  if (NS_FAILED(mEndStatus)) {
+    aStatus = mEndStatus;
+    mEndStatus = NS_OK;
+  }
+
   // Catch-all, we may have had an issue sending, so we may not be calling
   // StartNextMailFileSend to fully finish the sending. Therefore set
   // mSendingMessages to false here so that we don't think we're still trying
@@ -1218,27 +1266,31 @@ void nsMsgSendLater::EndSendMessages(nsresult aStatus, const char16_t *aMsg,
  * Called when the send part of sending a message is finished. This will set up
  * for the next step or "end" depending on the status.
  *
- * @param aStatus  The success or fail result of the send step.
- * @return         True if the copy process will continue, false otherwise.
+ * @param aStatus         The success or fail result of the send step.
+ * @param aMessage        The queued message that was sent.
+ * @param aMessageNumber  The position of the message in this send.
+ * @return                True if the copy process will continue, false
+ *                        otherwise.
  */
-bool nsMsgSendLater::OnSendStepFinished(nsresult aStatus) {
+bool nsMsgSendLater::OnSendStepFinished(nsresult aStatus,
+                                        nsIMsgDBHdr *aMessage,
+                                        uint32_t aMessageNumber) {
   if (NS_SUCCEEDED(aStatus)) {
-    SetOrigMsgDisposition();
-    DeleteCurrentMessage();
+    SetOrigMsgDisposition(aMessage);
+    DeleteMessage(aMessage);
 
     // Send finished, so that is now 100%, copy to proceed...
-    NotifyListenersOnProgress(mTotalSendCount, mMessagesToSend.Count(), 100, 0);
+    NotifyListenersOnProgress(aMessageNumber, mMessagesToSend.Count(), 100, 0);
 
     ++mTotalSentSuccessfully;
     return true;
   } else {
     // XXX we don't currently get a message string from the send service.
-    NotifyListenersOnMessageSendError(mTotalSendCount, aStatus, nullptr);
-    nsresult rv = StartNextMailFileSend(aStatus);
+    NotifyListenersOnMessageSendError(aMessageNumber, aMessage, aStatus,
+                                      nullptr);
     // if this is the last message we're sending, we should report
     // the status failure.
-    if (NS_FAILED(rv))
-      EndSendMessages(rv, nullptr, mTotalSendCount, mTotalSentSuccessfully);
+    FinishMessage(aMessageNumber, aStatus);
   }
   return false;
 }
@@ -1247,11 +1299,30 @@ bool nsMsgSendLater::OnSendStepFinished(nsresult aStatus) {
  * Called when the copy part of sending a message is finished. This will send
  * the next message or handle failure as appropriate.
  *
- * @param aStatus  The success or fail result of the copy step.
+ * @param aStatus         The success or fail result of the copy step.
+ * @param aMessageNumber  The position of the message in this send.
  */
-void nsMsgSendLater::OnCopyStepFinished(nsresult aStatus) {
+void nsMsgSendLater::OnCopyStepFinished(nsresult aStatus,
+                                        uint32_t aMessageNumber) {
   // Regardless of the success of the copy we will still keep trying
   // to send the rest...
+  FinishMessage(aMessageNumber, aStatus);
+}
+
+/**
+ * Called when a message is done with, whether it was sent or not. This makes
+ * room for the next message, or ends the send if it was the last one.
+ *
+ * @param aMessageNumber  The position of the message in this send.
+ * @param aStatus         The success or fail result for the message.
+ */
+void nsMsgSendLater::FinishMessage(uint32_t aMessageNumber, nsresult aStatus) {
+  NS_ASSERTION(mMessagesInFlight, "finishing a message that was not started");
+  if (mMessagesInFlight) --mMessagesInFlight;
+
+  // Notify that this message has finished being sent.
+  NotifyListenersOnProgress(aMessageNumber, mMessagesToSend.Count(), 100, 100);
+
   nsresult rv = StartNextMailFileSend(aStatus);
   if (NS_FAILED(rv))
     EndSendMessages(rv, nullptr, mTotalSendCount, mTotalSentSuccessfully);
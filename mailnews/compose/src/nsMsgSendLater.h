@@ -28,7 +28,8 @@ class nsMsgSendLater;
 class SendOperationListener : public nsIMsgSendListener,
                               public nsIMsgCopyServiceListener {
  public:
-  explicit SendOperationListener(nsMsgSendLater *aSendLater);
+  SendOperationListener(nsMsgSendLater *aSendLater, nsIMsgDBHdr *aMessage,
+                        uint32_t aMessageNumber);
 
   NS_DECL_ISUPPORTS
   NS_DECL_NSIMSGSENDLISTENER
@@ -37,6 +38,9 @@ class SendOperationListener : public nsIMsgSendListener,
  private:
   virtual ~SendOperationListener();
   RefPtr<nsMsgSendLater> mSendLater;
+  // The queued message being sent, and its position in the send.
+  nsCOMPtr<nsIMsgDBHdr> mMessage;
+  uint32_t mMessageNumber;
 };
 
 class nsMsgSendLater : public nsIMsgSendLater,
@@ -63,8 +67,8 @@ class nsMsgSendLater : public nsIMsgSendLater,
   nsresult StartNextMailFileSend(nsresult prevStatus);
   nsresult CompleteMailFileSend();
 
-  nsresult DeleteCurrentMessage();
-  nsresult SetOrigMsgDisposition();
+  nsresult DeleteMessage(nsIMsgDBHdr *aMessage);
+  nsresult SetOrigMsgDisposition(nsIMsgDBHdr *aMessage);
   // Necessary for creating a valid list of recipients
   nsresult BuildHeaders();
   nsresult DeliverQueuedLine(char *line, int32_t length);
@@ -81,13 +85,16 @@ class nsMsgSendLater : public nsIMsgSendLater,
                                  uint32_t aTotalMessage, uint32_t aSendPercent,
                                  uint32_t aCopyPercent);
   void NotifyListenersOnMessageSendError(uint32_t aCurrentMessage,
+                                         nsIMsgDBHdr *aMessage,
                                          nsresult aStatus,
                                          const char16_t *aMsg);
   void EndSendMessages(nsresult aStatus, const char16_t *aMsg,
                        uint32_t aTotalTried, uint32_t aSuccessful);
 
-  bool OnSendStepFinished(nsresult aStatus);
-  void OnCopyStepFinished(nsresult aStatus);
+  bool OnSendStepFinished(nsresult aStatus, nsIMsgDBHdr *aMessage,
+                          uint32_t aMessageNumber);
+  void OnCopyStepFinished(nsresult aStatus, uint32_t aMessageNumber);
+  void FinishMessage(uint32_t aMessageNumber, nsresult aStatus);
 
   // counters and things for enumeration
   uint32_t mTotalSentSuccessfully;
@@ -137,6 +144,14 @@ class nsMsgSendLater : public nsIMsgSendLater,
 
   bool mSendingMessages;
   bool mUserInitiated;
+
+  // Messages are spooled one at a time, but up to mMaxMessagesInFlight of
+  // them may be being sent or copied at once.
+  uint32_t mMessagesInFlight;
+  uint32_t mMaxMessagesInFlight;
+  bool mSpooling;
+  // Why the send was ended while messages were still in flight.
+  nsresult mEndStatus;
   nsCOMPtr<nsIMsgIdentity> mIdentity;
 };
 
@@ -255,15 +255,10 @@ nsresult nsSmtpProtocol::Initialize(nsIURI *aURL) {
   m_continuationResponse = -1;
   m_tlsEnabled = false;
   m_addressesLeft = 0;
-
-  m_sendDone = false;
+  m_pipelinedResponsesLeft = 0;
+  m_pipelinedError = NS_OK;
 
   m_sizelimit = 0;
-  m_totalMessageSize = 0;
-  nsCOMPtr<nsIFile> file;
-  m_runningURL->GetPostMessageFile(getter_AddRefs(file));
-  if (file) file->GetFileSize(&m_totalMessageSize);
-
   m_originalContentLength = 0;
   m_totalAmountRead = 0;
 
@@ -305,79 +300,10 @@ nsresult nsSmtpProtocol::Initialize(nsIURI *aURL) {
   if (postMessage) {
     m_nextState = SMTP_RESPONSE;
     m_nextStateAfterResponse = SMTP_EXTN_LOGIN_RESPONSE;
+  }
 
-    // compile a minimal list of valid target addresses by
-    // - looking only at mailboxes
-    // - dropping addresses with invalid localparts (until we implement RFC
-    // 6532)
-    // - using ACE for IDN domainparts
-    // - stripping duplicates
-    nsCString addresses;
-    m_runningURL->GetRecipients(getter_Copies(addresses));
-
-    ExtractEmails(EncodedHeader(addresses), UTF16ArrayAdapter<>(m_addresses));
-
-    nsCOMPtr<nsIIDNService> converter = do_GetService(NS_IDNSERVICE_CONTRACTID);
-    addresses.Truncate();
-    uint32_t count = m_addresses.Length();
-    for (uint32_t i = 0; i < count; i++) {
-      const char *start = m_addresses[i].get();
-      // Location of the @ character
-      const char *lastAt = nullptr;
-      const char *ch = start;
-      for (; *ch; ch++) {
-        if (*ch == '@') lastAt = ch;
-        // Check for first illegal character (outside 0x09,0x20-0x7e)
-        else if ((*ch < ' ' || *ch > '~') && (*ch != '\t')) {
-          break;
-        }
-      }
-      // validate the just parsed address
-      if (*ch || m_addresses[i].IsEmpty()) {
-        // Fortunately, we will always have an @ in each mailbox address.
-        // We try to fix illegal character in the domain part by converting
-        // that to ACE. Illegal characters in the local part are not fixable
-        // (which charset would it be anyway?), hence we error out in that
-        // case as well.
-        nsresult rv = NS_ERROR_FAILURE;  // anything but NS_OK
-        if (lastAt) {
-          // Illegal char in the domain part, hence use ACE
-          nsAutoCString domain;
-          domain.Assign(lastAt + 1);
-          rv = converter->ConvertUTF8toACE(domain, domain);
-          if (NS_SUCCEEDED(rv)) {
-            m_addresses[i].SetLength(lastAt - start + 1);
-            m_addresses[i] += domain;
-          }
-        }
-        if (NS_FAILED(rv)) {
-          // Throw an error, including the broken address
-          m_nextState = SMTP_ERROR_DONE;
-          ClearFlag(SMTP_PAUSE_FOR_READ);
-          // Unfortunately, nsExplainErrorDetails will show the error above
-          // the mailnews main window, because we don't necessarily get
-          // passed down a compose window - we might be sending in the
-          // background!
-          rv = nsExplainErrorDetails(m_runningURL, NS_ERROR_ILLEGAL_LOCALPART,
-                                     start, nullptr);
-          NS_ASSERTION(NS_SUCCEEDED(rv), "failed to explain illegal localpart");
-          m_urlErrorState = NS_ERROR_BUT_DONT_SHOW_ALERT;
-          return NS_ERROR_BUT_DONT_SHOW_ALERT;
-        }
-      }
-    }
-
-    // final cleanup
-    m_addressesLeft = m_addresses.Length();
-
-    // hmm no addresses to send message to...
-    if (m_addressesLeft == 0) {
-      m_nextState = SMTP_ERROR_DONE;
-      ClearFlag(SMTP_PAUSE_FOR_READ);
-      m_urlErrorState = NS_MSG_NO_RECIPIENTS;
-      return NS_MSG_NO_RECIPIENTS;
-    }
-  }  // if post message
+  rv = InitializeMessage();
+  if (NS_FAILED(rv)) return rv;
 
   rv = MsgExamineForProxyAsync(this, this, getter_AddRefs(m_proxyRequest));
   if (NS_FAILED(rv)) {
@@ -387,13 +313,114 @@ nsresult nsSmtpProtocol::Initialize(nsIURI *aURL) {
   return rv;
 }
 
+/*
+ * Sets up what is needed to send the message of m_runningURL: its size and
+ * the list of recipients.
+ */
+nsresult nsSmtpProtocol::InitializeMessage() {
+  m_sendDone = false;
+
+  m_totalMessageSize = 0;
+  nsCOMPtr<nsIFile> file;
+  m_runningURL->GetPostMessageFile(getter_AddRefs(file));
+  if (file) file->GetFileSize(&m_totalMessageSize);
+
+  m_addresses.Clear();
+  m_addressesLeft = 0;
+
+  bool postMessage = false;
+  m_runningURL->GetPostMessage(&postMessage);
+  if (!postMessage) return NS_OK;
+
+  // compile a minimal list of valid target addresses by
+  // - looking only at mailboxes
+  // - dropping addresses with invalid localparts (until we implement RFC 6532)
+  // - using ACE for IDN domainparts
+  // - stripping duplicates
+  nsCString addresses;
+  m_runningURL->GetRecipients(getter_Copies(addresses));
+
+  ExtractEmails(EncodedHeader(addresses), UTF16ArrayAdapter<>(m_addresses));
+
+  nsCOMPtr<nsIIDNService> converter = do_GetService(NS_IDNSERVICE_CONTRACTID);
+  addresses.Truncate();
+  uint32_t count = m_addresses.Length();
+  for (uint32_t i = 0; i < count; i++) {
+    const char *start = m_addresses[i].get();
+    // Location of the @ character
+    const char *lastAt = nullptr;
+    const char *ch = start;
+    for (; *ch; ch++) {
+      if (*ch == '@') lastAt = ch;
+      // Check for first illegal character (outside 0x09,0x20-0x7e)
+      else if ((*ch < ' ' || *ch > '~') && (*ch != '\t')) {
+        break;
+      }
+    }
+    // validate the just parsed address
+    if (*ch || m_addresses[i].IsEmpty()) {
+      // Fortunately, we will always have an @ in each mailbox address.
+      // We try to fix illegal character in the domain part by converting
+      // that to ACE. Illegal characters in the local part are not fixable
+      // (which charset would it be anyway?), hence we error out in that
+      // case as well.
+      nsresult rv = NS_ERROR_FAILURE;  // anything but NS_OK
+      if (lastAt) {
+        // Illegal char in the domain part, hence use ACE
+        nsAutoCString domain;
+        domain.Assign(lastAt + 1);
+        rv = converter->ConvertUTF8toACE(domain, domain);
+        if (NS_SUCCEEDED(rv)) {
+          m_addresses[i].SetLength(lastAt - start + 1);
+          m_addresses[i] += domain;
+        }
+      }
+      if (NS_FAILED(rv)) {
+        // Throw an error, including the broken address
+        m_nextState = SMTP_ERROR_DONE;
+        ClearFlag(SMTP_PAUSE_FOR_READ);
+        // Unfortunately, nsExplainErrorDetails will show the error above
+        // the mailnews main window, because we don't necessarily get
+        // passed down a compose window - we might be sending in the
+        // background!
+        rv = nsExplainErrorDetails(m_runningURL, NS_ERROR_ILLEGAL_LOCALPART,
+                                   start, nullptr);
+        NS_ASSERTION(NS_SUCCEEDED(rv), "failed to explain illegal localpart");
+        m_urlErrorState = NS_ERROR_BUT_DONT_SHOW_ALERT;
+        return NS_ERROR_BUT_DONT_SHOW_ALERT;
+      }
+    }
+  }
+
+  // final cleanup
+  m_addressesLeft = m_addresses.Length();
+
+  // hmm no addresses to send message to...
+  if (m_addressesLeft == 0) {
+    m_nextState = SMTP_ERROR_DONE;
+    ClearFlag(SMTP_PAUSE_FOR_READ);
+    m_urlErrorState = NS_MSG_NO_RECIPIENTS;
+    return NS_MSG_NO_RECIPIENTS;
+  }
+  return NS_OK;
+}
+
 // nsIProtocolProxyCallback
 NS_IMETHODIMP
 nsSmtpProtocol::OnProxyAvailable(nsICancelable *aRequest, nsIChannel *aChannel,
                                  nsIProxyInfo *aProxyInfo, nsresult aStatus) {
   // No checking of 'aStatus' here, see nsHttpChannel::OnProxyAvailable().
   // Status is non-fatal and we just kick on.
-  return InitializeInternal(aProxyInfo);
+  nsresult rv = InitializeInternal(aProxyInfo);
+  if (NS_FAILED(rv)) {
+    // Nobody is left to see the error, so fail the url itself.
+    nsCOMPtr<nsIMsgMailNewsUrl> mailNewsUrl = do_QueryInterface(m_url);
+    if (mailNewsUrl) {
+      mailNewsUrl->SetUrlState(true, NS_OK);
+      mailNewsUrl->SetUrlState(false, rv);
+    }
+  }
+  return rv;
 }
 
 nsresult nsSmtpProtocol::InitializeInternal(nsIProxyInfo *proxyInfo) {
@@ -428,7 +455,10 @@ nsresult nsSmtpProtocol::InitializeInternal(nsIProxyInfo *proxyInfo) {
     rv = OpenNetworkSocketWithInfo(hostName.get(), port, nullptr, proxyInfo,
                                    callbacks);
 
-  return LoadUrlInternal(m_url, m_consumer);
+  if (NS_SUCCEEDED(rv)) rv = LoadUrlInternal(m_url, m_consumer);
+  // A connection that never got going gives up its place to the next url.
+  if (NS_FAILED(rv)) RemoveConnection();
+  return rv;
 }
 
 void nsSmtpProtocol::AppendHelloArgument(nsACString &aResult) {
@@ -523,10 +553,12 @@ NS_IMETHODIMP nsSmtpProtocol::OnStopRequest(nsIRequest *request,
   if (connDroppedDuringAuth) {
     nsCOMPtr<nsIURI> runningURI = do_QueryInterface(m_runningURL);
     nsresult rv = AuthLoginResponse(nullptr, 0);
-    if (NS_FAILED(rv)) return rv;
-    return LoadUrl(runningURI, nullptr);
+    if (NS_SUCCEEDED(rv)) rv = LoadUrl(runningURI, nullptr);
+    if (NS_FAILED(rv)) RemoveConnection();
+    return rv;
   }
 
+  RemoveConnection();
   return rv;
 }
 
@@ -669,13 +701,9 @@ nsresult nsSmtpProtocol::ExtensionLoginResponse(nsIInputStream *inputStream,
 
 nsresult nsSmtpProtocol::SendHeloResponse(nsIInputStream *inputStream,
                                           uint32_t length) {
-  nsresult status = NS_OK;
-  nsAutoCString buffer;
-  nsresult rv;
-
   if (m_responseCode != 250) {
 #ifdef DEBUG
-    rv =
+    nsresult rv =
 #endif
         nsExplainErrorDetails(m_runningURL, NS_ERROR_SMTP_SERVER_ERROR,
                               m_responseText.get(), nullptr);
@@ -691,6 +719,14 @@ nsresult nsSmtpProtocol::SendHeloResponse(nsIInputStream *inputStream,
   smtpUrl->GetVerifyLogon(&verifyingLogon);
   if (verifyingLogon) return SendQuit();
 
+  return SendMailCommand();
+}
+
+nsresult nsSmtpProtocol::SendMailCommand() {
+  nsresult status = NS_OK;
+  nsAutoCString buffer;
+  nsresult rv;
+
   nsCOMPtr<nsIPrefService> prefs =
       do_GetService(NS_PREFSERVICE_CONTRACTID, &rv);
   NS_ENSURE_SUCCESS(rv, rv);
@@ -777,6 +813,18 @@ nsresult nsSmtpProtocol::SendHeloResponse(nsIInputStream *inputStream,
   }
   buffer += CRLF;
 
+  // With PIPELINING (RFC 2920), send every RCPT TO right behind MAIL FROM.
+  // The server answers them in order, so the responses are still checked one
+  // at a time, and a failing recipient is reported as such. DATA (or BDAT) is
+  // only sent once all of them have been accepted, so no message is started
+  // for a transaction we are going to give up on.
+  if (TestFlag(SMTP_EHLO_PIPELINING_ENABLED)) {
+    for (uint32_t i = m_addressesLeft; i > 0; i--) {
+      rv = AppendRecipientCommand(m_addresses[i - 1], buffer);
+      if (NS_FAILED(rv)) return rv;
+    }
+  }
+
   status = SendData(buffer.get());
 
   m_nextState = SMTP_RESPONSE;
@@ -891,6 +939,12 @@ nsresult nsSmtpProtocol::SendEhloResponse(nsIInputStream *inputStream,
     } else if (StringBeginsWith(responseLine, NS_LITERAL_CSTRING("8BITMIME"),
                                 nsCaseInsensitiveCStringComparator())) {
       SetFlag(SMTP_EHLO_8BIT_ENABLED);
+    } else if (responseLine.LowerCaseEqualsLiteral("pipelining")) {
+      if (mozilla::Preferences::GetBool("mail.smtp.pipelining", true))
+        SetFlag(SMTP_EHLO_PIPELINING_ENABLED);
+    } else if (responseLine.LowerCaseEqualsLiteral("chunking")) {
+      if (mozilla::Preferences::GetBool("mail.smtp.chunking", true))
+        SetFlag(SMTP_EHLO_CHUNKING_ENABLED);
     }
 
     startPos = endPos + 1;
@@ -1598,33 +1652,13 @@ nsresult nsSmtpProtocol::OnFailure(nsresult aError) {
   return ProcessProtocolState(nullptr, nullptr, 0, 0);
 }
 
-nsresult nsSmtpProtocol::SendMailResponse() {
-  nsresult status = NS_OK;
-  nsAutoCString buffer;
+/*
+ * Appends the RCPT TO command for aAddress, with the DSN parameters if they
+ * were requested and the server supports them.
+ */
+nsresult nsSmtpProtocol::AppendRecipientCommand(const nsCString &aAddress,
+                                                nsACString &aResult) {
   nsresult rv;
-
-  if (m_responseCode / 10 != 25) {
-    nsresult errorcode;
-    if ((m_responseCodeEnhanced == 570) || (m_responseCodeEnhanced == 571))
-      errorcode = NS_ERROR_SMTP_SEND_NOT_ALLOWED;
-    else if (TestFlag(SMTP_EHLO_SIZE_ENABLED))
-      errorcode = (m_responseCode == 452)
-                      ? NS_ERROR_SMTP_TEMP_SIZE_EXCEEDED
-                      : (m_responseCode == 552)
-                            ? NS_ERROR_SMTP_PERM_SIZE_EXCEEDED_2
-                            : NS_ERROR_SENDING_FROM_COMMAND;
-    else
-      errorcode = NS_ERROR_SENDING_FROM_COMMAND;
-
-    rv = nsExplainErrorDetails(m_runningURL, errorcode, m_responseText.get(),
-                               nullptr);
-    NS_ASSERTION(NS_SUCCEEDED(rv), "failed to explain SMTP error");
-
-    m_urlErrorState = NS_ERROR_BUT_DONT_SHOW_ALERT;
-    return (NS_ERROR_SENDING_FROM_COMMAND);
-  }
-
-  /* Send the RCPT TO: command */
   bool requestDSN = false;
   rv = m_runningURL->GetRequestDSN(&requestDSN);
 
@@ -1650,17 +1684,16 @@ nsresult nsSmtpProtocol::SendMailResponse() {
   bool requestOnNever = false;
   rv = prefBranch->GetBoolPref("mail.dsn.request_never_on", &requestOnNever);
 
-  nsCString &address = m_addresses[m_addressesLeft - 1];
   if (TestFlag(SMTP_EHLO_DSN_ENABLED) && requestDSN &&
       (requestOnSuccess || requestOnFailure || requestOnDelay ||
        requestOnNever)) {
-    char *encodedAddress = esmtp_value_encode(address.get());
+    char *encodedAddress = esmtp_value_encode(aAddress.get());
     nsAutoCString dsnBuffer;
 
     if (encodedAddress) {
-      buffer = "RCPT TO:<";
-      buffer += address;
-      buffer += "> NOTIFY=";
+      aResult += "RCPT TO:<";
+      aResult += aAddress;
+      aResult += "> NOTIFY=";
 
       if (requestOnNever)
         dsnBuffer += "NEVER";
@@ -1674,21 +1707,63 @@ nsresult nsSmtpProtocol::SendMailResponse() {
           dsnBuffer += dsnBuffer.IsEmpty() ? "DELAY" : ",DELAY";
       }
 
-      buffer += dsnBuffer;
-      buffer += " ORCPT=rfc822;";
-      buffer += encodedAddress;
-      buffer += CRLF;
+      aResult += dsnBuffer;
+      aResult += " ORCPT=rfc822;";
+      aResult += encodedAddress;
+      aResult += CRLF;
       PR_FREEIF(encodedAddress);
     } else {
       m_urlErrorState = NS_ERROR_OUT_OF_MEMORY;
       return (NS_ERROR_OUT_OF_MEMORY);
     }
   } else {
-    buffer = "RCPT TO:<";
-    buffer += address;
-    buffer += ">";
-    buffer += CRLF;
+    aResult += "RCPT TO:<";
+    aResult += aAddress;
+    aResult += ">";
+    aResult += CRLF;
+  }
+  return NS_OK;
+}
+
+nsresult nsSmtpProtocol::SendMailResponse() {
+  nsresult status = NS_OK;
+  nsAutoCString buffer;
+  nsresult rv;
+
+  if (m_responseCode / 10 != 25) {
+    nsresult errorcode;
+    if ((m_responseCodeEnhanced == 570) || (m_responseCodeEnhanced == 571))
+      errorcode = NS_ERROR_SMTP_SEND_NOT_ALLOWED;
+    else if (TestFlag(SMTP_EHLO_SIZE_ENABLED))
+      errorcode = (m_responseCode == 452)
+                      ? NS_ERROR_SMTP_TEMP_SIZE_EXCEEDED
+                      : (m_responseCode == 552)
+                            ? NS_ERROR_SMTP_PERM_SIZE_EXCEEDED_2
+                            : NS_ERROR_SENDING_FROM_COMMAND;
+    else
+      errorcode = NS_ERROR_SENDING_FROM_COMMAND;
+
+    rv = nsExplainErrorDetails(m_runningURL, errorcode, m_responseText.get(),
+                               nullptr);
+    NS_ASSERTION(NS_SUCCEEDED(rv), "failed to explain SMTP error");
+
+    m_urlErrorState = NS_ERROR_BUT_DONT_SHOW_ALERT;
+    return DiscardPipelinedResponses(NS_ERROR_SENDING_FROM_COMMAND,
+                                     m_addressesLeft);
+  }
+
+  if (TestFlag(SMTP_EHLO_PIPELINING_ENABLED)) {
+    // The RCPT TO commands went out with MAIL FROM. Don't pause for more data
+    // here, their responses may have arrived along with this one.
+    m_nextState = SMTP_RESPONSE;
+    m_nextStateAfterResponse = SMTP_SEND_RCPT_RESPONSE;
+    return NS_OK;
   }
+
+  /* Send the RCPT TO: command */
+  rv = AppendRecipientCommand(m_addresses[m_addressesLeft - 1], buffer);
+  if (NS_FAILED(rv)) return rv;
+
   status = SendData(buffer.get());
 
   m_nextState = SMTP_RESPONSE;
@@ -1722,10 +1797,17 @@ nsresult nsSmtpProtocol::SendRecipientResponse() {
     if (!NS_SUCCEEDED(rv)) NS_ASSERTION(false, "failed to explain SMTP error");
 
     m_urlErrorState = NS_ERROR_BUT_DONT_SHOW_ALERT;
-    return (NS_ERROR_SENDING_RCPT_COMMAND);
+    return DiscardPipelinedResponses(NS_ERROR_SENDING_RCPT_COMMAND,
+                                     m_addressesLeft - 1);
   }
 
   if (--m_addressesLeft > 0) {
+    if (TestFlag(SMTP_EHLO_PIPELINING_ENABLED)) {
+      // the next RCPT TO has been sent already, read its response
+      m_nextState = SMTP_RESPONSE;
+      m_nextStateAfterResponse = SMTP_SEND_RCPT_RESPONSE;
+      return NS_OK;
+    }
     // more senders to RCPT to
     // fake to 250 because SendMailResponse() can't handle 251
     m_responseCode = 250;
@@ -1733,6 +1815,12 @@ nsresult nsSmtpProtocol::SendRecipientResponse() {
     return NS_OK;
   }
 
+  if (TestFlag(SMTP_EHLO_CHUNKING_ENABLED)) {
+    // no DATA command, the message goes out in a BDAT chunk right away
+    m_nextState = SMTP_SEND_POST_DATA;
+    return NS_OK;
+  }
+
   /* else send the DATA command */
   buffer = "DATA";
   buffer += CRLF;
@@ -1745,6 +1833,30 @@ nsresult nsSmtpProtocol::SendRecipientResponse() {
   return (status);
 }
 
+/**
+ * With PIPELINING, the server still answers the RCPT TO commands sent behind
+ * the one that failed. Read those aCount responses before failing with aError,
+ * so that the QUIT sent then is the only command left unanswered.
+ */
+nsresult nsSmtpProtocol::DiscardPipelinedResponses(nsresult aError,
+                                                   uint32_t aCount) {
+  if (!TestFlag(SMTP_EHLO_PIPELINING_ENABLED) || aCount == 0) return aError;
+
+  m_pipelinedResponsesLeft = aCount;
+  m_pipelinedError = aError;
+  m_nextState = SMTP_RESPONSE;
+  m_nextStateAfterResponse = SMTP_DISCARD_PIPELINED_RESPONSE;
+  return NS_OK;
+}
+
+nsresult nsSmtpProtocol::DiscardPipelinedResponse() {
+  if (--m_pipelinedResponsesLeft > 0) {
+    m_nextState = SMTP_RESPONSE;
+    return NS_OK;
+  }
+  return m_pipelinedError;
+}
+
 nsresult nsSmtpProtocol::SendData(const char *dataBuffer,
                                   bool aSuppressLogging) {
   // XXX -1 is not a valid nsresult
@@ -1786,10 +1898,38 @@ void nsSmtpProtocol::SendMessageInFile() {
   nsCOMPtr<nsIFile> file;
   nsCOMPtr<nsIURI> url = do_QueryInterface(m_runningURL);
   m_runningURL->GetPostMessageFile(getter_AddRefs(file));
-  if (url && file)
+  if (url && file) {
+    // With CHUNKING (RFC 3030), the whole message is sent as a single
+    // "BDAT <size> LAST" chunk, so it needs neither dot-stuffing nor the
+    // closing '.' line. All earlier commands have been answered, so nothing is
+    // waiting in mAsyncBuffer, and writing the BDAT command straight into the
+    // output pipe puts it ahead of the message data.
+    mDotStuffPostData = !TestFlag(SMTP_EHLO_CHUNKING_ENABLED);
+    if (!mDotStuffPostData) {
+      int64_t fileSize = 0;
+      file->GetFileSize(&fileSize);
+      nsAutoCString command("BDAT ");
+      command.AppendInt(fileSize);
+      command.AppendLiteral(" LAST" CRLF);
+      MOZ_LOG(SMTPLogModule, mozilla::LogLevel::Info,
+              ("SMTP Send: %s", command.get()));
+
+      uint32_t bytesWritten = 0;
+      nsresult rv = m_outputStream->Write(command.get(), command.Length(),
+                                          &bytesWritten);
+      if (NS_FAILED(rv) || bytesWritten != command.Length()) {
+        m_urlErrorState = NS_ERROR_SENDING_MESSAGE;
+        m_nextState = SMTP_ERROR_DONE;
+        return;
+      }
+      if (mAsyncOutStream)
+        mAsyncOutStream->AsyncWait(mProvider, 0, 0, mProviderThread);
+    }
+
     // need to fully qualify to avoid getting overwritten by a #define
     // in some windows header file
     nsMsgAsyncWriteProtocol::PostMessage(url, file);
+  }
 
   SetFlag(SMTP_PAUSE_FOR_READ);
 
@@ -1836,8 +1976,59 @@ nsresult nsSmtpProtocol::SendMessageResponse() {
 
   UpdateStatus("smtpMailSent");
 
-  /* else */
-  return SendQuit();
+  // If another message is already waiting for a connection to this server,
+  // send it over this one instead of opening a new connection.
+  nsCOMPtr<nsISmtpServer> smtpServer;
+  m_runningURL->GetSmtpServer(getter_AddRefs(smtpServer));
+  nsCOMPtr<nsIURI> nextUrl;
+  if (smtpServer) smtpServer->GetNextQueuedUrl(this, getter_AddRefs(nextUrl));
+  if (!nextUrl) return SendQuit();
+
+  nsCOMPtr<nsIMsgMailNewsUrl> mailNewsUrl = do_QueryInterface(m_runningURL);
+  mailNewsUrl->SetUrlState(false, NS_OK);
+  return LoadNextUrl(nextUrl);
+}
+
+nsresult nsSmtpProtocol::LoadNextUrl(nsIURI *aURL) {
+  m_url = aURL;
+  m_runningURL = do_QueryInterface(aURL);
+  m_urlErrorState = NS_ERROR_FAILURE;
+
+  nsCOMPtr<nsIMsgMailNewsUrl> mailNewsUrl = do_QueryInterface(aURL);
+  m_statusFeedback = nullptr;
+  mailNewsUrl->GetStatusFeedback(getter_AddRefs(m_statusFeedback));
+  mailNewsUrl->SetUrlState(true, NS_OK);
+
+  nsresult rv = InitializeMessage();
+  if (NS_FAILED(rv)) return rv;
+
+  // The server may keep state from the previous transaction, e.g. after an
+  // error it did not report, so start the next one from a clean slate.
+  m_nextState = SMTP_RESPONSE;
+  m_nextStateAfterResponse = SMTP_SEND_RSET_RESPONSE;
+  SetFlag(SMTP_PAUSE_FOR_READ);
+  return SendData("RSET" CRLF);
+}
+
+nsresult nsSmtpProtocol::SendResetResponse() {
+  if (m_responseCode / 10 != 25) {
+    mozilla::DebugOnly<nsresult> rv =
+        nsExplainErrorDetails(m_runningURL, NS_ERROR_SMTP_SERVER_ERROR,
+                              m_responseText.get(), nullptr);
+    NS_ASSERTION(NS_SUCCEEDED(rv), "failed to explain SMTP error");
+
+    m_urlErrorState = NS_ERROR_BUT_DONT_SHOW_ALERT;
+    return NS_ERROR_SMTP_SERVER_ERROR;
+  }
+
+  return SendMailCommand();
+}
+
+void nsSmtpProtocol::RemoveConnection() {
+  if (!m_runningURL) return;
+  nsCOMPtr<nsISmtpServer> smtpServer;
+  m_runningURL->GetSmtpServer(getter_AddRefs(smtpServer));
+  if (smtpServer) smtpServer->RemoveConnection(this);
 }
 
 nsresult nsSmtpProtocol::SendQuit(SmtpState aNextStateAfterResponse) {
@@ -2010,6 +2201,19 @@ nsresult nsSmtpProtocol::ProcessProtocolState(nsIURI *url,
         else
           status = SendMessageResponse();
         break;
+
+      case SMTP_SEND_RSET_RESPONSE:
+        if (inputStream == nullptr)
+          SetFlag(SMTP_PAUSE_FOR_READ);
+        else
+          status = SendResetResponse();
+        break;
+      case SMTP_DISCARD_PIPELINED_RESPONSE:
+        if (inputStream == nullptr)
+          SetFlag(SMTP_PAUSE_FOR_READ);
+        else
+          status = DiscardPipelinedResponse();
+        break;
       case SMTP_DONE: {
         nsCOMPtr<nsIMsgMailNewsUrl> mailNewsUrl =
             do_QueryInterface(m_runningURL);
@@ -2030,8 +2234,10 @@ nsresult nsSmtpProtocol::ProcessProtocolState(nsIURI *url,
         break;
 
       case SMTP_FREE:
-        // smtp is a one time use connection so kill it if we get here...
+        // No more messages to send over this connection, so kill it and let
+        // the server hand its slot to the next queued message.
         nsMsgAsyncWriteProtocol::CloseSocket();
+        RemoveConnection();
         return NS_OK; /* final end */
 
       // This state means we're going into an async loop and waiting for
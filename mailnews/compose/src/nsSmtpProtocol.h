@@ -53,6 +53,8 @@ typedef enum _SmtpState {
   SMTP_SUSPENDED,                         // 25
   SMTP_AUTH_OAUTH2_STEP,                  // 26
   SMTP_AUTH_OAUTH2_RESPONSE,              // 27
+  SMTP_SEND_RSET_RESPONSE,                // 28
+  SMTP_DISCARD_PIPELINED_RESPONSE,        // 29
 } SmtpState;
 
 // State Flags (Note, I use the word state in terms of storing
@@ -64,6 +66,8 @@ typedef enum _SmtpState {
 #define SMTP_EHLO_STARTTLS_ENABLED 0x00000008
 #define SMTP_EHLO_SIZE_ENABLED 0x00000010
 #define SMTP_EHLO_8BIT_ENABLED 0x00000020
+#define SMTP_EHLO_PIPELINING_ENABLED 0x00000040
+#define SMTP_EHLO_CHUNKING_ENABLED 0x00000080
 
 // insecure mechanisms follow
 #define SMTP_AUTH_LOGIN_ENABLED 0x00000100
@@ -137,6 +141,10 @@ class nsSmtpProtocol : public nsMsgAsyncWriteProtocol,
 
   nsTArray<nsCString> m_addresses;
   uint32_t m_addressesLeft;
+  // Responses still due for commands pipelined behind one that failed, and
+  // the error to give up with once they have been read.
+  uint32_t m_pipelinedResponsesLeft;
+  nsresult m_pipelinedError;
   nsCString m_mailAddr;
   nsCString m_helloArgument;
   int32_t m_sizelimit;
@@ -163,7 +171,10 @@ class nsSmtpProtocol : public nsMsgAsyncWriteProtocol,
   // initialization function given a new url and transport layer
   nsresult Initialize(nsIURI *aURL);
   nsresult InitializeInternal(nsIProxyInfo *proxyInfo);
+  nsresult InitializeMessage();
   nsresult LoadUrlInternal(nsIURI *aURL, nsISupports *aConsumer);
+  nsresult LoadNextUrl(nsIURI *aURL);
+  void RemoveConnection();
   virtual nsresult ProcessProtocolState(nsIURI *url,
                                         nsIInputStream *inputStream,
                                         uint64_t sourceOffset,
@@ -198,11 +209,15 @@ class nsSmtpProtocol : public nsMsgAsyncWriteProtocol,
   nsresult AuthOAuth2Step1();
 
   nsresult SendTLSResponse();
+  nsresult SendMailCommand();
   nsresult SendMailResponse();
   nsresult SendRecipientResponse();
   nsresult SendDataResponse();
   void SendPostData();
   nsresult SendMessageResponse();
+  nsresult SendResetResponse();
+  nsresult DiscardPipelinedResponses(nsresult aError, uint32_t aCount);
+  nsresult DiscardPipelinedResponse();
   nsresult ProcessAuth();
 
   ////////////////////////////////////////////////////////////////////////////////////////
@@ -212,6 +227,8 @@ class nsSmtpProtocol : public nsMsgAsyncWriteProtocol,
   void SendMessageInFile();
 
   void AppendHelloArgument(nsACString &aResult);
+  nsresult AppendRecipientCommand(const nsCString &aAddress,
+                                  nsACString &aResult);
   nsresult GetPassword(nsString &aPassword);
   nsresult GetUsernamePassword(nsACString &aUsername, nsAString &aPassword);
   nsresult PromptForPassword(nsISmtpServer *aSmtpServer, nsISmtpUrl *aSmtpUrl,
@@ -19,6 +19,8 @@
 #include "nsArrayUtils.h"
 #include "nsMemory.h"
 #include "nsIObserverService.h"
+#include "nsIMsgMailNewsUrl.h"
+#include "nsSmtpProtocol.h"
 
 NS_IMPL_ADDREF(nsSmtpServer)
 NS_IMPL_RELEASE(nsSmtpServer)
@@ -566,6 +568,105 @@ nsSmtpServer::GetServerURI(nsACString &aResult) {
   return NS_OK;
 }
 
+NS_IMETHODIMP
+nsSmtpServer::GetMaximumConnectionsNumber(int32_t *aMaxConnections) {
+  NS_ENSURE_ARG_POINTER(aMaxConnections);
+  getIntPrefWithDefault("max_cached_connections", aMaxConnections, 2);
+  // We need at least one connection.
+  if (*aMaxConnections < 1) *aMaxConnections = 1;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+nsSmtpServer::SetMaximumConnectionsNumber(int32_t aMaxConnections) {
+  return mPrefBranch->SetIntPref("max_cached_connections", aMaxConnections);
+}
+
+NS_IMETHODIMP
+nsSmtpServer::GetSmtpConnectionAndLoadUrl(nsIURI *aUrl, nsIRequest **aRequest) {
+  NS_ENSURE_ARG_POINTER(aUrl);
+  NS_ENSURE_ARG_POINTER(aRequest);
+  *aRequest = nullptr;
+
+  int32_t maxConnections;
+  GetMaximumConnectionsNumber(&maxConnections);
+  if (mConnections.Count() >= maxConnections) {
+    // A connection will pick the url up when it has sent its message.
+    mUrlQueue.AppendObject(aUrl);
+    return NS_OK;
+  }
+
+  // The protocol removes itself from mConnections when it closes.
+  RefPtr<nsSmtpProtocol> smtpProtocol = new nsSmtpProtocol(aUrl);
+  mConnections.AppendObject(smtpProtocol);
+  nsresult rv = smtpProtocol->LoadUrl(aUrl, nullptr);
+  if (NS_FAILED(rv)) {
+    RemoveConnection(smtpProtocol);
+    return rv;
+  }
+
+  smtpProtocol.forget(aRequest);
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+nsSmtpServer::GetNextQueuedUrl(nsIRequest *aConnection, nsIURI **aUrl) {
+  NS_ENSURE_ARG_POINTER(aUrl);
+  *aUrl = nullptr;
+  // Connections sending something other than the Outbox aren't counted
+  // against the limit, so they don't take its messages either.
+  if (mUrlQueue.IsEmpty() || !mConnections.Contains(aConnection)) return NS_OK;
+
+  NS_ADDREF(*aUrl = mUrlQueue[0]);
+  mUrlQueue.RemoveObjectAt(0);
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+nsSmtpServer::RemoveConnection(nsIRequest *aConnection) {
+  // Connections that were not started by us, or were removed already.
+  if (!mConnections.RemoveObject(aConnection)) return NS_OK;
+
+  // Start the next queued url on a new connection in its place.
+  while (!mUrlQueue.IsEmpty()) {
+    nsCOMPtr<nsIURI> url = mUrlQueue[0];
+    mUrlQueue.RemoveObjectAt(0);
+    nsCOMPtr<nsIRequest> request;
+    nsresult rv = GetSmtpConnectionAndLoadUrl(url, getter_AddRefs(request));
+    if (NS_SUCCEEDED(rv)) break;
+
+    // Nobody is left to see the error, so fail the url itself.
+    FailQueuedUrl(url, rv);
+  }
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+nsSmtpServer::CancelUrl(nsIURI *aUrl, nsresult aStatus) {
+  NS_ENSURE_ARG_POINTER(aUrl);
+  if (mUrlQueue.RemoveObject(aUrl)) {
+    FailQueuedUrl(aUrl, aStatus);
+    return NS_OK;
+  }
+
+  // The url may have been picked up by a connection since it was queued.
+  for (int32_t i = 0; i < mConnections.Count(); i++) {
+    nsCOMPtr<nsIChannel> channel = do_QueryInterface(mConnections[i]);
+    nsCOMPtr<nsIURI> url;
+    if (channel) channel->GetURI(getter_AddRefs(url));
+    if (SameCOMIdentity(url, aUrl)) return mConnections[i]->Cancel(aStatus);
+  }
+  return NS_OK;
+}
+
+void nsSmtpServer::FailQueuedUrl(nsIURI *aUrl, nsresult aStatus) {
+  nsCOMPtr<nsIMsgMailNewsUrl> mailNewsUrl = do_QueryInterface(aUrl);
+  if (mailNewsUrl) {
+    mailNewsUrl->SetUrlState(true, NS_OK);
+    mailNewsUrl->SetUrlState(false, aStatus);
+  }
+}
+
 nsCString nsSmtpServer::GetServerURIInternal(const bool aIncludeUsername) {
   nsCString uri(NS_LITERAL_CSTRING("smtp://"));
   nsresult rv;
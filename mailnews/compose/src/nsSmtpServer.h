@@ -7,10 +7,13 @@
 #define __nsSmtpServer_h_
 
 #include "nsString.h"
+#include "nsCOMArray.h"
 #include "nsISmtpServer.h"
 #include "nsIPrefBranch.h"
 #include "nsWeakReference.h"
 #include "nsIObserver.h"
+#include "nsIRequest.h"
+#include "nsIURI.h"
 
 class nsSmtpServer : public nsISmtpServer,
                      public nsSupportsWeakReference,
@@ -37,8 +40,13 @@ class nsSmtpServer : public nsISmtpServer,
   nsresult OnUserOrHostNameChanged(const nsACString& oldName,
                                    const nsACString& newName,
                                    bool hostnameChanged);
+  void FailQueuedUrl(nsIURI* aUrl, nsresult aStatus);
   nsString m_password;
   bool m_logonFailed;
+
+  // The connections open to the server, and the urls waiting for one.
+  nsCOMArray<nsIRequest> mConnections;
+  nsCOMArray<nsIURI> mUrlQueue;
 };
 
 #endif
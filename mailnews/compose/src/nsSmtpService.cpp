@@ -74,6 +74,32 @@ NS_IMETHODIMP nsSmtpService::SendMailMessage(
     nsIMsgStatusFeedback *aStatusFeedback,
     nsIInterfaceRequestor *aNotificationCallbacks, bool aRequestDSN,
     nsIURI **aURL, nsIRequest **aRequest) {
+  return SendMailMessageInternal(aFilePath, aRecipients, aSenderIdentity,
+                                 aSender, aPassword, aUrlListener,
+                                 aStatusFeedback, aNotificationCallbacks,
+                                 aRequestDSN, false, aURL, aRequest);
+}
+
+NS_IMETHODIMP nsSmtpService::SendUnsentMailMessage(
+    nsIFile *aFilePath, const char *aRecipients,
+    nsIMsgIdentity *aSenderIdentity, const char *aSender,
+    const nsAString &aPassword, nsIUrlListener *aUrlListener,
+    nsIMsgStatusFeedback *aStatusFeedback,
+    nsIInterfaceRequestor *aNotificationCallbacks, bool aRequestDSN,
+    nsIURI **aURL, nsIRequest **aRequest) {
+  return SendMailMessageInternal(aFilePath, aRecipients, aSenderIdentity,
+                                 aSender, aPassword, aUrlListener,
+                                 aStatusFeedback, aNotificationCallbacks,
+                                 aRequestDSN, true, aURL, aRequest);
+}
+
+nsresult nsSmtpService::SendMailMessageInternal(
+    nsIFile *aFilePath, const char *aRecipients,
+    nsIMsgIdentity *aSenderIdentity, const char *aSender,
+    const nsAString &aPassword, nsIUrlListener *aUrlListener,
+    nsIMsgStatusFeedback *aStatusFeedback,
+    nsIInterfaceRequestor *aNotificationCallbacks, bool aRequestDSN,
+    bool aUseConnectionPool, nsIURI **aURL, nsIRequest **aRequest) {
   nsIURI *urlToRun = nullptr;
   nsresult rv = NS_OK;
 
@@ -87,8 +113,19 @@ NS_IMETHODIMP nsSmtpService::SendMailMessage(
     rv = NS_MsgBuildSmtpUrl(aFilePath, smtpServer, aRecipients, aSenderIdentity,
                             aSender, aUrlListener, aStatusFeedback,
                             aNotificationCallbacks, &urlToRun, aRequestDSN);
-    if (NS_SUCCEEDED(rv) && urlToRun)
-      rv = NS_MsgLoadSmtpUrl(urlToRun, nullptr, aRequest);
+    // For the Outbox, the server runs the url over one of its connections,
+    // or queues it until one is free, in which case there is no request to
+    // return. Anything else gets a connection of its own right away, so it
+    // can always be cancelled.
+    if (NS_SUCCEEDED(rv) && urlToRun) {
+      if (aUseConnectionPool) {
+        nsCOMPtr<nsIRequest> request;
+        rv = smtpServer->GetSmtpConnectionAndLoadUrl(urlToRun,
+                                                     getter_AddRefs(request));
+        if (aRequest) request.forget(aRequest);
+      } else
+        rv = NS_MsgLoadSmtpUrl(urlToRun, nullptr, aRequest);
+    }
 
     if (aURL)            // does the caller want a handle on the url?
       *aURL = urlToRun;  // transfer our ref count to the caller....
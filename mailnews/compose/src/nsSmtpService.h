@@ -54,6 +54,13 @@ class nsSmtpService : public nsISmtpService, public nsIProtocolHandler {
   nsresult createKeyedServer(const char *key,
                              nsISmtpServer **aResult = nullptr);
   nsresult saveKeyList();
+  nsresult SendMailMessageInternal(
+      nsIFile *aFilePath, const char *aRecipients,
+      nsIMsgIdentity *aSenderIdentity, const char *aSender,
+      const nsAString &aPassword, nsIUrlListener *aUrlListener,
+      nsIMsgStatusFeedback *aStatusFeedback,
+      nsIInterfaceRequestor *aNotificationCallbacks, bool aRequestDSN,
+      bool aUseConnectionPool, nsIURI **aURL, nsIRequest **aRequest);
 
   nsCOMArray<nsISmtpServer> mSmtpServers;
   nsCOMPtr<nsISmtpServer> mDefaultSmtpServer;
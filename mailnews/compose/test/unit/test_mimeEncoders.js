@@ -0,0 +1,118 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Saves a draft with a text attachment that needs quoted-printable and a
+ * binary attachment that needs base64, both large enough to be encoded in
+ * many calls and to fill the encoders' output buffer many times over. Checks
+ * the length of every encoded line and that the attachments decode to what
+ * was attached.
+ */
+
+const { MimeParser } = ChromeUtils.import("resource:///modules/mimeParser.jsm");
+
+// Lines longer than LINELENGTH_ENCODING_THRESHOLD get the text encoded.
+var kText = "";
+for (let i = 0; i < 200; i++) {
+  kText +=
+    "Line " +
+    i +
+    ": a=b caf\xe9\t" +
+    "x".repeat(i * 7) +
+    (i % 2 ? " \r\n" : "\t\r\n") +
+    (i % 10 ? "" : "From here\r\n.\r\n");
+}
+kText += "no line break at the end";
+
+// Not a multiple of three.
+var kBinary = "";
+for (let i = 0; i < 100001; i++) {
+  kBinary += String.fromCharCode((i * 7) % 256);
+}
+
+function makeAttachment(aName, aContentType, aData) {
+  let attachment = Cc[
+    "@mozilla.org/messengercompose/attachment;1"
+  ].createInstance(Ci.nsIMsgAttachment);
+  attachment.url = "data:" + aContentType + ";base64," + btoa(aData);
+  attachment.contentType = aContentType;
+  attachment.name = aName;
+  return attachment;
+}
+
+// Returns the body of each attachment of aMsgData by its file name.
+function getAttachments(aMsgData, aBodyFormat) {
+  let names = {};
+  let attachments = {};
+  MimeParser.parseSync(
+    aMsgData,
+    {
+      startPart(aPartNum, aHeaders) {
+        let disposition = aHeaders.getRawHeader("content-disposition");
+        let name = disposition && disposition[0].match(/filename="?([^";]+)/);
+        if (name) {
+          names[aPartNum] = name[1];
+          attachments[name[1]] = "";
+        }
+      },
+      deliverPartData(aPartNum, aData) {
+        if (aPartNum in names) {
+          attachments[names[aPartNum]] += aData;
+        }
+      },
+    },
+    {
+      bodyformat: aBodyFormat,
+      onerror(e) {
+        throw e;
+      },
+    }
+  );
+  return attachments;
+}
+
+add_task(async function testEncodeAttachments() {
+  localAccountUtils.loadLocalMailAccount();
+
+  let fields = Cc[
+    "@mozilla.org/messengercompose/composefields;1"
+  ].createInstance(Ci.nsIMsgCompFields);
+  fields.from = "Nobody <nobody@tinderbox.invalid>";
+  fields.to = "Nobody <nobody@tinderbox.invalid>";
+  fields.subject = "Encoded attachments";
+  fields.body = "Encoded attachments follow.";
+  fields.forcePlainText = true;
+  fields.characterSet = "ISO-8859-1";
+  await richCreateMessage(fields, [
+    makeAttachment("encoded.txt", "text/plain", kText),
+    makeAttachment("encoded.bin", "application/octet-stream", kBinary),
+  ]);
+  let msgData = mailTestUtils.loadMessageToString(
+    gDraftFolder,
+    mailTestUtils.firstMsgHdr(gDraftFolder)
+  );
+  Assert.ok(msgData.includes("Content-Transfer-Encoding: quoted-printable"));
+  Assert.ok(msgData.includes("Content-Transfer-Encoding: base64"));
+
+  let encoded = getAttachments(msgData, "nodecode");
+
+  let qpLines = encoded["encoded.txt"].split("\r\n");
+  Assert.greater(qpLines.length, 32);
+  for (let line of qpLines) {
+    Assert.lessOrEqual(line.length, 76, line);
+    Assert.ok(!line.startsWith("From ") && !line.startsWith("."), line);
+    Assert.ok(!/[ \t]$/.test(line), line);
+  }
+
+  // Every base64 line but the last is as long as can be.
+  let base64Lines = encoded["encoded.bin"].split("\r\n");
+  Assert.equal(base64Lines.length, Math.ceil((4 * 33334) / 72));
+  for (let line of base64Lines.slice(0, -1)) {
+    Assert.equal(line.length, 72);
+  }
+
+  let decoded = getAttachments(msgData, "decode");
+  Assert.ok(decoded["encoded.txt"] == kText);
+  Assert.equal(decoded["encoded.bin"].length, kBinary.length);
+  Assert.ok(decoded["encoded.bin"] == kBinary);
+});
@@ -241,6 +241,10 @@ function run_test() {
     gMsgFileData[i] = IOUtils.loadFileToString(gMsgFile[i]);
   }
 
+  // Each message is checked as the next one starts, so send them one at a
+  // time.
+  Services.prefs.setIntPref("mailnews.sendLater.maxMessagesInFlight", 1);
+
   // Ensure we have a local mail account, an normal account and appropriate
   // servers and identities.
   localAccountUtils.loadLocalMailAccount();
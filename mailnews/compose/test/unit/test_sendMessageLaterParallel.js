@@ -0,0 +1,262 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Sends several queued messages from the Outbox through a server with 50 ms
+ * of latency, allowing only one connection to it. Checks that the next
+ * message is spooled while the previous ones are being sent, that they all go
+ * out over the one connection with an RSET between them, and that each one is
+ * delivered intact and copied to the Sent folder. Then sends them again
+ * allowing two connections, and checks that both are used and the messages
+ * are shared between them.
+ */
+
+var { PromiseTestUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/PromiseTestUtils.jsm"
+);
+
+var kLatency = 50;
+var kMessageCount = 6;
+var kIdentityMail = "identity@foo.invalid";
+var gMsgFile = [
+  do_get_file("data/message1.eml"),
+  do_get_file("data/429891_testcase.eml"),
+];
+var kTestFileSender = ["from_B@foo.invalid", "from_A@foo.invalid"];
+var kTestFileRecipient = ["to_B@foo.invalid", "to_A@foo.invalid"];
+
+var gMsgFileData = [];
+var gPosts = [];
+var gIdentity;
+var gSmtpServer;
+var gSentFolder;
+
+var msgSendLater = Cc["@mozilla.org/messengercompose/sendlater;1"].getService(
+  Ci.nsIMsgSendLater
+);
+
+// Messages are sent in the order they were queued, alternating between the
+// two test files.
+function fileIndex(aMessage) {
+  return aMessage % gMsgFile.length;
+}
+
+function queueMessage(aFile) {
+  let promiseListener = new PromiseTestUtils.PromiseCopyListener();
+  let listener = Object.create(copyListener);
+  listener.OnStopCopy = aStatus => promiseListener.OnStopCopy(aStatus);
+
+  // Setting the compFields sender and recipient to any value is required to
+  // survive mime_sanity_check_fields in nsMsgCompUtils.cpp.
+  let compFields = Cc[
+    "@mozilla.org/messengercompose/composefields;1"
+  ].createInstance(Ci.nsIMsgCompFields);
+  compFields.from = "irrelevant@foo.invalid";
+  compFields.to = "irrelevant@foo.invalid";
+
+  let msgSend = Cc["@mozilla.org/messengercompose/send;1"].createInstance(
+    Ci.nsIMsgSend
+  );
+  msgSend.sendMessageFile(
+    gIdentity,
+    "",
+    compFields,
+    aFile,
+    false,
+    false,
+    Ci.nsIMsgSend.nsMsgQueueForLater,
+    null,
+    listener,
+    null,
+    null
+  );
+  return promiseListener.promise;
+}
+
+// Each connection gets a daemon of its own, so that messages sent at the same
+// time don't end up in the same post. Each post is kept once it is accepted.
+function createServer() {
+  let server = setupServerDaemon(function(d) {
+    let handler = new SMTP_RFC2821_handler({});
+    let onMultiline = handler.onMultiline;
+    handler.onMultiline = function(aLine) {
+      let response = onMultiline.call(this, aLine);
+      if (aLine == "." && response && response.startsWith("250")) {
+        gPosts.push(this._daemon.post);
+      }
+      return response;
+    };
+    return handler;
+  });
+  server.latency = kLatency;
+  server.start();
+  return server;
+}
+
+function sendUnsentMessages() {
+  return new Promise((resolve, reject) => {
+    let inFlight = 0;
+    let maxInFlight = 0;
+    let listener = {
+      QueryInterface: ChromeUtils.generateQI([Ci.nsIMsgSendLaterListener]),
+      onStartSending(aTotalMessageCount) {
+        Assert.equal(aTotalMessageCount, kMessageCount);
+      },
+      onMessageStartSending(
+        aCurrentMessage,
+        aTotalMessageCount,
+        aMessageHeader,
+        aIdentity
+      ) {
+        inFlight++;
+        maxInFlight = Math.max(maxInFlight, inFlight);
+      },
+      onMessageSendProgress(
+        aCurrentMessage,
+        aTotalMessageCount,
+        aMessageSendPercent,
+        aMessageCopyPercent
+      ) {
+        if (aMessageSendPercent == 100 && aMessageCopyPercent == 100) {
+          inFlight--;
+        }
+      },
+      onMessageSendError(aCurrentMessage, aMessageHeader, aStatus, aMsg) {
+        reject(aStatus);
+      },
+      onStopSending(aStatus, aMsg, aTotalTried, aSuccessful) {
+        msgSendLater.removeListener(this);
+        Assert.equal(inFlight, 0);
+        resolve({
+          status: aStatus,
+          tried: aTotalTried,
+          successful: aSuccessful,
+          maxInFlight,
+        });
+      },
+    };
+    msgSendLater.addListener(listener);
+    msgSendLater.sendUnsentMessages(gIdentity);
+  });
+}
+
+add_task(function setup() {
+  for (let i = 0; i < gMsgFile.length; i++) {
+    gMsgFileData[i] = IOUtils.loadFileToString(gMsgFile[i]);
+  }
+
+  localAccountUtils.loadLocalMailAccount();
+  MailServices.accounts.setSpecialFolders();
+
+  let account = MailServices.accounts.createAccount();
+  let incomingServer = MailServices.accounts.createIncomingServer(
+    "test",
+    "localhost",
+    "pop3"
+  );
+
+  gSmtpServer = getBasicSmtpServer(1);
+  gIdentity = getSmtpIdentity(kIdentityMail, gSmtpServer);
+
+  account.addIdentity(gIdentity);
+  account.defaultIdentity = gIdentity;
+  account.incomingServer = incomingServer;
+  MailServices.accounts.defaultAccount = account;
+
+  gSentFolder = localAccountUtils.rootFolder.createLocalSubfolder("Sent");
+  Assert.equal(gIdentity.doFcc, true);
+});
+
+add_task(async function testParallelSendLater() {
+  for (let i = 0; i < kMessageCount; i++) {
+    await queueMessage(gMsgFile[fileIndex(i)]);
+  }
+  Assert.equal(
+    msgSendLater.getUnsentMessagesFolder(gIdentity).getTotalMessages(false),
+    kMessageCount
+  );
+
+  let server = createServer();
+  gSmtpServer.port = server.port;
+  gSmtpServer.maximumConnectionsNumber = 1;
+  Services.prefs.setIntPref("mailnews.sendLater.maxMessagesInFlight", 4);
+
+  let result = await sendUnsentMessages();
+  Assert.equal(result.status, Cr.NS_OK);
+  Assert.equal(result.tried, kMessageCount);
+  Assert.equal(result.successful, kMessageCount);
+
+  // The next messages were spooled while the first one was being sent.
+  Assert.greater(result.maxInFlight, 1);
+
+  // All of them went over the one connection, with an RSET between them.
+  let expected = ["EHLO test"];
+  for (let i = 0; i < kMessageCount; i++) {
+    let index = fileIndex(i);
+    if (i > 0) {
+      expected.push("RSET");
+    }
+    expected.push(
+      "MAIL FROM:<" +
+        kTestFileSender[index] +
+        "> BODY=8BITMIME SIZE=" +
+        gMsgFileData[index].length,
+      "RCPT TO:<" + kTestFileRecipient[index] + ">",
+      "DATA"
+    );
+  }
+  do_check_transaction(server.playTransaction(), expected);
+
+  Assert.equal(gPosts.length, kMessageCount);
+  for (let i = 0; i < kMessageCount; i++) {
+    Assert.equal(gPosts[i], gMsgFileData[fileIndex(i)]);
+  }
+
+  Assert.equal(msgSendLater.hasUnsentMessages(gIdentity), false);
+  Assert.equal(gSentFolder.getTotalMessages(false), kMessageCount);
+  server.stop();
+});
+
+add_task(async function testTwoConnections() {
+  for (let i = 0; i < kMessageCount; i++) {
+    await queueMessage(gMsgFile[fileIndex(i)]);
+  }
+
+  let server = createServer();
+  gSmtpServer.port = server.port;
+  gSmtpServer.maximumConnectionsNumber = 2;
+  gPosts = [];
+
+  let result = await sendUnsentMessages();
+  Assert.equal(result.status, Cr.NS_OK);
+  Assert.equal(result.successful, kMessageCount);
+
+  // No more connections were opened than allowed, both of them were used, and
+  // each one sent an RSET before every message but its first.
+  let transactions = server.playTransaction();
+  Assert.equal(transactions.length, 2);
+  let sent = 0;
+  for (let transaction of transactions) {
+    let mails = transaction.them.filter(c => c.startsWith("MAIL FROM:")).length;
+    let resets = transaction.them.filter(c => c == "RSET").length;
+    Assert.greater(mails, 0);
+    Assert.equal(resets, mails - 1);
+    sent += mails;
+  }
+  Assert.equal(sent, kMessageCount);
+
+  // The messages may have been accepted in any order.
+  let expected = [];
+  for (let i = 0; i < kMessageCount; i++) {
+    expected.push(gMsgFileData[fileIndex(i)]);
+  }
+  Assert.deepEqual(gPosts.sort(), expected.sort());
+
+  Assert.equal(msgSendLater.hasUnsentMessages(gIdentity), false);
+  Assert.equal(gSentFolder.getTotalMessages(false), 2 * kMessageCount);
+  server.stop();
+});
+
+add_task(function endTest() {
+  Services.prefs.clearUserPref("mailnews.sendLater.maxMessagesInFlight");
+});
@@ -0,0 +1,198 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Sends a message to many recipients through a server with 50 ms of latency.
+ * Checks that with PIPELINING the MAIL FROM and RCPT TO commands go out
+ * together and DATA once the recipients have been accepted, that a rejected
+ * recipient is still reported as such and nothing is sent after the responses
+ * to the other recipients but QUIT, and that with CHUNKING the message goes
+ * out with BDAT and without dot-stuffing, and not at all if a recipient is
+ * rejected.
+ * Reports how long sending took with and without pipelining.
+ */
+
+/* import-globals-from ../../../test/resources/alertTestUtils.js */
+load("../../../resources/alertTestUtils.js");
+
+var { PromiseTestUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/PromiseTestUtils.jsm"
+);
+
+var NS_ERROR_BUT_DONT_SHOW_ALERT = 0x805530ef;
+
+var kLatency = 50;
+var kSender = "from@foo.invalid";
+var kRecipients = [];
+for (let i = 0; i < 20; i++) {
+  kRecipients.push("to" + i + "@foo.invalid");
+}
+var kRejected = kRecipients[7];
+
+var gAlertText = null;
+var gMessageFile;
+var gMessageData;
+
+/* exported alert */
+// for alertTestUtils.js
+function alert(aDialogTitle, aText) {
+  gAlertText = aText;
+}
+
+function createServer(aCapabilities, aRejectRecipient = false) {
+  let server = setupServerDaemon(function(d) {
+    let handler = new SMTP_RFC2821_handler(d);
+    handler.kCapabilities = aCapabilities;
+    if (aRejectRecipient) {
+      handler.RCPT = function(args) {
+        if (args == "TO:<" + kRejected + ">") {
+          return "550 5.1.1 No such user";
+        }
+        return "250 ok";
+      };
+    }
+    return handler;
+  });
+  server.latency = kLatency;
+  server.start();
+  return server;
+}
+
+// The sender goes in MAIL FROM, and the recipients are sent last one first.
+// Without aDataCommand, the transaction stops at the recipients.
+function expectedCommands(aRecipients, aDataCommand) {
+  return [
+    "EHLO test",
+    "MAIL FROM:<" + kSender + "> BODY=8BITMIME SIZE=" + gMessageData.length,
+  ]
+    .concat(aRecipients.map(r => "RCPT TO:<" + r + ">").reverse())
+    .concat(aDataCommand ? [aDataCommand] : []);
+}
+
+// Checks that MAIL FROM and all the recipients reached the server before it
+// had answered any of them, and that aNextCommand only came once it had
+// answered all of them.
+function checkPipelined(aTransaction, aRecipientCount, aNextCommand) {
+  let { them, sentBefore } = aTransaction;
+  let mail = them.findIndex(command => command.startsWith("MAIL FROM:"));
+  Assert.notEqual(mail, -1);
+  for (let i = 1; i <= aRecipientCount; i++) {
+    Assert.ok(them[mail + i].startsWith("RCPT TO:"));
+    Assert.equal(sentBefore[mail + i], sentBefore[mail]);
+  }
+  let next = mail + aRecipientCount + 1;
+  Assert.equal(them[next], aNextCommand);
+  Assert.equal(sentBefore[next], sentBefore[mail] + aRecipientCount + 1);
+}
+
+async function sendMessage(aServer, aRecipients) {
+  let smtpServer = getBasicSmtpServer(aServer.port);
+  let identity = getSmtpIdentity(kSender, smtpServer);
+  let urlListener = new PromiseTestUtils.PromiseUrlListener();
+  let start = Date.now();
+  MailServices.smtp.sendMailMessage(
+    gMessageFile,
+    aRecipients.join(", "),
+    identity,
+    kSender,
+    null,
+    urlListener,
+    null,
+    null,
+    false,
+    {},
+    {}
+  );
+  try {
+    await urlListener.promise;
+  } finally {
+    MailServices.smtp.deleteServer(smtpServer);
+  }
+  return Date.now() - start;
+}
+
+add_task(function setup() {
+  registerAlertTestUtils();
+  localAccountUtils.loadLocalMailAccount();
+
+  // A line starting with a dot has to be dot-stuffed after DATA, but not
+  // after BDAT.
+  gMessageData =
+    IOUtils.loadFileToString(do_get_file("data/message1.eml")) +
+    ".a line starting with a dot\r\n";
+  gMessageFile = do_get_profile();
+  gMessageFile.append("pipelining.eml");
+  IOUtils.saveStringToFile(gMessageFile, gMessageData);
+});
+
+add_task(async function testPipelining() {
+  Services.prefs.setBoolPref("mail.smtp.pipelining", false);
+  let server = createServer(["8BITMIME", "SIZE", "PIPELINING"]);
+  let serialTime = await sendMessage(server, kRecipients);
+  do_check_transaction(
+    server.playTransaction(),
+    expectedCommands(kRecipients, "DATA")
+  );
+  Assert.equal(server._daemon.post, gMessageData);
+  server.stop();
+
+  Services.prefs.setBoolPref("mail.smtp.pipelining", true);
+  server = createServer(["8BITMIME", "SIZE", "PIPELINING"]);
+  let pipelinedTime = await sendMessage(server, kRecipients);
+  let transaction = server.playTransaction();
+  checkPipelined(transaction, kRecipients.length, "DATA");
+  do_check_transaction(transaction, expectedCommands(kRecipients, "DATA"));
+  Assert.equal(server._daemon.post, gMessageData);
+  Assert.ok(server.maxLinesInFlight >= kRecipients.length + 1);
+  server.stop();
+
+  info(
+    `${kRecipients.length} recipients with ${kLatency} ms latency took ` +
+      `${serialTime} ms one command at a time, ${pipelinedTime} ms pipelined`
+  );
+});
+
+add_task(async function testPipelinedRecipientRejected() {
+  for (let capabilities of [
+    ["8BITMIME", "SIZE", "PIPELINING"],
+    ["8BITMIME", "SIZE", "PIPELINING", "CHUNKING"],
+  ]) {
+    let server = createServer(capabilities, true);
+    gAlertText = null;
+    await Assert.rejects(
+      sendMessage(server, kRecipients),
+      e => e == NS_ERROR_BUT_DONT_SHOW_ALERT
+    );
+    Assert.ok(gAlertText.includes(kRejected));
+    Assert.ok(gAlertText.includes("No such user"));
+
+    // The responses to all recipients were read before QUIT, and neither
+    // DATA nor BDAT was sent.
+    let transaction = server.playTransaction();
+    checkPipelined(transaction, kRecipients.length, "QUIT");
+    Assert.ok(
+      !transaction.them.some(c => c == "DATA" || c.startsWith("BDAT "))
+    );
+    do_check_transaction(transaction, expectedCommands(kRecipients));
+    Assert.equal(server._daemon.post, undefined);
+    server.stop();
+  }
+});
+
+add_task(async function testChunking() {
+  let server = createServer(["8BITMIME", "SIZE", "PIPELINING", "CHUNKING"]);
+  await sendMessage(server, kRecipients.slice(0, 3));
+  let bdat = "BDAT " + gMessageData.length + " LAST";
+  let transaction = server.playTransaction();
+  checkPipelined(transaction, 3, bdat);
+  do_check_transaction(
+    transaction,
+    expectedCommands(kRecipients.slice(0, 3), bdat)
+  );
+  Assert.equal(server._daemon.post, gMessageData);
+  server.stop();
+});
+
+add_task(function endTest() {
+  Services.prefs.clearUserPref("mail.smtp.pipelining");
+});
@@ -6,9 +6,12 @@
 #ifndef _nsMsgDatabase_H_
 #define _nsMsgDatabase_H_
 
+#include "mozilla/Atomics.h"
 #include "mozilla/Attributes.h"
 #include "mozilla/MemoryReporting.h"
+#include "mozilla/Monitor.h"
 #include "mozilla/Path.h"
+#include "mozilla/TimeStamp.h"
 #include "nsIFile.h"
 #include "nsIMsgDatabase.h"
 #include "nsMsgHdr.h"
@@ -26,12 +29,17 @@
 #include "nsCOMPtr.h"
 #include "nsCOMArray.h"
 #include "PLDHashTable.h"
+#include "nsDataHashtable.h"
 #include "nsTArray.h"
 #include "nsTObserverArray.h"
 #include "nsSimpleEnumerator.h"
+#include "nsIThreadPool.h"
+#include "nsProxyRelease.h"
+#include "nsThreadUtils.h"
 
 class nsMsgThread;
 class nsMsgDatabase;
+class nsMsgDBIndex;
 class nsIMsgThread;
 
 const int32_t kMsgDBVersion = 1;
@@ -56,6 +64,11 @@ class nsMsgDBService final : public nsIMsgDBService {
   void RemoveFromCache(nsMsgDatabase *pMessageDB) {
     m_dbCache.RemoveElement(pMessageDB);
   }
+  // Starts parsing the summary of an asynchronously opened db on the db open
+  // thread pool, unless mail.db.open_threads is 0.
+  void DispatchParse(nsMsgDatabase *aMsgDB);
+  // Called on the main thread after each parse the pool ran.
+  void ParseDone();
 
  protected:
   ~nsMsgDBService();
@@ -66,6 +79,43 @@ class nsMsgDBService final : public nsIMsgDBService {
   nsCOMArray<nsIMsgFolder> m_foldersPendingListeners;
   nsCOMArray<nsIDBChangeListener> m_pendingListeners;
   AutoTArray<nsMsgDatabase *, kInitialMsgDBCacheSize> m_dbCache;
+  nsCOMPtr<nsIThreadPool> m_parsePool;
+  uint32_t m_pendingParses;
+};
+
+/**
+ * Runs the mork parse of an asynchronously opened db on the db open thread
+ * pool. The thumb, and the env and heap private to the db that the store is
+ * built in, belong to the task until it's done. The main thread then turns
+ * the thumb into the open store in nsMsgDBService::OpenMore.
+ */
+class nsMsgDBParseTask final : public mozilla::Runnable {
+ public:
+  nsMsgDBParseTask(nsMsgDBService *aService, nsIMdbThumb *aThumb,
+                   nsIMdbEnv *aEnv);
+
+  NS_IMETHOD Run() override;
+
+  // Main thread only. Return true once the parse is over.
+  bool WaitUntilDone(mozilla::TimeDuration aTimeout);
+  void WaitUntilDone();
+  // Makes the parse stop at its next step. Callers still have to wait.
+  void Cancel() { mCancelled = true; }
+  // Only valid once the parse is over.
+  nsresult Result() const { return mResult; }
+
+ private:
+  ~nsMsgDBParseTask() {}
+
+  nsMainThreadPtrHandle<nsMsgDBService> mService;
+  // Kept alive by the db's m_thumb and m_mdbEnv, which aren't touched while
+  // the parse runs.
+  nsIMdbThumb *mThumb;
+  nsIMdbEnv *mEnv;
+  mozilla::Monitor mMonitor;
+  bool mDone;  // protected by mMonitor
+  nsresult mResult;
+  mozilla::Atomic<bool> mCancelled;
 };
 
 class nsMsgDBEnumerator : public nsSimpleEnumerator {
@@ -173,7 +223,12 @@ class nsMsgDatabase : public nsIMsgDatabase {
   nsMsgDatabase();
 
   nsresult GetMDBFactory(nsIMdbFactory **aMdbFactory);
-  nsIMdbEnv *GetEnv() { return m_mdbEnv; }
+  nsIMdbEnv *GetEnv() {
+    // The env belongs to the parse of an asynchronous open until OpenMore
+    // has seen it end. There's no store or row to use it with before then,
+    // so rather than block the main thread on the parse, there's no env.
+    return m_parseTask ? nullptr : m_mdbEnv;
+  }
   nsIMdbStore *GetStore() { return m_mdbStore; }
   virtual uint32_t GetCurVersion();
   nsresult GetCollationKeyGenerator();
@@ -254,6 +309,12 @@ class nsMsgDatabase : public nsIMsgDatabase {
   static void YarnToUInt32(struct mdbYarn *yarn, uint32_t *i);
   static void YarnToUInt64(struct mdbYarn *yarn, uint64_t *i);
 
+  // The folder info properties holding the stamp of the last save of the
+  // message id index, and the header count and high water mark it was saved
+  // with; they aren't carried over to a rebuilt summary.
+  static const char kIndexStampProperty[];
+  static const char kIndexCheckProperty[];
+
 #ifdef DEBUG
   virtual nsresult DumpContents();
   nsresult DumpThread(nsMsgKey threadId);
@@ -344,9 +405,17 @@ class nsMsgDatabase : public nsIMsgDatabase {
   // Used for asynchronous db opens. If non-null, we're still opening
   // the underlying mork database. If null, the db has been completely opened.
   nsCOMPtr<nsIMdbThumb> m_thumb;
+  // Set while m_thumb is parsed on the db open thread pool.
+  RefPtr<nsMsgDBParseTask> m_parseTask;
+  // Waits for the parse to end, cancelling it first if asked, and returns
+  // its result.
+  nsresult EndParse(bool aCancel);
   // used to remember the args to Open for async open.
   bool m_create;
   bool m_leaveInvalidDB;
+  // A compress commit is waiting for the main thread to become idle.
+  bool m_compressPending;
+  void ScheduleIdleCompress();
 
   nsCOMPtr<nsIFile> m_dbFile;
   nsTArray<nsMsgKey> m_newSet;  // new messages since last open.
@@ -398,9 +467,18 @@ class nsMsgDatabase : public nsIMsgDatabase {
 
   // not-reference holding array of threads we've handed out.
   // If a db goes away, it will clean up the outstanding threads.
-  // We use an nsTArray because we don't expect to ever have very many
-  // of these, rarely more than 5.
+  // Threaded views of big folders can have thousands of these, so they're
+  // also indexed by thread key, and each thread knows its slot in the array.
   nsTArray<nsMsgThread *> m_threads;
+  nsDataHashtable<nsUint32HashKey, nsMsgThread *> m_threadsByKey;
+  // How many threads have a key that another thread is indexed by.
+  uint32_t m_numUnindexedThreads;
+  // Called by nsMsgThread as thread objects come, go and learn their key.
+  void AddThread(nsMsgThread *aThread);
+  void RemoveThread(nsMsgThread *aThread);
+  void ThreadKeyChanged(nsMsgThread *aThread, nsMsgKey aOldKey);
+  // Stops indexing a thread by a key it no longer has, or is going away with.
+  void UnindexThread(nsMsgThread *aThread, nsMsgKey aKey);
   // Clear outstanding thread objects
   void ClearThreads();
   nsMsgThread *FindExistingThread(nsMsgKey threadId);
@@ -427,20 +505,25 @@ class nsMsgDatabase : public nsIMsgDatabase {
   nsCOMPtr<nsIMsgThread> m_cachedThread;
   nsCOMPtr<nsIMdbFactory> mMdbFactory;
 
-  // Message reference hash table
-  static PLDHashTableOps gRefHashTableOps;
-  struct RefHashElement : public PLDHashEntryHdr {
-    const char *mRef;  // Hash entry key, must come first
-    nsMsgKey mThreadId;
-    uint32_t mCount;
-  };
-  PLDHashTable *m_msgReferences;
-  nsresult GetRefFromHash(nsCString &reference, nsMsgKey *threadId);
-  nsresult AddRefToHash(nsCString &reference, nsMsgKey threadId);
-  nsresult AddMsgRefsToHash(nsIMsgDBHdr *msgHdr);
-  nsresult RemoveRefFromHash(nsCString &reference);
-  nsresult RemoveMsgRefsFromHash(nsIMsgDBHdr *msgHdr);
-  nsresult InitRefHash();
+  // Message-ID and References index, loaded on first use, and saved next to
+  // the summary file when the db is committed.
+  nsAutoPtr<nsMsgDBIndex> m_index;
+  // Returns the loaded index, or null if it can't be loaded.
+  nsMsgDBIndex *GetIndex();
+  // Returns the index to change, if it's loaded or can be opened. The first
+  // change after a save clears the saved stamp, so that a commit that doesn't
+  // save the index can't make the file look current.
+  nsMsgDBIndex *GetIndexToChange();
+  bool OpenIndex();
+  int64_t IndexCheck();
+  nsresult InitIndex();
+  void SaveIndex(bool aRewrite);
+  void NoteSummaryInIndex();
+  void AddHdrToIndex(nsIMsgDBHdr *msgHdr);
+  void RemoveHdrFromIndex(nsIMsgDBHdr *msgHdr);
+  nsresult GetThreadIdForReference(nsCString &reference, nsMsgKey *threadId);
+  // Called by nsMsgHdr::SetMessageId before the id changes.
+  void MessageIdChanging(nsMsgHdr *msgHdr, const nsACString &newId);
 
   // not-reference holding array of enumerators we've handed out.
   // If a db goes away, it will clean up the outstanding enumerators.
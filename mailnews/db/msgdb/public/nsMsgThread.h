@@ -53,6 +53,7 @@ class nsMsgThread : public nsIMsgThread {
                                          nsMsgKey threadParentKey);
 
   nsMsgKey m_threadKey;
+  uint32_t m_threadIndex;  // in m_mdbDB->m_threads
   uint32_t m_numChildren;
   uint32_t m_numUnreadChildren;
   uint32_t m_flags;
@@ -880,6 +880,12 @@ NS_IMETHODIMP nsDBFolderInfo::GetTransferInfo(nsIDBFolderInfo **transferInfo) {
       if (NS_SUCCEEDED(err)) {
         m_mdb->GetStore()->TokenToString(m_mdb->GetEnv(), cellColumn,
                                          &cellName);
+        // the message id index belongs to this summary file, not the new one
+        nsDependentCSubstring name((const char *)cellName.mYarn_Buf,
+                                   cellName.mYarn_Fill);
+        if (name.Equals(nsMsgDatabase::kIndexStampProperty) ||
+            name.Equals(nsMsgDatabase::kIndexCheckProperty))
+          continue;
         newInfo->m_values.AppendElement(
             Substring((const char *)cellYarn.mYarn_Buf,
                       (const char *)cellYarn.mYarn_Buf + cellYarn.mYarn_Fill));
@@ -0,0 +1,669 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "nsMsgDBIndex.h"
+
+#include <algorithm>
+#include "mozilla/EndianUtils.h"
+#include "msgCore.h"
+#include "nsTArray.h"
+
+/*
+  Format of the index file. Numbers are 32 bit big endian, and the tables
+  are used in place through a memory mapping:
+  [0x4D494458] ("MIDX")
+  [version = 1][stamp, high 32 bits][stamp, low 32 bits]
+  [number of ids][id bucket bits][number of references][reference bucket bits]
+  [size of the strings]
+  for the ids, and then the references
+    for each of the 2^B buckets, and once more for the end of the table
+      [index of the first entry whose (hash >> (32 - B)) >= bucket]
+    for each entry, sorted by hash and then string
+      [hash of string][offset of string][length of string][value][count]
+  for each id, and then each reference
+    string, NUL terminated
+  the journal: for each save since the tables were written
+    for each id or reference changed by the save
+      [1 for an id, 2 for a reference][value][count][length of string]string
+    [3][stamp, high 32 bits][stamp, low 32 bits]
+  after the last save, once the db has been committed with it
+    [4][summary file size, high 32 bits][low 32 bits]
+    [summary file modification time, high 32 bits][low 32 bits]
+
+  An id's value is the key of a header with the id, and a reference's value
+  is a thread id. A count of 0 in the journal means the string was removed.
+*/
+
+static const char kIndexCookie[] = {'M', 'I', 'D', 'X'};
+static const uint32_t kIndexVersion = 1;
+static const uint32_t kIndexHeaderSize = 36;
+static const uint32_t kIndexEntrySize = 20;
+static const uint32_t kIndexMaxBucketBits = 24;
+static const uint32_t kJournalId = 1;
+static const uint32_t kJournalReference = 2;
+static const uint32_t kJournalSave = 3;
+static const uint32_t kJournalSummary = 4;
+static const uint32_t kJournalSummarySize = 20;
+// The journal is merged into the tables once it's bigger than this, or than
+// a quarter of the tables.
+static const uint32_t kMaxJournalSize = 256 * 1024;
+
+namespace {
+
+// Buffers big endian numbers and bytes, so that the index is written in
+// large blocks rather than a few bytes at a time.
+class IndexWriter {
+ public:
+  explicit IndexWriter(FILE *aStream) : mStream(aStream), mError(false) {
+    mBuffer.SetCapacity(kBlockSize);
+  }
+
+  void WriteUInt32(uint32_t aValue) {
+    uint8_t bytes[sizeof(uint32_t)];
+    mozilla::BigEndian::writeUint32(bytes, aValue);
+    Write(bytes, sizeof(bytes));
+  }
+
+  void Write(const void *aData, uint32_t aLength) {
+    mBuffer.AppendElements(static_cast<const uint8_t *>(aData), aLength);
+    if (mBuffer.Length() >= kBlockSize) Flush();
+  }
+
+  // @return false if any write failed
+  bool Flush() {
+    if (!mError && !mBuffer.IsEmpty() &&
+        fwrite(mBuffer.Elements(), mBuffer.Length(), 1, mStream) != 1)
+      mError = true;
+    mBuffer.Clear();
+    return !mError;
+  }
+
+ private:
+  static const uint32_t kBlockSize = 65536;
+  FILE *mStream;
+  nsTArray<uint8_t> mBuffer;
+  bool mError;
+};
+
+// an entry to be written to the tables
+struct IndexWriteEntry {
+  uint32_t mHash;
+  uint32_t mLength;
+  const char *mString;
+  uint32_t mValue;
+  uint32_t mCount;
+};
+
+uint32_t Hash(const char *aString, uint32_t aLength) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < aLength; i++) {
+    hash ^= static_cast<uint8_t>(aString[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+}  // namespace
+
+nsMsgDBIndex::nsMsgDBIndex(nsIFile *aSummaryFile)
+    : mFD(nullptr),
+      mMap(nullptr),
+      mData(nullptr),
+      mSize(0),
+      mIds(),
+      mRefs(),
+      mStringsOffset(0),
+      mJournalOffset(0),
+      mJournalEnd(0),
+      mLoaded(false),
+      mDirty(false) {
+  // the sidecar is named after the summary file, e.g. "Inbox.msf.idx"
+  nsAutoString leafName;
+  if (!aSummaryFile ||
+      NS_FAILED(aSummaryFile->Clone(getter_AddRefs(mSummaryFile))) ||
+      NS_FAILED(aSummaryFile->Clone(getter_AddRefs(mFile))) ||
+      NS_FAILED(mFile->GetLeafName(leafName))) {
+    mFile = nullptr;
+    return;
+  }
+  leafName.AppendLiteral(SUMMARY_INDEX_SUFFIX);
+  if (NS_FAILED(mFile->SetLeafName(leafName))) mFile = nullptr;
+}
+
+nsMsgDBIndex::~nsMsgDBIndex() { Close(); }
+
+bool nsMsgDBIndex::Open(uint64_t aStamp) {
+  Close();
+  mIdChanges.Clear();
+  mRefChanges.Clear();
+  mUnsavedIds.Clear();
+  mUnsavedRefs.Clear();
+  mLoaded = false;
+  mDirty = false;
+
+  uint64_t fileStamp;
+  if (!aStamp || !Map(&fileStamp)) return false;
+  // If the tables have the stamp, saves after them weren't committed with
+  // the db, and Map left the end of the journal at its start.
+  if ((fileStamp != aStamp && !ReadJournal(aStamp)) || !SummaryFileMatches()) {
+    Close();
+    mIdChanges.Clear();
+    mRefChanges.Clear();
+    return false;
+  }
+  mLoaded = true;
+  return true;
+}
+
+bool nsMsgDBIndex::Map(uint64_t *aStamp) {
+  Close();
+  if (!mFile) return false;
+
+  int64_t fileSize;
+  nsresult rv = mFile->GetFileSize(&fileSize);
+  if (NS_FAILED(rv) || fileSize < kIndexHeaderSize || fileSize > UINT32_MAX)
+    return false;
+
+  rv = mFile->OpenNSPRFileDesc(PR_RDONLY, 0, &mFD);
+  if (NS_FAILED(rv)) return false;
+  mMap = PR_CreateFileMap(mFD, fileSize, PR_PROT_READONLY);
+  if (mMap)
+    mData = static_cast<const uint8_t *>(PR_MemMap(mMap, 0, fileSize));
+  if (!mData) {
+    Close();
+    return false;
+  }
+  mSize = static_cast<uint32_t>(fileSize);
+
+  if (memcmp(mData, kIndexCookie, sizeof(kIndexCookie)) ||
+      ReadUInt32(4) != kIndexVersion) {
+    Close();
+    return false;
+  }
+  *aStamp = (uint64_t(ReadUInt32(8)) << 32) | ReadUInt32(12);
+
+  uint64_t offset = kIndexHeaderSize;
+  if (!MapSection(ReadUInt32(16), ReadUInt32(20), offset, mIds) ||
+      !MapSection(ReadUInt32(24), ReadUInt32(28), offset, mRefs)) {
+    Close();
+    return false;
+  }
+  mStringsOffset = static_cast<uint32_t>(offset);
+  offset += ReadUInt32(32);
+  if (offset > mSize) {
+    Close();
+    return false;
+  }
+  mJournalOffset = static_cast<uint32_t>(offset);
+  mJournalEnd = mJournalOffset;
+  return true;
+}
+
+void nsMsgDBIndex::Close() {
+  if (mData) PR_MemUnmap(const_cast<uint8_t *>(mData), mSize);
+  if (mMap) PR_CloseFileMap(mMap);
+  if (mFD) PR_Close(mFD);
+  mFD = nullptr;
+  mMap = nullptr;
+  mData = nullptr;
+  mSize = 0;
+  mIds = Section();
+  mRefs = Section();
+  mStringsOffset = 0;
+  mJournalOffset = 0;
+  mJournalEnd = 0;
+}
+
+bool nsMsgDBIndex::MapSection(uint32_t aCount, uint32_t aBucketBits,
+                              uint64_t &aOffset, Section &aSection) {
+  if (aBucketBits > kIndexMaxBucketBits) return false;
+  aSection.mCount = aCount;
+  aSection.mBucketBits = aBucketBits;
+  aSection.mDirectoryOffset = static_cast<uint32_t>(aOffset);
+  aOffset += ((uint64_t(1) << aBucketBits) + 1) * sizeof(uint32_t);
+  if (aOffset > mSize) return false;
+  aSection.mEntriesOffset = static_cast<uint32_t>(aOffset);
+  aOffset += uint64_t(aCount) * kIndexEntrySize;
+  return aOffset <= mSize;
+}
+
+// Applies the journal up to the save stamped aStamp.
+bool nsMsgDBIndex::ReadJournal(uint64_t aStamp) {
+  // Find the save first, so that nothing is applied if it isn't there. A
+  // save that was cut short, or that comes after it, is ignored.
+  uint64_t offset = mJournalOffset;
+  uint32_t end = 0;
+  while (!end && offset + 12 <= mSize) {
+    uint32_t kind = ReadUInt32(offset);
+    if (kind == kJournalSave) {
+      uint64_t stamp = (uint64_t(ReadUInt32(offset + 4)) << 32) |
+                       ReadUInt32(offset + 8);
+      offset += 12;
+      if (stamp == aStamp) end = static_cast<uint32_t>(offset);
+    } else if (kind == kJournalId || kind == kJournalReference) {
+      if (offset + 16 > mSize) break;
+      offset += 16 + uint64_t(ReadUInt32(offset + 12));
+    } else {
+      break;
+    }
+  }
+  if (!end) return false;
+
+  uint32_t record = mJournalOffset;
+  while (record < end) {
+    uint32_t kind = ReadUInt32(record);
+    if (kind == kJournalSave) {
+      record += 12;
+      continue;
+    }
+    Entry entry = {ReadUInt32(record + 4), ReadUInt32(record + 8)};
+    uint32_t length = ReadUInt32(record + 12);
+    nsDependentCSubstring string(
+        reinterpret_cast<const char *>(mData + record + 16), length);
+    (kind == kJournalId ? mIdChanges : mRefChanges).Put(string, entry);
+    record += 16 + length;
+  }
+  mJournalEnd = end;
+  return true;
+}
+
+bool nsMsgDBIndex::GetSummaryFileState(uint64_t *aSize,
+                                       uint64_t *aTime) const {
+  // a fresh clone, so that nothing cached about the file is used
+  nsCOMPtr<nsIFile> summaryFile;
+  int64_t size;
+  PRTime time;
+  if (!mSummaryFile ||
+      NS_FAILED(mSummaryFile->Clone(getter_AddRefs(summaryFile))) ||
+      NS_FAILED(summaryFile->GetFileSize(&size)) ||
+      NS_FAILED(summaryFile->GetLastModifiedTime(&time)))
+    return false;
+  *aSize = static_cast<uint64_t>(size);
+  *aTime = static_cast<uint64_t>(time);
+  return true;
+}
+
+bool nsMsgDBIndex::SummaryFileMatches() const {
+  uint64_t size, time;
+  if (uint64_t(mJournalEnd) + kJournalSummarySize > mSize ||
+      ReadUInt32(mJournalEnd) != kJournalSummary ||
+      !GetSummaryFileState(&size, &time))
+    return false;
+  return ReadUInt64(mJournalEnd + 4) == size &&
+         ReadUInt64(mJournalEnd + 12) == time;
+}
+
+inline uint32_t nsMsgDBIndex::ReadUInt32(uint32_t aOffset) const {
+  return mozilla::BigEndian::readUint32(mData + aOffset);
+}
+
+inline uint64_t nsMsgDBIndex::ReadUInt64(uint32_t aOffset) const {
+  return mozilla::BigEndian::readUint64(mData + aOffset);
+}
+
+const char *nsMsgDBIndex::EntryString(const Section &aSection, uint32_t aIndex,
+                                      uint32_t *aLength) const {
+  if (aIndex >= aSection.mCount) return nullptr;
+  uint32_t entry = aSection.mEntriesOffset + aIndex * kIndexEntrySize;
+  uint32_t offset = ReadUInt32(entry + 4);
+  uint32_t length = ReadUInt32(entry + 8);
+  uint32_t stringsSize = mJournalOffset - mStringsOffset;
+  if (offset >= stringsSize || length >= stringsSize - offset) return nullptr;
+  const char *string =
+      reinterpret_cast<const char *>(mData + mStringsOffset + offset);
+  if (string[length]) return nullptr;
+  *aLength = length;
+  return string;
+}
+
+bool nsMsgDBIndex::FindInFile(const Section &aSection,
+                              const nsACString &aString, Entry *aEntry) const {
+  if (!aSection.mCount) return false;
+
+  uint32_t hash = Hash(aString.BeginReading(), aString.Length());
+  uint32_t bucket = aSection.mBucketBits ? hash >> (32 - aSection.mBucketBits)
+                                         : 0;
+  uint32_t directory = aSection.mDirectoryOffset + bucket * 4;
+  uint32_t low = std::min(ReadUInt32(directory), aSection.mCount);
+  uint32_t high = std::min(ReadUInt32(directory + 4), aSection.mCount);
+  auto hashAt = [&](uint32_t aIndex) {
+    return ReadUInt32(aSection.mEntriesOffset + aIndex * kIndexEntrySize);
+  };
+
+  // find the first entry in the bucket with this hash
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (hashAt(middle) < hash)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  for (; low < aSection.mCount && hashAt(low) == hash; low++) {
+    uint32_t length;
+    const char *string = EntryString(aSection, low, &length);
+    if (!string || length != aString.Length() ||
+        memcmp(string, aString.BeginReading(), length))
+      continue;
+    uint32_t entry = aSection.mEntriesOffset + low * kIndexEntrySize;
+    aEntry->mValue = ReadUInt32(entry + 12);
+    aEntry->mCount = ReadUInt32(entry + 16);
+    return true;
+  }
+  return false;
+}
+
+nsMsgDBIndex::Entry nsMsgDBIndex::Get(const Section &aSection,
+                                      const EntryTable &aChanges,
+                                      const nsACString &aString) const {
+  Entry entry = {nsMsgKey_None, 0};
+  if (!aChanges.Get(aString, &entry)) FindInFile(aSection, aString, &entry);
+  return entry;
+}
+
+void nsMsgDBIndex::Put(EntryTable &aChanges, StringSet &aUnsaved,
+                       const nsACString &aString, const Entry &aEntry) {
+  aChanges.Put(aString, aEntry);
+  aUnsaved.PutEntry(aString);
+  mDirty = true;
+}
+
+nsMsgDBIndex::LookupResult nsMsgDBIndex::GetKeyForMessageId(
+    const nsACString &aMessageId, nsMsgKey *aKey) {
+  Entry entry = Get(mIds, mIdChanges, aMessageId);
+  if (!entry.mCount) return kNotFound;
+  if (entry.mValue == nsMsgKey_None) return kUnknown;
+  *aKey = entry.mValue;
+  return kFound;
+}
+
+bool nsMsgDBIndex::GetThreadForReference(const nsACString &aReference,
+                                         nsMsgKey *aThreadId) {
+  Entry entry = Get(mRefs, mRefChanges, aReference);
+  if (!entry.mCount) return false;
+  *aThreadId = entry.mValue;
+  return true;
+}
+
+void nsMsgDBIndex::AddMessageId(const nsACString &aMessageId, nsMsgKey aKey) {
+  if (aMessageId.IsEmpty()) return;
+  Entry entry = Get(mIds, mIdChanges, aMessageId);
+  if (!entry.mCount || entry.mValue == nsMsgKey_None) entry.mValue = aKey;
+  entry.mCount++;
+  Put(mIdChanges, mUnsavedIds, aMessageId, entry);
+}
+
+void nsMsgDBIndex::RemoveMessageId(const nsACString &aMessageId,
+                                   nsMsgKey aKey) {
+  if (aMessageId.IsEmpty()) return;
+  Entry entry = Get(mIds, mIdChanges, aMessageId);
+  if (!entry.mCount) return;
+  // If other headers have the id, which one is left isn't known.
+  if (--entry.mCount == 0 || entry.mValue == aKey)
+    entry.mValue = nsMsgKey_None;
+  Put(mIdChanges, mUnsavedIds, aMessageId, entry);
+}
+
+void nsMsgDBIndex::AddReference(const nsACString &aReference,
+                                nsMsgKey aThreadId) {
+  if (aReference.IsEmpty()) return;
+  Entry entry = Get(mRefs, mRefChanges, aReference);
+  if (!entry.mCount) entry.mValue = aThreadId;
+  entry.mCount++;
+  Put(mRefChanges, mUnsavedRefs, aReference, entry);
+}
+
+void nsMsgDBIndex::RemoveReference(const nsACString &aReference) {
+  if (aReference.IsEmpty()) return;
+  Entry entry = Get(mRefs, mRefChanges, aReference);
+  if (!entry.mCount) return;
+  entry.mCount--;
+  Put(mRefChanges, mUnsavedRefs, aReference, entry);
+}
+
+nsresult nsMsgDBIndex::Save(uint64_t aStamp, bool aRewrite) {
+  if (!mLoaded || !mFile) return NS_ERROR_NOT_INITIALIZED;
+  uint64_t journalSize = mJournalEnd - mJournalOffset;
+  if (aRewrite || !mData ||
+      journalSize > std::max(kMaxJournalSize, mJournalOffset / 4) ||
+      mJournalEnd > INT32_MAX)
+    return Rewrite(aStamp);
+  return Append(aStamp);
+}
+
+nsresult nsMsgDBIndex::Append(uint64_t aStamp) {
+  FILE *stream;
+  nsresult rv = mFile->OpenANSIFileDesc("r+b", &stream);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // anything after the last save Open used is overwritten
+  bool written = !fseek(stream, mJournalEnd, SEEK_SET);
+  long end = 0;
+  if (written) {
+    IndexWriter writer(stream);
+    auto writeChanges = [&](uint32_t aKind, const Section &aSection,
+                            const EntryTable &aChanges,
+                            const StringSet &aUnsaved) {
+      for (auto iter = aUnsaved.ConstIter(); !iter.Done(); iter.Next()) {
+        const nsACString &string = iter.Get()->GetKey();
+        Entry entry = Get(aSection, aChanges, string);
+        writer.WriteUInt32(aKind);
+        writer.WriteUInt32(entry.mValue);
+        writer.WriteUInt32(entry.mCount);
+        writer.WriteUInt32(string.Length());
+        writer.Write(string.BeginReading(), string.Length());
+      }
+    };
+    writeChanges(kJournalId, mIds, mIdChanges, mUnsavedIds);
+    writeChanges(kJournalReference, mRefs, mRefChanges, mUnsavedRefs);
+    writer.WriteUInt32(kJournalSave);
+    writer.WriteUInt32(static_cast<uint32_t>(aStamp >> 32));
+    writer.WriteUInt32(static_cast<uint32_t>(aStamp));
+    written = writer.Flush();
+    end = ftell(stream);
+  }
+  if (fclose(stream) || end < 0 || uint64_t(end) > UINT32_MAX) written = false;
+  if (!written) {
+    NS_WARNING("failed to append to the message id index");
+    return NS_ERROR_FAILURE;
+  }
+
+  mJournalEnd = static_cast<uint32_t>(end);
+  mUnsavedIds.Clear();
+  mUnsavedRefs.Clear();
+  mDirty = false;
+  return NS_OK;
+}
+
+void nsMsgDBIndex::NoteSummaryFile() {
+  uint64_t size, time;
+  if (!mLoaded || mDirty || !mJournalEnd || !mFile ||
+      !GetSummaryFileState(&size, &time))
+    return;
+  FILE *stream;
+  if (NS_FAILED(mFile->OpenANSIFileDesc("r+b", &stream))) return;
+
+  // written where the next save goes, so that it's only read after the last
+  bool written = !fseek(stream, mJournalEnd, SEEK_SET);
+  if (written) {
+    IndexWriter writer(stream);
+    writer.WriteUInt32(kJournalSummary);
+    writer.WriteUInt32(static_cast<uint32_t>(size >> 32));
+    writer.WriteUInt32(static_cast<uint32_t>(size));
+    writer.WriteUInt32(static_cast<uint32_t>(time >> 32));
+    writer.WriteUInt32(static_cast<uint32_t>(time));
+    written = writer.Flush();
+  }
+  if (fclose(stream)) written = false;
+  // without it, the index is built again the next time the db is opened
+  NS_WARNING_ASSERTION(written, "failed to note the summary file in the index");
+}
+
+nsresult nsMsgDBIndex::Rewrite(uint64_t aStamp) {
+  // The unchanged entries are read from the mapped file while the new one is
+  // written, so write to a temporary file and then replace it.
+  nsCOMPtr<nsIFile> tempFile;
+  nsresult rv = mFile->Clone(getter_AddRefs(tempFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsAutoString leafName;
+  rv = mFile->GetLeafName(leafName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsAutoString tempName(leafName);
+  tempName.Append('~');
+  rv = tempFile->SetLeafName(tempName);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  FILE *stream;
+  rv = tempFile->OpenANSIFileDesc("wb", &stream);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  bool written = WriteFile(stream, aStamp);
+  if (fclose(stream)) written = false;
+  if (!written) {
+    NS_WARNING("failed to write the message id index");
+    tempFile->Remove(false);
+    return NS_ERROR_FAILURE;
+  }
+
+  // the old file can't be replaced while it is mapped on some platforms
+  uint32_t journalEnd = mJournalEnd;
+  bool mapped = mData != nullptr;
+  Close();
+  uint64_t stamp;
+  rv = tempFile->MoveTo(nullptr, leafName);
+  if (NS_FAILED(rv)) {
+    NS_WARNING("failed to replace the message id index");
+    tempFile->Remove(false);
+    // carry on with the old file and the unsaved changes
+    if (mapped && Map(&stamp)) mJournalEnd = journalEnd;
+    return rv;
+  }
+
+  // The new file has all of the entries, so start over with no changes.
+  mIdChanges.Clear();
+  mRefChanges.Clear();
+  mUnsavedIds.Clear();
+  mUnsavedRefs.Clear();
+  mDirty = false;
+  if (!Map(&stamp) || stamp != aStamp) {
+    // the entries are gone, so they'll have to be built again
+    Close();
+    mLoaded = false;
+    return NS_ERROR_FAILURE;
+  }
+  return NS_OK;
+}
+
+bool nsMsgDBIndex::WriteFile(FILE *aStream, uint64_t aStamp) {
+  // Collects the entries of one table: those in the file that haven't
+  // changed, and the changed ones that are still there.
+  auto collect = [&](const Section &aSection, const EntryTable &aChanges,
+                     nsTArray<IndexWriteEntry> &aEntries) {
+    aEntries.SetCapacity(aSection.mCount + aChanges.Count());
+    for (uint32_t index = 0; index < aSection.mCount; index++) {
+      uint32_t length;
+      const char *string = EntryString(aSection, index, &length);
+      if (!string || !length ||
+          aChanges.Contains(nsDependentCSubstring(string, length)))
+        continue;
+      uint32_t entry = aSection.mEntriesOffset + index * kIndexEntrySize;
+      IndexWriteEntry writeEntry = {
+          ReadUInt32(entry), length, string, ReadUInt32(entry + 12),
+          ReadUInt32(entry + 16)};
+      aEntries.AppendElement(writeEntry);
+    }
+    for (auto iter = aChanges.ConstIter(); !iter.Done(); iter.Next()) {
+      if (!iter.Data().mCount) continue;
+      // the keys are nsCStrings, so they are NUL terminated
+      const nsACString &string = iter.Key();
+      const char *chars = string.BeginReading();
+      IndexWriteEntry writeEntry = {Hash(chars, string.Length()),
+                                    string.Length(), chars, iter.Data().mValue,
+                                    iter.Data().mCount};
+      aEntries.AppendElement(writeEntry);
+    }
+    std::sort(aEntries.begin(), aEntries.end(),
+              [](const IndexWriteEntry &a, const IndexWriteEntry &b) {
+                if (a.mHash != b.mHash) return a.mHash < b.mHash;
+                return strcmp(a.mString, b.mString) < 0;
+              });
+  };
+
+  // aim for one or two entries per bucket
+  auto bucketBitsFor = [](uint32_t aCount) {
+    uint32_t bucketBits = 0;
+    while (bucketBits < kIndexMaxBucketBits &&
+           (uint64_t(2) << bucketBits) < aCount)
+      bucketBits++;
+    return bucketBits;
+  };
+
+  nsTArray<IndexWriteEntry> ids, refs;
+  collect(mIds, mIdChanges, ids);
+  collect(mRefs, mRefChanges, refs);
+  uint32_t idBucketBits = bucketBitsFor(ids.Length());
+  uint32_t refBucketBits = bucketBitsFor(refs.Length());
+  uint64_t stringsSize = 0;
+  for (const IndexWriteEntry &entry : ids) stringsSize += entry.mLength + 1;
+  for (const IndexWriteEntry &entry : refs) stringsSize += entry.mLength + 1;
+  if (stringsSize > UINT32_MAX) return false;
+
+  IndexWriter writer(aStream);
+  writer.Write(kIndexCookie, sizeof(kIndexCookie));
+  writer.WriteUInt32(kIndexVersion);
+  writer.WriteUInt32(static_cast<uint32_t>(aStamp >> 32));
+  writer.WriteUInt32(static_cast<uint32_t>(aStamp));
+  writer.WriteUInt32(ids.Length());
+  writer.WriteUInt32(idBucketBits);
+  writer.WriteUInt32(refs.Length());
+  writer.WriteUInt32(refBucketBits);
+  writer.WriteUInt32(static_cast<uint32_t>(stringsSize));
+
+  uint32_t stringOffset = 0;
+  auto writeTable = [&](const nsTArray<IndexWriteEntry> &aEntries,
+                        uint32_t aBucketBits) {
+    uint32_t count = aEntries.Length();
+    uint32_t index = 0;
+    for (uint64_t bucket = 0; bucket <= (uint64_t(1) << aBucketBits);
+         bucket++) {
+      while (index < count &&
+             (aBucketBits ? aEntries[index].mHash >> (32 - aBucketBits) : 0) <
+                 bucket)
+        index++;
+      writer.WriteUInt32(index);
+    }
+    for (const IndexWriteEntry &entry : aEntries) {
+      writer.WriteUInt32(entry.mHash);
+      writer.WriteUInt32(stringOffset);
+      writer.WriteUInt32(entry.mLength);
+      writer.WriteUInt32(entry.mValue);
+      writer.WriteUInt32(entry.mCount);
+      stringOffset += entry.mLength + 1;
+    }
+  };
+  writeTable(ids, idBucketBits);
+  writeTable(refs, refBucketBits);
+
+  // the strings are written with their NUL terminators
+  for (const IndexWriteEntry &entry : ids)
+    writer.Write(entry.mString, entry.mLength + 1);
+  for (const IndexWriteEntry &entry : refs)
+    writer.Write(entry.mString, entry.mLength + 1);
+
+  return writer.Flush();
+}
+
+size_t nsMsgDBIndex::SizeOfIncludingThis(
+    mozilla::MallocSizeOf aMallocSizeOf) const {
+  size_t n = aMallocSizeOf(this);
+  for (const EntryTable *changes : {&mIdChanges, &mRefChanges}) {
+    n += changes->ShallowSizeOfExcludingThis(aMallocSizeOf);
+    for (auto iter = changes->ConstIter(); !iter.Done(); iter.Next())
+      n += iter.Key().SizeOfExcludingThisIfUnshared(aMallocSizeOf);
+  }
+  n += mUnsavedIds.ShallowSizeOfExcludingThis(aMallocSizeOf);
+  n += mUnsavedRefs.ShallowSizeOfExcludingThis(aMallocSizeOf);
+  return n;
+}
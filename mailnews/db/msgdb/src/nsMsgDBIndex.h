@@ -0,0 +1,149 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef _nsMsgDBIndex_H_
+#define _nsMsgDBIndex_H_
+
+#include "MailNewsTypes.h"
+#include "mozilla/MemoryReporting.h"
+#include "nsCOMPtr.h"
+#include "nsDataHashtable.h"
+#include "nsIFile.h"
+#include "nsString.h"
+#include "nsTHashtable.h"
+#include "prio.h"
+
+/**
+ * The Message-ID and References index of a msg db, used to thread new
+ * headers. It maps each Message-ID to the key of a header with that id, and
+ * each id that headers refer to to the thread of the first of them.
+ *
+ * The index is kept in a sidecar next to the summary file ("Inbox.msf.idx"),
+ * which is mapped into memory and read in place, so opening a big folder
+ * doesn't walk all its headers to build the index again. Changes are kept in
+ * memory on top of the file; Save appends the ones made since the last save
+ * to a journal at the end of the file, and now and then rewrites the file
+ * with them merged in.
+ *
+ * Each save is stamped, and the db keeps the stamp of its last save in its
+ * folder info, committed with the summary. Open only uses the file up to the
+ * save with the db's stamp, and ignores the file if there's no such save.
+ * Builds that don't maintain the index keep the stamp when they change the
+ * headers, so after each commit the size and modification time of the
+ * summary file are noted after the last save, and Open also ignores the file
+ * if the summary file no longer matches them.
+ */
+class nsMsgDBIndex final {
+ public:
+  explicit nsMsgDBIndex(nsIFile *aSummaryFile);
+  ~nsMsgDBIndex();
+
+  /**
+   * Maps the index file and reads its journal, if the file has a save
+   * stamped aStamp. Otherwise the index starts out empty, and needs filling
+   * in from the headers followed by SetLoaded.
+   */
+  bool Open(uint64_t aStamp);
+  bool IsLoaded() const { return mLoaded; }
+  void SetLoaded() { mLoaded = true; }
+  // True if there are changes that aren't in the file yet.
+  bool IsDirty() const { return mDirty; }
+
+  enum LookupResult {
+    kNotFound,
+    kFound,
+    // Headers with the id were removed, but another one may be left; look
+    // in the db.
+    kUnknown
+  };
+  LookupResult GetKeyForMessageId(const nsACString &aMessageId,
+                                  nsMsgKey *aKey);
+  bool GetThreadForReference(const nsACString &aReference,
+                             nsMsgKey *aThreadId);
+
+  void AddMessageId(const nsACString &aMessageId, nsMsgKey aKey);
+  void RemoveMessageId(const nsACString &aMessageId, nsMsgKey aKey);
+  void AddReference(const nsACString &aReference, nsMsgKey aThreadId);
+  void RemoveReference(const nsACString &aReference);
+
+  /**
+   * Saves the changes as aStamp, by appending them to the journal, or by
+   * rewriting the file if aRewrite is set or the journal has grown too big.
+   */
+  nsresult Save(uint64_t aStamp, bool aRewrite);
+
+  /**
+   * Notes the size and modification time of the summary file, once the db
+   * has been committed with the last save. The next save overwrites them.
+   */
+  void NoteSummaryFile();
+
+  size_t SizeOfIncludingThis(mozilla::MallocSizeOf aMallocSizeOf) const;
+
+ private:
+  // The value of an id, and how many headers have it (0 if none).
+  struct Entry {
+    uint32_t mValue;
+    uint32_t mCount;
+  };
+  typedef nsDataHashtable<nsCStringHashKey, Entry> EntryTable;
+  typedef nsTHashtable<nsCStringHashKey> StringSet;
+
+  // One of the two tables in the file: a bucket directory and the entries,
+  // sorted by hash.
+  struct Section {
+    uint32_t mCount;
+    uint32_t mBucketBits;
+    uint32_t mDirectoryOffset;
+    uint32_t mEntriesOffset;
+  };
+
+  // Maps the file's tables, and gets the stamp they were written with.
+  bool Map(uint64_t *aStamp);
+  void Close();
+  bool MapSection(uint32_t aCount, uint32_t aBucketBits, uint64_t &aOffset,
+                  Section &aSection);
+  bool ReadJournal(uint64_t aStamp);
+  bool GetSummaryFileState(uint64_t *aSize, uint64_t *aTime) const;
+  // True if the summary file is as noted at the end of the journal.
+  bool SummaryFileMatches() const;
+  uint32_t ReadUInt32(uint32_t aOffset) const;
+  uint64_t ReadUInt64(uint32_t aOffset) const;
+  const char *EntryString(const Section &aSection, uint32_t aIndex,
+                          uint32_t *aLength) const;
+  bool FindInFile(const Section &aSection, const nsACString &aString,
+                  Entry *aEntry) const;
+  // The current entry for an id: the change if there is one, else the file's.
+  Entry Get(const Section &aSection, const EntryTable &aChanges,
+            const nsACString &aString) const;
+  void Put(EntryTable &aChanges, StringSet &aUnsaved,
+           const nsACString &aString, const Entry &aEntry);
+  nsresult Append(uint64_t aStamp);
+  nsresult Rewrite(uint64_t aStamp);
+  bool WriteFile(FILE *aStream, uint64_t aStamp);
+
+  nsCOMPtr<nsIFile> mFile;
+  nsCOMPtr<nsIFile> mSummaryFile;
+  PRFileDesc *mFD;
+  PRFileMap *mMap;
+  const uint8_t *mData;
+  uint32_t mSize;
+  Section mIds;
+  Section mRefs;
+  uint32_t mStringsOffset;
+  // The journal starts after the tables, and ends after the last save that
+  // Open used; later saves are appended there.
+  uint32_t mJournalOffset;
+  uint32_t mJournalEnd;
+  EntryTable mIdChanges;
+  EntryTable mRefChanges;
+  // The ids and references changed since the last save.
+  StringSet mUnsavedIds;
+  StringSet mUnsavedRefs;
+  bool mLoaded;
+  bool mDirty;
+};
+
+#endif
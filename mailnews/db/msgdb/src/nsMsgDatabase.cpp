@@ -12,6 +12,7 @@
 #include "nsDBFolderInfo.h"
 #include "nsMsgKeySet.h"
 #include "nsMsgThread.h"
+#include "nsMsgDBIndex.h"
 #include "nsIMsgSearchTerm.h"
 #include "nsMsgBaseCID.h"
 #include "nsMorkCID.h"
@@ -27,6 +28,7 @@
 #include "nsIMsgFolderCacheElement.h"
 #include "MailNewsTypes2.h"
 #include "nsMsgUtils.h"
+#include "nsThreadUtils.h"
 #include "nsMsgKeyArray.h"
 #include "nsIMutableArray.h"
 #include "nsArrayUtils.h"
@@ -69,7 +71,7 @@ PRTime nsMsgDatabase::gLastUseTime;
 
 NS_IMPL_ISUPPORTS(nsMsgDBService, nsIMsgDBService)
 
-nsMsgDBService::nsMsgDBService() {}
+nsMsgDBService::nsMsgDBService() : m_pendingParses(0) {}
 
 nsMsgDBService::~nsMsgDBService() {
 #ifdef DEBUG
@@ -217,17 +219,29 @@ NS_IMETHODIMP nsMsgDBService::OpenMore(nsIMsgDatabase *aDB, uint32_t aTimeHint,
     *_retval = true;
     return NS_OK;
   }
-  nsresult rv;
+  nsresult rv = NS_OK;
   *_retval = false;
+  bool parsed = false;
+  if (msgDatabase->m_parseTask) {
+    // The db open thread pool is parsing the db; give it aTimeHint to finish.
+    if (!msgDatabase->m_parseTask->WaitUntilDone(
+            TimeDuration::FromMilliseconds(aTimeHint)))
+      return NS_OK;
+    rv = msgDatabase->EndParse(false);
+    NS_ENSURE_SUCCESS(rv, rv);
+    parsed = true;
+  }
   PRIntervalTime startTime = PR_IntervalNow();
   do {
-    mdb_count outTotal;        // total somethings to do in operation
-    mdb_count outCurrent;      // subportion of total completed so far
-    mdb_bool outDone = false;  // is operation finished?
-    mdb_bool outBroken;        // is operation irreparably dead and broken?
-    rv = msgDatabase->m_thumb->DoMore(msgDatabase->m_mdbEnv, &outTotal,
-                                      &outCurrent, &outDone, &outBroken);
-    if (NS_FAILED(rv)) break;
+    mdb_bool outDone = parsed;  // is operation finished?
+    if (!parsed) {
+      mdb_count outTotal;    // total somethings to do in operation
+      mdb_count outCurrent;  // subportion of total completed so far
+      mdb_bool outBroken;    // is operation irreparably dead and broken?
+      rv = msgDatabase->m_thumb->DoMore(msgDatabase->m_mdbEnv, &outTotal,
+                                        &outCurrent, &outDone, &outBroken);
+      if (NS_FAILED(rv)) break;
+    }
     if (outDone) {
       nsCOMPtr<nsIMdbFactory> mdbFactory;
       rv = msgDatabase->GetMDBFactory(getter_AddRefs(mdbFactory));
@@ -256,6 +270,88 @@ NS_IMETHODIMP nsMsgDBService::OpenMore(nsIMsgDatabase *aDB, uint32_t aTimeHint,
   return rv;
 }
 
+void nsMsgDBService::DispatchParse(nsMsgDatabase *aMsgDB) {
+  int32_t threads = 2;
+  aMsgDB->GetIntPref("mail.db.open_threads", &threads);
+  if (threads <= 0) return;
+  if (!m_parsePool) {
+    m_parsePool = do_CreateInstance("@mozilla.org/thread-pool;1");
+    if (!m_parsePool) return;
+    m_parsePool->SetName(NS_LITERAL_CSTRING("MsgDBOpen"));
+    m_parsePool->SetIdleThreadLimit(1);
+  }
+  m_parsePool->SetThreadLimit(threads);
+  RefPtr<nsMsgDBParseTask> task =
+      new nsMsgDBParseTask(this, aMsgDB->m_thumb, aMsgDB->m_mdbEnv);
+  // If the pool won't take it, OpenMore parses on the main thread as before.
+  if (NS_FAILED(m_parsePool->Dispatch(task, NS_DISPATCH_NORMAL))) return;
+  m_pendingParses++;
+  aMsgDB->m_parseTask = task;
+}
+
+void nsMsgDBService::ParseDone() {
+  MOZ_ASSERT(m_pendingParses > 0);
+  if (--m_pendingParses || !m_parsePool) return;
+  // We run from our own event, so spinning the event loop in Shutdown is
+  // fine here.
+  nsCOMPtr<nsIThreadPool> pool = m_parsePool.forget();
+  pool->Shutdown();
+}
+
+nsMsgDBParseTask::nsMsgDBParseTask(nsMsgDBService *aService,
+                                   nsIMdbThumb *aThumb, nsIMdbEnv *aEnv)
+    : mozilla::Runnable("nsMsgDBParseTask"),
+      mService(new nsMainThreadPtrHolder<nsMsgDBService>(
+          "nsMsgDBParseTask::mService", aService)),
+      mThumb(aThumb),
+      mEnv(aEnv),
+      mMonitor("nsMsgDBParseTask::mMonitor"),
+      mDone(false),
+      mResult(NS_OK),
+      mCancelled(false) {}
+
+NS_IMETHODIMP nsMsgDBParseTask::Run() {
+  nsresult rv = NS_OK;
+  mdb_count outTotal;        // total somethings to do in operation
+  mdb_count outCurrent;      // subportion of total completed so far
+  mdb_bool outDone = false;  // is operation finished?
+  mdb_bool outBroken = false;
+  while (!outDone && !outBroken) {
+    if (mCancelled) {
+      rv = NS_ERROR_ABORT;
+      break;
+    }
+    rv = mThumb->DoMore(mEnv, &outTotal, &outCurrent, &outDone, &outBroken);
+    if (NS_FAILED(rv)) break;
+  }
+  if (NS_SUCCEEDED(rv) && !outDone) rv = NS_ERROR_FAILURE;
+  {
+    MonitorAutoLock lock(mMonitor);
+    mResult = rv;
+    mDone = true;
+    lock.Notify();
+  }
+  nsMainThreadPtrHandle<nsMsgDBService> service = mService;
+  return NS_DispatchToMainThread(NS_NewRunnableFunction(
+      "nsMsgDBParseTask::ParseDone", [service]() { service->ParseDone(); }));
+}
+
+bool nsMsgDBParseTask::WaitUntilDone(TimeDuration aTimeout) {
+  MonitorAutoLock lock(mMonitor);
+  TimeStamp deadline = TimeStamp::Now() + aTimeout;
+  while (!mDone) {
+    TimeStamp now = TimeStamp::Now();
+    if (now >= deadline) break;
+    lock.Wait(deadline - now);
+  }
+  return mDone;
+}
+
+void nsMsgDBParseTask::WaitUntilDone() {
+  MonitorAutoLock lock(mMonitor);
+  while (!mDone) lock.Wait();
+}
+
 /**
  * When a db is opened, we need to hook up any pending listeners for
  * that db, and notify them.
@@ -448,12 +544,14 @@ static bool gGotGlobalPrefs = false;
 static bool gThreadWithoutRe = true;
 static bool gStrictThreading = false;
 static bool gCorrectThreading = false;
+static int32_t gCompressWaste = 30;
 
 void nsMsgDatabase::GetGlobalPrefs() {
   if (!gGotGlobalPrefs) {
     GetBoolPref("mail.thread_without_re", &gThreadWithoutRe);
     GetBoolPref("mail.strict_threading", &gStrictThreading);
     GetBoolPref("mail.correct_threading", &gCorrectThreading);
+    GetIntPref("mail.db.compress_waste", &gCompressWaste);
     gGotGlobalPrefs = true;
   }
 }
@@ -542,17 +640,67 @@ void nsMsgDatabase::ClearEnumerators() {
 }
 
 nsMsgThread *nsMsgDatabase::FindExistingThread(nsMsgKey threadId) {
-  uint32_t numThreads = m_threads.Length();
-  for (uint32_t i = 0; i < numThreads; i++)
-    if (m_threads[i]->m_threadKey == threadId) return m_threads[i];
+  return m_threadsByKey.Get(threadId);
+}
 
-  return nullptr;
+void nsMsgDatabase::AddThread(nsMsgThread *aThread) {
+  aThread->m_threadIndex = m_threads.Length();
+  m_threads.AppendElement(aThread);
+  ThreadKeyChanged(aThread, nsMsgKey_None);
+}
+
+void nsMsgDatabase::RemoveThread(nsMsgThread *aThread) {
+  uint32_t index = aThread->m_threadIndex;
+  if (index >= m_threads.Length() || m_threads[index] != aThread) {
+    NS_ERROR("removing thread not in threads array");
+    return;
+  }
+  // Move the last thread into the slot, so removal doesn't shift the array.
+  nsMsgThread *lastThread = m_threads.LastElement();
+  lastThread->m_threadIndex = index;
+  m_threads[index] = lastThread;
+  m_threads.RemoveLastElement();
+  UnindexThread(aThread, aThread->m_threadKey);
+}
+
+void nsMsgDatabase::ThreadKeyChanged(nsMsgThread *aThread, nsMsgKey aOldKey) {
+  if (aOldKey == aThread->m_threadKey) return;
+  UnindexThread(aThread, aOldKey);
+  // If several thread objects share a key, the first one stays indexed.
+  if (aThread->m_threadKey == nsMsgKey_None) return;
+  if (m_threadsByKey.Contains(aThread->m_threadKey))
+    m_numUnindexedThreads++;
+  else
+    m_threadsByKey.Put(aThread->m_threadKey, aThread);
+}
+
+void nsMsgDatabase::UnindexThread(nsMsgThread *aThread, nsMsgKey aKey) {
+  if (aKey == nsMsgKey_None) return;
+  // Only the entry of this thread goes; another thread may be indexed by
+  // the key.
+  if (m_threadsByKey.Get(aKey) != aThread) {
+    m_numUnindexedThreads--;
+    return;
+  }
+  m_threadsByKey.Remove(aKey);
+  if (!m_numUnindexedThreads) return;
+  // Index another thread with the key, if there is one; aThread is already
+  // out of m_threads or has another key.
+  for (nsMsgThread *thread : m_threads) {
+    if (thread->m_threadKey == aKey) {
+      m_threadsByKey.Put(aKey, thread);
+      m_numUnindexedThreads--;
+      return;
+    }
+  }
 }
 
 void nsMsgDatabase::ClearThreads() {
   // clear out existing threads
   nsTArray<nsMsgThread *> copyThreads;
   copyThreads.SwapElements(m_threads);
+  m_threadsByKey.Clear();
+  m_numUnindexedThreads = 0;
 
   uint32_t numThreads = copyThreads.Length();
   for (uint32_t i = 0; i < numThreads; i++) copyThreads[i]->Clear();
@@ -576,9 +724,18 @@ void nsMsgDatabase::ClearCachedObjects(bool dbGoingAway) {
     ClearUseHdrCache();
     ClearThreads();
   }
+  EndParse(true);
   m_thumb = nullptr;
 }
 
+nsresult nsMsgDatabase::EndParse(bool aCancel) {
+  RefPtr<nsMsgDBParseTask> task = m_parseTask.forget();
+  if (!task) return NS_OK;
+  if (aCancel) task->Cancel();
+  task->WaitUntilDone();
+  return task->Result();
+}
+
 nsresult nsMsgDatabase::ClearHdrCache(bool reInit) {
   if (m_cachedHeaders) {
     // save this away in case we renter this code.
@@ -873,7 +1030,8 @@ size_t nsMsgDatabase::SizeOfExcludingThis(
   size_t totalSize = 0;
   if (m_dbFolderInfo)
     totalSize += m_dbFolderInfo->SizeOfExcludingThis(aMallocSizeOf);
-  if (m_mdbEnv) {
+  // The heap isn't ours to read while the db open pool parses into it.
+  if (m_mdbEnv && !m_parseTask) {
     nsIMdbHeap *morkHeap = nullptr;
     m_mdbEnv->GetHeap(&morkHeap);
     if (morkHeap) totalSize += morkHeap->GetUsedSize();
@@ -881,6 +1039,7 @@ size_t nsMsgDatabase::SizeOfExcludingThis(
   totalSize += m_newSet.ShallowSizeOfExcludingThis(aMallocSizeOf);
   totalSize += m_ChangeListeners.ShallowSizeOfExcludingThis(aMallocSizeOf);
   totalSize += m_threads.ShallowSizeOfExcludingThis(aMallocSizeOf);
+  totalSize += m_threadsByKey.ShallowSizeOfExcludingThis(aMallocSizeOf);
   // We have two tables of header objects, but every header in m_cachedHeaders
   // should be in m_headersInUse.
   // double-counting...
@@ -896,8 +1055,7 @@ size_t nsMsgDatabase::SizeOfExcludingThis(
     }
   }
   totalSize += headerSize;
-  if (m_msgReferences)
-    totalSize += m_msgReferences->ShallowSizeOfIncludingThis(aMallocSizeOf);
+  if (m_index) totalSize += m_index->SizeOfIncludingThis(aMallocSizeOf);
   return totalSize;
 }
 
@@ -965,6 +1123,7 @@ nsMsgDatabase::nsMsgDatabase()
       m_mdbAllThreadsTable(nullptr),
       m_create(false),
       m_leaveInvalidDB(false),
+      m_compressPending(false),
       m_mdbTokensInitialized(false),
       m_hdrRowScopeToken(0),
       m_hdrTableKindToken(0),
@@ -995,11 +1154,11 @@ nsMsgDatabase::nsMsgDatabase()
       m_threadNewestMsgDateColumnToken(0),
       m_offlineMsgOffsetColumnToken(0),
       m_offlineMessageSizeColumnToken(0),
+      m_numUnindexedThreads(0),
       m_headersInUse(nullptr),
       m_cachedHeaders(nullptr),
       m_bCacheHeaders(true),
       m_cachedThreadId(nsMsgKey_None),
-      m_msgReferences(nullptr),
       m_cacheSize(kMaxHdrsInCache) {
   mMemReporter = new mozilla::mailnews::MsgDBReporter(this);
   mozilla::RegisterWeakMemoryReporter(mMemReporter);
@@ -1013,11 +1172,6 @@ nsMsgDatabase::~nsMsgDatabase() {
   delete m_cachedHeaders;
   delete m_headersInUse;
 
-  if (m_msgReferences) {
-    delete m_msgReferences;
-    m_msgReferences = nullptr;
-  }
-
   MOZ_LOG(DBLog, LogLevel::Info,
           ("closing database    %s", m_dbFile->HumanReadablePath().get()));
 
@@ -1090,6 +1244,7 @@ nsresult nsMsgDatabase::OpenInternal(nsMsgDBService *aDBService,
   m_leaveInvalidDB = aLeaveInvalidDB;
   if (!sync && NS_SUCCEEDED(rv)) {
     aDBService->AddToCache(this);
+    if (m_thumb) aDBService->DispatchParse(this);
     // remember open options for when the parsing is complete.
     return rv;
   }
@@ -1148,8 +1303,10 @@ nsresult nsMsgDatabase::CheckForErrors(nsresult err, bool sync,
     // this will make the db folder info release its ref to the mail db...
     m_dbFolderInfo = nullptr;
     ForceClosed();
-    if (err == NS_MSG_ERROR_FOLDER_SUMMARY_OUT_OF_DATE)
+    if (err == NS_MSG_ERROR_FOLDER_SUMMARY_OUT_OF_DATE) {
       summaryFile->Remove(false);
+      RemoveSummaryIndexFile(summaryFile);
+    }
   }
   if (NS_FAILED(err) || newFile) {
     // if we couldn't open file, or we have a blank one, and we're supposed
@@ -1162,6 +1319,7 @@ nsresult nsMsgDatabase::CheckForErrors(nsresult err, bool sync,
                err != NS_MSG_ERROR_FOLDER_SUMMARY_OUT_OF_DATE) {
       Close(false);
       summaryFile->Remove(false);  // blow away the db if it's corrupt.
+      RemoveSummaryIndexFile(summaryFile);
     }
   }
   if (sync && (NS_SUCCEEDED(err) || err == NS_MSG_ERROR_FOLDER_SUMMARY_MISSING))
@@ -1179,6 +1337,10 @@ nsresult nsMsgDatabase::OpenMDB(nsIFile *dbFile, bool create, bool sync) {
   nsresult ret = GetMDBFactory(getter_AddRefs(mdbFactory));
   NS_ENSURE_SUCCESS(ret, ret);
 
+  // A pending asynchronous open may still be parsing with the current env.
+  bool parsed = !!m_parseTask;
+  nsresult parseResult = EndParse(false);
+
   ret = mdbFactory->MakeEnv(NULL, &m_mdbEnv);
   if (NS_SUCCEEDED(ret)) {
     nsIMdbHeap *dbHeap = nullptr;
@@ -1223,18 +1385,24 @@ nsresult nsMsgDatabase::OpenMDB(nsIFile *dbFile, bool create, bool sync) {
       }
     }
     if (NS_SUCCEEDED(ret) && m_thumb && sync) {
-      mdb_count outTotal;        // total somethings to do in operation
-      mdb_count outCurrent;      // subportion of total completed so far
       mdb_bool outDone = false;  // is operation finished?
-      mdb_bool outBroken;        // is operation irreparably dead and broken?
-      do {
-        ret = m_thumb->DoMore(m_mdbEnv, &outTotal, &outCurrent, &outDone,
-                              &outBroken);
-        if (NS_FAILED(ret)) {  // mork isn't really doing NS errors yet.
-          outDone = true;
-          break;
-        }
-      } while (NS_SUCCEEDED(ret) && !outBroken && !outDone);
+      if (parsed) {
+        // The db open thread pool already did the parse.
+        ret = parseResult;
+        outDone = NS_SUCCEEDED(ret);
+      } else {
+        mdb_count outTotal;    // total somethings to do in operation
+        mdb_count outCurrent;  // subportion of total completed so far
+        mdb_bool outBroken;    // is operation irreparably dead and broken?
+        do {
+          ret = m_thumb->DoMore(m_mdbEnv, &outTotal, &outCurrent, &outDone,
+                                &outBroken);
+          if (NS_FAILED(ret)) {  // mork isn't really doing NS errors yet.
+            outDone = true;
+            break;
+          }
+        } while (NS_SUCCEEDED(ret) && !outBroken && !outDone);
+      }
       //        m_mdbEnv->ClearErrors(); // ### temporary...
       // only 0 is a non-error return.
       if (NS_SUCCEEDED(ret) && outDone) {
@@ -1293,8 +1461,10 @@ NS_IMETHODIMP nsMsgDatabase::ForceClosed() {
   if (m_dbFolderInfo) m_dbFolderInfo->ReleaseExternalReferences();
   m_dbFolderInfo = nullptr;
 
+  EndParse(true);
   err = CloseMDB(true);  // Backup DB will try to recover info, so commit
   ClearCachedObjects(true);
+  m_index = nullptr;
   ClearEnumerators();
   if (m_mdbAllMsgHeadersTable) {
     m_mdbAllMsgHeadersTable->Release();
@@ -1332,6 +1502,28 @@ NS_IMETHODIMP nsMsgDatabase::GetFolder(nsIMsgFolder **aFolder) {
   return NS_OK;
 }
 
+// Large commits only append the rows changed since the last commit, so they
+// leave the rewrite of a wasteful file to an idle moment, unless it has grown
+// to several times the size of its content.
+static const mdb_percent kMaxCompressWaste = 75;
+// How long the idle compress may wait for the main thread, in milliseconds.
+static const uint32_t kIdleCompressTimeout = 10000;
+
+void nsMsgDatabase::ScheduleIdleCompress() {
+  if (m_compressPending) return;
+  m_compressPending = true;
+  RefPtr<nsMsgDatabase> self = this;
+  nsCOMPtr<nsIRunnable> compress = NS_NewRunnableFunction(
+      "nsMsgDatabase::ScheduleIdleCompress", [self]() {
+        // Closing the db may have compressed it already.
+        if (self->m_compressPending && self->m_mdbStore)
+          self->Commit(nsMsgDBCommitType::kCompressCommit);
+      });
+  nsresult rv =
+      NS_IdleDispatchToCurrentThread(compress.forget(), kIdleCompressTimeout);
+  if (NS_FAILED(rv)) m_compressPending = false;
+}
+
 NS_IMETHODIMP nsMsgDatabase::Commit(nsMsgDBCommit commitType) {
   nsresult err = NS_OK;
   nsCOMPtr<nsIMdbThumb> commitThumb;
@@ -1342,16 +1534,23 @@ NS_IMETHODIMP nsMsgDatabase::Commit(nsMsgDBCommit commitType) {
     mdb_percent outActualWaste = 0;
     mdb_bool outShould;
     if (m_mdbStore) {
-      err =
-          m_mdbStore->ShouldCompress(GetEnv(), 30, &outActualWaste, &outShould);
-      if (NS_SUCCEEDED(err) && outShould)
-        commitType = nsMsgDBCommitType::kCompressCommit;
+      GetGlobalPrefs();
+      err = m_mdbStore->ShouldCompress(GetEnv(), gCompressWaste,
+                                       &outActualWaste, &outShould);
+      if (NS_SUCCEEDED(err) && outShould) {
+        if (commitType == nsMsgDBCommitType::kSessionCommit ||
+            outActualWaste >= kMaxCompressWaste)
+          commitType = nsMsgDBCommitType::kCompressCommit;
+        else
+          ScheduleIdleCompress();
+      }
     }
   }
-  //  commitType = nsMsgDBCommitType::kCompressCommit;  // ### until incremental
-  //  writing works.
 
   if (m_mdbStore) {
+    // Save the index first, so that its stamp is committed with the headers
+    // it indexes.
+    SaveIndex(commitType == nsMsgDBCommitType::kCompressCommit);
     switch (commitType) {
       case nsMsgDBCommitType::kLargeCommit:
         err = m_mdbStore->LargeCommit(GetEnv(), getter_AddRefs(commitThumb));
@@ -1360,6 +1559,7 @@ NS_IMETHODIMP nsMsgDatabase::Commit(nsMsgDBCommit commitType) {
         err = m_mdbStore->SessionCommit(GetEnv(), getter_AddRefs(commitThumb));
         break;
       case nsMsgDBCommitType::kCompressCommit:
+        m_compressPending = false;
         err = m_mdbStore->CompressCommit(GetEnv(), getter_AddRefs(commitThumb));
         break;
     }
@@ -1377,6 +1577,7 @@ NS_IMETHODIMP nsMsgDatabase::Commit(nsMsgDBCommit commitType) {
   // ### do something with error, but clear it now because mork errors out on
   // commits.
   if (GetEnv()) GetEnv()->ClearErrors();
+  NoteSummaryInIndex();
 
   nsresult rv;
   nsCOMPtr<nsIMsgAccountManager> accountManager =
@@ -1879,7 +2080,7 @@ nsresult nsMsgDatabase::RemoveHeaderFromDB(nsMsgHdr *msgHdr) {
   nsresult ret = NS_OK;
 
   RemoveHdrFromCache(msgHdr, nsMsgKey_None);
-  if (UseCorrectThreading()) RemoveMsgRefsFromHash(msgHdr);
+  RemoveHdrFromIndex(msgHdr);
   nsIMdbRow *row = msgHdr->GetMDBRow();
   if (row) {
     ret = m_mdbAllMsgHeadersTable->CutRow(GetEnv(), row);
@@ -3150,14 +3351,13 @@ NS_IMETHODIMP nsMsgDatabase::AddNewHdrToDB(nsIMsgDBHdr *newHdr, bool notify) {
     }
 
     err = m_mdbAllMsgHeadersTable->AddRow(GetEnv(), hdr->GetMDBRow());
+    if (NS_SUCCEEDED(err)) AddHdrToIndex(newHdr);
     if (notify) {
       nsMsgKey threadParent;
 
       newHdr->GetThreadParent(&threadParent);
       NotifyHdrAddedAll(newHdr, threadParent, flags, NULL);
     }
-
-    if (UseCorrectThreading()) err = AddMsgRefsToHash(newHdr);
   }
   NS_ASSERTION(NS_SUCCEEDED(err), "error creating thread");
   return err;
@@ -3725,133 +3925,114 @@ bool nsMsgDatabase::UseCorrectThreading() {
   return gCorrectThreading;
 }
 
-// adapted from removed PL_DHashFreeStringKey
-static void msg_DHashFreeStringKey(PLDHashTable *aTable,
-                                   PLDHashEntryHdr *aEntry) {
-  const PLDHashEntryStub *stub = (const PLDHashEntryStub *)aEntry;
-  free((void *)stub->key);
-  PLDHashTable::ClearEntryStub(aTable, aEntry);
-}
-
-PLDHashTableOps nsMsgDatabase::gRefHashTableOps = {
-    PLDHashTable::HashStringKey, PLDHashTable::MatchStringKey,
-    PLDHashTable::MoveEntryStub, msg_DHashFreeStringKey, nullptr};
-
-nsresult nsMsgDatabase::GetRefFromHash(nsCString &reference,
-                                       nsMsgKey *threadId) {
-  // Initialize the reference hash
-  if (!m_msgReferences) {
-    nsresult rv = InitRefHash();
-    if (NS_FAILED(rv)) return rv;
-  }
-
-  // Find reference from the hash
-  PLDHashEntryHdr *entry =
-      m_msgReferences->Search((const void *)reference.get());
-  if (entry) {
-    RefHashElement *element = static_cast<RefHashElement *>(entry);
-    *threadId = element->mThreadId;
-    return NS_OK;
-  }
+const char nsMsgDatabase::kIndexStampProperty[] = "msgIdIndexStamp";
+const char nsMsgDatabase::kIndexCheckProperty[] = "msgIdIndexCheck";
 
-  return NS_ERROR_FAILURE;
+// The header count and high water mark the index was saved with. Builds that
+// don't know about the index keep the stamp when they add or delete headers,
+// but not these.
+int64_t nsMsgDatabase::IndexCheck() {
+  mdb_count numHdrs = 0;
+  nsMsgKey highWater = nsMsgKey_None;
+  m_mdbAllMsgHeadersTable->GetCount(GetEnv(), &numHdrs);
+  m_dbFolderInfo->GetHighWater(&highWater);
+  return (int64_t(numHdrs) << 32) | highWater;
 }
 
-nsresult nsMsgDatabase::AddRefToHash(nsCString &reference, nsMsgKey threadId) {
-  if (m_msgReferences) {
-    PLDHashEntryHdr *entry =
-        m_msgReferences->Add((void *)reference.get(), mozilla::fallible);
-    if (!entry) return NS_ERROR_OUT_OF_MEMORY;  // XXX out of memory
-
-    RefHashElement *element = static_cast<RefHashElement *>(entry);
-    if (!element->mRef) {
-      element->mRef =
-          ToNewCString(reference);  // Will be freed in msg_DHashFreeStringKey()
-      element->mThreadId = threadId;
-      element->mCount = 1;
-    } else
-      element->mCount++;
-  }
-
-  return NS_OK;
+nsMsgDBIndex *nsMsgDatabase::GetIndex() {
+  if ((m_index && m_index->IsLoaded()) || OpenIndex()) return m_index;
+  if (NS_FAILED(InitIndex())) return nullptr;
+  return m_index;
 }
 
-nsresult nsMsgDatabase::AddMsgRefsToHash(nsIMsgDBHdr *msgHdr) {
-  uint16_t numReferences = 0;
-  nsMsgKey threadId;
-  nsresult rv = NS_OK;
-
-  msgHdr->GetThreadId(&threadId);
-  msgHdr->GetNumReferences(&numReferences);
-
-  for (int32_t i = 0; i < numReferences; i++) {
-    nsAutoCString reference;
-
-    msgHdr->GetStringReference(i, reference);
-    if (reference.IsEmpty()) break;
-
-    rv = AddRefToHash(reference, threadId);
-    if (NS_FAILED(rv)) break;
-  }
-
-  return rv;
+nsMsgDBIndex *nsMsgDatabase::GetIndexToChange() {
+  // Without a saved index, building one is left to the first lookup.
+  if ((!m_index || !m_index->IsLoaded()) && !OpenIndex()) return nullptr;
+  if (!m_index->IsDirty() && m_dbFolderInfo)
+    m_dbFolderInfo->SetInt64Property(kIndexStampProperty, 0);
+  return m_index;
 }
 
-nsresult nsMsgDatabase::RemoveRefFromHash(nsCString &reference) {
-  if (m_msgReferences) {
-    PLDHashEntryHdr *entry =
-        m_msgReferences->Search((const void *)reference.get());
-    if (entry) {
-      RefHashElement *element = static_cast<RefHashElement *>(entry);
-      if (--element->mCount == 0)
-        m_msgReferences->Remove((void *)reference.get());
-    }
+// Opens the index saved with the last commit, if there is one.
+bool nsMsgDatabase::OpenIndex() {
+  if (!m_mdbAllMsgHeadersTable) return false;
+  if (!m_index) m_index = new nsMsgDBIndex(m_dbFile);
+  int64_t stamp = 0;
+  int64_t check = 0;
+  if (m_dbFolderInfo) {
+    m_dbFolderInfo->GetInt64Property(kIndexStampProperty, 0, &stamp);
+    m_dbFolderInfo->GetInt64Property(kIndexCheckProperty, 0, &check);
   }
-  return NS_OK;
+  if (!stamp) return false;
+  if (check == IndexCheck() && m_index->Open(stamp)) return true;
+  // the file is gone, damaged or stale, so don't look at it again
+  m_dbFolderInfo->SetInt64Property(kIndexStampProperty, 0);
+  return false;
 }
 
-// Filter only messages with one or more references
-nsresult nsMsgDatabase::RemoveMsgRefsFromHash(nsIMsgDBHdr *msgHdr) {
+// Adds the message id and references of a header to the index, or removes
+// them.
+static void IndexHdr(nsMsgDBIndex *index, nsIMsgDBHdr *msgHdr, bool add) {
+  nsMsgKey key;
+  nsMsgKey threadId;
+  nsCString messageId;
   uint16_t numReferences = 0;
-  nsresult rv = NS_OK;
 
+  msgHdr->GetMessageKey(&key);
+  msgHdr->GetThreadId(&threadId);
+  msgHdr->GetMessageId(getter_Copies(messageId));
   msgHdr->GetNumReferences(&numReferences);
 
+  if (add)
+    index->AddMessageId(messageId, key);
+  else
+    index->RemoveMessageId(messageId, key);
+
   for (int32_t i = 0; i < numReferences; i++) {
     nsAutoCString reference;
 
     msgHdr->GetStringReference(i, reference);
     if (reference.IsEmpty()) break;
 
-    rv = RemoveRefFromHash(reference);
-    if (NS_FAILED(rv)) break;
+    if (add)
+      index->AddReference(reference, threadId);
+    else
+      index->RemoveReference(reference);
   }
+}
 
-  return rv;
+void nsMsgDatabase::AddHdrToIndex(nsIMsgDBHdr *msgHdr) {
+  nsMsgDBIndex *index = GetIndexToChange();
+  if (index) IndexHdr(index, msgHdr, true);
 }
 
-static nsresult nsReferencesOnlyFilter(nsIMsgDBHdr *msg, void *closure) {
-  uint16_t numReferences = 0;
-  msg->GetNumReferences(&numReferences);
-  return (numReferences) ? NS_OK : NS_ERROR_FAILURE;
+void nsMsgDatabase::RemoveHdrFromIndex(nsIMsgDBHdr *msgHdr) {
+  nsMsgDBIndex *index = GetIndexToChange();
+  if (index) IndexHdr(index, msgHdr, false);
 }
 
-nsresult nsMsgDatabase::InitRefHash() {
-  // Delete an existing table just in case
-  if (m_msgReferences) delete m_msgReferences;
+void nsMsgDatabase::MessageIdChanging(nsMsgHdr *msgHdr,
+                                      const nsACString &newId) {
+  // headers that aren't in the db yet are indexed when they're added
+  nsMsgKey key;
+  bool inDB = false;
+  msgHdr->GetMessageKey(&key);
+  if (NS_FAILED(ContainsKey(key, &inDB)) || !inDB) return;
 
-  // Create new table
-  m_msgReferences = new PLDHashTable(
-      &gRefHashTableOps, sizeof(struct RefHashElement), MSG_HASH_SIZE);
-  if (!m_msgReferences) return NS_ERROR_OUT_OF_MEMORY;
+  nsMsgDBIndex *index = GetIndexToChange();
+  if (!index) return;
+  nsCString oldId;
+  msgHdr->GetMessageId(getter_Copies(oldId));
+  index->RemoveMessageId(oldId, key);
+  index->AddMessageId(newId, key);
+}
 
-  // Create enumerator to go through all messages with references
-  nsCOMPtr<nsISimpleEnumerator> enumerator;
-  enumerator = new nsMsgDBEnumerator(this, m_mdbAllMsgHeadersTable,
-                                     nsReferencesOnlyFilter, nullptr);
-  if (enumerator == nullptr) return NS_ERROR_OUT_OF_MEMORY;
+// Builds the index from the headers, for a db without a saved index.
+nsresult nsMsgDatabase::InitIndex() {
+  if (!m_index) return NS_ERROR_NOT_INITIALIZED;
 
-  // Populate table with references of existing messages
+  nsCOMPtr<nsISimpleEnumerator> enumerator = new nsMsgDBEnumerator(
+      this, m_mdbAllMsgHeadersTable, nullptr, nullptr);
   bool hasMore;
   nsresult rv = NS_OK;
   while (NS_SUCCEEDED(rv = enumerator->HasMoreElements(&hasMore)) && hasMore) {
@@ -3859,11 +4040,45 @@ nsresult nsMsgDatabase::InitRefHash() {
     rv = enumerator->GetNext(getter_AddRefs(supports));
     NS_ASSERTION(NS_SUCCEEDED(rv), "nsMsgDBEnumerator broken");
     nsCOMPtr<nsIMsgDBHdr> msgHdr = do_QueryInterface(supports);
-    if (msgHdr && NS_SUCCEEDED(rv)) rv = AddMsgRefsToHash(msgHdr);
+    if (msgHdr && NS_SUCCEEDED(rv)) IndexHdr(m_index, msgHdr, true);
     if (NS_FAILED(rv)) break;
   }
+  if (NS_FAILED(rv)) {
+    m_index = nullptr;
+    return rv;
+  }
+  m_index->SetLoaded();
+  return NS_OK;
+}
+
+// Saves the index changes made since the last commit, and records the stamp
+// of the save for the commit. A saved index that hasn't been used is opened,
+// so that the summary file can be noted in it after the commit.
+void nsMsgDatabase::SaveIndex(bool aRewrite) {
+  if ((!m_index || !m_index->IsLoaded()) && !OpenIndex()) return;
+  if (!m_index->IsDirty() || !m_dbFolderInfo) return;
+  int64_t stamp = PR_Now();
+  if (NS_SUCCEEDED(m_index->Save(stamp, aRewrite))) {
+    m_dbFolderInfo->SetInt64Property(kIndexStampProperty, stamp);
+    m_dbFolderInfo->SetInt64Property(kIndexCheckProperty, IndexCheck());
+  }
+}
 
-  return rv;
+// Notes the committed summary file in the index, so that a change to it by a
+// build that doesn't maintain the index is noticed when it's opened again.
+void nsMsgDatabase::NoteSummaryInIndex() {
+  int64_t stamp = 0;
+  if (m_dbFolderInfo)
+    m_dbFolderInfo->GetInt64Property(kIndexStampProperty, 0, &stamp);
+  if (stamp && m_index && m_index->IsLoaded()) m_index->NoteSummaryFile();
+}
+
+nsresult nsMsgDatabase::GetThreadIdForReference(nsCString &reference,
+                                                nsMsgKey *threadId) {
+  nsMsgDBIndex *index = GetIndex();
+  if (!index) return NS_ERROR_FAILURE;
+  return index->GetThreadForReference(reference, threadId) ? NS_OK
+                                                           : NS_ERROR_FAILURE;
 }
 
 nsresult nsMsgDatabase::CreateNewThread(nsMsgKey threadId, const char *subject,
@@ -3950,7 +4165,7 @@ nsIMsgThread *nsMsgDatabase::GetThreadForReference(nsCString &msgID,
   // Referenced message not found, check if there are messages that reference
   // same message
   else if (UseCorrectThreading()) {
-    if (NS_SUCCEEDED(GetRefFromHash(msgID, &threadId)))
+    if (NS_SUCCEEDED(GetThreadIdForReference(msgID, &threadId)))
       thread = GetThreadForThreadId(threadId);
   }
 
@@ -4023,7 +4238,7 @@ nsIMsgThread *nsMsgDatabase::GetThreadForMessageId(nsCString &msgId) {
   nsIMsgThread *thread = NULL;
   nsMsgKey threadId;
 
-  if (NS_SUCCEEDED(GetRefFromHash(msgId, &threadId)))
+  if (NS_SUCCEEDED(GetThreadIdForReference(msgId, &threadId)))
     thread = GetThreadForThreadId(threadId);
 
   return thread;
@@ -4146,6 +4361,33 @@ NS_IMETHODIMP nsMsgDatabase::GetMsgHdrForMessageID(const char *aMsgID,
   NS_ENSURE_ARG_POINTER(aMsgID);
   nsIMsgDBHdr *msgHdr = nullptr;
   nsresult rv = NS_OK;
+
+  // Use the index if it's loaded or saved, but leave building it to
+  // threading; mork can find the row without it.
+  if ((m_index && m_index->IsLoaded()) || OpenIndex()) {
+    nsMsgKey key;
+    switch (m_index->GetKeyForMessageId(nsDependentCString(aMsgID), &key)) {
+      case nsMsgDBIndex::kNotFound:
+        *aHdr = nullptr;
+        return NS_OK;
+      case nsMsgDBIndex::kFound: {
+        nsCOMPtr<nsIMsgDBHdr> hdr;
+        nsCString messageId;
+        rv = GetMsgHdrForKey(key, getter_AddRefs(hdr));
+        if (NS_SUCCEEDED(rv) && hdr)
+          hdr->GetMessageId(getter_Copies(messageId));
+        if (messageId.Equals(aMsgID)) {
+          hdr.forget(aHdr);
+          return NS_OK;
+        }
+        break;
+      }
+      case nsMsgDBIndex::kUnknown:
+        break;
+    }
+    rv = NS_OK;
+  }
+
   mdbYarn messageIdYarn;
 
   messageIdYarn.mYarn_Buf = (void *)aMsgID;
@@ -309,8 +309,10 @@ NS_IMETHODIMP nsMsgHdr::SetMessageId(const char *messageId) {
     nsAutoCString tempMessageID(messageId + 1);
     if (tempMessageID.CharAt(tempMessageID.Length() - 1) == '>')
       tempMessageID.SetLength(tempMessageID.Length() - 1);
+    m_mdb->MessageIdChanging(this, tempMessageID);
     return SetStringColumn(tempMessageID.get(), m_mdb->m_messageIdColumnToken);
   }
+  if (messageId) m_mdb->MessageIdChanging(this, nsDependentCString(messageId));
   return SetStringColumn(messageId, m_mdb->m_messageIdColumnToken);
 }
 
@@ -10,7 +10,6 @@
 #include "nsMsgMessageFlags.h"
 #include "nsSimpleEnumerator.h"
 #include "MailNewsTypes2.h"
-#include "mozilla/DebugOnly.h"
 
 NS_IMPL_ISUPPORTS(nsMsgThread, nsIMsgThread)
 
@@ -21,13 +20,9 @@ nsMsgThread::nsMsgThread(nsMsgDatabase *db, nsIMdbTable *table) {
   m_mdbTable = table;
   m_mdbDB = db;
   if (db)
-    db->m_threads.AppendElement(this);
+    db->AddThread(this);
   else
     NS_ERROR("no db for thread");
-#ifdef DEBUG_David_Bienvenu
-  if (m_mdbDB->m_threads.Length() > 5)
-    printf("more than five outstanding threads\n");
-#endif
   if (table && db) {
     table->GetMetaRow(db->GetEnv(), nullptr, nullptr,
                       getter_AddRefs(m_metaRow));
@@ -37,6 +32,7 @@ nsMsgThread::nsMsgThread(nsMsgDatabase *db, nsIMdbTable *table) {
 
 void nsMsgThread::Init() {
   m_threadKey = nsMsgKey_None;
+  m_threadIndex = 0;
   m_threadRootKey = nsMsgKey_None;
   m_numChildren = 0;
   m_numUnreadChildren = 0;
@@ -46,10 +42,9 @@ void nsMsgThread::Init() {
 }
 
 nsMsgThread::~nsMsgThread() {
-  if (m_mdbDB) {
-    mozilla::DebugOnly<bool> found = m_mdbDB->m_threads.RemoveElement(this);
-    NS_ASSERTION(found, "removing thread not in threads array");
-  } else  // This can happen if db is forced closed
+  if (m_mdbDB)
+    m_mdbDB->RemoveThread(this);
+  else  // This can happen if db is forced closed
     NS_WARNING("null db in thread");
   Clear();
 }
@@ -66,12 +61,14 @@ nsresult nsMsgThread::InitCachedValues() {
   NS_ENSURE_TRUE(m_mdbDB && m_metaRow, NS_ERROR_INVALID_POINTER);
 
   if (!m_cachedValuesInitialized) {
+    nsMsgKey oldThreadKey = m_threadKey;
     err = m_mdbDB->RowCellColumnToUInt32(
         m_metaRow, m_mdbDB->m_threadFlagsColumnToken, &m_flags);
     err = m_mdbDB->RowCellColumnToUInt32(
         m_metaRow, m_mdbDB->m_threadChildrenColumnToken, &m_numChildren);
     err = m_mdbDB->RowCellColumnToUInt32(
         m_metaRow, m_mdbDB->m_threadIdColumnToken, &m_threadKey, nsMsgKey_None);
+    m_mdbDB->ThreadKeyChanged(this, oldThreadKey);
     err = m_mdbDB->RowCellColumnToUInt32(
         m_metaRow, m_mdbDB->m_threadUnreadChildrenColumnToken,
         &m_numUnreadChildren);
@@ -99,7 +96,9 @@ nsresult nsMsgThread::InitCachedValues() {
 NS_IMETHODIMP nsMsgThread::SetThreadKey(nsMsgKey threadKey) {
   NS_ASSERTION(m_threadKey == nsMsgKey_None || m_threadKey == threadKey,
                "shouldn't be changing thread key");
+  nsMsgKey oldThreadKey = m_threadKey;
   m_threadKey = threadKey;
+  m_mdbDB->ThreadKeyChanged(this, oldThreadKey);
   // by definition, the initial thread key is also the thread root key.
   SetThreadRootKey(threadKey);
   // gotta set column in meta row here.
@@ -109,8 +108,10 @@ NS_IMETHODIMP nsMsgThread::SetThreadKey(nsMsgKey threadKey) {
 
 NS_IMETHODIMP nsMsgThread::GetThreadKey(nsMsgKey *result) {
   NS_ENSURE_ARG_POINTER(result);
+  nsMsgKey oldThreadKey = m_threadKey;
   nsresult res = m_mdbDB->RowCellColumnToUInt32(
       m_metaRow, m_mdbDB->m_threadIdColumnToken, &m_threadKey);
+  m_mdbDB->ThreadKeyChanged(this, oldThreadKey);
   *result = m_threadKey;
   return res;
 }
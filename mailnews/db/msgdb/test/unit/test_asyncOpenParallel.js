@@ -0,0 +1,107 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Opens several folder databases asynchronously at once, so that their
+ * summaries are parsed in parallel on the db open thread pool
+ * (mail.db.open_threads), and checks they hold the same messages as when
+ * they're parsed a slice at a time on the main thread. Also checks that a
+ * synchronous open of a db that is still being parsed waits for the parse.
+ */
+
+/* import-globals-from ../../../../test/resources/messageGenerator.js */
+load("../../../../resources/messageGenerator.js");
+
+var kFolderCount = 4;
+var kMessagesPerFolder = 40;
+
+var dbService = Cc["@mozilla.org/msgDatabase/msgDBService;1"].getService(
+  Ci.nsIMsgDBService
+);
+var gMessageGenerator = new MessageGenerator();
+
+/**
+ * Makes kFolderCount folders with a different number of messages each and
+ * closes their databases.
+ *
+ * @return array of [folder, sorted subjects of its messages]
+ */
+function makeFolders(aPrefix) {
+  let folders = [];
+  for (let f = 0; f < kFolderCount; f++) {
+    let folder = localAccountUtils.rootFolder
+      .createLocalSubfolder(aPrefix + f)
+      .QueryInterface(Ci.nsIMsgLocalMailFolder);
+    let subjects = [];
+    for (let i = 0; i < kMessagesPerFolder * (f + 1); i++) {
+      let message = gMessageGenerator.makeMessage();
+      folder.addMessage(message.toMboxString());
+      subjects.push(message.subject);
+    }
+    folder.msgDatabase = null;
+    folders.push([folder, subjects.sort()]);
+  }
+  return folders;
+}
+
+function checkDB(aDB, aSubjects) {
+  Assert.equal(aDB.dBFolderInfo.numMessages, aSubjects.length);
+  let subjects = [];
+  let enumerator = aDB.EnumerateMessages();
+  while (enumerator.hasMoreElements()) {
+    subjects.push(enumerator.getNext().QueryInterface(Ci.nsIMsgDBHdr).subject);
+  }
+  Assert.deepEqual(subjects.sort(), aSubjects);
+  aDB.Close(true);
+}
+
+// Opens all the folders' dbs at once and checks them once they're all open.
+function openAll(aFolders) {
+  let dbs = aFolders.map(([folder]) =>
+    dbService.asyncOpenFolderDB(folder, false)
+  );
+  return new Promise((resolve, reject) => {
+    let pending = dbs.slice();
+    function openMore() {
+      try {
+        pending = pending.filter(db => !dbService.openMore(db, 0));
+      } catch (ex) {
+        reject(ex);
+        return;
+      }
+      if (pending.length) {
+        do_timeout(0, openMore);
+        return;
+      }
+      for (let f = 0; f < aFolders.length; f++) {
+        checkDB(dbs[f], aFolders[f][1]);
+      }
+      resolve();
+    }
+    openMore();
+  });
+}
+
+add_task(async function testSerial() {
+  localAccountUtils.loadLocalMailAccount();
+  Services.prefs.setIntPref("mail.db.open_threads", 0);
+  await openAll(makeFolders("serial"));
+});
+
+add_task(async function testParallel() {
+  for (let threads of [1, 2, kFolderCount]) {
+    Services.prefs.setIntPref("mail.db.open_threads", threads);
+    await openAll(makeFolders("parallel" + threads + "_"));
+  }
+});
+
+add_task(function testSyncOpenWhileParsing() {
+  Services.prefs.setIntPref("mail.db.open_threads", 2);
+  for (let [folder, subjects] of makeFolders("sync")) {
+    let db = dbService.asyncOpenFolderDB(folder, false);
+    Assert.equal(dbService.openFolderDB(folder, false), db);
+    Assert.ok(dbService.openMore(db, 0));
+    checkDB(db, subjects);
+  }
+  Services.prefs.clearUserPref("mail.db.open_threads");
+});
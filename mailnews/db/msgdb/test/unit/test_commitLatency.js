@@ -0,0 +1,108 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that a large commit of a few changed headers only appends those
+ * changes to the summary file, however many headers the folder holds, that
+ * the changes survive reopening the database, and that changing a few cells
+ * of a row holding many only writes the changed cells.
+ */
+
+var kChangedHeaders = 20;
+// A commit group holding a header row with two changed cells, plus its
+// thread row and the folder info row, is far smaller than this.
+var kMaxGrowthPerCommit = 512;
+
+function makeFolder(aName, aCount) {
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder(aName);
+  let db = folder.msgDatabase;
+  for (let i = 0; i < aCount; i++) {
+    let hdr = db.CreateNewHdr(i + 1);
+    hdr.subject = "Subject " + i;
+    hdr.author = "Author " + (i % 53) + " <a@example.invalid>";
+    hdr.date = (1500000000 + i * 60) * 1000000;
+    hdr.messageSize = 1000 + ((i * 13) % 211);
+    db.AddNewHdrToDB(hdr, false);
+  }
+  db.Commit(Ci.nsMsgDBCommitType.kCompressCommit);
+  return folder;
+}
+
+// Each cell of a rewritten row takes at least "(^80=)" or "(^80^1)".
+var kMinCellSize = 6;
+var kManyCells = 100;
+
+function checkPartialRow() {
+  let folder = makeFolder("partial", 1);
+  let db = folder.msgDatabase;
+  let hdr = db.GetMsgHdrForKey(1);
+  for (let i = 0; i < kManyCells; i++) {
+    hdr.setStringProperty("cell" + i, "value " + i);
+  }
+  db.Commit(Ci.nsMsgDBCommitType.kCompressCommit);
+
+  let startSize = folder.summaryFile.fileSize;
+  for (let i = 0; i < 3; i++) {
+    hdr.setStringProperty("cell" + i * 7, "changed");
+  }
+  db.Commit(Ci.nsMsgDBCommitType.kLargeCommit);
+  let growth = folder.summaryFile.fileSize - startSize;
+  Assert.ok(growth > 0);
+  Assert.ok(growth < kManyCells * kMinCellSize);
+
+  db.Close(true);
+  db.ForceClosed();
+  folder.msgDatabase = null;
+  let dbService = Cc["@mozilla.org/msgDatabase/msgDBService;1"].getService(
+    Ci.nsIMsgDBService
+  );
+  db = dbService.openFolderDB(folder, true);
+  hdr = db.GetMsgHdrForKey(1);
+  for (let i = 0; i < kManyCells; i++) {
+    Assert.equal(
+      hdr.getStringProperty("cell" + i),
+      i % 7 == 0 && i < 21 ? "changed" : "value " + i
+    );
+  }
+  db.Close(true);
+}
+
+function changedKey(aIndex, aCount) {
+  return 1 + Math.floor((aIndex * aCount) / kChangedHeaders);
+}
+
+function run_test() {
+  localAccountUtils.loadLocalMailAccount();
+  let dbService = Cc["@mozilla.org/msgDatabase/msgDBService;1"].getService(
+    Ci.nsIMsgDBService
+  );
+
+  for (let size of [100, 2000]) {
+    let folder = makeFolder("commit" + size, size);
+    let db = folder.msgDatabase;
+    let startSize = folder.summaryFile.fileSize;
+    for (let i = 0; i < kChangedHeaders; i++) {
+      let hdr = db.GetMsgHdrForKey(changedKey(i, size));
+      db.MarkHdrRead(hdr, true, null);
+      hdr.setStringProperty("keywords", "$label" + (1 + (i % 5)));
+      db.Commit(Ci.nsMsgDBCommitType.kLargeCommit);
+    }
+    let growth = folder.summaryFile.fileSize - startSize;
+    Assert.ok(growth > 0);
+    Assert.ok(growth < kChangedHeaders * kMaxGrowthPerCommit);
+
+    db.Close(true);
+    db.ForceClosed();
+    folder.msgDatabase = null;
+    db = dbService.openFolderDB(folder, true);
+    for (let i = 0; i < kChangedHeaders; i++) {
+      let hdr = db.GetMsgHdrForKey(changedKey(i, size));
+      Assert.ok(hdr.isRead);
+      Assert.equal(hdr.getStringProperty("keywords"), "$label" + (1 + (i % 5)));
+      Assert.equal(hdr.subject, "Subject " + (changedKey(i, size) - 1));
+    }
+    db.Close(true);
+  }
+
+  checkPartialRow();
+}
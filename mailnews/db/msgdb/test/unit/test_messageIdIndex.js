@@ -0,0 +1,183 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that the Message-ID and References index is saved next to the
+ * summary file when the database is committed, and that after reopening the
+ * database, lookups by message id and the threading of new replies use it
+ * and see the adds, deletes and id changes made before and since, that an
+ * index left behind by a build that doesn't maintain it is ignored, and that
+ * the index is renamed and deleted with its folder.
+ */
+
+var kThreads = 10;
+var kMessagesPerThread = 5;
+
+var dbService = Cc["@mozilla.org/msgDatabase/msgDBService;1"].getService(
+  Ci.nsIMsgDBService
+);
+var gNextKey = 1;
+
+function messageId(aIndex) {
+  return "m" + aIndex + "@example.invalid";
+}
+
+function addHdr(aDB, aId, aReferences) {
+  let hdr = aDB.CreateNewHdr(gNextKey++);
+  hdr.messageId = "<" + aId + ">";
+  hdr.subject = "Subject " + hdr.messageKey;
+  hdr.date = (1500000000 + hdr.messageKey * 60) * 1000000;
+  hdr.setReferences(aReferences.map(id => "<" + id + ">").join(" "));
+  aDB.AddNewHdrToDB(hdr, false);
+  return hdr;
+}
+
+function reopen(aFolder, aDB) {
+  aDB.Close(true);
+  aDB.ForceClosed();
+  aFolder.msgDatabase = null;
+  return dbService.openFolderDB(aFolder, true);
+}
+
+function indexFile(aFolder) {
+  let file = aFolder.summaryFile;
+  file.leafName += ".idx";
+  return file;
+}
+
+function keyOf(aDB, aId) {
+  let hdr = aDB.getMsgHdrForMessageID(aId);
+  return hdr ? hdr.messageKey : null;
+}
+
+function threadKeyOf(aDB, aId) {
+  return aDB.getMsgHdrForMessageID(aId).threadId;
+}
+
+function run_test() {
+  localAccountUtils.loadLocalMailAccount();
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder("index");
+  let db = folder.msgDatabase;
+
+  // Each thread has a root and replies to it, and the replies of the even
+  // threads also refer to a message that isn't in the folder.
+  for (let t = 0; t < kThreads; t++) {
+    let root = messageId(t * kMessagesPerThread);
+    addHdr(db, root, []);
+    for (let i = 1; i < kMessagesPerThread; i++) {
+      let references = t % 2 ? [root] : ["missing" + t, root];
+      addHdr(db, messageId(t * kMessagesPerThread + i), references);
+    }
+  }
+  Assert.ok(!indexFile(folder).exists());
+  db = reopen(folder, db);
+  Assert.ok(indexFile(folder).exists());
+  let size = indexFile(folder).fileSize;
+
+  for (let i = 0; i < kThreads * kMessagesPerThread; i++) {
+    Assert.equal(keyOf(db, messageId(i)), i + 1);
+  }
+  Assert.equal(keyOf(db, "nothere@example.invalid"), null);
+
+  // A reply to a message in the folder, and one that only shares a
+  // reference with messages in the folder.
+  let reply = addHdr(db, "reply1@example.invalid", [messageId(3)]);
+  Assert.equal(reply.threadId, threadKeyOf(db, messageId(0)));
+  let cousin = addHdr(db, "reply2@example.invalid", ["missing2"]);
+  Assert.equal(cousin.threadId, threadKeyOf(db, messageId(10)));
+
+  // Delete the root of the second thread and change an id.
+  db.DeleteMessage(kMessagesPerThread + 1, null, false);
+  let renamed = db.getMsgHdrForMessageID(messageId(7));
+  renamed.messageId = "<renamed@example.invalid>";
+  Assert.equal(keyOf(db, messageId(5)), null);
+  Assert.equal(keyOf(db, messageId(7)), null);
+  Assert.equal(keyOf(db, "renamed@example.invalid"), 8);
+
+  // A few changes are appended to the index rather than rewriting it.
+  db.Commit(Ci.nsMsgDBCommitType.kLargeCommit);
+  let growth = indexFile(folder).fileSize - size;
+  Assert.ok(growth > 0);
+  Assert.ok(growth < 1024);
+  db = reopen(folder, db);
+  Assert.equal(keyOf(db, "reply1@example.invalid"), reply.messageKey);
+  Assert.equal(keyOf(db, messageId(5)), null);
+  Assert.equal(keyOf(db, messageId(7)), null);
+  Assert.equal(keyOf(db, "renamed@example.invalid"), 8);
+  let late = addHdr(db, "reply3@example.invalid", ["missing4"]);
+  Assert.equal(late.threadId, threadKeyOf(db, messageId(20)));
+
+  // Without its index file, the index is built from the headers again.
+  db.Commit(Ci.nsMsgDBCommitType.kLargeCommit);
+  db.Close(true);
+  db.ForceClosed();
+  folder.msgDatabase = null;
+  indexFile(folder).remove(false);
+  db = dbService.openFolderDB(folder, true);
+  let another = addHdr(db, "reply4@example.invalid", ["missing6"]);
+  Assert.equal(another.threadId, threadKeyOf(db, messageId(30)));
+  Assert.equal(keyOf(db, "reply3@example.invalid"), late.messageKey);
+  db = reopen(folder, db);
+  Assert.ok(indexFile(folder).exists());
+  Assert.equal(keyOf(db, "reply4@example.invalid"), another.messageKey);
+
+  // A build that doesn't know about the index adds a header and keeps the
+  // stamp; the saved index no longer covers every header, so it's ignored.
+  let folderInfo = db.dBFolderInfo;
+  let stamp = folderInfo.getInt64Property("msgIdIndexStamp", 0);
+  let check = folderInfo.getInt64Property("msgIdIndexCheck", 0);
+  let staleFile = indexFile(folder);
+  staleFile.leafName += ".stale";
+  indexFile(folder).copyTo(null, staleFile.leafName);
+  let unindexed = addHdr(db, "unindexed@example.invalid", []);
+  db.Commit(Ci.nsMsgDBCommitType.kLargeCommit);
+  folderInfo.setInt64Property("msgIdIndexStamp", stamp);
+  folderInfo.setInt64Property("msgIdIndexCheck", check);
+  db.Close(true);
+  db.ForceClosed();
+  folder.msgDatabase = null;
+  staleFile.moveTo(null, indexFile(folder).leafName);
+  db = dbService.openFolderDB(folder, true);
+  Assert.equal(keyOf(db, "unindexed@example.invalid"), unindexed.messageKey);
+  Assert.equal(keyOf(db, "reply4@example.invalid"), another.messageKey);
+
+  // Such a build changes an id, which leaves the header count and high water
+  // mark alone; the summary file has changed since the index was saved.
+  db = reopen(folder, db);
+  folderInfo = db.dBFolderInfo;
+  stamp = folderInfo.getInt64Property("msgIdIndexStamp", 0);
+  check = folderInfo.getInt64Property("msgIdIndexCheck", 0);
+  Assert.notEqual(stamp, 0);
+  indexFile(folder).copyTo(null, staleFile.leafName);
+  let changed = db.getMsgHdrForMessageID(messageId(12));
+  changed.messageId = "<changed@example.invalid>";
+  db.Commit(Ci.nsMsgDBCommitType.kLargeCommit);
+  folderInfo.setInt64Property("msgIdIndexStamp", stamp);
+  folderInfo.setInt64Property("msgIdIndexCheck", check);
+  db.Close(true);
+  db.ForceClosed();
+  folder.msgDatabase = null;
+  staleFile.moveTo(null, indexFile(folder).leafName);
+  db = dbService.openFolderDB(folder, true);
+  Assert.equal(db.dBFolderInfo.getInt64Property("msgIdIndexCheck", 0), check);
+  Assert.equal(keyOf(db, "changed@example.invalid"), changed.messageKey);
+  Assert.equal(keyOf(db, messageId(12)), null);
+  db.Close(true);
+  db.ForceClosed();
+  folder.msgDatabase = null;
+
+  // The index goes wherever the summary file goes.
+  let root = localAccountUtils.rootFolder;
+  Assert.ok(indexFile(folder).exists());
+  folder.rename("index2", null);
+  Assert.ok(!indexFile(folder).exists());
+  let moved = root.getChildNamed("index2");
+  Assert.ok(indexFile(moved).exists());
+  db = moved.msgDatabase;
+  Assert.equal(keyOf(db, "changed@example.invalid"), changed.messageKey);
+  db.Close(true);
+  moved.msgDatabase = null;
+  root.propagateDelete(moved, true, null);
+  Assert.ok(!moved.summaryFile.exists());
+  Assert.ok(!indexFile(moved).exists());
+}
@@ -0,0 +1,48 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Adds replies to a folder while all its threads are held open, as a threaded
+ * view does, and checks each reply joins the live thread object of its
+ * parent.
+ */
+
+var kMessagesPerThread = 4;
+
+function run_test() {
+  localAccountUtils.loadLocalMailAccount();
+  let count = 4000;
+  let threadCount = Math.ceil(count / kMessagesPerThread);
+
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder("threads");
+  let db = folder.msgDatabase;
+  let threads = [];
+  for (let i = 0; i < count; i++) {
+    // Start all the threads first, then add the replies round robin.
+    let t = i % threadCount;
+    let hdr = db.CreateNewHdr(i + 1);
+    hdr.messageId = "<m" + i + "@example.invalid>";
+    hdr.author = "Author " + (i % 17) + " <a@example.invalid>";
+    hdr.date = (1500000000 + i * 60) * 1000000;
+    if (i < threadCount) {
+      hdr.subject = "Thread " + t;
+    } else {
+      hdr.subject = "Re: Thread " + t;
+      hdr.setReferences("<m" + t + "@example.invalid>");
+    }
+    db.AddNewHdrToDB(hdr, false);
+    if (i < threadCount) {
+      threads.push(db.GetThreadContainingMsgHdr(hdr));
+    } else {
+      Assert.equal(db.GetThreadContainingMsgHdr(hdr), threads[t]);
+    }
+  }
+
+  for (let t = 0; t < threadCount; t++) {
+    let expected = Math.floor((count - t - 1) / threadCount) + 1;
+    Assert.equal(threads[t].numChildren, expected);
+    Assert.equal(threads[t].threadKey, t + 1);
+  }
+  threads = null;
+  db.Close(true);
+}
@@ -28,8 +28,13 @@
 #include "nsIChannel.h"
 #include "nsDependentSubstring.h"
 #include "nsMemory.h"
+#include "nsIThreadPool.h"
+#include "nsThreadUtils.h"
 
 #include "mozilla/ArenaAllocatorExtensions.h"  // for ArenaStrdup
+#include "mozilla/EndianUtils.h"
+#include "prio.h"
+#include <algorithm>
 
 using namespace mozilla;
 
@@ -77,24 +82,18 @@ struct BaseToken : public PLDHashEntryHdr {
 };
 
 // token for a particular message
-// mCount, mAnalysisLink are initialized to zero by the hash code
+// mCount is initialized to zero by the hash code
 struct Token : public BaseToken {
   uint32_t mCount;
-  uint32_t mAnalysisLink;  // index in mAnalysisStore of the AnalysisPerToken
-                           // object for the first trait for this token
-  // Helper to support Tokenizer::copyTokens()
-  void clone(const Token& other) {
-    mWord = other.mWord;
-    mCount = other.mCount;
-    mAnalysisLink = other.mAnalysisLink;
-  }
 };
 
 // token stored in a training file for a group of messages
-// mTraitLink is initialized to 0 by the hash code
+// mTraitLink, mFileLink are initialized to 0 by the hash code
 struct CorpusToken : public BaseToken {
   uint32_t mTraitLink;  // index in mTraitStore of the TraitPerToken
                         // object for the first trait for this token
+  uint32_t mFileLink;   // 1 + index of the token in the training file,
+                        // or 0 if the token is not in the file
 };
 
 // set the value of a TraitPerToken object
@@ -105,17 +104,6 @@ TraitPerToken::TraitPerToken(uint32_t aTraitId, uint32_t aCount)
 static const uint32_t kJunkTrait = nsIJunkMailPlugin::JUNK_TRAIT;
 static const uint32_t kGoodTrait = nsIJunkMailPlugin::GOOD_TRAIT;
 
-// set the value of an AnalysisPerToken object
-AnalysisPerToken::AnalysisPerToken(uint32_t aTraitIndex, double aDistance,
-                                   double aProbability)
-    : mTraitIndex(aTraitIndex),
-      mDistance(aDistance),
-      mProbability(aProbability),
-      mNextLink(0) {}
-
-// the initial size of the AnalysisPerToken linked list storage
-const uint32_t kAnalysisStoreCapacity = 2048;
-
 // the initial size of the TraitPerToken linked list storage
 const uint32_t kTraitStoreCapacity = 16384;
 
@@ -843,24 +831,6 @@ void Tokenizer::UnescapeCString(nsCString& aCString) {
   aCString.Assign(result);
 }
 
-Token* Tokenizer::copyTokens() {
-  uint32_t count = countTokens();
-  if (count > 0) {
-    Token* tokens = new Token[count];
-    if (tokens) {
-      Token* tp = tokens;
-      TokenEnumeration e(&mTokenTable);
-      while (e.hasMoreTokens()) {
-        Token* src = static_cast<Token*>(e.nextToken());
-        tp->clone(*src);
-        ++tp;
-      }
-    }
-    return tokens;
-  }
-  return NULL;
-}
-
 class TokenAnalyzer {
  public:
   virtual ~TokenAnalyzer() {}
@@ -1108,7 +1078,9 @@ nsBayesianFilter::nsBayesianFilter() : mTrainingDataDirty(false) {
   MOZ_LOG(BayesianFilterLogModule, LogLevel::Warning,
           ("junk probability threshold: %f", mJunkProbabilityThreshold));
 
-  mCorpus.readTrainingData();
+  // the corpus file is written on the next flush if the training was migrated
+  // from the version 1 files
+  mTrainingDataDirty = mCorpus.readTrainingData();
 
   // get parameters for training data flushing, from the prefs
 
@@ -1142,15 +1114,16 @@ nsBayesianFilter::nsBayesianFilter() : mTrainingDataDirty(false) {
   // the timer is not used on object construction, since for
   // the time being there are no dirying messages
 
-  // give a default capacity to the memory structure used to store
-  // per-message/per-trait token data
-  mAnalysisStore.SetCapacity(kAnalysisStoreCapacity);
-
-  // dummy 0th element. Index 0 means "end of list" so we need to
-  // start from 1
-  AnalysisPerToken analysisPT(0, 0.0, 0.0);
-  mAnalysisStore.AppendElement(analysisPT);
-  mNextAnalysisIndex = 1;
+  // messages are tokenized on the main thread, and scored in batches on a
+  // thread pool
+  rv = prefBranch->GetIntPref(
+      "mailnews.bayesian_spam_filter.classify_batch_size",
+      &mClassifyBatchSize);
+  if (NS_FAILED(rv) || mClassifyBatchSize < 1) mClassifyBatchSize = 32;
+  rv = prefBranch->GetIntPref("mailnews.bayesian_spam_filter.classify_threads",
+                              &mClassifyThreads);
+  if (NS_FAILED(rv) || mClassifyThreads < 0)
+    mClassifyThreads = 0;  // which means score on the main thread
 }
 
 nsresult nsBayesianFilter::Init() {
@@ -1166,8 +1139,10 @@ void nsBayesianFilter::TimerCallback(nsITimer* aTimer, void* aClosure) {
   // since the first time a message has been classified after the last flush
 
   nsBayesianFilter* filter = static_cast<nsBayesianFilter*>(aClosure);
-  filter->mCorpus.writeTrainingData(filter->mMaximumTokenCount);
-  filter->mTrainingDataDirty = false;
+  // If the data can't be written, it stays dirty and is tried again on
+  // shutdown.
+  nsresult rv = filter->mCorpus.writeTrainingData(filter->mMaximumTokenCount);
+  if (NS_SUCCEEDED(rv)) filter->mTrainingDataDirty = false;
 }
 
 nsBayesianFilter::~nsBayesianFilter() {
@@ -1178,12 +1153,65 @@ nsBayesianFilter::~nsBayesianFilter() {
   // call shutdown when we are going away in case we need
   // to flush the training set to disk
   Shutdown();
+  shutdownClassifyPool();
 }
 
+// The scores of one message for one pro/anti trait pair
+struct TraitScore {
+  double mProbability;
+  double mHamScore;  // H and S of the chi-square combination
+  double mSpamScore;
+  // if details were asked for, the tokens that were used (as indexes in the
+  // job), most significant first, with their percents
+  nsTArray<uint32_t> mDetailTokens;
+  nsTArray<uint32_t> mTokenPercents;
+  nsTArray<uint32_t> mRunningPercents;
+};
+
+// Everything needed to score one message. The corpus counts of the message's
+// tokens are copied out on the main thread, so that the job can be scored on
+// a pool thread while the corpus is trained or written.
+struct ClassificationJob {
+  nsCString mMessageURI;
+  uint32_t mTraitCount;
+  bool mWantDetails;
+  // message counts for each trait index, as pro, anti pairs
+  nsTArray<uint32_t> mMessageCounts;
+  uint32_t mGoodMessages;
+  uint32_t mJunkMessages;
+  // the message's tokens that are in the corpus, and their counts for each
+  // trait index, as pro, anti pairs
+  nsTArray<nsCString> mWords;
+  nsTArray<uint32_t> mTokenCounts;
+  // one score per trait index, set by ScoreClassification
+  nsTArray<TraitScore> mScores;
+};
+
+// A run of messages that is scored on the pool in one go
+class ClassificationBatch final {
+ public:
+  NS_INLINE_DECL_THREADSAFE_REFCOUNTING(ClassificationBatch)
+
+  ClassificationBatch() : mScored(false) {}
+
+  nsTArray<ClassificationJob> mJobs;
+  bool mScored;  // only used on the main thread
+
+ private:
+  ~ClassificationBatch() {}
+};
+
+static void ScoreClassification(ClassificationJob& aJob);
+
 // this object is used for one call to classifyMessage or classifyMessages().
 // So if we're classifying multiple messages, this object will be used for each
 // message. It's going to hold a reference to itself, basically, to stay in
 // memory.
+//
+// Messages are streamed and tokenized one after the other on the main thread,
+// and collected into batches that are scored on the filter's thread pool while
+// the next messages are streamed. The listeners are called on the main thread,
+// in message order, as the batches are scored.
 class MessageClassifier : public TokenAnalyzer {
  public:
   // full classifier with arbitrary traits
@@ -1201,12 +1229,17 @@ class MessageClassifier : public TokenAnalyzer {
         mDetailListener(aDetailListener),
         mProTraits(aProTraits),
         mAntiTraits(aAntiTraits),
-        mMsgWindow(aMsgWindow) {
+        mMsgWindow(aMsgWindow),
+        mBatch(new ClassificationBatch()),
+        mStreamingDone(false) {
     mCurMessageToClassify = 0;
     mNumMessagesToClassify = aNumMessagesToClassify;
     mMessageURIs = (char**)moz_xmalloc(sizeof(char*) * aNumMessagesToClassify);
     for (uint32_t i = 0; i < aNumMessagesToClassify; i++)
       mMessageURIs[i] = PL_strdup(aMessageURIs[i]);
+    // the aliases of the traits are looked up once for all the messages
+    mFilter->getTraitIds(mProTraits, mProIds);
+    mFilter->getTraitIds(mAntiTraits, mAntiIds);
   }
 
   // junk-only classifier
@@ -1219,7 +1252,9 @@ class MessageClassifier : public TokenAnalyzer {
         mJunkListener(aJunkListener),
         mTraitListener(nullptr),
         mDetailListener(nullptr),
-        mMsgWindow(aMsgWindow) {
+        mMsgWindow(aMsgWindow),
+        mBatch(new ClassificationBatch()),
+        mStreamingDone(false) {
     mCurMessageToClassify = 0;
     mNumMessagesToClassify = aNumMessagesToClassify;
     mMessageURIs = (char**)moz_xmalloc(sizeof(char*) * aNumMessagesToClassify);
@@ -1227,6 +1262,8 @@ class MessageClassifier : public TokenAnalyzer {
       mMessageURIs[i] = PL_strdup(aMessageURIs[i]);
     mProTraits.AppendElement(kJunkTrait);
     mAntiTraits.AppendElement(kGoodTrait);
+    mFilter->getTraitIds(mProTraits, mProIds);
+    mFilter->getTraitIds(mAntiTraits, mAntiIds);
   }
 
   virtual ~MessageClassifier() {
@@ -1236,10 +1273,11 @@ class MessageClassifier : public TokenAnalyzer {
     }
   }
   virtual void analyzeTokens(Tokenizer& tokenizer) {
-    mFilter->classifyMessage(tokenizer, mTokenSource.get(), mProTraits,
-                             mAntiTraits, mJunkListener, mTraitListener,
-                             mDetailListener);
+    ClassificationJob* job = mBatch->mJobs.AppendElement();
+    mFilter->gatherEvidence(tokenizer, mTokenSource.get(), mProIds, mAntiIds,
+                            mDetailListener != nullptr, *job);
     tokenizer.clearTokens();
+    if (mBatch->mJobs.Length() >= mFilter->classifyBatchSize()) scoreBatch();
     classifyNextMessage();
   }
 
@@ -1251,19 +1289,68 @@ class MessageClassifier : public TokenAnalyzer {
       mFilter->tokenizeMessage(mMessageURIs[mCurMessageToClassify], mMsgWindow,
                                this);
     } else {
-      // call all listeners with null parameters to signify end of batch
-      if (mJunkListener)
-        mJunkListener->OnMessageClassified(nullptr,
-                                           nsIJunkMailPlugin::UNCLASSIFIED, 0);
-      if (mTraitListener)
-        mTraitListener->OnMessageTraitsClassified(nullptr, 0, nullptr, nullptr);
-      mTokenListener =
-          nullptr;  // this breaks the circular ref that keeps this object alive
-                    // so we will be destroyed as a result.
+      mStreamingDone = true;
+      if (!mBatch->mJobs.IsEmpty()) scoreBatch();
+      reportScoredBatches();
     }
   }
 
+  // Reports the scored batches at the head of the queue to the listeners.
+  // Once all messages are reported, this ends the classification, which
+  // destroys this object.
+  void reportScoredBatches() {
+    while (!mPendingBatches.IsEmpty() && mPendingBatches[0]->mScored) {
+      RefPtr<ClassificationBatch> batch = mPendingBatches[0];
+      mPendingBatches.RemoveElementAt(0);
+      for (ClassificationJob& job : batch->mJobs)
+        mFilter->reportClassification(job, mProTraits, mJunkListener,
+                                      mTraitListener, mDetailListener);
+    }
+    if (!mStreamingDone || !mPendingBatches.IsEmpty()) return;
+
+    // call all listeners with null parameters to signify end of batch
+    if (mJunkListener)
+      mJunkListener->OnMessageClassified(nullptr,
+                                         nsIJunkMailPlugin::UNCLASSIFIED, 0);
+    if (mTraitListener)
+      mTraitListener->OnMessageTraitsClassified(nullptr, 0, nullptr, nullptr);
+    mTokenListener = nullptr;  // this breaks the circular ref that keeps this
+                               // object alive so we will be destroyed as a
+                               // result.
+  }
+
  private:
+  // Queues the current batch, and scores it on the pool. If there is no
+  // pool, the batch is scored right away.
+  void scoreBatch() {
+    RefPtr<ClassificationBatch> batch = mBatch.forget();
+    mBatch = new ClassificationBatch();
+    mPendingBatches.AppendElement(batch);
+
+    nsIThreadPool* pool = mFilter->getClassifyPool();
+    if (pool) {
+      // we stay alive until every pending batch is reported
+      MessageClassifier* self = this;
+      nsresult rv = pool->Dispatch(
+          NS_NewRunnableFunction(
+              "MessageClassifier::ScoreBatch",
+              [self, batch]() {
+                for (ClassificationJob& job : batch->mJobs)
+                  ScoreClassification(job);
+                NS_DispatchToMainThread(NS_NewRunnableFunction(
+                    "MessageClassifier::ReportScoredBatches", [self, batch]() {
+                      batch->mScored = true;
+                      self->reportScoredBatches();
+                    }));
+              }),
+          NS_DISPATCH_NORMAL);
+      if (NS_SUCCEEDED(rv)) return;
+    }
+
+    for (ClassificationJob& job : batch->mJobs) ScoreClassification(job);
+    batch->mScored = true;
+  }
+
   nsBayesianFilter* mFilter;
   nsCOMPtr<nsIJunkMailPlugin> mJunkMailPlugin;
   nsCOMPtr<nsIJunkMailClassificationListener> mJunkListener;
@@ -1271,10 +1358,16 @@ class MessageClassifier : public TokenAnalyzer {
   nsCOMPtr<nsIMsgTraitDetailListener> mDetailListener;
   nsTArray<uint32_t> mProTraits;
   nsTArray<uint32_t> mAntiTraits;
+  // each trait followed by its aliases, per trait index
+  nsTArray<nsTArray<uint32_t>> mProIds;
+  nsTArray<nsTArray<uint32_t>> mAntiIds;
   nsCOMPtr<nsIMsgWindow> mMsgWindow;
   int32_t mNumMessagesToClassify;
   int32_t mCurMessageToClassify;  // 0-based index
   char** mMessageURIs;
+  RefPtr<ClassificationBatch> mBatch;  // messages not yet given to the pool
+  nsTArray<RefPtr<ClassificationBatch>> mPendingBatches;  // in message order
+  bool mStreamingDone;
 };
 
 nsresult nsBayesianFilter::tokenizeMessage(const char* aMessageURI,
@@ -1340,130 +1433,25 @@ static inline double chi2P(double chi2, double nu, int32_t* error) {
   return nsIncompleteGammaP(nu / 2.0, chi2 / 2.0, error);
 }
 
-void nsBayesianFilter::classifyMessage(
-    Tokenizer& tokenizer, const char* messageURI,
-    nsTArray<uint32_t>& aProTraits, nsTArray<uint32_t>& aAntiTraits,
-    nsIJunkMailClassificationListener* listener,
-    nsIMsgTraitClassificationListener* aTraitListener,
-    nsIMsgTraitDetailListener* aDetailListener) {
-  Token* tokens = tokenizer.copyTokens();
-  uint32_t tokenCount;
-  if (!tokens) {
-    // This can happen with problems with UTF conversion
-    NS_ERROR("Trying to classify a null or invalid message");
-    tokenCount = 0;
-    // don't return so that we still call the listeners
-  } else {
-    tokenCount = tokenizer.countTokens();
-  }
-
-  if (aProTraits.Length() != aAntiTraits.Length()) {
-    NS_ERROR("Each Pro trait needs a matching Anti trait");
-    return;
-  }
-
+// Scores a message for each of its traits. This only uses the job, so it
+// may run on any thread.
+static void ScoreClassification(ClassificationJob& aJob) {
   /* this part is similar to the Graham algorithm with some adjustments. */
-  uint32_t traitCount = aProTraits.Length();
-
-  // pro message counts per trait index
-  AutoTArray<uint32_t, kTraitAutoCapacity> numProMessages;
-  // anti message counts per trait index
-  AutoTArray<uint32_t, kTraitAutoCapacity> numAntiMessages;
-  // array of pro aliases per trait index
-  AutoTArray<uint32_t*, kTraitAutoCapacity> proAliasArrays;
-  // number of pro aliases per trait index
-  AutoTArray<uint32_t, kTraitAutoCapacity> proAliasesLengths;
-  // array of anti aliases per trait index
-  AutoTArray<uint32_t*, kTraitAutoCapacity> antiAliasArrays;
-  // number of anti aliases per trait index
-  AutoTArray<uint32_t, kTraitAutoCapacity> antiAliasesLengths;
-  // construct the outgoing listener arrays
-  AutoTArray<uint32_t, kTraitAutoCapacity> traits;
-  AutoTArray<uint32_t, kTraitAutoCapacity> percents;
-  if (traitCount > kTraitAutoCapacity) {
-    traits.SetCapacity(traitCount);
-    percents.SetCapacity(traitCount);
-    numProMessages.SetCapacity(traitCount);
-    numAntiMessages.SetCapacity(traitCount);
-    proAliasesLengths.SetCapacity(traitCount);
-    antiAliasesLengths.SetCapacity(traitCount);
-    proAliasArrays.SetCapacity(traitCount);
-    antiAliasArrays.SetCapacity(traitCount);
-  }
-
-  nsresult rv;
-  nsCOMPtr<nsIMsgTraitService> traitService(
-      do_GetService("@mozilla.org/msg-trait-service;1", &rv));
-  if (NS_FAILED(rv)) {
-    NS_ERROR("Failed to get trait service");
-    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
-            ("Failed to get trait service"));
-  }
+  uint32_t traitCount = aJob.mTraitCount;
+  uint32_t tokenCount = aJob.mWords.Length();
+  aJob.mScores.SetLength(traitCount);
 
-  // get aliases and message counts for the pro and anti traits
   for (uint32_t traitIndex = 0; traitIndex < traitCount; traitIndex++) {
-    nsresult rv;
-
-    // pro trait
-    uint32_t proAliasesLength = 0;
-    uint32_t* proAliases = nullptr;
-    uint32_t proTrait = aProTraits[traitIndex];
-    if (traitService) {
-      rv = traitService->GetAliases(proTrait, &proAliasesLength, &proAliases);
-      if (NS_FAILED(rv)) {
-        NS_ERROR("trait service failed to get aliases");
-        MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
-                ("trait service failed to get aliases"));
-      }
-    }
-    proAliasesLengths.AppendElement(proAliasesLength);
-    proAliasArrays.AppendElement(proAliases);
-    uint32_t proMessageCount = mCorpus.getMessageCount(proTrait);
-    for (uint32_t aliasIndex = 0; aliasIndex < proAliasesLength; aliasIndex++)
-      proMessageCount += mCorpus.getMessageCount(proAliases[aliasIndex]);
-    numProMessages.AppendElement(proMessageCount);
-
-    // anti trait
-    uint32_t antiAliasesLength = 0;
-    uint32_t* antiAliases = nullptr;
-    uint32_t antiTrait = aAntiTraits[traitIndex];
-    if (traitService) {
-      rv =
-          traitService->GetAliases(antiTrait, &antiAliasesLength, &antiAliases);
-      if (NS_FAILED(rv)) {
-        NS_ERROR("trait service failed to get aliases");
-        MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
-                ("trait service failed to get aliases"));
-      }
-    }
-    antiAliasesLengths.AppendElement(antiAliasesLength);
-    antiAliasArrays.AppendElement(antiAliases);
-    uint32_t antiMessageCount = mCorpus.getMessageCount(antiTrait);
-    for (uint32_t aliasIndex = 0; aliasIndex < antiAliasesLength; aliasIndex++)
-      antiMessageCount += mCorpus.getMessageCount(antiAliases[aliasIndex]);
-    numAntiMessages.AppendElement(antiMessageCount);
-  }
+    TraitScore& score = aJob.mScores[traitIndex];
+    uint32_t numProMessages = aJob.mMessageCounts[2 * traitIndex];
+    uint32_t numAntiMessages = aJob.mMessageCounts[2 * traitIndex + 1];
 
-  for (uint32_t i = 0; i < tokenCount; ++i) {
-    Token& token = tokens[i];
-    CorpusToken* t = mCorpus.get(token.mWord);
-    if (!t) continue;
-    for (uint32_t traitIndex = 0; traitIndex < traitCount; traitIndex++) {
-      uint32_t iProCount = mCorpus.getTraitCount(t, aProTraits[traitIndex]);
-      // add in any counts for aliases to proTrait
-      for (uint32_t aliasIndex = 0; aliasIndex < proAliasesLengths[traitIndex];
-           aliasIndex++)
-        iProCount +=
-            mCorpus.getTraitCount(t, proAliasArrays[traitIndex][aliasIndex]);
-      double proCount = static_cast<double>(iProCount);
-
-      uint32_t iAntiCount = mCorpus.getTraitCount(t, aAntiTraits[traitIndex]);
-      // add in any counts for aliases to antiTrait
-      for (uint32_t aliasIndex = 0; aliasIndex < antiAliasesLengths[traitIndex];
-           aliasIndex++)
-        iAntiCount +=
-            mCorpus.getTraitCount(t, antiAliasArrays[traitIndex][aliasIndex]);
-      double antiCount = static_cast<double>(iAntiCount);
+    AutoTArray<TraitAnalysis, 1024> traitAnalyses;
+    for (uint32_t tokenIndex = 0; tokenIndex < tokenCount; tokenIndex++) {
+      const uint32_t* counts =
+          &aJob.mTokenCounts[2 * (tokenIndex * traitCount + traitIndex)];
+      double proCount = static_cast<double>(counts[0]);
+      double antiCount = static_cast<double>(counts[1]);
 
       double prob, denom;
       // Prevent a divide by zero error by setting defaults for prob
@@ -1476,31 +1464,17 @@ void nsBayesianFilter::classifyMessage(
       else if (antiCount == 0.0)
         prob = 1.0;
       // not really needed, but just to be sure check the denom as well
-      else if ((denom = proCount * numAntiMessages[traitIndex] +
-                        antiCount * numProMessages[traitIndex]) == 0.0)
+      else if ((denom = proCount * numAntiMessages +
+                        antiCount * numProMessages) == 0.0)
         continue;
       else
-        prob = (proCount * numAntiMessages[traitIndex]) / denom;
+        prob = (proCount * numAntiMessages) / denom;
 
       double n = proCount + antiCount;
       prob = (0.225 + n * prob) / (.45 + n);
       double distance = std::abs(prob - 0.5);
       if (distance >= .1) {
-        mozilla::DebugOnly<nsresult> rv =
-            setAnalysis(token, traitIndex, distance, prob);
-        NS_ASSERTION(NS_SUCCEEDED(rv), "Problem in setAnalysis");
-      }
-    }
-  }
-
-  for (uint32_t traitIndex = 0; traitIndex < traitCount; traitIndex++) {
-    AutoTArray<TraitAnalysis, 1024> traitAnalyses;
-    // copy valid tokens into an array to sort
-    for (uint32_t tokenIndex = 0; tokenIndex < tokenCount; tokenIndex++) {
-      uint32_t storeIndex = getAnalysisIndex(tokens[tokenIndex], traitIndex);
-      if (storeIndex) {
-        TraitAnalysis ta = {tokenIndex, mAnalysisStore[storeIndex].mDistance,
-                            mAnalysisStore[storeIndex].mProbability};
+        TraitAnalysis ta = {tokenIndex, distance, prob};
         traitAnalyses.AppendElement(ta);
       }
     }
@@ -1516,7 +1490,7 @@ void nsBayesianFilter::classifyMessage(
     nsTArray<double> sArray;
     nsTArray<double> hArray;
     uint32_t usedTokenCount = (count > kMaxTokens) ? kMaxTokens : count;
-    if (aDetailListener) {
+    if (aJob.mWantDetails) {
       sArray.SetCapacity(usedTokenCount);
       hArray.SetCapacity(usedTokenCount);
     }
@@ -1543,10 +1517,10 @@ void nsBayesianFilter::classifyMessage(
           Hexp += e;
         }
         MOZ_LOG(BayesianFilterLogModule, LogLevel::Warning,
-                ("token probability (%s) is %f", tokens[ta.mTokenIndex].mWord,
-                 ta.mProbability));
+                ("token probability (%s) is %f",
+                 aJob.mWords[ta.mTokenIndex].get(), ta.mProbability));
       }
-      if (aDetailListener) {
+      if (aJob.mWantDetails) {
         sArray.AppendElement(log(S) + Sexp * M_LN2);
         hArray.AppendElement(log(H) + Hexp * M_LN2);
       }
@@ -1568,11 +1542,14 @@ void nsBayesianFilter::classifyMessage(
     } else
       prob = 0.5;
 
-    if (aDetailListener) {
-      // Prepare output arrays
-      nsTArray<uint32_t> tokenPercents(usedTokenCount);
-      nsTArray<uint32_t> runningPercents(usedTokenCount);
-      nsTArray<char16_t*> tokenStrings(usedTokenCount);
+    score.mProbability = prob;
+    score.mHamScore = H;
+    score.mSpamScore = S;
+
+    if (aJob.mWantDetails) {
+      score.mDetailTokens.SetCapacity(usedTokenCount);
+      score.mTokenPercents.SetCapacity(usedTokenCount);
+      score.mRunningPercents.SetCapacity(usedTokenCount);
 
       double clueCount = 1.0;
       for (uint32_t tokenIndex = 0; tokenIndex < usedTokenCount; tokenIndex++) {
@@ -1587,22 +1564,139 @@ void nsBayesianFilter::classifyMessage(
           runningProb = (S - H + 1.0) / 2.0;
         else
           runningProb = 0.5;
-        runningPercents.AppendElement(
+        score.mRunningPercents.AppendElement(
             static_cast<uint32_t>(runningProb * 100. + .5));
-        tokenPercents.AppendElement(
+        score.mTokenPercents.AppendElement(
             static_cast<uint32_t>(ta.mProbability * 100. + .5));
-        tokenStrings.AppendElement(
-            ToNewUnicode(NS_ConvertUTF8toUTF16(tokens[ta.mTokenIndex].mWord)));
+        score.mDetailTokens.AppendElement(ta.mTokenIndex);
       }
+    }
+  }
+}
+
+void nsBayesianFilter::getTraitIds(const nsTArray<uint32_t>& aTraits,
+                                   nsTArray<nsTArray<uint32_t>>& aTraitIds) {
+  nsresult rv;
+  nsCOMPtr<nsIMsgTraitService> traitService(
+      do_GetService("@mozilla.org/msg-trait-service;1", &rv));
+  if (NS_FAILED(rv)) {
+    NS_ERROR("Failed to get trait service");
+    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+            ("Failed to get trait service"));
+  }
+
+  aTraitIds.Clear();
+  for (uint32_t traitIndex = 0; traitIndex < aTraits.Length(); traitIndex++) {
+    nsTArray<uint32_t>* ids = aTraitIds.AppendElement();
+    ids->AppendElement(aTraits[traitIndex]);
+
+    uint32_t aliasesLength = 0;
+    uint32_t* aliases = nullptr;
+    if (traitService) {
+      rv = traitService->GetAliases(aTraits[traitIndex], &aliasesLength,
+                                    &aliases);
+      if (NS_FAILED(rv)) {
+        NS_ERROR("trait service failed to get aliases");
+        MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+                ("trait service failed to get aliases"));
+      }
+    }
+    if (aliasesLength) {
+      ids->AppendElements(aliases, aliasesLength);
+      // free aliases arrays returned from XPCOM
+      free(aliases);
+    }
+  }
+}
+
+void nsBayesianFilter::gatherEvidence(
+    Tokenizer& aTokenizer, const char* aMessageURI,
+    const nsTArray<nsTArray<uint32_t>>& aProIds,
+    const nsTArray<nsTArray<uint32_t>>& aAntiIds, bool aWantDetails,
+    ClassificationJob& aJob) {
+  uint32_t traitCount = aProIds.Length();
+  aJob.mMessageURI = aMessageURI;
+  aJob.mTraitCount = traitCount;
+  aJob.mWantDetails = aWantDetails;
+  aJob.mGoodMessages = mCorpus.getMessageCount(kGoodTrait);
+  aJob.mJunkMessages = mCorpus.getMessageCount(kJunkTrait);
+
+  // message counts for the pro and anti traits, including their aliases
+  for (uint32_t traitIndex = 0; traitIndex < traitCount; traitIndex++) {
+    uint32_t proMessageCount = 0;
+    for (uint32_t trait : aProIds[traitIndex])
+      proMessageCount += mCorpus.getMessageCount(trait);
+    uint32_t antiMessageCount = 0;
+    for (uint32_t trait : aAntiIds[traitIndex])
+      antiMessageCount += mCorpus.getMessageCount(trait);
+    aJob.mMessageCounts.AppendElement(proMessageCount);
+    aJob.mMessageCounts.AppendElement(antiMessageCount);
+  }
+
+  // Tokens without any counts can't affect the scores, so they are left out.
+  // The rest keep the tokenizer's order, which the scoring depends on.
+  TokenEnumeration tokens = aTokenizer.getTokens();
+  while (tokens.hasMoreTokens()) {
+    Token* token = static_cast<Token*>(tokens.nextToken());
+    CorpusTokenRef t = mCorpus.get(token->mWord);
+    if (!t) continue;
+
+    uint32_t countsIndex = aJob.mTokenCounts.Length();
+    bool hasCount = false;
+    for (uint32_t traitIndex = 0; traitIndex < traitCount; traitIndex++) {
+      uint32_t proCount = 0;
+      for (uint32_t trait : aProIds[traitIndex])
+        proCount += mCorpus.getTraitCount(t, trait);
+      uint32_t antiCount = 0;
+      for (uint32_t trait : aAntiIds[traitIndex])
+        antiCount += mCorpus.getTraitCount(t, trait);
+      aJob.mTokenCounts.AppendElement(proCount);
+      aJob.mTokenCounts.AppendElement(antiCount);
+      hasCount |= proCount || antiCount;
+    }
+    if (!hasCount) {
+      aJob.mTokenCounts.TruncateLength(countsIndex);
+      continue;
+    }
+    aJob.mWords.AppendElement(nsDependentCString(token->mWord));
+  }
+}
+
+void nsBayesianFilter::reportClassification(
+    ClassificationJob& aJob, nsTArray<uint32_t>& aProTraits,
+    nsIJunkMailClassificationListener* listener,
+    nsIMsgTraitClassificationListener* aTraitListener,
+    nsIMsgTraitDetailListener* aDetailListener) {
+  const char* messageURI = aJob.mMessageURI.get();
+  uint32_t traitCount = aJob.mScores.Length();
+
+  // construct the outgoing listener arrays
+  AutoTArray<uint32_t, kTraitAutoCapacity> traits;
+  AutoTArray<uint32_t, kTraitAutoCapacity> percents;
+  if (traitCount > kTraitAutoCapacity) {
+    traits.SetCapacity(traitCount);
+    percents.SetCapacity(traitCount);
+  }
+
+  for (uint32_t traitIndex = 0; traitIndex < traitCount; traitIndex++) {
+    TraitScore& score = aJob.mScores[traitIndex];
+
+    if (aDetailListener) {
+      uint32_t usedTokenCount = score.mDetailTokens.Length();
+      nsTArray<char16_t*> tokenStrings(usedTokenCount);
+      for (uint32_t tokenIndex = 0; tokenIndex < usedTokenCount; tokenIndex++)
+        tokenStrings.AppendElement(ToNewUnicode(NS_ConvertUTF8toUTF16(
+            aJob.mWords[score.mDetailTokens[tokenIndex]])));
 
       aDetailListener->OnMessageTraitDetails(
           messageURI, aProTraits[traitIndex], usedTokenCount,
-          (const char16_t**)tokenStrings.Elements(), tokenPercents.Elements(),
-          runningPercents.Elements());
+          (const char16_t**)tokenStrings.Elements(),
+          score.mTokenPercents.Elements(), score.mRunningPercents.Elements());
       for (uint32_t tokenIndex = 0; tokenIndex < usedTokenCount; tokenIndex++)
         free(tokenStrings[tokenIndex]);
     }
 
+    double prob = score.mProbability;
     uint32_t proPercent = static_cast<uint32_t>(prob * 100. + .5);
 
     // directly classify junk to maintain backwards compatibility
@@ -1610,7 +1704,7 @@ void nsBayesianFilter::classifyMessage(
       bool isJunk = (prob >= mJunkProbabilityThreshold);
       MOZ_LOG(BayesianFilterLogModule, LogLevel::Info,
               ("%s is junk probability = (%f)  HAM SCORE:%f SPAM SCORE:%f",
-               messageURI, prob, H, S));
+               messageURI, prob, score.mHamScore, score.mSpamScore));
 
       // the algorithm in "A Plan For Spam" assumes that you have a large good
       // corpus and a large junk corpus.
@@ -1623,9 +1717,9 @@ void nsBayesianFilter::classifyMessage(
       // this will also "encourage" the user to train
       // see bug #194238
 
-      if (listener && !mCorpus.getMessageCount(kGoodTrait))
+      if (listener && !aJob.mGoodMessages)
         isJunk = true;
-      else if (listener && !mCorpus.getMessageCount(kJunkTrait))
+      else if (listener && !aJob.mJunkMessages)
         isJunk = false;
 
       if (listener)
@@ -1640,48 +1734,55 @@ void nsBayesianFilter::classifyMessage(
       traits.AppendElement(aProTraits[traitIndex]);
       percents.AppendElement(proPercent);
     }
-
-    // free aliases arrays returned from XPCOM
-    if (proAliasesLengths[traitIndex]) free(proAliasArrays[traitIndex]);
-    if (antiAliasesLengths[traitIndex]) free(antiAliasArrays[traitIndex]);
   }
 
   if (aTraitListener)
     aTraitListener->OnMessageTraitsClassified(
         messageURI, traits.Length(), traits.Elements(), percents.Elements());
+}
 
-  delete[] tokens;
-  // reuse mAnalysisStore without clearing memory
-  mNextAnalysisIndex = 1;
-  // but shrink it back to the default size
-  if (mAnalysisStore.Length() > kAnalysisStoreCapacity)
-    mAnalysisStore.RemoveElementsAt(
-        kAnalysisStoreCapacity,
-        mAnalysisStore.Length() - kAnalysisStoreCapacity);
-  mAnalysisStore.Compact();
+nsIThreadPool* nsBayesianFilter::getClassifyPool() {
+  if (!mClassifyPool && mClassifyThreads > 0) {
+    nsresult rv;
+    mClassifyPool = do_CreateInstance("@mozilla.org/thread-pool;1", &rv);
+    if (NS_FAILED(rv)) {
+      NS_WARNING("failed to create the classification thread pool");
+      mClassifyThreads = 0;  // don't try again
+      return nullptr;
+    }
+    mClassifyPool->SetName(NS_LITERAL_CSTRING("BayesianClassify"));
+    mClassifyPool->SetThreadLimit(mClassifyThreads);
+    mClassifyPool->SetIdleThreadLimit(1);
+  }
+  return mClassifyPool;
 }
 
-void nsBayesianFilter::classifyMessage(
-    Tokenizer& tokens, const char* messageURI,
-    nsIJunkMailClassificationListener* aJunkListener) {
-  AutoTArray<uint32_t, 1> proTraits;
-  AutoTArray<uint32_t, 1> antiTraits;
-  proTraits.AppendElement(kJunkTrait);
-  antiTraits.AppendElement(kGoodTrait);
-  classifyMessage(tokens, messageURI, proTraits, antiTraits, aJunkListener,
-                  nullptr, nullptr);
+void nsBayesianFilter::shutdownClassifyPool() {
+  // finish scoring the pending batches, and score any later ones on the main
+  // thread
+  if (mClassifyPool) {
+    mClassifyPool->Shutdown();
+    mClassifyPool = nullptr;
+  }
+  mClassifyThreads = 0;
 }
 
 NS_IMETHODIMP
 nsBayesianFilter::Observe(nsISupports* aSubject, const char* aTopic,
                           const char16_t* someData) {
-  if (!strcmp(aTopic, "profile-before-change")) Shutdown();
+  if (!strcmp(aTopic, "profile-before-change")) {
+    Shutdown();
+    shutdownClassifyPool();
+  }
   return NS_OK;
 }
 
 /* void shutdown (); */
 NS_IMETHODIMP nsBayesianFilter::Shutdown() {
-  if (mTrainingDataDirty) mCorpus.writeTrainingData(mMaximumTokenCount);
+  if (mTrainingDataDirty) {
+    nsresult rv = mCorpus.writeTrainingData(mMaximumTokenCount);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
   mTrainingDataDirty = false;
 
   return NS_OK;
@@ -1725,63 +1826,6 @@ NS_IMETHODIMP nsBayesianFilter::ClassifyMessages(
   return tokenizeMessage(aMsgURLs[0], aMsgWindow, analyzer);
 }
 
-nsresult nsBayesianFilter::setAnalysis(Token& token, uint32_t aTraitIndex,
-                                       double aDistance, double aProbability) {
-  uint32_t nextLink = token.mAnalysisLink;
-  uint32_t lastLink = 0;
-  uint32_t linkCount = 0, maxLinks = 100;
-
-  // try to find an existing element. Limit the search to maxLinks
-  // as a precaution
-  for (linkCount = 0; nextLink && linkCount < maxLinks; linkCount++) {
-    AnalysisPerToken& rAnalysis = mAnalysisStore[nextLink];
-    if (rAnalysis.mTraitIndex == aTraitIndex) {
-      rAnalysis.mDistance = aDistance;
-      rAnalysis.mProbability = aProbability;
-      return NS_OK;
-    }
-    lastLink = nextLink;
-    nextLink = rAnalysis.mNextLink;
-  }
-  if (linkCount >= maxLinks) return NS_ERROR_FAILURE;
-
-  // trait does not exist, so add it
-
-  AnalysisPerToken analysis(aTraitIndex, aDistance, aProbability);
-  if (mAnalysisStore.Length() == mNextAnalysisIndex)
-    mAnalysisStore.InsertElementAt(mNextAnalysisIndex, analysis);
-  else if (mAnalysisStore.Length() > mNextAnalysisIndex)
-    mAnalysisStore.ReplaceElementsAt(mNextAnalysisIndex, 1, analysis);
-  else  // we can only insert at the end of the array
-    return NS_ERROR_FAILURE;
-
-  if (lastLink)
-    // the token had at least one link, so update the last link to point to
-    // the new item
-    mAnalysisStore[lastLink].mNextLink = mNextAnalysisIndex;
-  else
-    // need to update the token's first link
-    token.mAnalysisLink = mNextAnalysisIndex;
-  mNextAnalysisIndex++;
-  return NS_OK;
-}
-
-uint32_t nsBayesianFilter::getAnalysisIndex(Token& token,
-                                            uint32_t aTraitIndex) {
-  uint32_t nextLink;
-  uint32_t linkCount = 0, maxLinks = 100;
-  for (nextLink = token.mAnalysisLink; nextLink && linkCount < maxLinks;
-       linkCount++) {
-    AnalysisPerToken& rAnalysis = mAnalysisStore[nextLink];
-    if (rAnalysis.mTraitIndex == aTraitIndex) return nextLink;
-    nextLink = rAnalysis.mNextLink;
-  }
-  NS_ASSERTION(linkCount < maxLinks, "corrupt analysis store");
-
-  // Trait not found, indicate by zero
-  return 0;
-}
-
 NS_IMETHODIMP nsBayesianFilter::ClassifyTraitsInMessage(
     const char* aMsgURI, uint32_t aTraitCount, uint32_t* aProTraits,
     uint32_t* aAntiTraits, nsIMsgTraitClassificationListener* aTraitListener,
@@ -2042,7 +2086,7 @@ NS_IMETHODIMP
 nsBayesianFilter::GetTokenCount(const nsACString& aWord, uint32_t aTrait,
                                 uint32_t* aCount) {
   NS_ENSURE_ARG_POINTER(aCount);
-  CorpusToken* t = mCorpus.get(PromiseFlatCString(aWord).get());
+  CorpusTokenRef t = mCorpus.get(PromiseFlatCString(aWord).get());
   uint32_t count = mCorpus.getTraitCount(t, aTrait);
   *aCount = count;
   return NS_OK;
@@ -2069,13 +2113,207 @@ nsBayesianFilter::GetTokenCount(const nsACString& aWord, uint32_t aTrait,
       for each token with non-zero count
         [count]
         [length of word]word
+
+    Format of the corpus file (corpus.dat) for version 2, which holds all
+    traits. Numbers are 32 bit big endian, and the file is used in place
+    through a memory mapping. It replaces the version 1 files, which are
+    read once if it doesn't exist yet and not written any more:
+    [0xFEEDFACF]
+    [version = 2][number of traits][number of tokens][bucket bits B][0]
+    for each trait
+      [id of trait][number of messages per trait]
+    for each of the 2^B buckets, and once more for the end of the table
+      [index of the first token whose (hash >> (32 - B)) >= bucket]
+    for each token, sorted by hash and then word
+      [hash of word][offset of word][length of word]
+    for each token
+      [count for first trait]...[count for last trait]
+    for each token
+      word, NUL terminated
 */
 
+static const char kCorpusCookie[] = {'\xFE', '\xED', '\xFA', '\xCF'};
+static const uint32_t kCorpusVersion = 2;
+static const uint32_t kCorpusHeaderSize = 24;
+static const uint32_t kCorpusTraitSize = 8;
+static const uint32_t kCorpusTokenSize = 12;
+// limits that keep the section offsets of a corrupt file in range
+static const uint32_t kCorpusMaxTraits = 1024;
+static const uint32_t kCorpusMaxBucketBits = 24;
+
+CorpusFile::CorpusFile()
+    : mFD(nullptr),
+      mMap(nullptr),
+      mData(nullptr),
+      mSize(0),
+      mTraitCount(0),
+      mTokenCount(0),
+      mBucketBits(0),
+      mDirectoryOffset(0),
+      mTokensOffset(0),
+      mCountsOffset(0),
+      mWordsOffset(0) {}
+
+CorpusFile::~CorpusFile() { Close(); }
+
+nsresult CorpusFile::Open(nsIFile* aFile) {
+  NS_ENSURE_ARG_POINTER(aFile);
+  Close();
+
+  int64_t fileSize;
+  nsresult rv = aFile->GetFileSize(&fileSize);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (fileSize < kCorpusHeaderSize || fileSize > UINT32_MAX)
+    return NS_ERROR_FILE_CORRUPTED;
+
+  rv = aFile->OpenNSPRFileDesc(PR_RDONLY, 0, &mFD);
+  NS_ENSURE_SUCCESS(rv, rv);
+  mMap = PR_CreateFileMap(mFD, fileSize, PR_PROT_READONLY);
+  if (mMap)
+    mData = static_cast<const uint8_t*>(PR_MemMap(mMap, 0, fileSize));
+  if (!mData) {
+    Close();
+    return NS_ERROR_FAILURE;
+  }
+  mSize = static_cast<uint32_t>(fileSize);
+
+  if (memcmp(mData, kCorpusCookie, sizeof(kCorpusCookie)) ||
+      ReadUInt32(4) != kCorpusVersion) {
+    Close();
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+  mTraitCount = ReadUInt32(8);
+  mTokenCount = ReadUInt32(12);
+  mBucketBits = ReadUInt32(16);
+  if (mTraitCount > kCorpusMaxTraits || mBucketBits > kCorpusMaxBucketBits) {
+    Close();
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+
+  uint64_t offset =
+      kCorpusHeaderSize + uint64_t(mTraitCount) * kCorpusTraitSize;
+  mDirectoryOffset = static_cast<uint32_t>(offset);
+  offset += ((uint64_t(1) << mBucketBits) + 1) * sizeof(uint32_t);
+  if (offset <= mSize) {
+    mTokensOffset = static_cast<uint32_t>(offset);
+    offset += uint64_t(mTokenCount) * kCorpusTokenSize;
+  }
+  if (offset <= mSize) {
+    mCountsOffset = static_cast<uint32_t>(offset);
+    offset += uint64_t(mTokenCount) * mTraitCount * sizeof(uint32_t);
+  }
+  if (offset > mSize) {
+    Close();
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+  mWordsOffset = static_cast<uint32_t>(offset);
+
+  MOZ_LOG(BayesianFilterLogModule, LogLevel::Debug,
+          ("mapped training data: %u tokens, %u traits", mTokenCount,
+           mTraitCount));
+  return NS_OK;
+}
+
+void CorpusFile::Close() {
+  if (mData) PR_MemUnmap(const_cast<uint8_t*>(mData), mSize);
+  if (mMap) PR_CloseFileMap(mMap);
+  if (mFD) PR_Close(mFD);
+  mFD = nullptr;
+  mMap = nullptr;
+  mData = nullptr;
+  mSize = 0;
+  mTraitCount = 0;
+  mTokenCount = 0;
+  mBucketBits = 0;
+}
+
+inline uint32_t CorpusFile::ReadUInt32(uint32_t aOffset) const {
+  return mozilla::BigEndian::readUint32(mData + aOffset);
+}
+
+uint32_t CorpusFile::TraitId(uint32_t aColumn) const {
+  if (aColumn >= mTraitCount) return 0;
+  return ReadUInt32(kCorpusHeaderSize + aColumn * kCorpusTraitSize);
+}
+
+uint32_t CorpusFile::MessageCount(uint32_t aColumn) const {
+  if (aColumn >= mTraitCount) return 0;
+  return ReadUInt32(kCorpusHeaderSize + aColumn * kCorpusTraitSize + 4);
+}
+
+uint32_t CorpusFile::Column(uint32_t aTraitId) const {
+  for (uint32_t column = 0; column < mTraitCount; column++) {
+    if (TraitId(column) == aTraitId) return column;
+  }
+  return kNotFound;
+}
+
+uint32_t CorpusFile::Hash(const char* aWord, uint32_t aLength) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < aLength; i++) {
+    hash ^= static_cast<uint8_t>(aWord[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+inline uint32_t CorpusFile::Hash(uint32_t aIndex) const {
+  return ReadUInt32(mTokensOffset + aIndex * kCorpusTokenSize);
+}
+
+uint32_t CorpusFile::Find(const char* aWord, uint32_t aLength) const {
+  if (!mTokenCount) return kNotFound;
+
+  uint32_t hash = Hash(aWord, aLength);
+  uint32_t bucket = mBucketBits ? hash >> (32 - mBucketBits) : 0;
+  uint32_t low = std::min(ReadUInt32(mDirectoryOffset + bucket * 4),
+                          mTokenCount);
+  uint32_t high = std::min(ReadUInt32(mDirectoryOffset + bucket * 4 + 4),
+                           mTokenCount);
+
+  // find the first token in the bucket with this hash
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (Hash(middle) < hash)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  for (; low < mTokenCount && Hash(low) == hash; low++) {
+    uint32_t length = ReadUInt32(mTokensOffset + low * kCorpusTokenSize + 8);
+    if (length != aLength) continue;
+    const char* word = Word(low);
+    if (word && !memcmp(word, aWord, aLength)) return low;
+  }
+  return kNotFound;
+}
+
+const char* CorpusFile::Word(uint32_t aIndex) const {
+  if (aIndex >= mTokenCount) return nullptr;
+  uint32_t entry = mTokensOffset + aIndex * kCorpusTokenSize;
+  uint32_t offset = ReadUInt32(entry + 4);
+  uint32_t length = ReadUInt32(entry + 8);
+  uint32_t wordsSize = mSize - mWordsOffset;
+  if (offset >= wordsSize || length >= wordsSize - offset) return nullptr;
+  const char* word =
+      reinterpret_cast<const char*>(mData + mWordsOffset + offset);
+  return word[length] ? nullptr : word;
+}
+
+uint32_t CorpusFile::Count(uint32_t aIndex, uint32_t aColumn) const {
+  if (aIndex >= mTokenCount || aColumn >= mTraitCount) return 0;
+  return ReadUInt32(mCountsOffset +
+                    (aIndex * mTraitCount + aColumn) * sizeof(uint32_t));
+}
+
 CorpusStore::CorpusStore()
     : TokenHash(sizeof(CorpusToken)),
-      mNextTraitIndex(1)  // skip 0 since index=0 will mean end of linked list
-{
+      mNextTraitIndex(1),  // skip 0 since index=0 will mean end of linked list
+      mSupersededCount(0),
+      mClearedTokenCount(0) {
   getTrainingFile(getter_AddRefs(mTrainingFile));
+  getCorpusFile(getter_AddRefs(mCorpusFile));
   mTraitStore.SetCapacity(kTraitStoreCapacity);
   TraitPerToken traitPT(0, 0);
   mTraitStore.AppendElement(traitPT);  // dummy 0th element
@@ -2083,11 +2321,6 @@ CorpusStore::CorpusStore()
 
 CorpusStore::~CorpusStore() {}
 
-inline int writeUInt32(FILE* stream, uint32_t value) {
-  value = PR_htonl(value);
-  return fwrite(&value, sizeof(uint32_t), 1, stream);
-}
-
 inline int readUInt32(FILE* stream, uint32_t* value) {
   int n = fread(value, sizeof(uint32_t), 1, stream);
   if (n == 1) {
@@ -2096,6 +2329,53 @@ inline int readUInt32(FILE* stream, uint32_t* value) {
   return n;
 }
 
+namespace {
+
+// Buffers big endian numbers and bytes, so that the training file is written
+// in large blocks rather than a few bytes at a time.
+class CorpusWriter {
+ public:
+  explicit CorpusWriter(FILE* aStream) : mStream(aStream), mError(false) {
+    mBuffer.SetCapacity(kBlockSize);
+  }
+
+  void WriteUInt32(uint32_t aValue) {
+    uint8_t bytes[sizeof(uint32_t)];
+    mozilla::BigEndian::writeUint32(bytes, aValue);
+    Write(bytes, sizeof(bytes));
+  }
+
+  void Write(const void* aData, uint32_t aLength) {
+    mBuffer.AppendElements(static_cast<const uint8_t*>(aData), aLength);
+    if (mBuffer.Length() >= kBlockSize) Flush();
+  }
+
+  // @return false if any write failed
+  bool Flush() {
+    if (!mError && !mBuffer.IsEmpty() &&
+        fwrite(mBuffer.Elements(), mBuffer.Length(), 1, mStream) != 1)
+      mError = true;
+    mBuffer.Clear();
+    return !mError;
+  }
+
+ private:
+  static const uint32_t kBlockSize = 65536;
+  FILE* mStream;
+  nsTArray<uint8_t> mBuffer;
+  bool mError;
+};
+
+}  // namespace
+
+// a token to be written to the training files
+struct CorpusWriteToken {
+  uint32_t mHash;
+  uint32_t mLength;
+  const char* mWord;
+  uint32_t mCountsIndex;  // index of the first of the token's trait counts
+};
+
 void CorpusStore::forgetTokens(Tokenizer& aTokenizer, uint32_t aTraitId,
                                uint32_t aCount) {
   // if we are forgetting the tokens for a message, should only
@@ -2122,40 +2402,6 @@ void CorpusStore::rememberTokens(Tokenizer& aTokenizer, uint32_t aTraitId,
   }
 }
 
-bool CorpusStore::writeTokens(FILE* stream, bool shrink, uint32_t aTraitId) {
-  uint32_t tokenCount = countTokens();
-  uint32_t newTokenCount = 0;
-
-  // calculate the tokens for this trait to write
-
-  TokenEnumeration tokens = getTokens();
-  for (uint32_t i = 0; i < tokenCount; ++i) {
-    CorpusToken* token = static_cast<CorpusToken*>(tokens.nextToken());
-    uint32_t count = getTraitCount(token, aTraitId);
-    // Shrinking the token database is accomplished by dividing all token counts
-    // by 2. If shrinking, we'll ignore counts < 2, otherwise only ignore counts
-    // of < 1
-    if ((shrink && count > 1) || (!shrink && count)) newTokenCount++;
-  }
-
-  if (writeUInt32(stream, newTokenCount) != 1) return false;
-
-  if (newTokenCount > 0) {
-    TokenEnumeration tokens = getTokens();
-    for (uint32_t i = 0; i < tokenCount; ++i) {
-      CorpusToken* token = static_cast<CorpusToken*>(tokens.nextToken());
-      uint32_t wordCount = getTraitCount(token, aTraitId);
-      if (shrink) wordCount /= 2;
-      if (!wordCount) continue;  // Don't output zero count words
-      if (writeUInt32(stream, wordCount) != 1) return false;
-      uint32_t tokenLength = strlen(token->mWord);
-      if (writeUInt32(stream, tokenLength) != 1) return false;
-      if (fwrite(token->mWord, tokenLength, 1, stream) != 1) return false;
-    }
-  }
-  return true;
-}
-
 bool CorpusStore::readTokens(FILE* stream, int64_t fileSize, uint32_t aTraitId,
                              bool aIsAdd) {
   uint32_t tokenCount;
@@ -2228,25 +2474,28 @@ nsresult CorpusStore::getTraitFile(nsIFile** aTraitFile) {
   return profileDir->QueryInterface(NS_GET_IID(nsIFile), (void**)aTraitFile);
 }
 
+nsresult CorpusStore::getCorpusFile(nsIFile** aCorpusFile) {
+  nsCOMPtr<nsIFile> profileDir;
+  nsresult rv = NS_GetSpecialDirectory(NS_APP_USER_PROFILE_50_DIR,
+                                       getter_AddRefs(profileDir));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = profileDir->Append(NS_LITERAL_STRING("corpus.dat"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  profileDir.forget(aCorpusFile);
+  return NS_OK;
+}
+
 static const char kMagicCookie[] = {'\xFE', '\xED', '\xFA', '\xCE'};
 
 // random string used to identify trait file and version (last byte is version)
 static const char kTraitCookie[] = {'\xFC', '\xA9', '\x36', '\x01'};
 
-void CorpusStore::writeTrainingData(uint32_t aMaximumTokenCount) {
+nsresult CorpusStore::writeTrainingData(uint32_t aMaximumTokenCount) {
   MOZ_LOG(BayesianFilterLogModule, LogLevel::Debug,
           ("writeTrainingData() entered"));
-  if (!mTrainingFile) return;
-
-  /*
-   * For backwards compatibility, write the good and junk tokens to
-   * training.dat; additional traits are added to a different file
-   */
-
-  // open the file, and write out training data
-  FILE* stream;
-  nsresult rv = mTrainingFile->OpenANSIFileDesc("wb", &stream);
-  if (NS_FAILED(rv)) return;
+  if (!mCorpusFile) return NS_ERROR_NOT_INITIALIZED;
 
   // If the number of tokens exceeds our limit, set the shrink flag
   bool shrink = false;
@@ -2257,106 +2506,255 @@ void CorpusStore::writeTrainingData(uint32_t aMaximumTokenCount) {
             ("shrinking token data file"));
   }
 
-  // We implement shrink by dividing counts by two
-  uint32_t shrinkFactor = shrink ? 2 : 1;
+  nsTArray<CorpusWriteToken> tokens;
+  nsTArray<uint32_t> counts;
+  collectTokens(shrink, tokens, counts);
 
-  if (!((fwrite(kMagicCookie, sizeof(kMagicCookie), 1, stream) == 1) &&
-        (writeUInt32(stream, getMessageCount(kGoodTrait) / shrinkFactor)) &&
-        (writeUInt32(stream, getMessageCount(kJunkTrait) / shrinkFactor)) &&
-        writeTokens(stream, shrink, kGoodTrait) &&
-        writeTokens(stream, shrink, kJunkTrait))) {
-    NS_WARNING("failed to write training data.");
-    fclose(stream);
-    // delete the training data file, since it is potentially corrupt.
-    mTrainingFile->Remove(false);
-  } else {
-    fclose(stream);
+  // The unchanged tokens are read from the mapped corpus file while the new
+  // one is written, so write to a temporary file and then replace it.
+  nsCOMPtr<nsIFile> tempFile;
+  nsresult rv = mCorpusFile->Clone(getter_AddRefs(tempFile));
+  if (NS_SUCCEEDED(rv))
+    rv = tempFile->SetLeafName(NS_LITERAL_STRING("corpus.dat.tmp"));
+  FILE* stream = nullptr;
+  if (NS_SUCCEEDED(rv)) rv = tempFile->OpenANSIFileDesc("wb", &stream);
+  if (NS_FAILED(rv)) {
+    NS_WARNING("failed to create training data file.");
+    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+            ("failed to create training data file: 0x%08x",
+             static_cast<uint32_t>(rv)));
+    return rv;
   }
 
-  /*
-   * Write the remaining data to a second file traits.dat
-   */
-
-  if (!mTraitFile) {
-    getTraitFile(getter_AddRefs(mTraitFile));
-    if (!mTraitFile) return;
+  bool written = writeCorpusFile(stream, tokens, counts, shrink ? 2 : 1);
+  if (fclose(stream)) written = false;
+  if (!written) {
+    NS_WARNING("failed to write training data.");
+    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+            ("failed to write training data."));
+    tempFile->Remove(false);
+    return NS_ERROR_FILE_DISK_FULL;
   }
 
-  // open the file, and write out training data
-  rv = mTraitFile->OpenANSIFileDesc("wb", &stream);
-  if (NS_FAILED(rv)) return;
+  // the old file can't be replaced while it is mapped on some platforms
+  mFile.Close();
+  nsAutoString leafName;
+  mCorpusFile->GetLeafName(leafName);
+  rv = tempFile->MoveTo(nullptr, leafName);
+  if (NS_FAILED(rv)) {
+    NS_WARNING("failed to replace training data.");
+    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+            ("failed to replace training data: 0x%08x",
+             static_cast<uint32_t>(rv)));
+    tempFile->Remove(false);
+    // carry on with the old file and the unwritten changes
+    mFile.Open(mCorpusFile);
+    return rv;
+  }
 
-  uint32_t numberOfTraits = mMessageCounts.Length();
-  bool error;
-  while (1)  // break on error or done
-  {
-    if ((error = (fwrite(kTraitCookie, sizeof(kTraitCookie), 1, stream) != 1)))
-      break;
+  // The new file has all of the counts, so start over with an empty delta.
+  clearDelta();
+  readTrainingData();
+  return NS_OK;
+}
 
-    for (uint32_t index = 0; index < numberOfTraits; index++) {
-      uint32_t trait = mMessageCountsId[index];
-      if (trait == 1 || trait == 2)
-        continue;  // junk traits are stored in training.dat
-      if ((error = (writeUInt32(stream, trait) != 1))) break;
-      if ((error = (writeUInt32(stream, mMessageCounts[index] / shrinkFactor) !=
-                    1)))
-        break;
-      if ((error = !writeTokens(stream, shrink, trait))) break;
+void CorpusStore::collectTokens(bool shrink,
+                                nsTArray<CorpusWriteToken>& aTokens,
+                                nsTArray<uint32_t>& aCounts) {
+  // We implement shrink by dividing counts by two
+  uint32_t shrinkFactor = shrink ? 2 : 1;
+  uint32_t traitCount = mMessageCountsId.Length();
+
+  AutoTArray<uint32_t, kTraitAutoCapacity> fileColumns;
+  for (uint32_t index = 0; index < traitCount; index++) {
+    uint32_t trait = mMessageCountsId[index];
+    fileColumns.AppendElement(mClearedFileTraits.Contains(trait)
+                                  ? CorpusFile::kNotFound
+                                  : mFile.Column(trait));
+  }
+
+  aTokens.SetCapacity(countTokens());
+
+  // Appends a token with its shrunk counts, unless they are all zero.
+  auto appendToken = [&](const char* aWord, auto aGetCount) {
+    uint32_t countsIndex = aCounts.Length();
+    bool hasCount = false;
+    for (uint32_t index = 0; index < traitCount; index++) {
+      uint32_t count = aGetCount(index) / shrinkFactor;
+      hasCount |= count != 0;
+      aCounts.AppendElement(count);
     }
-    break;
+    if (!hasCount) {
+      aCounts.TruncateLength(countsIndex);
+      return;
+    }
+    uint32_t length = strlen(aWord);
+    CorpusWriteToken token = {CorpusFile::Hash(aWord, length), length, aWord,
+                              countsIndex};
+    aTokens.AppendElement(token);
+  };
+
+  // tokens from the file that have not changed
+  uint32_t fileTokenCount = mFile.IsOpen() ? mFile.TokenCount() : 0;
+  for (uint32_t fileIndex = 0; fileIndex < fileTokenCount; fileIndex++) {
+    if (mSuperseded[fileIndex / 32] & (1u << (fileIndex % 32))) continue;
+    const char* word = mFile.Word(fileIndex);
+    if (!word || !*word) continue;
+    appendToken(word, [&](uint32_t aIndex) {
+      return mFile.Count(fileIndex, fileColumns[aIndex]);
+    });
+  }
+
+  // new and changed tokens
+  TokenEnumeration delta = getTokens();
+  while (delta.hasMoreTokens()) {
+    CorpusToken* token = static_cast<CorpusToken*>(delta.nextToken());
+    appendToken(token->mWord, [&](uint32_t aIndex) {
+      return getDeltaTraitCount(token, mMessageCountsId[aIndex]);
+    });
+  }
+
+  std::sort(aTokens.begin(), aTokens.end(),
+            [](const CorpusWriteToken& a, const CorpusWriteToken& b) {
+              if (a.mHash != b.mHash) return a.mHash < b.mHash;
+              return strcmp(a.mWord, b.mWord) < 0;
+            });
+}
+
+bool CorpusStore::writeCorpusFile(FILE* stream,
+                                  const nsTArray<CorpusWriteToken>& aTokens,
+                                  const nsTArray<uint32_t>& aCounts,
+                                  uint32_t aShrinkFactor) {
+  uint32_t traitCount = mMessageCountsId.Length();
+
+  // aim for one or two tokens per bucket
+  uint32_t tokenCount = aTokens.Length();
+  uint32_t bucketBits = 0;
+  while (bucketBits < kCorpusMaxBucketBits &&
+         (uint64_t(2) << bucketBits) < tokenCount)
+    bucketBits++;
+
+  CorpusWriter writer(stream);
+  writer.Write(kCorpusCookie, sizeof(kCorpusCookie));
+  writer.WriteUInt32(kCorpusVersion);
+  writer.WriteUInt32(traitCount);
+  writer.WriteUInt32(tokenCount);
+  writer.WriteUInt32(bucketBits);
+  writer.WriteUInt32(0);
+
+  for (uint32_t index = 0; index < traitCount; index++) {
+    writer.WriteUInt32(mMessageCountsId[index]);
+    writer.WriteUInt32(mMessageCounts[index] / aShrinkFactor);
+  }
+
+  uint32_t tokenIndex = 0;
+  for (uint64_t bucket = 0; bucket <= (uint64_t(1) << bucketBits); bucket++) {
+    while (tokenIndex < tokenCount &&
+           (bucketBits ? aTokens[tokenIndex].mHash >> (32 - bucketBits) : 0) <
+               bucket)
+      tokenIndex++;
+    writer.WriteUInt32(tokenIndex);
+  }
+
+  uint32_t wordOffset = 0;
+  for (const CorpusWriteToken& token : aTokens) {
+    writer.WriteUInt32(token.mHash);
+    writer.WriteUInt32(wordOffset);
+    writer.WriteUInt32(token.mLength);
+    wordOffset += token.mLength + 1;
+  }
+
+  for (const CorpusWriteToken& token : aTokens) {
+    for (uint32_t index = 0; index < traitCount; index++)
+      writer.WriteUInt32(aCounts[token.mCountsIndex + index]);
+  }
+
+  // the words are written with their NUL terminators
+  for (const CorpusWriteToken& token : aTokens)
+    writer.Write(token.mWord, token.mLength + 1);
+
+  return writer.Flush();
+}
+
+bool CorpusStore::readTrainingData() {
+  // The corpus file holds all of the training once it has been written. Its
+  // header says which version it is, and CorpusFile::Open rejects any other.
+  bool exists;
+  nsresult rv;
+  if (mCorpusFile && NS_SUCCEEDED(mCorpusFile->Exists(&exists)) && exists) {
+    rv = mFile.Open(mCorpusFile);
+    if (NS_SUCCEEDED(rv)) {
+      mSuperseded.Clear();
+      mSuperseded.InsertElementsAt(0, (mFile.TokenCount() + 31) / 32, 0u);
+      mSupersededCount = 0;
+      mClearedTokenCount = 0;
+      for (uint32_t column = 0; column < mFile.TraitCount(); column++)
+        setMessageCount(mFile.TraitId(column), mFile.MessageCount(column));
+      return false;
+    }
+    NS_WARNING("failed to read training data.");
+    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+            ("failed to map training data: 0x%08x",
+             static_cast<uint32_t>(rv)));
   }
-  // we add a 0 at the end to represent end of trait list
-  error = writeUInt32(stream, 0) != 1;
 
-  fclose(stream);
-  if (error) {
-    NS_WARNING("failed to write trait data.");
-    // delete the trait data file, since it is probably corrupt.
-    mTraitFile->Remove(false);
+  // Without a corpus file, migrate the training of the version 1 files into
+  // the delta, once. The corpus file is written on the next flush, and the
+  // version 1 files are left as they are for older builds.
+  if (!mTrainingFile) return false;
+  if (!mTraitFile) getTraitFile(getter_AddRefs(mTraitFile));
+
+  bool migrated = false;
+  rv = mTrainingFile->Exists(&exists);
+  if (NS_SUCCEEDED(rv) && exists) {
+    readLegacyTrainingData();
+    migrated = true;
   }
 
-  if (shrink) {
-    // We'll clear the tokens, and read them back in from the file.
-    // Yes this is slower than in place, but this is a rare event.
+  /*
+   * Additional traits are stored in traits.dat
+   */
+  if (!mTraitFile) return migrated;
 
-    if (countTokens()) {
-      clearTokens();
-      for (uint32_t index = 0; index < numberOfTraits; index++)
-        mMessageCounts[index] = 0;
-    }
+  rv = mTraitFile->Exists(&exists);
+  if (NS_FAILED(rv) || !exists) return migrated;
 
-    readTrainingData();
+  rv = UpdateData(mTraitFile, true, 0, nullptr, nullptr);
+
+  if (NS_FAILED(rv)) {
+    NS_WARNING("failed to read training data.");
+    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
+            ("failed to read training data."));
   }
+  return true;
 }
 
-void CorpusStore::readTrainingData() {
+bool CorpusStore::readLegacyTrainingData() {
   /*
    * To maintain backwards compatibility, good and junk traits
    * are stored in a file "training.dat"
    */
-  if (!mTrainingFile) return;
-
-  bool exists;
-  nsresult rv = mTrainingFile->Exists(&exists);
-  if (NS_FAILED(rv) || !exists) return;
-
   FILE* stream;
-  rv = mTrainingFile->OpenANSIFileDesc("rb", &stream);
-  if (NS_FAILED(rv)) return;
+  nsresult rv = mTrainingFile->OpenANSIFileDesc("rb", &stream);
+  if (NS_FAILED(rv)) return false;
 
   int64_t fileSize;
   rv = mTrainingFile->GetFileSize(&fileSize);
-  if (NS_FAILED(rv)) return;
+  if (NS_FAILED(rv)) {
+    fclose(stream);
+    return false;
+  }
 
   // FIXME:  should make sure that the tokenizers are empty.
   char cookie[4];
   uint32_t goodMessageCount = 0, junkMessageCount = 0;
-  if (!((fread(cookie, sizeof(cookie), 1, stream) == 1) &&
-        (memcmp(cookie, kMagicCookie, sizeof(cookie)) == 0) &&
-        (readUInt32(stream, &goodMessageCount) == 1) &&
-        (readUInt32(stream, &junkMessageCount) == 1) &&
-        readTokens(stream, fileSize, kGoodTrait, true) &&
-        readTokens(stream, fileSize, kJunkTrait, true))) {
+  bool read = (fread(cookie, sizeof(cookie), 1, stream) == 1) &&
+              (memcmp(cookie, kMagicCookie, sizeof(cookie)) == 0) &&
+              (readUInt32(stream, &goodMessageCount) == 1) &&
+              (readUInt32(stream, &junkMessageCount) == 1) &&
+              readTokens(stream, fileSize, kGoodTrait, true) &&
+              readTokens(stream, fileSize, kJunkTrait, true);
+  if (!read) {
     NS_WARNING("failed to read training data.");
     MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
             ("failed to read training data."));
@@ -2365,43 +2763,56 @@ void CorpusStore::readTrainingData() {
   setMessageCount(kJunkTrait, junkMessageCount);
 
   fclose(stream);
+  return read;
+}
 
-  /*
-   * Additional traits are stored in traits.dat
-   */
-
-  if (!mTraitFile) {
-    getTraitFile(getter_AddRefs(mTraitFile));
-    if (!mTraitFile) return;
-  }
-
-  rv = mTraitFile->Exists(&exists);
-  if (NS_FAILED(rv) || !exists) return;
-
-  rv = UpdateData(mTraitFile, true, 0, nullptr, nullptr);
+nsresult CorpusStore::resetTrainingData() {
+  // clear out our in memory training tokens, and unmap the file...
+  clearDelta();
 
-  if (NS_FAILED(rv)) {
-    NS_WARNING("failed to read training data.");
-    MOZ_LOG(BayesianFilterLogModule, LogLevel::Error,
-            ("failed to read training data."));
-  }
-  return;
+  if (mCorpusFile) mCorpusFile->Remove(false);
+  if (mTrainingFile) mTrainingFile->Remove(false);
+  if (mTraitFile) mTraitFile->Remove(false);
+  return NS_OK;
 }
 
-nsresult CorpusStore::resetTrainingData() {
-  // clear out our in memory training tokens...
-  if (countTokens()) clearTokens();
+void CorpusStore::clearDelta() {
+  mFile.Close();
+  mSuperseded.Clear();
+  mSupersededCount = 0;
+  mClearedFileTraits.Clear();
+  mClearedTokenCount = 0;
+
+  if (TokenHash::countTokens()) clearTokens();
+  mTraitStore.TruncateLength(1);  // keep the dummy 0th element
+  mNextTraitIndex = 1;
 
   uint32_t length = mMessageCounts.Length();
   for (uint32_t index = 0; index < length; index++) mMessageCounts[index] = 0;
+}
 
-  if (mTrainingFile) mTrainingFile->Remove(false);
-  if (mTraitFile) mTraitFile->Remove(false);
-  return NS_OK;
+CorpusTokenRef CorpusStore::get(const char* word) {
+  CorpusTokenRef token = {static_cast<CorpusToken*>(TokenHash::get(word)),
+                          CorpusFile::kNotFound};
+  // a token in the delta has all of its counts, so only look in the file
+  // for tokens that have not changed
+  if (!token.mDelta && mFile.IsOpen())
+    token.mFileIndex = mFile.Find(word, strlen(word));
+  return token;
+}
+
+uint32_t CorpusStore::countTokens() {
+  return mFile.TokenCount() - mSupersededCount - mClearedTokenCount +
+         TokenHash::countTokens();
 }
 
-inline CorpusToken* CorpusStore::get(const char* word) {
-  return static_cast<CorpusToken*>(TokenHash::get(word));
+bool CorpusStore::isFileTokenCleared(uint32_t aFileIndex) {
+  for (uint32_t column = 0; column < mFile.TraitCount(); column++) {
+    if (mFile.Count(aFileIndex, column) &&
+        !mClearedFileTraits.Contains(mFile.TraitId(column)))
+      return false;
+  }
+  return true;
 }
 
 nsresult CorpusStore::updateTrait(CorpusToken* token, uint32_t aTraitId,
@@ -2450,7 +2861,24 @@ nsresult CorpusStore::updateTrait(CorpusToken* token, uint32_t aTraitId,
   return NS_OK;
 }
 
-uint32_t CorpusStore::getTraitCount(CorpusToken* token, uint32_t aTraitId) {
+uint32_t CorpusStore::getTraitCount(const CorpusTokenRef& token,
+                                    uint32_t aTraitId) {
+  if (token.mDelta) return getDeltaTraitCount(token.mDelta, aTraitId);
+  if (token.mFileIndex != CorpusFile::kNotFound)
+    return getFileTraitCount(token.mFileIndex, aTraitId);
+  return 0;
+}
+
+uint32_t CorpusStore::getFileTraitCount(uint32_t aFileIndex,
+                                        uint32_t aTraitId) {
+  if (mClearedFileTraits.Contains(aTraitId)) return 0;
+  uint32_t column = mFile.Column(aTraitId);
+  if (column == CorpusFile::kNotFound) return 0;
+  return mFile.Count(aFileIndex, column);
+}
+
+uint32_t CorpusStore::getDeltaTraitCount(CorpusToken* token,
+                                         uint32_t aTraitId) {
   uint32_t nextLink;
   if (!token || !(nextLink = token->mTraitLink)) return 0;
 
@@ -2468,7 +2896,8 @@ uint32_t CorpusStore::getTraitCount(CorpusToken* token, uint32_t aTraitId) {
 
 CorpusToken* CorpusStore::add(const char* word, uint32_t aTraitId,
                               uint32_t aCount) {
-  CorpusToken* token = static_cast<CorpusToken*>(TokenHash::add(word));
+  CorpusTokenRef ref = get(word);
+  CorpusToken* token = ref.mDelta ? ref.mDelta : addDelta(word, ref.mFileIndex);
   if (token) {
     MOZ_LOG(BayesianFilterLogModule, LogLevel::Debug,
             ("adding word to corpus store: %s (Trait=%d) (deltaCount=%d)", word,
@@ -2478,10 +2907,31 @@ CorpusToken* CorpusStore::add(const char* word, uint32_t aTraitId,
   return token;
 }
 
+CorpusToken* CorpusStore::addDelta(const char* word, uint32_t aFileIndex) {
+  CorpusToken* token = static_cast<CorpusToken*>(TokenHash::add(word));
+  if (!token || aFileIndex == CorpusFile::kNotFound) return token;
+
+  // copy the counts, so that the file version of the token can be ignored
+  token->mFileLink = aFileIndex + 1;
+  if (!mClearedFileTraits.IsEmpty() && isFileTokenCleared(aFileIndex))
+    mClearedTokenCount--;
+  mSuperseded[aFileIndex / 32] |= 1u << (aFileIndex % 32);
+  mSupersededCount++;
+  for (uint32_t column = 0; column < mFile.TraitCount(); column++) {
+    uint32_t trait = mFile.TraitId(column);
+    uint32_t count = mFile.Count(aFileIndex, column);
+    if (count && !mClearedFileTraits.Contains(trait))
+      updateTrait(token, trait, count);
+  }
+  return token;
+}
+
 void CorpusStore::remove(const char* word, uint32_t aTraitId, uint32_t aCount) {
   MOZ_LOG(BayesianFilterLogModule, LogLevel::Debug,
           ("remove word: %s (TraitId=%d) (Count=%d)", word, aTraitId, aCount));
-  CorpusToken* token = get(word);
+  CorpusTokenRef ref = get(word);
+  if (!ref) return;
+  CorpusToken* token = ref.mDelta ? ref.mDelta : addDelta(word, ref.mFileIndex);
   if (token) updateTrait(token, aTraitId, -static_cast<int32_t>(aCount));
 }
 
@@ -2561,10 +3011,22 @@ nsresult CorpusStore::ClearTrait(uint32_t aTrait) {
   // clear message counts
   setMessageCount(aTrait, 0);
 
+  // ignore the counts in the file, which are dropped when it is next written
+  if (mFile.IsOpen() && !mClearedFileTraits.Contains(aTrait)) {
+    mClearedFileTraits.AppendElement(aTrait);
+    // tokens left without any counts are no longer in the corpus
+    mClearedTokenCount = 0;
+    for (uint32_t fileIndex = 0; fileIndex < mFile.TokenCount(); fileIndex++) {
+      if (!(mSuperseded[fileIndex / 32] & (1u << (fileIndex % 32))) &&
+          isFileTokenCleared(fileIndex))
+        mClearedTokenCount++;
+    }
+  }
+
   TokenEnumeration tokens = getTokens();
   while (tokens.hasMoreTokens()) {
     CorpusToken* token = static_cast<CorpusToken*>(tokens.nextToken());
-    int32_t wordCount = static_cast<int32_t>(getTraitCount(token, aTrait));
+    int32_t wordCount = static_cast<int32_t>(getDeltaTraitCount(token, aTrait));
     updateTrait(token, aTrait, -wordCount);
   }
   return NS_OK;
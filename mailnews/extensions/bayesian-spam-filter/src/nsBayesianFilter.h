@@ -18,6 +18,7 @@
 #include "mozilla/intl/WordBreaker.h"
 
 #include "mozilla/ArenaAllocator.h"
+#include "prio.h"
 
 #define DEFAULT_MIN_INTERVAL_BETWEEN_WRITES 15 * 60 * 1000
 
@@ -25,9 +26,12 @@ struct Token;
 class TokenEnumeration;
 class TokenAnalyzer;
 class nsIMsgWindow;
+class nsIFile;
 class nsIUTF8StringEnumerator;
 struct BaseToken;
 struct CorpusToken;
+struct ClassificationJob;
+class nsIThreadPool;
 
 /**
  * Helper class to enumerate Token objects in a PLDHashTable
@@ -60,24 +64,6 @@ struct TraitPerToken {
   TraitPerToken(uint32_t aId, uint32_t aCount);  // inititializer
 };
 
-// An Analysis is the statistical results for a particular message, a
-// particular token, and for a particular pair of trait/antitrait, that
-// is then used in subsequent analysis to score the message.
-//
-// Analyses per token are maintained as a linked list.
-//
-struct AnalysisPerToken {
-  uint32_t mTraitIndex;  // index representing a protrait/antitrait pair.
-                         // So if we are analyzing 3 different traits, then
-                         // the first trait is 0, the second 1, etc.
-  double mDistance;      // absolute value of mProbability - 0.5
-  double mProbability;   // relative indicator of match of trait to token
-  uint32_t mNextLink;    // index in mAnalysisStore for the Analysis object
-                         // for the next trait index, or 0 for none.
-  // initializer
-  AnalysisPerToken(uint32_t aTraitIndex, double aDistance, double aProbability);
-};
-
 class TokenHash {
  public:
   virtual ~TokenHash();
@@ -112,8 +98,6 @@ class Tokenizer : public TokenHash {
   //
   Token* add(const char* word, uint32_t count = 1);
 
-  Token* copyTokens();
-
   void tokenize(const char* text);
 
   /**
@@ -155,9 +139,89 @@ class Tokenizer : public TokenHash {
   RefPtr<mozilla::intl::WordBreaker> mWordBreaker;
 };
 
+/**
+ * Read-only view of a version 2 training file, mapped into memory. Nothing
+ * is copied out of the file; every accessor reads (and bounds checks) the
+ * mapping directly.
+ */
+class CorpusFile {
+ public:
+  CorpusFile();
+  ~CorpusFile();
+
+  static const uint32_t kNotFound = UINT32_MAX;
+
+  /**
+   * map a training file, failing if it is not a valid version 2 file
+   */
+  nsresult Open(nsIFile* aFile);
+  void Close();
+  bool IsOpen() const { return mData != nullptr; }
+
+  uint32_t TraitCount() const { return mTraitCount; }
+  uint32_t TokenCount() const { return mTokenCount; }
+  uint32_t TraitId(uint32_t aColumn) const;
+  uint32_t MessageCount(uint32_t aColumn) const;
+
+  /**
+   * @return the column holding counts for a trait, or kNotFound
+   */
+  uint32_t Column(uint32_t aTraitId) const;
+
+  /**
+   * @return index of the token for a word, or kNotFound
+   */
+  uint32_t Find(const char* aWord, uint32_t aLength) const;
+
+  /**
+   * @return the NUL terminated word for a token, or null if corrupt
+   */
+  const char* Word(uint32_t aIndex) const;
+  uint32_t Count(uint32_t aIndex, uint32_t aColumn) const;
+
+  /**
+   * hash of a token word, as stored in the file (32 bit FNV-1a)
+   */
+  static uint32_t Hash(const char* aWord, uint32_t aLength);
+
+ protected:
+  uint32_t ReadUInt32(uint32_t aOffset) const;
+  uint32_t Hash(uint32_t aIndex) const;
+
+  PRFileDesc* mFD;
+  PRFileMap* mMap;
+  const uint8_t* mData;
+  uint32_t mSize;
+  uint32_t mTraitCount;
+  uint32_t mTokenCount;
+  uint32_t mBucketBits;
+  uint32_t mDirectoryOffset;  // offsets of the file sections
+  uint32_t mTokensOffset;
+  uint32_t mCountsOffset;
+  uint32_t mWordsOffset;
+};
+
+struct CorpusWriteToken;
+
+/**
+ * A token as seen by the corpus: the in-memory delta entry, if the token
+ * has been changed since the training file was written, otherwise the
+ * token's index in the training file.
+ */
+struct CorpusTokenRef {
+  CorpusToken* mDelta;
+  uint32_t mFileIndex;
+  explicit operator bool() const {
+    return mDelta || mFileIndex != CorpusFile::kNotFound;
+  }
+};
+
 /**
  * Implements storage of a collection of message tokens and counts for
- * a corpus of classified messages
+ * a corpus of classified messages. Tokens from the training file are read
+ * in place from the mapped file; tokens that are trained after the file was
+ * written are kept in the hash table (the delta), and merged into a new file
+ * by writeTrainingData.
  */
 
 class CorpusStore : public TokenHash {
@@ -170,9 +234,14 @@ class CorpusStore : public TokenHash {
    *
    * @param word  the character representation of the token
    *
-   * @return      token structure containing counts, null if not found
+   * @return      reference to the token, false if not found
    */
-  CorpusToken* get(const char* word);
+  CorpusTokenRef get(const char* word);
+
+  /**
+   * number of distinct tokens in the file and the delta together
+   */
+  uint32_t countTokens();
 
   /**
    * add tokens to the storage, or increment counts if already exists.
@@ -199,13 +268,19 @@ class CorpusStore : public TokenHash {
    *
    * @param aMaximumTokenCount  prune tokens if number of tokens exceeds
    *                            this value.  == 0  for no pruning
+   *
+   * @return NS_OK if the corpus file was written, or the error that stopped
+   *         it, in which case the changes are kept for the next try
    */
-  void writeTrainingData(uint32_t aMaximumTokenCount);
+  nsresult writeTrainingData(uint32_t aMaximumTokenCount);
 
   /**
    * read the corpus information from file storage
+   *
+   * @return true if the data was migrated from the version 1 files, and
+   *         should be written out to the corpus file
    */
-  void readTrainingData();
+  bool readTrainingData();
 
   /**
    * delete the local corpus storage file and data
@@ -236,7 +311,7 @@ class CorpusStore : public TokenHash {
    * @param  token     the token string and associated counts
    * @param  aTraitId  identifier for the trait
    */
-  uint32_t getTraitCount(CorpusToken* token, uint32_t aTraitId);
+  uint32_t getTraitCount(const CorpusTokenRef& token, uint32_t aTraitId);
 
   /**
    * Add (or remove) data from a particular file to the corpus data.
@@ -291,6 +366,11 @@ class CorpusStore : public TokenHash {
    */
   nsresult getTraitFile(nsIFile** aFile);
 
+  /**
+   * return the version 2 corpus storage file, for all traits
+   */
+  nsresult getCorpusFile(nsIFile** aFile);
+
   /**
    * read token strings from the data file
    *
@@ -305,9 +385,48 @@ class CorpusStore : public TokenHash {
                   bool aIsAdd);
 
   /**
-   * write token strings to the data file
+   * read the good and junk tokens from a version 1 training file
    */
-  bool writeTokens(FILE* stream, bool shrink, uint32_t aTraitId);
+  bool readLegacyTrainingData();
+
+  /**
+   * merge the file and delta counts into a list of tokens to write, sorted
+   * for the corpus file
+   *
+   * @param aTokens  the tokens with a non-zero count
+   * @param aCounts  the counts of each token, one for each trait in
+   *                 mMessageCountsId, starting at the token's mCountsIndex
+   */
+  void collectTokens(bool shrink, nsTArray<CorpusWriteToken>& aTokens,
+                     nsTArray<uint32_t>& aCounts);
+
+  /**
+   * write collected tokens to a version 2 corpus file
+   */
+  bool writeCorpusFile(FILE* stream, const nsTArray<CorpusWriteToken>& aTokens,
+                       const nsTArray<uint32_t>& aCounts,
+                       uint32_t aShrinkFactor);
+
+  /**
+   * true if a file token has no counts left outside of cleared traits
+   */
+  bool isFileTokenCleared(uint32_t aFileIndex);
+
+  /**
+   * count of a trait for a token in the mapped file, zero if the trait
+   * has been cleared since the file was written
+   */
+  uint32_t getFileTraitCount(uint32_t aFileIndex, uint32_t aTraitId);
+
+  /**
+   * count of a trait in the linked list of a delta token
+   */
+  uint32_t getDeltaTraitCount(CorpusToken* token, uint32_t aTraitId);
+
+  /**
+   * forget the delta, after it has been merged into the file
+   */
+  void clearDelta();
 
   /**
    * remove counts for a token string
@@ -319,14 +438,32 @@ class CorpusStore : public TokenHash {
    */
   CorpusToken* add(const char* word, uint32_t aTraitId, uint32_t aCount);
 
+  /**
+   * add a token string to the delta, copying its counts from the file
+   *
+   * @param word        the character representation of the token
+   * @param aFileIndex  index of the token in the file, or
+   *                    CorpusFile::kNotFound for a new token
+   */
+  CorpusToken* addDelta(const char* word, uint32_t aFileIndex);
+
   /**
    * change counts in a trait in the traits array, adding the trait if needed
    */
   nsresult updateTrait(CorpusToken* token, uint32_t aTraitId,
                        int32_t aCountChange);
-  nsCOMPtr<nsIFile> mTrainingFile;      // file used to store junk training data
-  nsCOMPtr<nsIFile> mTraitFile;         // file used to store non-junk
-                                        // training data
+  nsCOMPtr<nsIFile> mTrainingFile;      // file used to store training data
+  nsCOMPtr<nsIFile> mTraitFile;         // file used by version 1 to store
+                                        // non-junk training data
+  nsCOMPtr<nsIFile> mCorpusFile;        // file used by version 2 to store
+                                        // all training data
+  CorpusFile mFile;                     // mapped corpus file
+  nsTArray<uint32_t> mSuperseded;       // bitmap of file tokens with a delta
+  uint32_t mSupersededCount;            // number of bits set in mSuperseded
+  uint32_t mClearedTokenCount;          // file tokens without a delta whose
+                                        // traits have all been cleared
+  nsTArray<uint32_t> mClearedFileTraits;  // traits whose file counts are
+                                          // cleared
   nsTArray<TraitPerToken> mTraitStore;  // memory for linked-list of counts
   uint32_t mNextTraitIndex;             // index in mTraitStore to first empty
                                         // TraitPerToken
@@ -353,15 +490,46 @@ class nsBayesianFilter : public nsIJunkMailPlugin,
 
   nsresult tokenizeMessage(const char* messageURI, nsIMsgWindow* aMsgWindow,
                            TokenAnalyzer* analyzer);
-  void classifyMessage(Tokenizer& tokens, const char* messageURI,
-                       nsIJunkMailClassificationListener* listener);
+  /**
+   * look up the aliases of traits
+   *
+   * @param aTraits    the traits
+   * @param aTraitIds  for each trait, the trait followed by its aliases
+   */
+  void getTraitIds(const nsTArray<uint32_t>& aTraits,
+                   nsTArray<nsTArray<uint32_t>>& aTraitIds);
 
-  void classifyMessage(Tokenizer& tokenizer, const char* messageURI,
-                       nsTArray<uint32_t>& aProTraits,
-                       nsTArray<uint32_t>& aAntiTraits,
-                       nsIJunkMailClassificationListener* listener,
-                       nsIMsgTraitClassificationListener* aTraitListener,
-                       nsIMsgTraitDetailListener* aDetailListener);
+  /**
+   * copy the corpus counts that are needed to score a tokenized message
+   *
+   * @param aProIds   for each trait index, the pro trait and its aliases
+   * @param aAntiIds  for each trait index, the anti trait and its aliases
+   * @param aJob      receives the counts
+   */
+  void gatherEvidence(Tokenizer& aTokenizer, const char* aMessageURI,
+                      const nsTArray<nsTArray<uint32_t>>& aProIds,
+                      const nsTArray<nsTArray<uint32_t>>& aAntiIds,
+                      bool aWantDetails, ClassificationJob& aJob);
+
+  /**
+   * call the listeners with the scores of a message
+   */
+  void reportClassification(ClassificationJob& aJob,
+                            nsTArray<uint32_t>& aProTraits,
+                            nsIJunkMailClassificationListener* listener,
+                            nsIMsgTraitClassificationListener* aTraitListener,
+                            nsIMsgTraitDetailListener* aDetailListener);
+
+  /**
+   * the pool that batches of messages are scored on, or null if they should
+   * be scored on the main thread
+   */
+  nsIThreadPool* getClassifyPool();
+
+  /**
+   * number of messages that are tokenized before they are scored together
+   */
+  uint32_t classifyBatchSize() { return mClassifyBatchSize; }
 
   void observeMessage(Tokenizer& tokens, const char* messageURI,
                       nsTArray<uint32_t>& oldClassifications,
@@ -382,21 +550,11 @@ class nsBayesianFilter : public nsIJunkMailPlugin,
                               // and not too close to 0
   nsCOMPtr<nsITimer> mTimer;
 
-  // index in mAnalysisStore for first empty AnalysisPerToken
-  uint32_t mNextAnalysisIndex;
-  // memory for linked list of AnalysisPerToken objects
-  nsTArray<AnalysisPerToken> mAnalysisStore;
-  /**
-   * Determine the location in mAnalysisStore where the AnalysisPerToken
-   * object for a particular token and trait is stored
-   */
-  uint32_t getAnalysisIndex(Token& token, uint32_t aTraitIndex);
-  /**
-   * Set the value of the AnalysisPerToken object for a particular
-   * token and trait
-   */
-  nsresult setAnalysis(Token& token, uint32_t aTraitIndex, double aDistance,
-                       double aProbability);
+  nsCOMPtr<nsIThreadPool> mClassifyPool;
+  int32_t mClassifyBatchSize;  // messages per batch given to the pool
+  int32_t mClassifyThreads;    // 0 to score on the main thread
+
+  void shutdownClassifyPool();
 };
 
 #endif  // _nsBayesianFilter_h__
@@ -2,7 +2,7 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
-// service class to manipulate the junk training.dat file
+// service class to manipulate the junk corpus.dat file
 //  code is adapted from Mnehy Thunderbird Extension
 
 var { Services } = ChromeUtils.import("resource://gre/modules/Services.jsm");
@@ -36,7 +36,7 @@ function TrainingData() {
       "initWithFile"
     );
     var oFile = new CFileByFile(sBaseDir);
-    oFile.append("training.dat");
+    oFile.append("corpus.dat");
     return oFile;
   }
 
@@ -79,32 +79,63 @@ function TrainingData() {
 
     var fileStream = getBinStream(file);
 
-    // check magic number
+    // check magic number and version
     var iMagicNumber = fileStream.read32();
-    Assert.equal(iMagicNumber, 0xfeedface);
-
-    // get ham'n'spam numbers
-    this.mGoodMessages = fileStream.read32();
-    this.mJunkMessages = fileStream.read32();
-
-    // Read good tokens
-    this.mGoodTokens = fileStream.read32();
-    var iRefCount, iTokenLen, sToken;
-    for (let i = 0; i < this.mGoodTokens; ++i) {
-      iRefCount = fileStream.read32();
-      iTokenLen = fileStream.read32();
-      sToken = fileStream.readBytes(iTokenLen);
-      this.mGoodCounts[sToken] = iRefCount;
+    Assert.equal(iMagicNumber, 0xfeedfacf);
+    Assert.equal(fileStream.read32(), 2);
+
+    var iTraitCount = fileStream.read32();
+    var iTokenCount = fileStream.read32();
+    var iBucketBits = fileStream.read32();
+    fileStream.read32(); // reserved
+
+    // get message counts for each trait
+    var aTraits = [];
+    for (let i = 0; i < iTraitCount; i++) {
+      let iTrait = fileStream.read32();
+      let iMessages = fileStream.read32();
+      aTraits.push(iTrait);
+      if (iTrait == Ci.nsIJunkMailPlugin.GOOD_TRAIT) {
+        this.mGoodMessages = iMessages;
+      } else if (iTrait == Ci.nsIJunkMailPlugin.JUNK_TRAIT) {
+        this.mJunkMessages = iMessages;
+      }
     }
 
-    // we have no further good tokens, so read junk tokens
-    this.mJunkTokens = fileStream.read32();
-    for (let i = 0; i < this.mJunkTokens; i++) {
-      // read token data
-      iRefCount = fileStream.read32();
-      iTokenLen = fileStream.read32();
-      sToken = fileStream.readBytes(iTokenLen);
-      this.mJunkCounts[sToken] = iRefCount;
+    // skip the bucket directory
+    for (let i = 0; i < (1 << iBucketBits) + 1; i++) {
+      fileStream.read32();
+    }
+
+    // the words follow the counts in table order, so only lengths are needed
+    var aLengths = [];
+    for (let i = 0; i < iTokenCount; i++) {
+      fileStream.read32(); // hash
+      fileStream.read32(); // offset
+      aLengths.push(fileStream.read32());
+    }
+
+    var aCounts = [];
+    for (let i = 0; i < iTokenCount; i++) {
+      let oCounts = {};
+      for (let trait of aTraits) {
+        oCounts[trait] = fileStream.read32();
+      }
+      aCounts.push(oCounts);
+    }
+
+    for (let i = 0; i < iTokenCount; i++) {
+      let sToken = fileStream.readBytes(aLengths[i] + 1).slice(0, -1);
+      let iGoodCount = aCounts[i][Ci.nsIJunkMailPlugin.GOOD_TRAIT];
+      if (iGoodCount) {
+        this.mGoodCounts[sToken] = iGoodCount;
+        this.mGoodTokens++;
+      }
+      let iJunkCount = aCounts[i][Ci.nsIJunkMailPlugin.JUNK_TRAIT];
+      if (iJunkCount) {
+        this.mJunkCounts[sToken] = iJunkCount;
+        this.mJunkTokens++;
+      }
     }
   }
 }
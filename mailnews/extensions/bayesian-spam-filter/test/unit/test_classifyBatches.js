@@ -0,0 +1,117 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Tests that messages classified in batches, on the thread pool or on the
+// main thread, are reported in order and with the same scores.
+
+var kProTraits = [4, 6];
+var kAntiTraits = [3, 5];
+
+// files to classify, and the expected percents for each trait (the same as
+// in test_traits.js)
+var kFiles = [
+  "ham1.eml",
+  "ham2.eml",
+  "spam1.eml",
+  "spam2.eml",
+  "spam3.eml",
+  "spam4.eml",
+];
+var kPercents = [
+  [0, 100],
+  [8, 95],
+  [100, 50],
+  [81, 0],
+  [98, 50],
+  [81, 0],
+];
+
+// training of files as traits
+var kTraining = [
+  { fileName: "ham1.eml", traitIds: [3, 6] },
+  { fileName: "spam1.eml", traitIds: [4] },
+  { fileName: "spam4.eml", traitIds: [5] },
+];
+
+function createPlugin(aBatchSize, aThreads) {
+  Services.prefs.setIntPref(
+    "mailnews.bayesian_spam_filter.classify_batch_size",
+    aBatchSize
+  );
+  Services.prefs.setIntPref(
+    "mailnews.bayesian_spam_filter.classify_threads",
+    aThreads
+  );
+  return Cc[
+    "@mozilla.org/messenger/filter-plugin;1?name=bayesianfilter"
+  ].createInstance(Ci.nsIJunkMailPlugin);
+}
+
+function train(aPlugin, aTraining) {
+  return new Promise(resolve => {
+    aPlugin.setMsgTraitClassification(
+      getSpec(aTraining.fileName),
+      0,
+      null,
+      aTraining.traitIds.length,
+      aTraining.traitIds,
+      { onMessageTraitsClassified: resolve }
+    );
+  });
+}
+
+function classify(aPlugin) {
+  return new Promise(resolve => {
+    let results = [];
+    let specs = kFiles.map(getSpec);
+    aPlugin.classifyTraitsInMessages(
+      specs.length,
+      specs,
+      kProTraits.length,
+      kProTraits,
+      kAntiTraits,
+      {
+        onMessageTraitsClassified(aMsgURI, aTraitCount, aTraits, aPercents) {
+          if (!aMsgURI) {
+            // end of the run
+            resolve(results);
+            return;
+          }
+          results.push({ uri: aMsgURI, percents: aPercents });
+        },
+      }
+    );
+  });
+}
+
+function checkResults(aResults) {
+  Assert.equal(aResults.length, kFiles.length);
+  for (let i = 0; i < kFiles.length; i++) {
+    Assert.equal(aResults[i].uri, getSpec(kFiles[i]));
+    Assert.deepEqual(aResults[i].percents, kPercents[i]);
+  }
+}
+
+add_task(async function test_classifyOnPool() {
+  localAccountUtils.loadLocalMailAccount();
+
+  // batches of 4 and 2 messages, scored on the pool
+  let plugin = createPlugin(4, 2);
+  for (let training of kTraining) {
+    await train(plugin, training);
+  }
+  checkResults(await classify(plugin));
+
+  // one message per batch
+  plugin.shutdown(); // writes the training data
+  plugin = createPlugin(1, 2);
+  checkResults(await classify(plugin));
+  plugin.shutdown();
+});
+
+add_task(async function test_classifyOnMainThread() {
+  let plugin = createPlugin(4, 0);
+  checkResults(await classify(plugin));
+  plugin.shutdown();
+});
@@ -0,0 +1,236 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Tests that trained tokens survive a round trip through the version 2
+// corpus file, that only the corpus file is written, that the version 1 files
+// are migrated once when there is no corpus file, and that they are ignored
+// once there is one, however recently they were changed.
+
+var kGoodTrait = Ci.nsIJunkMailPlugin.GOOD_TRAIT;
+var kJunkTrait = Ci.nsIJunkMailPlugin.JUNK_TRAIT;
+var kTraits = [kGoodTrait, kJunkTrait, 1001, 1002];
+
+var gTraining = [
+  ["ham1.eml", [kGoodTrait, 1001]],
+  ["ham2.eml", [kGoodTrait]],
+  ["spam1.eml", [kJunkTrait]],
+  ["spam4.eml", [kJunkTrait, 1002]],
+];
+
+function newFilter() {
+  return Cc["@mozilla.org/messenger/filter-plugin;1?name=bayesianfilter"]
+    .createInstance(Ci.nsIJunkMailPlugin)
+    .QueryInterface(Ci.nsIMsgCorpus);
+}
+
+function profileFile(aName) {
+  let file = do_get_profile();
+  file.append(aName);
+  return file;
+}
+
+function readMagic(aName) {
+  let stream = Cc["@mozilla.org/network/file-input-stream;1"].createInstance(
+    Ci.nsIFileInputStream
+  );
+  stream.init(profileFile(aName), -1, -1, 0);
+  let binary = Cc["@mozilla.org/binaryinputstream;1"].createInstance(
+    Ci.nsIBinaryInputStream
+  );
+  binary.setInputStream(stream);
+  let magic = binary.read32();
+  binary.close();
+  return magic;
+}
+
+// The words of the training messages, a superset of their body tokens.
+function trainingWords() {
+  let words = new Set();
+  for (let [fileName] of gTraining) {
+    let text = mailTestUtils.loadFileToString(
+      do_get_file("resources/" + fileName)
+    );
+    for (let word of text.toLowerCase().split(/[^a-z]+/)) {
+      if (word) {
+        words.add(word);
+      }
+    }
+  }
+  return [...words];
+}
+
+// Writes the version 1 files: training.dat with the good and junk traits, and
+// traits.dat with the others. aTraining maps each trait to its message count
+// and token counts.
+function writeLegacyFiles(aTraining) {
+  function writeFile(aName, aWrite) {
+    let stream = Cc[
+      "@mozilla.org/network/file-output-stream;1"
+    ].createInstance(Ci.nsIFileOutputStream);
+    stream.init(profileFile(aName), -1, -1, 0);
+    let binary = Cc["@mozilla.org/binaryoutputstream;1"].createInstance(
+      Ci.nsIBinaryOutputStream
+    );
+    binary.setOutputStream(stream);
+    aWrite(binary);
+    binary.close();
+  }
+  function writeTokens(aBinary, aTokens) {
+    let words = Object.keys(aTokens);
+    aBinary.write32(words.length);
+    for (let word of words) {
+      aBinary.write32(aTokens[word]);
+      aBinary.write32(word.length);
+      aBinary.writeBytes(word, word.length);
+    }
+  }
+
+  writeFile("training.dat", binary => {
+    binary.write32(0xfeedface);
+    binary.write32(aTraining[kGoodTrait].messages);
+    binary.write32(aTraining[kJunkTrait].messages);
+    writeTokens(binary, aTraining[kGoodTrait].tokens);
+    writeTokens(binary, aTraining[kJunkTrait].tokens);
+  });
+  writeFile("traits.dat", binary => {
+    binary.write32(0xfca93601);
+    for (let trait in aTraining) {
+      if (trait != kGoodTrait && trait != kJunkTrait) {
+        binary.write32(trait);
+        binary.write32(aTraining[trait].messages);
+        writeTokens(binary, aTraining[trait].tokens);
+      }
+    }
+    binary.write32(0);
+  });
+}
+
+var gLegacyTraining = {
+  [kGoodTrait]: { messages: 3, tokens: { alpha: 2, beta: 1 } },
+  [kJunkTrait]: { messages: 2, tokens: { gamma: 4 } },
+  1001: { messages: 1, tokens: { delta: 1, alpha: 3 } },
+};
+
+function checkLegacyTraining(aCorpus, aTraining) {
+  for (let trait in aTraining) {
+    let messageCount = {};
+    aCorpus.corpusCounts(trait, messageCount);
+    Assert.equal(messageCount.value, aTraining[trait].messages);
+    for (let word in aTraining[trait].tokens) {
+      Assert.equal(
+        aCorpus.getTokenCount(word, trait),
+        aTraining[trait].tokens[word],
+        word
+      );
+    }
+  }
+}
+
+function fileContents(aName) {
+  return mailTestUtils.loadFileToString(profileFile(aName));
+}
+
+function snapshot(aCorpus, aWords) {
+  let result = { tokens: 0, messages: {}, counts: {} };
+  for (let trait of kTraits) {
+    let messageCount = {};
+    result.tokens = aCorpus.corpusCounts(trait, messageCount);
+    result.messages[trait] = messageCount.value;
+    result.counts[trait] = aWords.map(word =>
+      aCorpus.getTokenCount(word, trait)
+    );
+  }
+  return result;
+}
+
+function train(aFilter, aFileName, aTraits) {
+  return new Promise(resolve => {
+    aFilter.setMsgTraitClassification(
+      getSpec(aFileName),
+      0,
+      null,
+      aTraits.length,
+      aTraits,
+      {
+        onMessageTraitsClassified(aMsgURI) {
+          if (aMsgURI) {
+            resolve();
+          }
+        },
+      }
+    );
+  });
+}
+
+var gWords;
+var gTrained;
+
+add_task(async function trainAndFlush() {
+  let filter = MailServices.junk;
+  filter.resetTrainingData();
+  for (let [fileName, traits] of gTraining) {
+    await train(filter, fileName, traits);
+  }
+  gWords = trainingWords();
+  gTrained = snapshot(filter.QueryInterface(Ci.nsIMsgCorpus), gWords);
+  Assert.greater(gTrained.tokens, 0);
+  Assert.equal(gTrained.messages[kGoodTrait], 2);
+  Assert.equal(gTrained.messages[1002], 1);
+  Assert.ok(gTrained.counts[kGoodTrait].some(count => count > 0));
+
+  filter.shutdown(); // flushes the training data
+
+  Assert.equal(readMagic("corpus.dat"), 0xfeedfacf);
+  // nothing but the corpus file is written
+  Assert.ok(!profileFile("training.dat").exists());
+  Assert.ok(!profileFile("traits.dat").exists());
+});
+
+add_task(function readCorpusFile() {
+  let corpus = newFilter();
+  Assert.deepEqual(snapshot(corpus, gWords), gTrained);
+
+  // tokens whose traits have all been cleared are no longer counted
+  corpus.clearTrait(kGoodTrait);
+  corpus.clearTrait(1001);
+  let tokens = corpus.corpusCounts(0, {});
+  Assert.less(tokens, gTrained.tokens);
+  Assert.greater(tokens, 0);
+  corpus.clearTrait(kJunkTrait);
+  corpus.clearTrait(1002);
+  Assert.equal(corpus.corpusCounts(0, {}), 0);
+  corpus.QueryInterface(Ci.nsIJunkMailPlugin).shutdown();
+});
+
+add_task(function migrateLegacyFiles() {
+  profileFile("corpus.dat").remove(false);
+  writeLegacyFiles(gLegacyTraining);
+  let training = fileContents("training.dat");
+  let traits = fileContents("traits.dat");
+
+  let corpus = newFilter();
+  checkLegacyTraining(corpus, gLegacyTraining);
+
+  // The migrated training goes to the corpus file, and the version 1 files
+  // are left alone.
+  corpus.QueryInterface(Ci.nsIJunkMailPlugin).shutdown();
+  Assert.equal(readMagic("corpus.dat"), 0xfeedfacf);
+  Assert.equal(fileContents("training.dat"), training);
+  Assert.equal(fileContents("traits.dat"), traits);
+
+  checkLegacyTraining(newFilter(), gLegacyTraining);
+});
+
+add_task(function ignoreLegacyFilesWithCorpusFile() {
+  // Whatever the file times say, version 1 files are only read when there is
+  // no corpus file.
+  writeLegacyFiles({
+    [kGoodTrait]: { messages: 9, tokens: { alpha: 9 } },
+    [kJunkTrait]: { messages: 9, tokens: { gamma: 9 } },
+  });
+  profileFile("corpus.dat").lastModifiedTime = Date.now() - 3600 * 1000;
+  profileFile("training.dat").lastModifiedTime = Date.now() + 3600 * 1000;
+
+  checkLegacyTraining(newFilter(), gLegacyTraining);
+});
@@ -132,6 +132,13 @@ void nsIMAPBodyShell::AdoptMimeHeader(const char *partNum, char *mimeHeader) {
   }
 }
 
+void nsIMAPBodyShell::SetBinaryPartSize(const char *partNum, uint32_t size) {
+  if (!GetIsValid()) return;
+
+  nsIMAPBodypart *foundPart = m_message->FindPartWithNumber(partNum);
+  if (foundPart) foundPart->SetBinarySize(size);
+}
+
 void nsIMAPBodyShell::AddPrefetchToQueue(nsIMAPeFetchFields fields,
                                          const char *partNumber) {
   nsIMAPMessagePartID newPart(fields, partNumber);
@@ -262,6 +269,7 @@ nsIMAPBodypart::nsIMAPBodypart(char *partNumber, nsIMAPBodypart *parentPart) {
   m_boundaryData = NULL;  // initialize from parsed BODYSTRUCTURE
   m_contentLength = 0;
   m_partLength = 0;
+  m_binarySize = -1;
 
   m_contentType = NULL;
   m_bodyType = NULL;
@@ -344,6 +352,35 @@ void nsIMAPBodypart::QueuePrefetchMIMEHeader(nsIMAPBodyShell *aShell) {
   aShell->AddPrefetchToQueue(kMIMEHeader, m_partNumberString);
 }
 
+bool nsIMAPBodypart::FetchesBinary(nsIMAPBodyShell *aShell) {
+  // the size is only asked for parts the server can decode.
+  return m_binarySize >= 0 && !m_partData && ShouldFetchInline(aShell);
+}
+
+// Replaces the Content-Transfer-Encoding of a MIME header with "binary", for
+// a part the server decodes for us.
+static void SetBinaryTransferEncoding(nsCString &aHeader) {
+  NS_NAMED_LITERAL_CSTRING(kEncodingHeader, "Content-Transfer-Encoding:");
+  uint32_t lineStart = 0;
+  while (lineStart < aHeader.Length()) {
+    int32_t lineEnd = aHeader.FindChar('\n', lineStart);
+    uint32_t next = (lineEnd == kNotFound) ? aHeader.Length() : lineEnd + 1;
+    if (StringBeginsWith(Substring(aHeader, lineStart), kEncodingHeader,
+                         nsCaseInsensitiveCStringComparator())) {
+      // the value may be folded onto the following lines
+      while (next < aHeader.Length() &&
+             (aHeader[next] == ' ' || aHeader[next] == '\t')) {
+        lineEnd = aHeader.FindChar('\n', next);
+        next = (lineEnd == kNotFound) ? aHeader.Length() : lineEnd + 1;
+      }
+      aHeader.Replace(lineStart, next - lineStart,
+                      kEncodingHeader + NS_LITERAL_CSTRING(" binary" CRLF));
+      return;
+    }
+    lineStart = next;
+  }
+}
+
 int32_t nsIMAPBodypart::GenerateMIMEHeader(nsIMAPBodyShell *aShell, bool stream,
                                            bool prefetch) {
   if (prefetch && !m_headerData) {
@@ -352,6 +389,9 @@ int32_t nsIMAPBodypart::GenerateMIMEHeader(nsIMAPBodyShell *aShell, bool stream,
   }
   if (m_headerData) {
     int32_t mimeHeaderLength = 0;
+    nsAutoCString headerData(m_headerData);
+    bool binary = FetchesBinary(aShell);
+    if (binary) SetBinaryTransferEncoding(headerData);
 
     if (!ShouldFetchInline(aShell)) {
       // if this part isn't inline, add the X-Mozilla-IMAP-Part header
@@ -369,12 +409,17 @@ int32_t nsIMAPBodypart::GenerateMIMEHeader(nsIMAPBodyShell *aShell, bool stream,
       }
     }
 
-    mimeHeaderLength += PL_strlen(m_headerData);
+    mimeHeaderLength += headerData.Length();
     if (stream) {
       aShell->GetConnection()->Log("SHELL", "GENERATE-MIMEHeader",
                                    m_partNumberString);
-      aShell->GetConnection()->HandleMessageDownLoadLine(
-          m_headerData, false);  // all one line?  Can we do that?
+      // GeneratePart puts the server's header back if it won't decode the
+      // part after all.
+      if (binary)
+        aShell->GetConnection()->HoldPartHeader(headerData);
+      else
+        aShell->GetConnection()->HandleMessageDownLoadLine(
+            headerData.get(), false);  // all one line?  Can we do that?
     }
 
     return mimeHeaderLength;
@@ -398,6 +443,7 @@ int32_t nsIMAPBodypart::GeneratePart(nsIMAPBodyShell *aShell, bool stream,
     return PL_strlen(m_partData);
   }
 
+  bool binary = FetchesBinary(aShell);
   // we are fetching and streaming this part's body as we go
   if (stream && !aShell->DeathSignalReceived()) {
     char *generatingPart = aShell->GetGeneratingPart();
@@ -410,12 +456,35 @@ int32_t nsIMAPBodypart::GeneratePart(nsIMAPBodyShell *aShell, bool stream,
             ("GeneratePart(): Call FetchTryChunking() part length=%" PRIi32
              ", part number=%s",
              m_partLength, m_partNumberString));
-    aShell->GetConnection()->FetchTryChunking(aShell->GetUID(), kMIMEPart, true,
-                                              m_partNumberString, m_partLength,
-                                              !fetchingSpecificPart);
+    if (binary) {
+      aShell->GetConnection()->FetchTryChunking(
+          aShell->GetUID(), kMIMEPartBinary, true, m_partNumberString,
+          m_binarySize, !fetchingSpecificPart);
+      // The server would have refused BINARY.SIZE for a part it can't decode,
+      // but if it refuses the part itself, fetch it as it is, and don't ask
+      // for it decoded the next time the shell is generated. None of the
+      // part has come, so its header is still held, and the header the
+      // server sent, with the part's own encoding, goes out instead.
+      if (aShell->GetConnection()->UnknownCTE() &&
+          aShell->GetConnection()->PartHeaderHeld()) {
+        m_binarySize = -1;
+        if (m_headerData)
+          aShell->GetConnection()->HoldPartHeader(
+              nsDependentCString(m_headerData));
+        aShell->GetConnection()->FetchTryChunking(
+            aShell->GetUID(), kMIMEPart, true, m_partNumberString,
+            m_partLength, !fetchingSpecificPart);
+      }
+    } else
+      aShell->GetConnection()->FetchTryChunking(
+          aShell->GetUID(), kMIMEPart, true, m_partNumberString, m_partLength,
+          !fetchingSpecificPart);
   }
-  return m_partLength;  // the part length has been filled in from the
-                        // BODYSTRUCTURE response
+  // an empty part still gets its header
+  if (stream) aShell->GetConnection()->FlushPartHeader();
+  // the part length has been filled in from the BODYSTRUCTURE response, and
+  // the decoded size from BINARY.SIZE
+  return binary && m_binarySize >= 0 ? m_binarySize : m_partLength;
 }
 
 int32_t nsIMAPBodypart::GenerateBoundary(nsIMAPBodyShell *aShell, bool stream,
@@ -525,6 +594,10 @@ int32_t nsIMAPBodypartLeaf::Generate(nsIMAPBodyShell *aShell, bool stream,
 
     if (!aShell->GetPseudoInterrupted()) {
       if (ShouldFetchInline(aShell)) {
+        // Ask for the decoded size along with the MIME header, if the server
+        // is to decode the part.
+        if (prefetch && m_binarySize < 0 && CanFetchBinary(aShell))
+          aShell->AddPrefetchToQueue(kBinarySize, m_partNumberString);
         // Fetch and stream the content of this part
         len += GeneratePart(aShell, stream, prefetch);
       } else {
@@ -537,6 +610,14 @@ int32_t nsIMAPBodypartLeaf::Generate(nsIMAPBodyShell *aShell, bool stream,
   return m_contentLength;
 }
 
+bool nsIMAPBodypartLeaf::CanFetchBinary(nsIMAPBodyShell *aShell) {
+  return m_parentPart->GetType() != IMAP_BODY_MESSAGE_RFC822 &&
+         m_bodyEncoding &&
+         (!PL_strcasecmp(m_bodyEncoding, "base64") ||
+          !PL_strcasecmp(m_bodyEncoding, "quoted-printable")) &&
+         aShell->GetConnection()->UseBinaryFetch();
+}
+
 // returns true if this part should be fetched inline for generation.
 bool nsIMAPBodypartLeaf::ShouldFetchInline(nsIMAPBodyShell *aShell) {
   char *generatingPart = aShell->GetGeneratingPart();
@@ -96,9 +96,14 @@ class nsIMAPBodypart {
   const char *GetBodyType() { return m_bodyType; }
   const char *GetBodySubType() { return m_bodySubType; }
   void SetBoundaryData(char *boundaryData) { m_boundaryData = boundaryData; }
+  // The size of the part once decoded by the server, if it's to be fetched
+  // with BINARY.
+  void SetBinarySize(int32_t binarySize) { m_binarySize = binarySize; }
 
  protected:
   virtual void QueuePrefetchMIMEHeader(nsIMAPBodyShell *aShell);
+  // Returns true if this part's content is fetched decoded by the server.
+  bool FetchesBinary(nsIMAPBodyShell *aShell);
   // virtual void  PrefetchMIMEHeader();  // Initiates a prefetch for the MIME
   // header of this part.
   nsIMAPBodypart(char *partNumber, nsIMAPBodypart *parentPart);
@@ -113,6 +118,7 @@ class nsIMAPBodypart {
                        // in yet.
   char *m_boundaryData;  // MIME boundary for this part
   int32_t m_partLength;
+  int32_t m_binarySize;     // decoded size of the part, -1 if not fetched so.
   int32_t m_contentLength;  // Total content length which will be Generate()'d.
                             // -1 if not filled in yet.
   nsIMAPBodypart *m_parentPart;  // Parent of this part
@@ -183,6 +189,10 @@ class nsIMAPBodypartLeaf : public nsIMAPBodypart {
   virtual bool PreflightCheckAllInline(nsIMAPBodyShell *aShell) override;
 
  private:
+  // Returns true if the server can decode this part for us: a base64 or
+  // quoted-printable part whose MIME header we generate, so that the header
+  // can say it isn't encoded anymore.
+  bool CanFetchBinary(nsIMAPBodyShell *aShell);
   bool mPreferPlainText;
 };
 
@@ -253,6 +263,8 @@ class nsIMAPBodyShell : public nsISupports {
   // Fills in buffer (and adopts storage) for MIME headers in appropriate
   // object. If object can't be found, sets isValid to false.
   void AdoptMimeHeader(const char *partNum, char *mimeHeader);
+  // Sets the size of a part as decoded by the server, from BINARY.SIZE.
+  void SetBinaryPartSize(const char *partNum, uint32_t size);
 
   // Generation
   // Streams out an HTML representation of this IMAP message, going along and
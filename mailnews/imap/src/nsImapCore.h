@@ -143,6 +143,8 @@ const eIMAPCapabilityFlag kHasListExtendedCapability =    0x100000000LL;  /* RFC
 const eIMAPCapabilityFlag kHasSpecialUseCapability =      0x200000000LL;  /* RFC 6154: Sent, Draft etc. folders */
 const eIMAPCapabilityFlag kGmailImapCapability =          0x400000000LL;  /* X-GM-EXT-1 capability extension for gmail */
 const eIMAPCapabilityFlag kHasXOAuth2Capability =         0x800000000LL;  /* AUTH XOAUTH2 extension */
+const eIMAPCapabilityFlag kHasQResyncCapability =         0x1000000000LL; /* RFC 7162 QRESYNC extension */
+const eIMAPCapabilityFlag kHasBinaryCapability =          0x2000000000LL; /* RFC 3516 BINARY extension */
 
 
 // this used to be part of the connection object class - maybe we should move it into
@@ -157,7 +159,9 @@ typedef enum {
     kRFC822HeadersOnly,
     kMIMEPart,
     kMIMEHeader,
-    kBodyStart
+    kBodyStart,
+    kMIMEPartBinary,  // a MIME part, decoded by the server (RFC 3516)
+    kBinarySize       // the decoded size of a MIME part
 } nsIMAPeFetchFields;
 
 typedef struct _utf_name_struct {
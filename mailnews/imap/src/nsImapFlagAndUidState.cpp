@@ -8,8 +8,6 @@
 #include "nsImapCore.h"
 #include "nsImapFlagAndUidState.h"
 #include "nsMsgUtils.h"
-#include "prcmon.h"
-#include "nspr.h"
 
 NS_IMPL_ISUPPORTS(nsImapFlagAndUidState, nsIImapFlagAndUidState)
 
@@ -17,7 +15,8 @@ using namespace mozilla;
 
 NS_IMETHODIMP nsImapFlagAndUidState::GetNumberOfMessages(int32_t *result) {
   if (!result) return NS_ERROR_NULL_POINTER;
-  *result = fUids.Length();
+  MutexAutoLock mon(mLock);
+  *result = fFlags.Length();
   return NS_OK;
 }
 
@@ -25,22 +24,30 @@ NS_IMETHODIMP nsImapFlagAndUidState::GetUidOfMessage(int32_t zeroBasedIndex,
                                                      uint32_t *aResult) {
   NS_ENSURE_ARG_POINTER(aResult);
 
-  PR_CEnterMonitor(this);
-  *aResult = fUids.SafeElementAt(zeroBasedIndex, nsMsgKey_None);
-  PR_CExitMonitor(this);
+  MutexAutoLock mon(mLock);
+  if (zeroBasedIndex < 0 || (uint32_t)zeroBasedIndex >= fFlags.Length())
+    *aResult = nsMsgKey_None;
+  else
+    *aResult = RunUid(fRuns[FindRun(zeroBasedIndex)], zeroBasedIndex);
   return NS_OK;
 }
 
 NS_IMETHODIMP nsImapFlagAndUidState::GetMessageFlags(int32_t zeroBasedIndex,
                                                      uint16_t *aResult) {
   NS_ENSURE_ARG_POINTER(aResult);
+  MutexAutoLock mon(mLock);
   *aResult = fFlags.SafeElementAt(zeroBasedIndex, kNoImapMsgFlag);
   return NS_OK;
 }
 
 NS_IMETHODIMP nsImapFlagAndUidState::SetMessageFlags(int32_t zeroBasedIndex,
                                                      unsigned short flags) {
-  if (zeroBasedIndex < (int32_t)fUids.Length()) fFlags[zeroBasedIndex] = flags;
+  MutexAutoLock mon(mLock);
+  if (zeroBasedIndex >= 0 && (uint32_t)zeroBasedIndex < fFlags.Length()) {
+    CountFlags(fFlags[zeroBasedIndex], -1);
+    fFlags[zeroBasedIndex] = flags;
+    CountFlags(flags, 1);
+  }
   return NS_OK;
 }
 
@@ -48,17 +55,8 @@ NS_IMETHODIMP nsImapFlagAndUidState::GetNumberOfRecentMessages(
     int32_t *result) {
   if (!result) return NS_ERROR_NULL_POINTER;
 
-  PR_CEnterMonitor(this);
-  uint32_t counter = 0;
-  int32_t numUnseenMessages = 0;
-
-  for (counter = 0; counter < fUids.Length(); counter++) {
-    if (fFlags[counter] & kImapMsgRecentFlag) numUnseenMessages++;
-  }
-  PR_CExitMonitor(this);
-
-  *result = numUnseenMessages;
-
+  MutexAutoLock mon(mLock);
+  *result = fNumberRecent;
   return NS_OK;
 }
 
@@ -72,13 +70,14 @@ NS_IMETHODIMP nsImapFlagAndUidState::GetPartialUIDFetch(
 /* amount to expand for imap entry flags when we need more */
 
 nsImapFlagAndUidState::nsImapFlagAndUidState(int32_t numberOfMessages)
-    : fUids(numberOfMessages),
-      fFlags(numberOfMessages),
+    : fFlags(numberOfMessages),
       m_customFlagsHash(10),
+      m_keywordSetIndexes(10),
       m_customAttributesHash(10),
       mLock("nsImapFlagAndUidState.mLock") {
   fSupportedUserFlags = 0;
   fNumberDeleted = 0;
+  fNumberRecent = 0;
   fPartialUIDFetch = true;
   fStartCapture = false;
   fNumAdded = 0;
@@ -122,15 +121,18 @@ nsImapFlagAndUidState::GetOtherKeywords(uint16_t index, nsACString &aKeyword) {
 // allocation needed will be very close to what we were already using
 
 NS_IMETHODIMP nsImapFlagAndUidState::Reset() {
-  PR_CEnterMonitor(this);
+  MutexAutoLock mon(mLock);
   fNumberDeleted = 0;
+  fNumberRecent = 0;
   m_customFlagsHash.Clear();
-  fUids.Clear();
+  m_keywordSets.Clear();
+  m_keywordSetIndexes.Clear();
+  fRuns.Clear();
   fFlags.Clear();
+  fVanished.Clear();
   fPartialUIDFetch = true;
   fStartCapture = false;
   fNumAdded = 0;
-  PR_CExitMonitor(this);
   return NS_OK;
 }
 
@@ -140,16 +142,128 @@ NS_IMETHODIMP nsImapFlagAndUidState::ExpungeByIndex(uint32_t msgIndex) {
   // protect ourselves in case the server gave us an index key of -1 or 0
   if ((int32_t)msgIndex <= 0) return NS_ERROR_INVALID_ARG;
 
-  if ((uint32_t)fUids.Length() < msgIndex) return NS_ERROR_INVALID_ARG;
+  MutexAutoLock mon(mLock);
+  if ((uint32_t)fFlags.Length() < msgIndex) return NS_ERROR_INVALID_ARG;
 
-  PR_CEnterMonitor(this);
   msgIndex--;  // msgIndex is 1-relative
-  if (fFlags[msgIndex] &
-      kImapMsgDeletedFlag)  // see if we already had counted this one as deleted
-    fNumberDeleted--;
-  fUids.RemoveElementAt(msgIndex);
+  // see if we already had counted this one as deleted
+  CountFlags(fFlags[msgIndex], -1);
+
+  // Take the message out of its run, splitting the run if the message is in
+  // the middle of it, and move the runs after it down.
+  size_t run = FindRun(msgIndex);
+  UidRun &current = fRuns[run];
+  uint32_t end = RunEnd(run);
+  size_t next = run + 1;
+  if (end - current.mIndex == 1) {
+    fRuns.RemoveElementAt(run);
+    next = run;
+  } else if (msgIndex == current.mIndex) {
+    current.mUid = RunUid(current, msgIndex + 1);
+  } else if (msgIndex + 1 < end) {
+    UidRun rest = {msgIndex + 1, RunUid(current, msgIndex + 1)};
+    fRuns.InsertElementAt(next, rest);
+  }
+  for (size_t i = next; i < fRuns.Length(); i++) fRuns[i].mIndex--;
   fFlags.RemoveElementAt(msgIndex);
-  PR_CExitMonitor(this);
+  // The runs on either side may carry on from each other now.
+  MergeRuns(next, next);
+  return NS_OK;
+}
+
+NS_IMETHODIMP nsImapFlagAndUidState::ExpungeByUids(uint32_t firstUid,
+                                                   uint32_t lastUid,
+                                                   bool earlier) {
+  if (!firstUid || lastUid < firstUid) return NS_ERROR_INVALID_ARG;
+
+  MutexAutoLock mon(mLock);
+  if (!earlier) {
+    // Squeeze out the vanished messages in one pass. Without EARLIER, the
+    // server only reports messages we could see, so each uid that isn't in
+    // the flag state was one of the messages a partial fetch left out
+    // between the fetched messages around it.
+    nsTArray<UidRun> runs(fRuns.Length());
+    uint32_t kept = 0;
+    uint32_t prevUid = 0;
+    for (size_t run = 0; run < fRuns.Length(); run++) {
+      const UidRun &current = fRuns[run];
+      uint32_t end = RunEnd(run);
+      uint32_t unknownToRemove = 0;
+      if (!current.mUid) {
+        uint64_t low = std::max<uint64_t>(prevUid + 1ULL, firstUid);
+        uint64_t high = run + 1 < fRuns.Length()
+                            ? std::min<uint64_t>(fRuns[run + 1].mUid - 1ULL,
+                                                 lastUid)
+                            : lastUid;
+        unknownToRemove = high >= low ? uint32_t(high - low + 1) : 0;
+      }
+      for (uint32_t i = current.mIndex; i < end; i++) {
+        uint32_t uid = RunUid(current, i);
+        bool vanished;
+        if (uid) {
+          vanished = uid >= firstUid && uid <= lastUid;
+          prevUid = uid;
+        } else {
+          vanished = unknownToRemove > 0;
+          if (vanished) unknownToRemove--;
+        }
+        if (vanished) {
+          CountFlags(fFlags[i], -1);
+          continue;
+        }
+        AppendRun(runs, kept, uid);
+        fFlags[kept++] = fFlags[i];
+      }
+    }
+    fRuns.SwapElements(runs);
+    fFlags.TruncateLength(kept);
+  }
+
+  // Merge the range into the ones we have, so isVanished can search them.
+  size_t index = FindVanishedRange(firstUid - 1);
+  if (index < fVanished.Length() && fVanished[index].mFirst - 1 <= lastUid) {
+    UidRange &range = fVanished[index];
+    range.mFirst = std::min(range.mFirst, firstUid);
+    range.mLast = std::max(range.mLast, lastUid);
+    size_t next = index + 1;
+    while (next < fVanished.Length() &&
+           fVanished[next].mFirst - 1 <= range.mLast) {
+      range.mLast = std::max(range.mLast, fVanished[next].mLast);
+      next++;
+    }
+    fVanished.RemoveElementsAt(index + 1, next - index - 1);
+  } else {
+    UidRange range = {firstUid, lastUid};
+    fVanished.InsertElementAt(index, range);
+  }
+  return NS_OK;
+}
+
+size_t nsImapFlagAndUidState::FindVanishedRange(uint32_t uid) {
+  size_t low = 0;
+  size_t high = fVanished.Length();
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (fVanished[middle].mLast < uid)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+NS_IMETHODIMP nsImapFlagAndUidState::GetHasVanishedMessages(bool *aResult) {
+  NS_ENSURE_ARG_POINTER(aResult);
+  MutexAutoLock mon(mLock);
+  *aResult = !fVanished.IsEmpty();
+  return NS_OK;
+}
+
+NS_IMETHODIMP nsImapFlagAndUidState::IsVanished(uint32_t uid, bool *aResult) {
+  NS_ENSURE_ARG_POINTER(aResult);
+  MutexAutoLock mon(mLock);
+  size_t index = FindVanishedRange(uid);
+  *aResult = index < fVanished.Length() && fVanished[index].mFirst <= uid;
   return NS_OK;
 }
 
@@ -161,12 +275,15 @@ NS_IMETHODIMP nsImapFlagAndUidState::AddUidFlagPair(uint32_t uid,
     return NS_OK;
   // check for potential overflow in buffer size for uid array
   if (zeroBasedIndex > 0x3FFFFFFF) return NS_ERROR_INVALID_ARG;
-  PR_CEnterMonitor(this);
-  // make sure there is room for this pair
-  if (zeroBasedIndex >= fUids.Length()) {
-    int32_t sizeToGrowBy = zeroBasedIndex - fUids.Length() + 1;
-    fUids.InsertElementsAt(fUids.Length(), sizeToGrowBy, 0);
-    fFlags.InsertElementsAt(fFlags.Length(), sizeToGrowBy, 0);
+  MutexAutoLock mon(mLock);
+  uint32_t length = fFlags.Length();
+  if (zeroBasedIndex >= length) {
+    // Usually the next message of a FETCH 1:* response, which just makes
+    // the last run longer.
+    if (zeroBasedIndex > length) AppendRun(fRuns, length, 0);
+    AppendRun(fRuns, zeroBasedIndex, uid);
+    fFlags.InsertElementsAt(length, zeroBasedIndex - length, kNoImapMsgFlag);
+    fFlags.AppendElement(flags);
     if (fStartCapture) {
       // A new partial (CONDSTORE/CHANGEDSINCE) fetch response is occurring
       // so need to start the count of number of uid/flag combos added.
@@ -174,15 +291,87 @@ NS_IMETHODIMP nsImapFlagAndUidState::AddUidFlagPair(uint32_t uid,
       fStartCapture = false;
     }
     fNumAdded++;
+  } else {
+    CountFlags(fFlags[zeroBasedIndex], -1);
+    SetUidAt(zeroBasedIndex, uid);
+    fFlags[zeroBasedIndex] = flags;
   }
-
-  fUids[zeroBasedIndex] = uid;
-  fFlags[zeroBasedIndex] = flags;
-  if (flags & kImapMsgDeletedFlag) fNumberDeleted++;
-  PR_CExitMonitor(this);
+  CountFlags(flags, 1);
   return NS_OK;
 }
 
+void nsImapFlagAndUidState::AppendRun(nsTArray<UidRun> &runs, uint32_t index,
+                                      uint32_t uid) {
+  if (runs.IsEmpty() || RunUid(runs.LastElement(), index) != uid) {
+    UidRun run = {index, uid};
+    runs.AppendElement(run);
+  }
+}
+
+size_t nsImapFlagAndUidState::FindRun(uint32_t index) {
+  // The first run starts at index 0.
+  size_t low = 0;
+  size_t high = fRuns.Length();
+  while (high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+    if (fRuns[middle].mIndex <= index)
+      low = middle;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+uint32_t nsImapFlagAndUidState::RunEnd(size_t runIndex) {
+  return runIndex + 1 < fRuns.Length() ? fRuns[runIndex + 1].mIndex
+                                       : fFlags.Length();
+}
+
+uint32_t nsImapFlagAndUidState::RunUid(const UidRun &run, uint32_t index) {
+  return run.mUid ? run.mUid + (index - run.mIndex) : 0;
+}
+
+uint32_t nsImapFlagAndUidState::RunSortUid(size_t runIndex) {
+  const UidRun &run = fRuns[runIndex];
+  if (run.mUid || !runIndex) return run.mUid;
+  return RunUid(fRuns[runIndex - 1], run.mIndex);
+}
+
+void nsImapFlagAndUidState::SetUidAt(uint32_t index, uint32_t uid) {
+  size_t run = FindRun(index);
+  UidRun current = fRuns[run];
+  if (RunUid(current, index) == uid) return;
+
+  // Give the message a run of its own, between what's left of its old run.
+  uint32_t end = RunEnd(run);
+  AutoTArray<UidRun, 3> pieces;
+  if (index > current.mIndex) pieces.AppendElement(current);
+  UidRun single = {index, uid};
+  pieces.AppendElement(single);
+  if (index + 1 < end) {
+    UidRun rest = {index + 1, RunUid(current, index + 1)};
+    pieces.AppendElement(rest);
+  }
+  fRuns.ReplaceElementsAt(run, 1, pieces.Elements(), pieces.Length());
+  MergeRuns(run, run + pieces.Length());
+}
+
+void nsImapFlagAndUidState::MergeRuns(size_t first, size_t last) {
+  if (fRuns.IsEmpty()) return;
+  first = std::max<size_t>(first, 1);
+  last = std::min(last, fRuns.Length() - 1);
+  for (size_t i = last + 1; i-- > first;) {
+    if (RunUid(fRuns[i - 1], fRuns[i].mIndex) == fRuns[i].mUid)
+      fRuns.RemoveElementAt(i);
+  }
+}
+
+void nsImapFlagAndUidState::CountFlags(imapMessageFlagsType flags,
+                                       int32_t delta) {
+  if (flags & kImapMsgDeletedFlag) fNumberDeleted += delta;
+  if (flags & kImapMsgRecentFlag) fNumberRecent += delta;
+}
+
 NS_IMETHODIMP nsImapFlagAndUidState::GetNumberOfDeletedMessages(
     int32_t *numDeletedMessages) {
   NS_ENSURE_ARG_POINTER(numDeletedMessages);
@@ -191,19 +380,22 @@ NS_IMETHODIMP nsImapFlagAndUidState::GetNumberOfDeletedMessages(
 }
 
 int32_t nsImapFlagAndUidState::NumberOfDeletedMessages() {
+  MutexAutoLock mon(mLock);
   return fNumberDeleted;
 }
 
 // since the uids are sorted, start from the back (rb)
 
 uint32_t nsImapFlagAndUidState::GetHighestNonDeletedUID() {
-  uint32_t msgIndex = fUids.Length();
-  do {
-    if (msgIndex <= 0) return (0);
-    msgIndex--;
-    if (fUids[msgIndex] && !(fFlags[msgIndex] & kImapMsgDeletedFlag))
-      return fUids[msgIndex];
-  } while (msgIndex > 0);
+  MutexAutoLock mon(mLock);
+  for (size_t run = fRuns.Length(); run-- > 0;) {
+    const UidRun &current = fRuns[run];
+    if (!current.mUid) continue;
+    for (uint32_t msgIndex = RunEnd(run); msgIndex-- > current.mIndex;) {
+      if (!(fFlags[msgIndex] & kImapMsgDeletedFlag))
+        return RunUid(current, msgIndex);
+    }
+  }
   return 0;
 }
 
@@ -211,29 +403,47 @@ uint32_t nsImapFlagAndUidState::GetHighestNonDeletedUID() {
 // to see if there really is new mail there.
 
 bool nsImapFlagAndUidState::IsLastMessageUnseen() {
-  uint32_t msgIndex = fUids.Length();
-
-  if (msgIndex <= 0) return false;
-  msgIndex--;
+  MutexAutoLock mon(mLock);
+  if (fFlags.IsEmpty()) return false;
   // if last message is deleted, it was probably filtered the last time around
-  if (fUids[msgIndex] &&
-      (fFlags[msgIndex] & (kImapMsgSeenFlag | kImapMsgDeletedFlag)))
+  if (fRuns.LastElement().mUid &&
+      (fFlags.LastElement() & (kImapMsgSeenFlag | kImapMsgDeletedFlag)))
     return false;
   return true;
 }
 
-// find a message flag given a key with non-recursive binary search, since some
-// folders may have thousand of messages, once we find the key set its index, or
-// the index of where the key should be inserted
+// find a message flag given a key with non-recursive binary search over the
+// runs, since some folders may have millions of messages, once we find the
+// key set its index, or the index of the last message before where the key
+// would be
 
 imapMessageFlagsType nsImapFlagAndUidState::GetMessageFlagsFromUID(
     uint32_t uid, bool *foundIt, int32_t *ndx) {
-  PR_CEnterMonitor(this);
-  *ndx = (int32_t)fUids.IndexOfFirstElementGt(uid) - 1;
-  *foundIt = *ndx >= 0 && fUids[*ndx] == uid;
-  imapMessageFlagsType retFlags = (*foundIt) ? fFlags[*ndx] : kNoImapMsgFlag;
-  PR_CExitMonitor(this);
-  return retFlags;
+  MutexAutoLock mon(mLock);
+  size_t low = 0;
+  size_t high = fRuns.Length();
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (RunSortUid(middle) <= uid)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  *foundIt = false;
+  *ndx = -1;
+  if (low) {
+    size_t run = low - 1;
+    const UidRun &current = fRuns[run];
+    uint32_t end = RunEnd(run);
+    if (current.mUid) {
+      uint32_t offset = uid - current.mUid;
+      *foundIt = offset < end - current.mIndex;
+      *ndx = *foundIt ? current.mIndex + offset : end - 1;
+    } else {
+      *ndx = (int32_t)current.mIndex - 1;
+    }
+  }
+  return (*foundIt) ? fFlags[*ndx] : kNoImapMsgFlag;
 }
 
 NS_IMETHODIMP nsImapFlagAndUidState::AddUidCustomFlagPair(
@@ -242,8 +452,9 @@ NS_IMETHODIMP nsImapFlagAndUidState::AddUidCustomFlagPair(
 
   MutexAutoLock mon(mLock);
   nsCString ourCustomFlags;
-  nsCString oldValue;
-  if (m_customFlagsHash.Get(uid, &oldValue)) {
+  uint32_t oldIndex;
+  if (m_customFlagsHash.Get(uid, &oldIndex)) {
+    const nsCString &oldValue = m_keywordSets[oldIndex];
     // We'll store multiple keys as space-delimited since space is not
     // a valid character in a keyword. First, we need to look for the
     // customFlag in the existing flags;
@@ -266,20 +477,29 @@ NS_IMETHODIMP nsImapFlagAndUidState::AddUidCustomFlagPair(
     ourCustomFlags.Assign(oldValue);
     ourCustomFlags.Append(' ');
     ourCustomFlags.Append(customFlag);
-    m_customFlagsHash.Remove(uid);
   } else {
     ourCustomFlags.Assign(customFlag);
   }
-  m_customFlagsHash.Put(uid, ourCustomFlags);
+  m_customFlagsHash.Put(uid, InternKeywords(ourCustomFlags));
   return NS_OK;
 }
 
+uint32_t nsImapFlagAndUidState::InternKeywords(const nsACString &keywords) {
+  uint32_t index;
+  if (!m_keywordSetIndexes.Get(keywords, &index)) {
+    index = m_keywordSets.Length();
+    m_keywordSets.AppendElement(keywords);
+    m_keywordSetIndexes.Put(keywords, index);
+  }
+  return index;
+}
+
 NS_IMETHODIMP nsImapFlagAndUidState::GetCustomFlags(uint32_t uid,
                                                     char **customFlags) {
   MutexAutoLock mon(mLock);
-  nsCString value;
-  if (m_customFlagsHash.Get(uid, &value)) {
-    *customFlags = NS_xstrdup(value.get());
+  uint32_t index;
+  if (m_customFlagsHash.Get(uid, &index)) {
+    *customFlags = NS_xstrdup(m_keywordSets[index].get());
     return (*customFlags) ? NS_OK : NS_ERROR_FAILURE;
   }
   *customFlags = nullptr;
@@ -40,19 +40,64 @@ class nsImapFlagAndUidState : public nsIImapFlagAndUidState {
  private:
   virtual ~nsImapFlagAndUidState();
 
-  nsTArray<nsMsgKey> fUids;
+  // The messages from mIndex up to the start of the next run (or the end)
+  // have consecutive uids starting at mUid. A run with a zero mUid covers
+  // messages a partial fetch didn't report, whose uids we don't know.
+  struct UidRun {
+    uint32_t mIndex;
+    uint32_t mUid;
+  };
+  // A run of uids reported by a VANISHED response.
+  struct UidRange {
+    uint32_t mFirst;
+    uint32_t mLast;
+  };
+
+  // All of these expect mLock to be held.
+  static void AppendRun(nsTArray<UidRun> &runs, uint32_t index, uint32_t uid);
+  // The index of the run holding the message at index.
+  size_t FindRun(uint32_t index);
+  // The first index after the run at runIndex.
+  uint32_t RunEnd(size_t runIndex);
+  // The uid the run would give the message at index.
+  static uint32_t RunUid(const UidRun &run, uint32_t index);
+  // The uid a run is sorted by: a run of unknown uids sorts right after the
+  // run before it.
+  uint32_t RunSortUid(size_t runIndex);
+  void SetUidAt(uint32_t index, uint32_t uid);
+  // Merges the runs from first to last into their predecessors where the
+  // uids carry on.
+  void MergeRuns(size_t first, size_t last);
+  void CountFlags(imapMessageFlagsType flags, int32_t delta);
+  uint32_t InternKeywords(const nsACString &keywords);
+  // The index of the first vanished range that ends at or after uid.
+  size_t FindVanishedRange(uint32_t uid);
+
+  // Sorted by index and, for the runs with known uids, by uid. Mailboxes
+  // mostly hold long stretches of consecutive uids, so this is much smaller
+  // than a uid per message, and is never empty if there are messages.
+  nsTArray<UidRun> fRuns;
+  // One per message, which is also how we count the messages.
   nsTArray<imapMessageFlagsType> fFlags;
-  // Hash table, mapping uids to extra flags
-  nsDataHashtable<nsUint32HashKey, nsCString> m_customFlagsHash;
+  // Maps uids to an index in m_keywordSets.
+  nsDataHashtable<nsUint32HashKey, uint32_t> m_customFlagsHash;
+  // The distinct space-separated keyword lists, which most messages share,
+  // and their indexes.
+  nsTArray<nsCString> m_keywordSets;
+  nsDataHashtable<nsCStringHashKey, uint32_t> m_keywordSetIndexes;
   // Hash table, mapping UID+customAttributeName to customAttributeValue.
   nsDataHashtable<nsCStringHashKey, nsCString> m_customAttributesHash;
   uint16_t fSupportedUserFlags;
   int32_t fNumberDeleted;
+  int32_t fNumberRecent;
   bool fPartialUIDFetch;
   uint32_t fNumAdded;
   bool fStartCapture;
+  // Sorted, disjoint and not adjacent.
+  nsTArray<UidRange> fVanished;
   // Keywords (aka, tags) in FLAGS response to SELECT defined by other clients
   nsTArray<nsCString> fOtherKeywords;
+  // Guards the messages and their keywords.
   mozilla::Mutex mLock;
 };
 
@@ -44,6 +44,8 @@
 
 using namespace mozilla;
 
+extern LazyLogModule IMAP;  // defined in nsImapProtocol.cpp
+
 // Despite its name, this contains a folder path, for example INBOX/Trash.
 #define PREF_TRASH_FOLDER_PATH "trash_folder_name"
 #define DEFAULT_TRASH_FOLDER_PATH "Trash"  // XXX Is this a useful default?
@@ -427,9 +429,7 @@ nsImapIncomingServer::GetImapConnectionAndLoadUrl(nsIImapUrl *aImapUrl,
             // queue
     nsImapProtocol::LogImapUrl("queuing url", aImapUrl);
     PR_CEnterMonitor(this);
-    m_urlQueue.AppendObject(aImapUrl);
-    m_urlConsumers.AppendElement(aConsumer);
-    NS_IF_ADDREF(aConsumer);
+    QueueUrl(aImapUrl, aConsumer);
     PR_CExitMonitor(this);
     // let's try running it now - maybe the connection is free now.
     bool urlRun;
@@ -453,8 +453,7 @@ nsImapIncomingServer::SuspendUrl(nsIImapUrl *aImapUrl) {
   NS_ENSURE_ARG_POINTER(aImapUrl);
   nsImapProtocol::LogImapUrl("suspending url", aImapUrl);
   PR_CEnterMonitor(this);
-  m_urlQueue.AppendObject(aImapUrl);
-  m_urlConsumers.AppendElement(nullptr);
+  QueueUrl(aImapUrl, nullptr);
   PR_CExitMonitor(this);
   return NS_OK;
 }
@@ -482,9 +481,76 @@ nsImapIncomingServer::RetryUrl(nsIImapUrl *aImapUrl,
   return rv;
 }
 
+// Queues a url that can't run yet. Urls the user is waiting for go ahead of
+// background ones (biff, auto sync), but never ahead of a url for the same
+// folder, so the urls for a folder still run in the order they came in.
+void nsImapIncomingServer::QueueUrl(nsIImapUrl *aImapUrl,
+                                    nsISupports *aConsumer) {
+  int32_t index = m_urlQueue.Count();
+  if (!IsBackgroundUrl(aImapUrl)) {
+    nsCOMPtr<nsIMsgFolder> folder;
+    nsCOMPtr<nsIMsgMailNewsUrl> mailnewsUrl = do_QueryInterface(aImapUrl);
+    if (mailnewsUrl) mailnewsUrl->GetFolder(getter_AddRefs(folder));
+    while (index > 0 && IsBackgroundUrl(m_urlQueue[index - 1])) {
+      nsCOMPtr<nsIMsgFolder> queuedFolder;
+      nsCOMPtr<nsIMsgMailNewsUrl> queuedUrl =
+          do_QueryInterface(m_urlQueue[index - 1]);
+      if (queuedUrl) queuedUrl->GetFolder(getter_AddRefs(queuedFolder));
+      if (folder && folder == queuedFolder) break;
+      index--;
+    }
+  }
+  m_urlQueue.InsertObjectAt(aImapUrl, index);
+  m_urlConsumers.InsertElementAt(index, aConsumer);
+  NS_IF_ADDREF(aConsumer);
+  m_urlQueueTimes.InsertElementAt(index, PR_Now());
+  MOZ_LOG(IMAP, LogLevel::Info,
+          ("queued url at position %d, %d urls queued", index,
+           m_urlQueue.Count()));
+}
+
+void nsImapIncomingServer::RemoveQueuedUrlAt(int32_t aIndex) {
+  m_urlQueue.RemoveObjectAt(aIndex);
+  m_urlConsumers.RemoveElementAt(aIndex);
+  m_urlQueueTimes.RemoveElementAt(aIndex);
+}
+
+// A background url is one nobody is looking at: it has no window, and its
+// folder isn't shown in one.
+bool nsImapIncomingServer::IsBackgroundUrl(nsIImapUrl *aImapUrl) {
+  nsCOMPtr<nsIMsgMailNewsUrl> mailnewsUrl = do_QueryInterface(aImapUrl);
+  if (!mailnewsUrl) return false;
+
+  nsCOMPtr<nsIMsgWindow> msgWindow;
+  mailnewsUrl->GetMsgWindow(getter_AddRefs(msgWindow));
+  if (msgWindow) return false;
+
+  nsCOMPtr<nsIMsgFolder> folder;
+  mailnewsUrl->GetFolder(getter_AddRefs(folder));
+  if (!folder) return true;
+  bool folderOpen = false;
+  nsCOMPtr<nsIMsgMailSession> session =
+      do_GetService(NS_MSGMAILSESSION_CONTRACTID);
+  if (session) session->IsFolderOpenInWindow(folder, &folderOpen);
+  return !folderOpen;
+}
+
+bool nsImapIncomingServer::IsMailboxWantedByQueuedUrl(
+    const nsACString &aMailboxName) {
+  for (int32_t i = 0; i < m_urlQueue.Count(); i++) {
+    nsCString folderName;
+    m_urlQueue[i]->CreateServerSourceFolderPathString(
+        getter_Copies(folderName));
+    if (folderName.Equals(aMailboxName)) return true;
+  }
+  return false;
+}
+
 // checks to see if there are any queued urls on this incoming server,
-// and if so, tries to run the oldest one. Returns true if the url is run
-// on the passed in protocol connection.
+// and if so, tries to run the oldest one that can run. A url waiting for a
+// busy connection that has its folder selected doesn't hold up the urls
+// behind it. Returns true if the url is run on the passed in protocol
+// connection.
 NS_IMETHODIMP
 nsImapIncomingServer::LoadNextQueuedUrl(nsIImapProtocol *aProtocol,
                                         bool *aResult) {
@@ -496,10 +562,10 @@ nsImapIncomingServer::LoadNextQueuedUrl(nsIImapProtocol *aProtocol,
   nsCOMPtr<nsIImapProtocol> protocolInstance;
 
   MutexAutoLock mon(mLock);
-  int32_t cnt = m_urlQueue.Count();
+  int32_t index = 0;
 
-  while (cnt > 0 && !urlRun && keepGoing) {
-    nsCOMPtr<nsIImapUrl> aImapUrl(m_urlQueue[0]);
+  while (index < m_urlQueue.Count() && !urlRun && keepGoing) {
+    nsCOMPtr<nsIImapUrl> aImapUrl(m_urlQueue[index]);
 
     bool removeUrlFromQueue = false;
     if (aImapUrl) {
@@ -508,16 +574,23 @@ nsImapIncomingServer::LoadNextQueuedUrl(nsIImapProtocol *aProtocol,
       NS_ENSURE_SUCCESS(rv, rv);
       // if we didn't doom the url, lets run it.
       if (!removeUrlFromQueue) {
-        nsISupports *aConsumer = m_urlConsumers.ElementAt(0);
+        nsISupports *aConsumer = m_urlConsumers.ElementAt(index);
         NS_IF_ADDREF(aConsumer);
 
         nsImapProtocol::LogImapUrl(
             "creating protocol instance to play queued url", aImapUrl);
-        rv = GetImapConnection(aImapUrl, getter_AddRefs(protocolInstance));
+        bool waitingForFolder = false;
+        rv = GetImapConnection(aImapUrl, getter_AddRefs(protocolInstance),
+                               &waitingForFolder);
         if (NS_SUCCEEDED(rv) && protocolInstance) {
           nsCOMPtr<nsIURI> url = do_QueryInterface(aImapUrl, &rv);
           if (NS_SUCCEEDED(rv) && url) {
             nsImapProtocol::LogImapUrl("playing queued url", aImapUrl);
+            MOZ_LOG(IMAP, LogLevel::Info,
+                    ("queued url waited %d ms, %d urls queued",
+                     int32_t((PR_Now() - m_urlQueueTimes[index]) /
+                             PR_USEC_PER_MSEC),
+                     m_urlQueue.Count() - 1));
             rv = protocolInstance->LoadImapUrl(url, aConsumer);
             NS_ASSERTION(NS_SUCCEEDED(rv), "failed running queued url");
             bool isInbox;
@@ -526,6 +599,11 @@ nsImapIncomingServer::LoadNextQueuedUrl(nsIImapProtocol *aProtocol,
               nsImapProtocol::LogImapUrl("didn't need to run", aImapUrl);
             removeUrlFromQueue = true;
           }
+        } else if (NS_SUCCEEDED(rv) && waitingForFolder) {
+          // leave it for the connection busy in its folder, and see if a
+          // later url can run on another connection.
+          nsImapProtocol::LogImapUrl("queued url waiting for its folder",
+                                     aImapUrl);
         } else {
           nsImapProtocol::LogImapUrl(
               "failed creating protocol instance to play queued url", aImapUrl);
@@ -533,12 +611,11 @@ nsImapIncomingServer::LoadNextQueuedUrl(nsIImapProtocol *aProtocol,
         }
         NS_IF_RELEASE(aConsumer);
       }
-      if (removeUrlFromQueue) {
-        m_urlQueue.RemoveObjectAt(0);
-        m_urlConsumers.RemoveElementAt(0);
-      }
     }
-    cnt = m_urlQueue.Count();
+    if (removeUrlFromQueue)
+      RemoveQueuedUrlAt(index);
+    else
+      index++;
   }
   if (aResult) *aResult = urlRun && aProtocol && aProtocol == protocolInstance;
 
@@ -559,10 +636,7 @@ nsImapIncomingServer::AbortQueuedUrls() {
     if (aImapUrl) {
       rv = DoomUrlIfChannelHasError(aImapUrl, &removeUrlFromQueue);
       NS_ENSURE_SUCCESS(rv, rv);
-      if (removeUrlFromQueue) {
-        m_urlQueue.RemoveObjectAt(cnt - 1);
-        m_urlConsumers.RemoveElementAt(cnt - 1);
-      }
+      if (removeUrlFromQueue) RemoveQueuedUrlAt(cnt - 1);
     }
     cnt--;
   }
@@ -639,15 +713,26 @@ bool nsImapIncomingServer::ConnectionTimeOut(nsIImapProtocol *aConnection) {
   return retVal;
 }
 
+// If no connection can run the url, sets aWaitingForFolder when that's
+// because a busy connection has its folder selected, rather than because
+// all the connections are in use.
 nsresult nsImapIncomingServer::GetImapConnection(
-    nsIImapUrl *aImapUrl, nsIImapProtocol **aImapConnection) {
+    nsIImapUrl *aImapUrl, nsIImapProtocol **aImapConnection,
+    bool *aWaitingForFolder) {
   NS_ENSURE_ARG_POINTER(aImapUrl);
 
+  // How good a free connection is for running a url that needs a new
+  // folder selected: best is one in the authenticated state, then one whose
+  // selected folder no queued url wants, so the queued urls can still use
+  // that selection.
+  enum { kNotSelected, kSelectedUnwanted, kSelectedWanted };
+
   nsresult rv = NS_OK;
   bool canRunUrlImmediately = false;
   bool canRunButBusy = false;
   nsCOMPtr<nsIImapProtocol> connection;
   nsCOMPtr<nsIImapProtocol> freeConnection;
+  int32_t freeConnectionRank = kNotSelected;
   bool isBusy = false;
   bool isInboxConnection = false;
 
@@ -710,13 +795,17 @@ nsresult nsImapIncomingServer::GetImapConnection(
       if (NS_FAILED(rv)) continue;
       // if max connections is <= 1, we have to re-use the inbox connection.
       if (!isBusy && (!isInboxConnection || maxConnections <= 1)) {
-        if (!freeConnection)
+        // check which is the better free connection to use.
+        nsAutoCString selectedFolderName;
+        connection->GetSelectedMailboxName(getter_Copies(selectedFolderName));
+        int32_t rank = kNotSelected;
+        if (!selectedFolderName.IsEmpty())
+          rank = IsMailboxWantedByQueuedUrl(selectedFolderName)
+                     ? kSelectedWanted
+                     : kSelectedUnwanted;
+        if (!freeConnection || rank < freeConnectionRank) {
           freeConnection = connection;
-        else  // check which is the better free connection to use.
-        {     // We prefer one not in the selected state.
-          nsAutoCString selectedFolderName;
-          connection->GetSelectedMailboxName(getter_Copies(selectedFolderName));
-          if (selectedFolderName.IsEmpty()) freeConnection = connection;
+          freeConnectionRank = rank;
         }
       }
     }
@@ -743,7 +832,7 @@ nsresult nsImapIncomingServer::GetImapConnection(
   // connections for these types of urls if we have a free connection. So we
   // check the actual required state here.
   else if (cnt < maxConnections &&
-           (!freeConnection ||
+           (!freeConnection || freeConnectionRank == kSelectedWanted ||
             requiredState == nsIImapUrl::nsImapSelectedState))
     rv = CreateProtocolInstance(aImapConnection);
   else if (freeConnection) {
@@ -754,6 +843,7 @@ nsresult nsImapIncomingServer::GetImapConnection(
       nsImapProtocol::LogImapUrl("exceeded connection cache limit", aImapUrl);
     // caller will queue the url
   }
+  if (aWaitingForFolder) *aWaitingForFolder = canRunButBusy;
 
   PR_CExitMonitor(this);
   return rv;
@@ -2200,14 +2290,13 @@ nsImapIncomingServer::OnStopRunningUrl(nsIURI *url, nsresult exitCode) {
             msgFolder->SetMsgDatabase(nullptr);
           nsCOMPtr<nsIMsgImapMailFolder> imapFolder =
               do_QueryInterface(msgFolder);
-          m_foldersToStat.RemoveObject(imapFolder);
+          m_foldersBeingStatted.RemoveObject(imapFolder);
         }
         // if we get an error running the url, it's better
         // not to chain the next url.
         if (NS_FAILED(exitCode) && exitCode != NS_MSG_ERROR_IMAP_COMMAND_FAILED)
           m_foldersToStat.Clear();
-        if (m_foldersToStat.Count() > 0)
-          m_foldersToStat[0]->UpdateStatus(this, nullptr);
+        StatNextFolders();
         break;
       }
       default:
@@ -2804,7 +2893,8 @@ nsImapIncomingServer::GetNewMessagesForNonInboxFolders(nsIMsgFolder *aFolder,
       gGotStatusPref = true;
     }
     if (gUseStatus && !isOpen) {
-      if (!isServer && m_foldersToStat.IndexOf(imapFolder) == -1)
+      if (!isServer && m_foldersToStat.IndexOf(imapFolder) == -1 &&
+          m_foldersBeingStatted.IndexOf(imapFolder) == -1)
         m_foldersToStat.AppendObject(imapFolder);
     } else
       aFolder->UpdateFolder(aWindow);
@@ -2828,11 +2918,26 @@ nsImapIncomingServer::GetNewMessagesForNonInboxFolders(nsIMsgFolder *aFolder,
     GetNewMessagesForNonInboxFolders(msgFolder, aWindow, forceAllFolders,
                                      performingBiff);
   }
-  if (isServer && m_foldersToStat.Count() > 0)
-    m_foldersToStat[0]->UpdateStatus(this, nullptr);
+  if (isServer) StatNextFolders();
   return NS_OK;
 }
 
+// Runs Status urls for the folders waiting to be checked for new mail, on as
+// many connections as we may open but one, which is left for the user.
+void nsImapIncomingServer::StatNextFolders() {
+  int32_t maxConnections;
+  (void)GetMaximumConnectionsNumber(&maxConnections);
+  int32_t maxStatting = maxConnections > 1 ? maxConnections - 1 : 1;
+  while (m_foldersToStat.Count() > 0 &&
+         m_foldersBeingStatted.Count() < maxStatting) {
+    nsCOMPtr<nsIMsgImapMailFolder> imapFolder(m_foldersToStat[0]);
+    m_foldersToStat.RemoveObjectAt(0);
+    m_foldersBeingStatted.AppendObject(imapFolder);
+    if (NS_FAILED(imapFolder->UpdateStatus(this, nullptr)))
+      m_foldersBeingStatted.RemoveObject(imapFolder);
+  }
+}
+
 NS_IMETHODIMP
 nsImapIncomingServer::GetArbitraryHeaders(nsACString &aResult) {
   nsCOMPtr<nsIMsgFilterList> filterList;
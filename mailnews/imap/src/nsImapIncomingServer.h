@@ -93,12 +93,19 @@ class nsImapIncomingServer : public nsMsgIncomingServer,
  private:
   nsresult SubscribeToFolder(const char16_t *aName, bool subscribe);
   nsresult GetImapConnection(nsIImapUrl *aImapUrl,
-                             nsIImapProtocol **aImapConnection);
+                             nsIImapProtocol **aImapConnection,
+                             bool *aWaitingForFolder = nullptr);
   nsresult CreateProtocolInstance(nsIImapProtocol **aImapConnection);
   nsresult CreateHostSpecificPrefName(const char *prefPrefix,
                                       nsAutoCString &prefName);
 
   nsresult DoomUrlIfChannelHasError(nsIImapUrl *aImapUrl, bool *urlDoomed);
+  // url queue scheduling
+  void QueueUrl(nsIImapUrl *aImapUrl, nsISupports *aConsumer);
+  void RemoveQueuedUrlAt(int32_t aIndex);
+  bool IsBackgroundUrl(nsIImapUrl *aImapUrl);
+  bool IsMailboxWantedByQueuedUrl(const nsACString &aMailboxName);
+  void StatNextFolders();
   bool ConnectionTimeOut(nsIImapProtocol *aImapConnection);
   nsresult GetFormattedStringFromName(const nsAString &aValue,
                                       const char *aName, nsAString &aResult);
@@ -114,7 +121,10 @@ class nsImapIncomingServer : public nsMsgIncomingServer,
                            // subscribe UI is up.
   nsCOMArray<nsIMsgImapMailFolder>
       m_foldersToStat;  // folders to check for new mail with Status
+  nsCOMArray<nsIMsgImapMailFolder>
+      m_foldersBeingStatted;  // folders whose Status url is running
   nsTArray<nsISupports *> m_urlConsumers;
+  nsTArray<PRTime> m_urlQueueTimes;  // when each queued url was queued
   eIMAPCapabilityFlags m_capability;
   nsCString m_manageMailAccountUrl;
   bool m_userAuthenticated;
@@ -1533,6 +1533,7 @@ NS_IMETHODIMP nsImapMailFolder::RenameLocal(const nsACString &newName,
 
   nsAutoCString newNameStr;
   oldSummaryFile->Remove(false);
+  RemoveSummaryIndexFile(oldSummaryFile);
   if (count > 0) {
     newNameStr = leafname;
     NS_MsgHashIfNecessary(newNameStr);
@@ -2480,7 +2481,10 @@ NS_IMETHODIMP nsImapMailFolder::UpdateImapMailboxInfo(
     nsCOMPtr<nsIFile> summaryFile;
     rv = GetSummaryFileLocation(pathFile, getter_AddRefs(summaryFile));
     // Remove summary file.
-    if (NS_SUCCEEDED(rv) && summaryFile) summaryFile->Remove(false);
+    if (NS_SUCCEEDED(rv) && summaryFile) {
+      summaryFile->Remove(false);
+      RemoveSummaryIndexFile(summaryFile);
+    }
 
     // Create a new summary file, update the folder message counts, and
     // Close the summary file db.
@@ -3918,9 +3922,18 @@ void nsImapMailFolder::FindKeysToDelete(const nsTArray<nsMsgKey> &existingKeys,
   flagState->GetPartialUIDFetch(&partialUIDFetch);
 
   // if we're doing a partialUIDFetch, just delete the keys from the db
-  // that have the deleted flag set (if not using imap delete model)
-  // and return.
+  // that the server said vanished, and the ones that have the deleted flag
+  // set (if not using imap delete model), and return.
   if (partialUIDFetch) {
+    bool hasVanished = false;
+    flagState->GetHasVanishedMessages(&hasVanished);
+    if (hasVanished) {
+      for (nsMsgKey key : existingKeys) {
+        bool vanished = false;
+        flagState->IsVanished(key, &vanished);
+        if (vanished) keysToDelete.AppendElement(key);
+      }
+    }
     if (!showDeletedMessages) {
       for (uint32_t i = 0; (int32_t)i < numMessageInFlagState; i++) {
         flagState->GetUidOfMessage(i, &uidOfMessage);
@@ -3931,10 +3944,11 @@ void nsImapMailFolder::FindKeysToDelete(const nsTArray<nsMsgKey> &existingKeys,
             keysToDelete.AppendElement(uidOfMessage);
         }
       }
-    } else if (boxFlags & kJustExpunged) {
+    } else if ((boxFlags & kJustExpunged) && !hasVanished) {
       // we've just issued an expunge with a partial flag state. We should
       // delete headers with the imap deleted flag set, because we can't
-      // tell from the expunge response which messages were deleted.
+      // tell from the expunge response which messages were deleted
+      // (a VANISHED response would have told us).
       nsCOMPtr<nsISimpleEnumerator> hdrs;
       nsresult rv = GetMessages(getter_AddRefs(hdrs));
       NS_ENSURE_SUCCESS_VOID(rv);
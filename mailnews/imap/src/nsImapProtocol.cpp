@@ -223,13 +223,18 @@ bool nsMsgImapLineDownloadCache::CacheEmpty() { return m_bufferPos == 0; }
 
 NS_IMETHODIMP nsMsgImapLineDownloadCache::CacheLine(const char *line,
                                                     uint32_t uid) {
-  NS_ASSERTION((PL_strlen(line) + 1) <= SpaceAvailable(),
+  CacheLine(line, PL_strlen(line), uid);
+  return NS_OK;
+}
+
+void nsMsgImapLineDownloadCache::CacheLine(const char *line,
+                                           uint32_t lineLength, uint32_t uid) {
+  NS_ASSERTION(lineLength + 1 <= SpaceAvailable(),
                "Oops... line length greater than space available");
 
   fLineInfo->uidOfMessage = uid;
 
-  AppendString(line);
-  return NS_OK;
+  AppendBuffer(line, lineLength);
 }
 
 /* attribute nsMsgKey msgUid; */
@@ -289,6 +294,7 @@ static bool gHideUnusedNamespaces = true;
 static bool gHideOtherUsersFromList = false;
 static bool gUseEnvelopeCmd = false;
 static bool gUseLiteralPlus = true;
+static bool gUseBinaryFetch = true;
 static bool gExpungeAfterDelete = false;
 static bool gCheckDeletedBeforeExpunge = false;  // bug 235004
 static int32_t gResponseTimeout = 60;
@@ -306,6 +312,12 @@ static const int32_t kAutoExpungeAlways = 1;
 static const int32_t kAutoExpungeOnThreshold = 2;
 static int32_t gExpungeOption = kAutoExpungeDeleteModel;
 static int32_t gExpungeThreshold = 20;
+// most header fetch commands we'll have outstanding at once; 1 means don't
+// pipeline them.
+static int32_t gMaxHdrFetchesInFlight = 8;
+// most headers a pipelined fetch command asks for, so that a run of uids
+// still becomes several commands.
+static const uint32_t kMaxHdrsPerFetch = 100;
 
 const int32_t kAppBufSize = 100;
 // can't use static nsCString because it shows up as a leak.
@@ -333,6 +345,7 @@ nsresult nsImapProtocol::GlobalInitialization(nsIPrefBranch *aPrefBranch) {
                           &gPromoteNoopToCheckCount);
   aPrefBranch->GetBoolPref("mail.imap.use_envelope_cmd", &gUseEnvelopeCmd);
   aPrefBranch->GetBoolPref("mail.imap.use_literal_plus", &gUseLiteralPlus);
+  aPrefBranch->GetBoolPref("mail.imap.use_binary_fetch", &gUseBinaryFetch);
   aPrefBranch->GetBoolPref("mail.imap.expunge_after_delete",
                            &gExpungeAfterDelete);
   aPrefBranch->GetBoolPref("mail.imap.check_deleted_before_expunge",
@@ -340,6 +353,8 @@ nsresult nsImapProtocol::GlobalInitialization(nsIPrefBranch *aPrefBranch) {
   aPrefBranch->GetIntPref("mail.imap.expunge_option", &gExpungeOption);
   aPrefBranch->GetIntPref("mail.imap.expunge_threshold_number",
                           &gExpungeThreshold);
+  aPrefBranch->GetIntPref("mail.imap.max_pipelined_hdr_fetches",
+                          &gMaxHdrFetchesInFlight);
   aPrefBranch->GetIntPref("mailnews.tcptimeout", &gResponseTimeout);
   aPrefBranch->GetCharPref("mail.imap.force_select_detect", gForceSelectDetect);
   ParseString(gForceSelectDetect, ';', gForceSelectServersArray);
@@ -458,6 +473,7 @@ nsImapProtocol::nsImapProtocol()
       m_waitForBodyIdsMonitor("imapWaitForBodyIds"),
       m_fetchBodyListMonitor("imapFetchBodyList"),
       m_passwordReadyMonitor("imapPasswordReady"),
+      m_hdrParseMonitor("imapHdrParse"),
       mLock("nsImapProtocol.mLock"),
       m_parser(*this) {
   m_urlInProgress = false;
@@ -465,6 +481,7 @@ nsImapProtocol::nsImapProtocol()
   m_retryUrlOnError = false;
   m_useIdle = true;  // by default, use it
   m_useCondStore = true;
+  m_selectedWithQResync = false;
   m_useCompressDeflate = true;
   m_ignoreExpunges = false;
   m_prefAuthMethods = kCapabilityUndefined;
@@ -554,6 +571,9 @@ nsImapProtocol::nsImapProtocol()
   m_chunkSize = 0;
   m_chunkThreshold = 0;
   m_fromHeaderSeen = false;
+  m_canonicalLineEnding = true;
+  m_downloadPendingCRs = 0;
+  m_downloadInLine = false;
   m_closeNeededBeforeSelect = false;
   m_needNoop = false;
   m_noopCount = 0;
@@ -581,6 +601,11 @@ nsImapProtocol::nsImapProtocol()
   // since these are embedded in the nsImapProtocol object, but passed
   // through proxied xpcom methods, just AddRef them here.
   m_hdrDownloadCache = new nsMsgImapHdrXferInfo();
+  m_hdrParseCache = new nsMsgImapHdrXferInfo();
+  m_hdrParsePending = false;
+  m_hdrFetchWindow = 2;
+  m_hdrFetchLatency = 0;
+  m_hdrFetchTransfer = 0;
   m_downloadLineCache = new nsMsgImapLineDownloadCache();
 
   // subscription
@@ -1237,6 +1262,11 @@ nsImapProtocol::TellThreadToDie(bool aIsSafeToClose) {
     m_safeToCloseConnection = aIsSafeToClose;
     m_threadShouldDie = true;
   }
+  {
+    // don't leave the thread waiting for headers the main thread parses.
+    ReentrantMonitorAutoEnter parseMon(m_hdrParseMonitor);
+    parseMon.Notify();
+  }
   ReentrantMonitorAutoEnter readyMon(m_urlReadyToRunMonitor);
   m_nextUrlReadyToRun = true;
   readyMon.Notify();
@@ -1600,6 +1630,7 @@ bool nsImapProtocol::ProcessCurrentURL() {
   m_runningUrl->GetExternalLinkUrl(&isExternalUrl);
   m_runningUrl->GetValidUrl(&validUrl);
   m_runningUrl->GetImapAction(&m_imapAction);
+  m_canonicalLineEnding = true;
 
   if (isExternalUrl) {
     if (m_imapAction == nsIImapUrl::nsImapSelectFolder) {
@@ -2436,8 +2467,7 @@ void nsImapProtocol::ProcessSelectedStateURL() {
       {
         nsTArray<nsMsgKey> msgIdList;
         bool more;
-        m_imapMailFolderSink->GetMsgHdrsToDownload(
-            &more, &m_progressExpectedNumber, msgIdList);
+        GetMsgHdrsToDownload(&more, msgIdList);
         if (msgIdList.Length() > 0) {
           FolderHeaderDump(msgIdList.Elements(), msgIdList.Length());
           m_runningUrl->SetMoreHeadersToDownload(more);
@@ -3088,6 +3118,15 @@ nsresult nsImapProtocol::BeginMessageDownLoad(
   // transformations
   m_bytesToChannel = 0;
 
+  // normalize line endings to CRLF unless we are saving the message to disk
+  m_canonicalLineEnding = true;
+  nsCOMPtr<nsIMsgMessageUrl> msgUrl = do_QueryInterface(m_runningUrl);
+  if (m_imapAction == nsIImapUrl::nsImapSaveMessageToDisk && msgUrl)
+    msgUrl->GetCanonicalLineEnding(&m_canonicalLineEnding);
+  m_downloadPendingCRs = 0;
+  m_downloadInLine = false;
+  m_heldPartHeader.Truncate();
+
   if (content_type) {
     m_fromHeaderSeen = false;
     if (GetServerStateParser().GetDownloadingHeaders()) {
@@ -3214,13 +3253,34 @@ void nsImapProtocol::SelectMailbox(const char *mailboxName) {
   commandBuffer.AppendLiteral(" select \"");
   commandBuffer.Append(escapedName.get());
   commandBuffer.Append('"');
-  if (UseCondStore()) commandBuffer.AppendLiteral(" (CONDSTORE)");
+  // If we know the folder's state from an earlier session, ask for the
+  // changes since then (RFC 7162), so the server sends the flags that changed
+  // and the uids that vanished rather than us fetching all the flags.
+  bool qresync = UseQResync() && GetServerStateParser().fQResyncEnabled &&
+                 mFolderLastModSeq && m_uidValidity != kUidUnknown &&
+                 m_uidValidity;
+  if (qresync) {
+    commandBuffer.AppendLiteral(" (QRESYNC (");
+    commandBuffer.AppendInt((uint32_t)m_uidValidity);
+    commandBuffer.Append(' ');
+    commandBuffer.AppendInt(mFolderLastModSeq);
+    if (mFolderHighestUID) {
+      commandBuffer.AppendLiteral(" 1:");
+      commandBuffer.AppendInt(mFolderHighestUID);
+    }
+    commandBuffer.AppendLiteral("))");
+  } else if (UseCondStore())
+    commandBuffer.AppendLiteral(" (CONDSTORE)");
   commandBuffer.Append(CRLF);
 
   nsresult res;
   res = SendData(commandBuffer.get());
   if (NS_FAILED(res)) return;
   ParseIMAPandCheckForNewMail();
+  // if the uid validity changed, the server ignored what we knew.
+  m_selectedWithQResync =
+      qresync && GetServerStateParser().LastCommandSuccessful() &&
+      GetServerStateParser().FolderUID() == m_uidValidity;
 
   int32_t numOfMessagesInFlagState = 0;
   nsImapAction imapAction;
@@ -3286,6 +3346,11 @@ void nsImapProtocol::PipelinedFetchMessageParts(
           stringToFetch.AppendLiteral("BODY.PEEK[HEADER]");
         }
         break;
+      case kBinarySize:
+        stringToFetch.AppendLiteral("BINARY.SIZE[");
+        stringToFetch.Append(currentPart.GetPartNumberString());
+        stringToFetch.Append(']');
+        break;
       default:
         NS_ASSERTION(
             false,
@@ -3350,6 +3415,22 @@ void nsImapProtocol::FetchMessage(const nsCString &messageIds,
                                   nsIMAPeFetchFields whatToFetch,
                                   const char *fetchModifier, uint32_t startByte,
                                   uint32_t numBytes, char *part) {
+  nsCString command;
+  nsresult rv = SendFetch(messageIds, whatToFetch, fetchModifier, startByte,
+                          numBytes, part, command);
+  if (rv == NS_ERROR_OUT_OF_MEMORY) return;
+  if (NS_SUCCEEDED(rv)) ParseIMAPandCheckForNewMail(command.get());
+  GetServerStateParser().SetFetchingFlags(false);
+  // Always clear this flag after every fetch.
+  m_fetchingWholeMessage = false;
+  if (GetServerStateParser().LastCommandSuccessful() && CheckNeeded()) Check();
+}
+
+nsresult nsImapProtocol::SendFetch(const nsCString &messageIds,
+                                   nsIMAPeFetchFields whatToFetch,
+                                   const char *fetchModifier,
+                                   uint32_t startByte, uint32_t numBytes,
+                                   char *part, nsCString &aCommand) {
   IncrementCommandTagNumber();
 
   nsCString commandString;
@@ -3544,6 +3625,21 @@ void nsImapProtocol::FetchMessage(const nsCString &messageIds,
     case kMIMEHeader:
       commandString.AppendLiteral(" %s (BODY[%s.MIME])");
       break;
+    case kMIMEPartBinary:
+      commandString.AppendLiteral(" %s (BINARY.PEEK[%s]");
+      if (numBytes > 0) {
+        // if we are retrieving chunks
+        char *byterangeString = PR_smprintf("<%ld.%ld>", startByte, numBytes);
+        if (byterangeString) {
+          commandString.Append(byterangeString);
+          PR_Free(byterangeString);
+        }
+      }
+      commandString.Append(')');
+      break;
+    case kBinarySize:
+      commandString.AppendLiteral(" %s (BINARY.SIZE[%s])");
+      break;
   }
 
   if (fetchModifier) commandString.Append(fetchModifier);
@@ -3560,7 +3656,8 @@ void nsImapProtocol::FetchMessage(const nsCString &messageIds,
 
   if (protocolString) {
     char *cCommandStr = ToNewCString(commandString);
-    if ((whatToFetch == kMIMEPart) || (whatToFetch == kMIMEHeader)) {
+    if ((whatToFetch == kMIMEPart) || (whatToFetch == kMIMEHeader) ||
+        (whatToFetch == kMIMEPartBinary) || (whatToFetch == kBinarySize)) {
       PR_snprintf(protocolString,      // string to create
                   protocolStringSize,  // max size
                   cCommandStr,         // format string
@@ -3577,15 +3674,12 @@ void nsImapProtocol::FetchMessage(const nsCString &messageIds,
     nsresult rv = SendData(protocolString);
 
     free(cCommandStr);
-    if (NS_SUCCEEDED(rv)) ParseIMAPandCheckForNewMail(protocolString);
+    aCommand.Assign(protocolString);
     PR_Free(protocolString);
-    GetServerStateParser().SetFetchingFlags(false);
-    // Always clear this flag after every fetch.
-    m_fetchingWholeMessage = false;
-    if (GetServerStateParser().LastCommandSuccessful() && CheckNeeded())
-      Check();
-  } else
-    HandleMemoryFailure();
+    return rv;
+  }
+  HandleMemoryFailure();
+  return NS_ERROR_OUT_OF_MEMORY;
 }
 
 void nsImapProtocol::FetchTryChunking(const nsCString &messageIds,
@@ -3631,6 +3725,23 @@ void nsImapProtocol::PipelinedFetchMessageParts(
     nsCString &uid, const nsTArray<nsIMAPMessagePartID> &parts) {
   // assumes no chunking
 
+  // The decoded sizes are asked for in a command of their own, so that a
+  // server that can't decode one of the parts (NO [UNKNOWN-CTE], RFC 3516)
+  // doesn't fail the header fetches along with them.
+  nsTArray<nsIMAPMessagePartID> headers, binarySizes;
+  for (uint32_t i = 0; i < parts.Length(); i++) {
+    nsIMAPMessagePartID part = parts[i];
+    if (part.GetFields() == kBinarySize)
+      binarySizes.AppendElement(part);
+    else
+      headers.AppendElement(part);
+  }
+  if (!headers.IsEmpty() && !binarySizes.IsEmpty()) {
+    PipelinedFetchMessageParts(uid, headers);
+    PipelinedFetchMessageParts(uid, binarySizes);
+    return;
+  }
+
   // build up a string to fetch
   nsCString stringToFetch;
   nsCString what;
@@ -3660,6 +3771,12 @@ void nsImapProtocol::PipelinedFetchMessageParts(
           stringToFetch += "BODY.PEEK[HEADER]";
         }
         break;
+      case kBinarySize:
+        what = "BINARY.SIZE[";
+        what += currentPart.GetPartNumberString();
+        what += "]";
+        stringToFetch += what;
+        break;
       default:
         NS_ASSERTION(
             false,
@@ -3685,12 +3802,26 @@ void nsImapProtocol::PipelinedFetchMessageParts(
     } else
       HandleMemoryFailure();
   }
+
+  if (GetServerStateParser().UnknownCTE()) {
+    // Ask again one part at a time. The parts the server can't decode are
+    // left without a decoded size, and so are fetched as they are.
+    if (binarySizes.Length() > 1) {
+      for (uint32_t i = 0; i < binarySizes.Length() && !DeathSignalReceived();
+           i++) {
+        nsTArray<nsIMAPMessagePartID> part;
+        part.AppendElement(binarySizes[i]);
+        PipelinedFetchMessageParts(uid, part);
+      }
+    }
+    GetServerStateParser().SetCommandFailed(false);
+  }
 }
 
-void nsImapProtocol::PostLineDownLoadEvent(const char *line,
+// |line| may hold many lines; |byteCount| is its length.
+void nsImapProtocol::PostLineDownLoadEvent(const char *line, uint32_t byteCount,
                                            uint32_t uidOfMessage) {
   if (!GetServerStateParser().GetDownloadingHeaders()) {
-    uint32_t byteCount = PL_strlen(line);
     bool echoLineToMessageSink = false;
     // if we have a channel listener, then just spool the message
     // directly to the listener
@@ -3730,6 +3861,7 @@ void nsImapProtocol::HandleMessageDownLoadLine(const char *line,
                                                bool isPartialLine,
                                                char *lineCopy) {
   NS_ENSURE_TRUE_VOID(line);
+  FlushPartHeader();
   NS_ASSERTION(lineCopy == nullptr || !PL_strcmp(line, lineCopy),
                "line and lineCopy must contain the same string");
   const char *messageLine = line;
@@ -3743,13 +3875,8 @@ void nsImapProtocol::HandleMessageDownLoadLine(const char *line,
     // Change this line to native line termination, duplicate if necessary.
     // Do not assume that the line really ends in CRLF
     // to start with, even though it is supposed to be RFC822
-
-    // normalize line endings to CRLF unless we are saving the message to disk
-    bool canonicalLineEnding = true;
-    nsCOMPtr<nsIMsgMessageUrl> msgUrl = do_QueryInterface(m_runningUrl);
-
-    if (m_imapAction == nsIImapUrl::nsImapSaveMessageToDisk && msgUrl)
-      msgUrl->GetCanonicalLineEnding(&canonicalLineEnding);
+    // (see BeginMessageDownLoad for which line endings we want).
+    bool canonicalLineEnding = m_canonicalLineEnding;
 
     NS_ASSERTION(MSG_LINEBREAK_LEN == 1 || (MSG_LINEBREAK_LEN == 2 &&
                                             !PL_strcmp(CRLF, MSG_LINEBREAK)),
@@ -3867,19 +3994,104 @@ void nsImapProtocol::HandleMessageDownLoadLine(const char *line,
 
   // so now the cache is flushed, but this string might still be to big
   if (m_downloadLineCache->SpaceAvailable() < lineLength + 1)
-    PostLineDownLoadEvent(messageLine,
+    PostLineDownLoadEvent(messageLine, lineLength,
                           GetServerStateParser().CurrentResponseUID());
   else
-    m_downloadLineCache->CacheLine(messageLine,
+    m_downloadLineCache->CacheLine(messageLine, lineLength,
                                    GetServerStateParser().CurrentResponseUID());
 
   PR_Free(localMessageLine);
 }
 
+// Unlike HandleMessageDownLoadLine, |data| is passed on unchanged: it may
+// hold NULs and its line endings, if any, are left alone.
+void nsImapProtocol::HandleMessageDownLoadData(const char *data,
+                                               uint32_t length) {
+  FlushPartHeader();
+  uint32_t uid = GetServerStateParser().CurrentResponseUID();
+  if ((m_downloadLineCache->CurrentUID() != uid &&
+       !m_downloadLineCache->CacheEmpty()) ||
+      m_downloadLineCache->SpaceAvailable() < length + 1)
+    FlushDownloadCache();
+
+  if (m_downloadLineCache->SpaceAvailable() < length + 1)
+    PostLineDownLoadEvent(data, length, uid);
+  else
+    m_downloadLineCache->CacheLine(data, length, uid);
+}
+
+// Each line break becomes the one BeginMessageDownLoad chose, taking up to
+// two CRs before the LF with it (CRCRLF), and NULs become blanks as they do
+// in the lines ReadNextLine returns.
+void nsImapProtocol::HandleMessageDownLoadBlock(const char *data,
+                                                uint32_t length,
+                                                bool lastBlock) {
+  const char *lineBreak = m_canonicalLineEnding ? CRLF : MSG_LINEBREAK;
+  const char *end = data + length;
+  nsAutoCString block;
+  // Most lines end in CRLF, so the block rarely grows.
+  block.SetCapacity(length + m_downloadPendingCRs + MSG_LINEBREAK_LEN);
+
+  const char *p = data;
+  while (p < end) {
+    const char *span = p;
+    while (p < end && *p != '\r' && *p != '\n') p++;
+    if (p > span) {
+      // the CRs held back were inside the line after all
+      block.Append("\r\r", m_downloadPendingCRs);
+      m_downloadPendingCRs = 0;
+      block.Append(span, p - span);
+      m_downloadInLine = true;
+    }
+    if (p == end) break;
+
+    if (*p == '\r') {
+      if (m_downloadPendingCRs == 2)
+        block.Append('\r');
+      else
+        m_downloadPendingCRs++;
+      m_downloadInLine = true;
+    } else {
+      block.Append(lineBreak);
+      m_downloadPendingCRs = 0;
+      m_downloadInLine = false;
+    }
+    p++;
+  }
+
+  if (lastBlock) {
+    // A CR at the end of the message ends its last line, like an LF would.
+    if (m_downloadPendingCRs) {
+      block.Append("\r\r", m_downloadPendingCRs - 1);
+      block.Append(lineBreak);
+    } else if (m_downloadInLine) {
+      block.Append(lineBreak);
+    }
+    m_downloadPendingCRs = 0;
+    m_downloadInLine = false;
+  }
+
+  block.ReplaceChar('\0', ' ');
+  if (!block.IsEmpty()) HandleMessageDownLoadData(block.get(), block.Length());
+}
+
+void nsImapProtocol::HoldPartHeader(const nsACString &header) {
+  m_heldPartHeader = header;
+}
+
+void nsImapProtocol::FlushPartHeader() {
+  if (m_heldPartHeader.IsEmpty()) return;
+  nsCString header;
+  header.Assign(m_heldPartHeader);
+  m_heldPartHeader.Truncate();
+  HandleMessageDownLoadLine(header.get(), false);
+}
+
 void nsImapProtocol::FlushDownloadCache() {
   if (!m_downloadLineCache->CacheEmpty()) {
+    uint32_t byteCount = m_downloadLineCache->GetBufferPos();
     msg_line_info *downloadLine = m_downloadLineCache->GetCurrentLineInfo();
-    PostLineDownLoadEvent(downloadLine->adoptedMessageLine,
+    PostLineDownLoadEvent(downloadLine->adoptedMessageLine, byteCount,
                           downloadLine->uidOfMessage);
     m_downloadLineCache->ResetCache();
   }
@@ -3896,10 +4108,7 @@ void nsImapProtocol::NormalMessageEndDownload() {
     m_hdrDownloadCache->FinishCurrentHdr();
     int32_t numHdrsCached;
     m_hdrDownloadCache->GetNumHeaders(&numHdrsCached);
-    if (numHdrsCached == kNumHdrsToXfer) {
-      m_imapMailFolderSink->ParseMsgHdrs(this, m_hdrDownloadCache);
-      m_hdrDownloadCache->ResetAll();
-    }
+    if (numHdrsCached == kNumHdrsToXfer) ParseMsgHdrsAsync();
   }
   FlushDownloadCache();
 
@@ -3999,6 +4208,11 @@ void nsImapProtocol::ProcessMailboxUpdate(bool handlePossibleUndo) {
     deleted = m_flagState->NumberOfDeletedMessages();
     bool flagStateEmpty = !added;
     bool useCS = UseCondStore();
+    // After a QRESYNC select, the server has already sent the flags of the
+    // messages that changed and the uids of the ones that vanished, so only
+    // new messages are left to look for.
+    bool qresynced = m_selectedWithQResync;
+    m_selectedWithQResync = false;
 
     // Figure out if we need to do a full sync (UID Fetch Flags 1:*),
     // a partial sync using CHANGEDSINCE, or a sync from the previous
@@ -4010,12 +4224,14 @@ void nsImapProtocol::ProcessMailboxUpdate(bool handlePossibleUndo) {
     // Print to log items affecting needFullFolderSync:
     MOZ_LOG(IMAP_CS, LogLevel::Debug,
             ("Do full sync?: mFolderHighestUID=%" PRIu32 ", added=%" PRId32
-             ", useCS=%s",
-             mFolderHighestUID, added, useCS ? "true" : "false"));
-    bool needFullFolderSync = !mFolderHighestUID || (flagStateEmpty && !useCS);
+             ", useCS=%s, qresynced=%s",
+             mFolderHighestUID, added, useCS ? "true" : "false",
+             qresynced ? "true" : "false"));
+    bool needFullFolderSync =
+        !qresynced && (!mFolderHighestUID || (flagStateEmpty && !useCS));
     bool needFolderSync = false;
 
-    if (!needFullFolderSync) {
+    if (!needFullFolderSync && !qresynced) {
       // Figure out if we need to do a non-highwater mark sync.
       // Set needFolderSync true when at least 1 of these 3 cases is true:
       // 1. Have no uids in flag array or all flag elements are marked deleted
@@ -4171,6 +4387,10 @@ void nsImapProtocol::ProcessMailboxUpdate(bool handlePossibleUndo) {
       // if we're using CONDSTORE, and the parser hasn't seen any UIDs, use
       // the highest UID previously seen and saved for the folder instead.
       if (useCS && !highestRecordedUID) highestRecordedUID = mFolderHighestUID;
+      // after a QRESYNC select, the parser has only seen the uids of changed
+      // messages, which may all be below the saved highest uid.
+      if (qresynced && highestRecordedUID < mFolderHighestUID)
+        highestRecordedUID = mFolderHighestUID;
       // clang-format off
       MOZ_LOG(IMAP_CS, LogLevel::Debug,
               ("Check for new messages above UID=%" PRIu32, highestRecordedUID));
@@ -4209,8 +4429,7 @@ void nsImapProtocol::ProcessMailboxUpdate(bool handlePossibleUndo) {
     if (m_imapMailFolderSink) {
       bool more;
       m_imapMailFolderSink->UpdateImapMailboxInfo(this, new_spec);
-      m_imapMailFolderSink->GetMsgHdrsToDownload(
-          &more, &m_progressExpectedNumber, msgIdList);
+      GetMsgHdrsToDownload(&more, msgIdList);
       // Assert that either it's empty string OR it must be header string.
       MOZ_ASSERT((m_stringIndex == IMAP_EMPTY_STRING_INDEX) ||
                  (m_stringIndex == IMAP_HEADERS_STRING_INDEX));
@@ -4333,8 +4552,31 @@ NS_IMETHODIMP nsImapProtocol::GetSupportedUserFlags(uint16_t *supportedFlags) {
   *supportedFlags = m_flagState->GetSupportedUserFlags();
   return NS_OK;
 }
+// Gets the uids of the headers to download from the folder. A folder that's
+// open in a window hands them out a chunk per url run; when fetches are
+// pipelined, take as many chunks as the fetch window can keep in flight, so
+// that the pipeline isn't drained every chunk.
+void nsImapProtocol::GetMsgHdrsToDownload(bool *aMore,
+                                          nsTArray<nsMsgKey> &aKeys) {
+  m_imapMailFolderSink->GetMsgHdrsToDownload(aMore, &m_progressExpectedNumber,
+                                             aKeys);
+  if (gMaxHdrFetchesInFlight <= 1) return;
+  uint32_t wanted = m_hdrFetchWindow * kMaxHdrsPerFetch;
+  while (*aMore && aKeys.Length() < wanted) {
+    nsTArray<nsMsgKey> chunk;
+    m_imapMailFolderSink->GetMsgHdrsToDownload(
+        aMore, &m_progressExpectedNumber, chunk);
+    if (chunk.IsEmpty()) break;
+    aKeys.AppendElements(chunk);
+  }
+}
+
 void nsImapProtocol::FolderMsgDumpLoop(uint32_t *msgUids, uint32_t msgCount,
                                        nsIMAPeFetchFields fields) {
+  if (fields == kHeadersRFC822andUid && gMaxHdrFetchesInFlight > 1) {
+    PipelinedHeaderFetch(msgUids, msgCount);
+    return;
+  }
   int32_t msgCountLeft = msgCount;
   uint32_t msgsDownloaded = 0;
   do {
@@ -4348,10 +4590,166 @@ void nsImapProtocol::FolderMsgDumpLoop(uint32_t *msgUids, uint32_t msgCount,
   } while (msgCountLeft > 0 && !DeathSignalReceived());
 }
 
+// Sends the header fetches for msgUids without waiting for the responses to
+// the earlier ones, so that on a slow link the server isn't left idle for a
+// round trip between commands. Each response is still parsed in the order
+// the commands were sent.
+void nsImapProtocol::PipelinedHeaderFetch(uint32_t *msgUids,
+                                          uint32_t msgCount) {
+  struct PendingFetch {
+    nsCString mCommand;
+    PRTime mSentAt;
+    bool mSentIntoEmptyPipe;
+  };
+  nsTArray<PendingFetch> pending;
+  uint32_t msgsSent = 0;
+  bool sending = true;
+  bool allSucceeded = true;
+  PRTime lastDone = PR_Now();
+  do {
+    while (sending && msgsSent < msgCount &&
+           pending.Length() < (uint32_t)m_hdrFetchWindow) {
+      if (DeathSignalReceived()) {
+        sending = false;
+        break;
+      }
+      nsCString idString;
+      uint32_t msgsToFetch = std::min(msgCount - msgsSent, kMaxHdrsPerFetch);
+      AllocateImapUidString(msgUids + msgsSent, msgsToFetch, m_flagState,
+                            idString);
+      msgsSent += msgsToFetch;
+      PendingFetch *fetch = pending.AppendElement();
+      fetch->mSentIntoEmptyPipe = pending.Length() == 1;
+      fetch->mSentAt = PR_Now();
+      if (NS_FAILED(SendFetch(idString, kHeadersRFC822andUid, nullptr, 0, 0,
+                              nullptr, fetch->mCommand))) {
+        pending.RemoveLastElement();
+        sending = false;
+      }
+    }
+    if (pending.IsEmpty()) break;
+
+    ParseIMAPandCheckForNewMail(pending[0].mCommand.get());
+    // the responses to the commands already sent still have to be read, but
+    // don't send more after a failure.
+    if (!GetServerStateParser().LastCommandSuccessful()) {
+      allSucceeded = false;
+      sending = false;
+    }
+    PRTime done = PR_Now();
+    AdjustHdrFetchWindow(pending[0].mSentAt, pending[0].mSentIntoEmptyPipe,
+                         lastDone, done);
+    lastDone = done;
+    pending.RemoveElementAt(0);
+    // if the connection is gone, there's nothing left to read.
+    if (!GetServerStateParser().Connected()) break;
+  } while (true);
+
+  GetServerStateParser().SetFetchingFlags(false);
+  // callers look at the state of the last command, so make it reflect them
+  // all.
+  if (!allSucceeded) GetServerStateParser().SetCommandFailed(true);
+  if (GetServerStateParser().LastCommandSuccessful() && CheckNeeded()) Check();
+}
+
+// Keeps enough header fetches outstanding to cover the time it takes a
+// command to reach the server and its response to start arriving. That's
+// learned from commands sent when nothing else was outstanding; after that,
+// the time between responses is how long the server takes to send one.
+void nsImapProtocol::AdjustHdrFetchWindow(PRTime aSentAt,
+                                          bool aSentIntoEmptyPipe,
+                                          PRTime aPrevDone, PRTime aDone) {
+  if (aSentIntoEmptyPipe) {
+    PRTime latency = aDone - aSentAt;
+    m_hdrFetchLatency =
+        m_hdrFetchLatency ? (3 * m_hdrFetchLatency + latency) / 4 : latency;
+    return;
+  }
+  int32_t window;
+  if (aSentAt + m_hdrFetchLatency > aPrevDone) {
+    // the response can't have been waiting when we finished parsing the
+    // previous one, so the connection was idle in between.
+    window = m_hdrFetchWindow + 1;
+  } else {
+    PRTime transfer = std::max<PRTime>(aDone - aPrevDone, 1);
+    m_hdrFetchTransfer = m_hdrFetchTransfer
+                             ? (3 * m_hdrFetchTransfer + transfer) / 4
+                             : transfer;
+    window = 1 + (int32_t)((m_hdrFetchLatency + m_hdrFetchTransfer - 1) /
+                           m_hdrFetchTransfer);
+  }
+  m_hdrFetchWindow = std::max(2, std::min(window, gMaxHdrFetchesInFlight));
+  MOZ_LOG(IMAP, LogLevel::Debug,
+          ("AdjustHdrFetchWindow: latency %" PRId64 " transfer %" PRId64
+           " window %d",
+           m_hdrFetchLatency, m_hdrFetchTransfer, m_hdrFetchWindow));
+}
+
+class nsImapParseMsgHdrsEvent : public mozilla::Runnable {
+ public:
+  nsImapParseMsgHdrsEvent(nsImapProtocol *aProtocol,
+                          ImapMailFolderSinkProxy *aSink,
+                          nsMsgImapHdrXferInfo *aHdrs)
+      : mozilla::Runnable("nsImapParseMsgHdrsEvent"),
+        mProtocol(aProtocol),
+        mSink(aSink),
+        mHdrs(aHdrs) {}
+  NS_IMETHOD Run() {
+    // on the main thread, the proxy calls the folder directly.
+    mSink->ParseMsgHdrs(mProtocol, mHdrs);
+    mHdrs->ResetAll();
+    mProtocol->HdrParseDone(mHdrs);
+    return NS_OK;
+  }
+
+ private:
+  RefPtr<nsImapProtocol> mProtocol;
+  RefPtr<ImapMailFolderSinkProxy> mSink;
+  RefPtr<nsMsgImapHdrXferInfo> mHdrs;
+};
+
+void nsImapProtocol::ParseMsgHdrsAsync() {
+  WaitForHdrParse();
+  RefPtr<nsMsgImapHdrXferInfo> hdrs;
+  {
+    // HdrParseDone looks at m_hdrParseCache on the main thread.
+    ReentrantMonitorAutoEnter mon(m_hdrParseMonitor);
+    m_hdrParseCache.swap(m_hdrDownloadCache);
+    m_hdrParsePending = true;
+    hdrs = m_hdrParseCache;
+  }
+  RefPtr<nsImapParseMsgHdrsEvent> event =
+      new nsImapParseMsgHdrsEvent(this, m_imapMailFolderSink, hdrs);
+  if (NS_FAILED(NS_DispatchToMainThread(event))) {
+    m_imapMailFolderSink->ParseMsgHdrs(this, hdrs);
+    hdrs->ResetAll();
+    HdrParseDone(hdrs);
+  }
+}
+
+void nsImapProtocol::WaitForHdrParse() {
+  ReentrantMonitorAutoEnter mon(m_hdrParseMonitor);
+  while (m_hdrParsePending && !DeathSignalReceived())
+    mon.Wait(kImapSleepTime);
+  if (m_hdrParsePending) {
+    // the main thread still has those headers; leave them to it.
+    m_hdrParseCache = new nsMsgImapHdrXferInfo();
+    m_hdrParsePending = false;
+  }
+}
+
+void nsImapProtocol::HdrParseDone(nsMsgImapHdrXferInfo *aHdrs) {
+  ReentrantMonitorAutoEnter mon(m_hdrParseMonitor);
+  if (aHdrs == m_hdrParseCache) m_hdrParsePending = false;
+  mon.Notify();
+}
+
 void nsImapProtocol::HeaderFetchCompleted() {
+  WaitForHdrParse();
   if (m_imapMailFolderSink)
     m_imapMailFolderSink->ParseMsgHdrs(this, m_hdrDownloadCache);
   m_hdrDownloadCache->ReleaseAll();
+  m_hdrParseCache->ReleaseAll();
 
   if (m_imapMailFolderSink) m_imapMailFolderSink->HeaderFetchCompleted(this);
 }
@@ -4703,54 +5101,7 @@ char *nsImapProtocol::CreateNewLineFromSocket() {
 
   kungFuGrip = nullptr;
 
-  if (NS_FAILED(rv)) {
-    switch (rv) {
-      case NS_ERROR_UNKNOWN_HOST:
-      case NS_ERROR_UNKNOWN_PROXY_HOST:
-        AlertUserEventUsingName("imapUnknownHostError");
-        break;
-      case NS_ERROR_CONNECTION_REFUSED:
-      case NS_ERROR_PROXY_CONNECTION_REFUSED:
-        AlertUserEventUsingName("imapConnectionRefusedError");
-        break;
-      case NS_ERROR_NET_TIMEOUT:
-      case NS_ERROR_NET_RESET:
-      case NS_BASE_STREAM_CLOSED:
-      case NS_ERROR_NET_INTERRUPT:
-        // we should retry on RESET, especially for SSL...
-        if ((TestFlag(IMAP_RECEIVED_GREETING) || rv == NS_ERROR_NET_RESET) &&
-            m_runningUrl && !m_retryUrlOnError) {
-          bool rerunningUrl;
-          nsImapAction imapAction;
-          m_runningUrl->GetRerunningUrl(&rerunningUrl);
-          m_runningUrl->GetImapAction(&imapAction);
-          // don't rerun if we already were rerunning. And don't rerun
-          // online move/copies that timeout.
-          if (!rerunningUrl && (rv != NS_ERROR_NET_TIMEOUT ||
-                                (imapAction != nsIImapUrl::nsImapOnlineCopy &&
-                                 imapAction != nsIImapUrl::nsImapOnlineMove))) {
-            m_runningUrl->SetRerunningUrl(true);
-            m_retryUrlOnError = true;
-            break;
-          }
-        }
-        if (rv == NS_ERROR_NET_TIMEOUT)
-          AlertUserEventUsingName("imapNetTimeoutError");
-        else
-          AlertUserEventUsingName(TestFlag(IMAP_RECEIVED_GREETING)
-                                      ? "imapServerDisconnected"
-                                      : "imapServerDroppedConnection");
-        break;
-      default:
-        break;
-    }
-
-    nsAutoCString logMsg("clearing IMAP_CONNECTION_IS_OPEN - rv = ");
-    logMsg.AppendInt(static_cast<uint32_t>(rv), 16);
-    Log("CreateNewLineFromSocket", nullptr, logMsg.get());
-    ClearFlag(IMAP_CONNECTION_IS_OPEN);
-    TellThreadToDie();
-  }
+  if (NS_FAILED(rv)) SocketReadFailed(rv);
   Log("CreateNewLineFromSocket", nullptr, newLine);
   SetConnectionStatus(newLine && numBytesInLine
                           ? NS_OK
@@ -4758,6 +5109,74 @@ char *nsImapProtocol::CreateNewLineFromSocket() {
   return newLine;
 }
 
+char *nsImapProtocol::CreateNewBytesFromSocket(uint32_t aMaxBytes,
+                                               uint32_t &aNumBytes) {
+  bool needMoreData = false;
+  char *newBytes = nullptr;
+  nsresult rv = NS_OK;
+  nsCOMPtr<nsIInputStream> kungFuGrip = m_inputStream;
+  do {
+    newBytes = m_inputStreamBuffer->ReadNextBytes(m_inputStream, aMaxBytes,
+                                                  aNumBytes, needMoreData, &rv);
+  } while (!newBytes && NS_SUCCEEDED(rv) && !DeathSignalReceived());
+  kungFuGrip = nullptr;
+
+  if (NS_FAILED(rv)) SocketReadFailed(rv);
+  SetConnectionStatus(newBytes && aNumBytes ? NS_OK : rv);
+  return newBytes;
+}
+
+// Tells the user why reading from the socket failed, or arranges to retry
+// the url, and closes the connection.
+void nsImapProtocol::SocketReadFailed(nsresult rv) {
+  switch (rv) {
+    case NS_ERROR_UNKNOWN_HOST:
+    case NS_ERROR_UNKNOWN_PROXY_HOST:
+      AlertUserEventUsingName("imapUnknownHostError");
+      break;
+    case NS_ERROR_CONNECTION_REFUSED:
+    case NS_ERROR_PROXY_CONNECTION_REFUSED:
+      AlertUserEventUsingName("imapConnectionRefusedError");
+      break;
+    case NS_ERROR_NET_TIMEOUT:
+    case NS_ERROR_NET_RESET:
+    case NS_BASE_STREAM_CLOSED:
+    case NS_ERROR_NET_INTERRUPT:
+      // we should retry on RESET, especially for SSL...
+      if ((TestFlag(IMAP_RECEIVED_GREETING) || rv == NS_ERROR_NET_RESET) &&
+          m_runningUrl && !m_retryUrlOnError) {
+        bool rerunningUrl;
+        nsImapAction imapAction;
+        m_runningUrl->GetRerunningUrl(&rerunningUrl);
+        m_runningUrl->GetImapAction(&imapAction);
+        // don't rerun if we already were rerunning. And don't rerun
+        // online move/copies that timeout.
+        if (!rerunningUrl && (rv != NS_ERROR_NET_TIMEOUT ||
+                              (imapAction != nsIImapUrl::nsImapOnlineCopy &&
+                               imapAction != nsIImapUrl::nsImapOnlineMove))) {
+          m_runningUrl->SetRerunningUrl(true);
+          m_retryUrlOnError = true;
+          break;
+        }
+      }
+      if (rv == NS_ERROR_NET_TIMEOUT)
+        AlertUserEventUsingName("imapNetTimeoutError");
+      else
+        AlertUserEventUsingName(TestFlag(IMAP_RECEIVED_GREETING)
+                                    ? "imapServerDisconnected"
+                                    : "imapServerDroppedConnection");
+      break;
+    default:
+      break;
+  }
+
+  nsAutoCString logMsg("clearing IMAP_CONNECTION_IS_OPEN - rv = ");
+  logMsg.AppendInt(static_cast<uint32_t>(rv), 16);
+  Log("CreateNewLineFromSocket", nullptr, logMsg.get());
+  ClearFlag(IMAP_CONNECTION_IS_OPEN);
+  TellThreadToDie();
+}
+
 nsresult nsImapProtocol::GetConnectionStatus() { return m_connectionStatus; }
 
 void nsImapProtocol::SetConnectionStatus(nsresult status) {
@@ -5299,7 +5718,11 @@ void nsImapProtocol::EnableCondStore() {
   IncrementCommandTagNumber();
   nsCString command(GetServerCommandTag());
 
-  command.AppendLiteral(" ENABLE CONDSTORE" CRLF);
+  // QRESYNC enables CondStore as well.
+  if (UseQResync())
+    command.AppendLiteral(" ENABLE QRESYNC" CRLF);
+  else
+    command.AppendLiteral(" ENABLE CONDSTORE" CRLF);
 
   nsresult rv = SendData(command.get());
   if (NS_SUCCEEDED(rv)) ParseIMAPandCheckForNewMail();
@@ -7769,7 +8192,7 @@ void nsImapProtocol::ProcessAfterAuthenticated() {
   if (UseCompressDeflate()) StartCompressDeflate();
 
   if ((GetServerStateParser().GetCapabilityFlag() & kHasEnableCapability) &&
-      UseCondStore())
+      (UseCondStore() || UseQResync()))
     EnableCondStore();
 
   bool haveIdResponse = false;
@@ -8349,6 +8772,22 @@ bool nsImapProtocol::UseCondStore() {
          GetServerStateParser().fUseModSeq;
 }
 
+bool nsImapProtocol::UseQResync() {
+  return m_useCondStore &&
+         GetServerStateParser().GetCapabilityFlag() & kHasQResyncCapability &&
+         GetServerStateParser().GetCapabilityFlag() & kHasEnableCapability;
+}
+
+bool nsImapProtocol::UseBinaryFetch() {
+  return gUseBinaryFetch &&
+         GetServerStateParser().GetCapabilityFlag() & kHasBinaryCapability;
+}
+
+bool nsImapProtocol::UnknownCTE() {
+  return GetServerStateParser().CommandFailed() &&
+         GetServerStateParser().UnknownCTE();
+}
+
 bool nsImapProtocol::UseCompressDeflate() {
   // Check that the server is capable of compression, and the user
   // hasn't disabled the use of compression for this server.
@@ -54,7 +54,10 @@
 class nsIMAPMessagePartID;
 class nsIPrefBranch;
 
-#define kDownLoadCacheSize 16000u  // was 1536 - try making it bigger
+// Size of the blocks a fetched message is streamed in. Each block costs a
+// trip to the main thread for the channel listener, and another one for the
+// offline store, so bigger is better for large messages.
+#define kDownLoadCacheSize 65536u  // was 16000, and 1536 before that
 
 typedef struct _msg_line_info {
   const char *adoptedMessageLine;
@@ -70,6 +73,7 @@ class nsMsgImapLineDownloadCache : public nsIImapHeaderInfo,
   uint32_t CurrentUID();
   uint32_t SpaceAvailable();
   bool CacheEmpty();
+  void CacheLine(const char *line, uint32_t lineLength, uint32_t uid);
 
   msg_line_info *GetCurrentLineInfo();
 
@@ -200,6 +204,12 @@ class nsImapProtocol : public nsIImapProtocol,
                             const char *fetchModifier = nullptr,
                             uint32_t startByte = 0, uint32_t numBytes = 0,
                             char *part = 0);
+  // sends a fetch command without waiting for the response; aCommand is set
+  // to what was sent, for parsing the response later.
+  nsresult SendFetch(const nsCString &messageIds,
+                     nsIMAPeFetchFields whatToFetch, const char *fetchModifier,
+                     uint32_t startByte, uint32_t numBytes, char *part,
+                     nsCString &aCommand);
   void FetchTryChunking(const nsCString &messageIds,
                         nsIMAPeFetchFields whatToFetch, bool idIsUid,
                         char *part, uint32_t downloadSize, bool tryChunking);
@@ -213,9 +223,22 @@ class nsImapProtocol : public nsIImapProtocol,
       const char *contentType);  // some downloads are header only
   virtual void HandleMessageDownLoadLine(const char *line, bool isPartialLine,
                                          char *lineCopy = nullptr);
+  // Passes on data that isn't made of lines, such as a decoded part.
+  void HandleMessageDownLoadData(const char *data, uint32_t length);
+  // Passes on a block of message data, which may end in the middle of a line,
+  // changing its line endings like HandleMessageDownLoadLine does.
+  // |lastBlock| ends the message data.
+  void HandleMessageDownLoadBlock(const char *data, uint32_t length,
+                                  bool lastBlock);
+  // Holds the MIME header of a part being generated until the first of the
+  // part's data comes, so it can still be changed if the fetch is refused.
+  void HoldPartHeader(const nsACString &header);
+  bool PartHeaderHeld() { return !m_heldPartHeader.IsEmpty(); }
+  void FlushPartHeader();
   virtual void NormalMessageEndDownload();
   virtual void AbortMessageDownLoad();
-  virtual void PostLineDownLoadEvent(const char *line, uint32_t uid);
+  virtual void PostLineDownLoadEvent(const char *line, uint32_t byteCount,
+                                     uint32_t uid);
   void FlushDownloadCache();
 
   virtual void SetMailboxDiscoveryStatus(EMailboxDiscoverStatus status);
@@ -244,9 +267,17 @@ class nsImapProtocol : public nsIImapProtocol,
   // been modified. Used for MIME parts on demand.
   void SetContentModified(IMAP_ContentModifiedType modified);
   bool GetShouldFetchAllParts();
+  // true if MIME parts can be fetched decoded by the server (RFC 3516).
+  bool UseBinaryFetch();
+  // true if the last command failed because the server couldn't decode a
+  // part (NO [UNKNOWN-CTE]).
+  bool UnknownCTE();
   bool GetIgnoreExpunges() { return m_ignoreExpunges; }
   // Generic accessors required by the imap parser
   char *CreateNewLineFromSocket();
+  // Reads up to aMaxBytes from the socket as they came, line ending or not.
+  char *CreateNewBytesFromSocket(uint32_t aMaxBytes, uint32_t &aNumBytes);
+  void SocketReadFailed(nsresult rv);
   nsresult GetConnectionStatus();
   void SetConnectionStatus(nsresult status);
 
@@ -399,6 +430,7 @@ class nsImapProtocol : public nsIImapProtocol,
   mozilla::ReentrantMonitor m_waitForBodyIdsMonitor;
   mozilla::ReentrantMonitor m_fetchBodyListMonitor;
   mozilla::ReentrantMonitor m_passwordReadyMonitor;
+  mozilla::ReentrantMonitor m_hdrParseMonitor;
   mozilla::Mutex mLock;
   // If we get an async password prompt, this is where the UI thread
   // stores the password, before notifying the imap thread of the password
@@ -448,6 +480,16 @@ class nsImapProtocol : public nsIImapProtocol,
                      nsIMAPeFetchFields fields);
   void FolderMsgDumpLoop(uint32_t *msgUids, uint32_t msgCount,
                          nsIMAPeFetchFields fields);
+  void GetMsgHdrsToDownload(bool *aMore, nsTArray<nsMsgKey> &aKeys);
+  void PipelinedHeaderFetch(uint32_t *msgUids, uint32_t msgCount);
+  void AdjustHdrFetchWindow(PRTime aSentAt, bool aSentIntoEmptyPipe,
+                            PRTime aPrevDone, PRTime aDone);
+  // hands the full header cache to the main thread to be parsed, and goes on
+  // filling the other one.
+  void ParseMsgHdrsAsync();
+  void WaitForHdrParse();
+  void HdrParseDone(nsMsgImapHdrXferInfo *aHdrs);
+  friend class nsImapParseMsgHdrsEvent;
   void WaitForPotentialListOfBodysToFetch(nsTArray<nsMsgKey> &msgIdList);
   void HeaderFetchCompleted();
   void UploadMessageFromFile(nsIFile *file, const char *mailboxName,
@@ -633,6 +675,12 @@ class nsImapProtocol : public nsIImapProtocol,
   bool UseCondStore();
   // false if pref "mail.server.serverxxx.use_condstore" is false;
   bool m_useCondStore;
+  // QRESYNC support - true if the server supports it and ENABLE, and the user
+  // hasn't disabled CondStore, which QRESYNC builds on.
+  bool UseQResync();
+  // true if the last select resynchronized the folder with QRESYNC, i.e.,
+  // the server sent the changes since mFolderLastModSeq in its response.
+  bool m_selectedWithQResync;
   // COMPRESS=DEFLATE support - true if server supports it, and the user hasn't
   // disabled it.
   bool UseCompressDeflate();
@@ -668,7 +716,22 @@ class nsImapProtocol : public nsIImapProtocol,
   int32_t m_chunkSize;
   int32_t m_chunkThreshold;
   RefPtr<nsMsgImapLineDownloadCache> m_downloadLineCache;
+  // HandleMessageDownLoadBlock's state between blocks: the CRs held back in
+  // case an LF follows them, and whether the last line is still open.
+  uint32_t m_downloadPendingCRs;
+  bool m_downloadInLine;
+  nsCString m_heldPartHeader;
   RefPtr<nsMsgImapHdrXferInfo> m_hdrDownloadCache;
+  // the headers being parsed on the main thread while m_hdrDownloadCache
+  // fills; m_hdrParsePending is guarded by m_hdrParseMonitor.
+  RefPtr<nsMsgImapHdrXferInfo> m_hdrParseCache;
+  bool m_hdrParsePending;
+  // how many header fetch commands to keep outstanding, and the smoothed
+  // times, in usec, from sending one to an idle server until its response is
+  // in, and between responses when several are outstanding.
+  int32_t m_hdrFetchWindow;
+  PRTime m_hdrFetchLatency;
+  PRTime m_hdrFetchTransfer;
   nsCOMPtr<nsIImapHeaderInfo> m_curHdrInfo;
   // mapping between mailboxes and the corresponding folder flags
   nsDataHashtable<nsCStringHashKey, int32_t> m_standardListMailboxes;
@@ -678,6 +741,9 @@ class nsImapProtocol : public nsIImapProtocol,
   nsCOMPtr<nsIImapHostSessionList> m_hostSessionList;
 
   bool m_fromHeaderSeen;
+  // whether to use CRLF line endings for the message being downloaded, or
+  // native ones.
+  bool m_canonicalLineEnding;
 
   nsString mAcceptLanguages;
 
@@ -37,6 +37,8 @@ nsImapServerResponseParser::nsImapServerResponseParser(
       fIMAPstate(kNonAuthenticated),
       fLastChunk(false),
       fNextChunkStartsWithNewline(false),
+      fReadingBinaryPart(false),
+      fUnknownCTE(false),
       fServerConnection(imapProtocolConnection),
       fHostSessionList(nullptr) {
   fSearchResults = nsImapSearchResultSequence::CreateSearchResultSequence();
@@ -58,6 +60,7 @@ nsImapServerResponseParser::nsImapServerResponseParser(
   fStatusExistingMessages = 0;
   fReceivedHeaderOrSizeForUID = nsMsgKey_None;
   fCondStoreEnabled = false;
+  fQResyncEnabled = false;
   fStdJunkNotJunkUseOk = false;
 }
 
@@ -119,6 +122,7 @@ void nsImapServerResponseParser::IncrementNumberOfTaggedResponsesExpected(
 
 void nsImapServerResponseParser::InitializeState() {
   fCurrentCommandFailed = false;
+  fUnknownCTE = false;
   fNumberOfRecentMessages = 0;
   fReceivedHeaderOrSizeForUID = nsMsgKey_None;
 }
@@ -576,7 +580,9 @@ void nsImapServerResponseParser::response_data() {
           SetSyntaxError(true);
         break;
       case 'V':
-        if (!PL_strcasecmp(fNextToken, "VERSION")) {
+        if (!PL_strcasecmp(fNextToken, "VANISHED")) {
+          vanished_data();
+        } else if (!PL_strcasecmp(fNextToken, "VERSION")) {
           // figure out the version of the Netscape server here
           PR_FREEIF(fNetscapeServerVersionString);
           AdvanceToNextToken();
@@ -906,6 +912,48 @@ void nsImapServerResponseParser::numeric_mailbox_data() {
   }
 }
 
+/*
+ expunged_resp ::= "VANISHED" [SPACE "(EARLIER)"] SPACE known_uids
+
+ RFC 7162; sent instead of EXPUNGE once QRESYNC is enabled. Without EARLIER,
+ the messages were just expunged and the later ones are renumbered. With it,
+ they were expunged before the folder was selected.
+*/
+void nsImapServerResponseParser::vanished_data() {
+  AdvanceToNextToken();
+  if (!ContinueParse()) return;
+  bool earlier = !PL_strcasecmp(fNextToken, "(EARLIER)");
+  if (earlier) {
+    AdvanceToNextToken();
+    if (!ContinueParse()) return;
+  }
+  if (!fFlagState || (!earlier && fServerConnection.GetIgnoreExpunges())) {
+    skip_to_CRLF();
+    return;
+  }
+
+  // the uid set is a comma separated list of uids and uid ranges
+  char *uids = fNextToken;
+  while (uids && *uids) {
+    char *end = nullptr;
+    uint32_t first = strtoul(uids, &end, 10);
+    uint32_t last = first;
+    if (end && *end == ':') last = strtoul(end + 1, &end, 10);
+    if (!end || end == uids || !first || !last) {
+      SetSyntaxError(true);
+      return;
+    }
+    if (last < first) {
+      uint32_t swap = first;
+      first = last;
+      last = swap;
+    }
+    fFlagState->ExpungeByUids(first, last, earlier);
+    uids = (*end == ',') ? end + 1 : nullptr;
+  }
+  skip_to_CRLF();
+}
+
 /*
 msg_fetch       ::= "(" 1#("BODY" SPACE body /
 "BODYSTRUCTURE" SPACE body /
@@ -1182,6 +1230,15 @@ void nsImapServerResponseParser::msg_fetch() {
       fDownloadingHeaders = false;
       // A specific MIME part, or MIME part header
       mime_data();
+    } else if (!PL_strncasecmp(fNextToken, "BINARY.SIZE[", 12)) {
+      binary_size_data();
+    } else if (!PL_strncasecmp(fNextToken, "BINARY[", 7)) {
+      // A MIME part the server decoded (RFC 3516); streamed out like BODY[],
+      // but as it came rather than line by line.
+      fDownloadingHeaders = false;
+      fReadingBinaryPart = true;
+      mime_part_data();
+      fReadingBinaryPart = false;
     } else if (!PL_strcasecmp(fNextToken, "ENVELOPE")) {
       fDownloadingHeaders = true;
       bNeedEndMessageDownload = true;
@@ -1725,6 +1782,10 @@ void nsImapServerResponseParser::resp_text_code() {
     } else if (!PL_strcasecmp(fNextToken, "READ-WRITE]")) {
       fCurrentFolderReadOnly = false;
       AdvanceToNextToken();
+    } else if (!PL_strcasecmp(fNextToken, "UNKNOWN-CTE]")) {
+      // RFC 3516: the server can't decode a part we asked for with BINARY
+      fUnknownCTE = true;
+      AdvanceToNextToken();
     } else if (!PL_strcasecmp(fNextToken, "TRYCREATE]")) {
       // do nothing for now
       AdvanceToNextToken();
@@ -2008,6 +2069,10 @@ void nsImapServerResponseParser::capability_data() {
         fCapabilityFlag |= kHasCondStoreCapability;
       else if (token.Equals("ENABLE", nsCaseInsensitiveCStringComparator()))
         fCapabilityFlag |= kHasEnableCapability;
+      else if (token.Equals("QRESYNC", nsCaseInsensitiveCStringComparator()))
+        fCapabilityFlag |= kHasQResyncCapability;
+      else if (token.Equals("BINARY", nsCaseInsensitiveCStringComparator()))
+        fCapabilityFlag |= kHasBinaryCapability;
       else if (token.Equals("LIST-EXTENDED",
                             nsCaseInsensitiveCStringComparator()))
         fCapabilityFlag |= kHasListExtendedCapability;
@@ -2078,6 +2143,9 @@ void nsImapServerResponseParser::enable_data() {
     // eat each enable response;
     AdvanceToNextToken();
     if (!strcmp("CONDSTORE", fNextToken)) fCondStoreEnabled = true;
+    // Enabling QRESYNC enables CONDSTORE too.
+    if (!strcmp("QRESYNC", fNextToken))
+      fCondStoreEnabled = fQResyncEnabled = true;
   } while (fNextToken && !fAtEndOfLine && ContinueParse());
 }
 
@@ -2304,6 +2372,27 @@ void nsImapServerResponseParser::mime_header_data() {
   }
 }
 
+// RFC 3516: "BINARY.SIZE[" section-part "]" SP number
+void nsImapServerResponseParser::binary_size_data() {
+  nsAutoCString partNumber(fNextToken + 12);  // 12 == strlen("BINARY.SIZE[")
+  int32_t end = partNumber.FindChar(']');
+  if (end < 0) {
+    SetSyntaxError(true);
+    return;
+  }
+  partNumber.SetLength(end);
+  AdvanceToNextToken();
+  if (ContinueParse()) {
+    uint32_t size = strtoul(fNextToken, nullptr, 10);
+    if (m_shell) m_shell->SetBinaryPartSize(partNumber.get(), size);
+    // if this token ends in ')', it's the last one of the fetch response
+    if (*(fNextToken + strlen(fNextToken) - 1) == ')')
+      fNextToken += strlen(fNextToken) - 1;
+    else
+      AdvanceToNextToken();
+  }
+}
+
 // Actual mime parts are filled in on demand (either from shell generation
 // or from explicit user download), so we need to stream these out.
 void nsImapServerResponseParser::mime_part_data() {
@@ -2680,7 +2769,8 @@ void nsImapServerResponseParser::ResetCapabilityFlag() {}
 // only chunk. This signals the caller that the stream should be closed since
 // the message response has been processed.
 bool nsImapServerResponseParser::msg_fetch_literal(bool chunk, int32_t origin) {
-  numberOfCharsInThisChunk = atoi(fNextToken + 1);
+  // a literal8 ("~{n}", RFC 3516) is read the same way.
+  numberOfCharsInThisChunk = atoi(fNextToken + (*fNextToken == '~' ? 2 : 1));
   // If we didn't request a specific size, or the server isn't returning exactly
   // as many octets as we requested, this must be the last or only chunk
   bool lastChunk = (!chunk || (numberOfCharsInThisChunk !=
@@ -2696,6 +2786,11 @@ bool nsImapServerResponseParser::msg_fetch_literal(bool chunk, int32_t origin) {
 
   charsReadSoFar = 0;
 
+  // Only a header download, and the From: line that XSENDER checks, need the
+  // literal split into lines.
+  if (fReadingBinaryPart || (!fDownloadingHeaders && !fXSenderInfo))
+    return msg_fetch_literal_blocks(lastChunk, origin);
+
   while (ContinueParse() && !fServerConnection.DeathSignalReceived() &&
          (charsReadSoFar < numberOfCharsInThisChunk)) {
     AdvanceToNextLine();
@@ -2852,6 +2947,48 @@ bool nsImapServerResponseParser::msg_fetch_literal(bool chunk, int32_t origin) {
   return lastChunk;
 }
 
+// Reads the data of a literal in blocks straight from the socket buffer. A
+// part the server decoded may hold any octet, so it's passed on as it came.
+// Message data only has its line endings changed, which
+// HandleMessageDownLoadBlock does for a whole block at a time.
+bool nsImapServerResponseParser::msg_fetch_literal_blocks(bool lastChunk,
+                                                          int32_t origin) {
+  fNextChunkStartsWithNewline = false;
+  while (ContinueParse() && !fServerConnection.DeathSignalReceived() &&
+         (charsReadSoFar < numberOfCharsInThisChunk)) {
+    uint32_t numBytes = 0;
+    char *data = fServerConnection.CreateNewBytesFromSocket(
+        numberOfCharsInThisChunk - charsReadSoFar, numBytes);
+    if (!data) {
+      SetConnected(false);
+      break;
+    }
+    charsReadSoFar += numBytes;
+    if (fCurrentCommandIsSingleMessageFetch) {
+      fServerConnection.ProgressEventFunctionUsingName(
+          "imapDownloadingMessage");
+      if (fTotalDownloadSize > 0)
+        fServerConnection.PercentProgressUpdateEvent(
+            0, charsReadSoFar + origin, fTotalDownloadSize);
+    }
+    if (fReadingBinaryPart)
+      fServerConnection.HandleMessageDownLoadData(data, numBytes);
+    else
+      fServerConnection.HandleMessageDownLoadBlock(data, numBytes, false);
+    PR_Free(data);
+  }
+  // the last line of the message may not have a line break yet
+  if (lastChunk && !fReadingBinaryPart)
+    fServerConnection.HandleMessageDownLoadBlock("", 0, true);
+
+  // the rest of the response starts on the line after the literal
+  if (ContinueParse()) {
+    AdvanceToNextLine();
+    AdvanceToNextToken();
+  }
+  return lastChunk;
+}
+
 bool nsImapServerResponseParser::CurrentFolderReadOnly() {
   return fCurrentFolderReadOnly;
 }
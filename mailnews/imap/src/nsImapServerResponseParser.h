@@ -41,6 +41,8 @@ class nsImapServerResponseParser : public nsIMAPGenericParser {
   virtual void InitializeState();
   bool CommandFailed();
   void SetCommandFailed(bool failed);
+  // true if the last command was refused with [UNKNOWN-CTE] (RFC 3516).
+  bool UnknownCTE() { return fUnknownCTE; }
 
   enum eIMAPstate { kNonAuthenticated, kAuthenticated, kFolderSelected };
 
@@ -133,6 +135,7 @@ class nsImapServerResponseParser : public nsIMAPGenericParser {
   char *fAuthChallenge;  // the challenge returned by the server in
                          // response to authenticate using CRAM-MD5 or NTLM
   bool fCondStoreEnabled;
+  bool fQResyncEnabled;
   bool fUseModSeq;  // can use mod seq for currently selected folder
   uint64_t fHighestModSeq;
 
@@ -161,6 +164,7 @@ class nsImapServerResponseParser : public nsIMAPGenericParser {
   virtual void id_data();
   virtual void mailbox_data();
   virtual void numeric_mailbox_data();
+  virtual void vanished_data();
   virtual void capability_data();
   virtual void xserverinfo_data();
   virtual void xmailboxinfo_data();
@@ -174,6 +178,7 @@ class nsImapServerResponseParser : public nsIMAPGenericParser {
                                           nsIMAPBodypart *parentPart);
   virtual void mime_data();
   virtual void mime_part_data();
+  virtual void binary_size_data();
   virtual void mime_header_data();
   virtual void quota_data();
   virtual void msg_fetch();
@@ -183,6 +188,7 @@ class nsImapServerResponseParser : public nsIMAPGenericParser {
                                  const char *content_type);
   virtual bool msg_fetch_quoted();
   virtual bool msg_fetch_literal(bool chunk, int32_t origin);
+  virtual bool msg_fetch_literal_blocks(bool lastChunk, int32_t origin);
   virtual void mailbox_list(bool discoveredFromLsub);
   virtual void mailbox(nsImapMailboxSpec *boxSpec);
 
@@ -273,6 +279,11 @@ class nsImapServerResponseParser : public nsIMAPGenericParser {
   // Flags split of \r and \n between chunks in msg_fetch_literal().
   bool fNextChunkStartsWithNewline;
 
+  // true while reading the data of a BINARY[] response.
+  bool fReadingBinaryPart;
+  // true if the last command failed because the server can't decode a part.
+  bool fUnknownCTE;
+
   // points to the current body shell, if any
   RefPtr<nsIMAPBodyShell> m_shell;
 
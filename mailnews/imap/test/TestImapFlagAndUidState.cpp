@@ -161,6 +161,67 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  // Reset all
+  flagState->Reset();
+  // This tests a big mailbox with long stretches of consecutive uids,
+  // looking messages up by uid after expunging from the middle of them.
+  flagState->SetPartialUIDFetch(false);
+  for (uint32_t i = 0; i < 100000; i++)
+    flagState->AddUidFlagPair(i < 50000 ? i + 1 : i + 11,
+                              i % 10 ? kImapMsgSeenFlag : kImapMsgDeletedFlag,
+                              i);
+  flagState->ExpungeByIndex(21);
+  flagState->SetMessageFlags(0, kImapMsgSeenFlag);
+  flagState->SetMessageFlags(1, kImapMsgDeletedFlag);
+  struct {
+    uint32_t uid;
+    bool found;
+    int32_t index;
+  } lookups[] = {{1, true, 0},          {20, true, 19},
+                 {21, false, 19},       {22, true, 20},
+                 {50000, true, 49998},  {50001, false, 49998},
+                 {50011, true, 49999},  {100010, true, 99998},
+                 {100011, false, 99998}};
+  for (auto& lookup : lookups) {
+    bool foundIt;
+    int32_t index;
+    flagState->GetMessageFlagsFromUID(lookup.uid, &foundIt, &index);
+    if (foundIt != lookup.found || (foundIt && index != lookup.index)) {
+      printf("TEST-UNEXPECTED-FAIL | uid %d found %d at %d | %s\n",
+             lookup.uid, foundIt, index, __FILE__);
+      return -1;
+    }
+  }
+  // Messages 1, 11, 21 and so on were deleted; 1 was undeleted, 2 deleted
+  // and 21 expunged.
+  int32_t numDeleted;
+  flagState->GetNumberOfDeletedMessages(&numDeleted);
+  if (numDeleted != 9999) {
+    printf("TEST-UNEXPECTED-FAIL | %d deleted messages, not 9999 | %s\n",
+           numDeleted, __FILE__);
+    return -1;
+  }
+
+  // Messages share their keyword lists.
+  flagState->AddUidCustomFlagPair(5, "$label1");
+  flagState->AddUidCustomFlagPair(5, "junk");
+  flagState->AddUidCustomFlagPair(5, "$label1");
+  flagState->AddUidCustomFlagPair(6, "$label1");
+  flagState->AddUidCustomFlagPair(6, "junk");
+  char* customFlags5;
+  char* customFlags6;
+  flagState->GetCustomFlags(5, &customFlags5);
+  flagState->GetCustomFlags(6, &customFlags6);
+  bool keywordsMatch = customFlags5 && customFlags6 &&
+                       !strcmp(customFlags5, "$label1 junk") &&
+                       !strcmp(customFlags6, "$label1 junk");
+  free(customFlags5);
+  free(customFlags6);
+  if (!keywordsMatch) {
+    printf("TEST-UNEXPECTED-FAIL | wrong keywords | %s\n", __FILE__);
+    return -1;
+  }
+
   printf("TEST-PASS | %s | all tests passed\n", __FILE__);
   return 0;
 }
@@ -0,0 +1,218 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Streams messages whose large attachment is left on the server from a server
+ * supporting the BINARY extension. Checks that the base64 encoded text part
+ * and inline attachment are fetched decoded by the server, and that the
+ * attachment comes through byte for byte. Then has the server refuse to
+ * decode the attachment (UNKNOWN-CTE), and checks that it is fetched as it is
+ * instead. Last has the server give the decoded size of the text part but
+ * refuse to decode the part itself, and checks that the part is shown with
+ * the header and content the server has for it.
+ */
+
+var { Services } = ChromeUtils.import("resource://gre/modules/Services.jsm");
+
+/* import-globals-from ../../../test/resources/messageGenerator.js */
+load("../../../resources/messageGenerator.js");
+
+var { PromiseTestUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/PromiseTestUtils.jsm"
+);
+var mimeMsg = {};
+ChromeUtils.import("resource:///modules/gloda/mimemsg.js", mimeMsg);
+
+var kBodyText = "BINARY fetched text, with a non-ASCII character: é.";
+
+// Every octet but NUL, which the fake server can't send; lone CRs and LFs
+// included.
+var kImageData = "";
+for (let i = 1; i < 256; i++) {
+  kImageData += String.fromCharCode(i);
+}
+var kImageBase64 = btoa(kImageData).replace(/(.{76})/g, "$1\r\n");
+
+function addMessage() {
+  let utf8Text = unescape(encodeURIComponent(kBodyText));
+  let messageGenerator = new MessageGenerator();
+  let message = messageGenerator.makeMessage({
+    body: {
+      body: btoa(utf8Text).replace(/(.{20})/g, "$1\r\n"),
+      contentType: "text/plain",
+      charset: "UTF-8",
+      encoding: "base64",
+    },
+    attachments: [
+      {
+        body: kImageBase64,
+        contentType: "image/png",
+        encoding: "base64",
+        filename: "octets.png",
+      },
+      {
+        body: btoa("x".repeat(4000)),
+        contentType: "application/pdf",
+        encoding: "base64",
+        filename: "big.pdf",
+      },
+    ],
+  });
+  let dataUri = Services.io.newURI(
+    "data:text/plain;base64," + btoa(message.toMessageString())
+  );
+  IMAPPump.mailbox.addMessage(
+    new imapMessage(dataUri.spec, IMAPPump.mailbox.uidnext++, [])
+  );
+}
+
+// Streams the message as generated from its parts, byte for byte.
+function streamParts(aMsgHdr) {
+  let msgURI = aMsgHdr.folder.getUriForMsg(aMsgHdr);
+  let msgServ = Cc["@mozilla.org/messenger;1"]
+    .createInstance(Ci.nsIMessenger)
+    .messageServiceFromURI(msgURI);
+  return new Promise((resolve, reject) => {
+    let data = "";
+    msgServ.streamMessage(
+      msgURI,
+      {
+        QueryInterface: ChromeUtils.generateQI([Ci.nsIStreamListener]),
+        onStartRequest(aRequest) {},
+        onDataAvailable(aRequest, aInputStream, aOffset, aCount) {
+          let stream = Cc[
+            "@mozilla.org/scriptableinputstream;1"
+          ].createInstance(Ci.nsIScriptableInputStream);
+          stream.init(aInputStream);
+          data += stream.readBytes(aCount);
+        },
+        onStopRequest(aRequest, aStatusCode) {
+          if (aStatusCode == Cr.NS_OK) {
+            resolve(data);
+          } else {
+            reject(aStatusCode);
+          }
+        },
+      },
+      null,
+      null,
+      false,
+      "&fetchCompleteMessage=false",
+      false
+    );
+  });
+}
+
+function getMimeMessage(aMsgHdr) {
+  return new Promise(resolve => {
+    mimeMsg.MsgHdrToMimeMessage(
+      aMsgHdr,
+      null,
+      (aMsgHdr, aMimeMessage) => resolve(aMimeMessage),
+      true /* allowDownload */,
+      { partsOnDemand: true }
+    );
+  });
+}
+
+function messageAt(aIndex) {
+  let enumerator = IMAPPump.inbox.msgDatabase.EnumerateMessages();
+  let msgHdr;
+  for (let i = 0; i <= aIndex; i++) {
+    msgHdr = enumerator.getNext().QueryInterface(Ci.nsIMsgDBHdr);
+  }
+  return msgHdr;
+}
+
+add_task(async function setup() {
+  Services.prefs.setIntPref("mail.imap.mime_parts_on_demand_threshold", 20);
+  Services.prefs.setBoolPref("mail.imap.mime_parts_on_demand", true);
+  Services.prefs.setBoolPref(
+    "mail.server.server1.autosync_offline_stores",
+    false
+  );
+  Services.prefs.setBoolPref("mail.server.server1.offline_download", false);
+  Services.prefs.setIntPref("browser.cache.disk.capacity", 0);
+  setupIMAPPump("RFC3516");
+
+  // The shells of the messages are cached, so each test gets one of its own.
+  addMessage();
+  addMessage();
+  addMessage();
+  addMessage();
+
+  let promiseUrlListener = new PromiseTestUtils.PromiseUrlListener();
+  IMAPPump.inbox.updateFolderWithListener(null, promiseUrlListener);
+  await promiseUrlListener.promise;
+});
+
+add_task(async function streamWithBinaryFetch() {
+  let transaction = IMAPPump.server.playTransaction();
+  let start = transaction.them.length;
+
+  let mimeMessage = await getMimeMessage(messageAt(0));
+
+  let commands = transaction.them.slice(start);
+  Assert.ok(commands.some(command => command.includes("BINARY.SIZE[1]")));
+  Assert.ok(commands.some(command => command.includes("BINARY.PEEK[1]")));
+  Assert.ok(commands.some(command => command.includes("BINARY.PEEK[2]")));
+  Assert.ok(mimeMessage.allUserAttachments[1].url.includes("/;section="));
+  Assert.ok(mimeMessage.coerceBodyToPlaintext().includes(kBodyText));
+});
+
+add_task(async function attachmentComesThroughUnchanged() {
+  let data = await streamParts(messageAt(1));
+  Assert.ok(data.includes("Content-Transfer-Encoding: binary"));
+  Assert.ok(data.includes(kImageData));
+});
+
+add_task(async function fetchUndecodablePart() {
+  IMAPPump.daemon.undecodableParts = ["2"];
+  let transaction = IMAPPump.server.playTransaction();
+  let start = transaction.them.length;
+
+  let data = await streamParts(messageAt(2));
+
+  // The sizes are asked for again one part at a time, so the server still
+  // decodes the text part.
+  let commands = transaction.them.slice(start);
+  Assert.ok(commands.some(command => command.includes("BINARY.PEEK[1]")));
+  Assert.ok(!commands.some(command => command.includes("BINARY.PEEK[2]")));
+  Assert.ok(commands.some(command => command.includes("BODY.PEEK[2]")));
+  Assert.ok(data.includes(kImageBase64.split("\r\n")[0]));
+  IMAPPump.daemon.undecodableParts = [];
+});
+
+add_task(async function partRefusedAfterItsSize() {
+  IMAPPump.daemon.undecodableContent = ["1"];
+  let transaction = IMAPPump.server.playTransaction();
+  let start = transaction.them.length;
+
+  let data = await streamParts(messageAt(3));
+
+  let commands = transaction.them.slice(start);
+  Assert.ok(commands.some(command => command.includes("BINARY.SIZE[1]")));
+  Assert.ok(commands.some(command => command.includes("BINARY.PEEK[1]")));
+  Assert.ok(commands.some(command => command.includes("BODY.PEEK[1]")));
+  // The text part comes as base64, under a header that says so; only the
+  // inline attachment is said to be binary.
+  let utf8Text = unescape(encodeURIComponent(kBodyText));
+  let contentStart = data.indexOf(btoa(utf8Text).substr(0, 20));
+  Assert.notEqual(contentStart, -1);
+  let partHeader = data.substring(
+    data.lastIndexOf("\r\n--", contentStart),
+    contentStart
+  );
+  Assert.ok(partHeader.includes("Content-Transfer-Encoding: base64"));
+  Assert.ok(!partHeader.includes("binary"));
+  Assert.equal(data.split("Content-Transfer-Encoding: binary").length, 2);
+
+  // and shown decoded
+  let mimeMessage = await getMimeMessage(messageAt(3));
+  Assert.ok(mimeMessage.coerceBodyToPlaintext().includes(kBodyText));
+  IMAPPump.daemon.undecodableContent = [];
+});
+
+add_task(function endTest() {
+  teardownIMAPPump();
+});
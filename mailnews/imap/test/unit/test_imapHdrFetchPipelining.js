@@ -0,0 +1,69 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Downloads the headers of a folder whose new messages are one run of uids,
+ * from a server with 50 ms of latency. Checks that the fetch was split into
+ * several commands that were pipelined, and that all the headers arrived,
+ * were added to the db in uid order, and match the messages.
+ */
+
+/* import-globals-from ../../../test/resources/messageGenerator.js */
+load("../../../resources/messageGenerator.js");
+
+var { MailServices } = ChromeUtils.import(
+  "resource:///modules/MailServices.jsm"
+);
+var { PromiseTestUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/PromiseTestUtils.jsm"
+);
+
+var kLatency = 50;
+var kMessageCount = 600;
+
+add_task(async function testPipelinedHdrFetch() {
+  setupIMAPPump();
+
+  let messageGenerator = new MessageGenerator();
+  let mailbox = IMAPPump.mailbox;
+  let messages = new Map();
+  for (let i = 0; i < kMessageCount; i++) {
+    let message = messageGenerator.makeMessage();
+    let dataUri = Services.io.newURI(
+      "data:text/plain;base64," + btoa(message.toMessageString())
+    );
+    messages.set(mailbox.uidnext, message);
+    mailbox.addMessage(new imapMessage(dataUri.spec, mailbox.uidnext++, []));
+  }
+
+  let addedKeys = [];
+  let listener = {
+    msgAdded(aMsg) {
+      addedKeys.push(aMsg.messageKey);
+    },
+  };
+  MailServices.mfn.addListener(
+    listener,
+    Ci.nsIMsgFolderNotificationService.msgAdded
+  );
+  IMAPPump.server.latency = kLatency;
+  let promiseUrlListener = new PromiseTestUtils.PromiseUrlListener();
+  IMAPPump.inbox.updateFolderWithListener(null, promiseUrlListener);
+  await promiseUrlListener.promise;
+  MailServices.mfn.removeListener(listener);
+
+  let db = IMAPPump.inbox.msgDatabase;
+  Assert.equal(db.dBFolderInfo.numMessages, kMessageCount);
+  Assert.ok(IMAPPump.server.maxLinesInFlight >= 2);
+  Assert.deepEqual(addedKeys, [...messages.keys()]);
+  for (let [uid, message] of messages) {
+    let hdr = db.GetMsgHdrForKey(uid);
+    Assert.equal(hdr.messageId, message.messageId);
+    Assert.equal(hdr.subject, message.subject);
+  }
+});
+
+add_task(function endTest() {
+  IMAPPump.server.latency = 0;
+  teardownIMAPPump();
+});
@@ -0,0 +1,113 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Streams messages much larger than a socket read and the download cache,
+ * which are read from the server in blocks rather than line by line. Checks
+ * that they come through unchanged but for their line endings: once in a
+ * single literal, and once in chunks that each end between a CR and its LF.
+ */
+
+var { Services } = ChromeUtils.import("resource://gre/modules/Services.jsm");
+var { PromiseTestUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/PromiseTestUtils.jsm"
+);
+
+var kChunkSize = 10000;
+
+// Builds a message whose header is one byte longer than a multiple of the
+// 100 byte body lines, so every chunk ends with the CR of a line.
+function makeMessage(aSubject) {
+  let header =
+    "From: Tester <tester@example.com>\r\n" +
+    "To: Tester <tester@example.com>\r\n" +
+    "Subject: " +
+    aSubject +
+    "\r\n" +
+    "Message-ID: <" +
+    aSubject.replace(/ /g, "") +
+    "@example.com>\r\n" +
+    "X-Pad: ";
+  let pad = (101 - ((header.length + 4) % 100)) % 100;
+  header += "p".repeat(pad) + "\r\n\r\n";
+
+  let body = "";
+  for (let i = 0; i < 3000; i++) {
+    body += (i % 10).toString().repeat(98) + "\r\n";
+  }
+  // a line longer than the download cache, and one ending in a bare LF
+  body += "y".repeat(100000) + "\r\n";
+  body += "bare LF\n";
+  body += "last line\r\n";
+  return header + body;
+}
+
+function addMessage(aMessage) {
+  let dataUri = Services.io.newURI(
+    "data:text/plain;base64," + btoa(aMessage)
+  );
+  IMAPPump.mailbox.addMessage(
+    new imapMessage(dataUri.spec, IMAPPump.mailbox.uidnext++, [])
+  );
+}
+
+async function streamMessage(aKey) {
+  let msgHdr = IMAPPump.inbox.msgDatabase.GetMsgHdrForKey(aKey);
+  let msgURI = IMAPPump.inbox.getUriForMsg(msgHdr);
+  let msgServ = Cc["@mozilla.org/messenger;1"]
+    .createInstance(Ci.nsIMessenger)
+    .messageServiceFromURI(msgURI);
+  let streamListener = new PromiseTestUtils.PromiseStreamListener();
+  msgServ.streamMessage(msgURI, streamListener, null, null, false, "", false);
+  return streamListener.promise;
+}
+
+var gMessages = [makeMessage("Single literal"), makeMessage("Chunked")];
+
+add_task(async function setup() {
+  // Set before the first connection reads them.
+  Services.prefs.setBoolPref("mail.server.default.fetch_by_chunks", true);
+  Services.prefs.setIntPref("mail.imap.chunk_size", kChunkSize);
+  Services.prefs.setIntPref(
+    "mail.imap.min_chunk_size_threshold",
+    kChunkSize + kChunkSize / 2
+  );
+  Services.prefs.setIntPref("mail.imap.chunk_add", 0);
+  Services.prefs.setBoolPref(
+    "mail.server.server1.autosync_offline_stores",
+    false
+  );
+  Services.prefs.setBoolPref("mail.server.server1.offline_download", false);
+  setupIMAPPump();
+
+  for (let message of gMessages) {
+    addMessage(message);
+  }
+  let promiseUrlListener = new PromiseTestUtils.PromiseUrlListener();
+  IMAPPump.inbox.updateFolderWithListener(null, promiseUrlListener);
+  await promiseUrlListener.promise;
+});
+
+add_task(async function singleLiteral() {
+  Services.prefs.setBoolPref("mail.server.server1.fetch_by_chunks", false);
+  let data = await streamMessage(1);
+  Assert.equal(data, gMessages[0].replace(/\r?\n/g, "\r\n"));
+});
+
+add_task(async function chunkBoundariesInLineBreaks() {
+  Services.prefs.setBoolPref("mail.server.server1.fetch_by_chunks", true);
+  let transaction = IMAPPump.server.playTransaction();
+  let start = transaction.them.length;
+
+  let data = await streamMessage(2);
+
+  let commands = transaction.them.slice(start);
+  Assert.ok(
+    commands.some(command => command.includes("<" + kChunkSize + "."))
+  );
+  Assert.equal(data, gMessages[1].replace(/\r?\n/g, "\r\n"));
+});
+
+add_task(function endTest() {
+  teardownIMAPPump();
+});
@@ -0,0 +1,113 @@
+/* -*- Mode: Java; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * Test that when the server supports QRESYNC (RFC 7162), reselecting a folder
+ * only transfers what changed: flag changes and expunges made from another
+ * machine reach the db without a fetch of all the flags, and so do expunges
+ * reported as VANISHED while the folder is selected.
+ */
+
+/* import-globals-from ../../../test/resources/logHelper.js */
+/* import-globals-from ../../../test/resources/messageGenerator.js */
+load("../../../resources/logHelper.js");
+load("../../../resources/messageGenerator.js");
+
+var { PromiseTestUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/PromiseTestUtils.jsm"
+);
+
+var gMessageGenerator = new MessageGenerator();
+var gMessages = [];
+var gSecondFolder;
+
+// Changes made to the mailbox directly need a new modseq.
+function bumpModSeq(aMessage) {
+  let mailbox = IMAPPump.mailbox;
+  mailbox.highestmodseq = (mailbox.highestmodseq || 1) + 1;
+  aMessage.modseq = mailbox.highestmodseq;
+}
+
+function addMessage() {
+  let synthMessage = gMessageGenerator.makeMessage();
+  let msgURI = Services.io.newURI(
+    "data:text/plain;base64," + btoa(synthMessage.toMessageString())
+  );
+  let message = new imapMessage(msgURI.spec, IMAPPump.mailbox.uidnext++, []);
+  bumpModSeq(message);
+  IMAPPump.mailbox.addMessage(message);
+  gMessages.push([message, synthMessage.messageId]);
+}
+
+function getHdr(aIndex) {
+  return IMAPPump.inbox.msgDatabase.getMsgHdrForMessageID(gMessages[aIndex][1]);
+}
+
+async function updateFolder(aFolder) {
+  let promiseUrlListener = new PromiseTestUtils.PromiseUrlListener();
+  aFolder.updateFolderWithListener(null, promiseUrlListener);
+  await promiseUrlListener.promise;
+}
+
+add_task(async function setup() {
+  Services.prefs.setBoolPref("mail.server.default.use_condstore", true);
+  setupIMAPPump("RFC7162");
+  IMAPPump.daemon.createMailbox("secondFolder", { subscribed: true });
+  for (let i = 0; i < 5; i++) {
+    addMessage();
+  }
+  await updateFolder(IMAPPump.inbox);
+  Assert.equal(IMAPPump.inbox.getTotalMessages(false), 5);
+  gSecondFolder = IMAPPump.incomingServer.rootFolder
+    .getChildNamed("secondFolder")
+    .QueryInterface(Ci.nsIMsgImapMailFolder);
+});
+
+add_task(async function resyncChangesFromElsewhere() {
+  // Select another folder, so that the inbox is selected again below.
+  await updateFolder(gSecondFolder);
+
+  // Another client reads a message, expunges two and a new one arrives.
+  let mailbox = IMAPPump.mailbox;
+  gMessages[0][0].setFlag("\\Seen");
+  bumpModSeq(gMessages[0][0]);
+  mailbox.highestmodseq++;
+  mailbox.vanished = [];
+  for (let index of [1, 3]) {
+    let message = gMessages[index][0];
+    mailbox._messages.splice(mailbox._messages.indexOf(message), 1);
+    mailbox.vanished.push({ uid: message.uid, modseq: mailbox.highestmodseq });
+  }
+  addMessage();
+
+  let transaction = IMAPPump.server.playTransaction();
+  let start = transaction.them.length;
+  await updateFolder(IMAPPump.inbox);
+  let commands = transaction.them.slice(start);
+  Assert.ok(
+    commands.some(command =>
+      /select "INBOX" \(QRESYNC \(\d+ \d+ 1:5\)\)/.test(command)
+    )
+  );
+  Assert.ok(!commands.some(command => command.includes("1:*")));
+
+  Assert.equal(IMAPPump.inbox.getTotalMessages(false), 4);
+  Assert.ok(getHdr(0).isRead);
+  Assert.equal(getHdr(1), null);
+  Assert.ok(!getHdr(2).isRead);
+  Assert.equal(getHdr(3), null);
+  Assert.ok(getHdr(5));
+});
+
+add_task(async function expungeWhileSelected() {
+  gMessages[2][0].setFlag("\\Deleted");
+  bumpModSeq(gMessages[2][0]);
+  let promiseUrlListener = new PromiseTestUtils.PromiseUrlListener();
+  IMAPPump.inbox.expunge(promiseUrlListener, null);
+  await promiseUrlListener.promise;
+  await updateFolder(IMAPPump.inbox);
+
+  Assert.equal(IMAPPump.inbox.getTotalMessages(false), 3);
+  Assert.equal(getHdr(2), null);
+  Assert.ok(getHdr(4));
+});
+
+add_task(teardownIMAPPump);
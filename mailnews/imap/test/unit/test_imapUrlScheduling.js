@@ -0,0 +1,191 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks how urls are handed out to the connections of an IMAP server:
+ * - a url the user is waiting for is queued ahead of background urls,
+ * - a url needing a folder selected prefers a connection with none selected,
+ * - a url waiting for the busy connection that has its folder selected
+ *   doesn't hold up the urls queued behind it,
+ * - checking folders for new mail runs STATUS on more than one connection.
+ */
+
+/* import-globals-from ../../../test/resources/messageGenerator.js */
+load("../../../resources/messageGenerator.js");
+
+var kMailboxes = ["a", "b", "c", "d", "e", "f"];
+
+// The SELECT and STATUS commands the server handled, in order, with the
+// handler of the connection they came in on.
+var gCommands = [];
+
+var gMsgWindow = Cc["@mozilla.org/messenger/msgwindow;1"].createInstance(
+  Ci.nsIMsgWindow
+);
+
+function addMessageTo(aMailbox) {
+  let messageGenerator = new MessageGenerator();
+  let message = messageGenerator.makeMessage();
+  let dataUri = Services.io.newURI(
+    "data:text/plain;base64," + btoa(message.toMessageString())
+  );
+  aMailbox.addMessage(new imapMessage(dataUri.spec, aMailbox.uidnext++, []));
+}
+
+function folder(aName) {
+  return IMAPPump.incomingServer.rootFolder
+    .getChildNamed(aName)
+    .QueryInterface(Ci.nsIMsgImapMailFolder);
+}
+
+// Urls without a window, for a folder that isn't open in one, are background
+// urls.
+function updateFolder(aName, aMsgWindow = null) {
+  let listener = new PromiseTestUtils.PromiseUrlListener();
+  folder(aName).updateFolderWithListener(aMsgWindow, listener);
+  return listener.promise;
+}
+
+function updateStatus(aName) {
+  let listener = new PromiseTestUtils.PromiseUrlListener();
+  folder(aName).updateStatus(listener, null);
+  return listener.promise;
+}
+
+function lastCommand(aCommand, aMailbox) {
+  let commands = gCommands.filter(
+    c => c.command == aCommand && c.mailbox == aMailbox
+  );
+  return commands[commands.length - 1];
+}
+
+// Stops the server from answering the connection of aHandler. Returns a
+// function that lets it answer what it held back.
+function holdConnection(aHandler) {
+  let reader = IMAPPump.server._readers.find(r => r._handler == aHandler);
+  let held = [];
+  reader._processLine = line => held.push(line);
+  return function release() {
+    delete reader._processLine;
+    for (let line of held) {
+      reader._processLine(line);
+    }
+  };
+}
+
+add_task(async function setup() {
+  setupIMAPPump();
+
+  let createHandler = IMAPPump.server._handlerCreator;
+  IMAPPump.server._handlerCreator = function(aDaemon) {
+    let handler = createHandler(aDaemon);
+    for (let command of ["SELECT", "STATUS"]) {
+      let handle = handler[command];
+      handler[command] = function(args) {
+        gCommands.push({ command, mailbox: args[0], handler: this });
+        return handle.call(this, args);
+      };
+    }
+    return handler;
+  };
+
+  // The folders are discovered by the first connection, which is still
+  // getting going.
+  let promiseFolders = [];
+  for (let name of kMailboxes) {
+    IMAPPump.daemon.createMailbox(name, { subscribed: true });
+    addMessageTo(IMAPPump.daemon.getMailbox(name));
+    promiseFolders.push(PromiseTestUtils.promiseFolderAdded(name));
+  }
+  await Promise.all(promiseFolders);
+});
+
+add_task(async function interactiveBeforeBackground() {
+  // With a single connection, everything after the first url is queued.
+  let start = gCommands.length;
+  await Promise.all([
+    updateFolder("e", gMsgWindow),
+    updateFolder("b"),
+    updateFolder("c", gMsgWindow),
+  ]);
+
+  let selected = gCommands
+    .slice(start)
+    .filter(c => c.command == "SELECT" && kMailboxes.includes(c.mailbox))
+    .map(c => c.mailbox);
+  Assert.deepEqual(selected, ["e", "c", "b"]);
+});
+
+add_task(async function preferUnselectedConnection() {
+  IMAPPump.incomingServer.maximumConnectionsNumber = 2;
+
+  // The connection with b selected is busy, so a second one is opened for the
+  // STATUS, and stays in the authenticated state.
+  await Promise.all([updateFolder("b"), updateStatus("e")]);
+  let statusHandler = lastCommand("STATUS", "e").handler;
+  Assert.notEqual(statusHandler, lastCommand("SELECT", "b").handler);
+
+  // Both connections are free; d is selected on the one without a folder
+  // selected.
+  await updateFolder("d");
+  Assert.equal(lastCommand("SELECT", "d").handler, statusHandler);
+});
+
+add_task(async function skipUrlWaitingForFolder() {
+  let heldHandler = lastCommand("SELECT", "b").handler;
+  let release = holdConnection(heldHandler);
+
+  let held = updateFolder("b");
+  let other = updateFolder("d");
+  // Waits for the held connection, which has b selected...
+  let waiting = updateFolder("b");
+  // ...while the url queued behind it runs once d is done.
+  let next = updateFolder("c");
+  await Promise.all([other, next]);
+  Assert.notEqual(lastCommand("SELECT", "c").handler, heldHandler);
+
+  release();
+  await Promise.all([held, waiting]);
+});
+
+add_task(async function statusOnSeveralConnections() {
+  IMAPPump.incomingServer.maximumConnectionsNumber = 3;
+
+  let start = gCommands.length;
+  let checked = ["a", "d", "e"];
+  let promiseChecked = new Promise(resolve => {
+    let pending = new Set(checked);
+    let listener = {
+      OnItemIntPropertyChanged(aItem, aProperty, aOldValue, aNewValue) {
+        if (aProperty == "TotalUnreadMessages" && aNewValue > aOldValue) {
+          pending.delete(aItem.name);
+          if (pending.size == 0) {
+            MailServices.mailSession.RemoveFolderListener(listener);
+            resolve();
+          }
+        }
+      },
+    };
+    MailServices.mailSession.AddFolderListener(
+      listener,
+      Ci.nsIFolderListener.intPropertyChanged
+    );
+  });
+  for (let name of checked) {
+    addMessageTo(IMAPPump.daemon.getMailbox(name));
+    folder(name).setFlag(Ci.nsMsgFolderFlags.CheckNew);
+  }
+
+  IMAPPump.inbox.getNewMessages(null, null);
+  await promiseChecked;
+
+  let statuses = gCommands
+    .slice(start)
+    .filter(c => c.command == "STATUS" && checked.includes(c.mailbox));
+  Assert.deepEqual(statuses.map(c => c.mailbox).sort(), checked);
+  Assert.greater(new Set(statuses.map(c => c.handler)).size, 1);
+});
+
+add_task(function endTest() {
+  teardownIMAPPump();
+});
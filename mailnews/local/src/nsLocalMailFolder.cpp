@@ -310,6 +310,7 @@ NS_IMETHODIMP nsMsgLocalMailFolder::GetDatabaseWithReparse(
       NS_ENSURE_SUCCESS(rv, rv);
       // Remove summary file.
       summaryFile->Remove(false);
+      RemoveSummaryIndexFile(summaryFile);
 
       // if it's out of date then reopen with upgrade.
       rv = msgDBService->CreateNewDB(this, getter_AddRefs(mDatabase));
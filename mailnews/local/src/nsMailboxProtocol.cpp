@@ -43,6 +43,9 @@ static LazyLogModule MAILBOX("Mailbox");
  */
 #define OUTPUT_BUFFER_SIZE (4096 * 2)
 
+// Size of the blocks a mailbox being parsed is read in.
+#define MAILBOX_PARSE_SEGMENT_SIZE (64 * 1024)
+
 nsMailboxProtocol::nsMailboxProtocol(nsIURI *aURI) : nsMsgProtocol(aURI) {}
 
 nsMailboxProtocol::~nsMailboxProtocol() {}
@@ -104,6 +107,8 @@ nsresult nsMailboxProtocol::Initialize(nsIURI *aURL) {
           mailnewsUrl->SetMaxProgress(fileSize);
         }
 
+        // The parser skips message bodies in place, so hand it big blocks.
+        m_readSegmentSize = MAILBOX_PARSE_SEGMENT_SIZE;
         rv =
             OpenFileSocket(aURL, 0, -1 /* read in all the bytes in the file */);
       } else {
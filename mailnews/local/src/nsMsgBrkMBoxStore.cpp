@@ -357,6 +357,7 @@ NS_IMETHODIMP nsMsgBrkMBoxStore::RenameFolder(nsIMsgFolder *aFolder,
 
   nsString dbName(safeName);
   dbName.AppendLiteral(SUMMARY_SUFFIX);
+  RenameSummaryIndexFile(oldSummaryFile, dbName);
   oldSummaryFile->MoveTo(nullptr, dbName);
 
   if (numChildren > 0) {
@@ -39,6 +39,8 @@ bool nsMsgLocalStoreUtils::nsShouldIgnoreFile(nsAString &name) {
   // don't add summary files to the list of folders;
   // don't add popstate files to the list either, or rules (sort.dat).
   if (StringEndsWith(name, NS_LITERAL_STRING(".snm")) ||
+      StringEndsWith(name, NS_LITERAL_STRING(SUMMARY_SUFFIX
+                                                 SUMMARY_INDEX_SUFFIX)) ||
       name.LowerCaseEqualsLiteral("popstate.dat") ||
       name.LowerCaseEqualsLiteral("sort.dat") ||
       name.LowerCaseEqualsLiteral("mailfilt.log") ||
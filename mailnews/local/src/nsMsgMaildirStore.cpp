@@ -9,6 +9,9 @@
 
 #include "prprf.h"
 #include "mozilla/Logging.h"
+#include "mozilla/Atomics.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/TimeStamp.h"
 #include "msgCore.h"
 #include "nsMsgMaildirStore.h"
 #include "nsIMsgFolder.h"
@@ -30,7 +33,7 @@
 #include "nsParseMailbox.h"
 #include "nsMsgLocalCID.h"
 #include "nsIMsgLocalMailFolder.h"
-#include "nsITimer.h"
+#include "nsIThreadPool.h"
 #include "nsIMailboxUrl.h"
 #include "nsIMsgMailNewsUrl.h"
 #include "nsIMsgFilterPlugin.h"
@@ -389,6 +392,7 @@ NS_IMETHODIMP nsMsgMaildirStore::RenameFolder(nsIMsgFolder *aFolder,
   // rename summary
   nsAutoString summaryName(safeName);
   summaryName.AppendLiteral(SUMMARY_SUFFIX);
+  RenameSummaryIndexFile(oldSummaryFile, summaryName);
   oldSummaryFile->MoveTo(nullptr, summaryName);
 
   nsCOMPtr<nsIMsgFolder> parentFolder;
@@ -1136,130 +1140,261 @@ NS_IMETHODIMP nsMsgMaildirStore::CompactFolder(nsIMsgFolder *aFolder,
   return NS_OK;
 }
 
-class MaildirStoreParser {
+// Rebuilding the index of a maildir folder reads the header block of each
+// message file on a thread pool, a batch of files at a time, and then parses
+// the headers and adds them to the db on the main thread, since the db is not
+// thread safe. The next batch is read while the current one is committed.
+struct MaildirHeaderBlock {
+  nsCOMPtr<nsIFile> m_file;
+  nsCString m_headers;  // raw headers, including the blank line ending them
+  int64_t m_fileSize;
+  nsresult m_status;
+};
+
+class MaildirStoreParser final {
  public:
+  NS_INLINE_DECL_THREADSAFE_REFCOUNTING(MaildirStoreParser)
+
   MaildirStoreParser(nsIMsgFolder *aFolder, nsIMsgDatabase *aMsgDB,
                      nsIDirectoryEnumerator *aDirectoryEnumerator,
                      nsIUrlListener *aUrlListener);
-  virtual ~MaildirStoreParser();
 
-  nsresult ParseNextMessage(nsIFile *aFile);
-  static void TimerCallback(nsITimer *aTimer, void *aClosure);
-  nsresult StartTimer();
+  nsresult Start();
+  // Called on a pool thread to read the header block for one batch entry.
+  void ReadHeaderBlock(uint32_t aIndex);
+  // Called on the main thread when all entries of a batch have been read.
+  void CommitBatch();
+
+ private:
+  ~MaildirStoreParser() {}
+
+  bool ReadNextBatch();
+  nsresult ParseHeaderBlock(MaildirHeaderBlock &aBlock);
+  void Finish();
 
   nsCOMPtr<nsIDirectoryEnumerator> m_directoryEnumerator;
   nsCOMPtr<nsIMsgFolder> m_folder;
   nsCOMPtr<nsIMsgDatabase> m_db;
-  nsCOMPtr<nsITimer> m_timer;
   nsCOMPtr<nsIUrlListener> m_listener;
+  nsCOMPtr<nsIThreadPool> m_readPool;
+  RefPtr<nsParseMailMessageState> m_msgParser;
+  nsTArray<MaildirHeaderBlock> m_batch;
+  mozilla::Atomic<uint32_t> m_pendingReads;
+  uint32_t m_batchSize;
+  uint32_t m_numFiles;
+  mozilla::TimeStamp m_startTime;
 };
 
 MaildirStoreParser::MaildirStoreParser(nsIMsgFolder *aFolder,
                                        nsIMsgDatabase *aMsgDB,
                                        nsIDirectoryEnumerator *aDirEnum,
-                                       nsIUrlListener *aUrlListener) {
+                                       nsIUrlListener *aUrlListener)
+    : m_pendingReads(0), m_batchSize(256), m_numFiles(0) {
   m_folder = aFolder;
   m_db = aMsgDB;
   m_directoryEnumerator = aDirEnum;
   m_listener = aUrlListener;
 }
 
-MaildirStoreParser::~MaildirStoreParser() {}
+nsresult MaildirStoreParser::Start() {
+  NS_ENSURE_TRUE(m_db, NS_ERROR_NULL_POINTER);
+  int32_t batchSize =
+      mozilla::Preferences::GetInt("mail.maildir.rebuild_batch_size", 256);
+  int32_t numThreads =
+      mozilla::Preferences::GetInt("mail.maildir.rebuild_threads", 4);
+  m_batchSize = std::max(batchSize, 1);
 
-nsresult MaildirStoreParser::ParseNextMessage(nsIFile *aFile) {
   nsresult rv;
-  NS_ENSURE_TRUE(m_db, NS_ERROR_NULL_POINTER);
-  nsCOMPtr<nsIInputStream> inputStream;
-  nsCOMPtr<nsIMsgParseMailMsgState> msgParser =
-      do_CreateInstance(NS_PARSEMAILMSGSTATE_CONTRACTID, &rv);
-  NS_ENSURE_SUCCESS(rv, rv);
-  msgParser->SetMailDB(m_db);
-  nsCOMPtr<nsIMsgDBHdr> newMsgHdr;
-  rv = m_db->CreateNewHdr(nsMsgKey_None, getter_AddRefs(newMsgHdr));
+  m_readPool = do_CreateInstance("@mozilla.org/thread-pool;1", &rv);
   NS_ENSURE_SUCCESS(rv, rv);
-
-  newMsgHdr->SetMessageOffset(0);
-
-  rv = NS_NewLocalFileInputStream(getter_AddRefs(inputStream), aFile);
-  if (NS_SUCCEEDED(rv) && inputStream) {
-    RefPtr<nsMsgLineStreamBuffer> inputStreamBuffer =
-        new nsMsgLineStreamBuffer(FILE_IO_BUFFER_SIZE, true, false);
-    int64_t fileSize;
-    aFile->GetFileSize(&fileSize);
-    msgParser->SetNewMsgHdr(newMsgHdr);
-    msgParser->SetState(nsIMsgParseMailMsgState::ParseHeadersState);
-    msgParser->SetEnvelopePos(0);
-    bool needMoreData = false;
-    char *newLine = nullptr;
-    uint32_t numBytesInLine = 0;
-    // we only have to read the headers, because we know the message size
-    // from the file size. So we can do this in one time slice.
-    do {
-      newLine = inputStreamBuffer->ReadNextLine(inputStream, numBytesInLine,
-                                                needMoreData);
-      if (newLine) {
-        msgParser->ParseAFolderLine(newLine, numBytesInLine);
-        free(newLine);
-      }
-    } while (newLine && numBytesInLine > 0);
-
-    msgParser->FinishHeader();
-    // A single message needs to be less than 4GB
-    newMsgHdr->SetMessageSize((uint32_t)fileSize);
-    m_db->AddNewHdrToDB(newMsgHdr, true);
-    nsAutoCString storeToken;
-    aFile->GetNativeLeafName(storeToken);
-    newMsgHdr->SetStringProperty("storeToken", storeToken.get());
+  m_readPool->SetName(NS_LITERAL_CSTRING("MaildirRebuild"));
+  m_readPool->SetThreadLimit(std::max(numThreads, 1));
+  m_readPool->SetIdleThreadLimit(std::max(numThreads, 1));
+
+  // One parse state is reused for every message in the folder.
+  m_msgParser = new nsParseMailMessageState();
+  m_msgParser->SetMailDB(m_db);
+
+  m_startTime = mozilla::TimeStamp::Now();
+  if (!ReadNextBatch()) {
+    // Empty folder; still finish asynchronously, like a non-empty one.
+    RefPtr<MaildirStoreParser> self = this;
+    return NS_DispatchToMainThread(NS_NewRunnableFunction(
+        "MaildirStoreParser::Finish", [self]() { self->Finish(); }));
   }
-  NS_ENSURE_SUCCESS(rv, rv);
-  return rv;
+  return NS_OK;
 }
 
-void MaildirStoreParser::TimerCallback(nsITimer *aTimer, void *aClosure) {
-  MaildirStoreParser *parser = (MaildirStoreParser *)aClosure;
+// Takes the next batch of files from the directory enumerator and dispatches
+// a read of each of them to the pool. Returns false if there were no files
+// left.
+bool MaildirStoreParser::ReadNextBatch() {
+  MOZ_ASSERT(NS_IsMainThread());
+  m_batch.Clear();
   bool hasMore;
-  parser->m_directoryEnumerator->HasMoreElements(&hasMore);
-  if (!hasMore) {
-    nsCOMPtr<nsIMsgPluggableStore> store;
-    parser->m_folder->GetMsgStore(getter_AddRefs(store));
-    parser->m_timer->Cancel();
-    if (parser->m_db) parser->m_db->SetSummaryValid(true);
-    // store->SetSummaryFileValid(parser->m_folder, parser->m_db, true);
-    if (parser->m_listener) {
-      nsresult rv;
-      nsCOMPtr<nsIMailboxUrl> mailboxurl =
-          do_CreateInstance(NS_MAILBOXURL_CONTRACTID, &rv);
-      if (NS_SUCCEEDED(rv) && mailboxurl) {
-        nsCOMPtr<nsIMsgMailNewsUrl> url = do_QueryInterface(mailboxurl);
-        url->SetUpdatingFolder(true);
-        nsAutoCString uriSpec("mailbox://");
-        // ### TODO - what if SetSpec fails?
-        (void)url->SetSpecInternal(uriSpec);
-        parser->m_listener->OnStopRunningUrl(url, NS_OK);
+  while (m_batch.Length() < m_batchSize &&
+         NS_SUCCEEDED(m_directoryEnumerator->HasMoreElements(&hasMore)) &&
+         hasMore) {
+    nsCOMPtr<nsIFile> currentFile;
+    nsresult rv =
+        m_directoryEnumerator->GetNextFile(getter_AddRefs(currentFile));
+    if (NS_FAILED(rv) || !currentFile) break;
+    MaildirHeaderBlock *block = m_batch.AppendElement();
+    block->m_file = currentFile;
+    block->m_fileSize = 0;
+    block->m_status = NS_OK;
+  }
+  uint32_t count = m_batch.Length();
+  if (!count) return false;
+
+  // The batch array must not be resized until all reads have completed.
+  m_pendingReads = count;
+  RefPtr<MaildirStoreParser> self = this;
+  for (uint32_t i = 0; i < count; i++) {
+    nsresult rv = m_readPool->Dispatch(
+        NS_NewRunnableFunction("MaildirStoreParser::ReadHeaderBlock",
+                               [self, i]() { self->ReadHeaderBlock(i); }),
+        NS_DISPATCH_NORMAL);
+    if (NS_FAILED(rv)) {
+      // Do the read here rather than stalling the batch.
+      ReadHeaderBlock(i);
+    }
+  }
+  return true;
+}
+
+void MaildirStoreParser::ReadHeaderBlock(uint32_t aIndex) {
+  MaildirHeaderBlock &block = m_batch[aIndex];
+  PRFileDesc *fd = nullptr;
+  block.m_status = block.m_file->GetFileSize(&block.m_fileSize);
+  if (NS_SUCCEEDED(block.m_status))
+    block.m_status = block.m_file->OpenNSPRFileDesc(PR_RDONLY, 0, &fd);
+  if (NS_SUCCEEDED(block.m_status)) {
+    // We know the message size from the file size, so we only have to read
+    // up to the blank line that terminates the headers.
+    char buffer[FILE_IO_BUFFER_SIZE];
+    uint32_t scanFrom = 0;
+    int32_t bytesRead;
+    while ((bytesRead = PR_Read(fd, buffer, sizeof(buffer))) > 0) {
+      block.m_headers.Append(buffer, bytesRead);
+      const char *start = block.m_headers.BeginReading();
+      const char *end = block.m_headers.EndReading();
+      // Back up three chars so a blank line ("\n\n" or "\n\r\n") split across
+      // reads is still found.
+      const char *cur = start + (scanFrom > 3 ? scanFrom - 3 : 0);
+      const char *headerEnd = nullptr;
+      if (!scanFrom && (*start == '\n' || !strncmp(start, "\r\n", 2)))
+        headerEnd = start + (*start == '\n' ? 1 : 2);
+      while (!headerEnd && cur < end &&
+             (cur = static_cast<const char *>(memchr(cur, '\n', end - cur)))) {
+        ++cur;
+        if (cur < end && *cur == '\n') {
+          headerEnd = cur + 1;
+        } else if (cur + 1 < end && cur[0] == '\r' && cur[1] == '\n') {
+          headerEnd = cur + 2;
+        }
+      }
+      if (headerEnd) {
+        block.m_headers.SetLength(headerEnd - start);
+        break;
       }
+      scanFrom = block.m_headers.Length();
     }
-    // Parsing complete and timer cancelled, so we release the parser object.
-    delete parser;
-    return;
+    if (bytesRead < 0) block.m_status = NS_ERROR_FAILURE;
+    PR_Close(fd);
+  }
+
+  if (--m_pendingReads == 0) {
+    RefPtr<MaildirStoreParser> self = this;
+    NS_DispatchToMainThread(NS_NewRunnableFunction(
+        "MaildirStoreParser::CommitBatch", [self]() { self->CommitBatch(); }));
   }
-  nsCOMPtr<nsIFile> currentFile;
-  nsresult rv =
-      parser->m_directoryEnumerator->GetNextFile(getter_AddRefs(currentFile));
-  if (NS_SUCCEEDED(rv)) rv = parser->ParseNextMessage(currentFile);
-  if (NS_FAILED(rv) && parser->m_listener)
-    parser->m_listener->OnStopRunningUrl(nullptr, NS_ERROR_FAILURE);
 }
 
-nsresult MaildirStoreParser::StartTimer() {
-  nsresult rv;
-  m_timer = do_CreateInstance("@mozilla.org/timer;1", &rv);
+void MaildirStoreParser::CommitBatch() {
+  MOZ_ASSERT(NS_IsMainThread());
+  nsTArray<MaildirHeaderBlock> batch;
+  batch.SwapElements(m_batch);
+  // Start reading the next batch before we parse this one.
+  bool hasMore = ReadNextBatch();
+
+  for (uint32_t i = 0; i < batch.Length(); i++) {
+    nsresult rv = batch[i].m_status;
+    if (NS_SUCCEEDED(rv)) rv = ParseHeaderBlock(batch[i]);
+    if (NS_FAILED(rv) && m_listener)
+      m_listener->OnStopRunningUrl(nullptr, NS_ERROR_FAILURE);
+  }
+  m_numFiles += batch.Length();
+
+  if (!hasMore) Finish();
+}
+
+nsresult MaildirStoreParser::ParseHeaderBlock(MaildirHeaderBlock &aBlock) {
+  NS_ENSURE_TRUE(m_db, NS_ERROR_NULL_POINTER);
+  nsCOMPtr<nsIMsgDBHdr> newMsgHdr;
+  nsresult rv = m_db->CreateNewHdr(nsMsgKey_None, getter_AddRefs(newMsgHdr));
   NS_ENSURE_SUCCESS(rv, rv);
-  m_timer->InitWithNamedFuncCallback(TimerCallback, (void *)this, 0,
-                                     nsITimer::TYPE_REPEATING_SLACK,
-                                     "MaildirStoreParser::TimerCallback");
+
+  newMsgHdr->SetMessageOffset(0);
+
+  m_msgParser->Clear();
+  m_msgParser->SetNewMsgHdr(newMsgHdr);
+  m_msgParser->SetState(nsIMsgParseMailMsgState::ParseHeadersState);
+  m_msgParser->SetEnvelopePos(0);
+
+  // Feed the header block to the parser a line at a time, line endings
+  // included, ending with the blank line.
+  const char *line = aBlock.m_headers.BeginReading();
+  const char *end = aBlock.m_headers.EndReading();
+  while (line < end) {
+    const char *eol =
+        static_cast<const char *>(memchr(line, '\n', end - line));
+    const char *next = eol ? eol + 1 : end;
+    m_msgParser->ParseFolderLine(line, next - line);
+    line = next;
+  }
+  // A file without a body has no blank line, so end the headers here.
+  if (m_msgParser->m_state == nsIMsgParseMailMsgState::ParseHeadersState)
+    m_msgParser->ParseFolderLine(MSG_LINEBREAK, MSG_LINEBREAK_LEN);
+
+  m_msgParser->FinishHeader();
+  // A single message needs to be less than 4GB
+  newMsgHdr->SetMessageSize((uint32_t)aBlock.m_fileSize);
+  m_db->AddNewHdrToDB(newMsgHdr, true);
+  nsAutoCString storeToken;
+  aBlock.m_file->GetNativeLeafName(storeToken);
+  newMsgHdr->SetStringProperty("storeToken", storeToken.get());
+  m_msgParser->SetNewMsgHdr(nullptr);
   return NS_OK;
 }
 
+void MaildirStoreParser::Finish() {
+  MOZ_ASSERT(NS_IsMainThread());
+  if (m_readPool) {
+    m_readPool->Shutdown();
+    m_readPool = nullptr;
+  }
+  double seconds = (mozilla::TimeStamp::Now() - m_startTime).ToSeconds();
+  MOZ_LOG(MailDirLog, mozilla::LogLevel::Info,
+          ("Rebuilt index from %u files in %.2f s (%.0f files/s)", m_numFiles,
+           seconds, seconds > 0 ? m_numFiles / seconds : 0.0));
+
+  if (m_db) m_db->SetSummaryValid(true);
+  if (m_listener) {
+    nsresult rv;
+    nsCOMPtr<nsIMailboxUrl> mailboxurl =
+        do_CreateInstance(NS_MAILBOXURL_CONTRACTID, &rv);
+    if (NS_SUCCEEDED(rv) && mailboxurl) {
+      nsCOMPtr<nsIMsgMailNewsUrl> url = do_QueryInterface(mailboxurl);
+      url->SetUpdatingFolder(true);
+      nsAutoCString uriSpec("mailbox://");
+      // ### TODO - what if SetSpec fails?
+      (void)url->SetSpecInternal(uriSpec);
+      m_listener->OnStopRunningUrl(url, NS_OK);
+    }
+  }
+}
+
 NS_IMETHODIMP nsMsgMaildirStore::RebuildIndex(nsIMsgFolder *aFolder,
                                               nsIMsgDatabase *aMsgDB,
                                               nsIMsgWindow *aMsgWindow,
@@ -1276,10 +1411,10 @@ NS_IMETHODIMP nsMsgMaildirStore::RebuildIndex(nsIMsgFolder *aFolder,
   rv = path->GetDirectoryEntries(getter_AddRefs(directoryEnumerator));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  MaildirStoreParser *fileParser =
+  RefPtr<MaildirStoreParser> fileParser =
       new MaildirStoreParser(aFolder, aMsgDB, directoryEnumerator, aListener);
-  NS_ENSURE_TRUE(fileParser, NS_ERROR_OUT_OF_MEMORY);
-  fileParser->StartTimer();
+  rv = fileParser->Start();
+  NS_ENSURE_SUCCESS(rv, rv);
   ResetForceReparse(aMsgDB);
   return NS_OK;
 }
@@ -290,19 +290,93 @@ void nsMsgMailboxParser::UpdateProgressPercent() {
   }
 }
 
+// Returns the end of the line starting at aStart, past its CR, LF or CRLF, the
+// way nsMsgLineBuffer splits lines. Returns null if the line is incomplete, or
+// ends in a CR that may be the first half of a CRLF.
+static const char *FindLineEnd(const char *aStart, const char *aEnd) {
+  const char *lf = (const char *)memchr(aStart, '\n', aEnd - aStart);
+  const char *cr =
+      (const char *)memchr(aStart, '\r', (lf ? lf : aEnd) - aStart);
+  if (cr) {
+    if (cr + 1 == aEnd) return nullptr;
+    return cr[1] == '\n' ? cr + 2 : cr + 1;
+  }
+  return lf ? lf + 1 : nullptr;
+}
+
+// Does what HandleLine and ParseFolderLine do for the body lines at aStart,
+// without copying them into the line buffer. Stops at a line that might be an
+// envelope, and at an incomplete line. Returns where it stopped.
+const char *nsMsgMailboxParser::SkipBodyLines(const char *aStart,
+                                              const char *aEnd) {
+  const char *line = aStart;
+  while (line < aEnd && *line != 'F') {
+    const char *lineEnd = FindLineEnd(line, aEnd);
+    if (!lineEnd) break;
+    m_body_lines++;
+    m_lastLineBlank = IS_MSG_LINEBREAK(line);
+    m_position += lineEnd - line;
+    line = lineEnd;
+  }
+  return line;
+}
+
+nsresult nsMsgMailboxParser::ParseBlock(const char *aBlock, uint32_t aLength) {
+  const char *cur = aBlock;
+  const char *end = aBlock + aLength;
+  while (cur < end) {
+    // Body lines can only be skipped if no partial line is buffered.
+    if (m_state == nsIMsgParseMailMsgState::ParseBodyState && m_mailDB &&
+        GetBufferPos() == 0) {
+      cur = SkipBodyLines(cur, end);
+      if (cur == end) break;
+    }
+    // Hand the line buffer one line at a time, so that we get to skip again
+    // as soon as the headers are done.
+    const char *lineEnd = FindLineEnd(cur, end);
+    if (!lineEnd) lineEnd = end;
+    nsresult rv = BufferInput(cur, lineEnd - cur);
+    NS_ENSURE_SUCCESS(rv, rv);
+    cur = lineEnd;
+  }
+  return NS_OK;
+}
+
+struct ParseSegmentClosure {
+  nsMsgMailboxParser *mParser;
+  nsresult mStatus;
+};
+
+/* static */
+nsresult nsMsgMailboxParser::ParseSegment(nsIInputStream *aInputStream,
+                                          void *aClosure, const char *aSegment,
+                                          uint32_t aToOffset, uint32_t aCount,
+                                          uint32_t *aParsedCount) {
+  ParseSegmentClosure *closure = static_cast<ParseSegmentClosure *>(aClosure);
+  closure->mStatus = closure->mParser->ParseBlock(aSegment, aCount);
+  // An error stops ReadSegments; it reports it through the closure.
+  if (NS_FAILED(closure->mStatus)) return closure->mStatus;
+  *aParsedCount = aCount;
+  return NS_OK;
+}
+
 nsresult nsMsgMailboxParser::ProcessMailboxInputStream(nsIInputStream *aIStream,
                                                        uint32_t aLength) {
   nsresult ret = NS_OK;
 
   uint32_t bytesRead = 0;
 
-  if (NS_SUCCEEDED(m_inputStream.GrowBuffer(aLength))) {
-    // OK, this sucks, but we're going to have to copy into our
-    // own byte buffer, and then pass that to the line buffering code,
-    // which means a couple buffer copies.
+  // Parse the data where the stream keeps it, if it lets us.
+  ParseSegmentClosure closure = {this, NS_OK};
+  ret = aIStream->ReadSegments(ParseSegment, &closure, aLength, &bytesRead);
+  if (NS_SUCCEEDED(ret)) {
+    ret = closure.mStatus;
+  } else if (ret == NS_ERROR_NOT_IMPLEMENTED &&
+             NS_SUCCEEDED(m_inputStream.GrowBuffer(aLength))) {
+    // Otherwise we have to copy into our own byte buffer first.
     ret = aIStream->Read(m_inputStream.GetBuffer(), aLength, &bytesRead);
     if (NS_SUCCEEDED(ret))
-      ret = BufferInput(m_inputStream.GetBuffer(), bytesRead);
+      ret = ParseBlock(m_inputStream.GetBuffer(), bytesRead);
   }
   if (m_graph_progress_total > 0) {
     if (NS_SUCCEEDED(ret)) m_graph_progress_received += bytesRead;
@@ -170,6 +170,14 @@ class nsMsgMailboxParser : public nsIStreamListener,
   virtual int32_t PublishMsgHeader(nsIMsgWindow *msgWindow);
   void FreeBuffers();
 
+  // Parses a block of the mailbox. Message bodies are skipped in place;
+  // everything else goes through the line buffer and HandleLine.
+  nsresult ParseBlock(const char *aBlock, uint32_t aLength);
+  const char *SkipBodyLines(const char *aStart, const char *aEnd);
+  static nsresult ParseSegment(nsIInputStream *aInputStream, void *aClosure,
+                               const char *aSegment, uint32_t aToOffset,
+                               uint32_t aCount, uint32_t *aParsedCount);
+
   // data
   nsString m_folderName;
   nsCString m_inboxUri;
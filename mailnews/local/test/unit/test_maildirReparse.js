@@ -0,0 +1,90 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Rebuilds the index of a maildir folder whose messages have header blocks
+ * ending at and around the size of the reads the rebuild does, so that the
+ * blank line after the headers is split across two reads. Checks that the
+ * headers are parsed and that the body is not, which would show up as a line
+ * count.
+ */
+
+var { IOUtils } = ChromeUtils.import("resource:///modules/IOUtils.js");
+
+var kReadSize = 16 * 1024; // FILE_IO_BUFFER_SIZE
+
+// [line ending, length of the header block before the blank line]
+var gSplits = [
+  ["\r\n", kReadSize - 3],
+  ["\r\n", kReadSize - 2],
+  ["\r\n", kReadSize - 1], // "\n\r" | "\n"
+  ["\r\n", kReadSize],
+  ["\n", kReadSize - 1],
+  ["\n", kReadSize], // "\n" | "\n"
+];
+
+function makeMessage(aIndex, aEol, aHeaderLength) {
+  let subject = "Subject: split " + aIndex + aEol;
+  let padPrefix = "X-Pad: ";
+  let pad = "a".repeat(
+    aHeaderLength - subject.length - padPrefix.length - aEol.length
+  );
+  let headers = subject + padPrefix + pad + aEol;
+  Assert.equal(headers.length, aHeaderLength);
+  return headers + aEol + ["line 1", "line 2", "line 3", ""].join(aEol);
+}
+
+add_task(async function testSplitBlankLine() {
+  Services.prefs.setCharPref(
+    "mail.serverDefaultStoreContractID",
+    "@mozilla.org/msgstore/maildirstore;1"
+  );
+  localAccountUtils.loadLocalMailAccount();
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder("split");
+
+  let cur = folder.filePath.clone();
+  cur.append("cur");
+  if (!cur.exists()) {
+    cur.create(Ci.nsIFile.DIRECTORY_TYPE, 0o755);
+  }
+  let sizes = new Map();
+  for (let i = 0; i < gSplits.length; i++) {
+    let [eol, headerLength] = gSplits[i];
+    let data = makeMessage(i, eol, headerLength);
+    let file = cur.clone();
+    file.append("split" + i);
+    IOUtils.saveStringToFile(file, data);
+    sizes.set("split " + i, data.length);
+  }
+
+  folder.msgDatabase.ForceClosed();
+  folder.msgDatabase = null;
+  await new Promise(resolve => {
+    try {
+      folder.getDatabaseWithReparse(
+        {
+          OnStartRunningUrl(aUrl) {},
+          OnStopRunningUrl(aUrl, aExitCode) {
+            Assert.equal(aExitCode, Cr.NS_OK);
+            resolve();
+          },
+        },
+        null
+      );
+    } catch (ex) {
+      Assert.equal(ex.result, Cr.NS_ERROR_NOT_INITIALIZED);
+    }
+  });
+
+  let count = 0;
+  let enumerator = folder.msgDatabase.EnumerateMessages();
+  while (enumerator.hasMoreElements()) {
+    let hdr = enumerator.getNext().QueryInterface(Ci.nsIMsgDBHdr);
+    Assert.ok(sizes.has(hdr.subject), hdr.subject);
+    Assert.equal(hdr.messageSize, sizes.get(hdr.subject));
+    // Bodies are not read, so a line count means the blank line was missed.
+    Assert.equal(hdr.lineCount, 0, hdr.subject);
+    count++;
+  }
+  Assert.equal(count, gSplits.length);
+});
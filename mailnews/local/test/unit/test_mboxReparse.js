@@ -0,0 +1,97 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Reparses an mbox with LF and CRLF line endings, body lines that look like
+ * envelopes, and a body that spans several of the blocks the parser reads,
+ * and checks the offsets, sizes and line counts of the rebuilt headers.
+ */
+
+var kLongBodyLines = 5000; // well over one 64 KiB block
+
+// [mbox text, subject, line count, length of the trailing blank line]
+var gMessages = [
+  [
+    "From - Mon Jan  1 00:00:00 2018\n" +
+      "Subject: one\n" +
+      "From: a@example.invalid\n" +
+      "\n" +
+      "line 1\n" +
+      "From: not an envelope\n" +
+      "Friday\n" +
+      "\n",
+    "one",
+    3,
+    1,
+  ],
+  [
+    "From - Mon Jan  1 00:00:01 2018\r\n" +
+      "Subject: two\r\n" +
+      "\r\n" +
+      "0123456789abcdefghijklmnopqrstuvwxyz\r\n".repeat(kLongBodyLines) +
+      "\r\n",
+    "two",
+    kLongBodyLines,
+    2,
+  ],
+  [
+    "From - Mon Jan  1 00:00:02 2018\n" +
+      "Subject: three\n" +
+      "\n" +
+      "Fine, and the last line.\n",
+    "three",
+    1,
+    0,
+  ],
+];
+
+add_task(async function testReparse() {
+  localAccountUtils.loadLocalMailAccount();
+  let folder = localAccountUtils.rootFolder.createLocalSubfolder("reparse");
+
+  let mbox = gMessages.map(m => m[0]).join("");
+  let stream = Cc["@mozilla.org/network/file-output-stream;1"].createInstance(
+    Ci.nsIFileOutputStream
+  );
+  // write only, create, truncate
+  stream.init(folder.filePath, 0x02 | 0x08 | 0x20, 0o600, 0);
+  stream.write(mbox, mbox.length);
+  stream.close();
+
+  folder.msgDatabase.ForceClosed();
+  folder.msgDatabase = null;
+  await new Promise(resolve => {
+    try {
+      folder.getDatabaseWithReparse(
+        {
+          OnStartRunningUrl(aUrl) {},
+          OnStopRunningUrl(aUrl, aExitCode) {
+            Assert.equal(aExitCode, Cr.NS_OK);
+            resolve();
+          },
+        },
+        null
+      );
+    } catch (ex) {
+      Assert.equal(ex.result, Cr.NS_ERROR_NOT_INITIALIZED);
+    }
+  });
+
+  let hdrs = [];
+  let enumerator = folder.msgDatabase.EnumerateMessages();
+  while (enumerator.hasMoreElements()) {
+    hdrs.push(enumerator.getNext().QueryInterface(Ci.nsIMsgDBHdr));
+  }
+  Assert.equal(hdrs.length, gMessages.length);
+  hdrs.sort((a, b) => a.messageOffset - b.messageOffset);
+  let offset = 0;
+  for (let i = 0; i < gMessages.length; i++) {
+    let [text, subject, lineCount, blankLength] = gMessages[i];
+    let hdr = hdrs[i];
+    Assert.equal(hdr.subject, subject);
+    Assert.equal(hdr.messageOffset, offset);
+    Assert.equal(hdr.messageSize, text.length - blankLength);
+    Assert.equal(hdr.lineCount, lineCount);
+    offset += text.length;
+  }
+});
@@ -72,6 +72,12 @@ pref("mailnews.default_news_sort_type", 21); //
 // the thread root
 pref("mailnews.sort_threads_by_root", false);
 
+// Views with at least this many rows are sorted by extracting all the sort
+// keys first and sorting them on several threads. 0 disables that.
+pref("mailnews.view.large_sort_threshold", 20000);
+// How many threads such a sort uses, at most 8; 0 for one per processor.
+pref("mailnews.view.large_sort_threads", 0);
+
 // default view flags for new folders
 // both flags are int values reflecting nsMsgViewFlagsType values
 // as defined in nsIMsgDBView.idl (kNone = 0, kThreadedDisplay = 1 etc.)
@@ -97,6 +103,16 @@ pref("mail.db_timestamp_leeway", 4000);
 pref("mail.db.idle_limit", 300000);
 // How many db's should we leave open? LRU db's will be closed first
 pref("mail.db.max_open", 30);
+// How much of a .msf file, in percent, may be superseded commits before it
+// is rewritten. Closing a db rewrites it at once, otherwise it waits for idle.
+pref("mail.db.compress_waste", 30);
+// How many threads may parse .msf files of asynchronously opened db's at
+// once. 0 parses them on the main thread, a slice at a time.
+pref("mail.db.open_threads", 2);
+// How many of the most recently used db's to open at startup, and the
+// folders they were last recorded for (a JSON array of folder URIs).
+pref("mail.db.prewarm_count", 5);
+pref("mail.db.prewarm_folders", "[]");
 
 // Should we allow folders over 4GB in size?
 pref("mailnews.allowMboxOver4GB", true);
@@ -119,11 +135,18 @@ pref("mail.imap.auto_unsubscribe_from_noselect_folders",    true);
 pref("mail.imap.mime_parts_on_demand",      true);
 pref("mail.imap.mime_parts_on_demand_threshold", 30000);
 pref("mail.imap.use_literal_plus",          true);
+// Fetch base64 and quoted-printable text parts decoded, from servers that
+// support BINARY (RFC 3516).
+pref("mail.imap.use_binary_fetch",          true);
 pref("mail.imap.expunge_after_delete",      false);
 pref("mail.imap.check_deleted_before_expunge", false);
 pref("mail.imap.expunge_option",            0);
 pref("mail.imap.expunge_threshold_number",  20);
 pref("mail.imap.hdr_chunk_size", 200);
+// How many header fetch commands may be sent before the responses to the
+// earlier ones arrive. The number used adapts to the latency of the server,
+// up to this. 1 sends them one at a time.
+pref("mail.imap.max_pipelined_hdr_fetches", 8);
 // Should we filter imap messages based on new messages since the previous
 // highest UUID seen instead of unread?
 pref("mail.imap.filter_on_new", true);
@@ -284,6 +307,11 @@ pref("mailnews.offline_sync_news",         false);
 pref("mailnews.offline_sync_send_unsent",  true);
 pref("mailnews.offline_sync_work_offline", false);
 pref("mailnews.force_ascii_search",        false);
+// Threads used to evaluate the terms of offline searches; 0 evaluates them on
+// the main thread, one folder at a time.
+pref("mailnews.search.threads",             2);
+// How many folders an offline search reads at once when it uses threads.
+pref("mailnews.search.parallel_scopes",     4);
 
 pref("mailnews.send_default_charset",       "chrome://messenger/locale/messenger.properties");
 pref("mailnews.view_default_charset",       "chrome://messenger/locale/messenger.properties");
@@ -558,6 +586,11 @@ pref("mail.server.default.autosync_max_age_days", -1);
 // Can we change the store type without conversion? (=has the store been used)
 pref("mail.server.default.canChangeStoreType", false);
 
+// Rebuilding a maildir folder index reads the headers of this many message
+// files at a time, on this many background threads.
+pref("mail.maildir.rebuild_batch_size", 256);
+pref("mail.maildir.rebuild_threads", 4);
+
 // Store conversion (mbox <-> maildir)
 #ifndef RELEASE_OR_BETA
 pref("mail.store_conversion_enabled", true);
@@ -585,6 +618,10 @@ pref("mail.spam.markAsNotJunkMarksUnRead", true);
 pref("mail.spam.display.sanitize", true); // display simple html for html junk messages
 // the number of allowed bayes tokens before the database is shrunk
 pref("mailnews.bayesian_spam_filter.junk_maxtokens", 100000);
+// the number of messages tokenized before they are scored together, and the
+// number of threads scoring them (0 scores on the main thread)
+pref("mailnews.bayesian_spam_filter.classify_batch_size", 32);
+pref("mailnews.bayesian_spam_filter.classify_threads", 2);
 
 // pref to warn the users of exceeding the size of the message being composed. (Default 20MB).
 pref("mailnews.message_warning_size", 20971520);
@@ -622,8 +659,19 @@ pref("mail.smtp.useMatchingHostNameServer", false);
 // we use the identity email address, which is the old behaviour
 pref("mail.smtp.useSenderForSmtpMailFrom", true);
 
+// if true, and the server advertises PIPELINING (RFC 2920), the MAIL FROM,
+// RCPT TO and DATA commands are sent without waiting for each response
+pref("mail.smtp.pipelining", true);
+
+// if true, and the server advertises CHUNKING (RFC 3030), the message is sent
+// with BDAT instead of DATA, which spares the dot-stuffing
+pref("mail.smtp.chunking", true);
+
 pref("mail.smtpserver.default.authMethod", 3); // cleartext password. @see nsIMsgIncomingServer.authMethod.
 pref("mail.smtpserver.default.try_ssl", 0); // @see nsISmtpServer.socketType
+// Most connections open at once to an SMTP server. Messages sent while all of
+// them are busy wait for one, which then sends them after an RSET.
+pref("mail.smtpserver.default.max_cached_connections", 2);
 
 // If true, SMTP LOGIN auth and POP3 USER/PASS auth, the last of the methods to try, will use Latin1.
 pref("mail.smtp_login_pop3_user_pass_auth_is_latin1", true);
@@ -634,6 +682,11 @@ pref("mail.display_struct", true);  // TXT->HTML *bold* etc. in viewer; ditto
 pref("mail.send_struct", false);   // HTML->HTML *bold* etc. during Send; ditto
 // display time and date in message pane using senders timezone
 pref("mailnews.display.date_senders_timezone", false);
+// Largest single part (in KB) libmime keeps in memory while it waits to decide
+// how to display it, and the total it may keep in memory per message. Parts
+// beyond either limit are buffered in a temp file instead.
+pref("mailnews.display.part_buffer_limit_kb", 256);
+pref("mailnews.display.part_buffer_budget_kb", 2048);
 // For the next 4 prefs, see <http://www.bucksch.org/1/projects/mozilla/108153>
 pref("mailnews.display.prefer_plaintext", false);  // Ignore HTML parts in multipart/alternative
 pref("mailnews.display.html_as", 0);  // How to display HTML/MIME parts. 0 = Render the sender's HTML; 1 = HTML->TXT->HTML; 2 = Show HTML source; 3 = Sanitize HTML; 4 = Show all body parts
@@ -784,6 +837,9 @@ pref("mail.content_disposition_type", 1);
 
 // Experimental option to send message in the background - don't wait to close window.
 pref("mailnews.sendInBackground", false);
+// Most messages from the Outbox being sent at once when sending unsent
+// messages. 1 sends them one at a time.
+pref("mailnews.sendLater.maxMessagesInFlight", 4);
 // Will show a progress dialog when saving or sending a message
 pref("mailnews.show_send_progress", true);
 pref("mail.server.default.retainBy", 1);
@@ -324,7 +324,7 @@ static int MimeEncrypted_close_headers(MimeObject *obj) {
     mimeEmitterAddHeaderField(obj->options, "x-jsemitter-encrypted", "1");
 
   if (enc->part_buffer) return -1;
-  enc->part_buffer = MimePartBufferCreate();
+  enc->part_buffer = MimePartBufferCreate(obj->options);
   if (!enc->part_buffer) return MIME_OUT_OF_MEMORY;
 
   return 0;
@@ -41,6 +41,39 @@ struct MimeDecoderData {
   void *closure;
 };
 
+static const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The 6-bit value of each base64 character, kBase64Pad for '=' and
+// kBase64Invalid for everything else. Both flags are above 63, so a group of
+// four plain characters can be told apart by or-ing their values together.
+static const uint8_t kBase64Pad = 0x40;
+static const uint8_t kBase64Invalid = 0x80;
+#define EQ kBase64Pad
+#define XX kBase64Invalid
+// clang-format off
+static const uint8_t kBase64DecodeTable[256] = {
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, XX, XX, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, EQ, XX, XX,
+    XX,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, XX,
+    XX, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+};
+// clang-format on
+#undef EQ
+#undef XX
+
 static int mime_decode_qp_buffer(MimeDecoderData *data, const char *buffer,
                                  int32_t length, int32_t *outSize) {
   /* Warning, we are overwriting the buffer which was passed in.
@@ -50,6 +83,7 @@ static int mime_decode_qp_buffer(MimeDecoderData *data, const char *buffer,
   char *out = (char *)buffer;
   char token[3];
   int i;
+  int32_t written = 0;
 
   NS_ASSERTION(data->encoding == mime_QuotedPrintable,
                "1.1 <rhp@netscape.com> 19 Mar 1999 12:00");
@@ -76,6 +110,21 @@ static int mime_decode_qp_buffer(MimeDecoderData *data, const char *buffer,
                                   nsMimeOutput::nsMimeMessageBodyDisplay;
 
   while (length > 0 || i != 0) {
+    if (i == 0) {
+      // Everything up to the next "=" is passed through unchanged, so copy
+      // it in one go rather than a token at a time. The last two characters
+      // are left to the token handling below, which holds on to them until
+      // it knows what follows.
+      const char *eq = (const char *)memchr(in, '=', length);
+      int32_t run = (eq ? eq - in : length) - 2;
+      if (run > 0) {
+        if (out != in) memmove(out, in, run);
+        out += run;
+        in += run;
+        length -= run;
+      }
+    }
+
     while (i < 3 && length > 0) {
       token[i++] = *in;
       in++;
@@ -145,6 +194,28 @@ static int mime_decode_qp_buffer(MimeDecoderData *data, const char *buffer,
       }
 
       *out++ = c ? (char)c : ((treatNullAsSpace) ? ' ' : (char)c);
+    } else if (token[1] != '=' && token[2] != '=' && length >= 2 &&
+               in[0] != '=' && in[1] != '=') {
+      /* Neither these nor the next two characters can start an escape, so
+       pass these through and go back to copying whole runs. */
+      if (in - out >= 3) {
+        *out++ = token[0];
+        *out++ = token[1];
+        *out++ = token[2];
+      } else {
+        /* Some of them were left over from the last buffer, so there isn't
+         room for them all yet. Write out what has been decoded so far and
+         then these directly, as the base64 decoder does with leftovers. */
+        int status = 1;
+        if (out > buffer)
+          status = data->write_buffer(buffer, (out - buffer), data->closure);
+        if (status >= 0) status = data->write_buffer(token, 3, data->closure);
+        if (status < 0) /* abort */
+          return status;
+        written += (out - buffer) + 3;
+        buffer = in;
+        out = (char *)buffer;
+      }
     } else {
       *out++ = token[0];
 
@@ -155,7 +226,7 @@ static int mime_decode_qp_buffer(MimeDecoderData *data, const char *buffer,
   }
 
   // Fill the size
-  if (outSize) *outSize = out - buffer;
+  if (outSize) *outSize = written + (out - buffer);
 
   /* Now that we've altered the data in place, write it. */
   if (out > buffer)
@@ -172,22 +243,14 @@ static int mime_decode_base64_token(const char *in, char *out) {
   unsigned long num = 0;
 
   for (j = 0; j < 4; j++) {
-    unsigned char c = 0;
-    if (in[j] >= 'A' && in[j] <= 'Z')
-      c = in[j] - 'A';
-    else if (in[j] >= 'a' && in[j] <= 'z')
-      c = in[j] - ('a' - 26);
-    else if (in[j] >= '0' && in[j] <= '9')
-      c = in[j] - ('0' - 52);
-    else if (in[j] == '+')
-      c = 62;
-    else if (in[j] == '/')
-      c = 63;
-    else if (in[j] == '=') {
+    unsigned char c = kBase64DecodeTable[(unsigned char)in[j]];
+    if (c == kBase64Pad) {
       c = 0;
       eq_count++;
-    } else
+    } else if (c == kBase64Invalid) {
+      c = 0;
       NS_ERROR("Invalid character");
+    }
     num = (num << 6) | c;
   }
 
@@ -237,9 +300,27 @@ static int mime_decode_base64_buffer(MimeDecoderData *data, const char *buffer,
   }
 
   while (length > 0) {
+    if (i == 0 && !leftover) {
+      // Decode groups of four base64 characters straight from the input for
+      // as long as there is no line break or padding among them.
+      while (length >= 4) {
+        uint32_t a = kBase64DecodeTable[(unsigned char)in[0]];
+        uint32_t b = kBase64DecodeTable[(unsigned char)in[1]];
+        uint32_t c = kBase64DecodeTable[(unsigned char)in[2]];
+        uint32_t d = kBase64DecodeTable[(unsigned char)in[3]];
+        if ((a | b | c | d) & (kBase64Pad | kBase64Invalid)) break;
+        uint32_t num = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = (char)(num >> 16);
+        out[1] = (char)((num >> 8) & 0xFF);
+        out[2] = (char)(num & 0xFF);
+        out += 3;
+        in += 4;
+        length -= 4;
+      }
+    }
+
     while (i < 4 && length > 0) {
-      if ((*in >= 'A' && *in <= 'Z') || (*in >= 'a' && *in <= 'z') ||
-          (*in >= '0' && *in <= '9') || *in == '+' || *in == '/' || *in == '=')
+      if (kBase64DecodeTable[(unsigned char)*in] != kBase64Invalid)
         token[i++] = *in;
       in++;
       length--;
@@ -755,6 +836,10 @@ int MimeDecoderWrite(MimeDecoderData *data, const char *buffer, int32_t size,
 namespace mozilla {
 namespace mailnews {
 
+// Encoded output is collected into a buffer of this many lines before being
+// handed to the callback, rather than calling it for every line.
+#define ENCODER_BUFFER_LINES 32
+
 MimeEncoder::MimeEncoder(OutputCallback callback, void *closure)
     : mCallback(callback), mClosure(closure), mCurrentColumn(0) {}
 
@@ -811,8 +896,9 @@ nsresult Base64Encoder::Write(const char *buffer, int32_t size) {
   const uint8_t *end = (const uint8_t *)(buffer + size);
   MOZ_ASSERT((end - in + i) % 3 == 0, "Need a multiple of 3 bytes to decode");
 
-  // Populate the out_buffer with base64 data, one line at a time.
-  char out_buffer[80];  // Max line length will be 80, so this is safe.
+  // Populate the out_buffer with base64 data, a batch of lines at a time.
+  // Max line length will be 80, so this is safe.
+  char out_buffer[80 * ENCODER_BUFFER_LINES];
   RangedPtr<char> out(out_buffer);
   while (in < end) {
     // Accumulate the input bits.
@@ -826,13 +912,16 @@ nsresult Base64Encoder::Write(const char *buffer, int32_t size) {
 
     mCurrentColumn += 4;
     if (mCurrentColumn >= 72) {
-      // Do a linebreak before column 76.  Flush out the line buffer.
+      // Do a linebreak before column 76.  Flush out the buffer if there may
+      // not be room for another line.
       mCurrentColumn = 0;
       *out++ = '\x0D';
       *out++ = '\x0A';
-      nsresult rv = mCallback(out_buffer, (out.get() - out_buffer), mClosure);
-      NS_ENSURE_SUCCESS(rv, rv);
-      out = out_buffer;
+      if (out.get() - out_buffer > int32_t(sizeof(out_buffer)) - 80) {
+        nsresult rv = mCallback(out_buffer, (out.get() - out_buffer), mClosure);
+        NS_ENSURE_SUCCESS(rv, rv);
+        out = out_buffer;
+      }
     }
   }
 
@@ -867,21 +956,17 @@ nsresult Base64Encoder::Flush() {
 
 void Base64Encoder::Base64EncodeBits(RangedPtr<char> &out, uint32_t bits) {
   // Convert 3 bytes to 4 base64 bytes
-  for (int32_t j = 18; j >= 0; j -= 6) {
-    unsigned int k = (bits >> j) & 0x3F;
-    if (k < 26)
-      *out++ = k + 'A';
-    else if (k < 52)
-      *out++ = k - 26 + 'a';
-    else if (k < 62)
-      *out++ = k - 52 + '0';
-    else if (k == 62)
-      *out++ = '+';
-    else if (k == 63)
-      *out++ = '/';
-    else
-      MOZ_CRASH("6 bits should only be between 0 and 64");
-  }
+  out[0] = kBase64Alphabet[(bits >> 18) & 0x3F];
+  out[1] = kBase64Alphabet[(bits >> 12) & 0x3F];
+  out[2] = kBase64Alphabet[(bits >> 6) & 0x3F];
+  out[3] = kBase64Alphabet[bits & 0x3F];
+  out += 4;
+}
+
+// Whether a character can be written as is in quoted-printable text: the
+// printable characters except for '='.
+static inline bool IsQPLiteral(uint8_t c) {
+  return (c >= 33 && c <= 60) | (c >= 62 && c <= 126);
 }
 
 class QPEncoder : public MimeEncoder {
@@ -896,11 +981,12 @@ class QPEncoder : public MimeEncoder {
 nsresult QPEncoder::Write(const char *buffer, int32_t size) {
   nsresult rv = NS_OK;
   static const char *hexdigits = "0123456789ABCDEF";
-  char out_buffer[80];
+  char out_buffer[80 * ENCODER_BUFFER_LINES];
   RangedPtr<char> out(out_buffer);
   bool white = false;
 
-  // Populate the out_buffer with quoted-printable data, one line at a time.
+  // Populate the out_buffer with quoted-printable data, a batch of lines at a
+  // time.
   const uint8_t *in = (uint8_t *)buffer;
   const uint8_t *end = in + size;
   for (; in < end; in++) {
@@ -922,11 +1008,13 @@ nsresult QPEncoder::Write(const char *buffer, int32_t size) {
       *out++ = '\r';
       *out++ = '\n';
       white = false;
-
-      rv = mCallback(out_buffer, out.get() - out_buffer, mClosure);
-      NS_ENSURE_SUCCESS(rv, rv);
-      out = out_buffer;
       mCurrentColumn = 0;
+
+      if (out.get() - out_buffer > int32_t(sizeof(out_buffer)) - 80) {
+        rv = mCallback(out_buffer, out.get() - out_buffer, mClosure);
+        NS_ENSURE_SUCCESS(rv, rv);
+        out = out_buffer;
+      }
     } else if (mCurrentColumn == 0 && *in == '.') {
       // Just to be SMTP-safe, if "." appears in column 0, encode it.
       goto HEX;
@@ -939,13 +1027,17 @@ nsresult QPEncoder::Write(const char *buffer, int32_t size) {
       // data in the buffer to be certain), encode the 'F' in hex to avoid
       // potential problems with BSD mailbox formats.
       goto HEX;
-    } else if ((*in >= 33 && *in <= 60) |
-               (*in >= 62 &&
-                *in <= 126))  // Printable characters except for '='
+    } else if (IsQPLiteral(*in))  // Printable characters except for '='
     {
       white = false;
       *out++ = *in;
       mCurrentColumn++;
+      // Copy the rest of a run of them up to the soft line break without
+      // going through the checks above for each one.
+      while (mCurrentColumn < 73 && in + 1 < end && IsQPLiteral(in[1])) {
+        *out++ = *++in;
+        mCurrentColumn++;
+      }
     } else if (*in == ' ' || *in == '\t')  // Whitespace
     {
       white = true;
@@ -968,12 +1060,14 @@ nsresult QPEncoder::Write(const char *buffer, int32_t size) {
       *out++ = '=';
       *out++ = '\r';
       *out++ = '\n';
-
-      rv = mCallback(out_buffer, out.get() - out_buffer, mClosure);
-      NS_ENSURE_SUCCESS(rv, rv);
-      out = out_buffer;
       white = false;
       mCurrentColumn = 0;
+
+      if (out.get() - out_buffer > int32_t(sizeof(out_buffer)) - 80) {
+        rv = mCallback(out_buffer, out.get() - out_buffer, mClosure);
+        NS_ENSURE_SUCCESS(rv, rv);
+        out = out_buffer;
+      }
     }
   }
 
@@ -28,6 +28,106 @@
 // Forward declares...
 int32_t MimeHeaders_build_heads_list(MimeHeaders *hdrs);
 
+/* The name index maps each header name, case-insensitively, to the first
+   header with that name.  The hash table slots hold 1 + that header's index
+   in `heads', or 0 if unused; collisions probe the following slots.  The
+   headers with the same name are chained, in order, through the `next'
+   array, which holds 1 + the index of the following one, or 0 at the end.
+ */
+#define MIME_NAME_INDEX_NEXT(hdrs) \
+  ((hdrs)->name_index + (hdrs)->name_index_size)
+#define MIME_NAME_INDEX_LENGTH(hdrs) \
+  (MIME_NAME_INDEX_NEXT(hdrs) + (hdrs)->heads_size)
+
+static uint32_t MimeHeaders_hash_name(const char *name, int32_t length) {
+  uint32_t hash = 2166136261u;
+  for (int32_t i = 0; i < length; i++) {
+    unsigned char c = name[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    hash = (hash ^ c) * 16777619u;
+  }
+  return hash;
+}
+
+/* Returns the length of the name of the header starting at `head', or -1
+   if it has no colon before `end'. */
+static int32_t MimeHeaders_name_length(const char *head, const char *end) {
+  const char *colon;
+
+  /* Find the colon. */
+  for (colon = head; colon < end; colon++)
+    if (*colon == ':') break;
+
+  if (colon >= end) return -1;
+
+  /* Back up over whitespace before the colon. */
+  for (; colon > head && IS_SPACE(colon[-1]); colon--)
+    ;
+
+  return colon - head;
+}
+
+static int MimeHeaders_build_name_index(MimeHeaders *hdrs) {
+  int32_t table_size = 8;
+  while (table_size < hdrs->heads_size * 2) table_size *= 2;
+
+  int32_t total = table_size + 2 * hdrs->heads_size;
+  hdrs->name_index = (int32_t *)PR_MALLOC(total * sizeof(int32_t));
+  if (!hdrs->name_index) return MIME_OUT_OF_MEMORY;
+  memset(hdrs->name_index, 0, total * sizeof(int32_t));
+  hdrs->name_index_size = table_size;
+
+  int32_t *next = MIME_NAME_INDEX_NEXT(hdrs);
+  int32_t *lengths = MIME_NAME_INDEX_LENGTH(hdrs);
+
+  /* Go backwards, putting each header at the front of its name's chain, so
+     that the chains come out in order. */
+  for (int32_t i = hdrs->heads_size - 1; i >= 0; i--) {
+    char *head = hdrs->heads[i];
+    char *end =
+        (i == hdrs->heads_size - 1 ? hdrs->all_headers + hdrs->all_headers_fp
+                                   : hdrs->heads[i + 1]);
+    lengths[i] = -1;
+    if (!head) continue;
+
+    /* Quick hack to skip over BSD Mailbox delimiter. */
+    if (i == 0 && head[0] == 'F' && !strncmp(head, "From ", 5)) continue;
+
+    int32_t length = MimeHeaders_name_length(head, end);
+    if (length < 0) continue;
+    lengths[i] = length;
+
+    uint32_t slot = MimeHeaders_hash_name(head, length) & (table_size - 1);
+    for (; hdrs->name_index[slot];
+         slot = (slot + 1) & (table_size - 1)) {
+      int32_t other = hdrs->name_index[slot] - 1;
+      if (lengths[other] == length &&
+          !PL_strncasecmp(hdrs->heads[other], head, length))
+        break;
+    }
+    next[i] = hdrs->name_index[slot];
+    hdrs->name_index[slot] = i + 1;
+  }
+
+  return 0;
+}
+
+/* Returns the index in `heads' of the first header called `name', or -1. */
+static int32_t MimeHeaders_find_name(MimeHeaders *hdrs, const char *name,
+                                     int32_t length) {
+  if (!hdrs->name_index) return -1;
+
+  int32_t *lengths = MIME_NAME_INDEX_LENGTH(hdrs);
+  uint32_t mask = hdrs->name_index_size - 1;
+  for (uint32_t slot = MimeHeaders_hash_name(name, length) & mask;
+       hdrs->name_index[slot]; slot = (slot + 1) & mask) {
+    int32_t i = hdrs->name_index[slot] - 1;
+    if (lengths[i] == length && !PL_strncasecmp(hdrs->heads[i], name, length))
+      return i;
+  }
+  return -1;
+}
+
 void MimeHeaders_convert_header_value(MimeDisplayOptions *opt, nsCString &value,
                                       bool convert_charset_only) {
   if (value.IsEmpty()) return;
@@ -74,6 +174,7 @@ void MimeHeaders_free(MimeHeaders *hdrs) {
   if (!hdrs) return;
   PR_FREEIF(hdrs->all_headers);
   PR_FREEIF(hdrs->heads);
+  PR_FREEIF(hdrs->name_index);
   PR_FREEIF(hdrs->obuffer);
   PR_FREEIF(hdrs->munged_subject);
   hdrs->obuffer_fp = 0;
@@ -160,6 +261,21 @@ MimeHeaders *MimeHeaders_copy(MimeHeaders *hdrs) {
           (hdrs2->all_headers + (hdrs->heads[i] - hdrs->all_headers));
     }
   }
+
+  if (hdrs->name_index) {
+    /* The index only holds positions in `heads', so it can be copied as
+       is. */
+    int32_t total = hdrs->name_index_size + 2 * hdrs->heads_size;
+    hdrs2->name_index = (int32_t *)PR_MALLOC(total * sizeof(int32_t));
+    if (!hdrs2->name_index) {
+      PR_FREEIF(hdrs2->heads);
+      PR_FREEIF(hdrs2->all_headers);
+      PR_Free(hdrs2);
+      return 0;
+    }
+    memcpy(hdrs2->name_index, hdrs->name_index, total * sizeof(int32_t));
+    hdrs2->name_index_size = hdrs->name_index_size;
+  }
   return hdrs2;
 }
 
@@ -259,7 +375,7 @@ int MimeHeaders_build_heads_list(MimeHeaders *hdrs) {
     }
   }
 
-  return 0;
+  return MimeHeaders_build_name_index(hdrs);
 }
 
 char *MimeHeaders_get(MimeHeaders *hdrs, const char *header_name, bool strip_p,
@@ -296,39 +412,27 @@ char *MimeHeaders_get(MimeHeaders *hdrs, const char *header_name, bool strip_p,
     return 0;
   }
 
+  /* The index can only be missing if we ran out of memory building it. */
+  if (!hdrs->name_index) return 0;
+
   name_length = strlen(header_name);
 
-  for (i = 0; i < hdrs->heads_size; i++) {
+  /* Go through the headers with this name, in order. */
+  int32_t *next = MIME_NAME_INDEX_NEXT(hdrs);
+  for (i = MimeHeaders_find_name(hdrs, header_name, name_length); i >= 0;
+       i = next[i] - 1) {
     char *head = hdrs->heads[i];
     char *end =
         (i == hdrs->heads_size - 1 ? hdrs->all_headers + hdrs->all_headers_fp
                                    : hdrs->heads[i + 1]);
-    char *colon, *ocolon;
-
-    NS_ASSERTION(head, "1.1 <rhp@netscape.com> 19 Mar 1999 12:00");
-    if (!head) continue;
-
-    /* Quick hack to skip over BSD Mailbox delimiter. */
-    if (i == 0 && head[0] == 'F' && !strncmp(head, "From ", 5)) continue;
-
-    /* Find the colon. */
-    for (colon = head; colon < end; colon++)
-      if (*colon == ':') break;
+    char *ocolon;
 
-    if (colon >= end) continue;
-
-    /* Back up over whitespace before the colon. */
-    ocolon = colon;
-    for (; colon > head && IS_SPACE(colon[-1]); colon--)
+    /* Find the colon, which can only be preceded by whitespace after the
+       name. */
+    for (ocolon = head + name_length; *ocolon != ':'; ocolon++)
       ;
 
-    /* If the strings aren't the same length, it doesn't match. */
-    if (name_length != colon - head) continue;
-
-    /* If the strings differ, it doesn't match. */
-    if (PL_strncasecmp(header_name, head, name_length)) continue;
-
-    /* Otherwise, we've got a match. */
+    /* We've got a match. */
     {
       char *contents = ocolon + 1;
       char *s;
@@ -292,7 +292,7 @@ static int MimeMultipartAlternative_create_child(MimeObject *obj) {
   malt->buffered_hdrs[i] = MimeHeaders_copy(mult->hdrs);
   NS_ENSURE_TRUE(malt->buffered_hdrs[i], MIME_OUT_OF_MEMORY);
 
-  malt->part_buffers[i] = MimePartBufferCreate();
+  malt->part_buffers[i] = MimePartBufferCreate(obj->options);
   NS_ENSURE_TRUE(malt->part_buffers[i], MIME_OUT_OF_MEMORY);
 
   return 0;
@@ -14,6 +14,7 @@
 #include "mimemalt.h"
 #include "mimebuf.h"
 #include "mimemapl.h"
+#include "mimepbuf.h"
 #include "prprf.h"
 #include "mimei.h" /* for moved MimeDisplayData struct */
 #include "mimebuf.h"
@@ -50,7 +51,9 @@
 #include "nsIParserUtils.h"
 // </for>
 #include "mozilla/Services.h"
+#include "mozilla/Telemetry.h"
 #include "mozilla/Unused.h"
+#include <algorithm>
 
 void ValidateRealName(nsMsgAttachmentData *aAttach, MimeHeaders *aHdrs);
 
@@ -1246,11 +1249,22 @@ MimeDisplayOptions::MimeDisplayOptions() {
   notify_nested_bodies = false;
   write_pure_bodies = false;
   metadata_only = false;
+
+  part_buffer_limit = MIME_PART_BUFFER_LIMIT_DEFAULT;
+  part_buffer_budget = MIME_PART_BUFFER_BUDGET_DEFAULT;
+  part_buffer_bytes = 0;
+  part_buffer_peak = 0;
 }
 
 MimeDisplayOptions::~MimeDisplayOptions() {
   PR_FREEIF(part_to_load);
   PR_FREEIF(default_charset);
+
+  NS_ASSERTION(part_buffer_bytes == 0, "part buffers outlived their options");
+  if (part_buffer_peak > 0)
+    mozilla::Telemetry::Accumulate(
+        mozilla::Telemetry::TB_MIME_PART_BUFFER_PEAK_KB,
+        (part_buffer_peak + 1023) / 1024);
 }
 ////////////////////////////////////////////////////////////////
 // Bridge routines for new stream converter XP-COM interface
@@ -1397,6 +1411,19 @@ extern "C" void *mime_bridge_create_display_stream(
         "mail.reply_quote_inline", &(msd->options->quote_attachment_inline_p));
     msd->options->m_prefBranch->GetIntPref("mailnews.display.html_as",
                                            &(msd->options->html_as_p));
+
+    // The limits are in kilobytes; larger ones than fit in bytes are clamped.
+    int32_t limitKB;
+    if (NS_SUCCEEDED(msd->options->m_prefBranch->GetIntPref(
+            "mailnews.display.part_buffer_limit_kb", &limitKB)) &&
+        limitKB >= 0)
+      msd->options->part_buffer_limit =
+          std::min(limitKB, INT32_MAX / 1024) * 1024;
+    if (NS_SUCCEEDED(msd->options->m_prefBranch->GetIntPref(
+            "mailnews.display.part_buffer_budget_kb", &limitKB)) &&
+        limitKB >= 0)
+      msd->options->part_buffer_budget =
+          std::min(limitKB, INT32_MAX / 1024) * 1024;
   }
   /* This pref is written down in with the
      opposite sense of what we like to use... */
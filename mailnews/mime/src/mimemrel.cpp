@@ -112,12 +112,6 @@
 #include "nsMsgUtils.h"
 #include <ctype.h>
 
-//
-// External Defines...
-//
-
-extern nsresult nsMsgCreateTempFile(const char *tFileName, nsIFile **tFile);
-
 #define MIME_SUPERCLASS mimeMultipartClass
 MimeDefClass(MimeMultipartRelated, MimeMultipartRelatedClass,
              mimeMultipartRelatedClass, &MIME_SUPERCLASS);
@@ -161,9 +155,6 @@ static int MimeMultipartRelated_initialize(MimeObject *obj) {
 
   if (!relobj->hash) return MIME_OUT_OF_MEMORY;
 
-  relobj->input_file_stream = nullptr;
-  relobj->output_file_stream = nullptr;
-
   return ((MimeObjectClass *)&MIME_SUPERCLASS)->initialize(obj);
 }
 
@@ -183,11 +174,13 @@ static void MimeMultipartRelated_finalize(MimeObject *obj) {
   if (relobj->buffered_hdrs) {
     PR_FREEIF(relobj->buffered_hdrs->all_headers);
     PR_FREEIF(relobj->buffered_hdrs->heads);
+    PR_FREEIF(relobj->buffered_hdrs->name_index);
     PR_FREEIF(relobj->buffered_hdrs);
   }
-  PR_FREEIF(relobj->head_buffer);
-  relobj->head_buffer_fp = 0;
-  relobj->head_buffer_size = 0;
+  if (relobj->head_buffer) {
+    MimePartBufferDestroy(relobj->head_buffer);
+    relobj->head_buffer = nullptr;
+  }
   if (relobj->hash) {
     PL_HashTableEnumerateEntries(relobj->hash, mime_multipart_related_nukehash,
                                  NULL);
@@ -195,21 +188,6 @@ static void MimeMultipartRelated_finalize(MimeObject *obj) {
     relobj->hash = NULL;
   }
 
-  if (relobj->input_file_stream) {
-    relobj->input_file_stream->Close();
-    relobj->input_file_stream = nullptr;
-  }
-
-  if (relobj->output_file_stream) {
-    relobj->output_file_stream->Close();
-    relobj->output_file_stream = nullptr;
-  }
-
-  if (relobj->file_buffer) {
-    relobj->file_buffer->Remove(false);
-    relobj->file_buffer = nullptr;
-  }
-
   if (relobj->headobj) {
     // In some error conditions when MimeMultipartRelated_parse_eof() isn't run
     // (for example, no temp disk space available to extract message parts),
@@ -591,88 +569,13 @@ static int MimeMultipartRelated_parse_child_line(MimeObject *obj,
   if (!kid) return -1;
   if (kid != relobj->headobj) return 0;
 
-  /* Buffer this up (###tw much code duplication from mimemalt.c) */
-  /* If we don't yet have a buffer (either memory or file) try and make a
-     memory buffer. */
-  if (!relobj->head_buffer && !relobj->file_buffer) {
-    int target_size = 1024 * 50; /* try for 50k */
-    while (target_size > 0) {
-      relobj->head_buffer = (char *)PR_MALLOC(target_size);
-      if (relobj->head_buffer) break; /* got it! */
-      target_size -= (1024 * 5);      /* decrease it and try again */
-    }
-
-    if (relobj->head_buffer) {
-      relobj->head_buffer_size = target_size;
-    } else {
-      relobj->head_buffer_size = 0;
-    }
-
-    relobj->head_buffer_fp = 0;
+  /* Buffer this up until the parts it refers to have been seen. */
+  if (!relobj->head_buffer) {
+    relobj->head_buffer = MimePartBufferCreate(obj->options);
+    if (!relobj->head_buffer) return MIME_OUT_OF_MEMORY;
   }
 
-  nsresult rv;
-  /* Ok, if at this point we still don't have either kind of buffer, try and
-     make a file buffer. */
-  if (!relobj->head_buffer && !relobj->file_buffer) {
-    nsCOMPtr<nsIFile> file;
-    rv = nsMsgCreateTempFile("nsma", getter_AddRefs(file));
-    NS_ENSURE_SUCCESS(rv, -1);
-    relobj->file_buffer = file;
-
-    rv = MsgNewBufferedFileOutputStream(
-        getter_AddRefs(relobj->output_file_stream), relobj->file_buffer,
-        PR_WRONLY | PR_CREATE_FILE, 00600);
-    NS_ENSURE_SUCCESS(rv, -1);
-  }
-
-  PR_ASSERT(relobj->head_buffer || relobj->output_file_stream);
-
-  /* If this line will fit in the memory buffer, put it there.
-   */
-  if (relobj->head_buffer &&
-      relobj->head_buffer_fp + length < relobj->head_buffer_size) {
-    memcpy(relobj->head_buffer + relobj->head_buffer_fp, line, length);
-    relobj->head_buffer_fp += length;
-  } else {
-    /* Otherwise it won't fit; write it to the file instead. */
-
-    /* If the file isn't open yet, open it, and dump the memory buffer
-       to it. */
-    if (!relobj->output_file_stream) {
-      if (!relobj->file_buffer) {
-        nsCOMPtr<nsIFile> file;
-        rv = nsMsgCreateTempFile("nsma", getter_AddRefs(file));
-        NS_ENSURE_SUCCESS(rv, -1);
-        relobj->file_buffer = file;
-      }
-
-      nsresult rv = MsgNewBufferedFileOutputStream(
-          getter_AddRefs(relobj->output_file_stream), relobj->file_buffer,
-          PR_WRONLY | PR_CREATE_FILE, 00600);
-      NS_ENSURE_SUCCESS(rv, -1);
-
-      if (relobj->head_buffer && relobj->head_buffer_fp) {
-        uint32_t bytesWritten;
-        rv = relobj->output_file_stream->Write(
-            relobj->head_buffer, relobj->head_buffer_fp, &bytesWritten);
-        if (NS_FAILED(rv) || (bytesWritten < relobj->head_buffer_fp))
-          return MIME_UNABLE_TO_OPEN_TMP_FILE;
-      }
-
-      PR_FREEIF(relobj->head_buffer);
-      relobj->head_buffer_fp = 0;
-      relobj->head_buffer_size = 0;
-    }
-
-    /* Dump this line to the file. */
-    uint32_t bytesWritten;
-    rv = relobj->output_file_stream->Write(line, length, &bytesWritten);
-    if ((int32_t)bytesWritten < length || NS_FAILED(rv))
-      return MIME_UNABLE_TO_OPEN_TMP_FILE;
-  }
-
-  return 0;
+  return MimePartBufferWrite(relobj->head_buffer, line, length);
 }
 
 static int real_write(MimeMultipartRelated *relobj, const char *buf,
@@ -985,8 +888,7 @@ static int MimeMultipartRelated_parse_eof(MimeObject *obj, bool abort_p) {
 
 #ifdef MIME_DRAFTS
   if (obj->options && obj->options->decompose_file_p &&
-      obj->options->decompose_file_init_fn &&
-      (relobj->file_buffer || relobj->head_buffer)) {
+      obj->options->decompose_file_init_fn && relobj->head_buffer) {
     status = obj->options->decompose_file_init_fn(obj->options->stream_closure,
                                                   relobj->buffered_hdrs);
     if (status < 0) return status;
@@ -1010,56 +912,11 @@ static int MimeMultipartRelated_parse_eof(MimeObject *obj, bool abort_p) {
   if (status < 0) goto FAIL;
 
   if (relobj->head_buffer) {
-    /* Read it out of memory. */
-    PR_ASSERT(!relobj->file_buffer && !relobj->input_file_stream);
-
-    status = body->clazz->parse_buffer(relobj->head_buffer,
-                                       relobj->head_buffer_fp, body);
-  } else if (relobj->file_buffer) {
-    /* Read it off disk. */
-    char *buf;
-
-    PR_ASSERT(relobj->head_buffer_size == 0 && relobj->head_buffer_fp == 0);
-    PR_ASSERT(relobj->file_buffer);
-    if (!relobj->file_buffer) {
-      status = -1;
-      goto FAIL;
-    }
-
-    buf = (char *)PR_MALLOC(FILE_IO_BUFFER_SIZE);
-    if (!buf) {
-      status = MIME_OUT_OF_MEMORY;
-      goto FAIL;
-    }
-
-    // First, close the output file to open the input file!
-    if (relobj->output_file_stream) relobj->output_file_stream->Close();
-
-    nsresult rv = NS_NewLocalFileInputStream(
-        getter_AddRefs(relobj->input_file_stream), relobj->file_buffer);
-    if (NS_FAILED(rv)) {
-      PR_Free(buf);
-      status = MIME_UNABLE_TO_OPEN_TMP_FILE;
-      goto FAIL;
-    }
-
-    while (1) {
-      uint32_t bytesRead = 0;
-      rv = relobj->input_file_stream->Read(buf, FILE_IO_BUFFER_SIZE - 1,
-                                           &bytesRead);
-      if (NS_FAILED(rv) || !bytesRead) {
-        status = NS_FAILED(rv) ? -1 : 0;
-        break;
-      } else {
-        /* It would be really nice to be able to yield here, and let
-           some user events and other input sources get processed.
-           Oh well. */
-
-        status = body->clazz->parse_buffer(buf, bytesRead, body);
-        if (status < 0) break;
-      }
-    }
-    PR_Free(buf);
+    status = MimePartBufferRead(
+        relobj->head_buffer,
+        /* The MimeConverterOutputCallback cast is to turn the
+         `void' argument into `MimeObject'. */
+        ((MimeConverterOutputCallback)body->clazz->parse_buffer), body);
   }
 
   if (status < 0) goto FAIL;
@@ -1074,8 +931,7 @@ FAIL:
 
 #ifdef MIME_DRAFTS
   if (obj->options && obj->options->decompose_file_p &&
-      obj->options->decompose_file_close_fn &&
-      (relobj->file_buffer || relobj->head_buffer)) {
+      obj->options->decompose_file_close_fn && relobj->head_buffer) {
     status =
         obj->options->decompose_file_close_fn(obj->options->stream_closure);
     if (status < 0) return status;
@@ -11,6 +11,7 @@
 #include "prio.h"
 #include "nsNetUtil.h"
 #include "modmimee.h"  // for MimeConverterOutputCallback
+#include "mimepbuf.h"
 
 /* The MimeMultipartRelated class implements the multipart/related MIME
    container, which allows `sibling' sub-parts to refer to each other.
@@ -30,15 +31,8 @@ struct MimeMultipartRelated {
 
   char* base_url;  // Base URL (if any) for the whole multipart/related.
 
-  char* head_buffer;          // Buffer used to remember the text/html 'head'
-                              // part.
-  uint32_t head_buffer_fp;    // Active length.
-  uint32_t head_buffer_size;  // How big it is.
-
-  nsCOMPtr<nsIFile> file_buffer;  // The nsIFile of a temp file used when we
-                                  // run out of room in the head_buffer.
-  nsCOMPtr<nsIInputStream> input_file_stream;    // A stream to it.
-  nsCOMPtr<nsIOutputStream> output_file_stream;  // A stream to it.
+  MimePartBufferData* head_buffer;  // Buffer used to remember the text/html
+                                    // 'head' part.
 
   MimeHeaders* buffered_hdrs;  // The headers of the 'head' part. */
 
@@ -455,7 +455,7 @@ static int MimeMultipartSigned_parse_child_line(MimeObject *obj,
     case MimeMultipartSignedBodyFirstLine:
       PR_ASSERT(first_line_p);
       if (!sig->part_buffer) {
-        sig->part_buffer = MimePartBufferCreate();
+        sig->part_buffer = MimePartBufferCreate(obj->options);
         if (!sig->part_buffer) return MIME_OUT_OF_MEMORY;
       }
       /* fall through */
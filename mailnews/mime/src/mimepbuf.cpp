@@ -11,6 +11,7 @@
 #include "nsMimeStringResources.h"
 #include "nsNetUtil.h"
 #include "nsMsgUtils.h"
+#include <algorithm>
 //
 // External Defines...
 //
@@ -20,19 +21,17 @@ extern nsresult nsMsgCreateTempFile(const char *tFileName, nsIFile **tFile);
 
    Implementation:
 
-     When asked to buffer an object, we first try to malloc() a buffer to
-   hold the upcoming part.  First we try to allocate a 50k buffer, and
-   then back off by 5k until we are able to complete the allocation,
-   or are unable to allocate anything.
+     When asked to buffer an object, we first store it in a small malloc()ed
+   memory buffer, which is doubled in size as data is handed to us.  The
+   buffer may grow until it reaches the per-part limit, as long as the growth
+   keeps the memory buffers of the whole message within the message budget
+   (both taken from MimeDisplayOptions).
 
-   As data is handed to us, we store it in the memory buffer, until the
-   size of the memory buffer is exceeded (including the case where no
-   memory buffer was able to be allocated at all.)
-
-   Once we've filled the memory buffer, we open a temp file on disk.
-   Anything that is currently in the memory buffer is then flushed out
-   to the disk file (and the memory buffer is discarded.)  Subsequent
-   data that is passed in is appended to the file.
+   Once the memory buffer can't grow any more (including the case where the
+   allocation fails), we open a temp file on disk.  Anything that is
+   currently in the memory buffer is then flushed out to the disk file (and
+   the memory buffer is discarded, returning its share of the budget.)
+   Subsequent data that is passed in is appended to the file.
 
    Thus only one of the memory buffer or the disk buffer ever exist at
    the same time; and small parts tend to live completely in memory
@@ -43,25 +42,75 @@ extern nsresult nsMsgCreateTempFile(const char *tFileName, nsIFile **tFile);
    buffer; or blocks read from the disk file.
  */
 
-#define TARGET_MEMORY_BUFFER_SIZE (1024 * 50)   /* try for 50k mem buffer */
-#define TARGET_MEMORY_BUFFER_QUANTUM (1024 * 5) /* decrease in steps of 5k */
-#define DISK_BUFFER_SIZE (1024 * 10)            /* read disk in 10k chunks */
+#define MEMORY_BUFFER_START_SIZE (1024 * 4) /* first mem buffer is 4k */
+#define DISK_BUFFER_SIZE (1024 * 16)        /* read disk in 16k chunks */
 
 struct MimePartBufferData {
   char *part_buffer;        /* Buffer used for part-lookahead. */
   int32_t part_buffer_fp;   /* Active length. */
   int32_t part_buffer_size; /* How big it is. */
 
+  MimeDisplayOptions *options; /* Where our memory use is accounted. */
+
   nsCOMPtr<nsIFile> file_buffer; /* The nsIFile of a temp file used when we
-                                    run out of room in the head_buffer. */
+                                    run out of room in the part_buffer. */
   nsCOMPtr<nsIInputStream> input_file_stream;   /* A stream to it. */
   nsCOMPtr<nsIOutputStream> output_file_stream; /* A stream to it. */
   MimePartBufferData()
-      : part_buffer(nullptr), part_buffer_fp(0), part_buffer_size(0) {}
+      : part_buffer(nullptr),
+        part_buffer_fp(0),
+        part_buffer_size(0),
+        options(nullptr) {}
 };
 
-MimePartBufferData *MimePartBufferCreate(void) {
-  return new MimePartBufferData();
+MimePartBufferData *MimePartBufferCreate(MimeDisplayOptions *opt) {
+  MimePartBufferData *data = new MimePartBufferData();
+  data->options = opt;
+  return data;
+}
+
+/* Discard the memory buffer and give its size back to the message budget. */
+static void MimePartBufferFreeMemory(MimePartBufferData *data) {
+  if (data->part_buffer && data->options)
+    data->options->part_buffer_bytes -= data->part_buffer_size;
+
+  PR_FREEIF(data->part_buffer);
+  data->part_buffer_fp = 0;
+  data->part_buffer_size = 0;
+}
+
+/* Try to make room for `size' more bytes in the memory buffer.  Returns false
+   if that would exceed the part limit or the message budget, or if the
+   allocation fails; the memory buffer is left as it was in that case.
+ */
+static bool MimePartBufferGrow(MimePartBufferData *data, int32_t size) {
+  MimeDisplayOptions *opt = data->options;
+  int32_t limit = opt ? opt->part_buffer_limit : MIME_PART_BUFFER_LIMIT_DEFAULT;
+  int32_t budget =
+      opt ? opt->part_buffer_budget : MIME_PART_BUFFER_BUDGET_DEFAULT;
+
+  if (size > limit - data->part_buffer_fp) return false;
+  int32_t needed = data->part_buffer_fp + size;
+
+  int32_t new_size = std::max(data->part_buffer_size, MEMORY_BUFFER_START_SIZE);
+  while (new_size < needed)
+    new_size = (new_size > limit / 2) ? limit : new_size * 2;
+  new_size = std::min(new_size, limit);
+
+  int32_t growth = new_size - data->part_buffer_size;
+  if (opt && growth > budget - opt->part_buffer_bytes) return false;
+
+  char *new_buffer = (char *)PR_REALLOC(data->part_buffer, new_size);
+  if (!new_buffer) return false;
+
+  data->part_buffer = new_buffer;
+  data->part_buffer_size = new_size;
+  if (opt) {
+    opt->part_buffer_bytes += growth;
+    opt->part_buffer_peak =
+        std::max(opt->part_buffer_peak, opt->part_buffer_bytes);
+  }
+  return true;
 }
 
 void MimePartBufferClose(MimePartBufferData *data) {
@@ -83,8 +132,7 @@ void MimePartBufferReset(MimePartBufferData *data) {
   NS_ASSERTION(data, "MimePartBufferReset: no data");
   if (!data) return;
 
-  PR_FREEIF(data->part_buffer);
-  data->part_buffer_fp = 0;
+  MimePartBufferFreeMemory(data);
 
   if (data->input_file_stream) {
     data->input_file_stream->Close();
@@ -114,28 +162,18 @@ int MimePartBufferWrite(MimePartBufferData *data, const char *buf,
   NS_ASSERTION(data && buf && size > 0, "MimePartBufferWrite: Bad param");
   if (!data || !buf || size <= 0) return -1;
 
-  /* If we don't yet have a buffer (either memory or file) try and make a
-     memory buffer.
+  /* As long as we haven't gone to disk, try to keep this buf in memory,
+     growing the memory buffer if need be.
    */
-  if (!data->part_buffer && !data->file_buffer) {
-    int target_size = TARGET_MEMORY_BUFFER_SIZE;
-    while (target_size > 0) {
-      data->part_buffer = (char *)PR_MALLOC(target_size);
-      if (data->part_buffer) break;                 // got it!
-      target_size -= TARGET_MEMORY_BUFFER_QUANTUM;  // decrease it and try again
+  if (!data->file_buffer) {
+    if (size <= data->part_buffer_size - data->part_buffer_fp ||
+        MimePartBufferGrow(data, size)) {
+      memcpy(data->part_buffer + data->part_buffer_fp, buf, size);
+      data->part_buffer_fp += size;
+      return 0;
     }
 
-    if (data->part_buffer)
-      data->part_buffer_size = target_size;
-    else
-      data->part_buffer_size = 0;
-
-    data->part_buffer_fp = 0;
-  }
-
-  /* Ok, if at this point we still don't have either kind of buffer, try and
-    make a file buffer. */
-  if (!data->part_buffer && !data->file_buffer) {
+    /* It won't fit; open the file, and dump the memory buffer to it. */
     nsCOMPtr<nsIFile> tmpFile;
     nsresult rv = nsMsgCreateTempFile("nsma", getter_AddRefs(tmpFile));
     NS_ENSURE_SUCCESS(rv, MIME_UNABLE_TO_OPEN_TMP_FILE);
@@ -145,55 +183,24 @@ int MimePartBufferWrite(MimePartBufferData *data, const char *buf,
         getter_AddRefs(data->output_file_stream), data->file_buffer,
         PR_WRONLY | PR_CREATE_FILE, 00600);
     NS_ENSURE_SUCCESS(rv, MIME_UNABLE_TO_OPEN_TMP_FILE);
-  }
 
-  NS_ASSERTION(data->part_buffer || data->output_file_stream,
-               "no part_buffer or file_stream");
+    if (data->part_buffer && data->part_buffer_fp) {
+      uint32_t bytesWritten;
+      rv = data->output_file_stream->Write(
+          data->part_buffer, data->part_buffer_fp, &bytesWritten);
+      NS_ENSURE_SUCCESS(rv, MIME_ERROR_WRITING_FILE);
+    }
 
-  /* If this buf will fit in the memory buffer, put it there.
-   */
-  if (data->part_buffer &&
-      data->part_buffer_fp + size < data->part_buffer_size) {
-    memcpy(data->part_buffer + data->part_buffer_fp, buf, size);
-    data->part_buffer_fp += size;
+    MimePartBufferFreeMemory(data);
   }
 
-  /* Otherwise it won't fit; write it to the file instead. */
-  else {
-    /* If the file isn't open yet, open it, and dump the memory buffer
-    to it. */
-    if (!data->output_file_stream) {
-      nsresult rv;
-      if (!data->file_buffer) {
-        nsCOMPtr<nsIFile> tmpFile;
-        rv = nsMsgCreateTempFile("nsma", getter_AddRefs(tmpFile));
-        NS_ENSURE_SUCCESS(rv, MIME_UNABLE_TO_OPEN_TMP_FILE);
-        data->file_buffer = tmpFile;
-      }
+  NS_ASSERTION(data->output_file_stream, "no file_stream");
+  if (!data->output_file_stream) return MIME_ERROR_WRITING_FILE;
 
-      rv = MsgNewBufferedFileOutputStream(
-          getter_AddRefs(data->output_file_stream), data->file_buffer,
-          PR_WRONLY | PR_CREATE_FILE, 00600);
-      NS_ENSURE_SUCCESS(rv, MIME_UNABLE_TO_OPEN_TMP_FILE);
-
-      if (data->part_buffer && data->part_buffer_fp) {
-        uint32_t bytesWritten;
-        nsresult rv = data->output_file_stream->Write(
-            data->part_buffer, data->part_buffer_fp, &bytesWritten);
-        NS_ENSURE_SUCCESS(rv, MIME_ERROR_WRITING_FILE);
-      }
-
-      PR_FREEIF(data->part_buffer);
-      data->part_buffer_fp = 0;
-      data->part_buffer_size = 0;
-    }
-
-    /* Dump this buf to the file. */
-    uint32_t bytesWritten;
-    nsresult rv = data->output_file_stream->Write(buf, size, &bytesWritten);
-    if (NS_FAILED(rv) || (int32_t)bytesWritten < size)
-      return MIME_OUT_OF_MEMORY;
-  }
+  /* Dump this buf to the file. */
+  uint32_t bytesWritten;
+  nsresult rv = data->output_file_stream->Write(buf, size, &bytesWritten);
+  if (NS_FAILED(rv) || (int32_t)bytesWritten < size) return MIME_OUT_OF_MEMORY;
 
   return 0;
 }
@@ -215,8 +222,6 @@ int MimePartBufferRead(MimePartBufferData *data,
 
     NS_ASSERTION(data->part_buffer_size == 0 && data->part_buffer_fp == 0,
                  "buffer size is not null");
-    NS_ASSERTION(data->file_buffer, "no file buffer name");
-    if (!data->file_buffer) return -1;
 
     buf = (char *)PR_MALLOC(buf_size);
     if (!buf) return MIME_OUT_OF_MEMORY;
@@ -234,6 +239,7 @@ int MimePartBufferRead(MimePartBufferData *data,
       uint32_t bytesRead = 0;
       rv = data->input_file_stream->Read(buf, buf_size - 1, &bytesRead);
       if (NS_FAILED(rv) || !bytesRead) {
+        if (NS_FAILED(rv)) status = -1;
         break;
       } else {
         /* It would be really nice to be able to yield here, and let
@@ -247,5 +253,5 @@ int MimePartBufferRead(MimePartBufferData *data,
     PR_Free(buf);
   }
 
-  return 0;
+  return status < 0 ? status : 0;
 }
@@ -14,22 +14,41 @@
    buffering is done in an efficient way that works well for both very large
    and very small objects.
 
-   This is used in two places:
+   This is used in several places:
 
    = The implementation of multipart/alternative uses this code to do a
      one-part-lookahead.  As it traverses its children, it moves forward
      until it finds a part which cannot be displayed; and then it displays
      the *previous* part (the last which *could* be displayed.)  This code
      is used to hold the previous part until it is needed.
+
+   = multipart/related holds its 'head' part here until the parts it
+     refers to have been seen.
+
+   = multipart/signed and the encrypted types hold the signed or encrypted
+     data here until it can be verified or decrypted.
+
+   How much memory the buffers may use is governed by the part_buffer_*
+   fields of MimeDisplayOptions: a part larger than part_buffer_limit, or one
+   which would take the buffers of the whole message past part_buffer_budget,
+   is moved to a temp file.
 */
 
+/* Defaults for MimeDisplayOptions::part_buffer_limit and
+   part_buffer_budget, in bytes.
+ */
+#define MIME_PART_BUFFER_LIMIT_DEFAULT (1024 * 256)
+#define MIME_PART_BUFFER_BUDGET_DEFAULT (1024 * 2048)
+
 /* An opaque object used to represent the buffered data.
  */
 typedef struct MimePartBufferData MimePartBufferData;
 
-/* Create an empty part buffer object.
+/* Create an empty part buffer object.  The memory it uses is accounted
+   against the given options, which must outlive the buffer; they may be null,
+   in which case the default limits apply.
  */
-extern MimePartBufferData *MimePartBufferCreate(void);
+extern MimePartBufferData *MimePartBufferCreate(MimeDisplayOptions *opt);
 
 /* Assert that the buffer is now full (EOF has been reached on the current
    part.)  This will free some resources, but leaves the part in the buffer.
@@ -54,7 +73,8 @@ extern int MimePartBufferWrite(MimePartBufferData *data, const char *buf,
 
 /* Read the contents of the buffer back out.  This will invoke the provided
    read_fn with successive chunks of data until the buffer has been drained.
-   The provided function may be called once, or multiple times.
+   The provided function may be called once, or multiple times.  Returns the
+   first negative status returned by read_fn, if any.
  */
 extern int MimePartBufferRead(MimePartBufferData *data,
                               MimeConverterOutputCallback read_fn,
@@ -44,6 +44,16 @@ typedef struct MimeHeaders {
   int32_t heads_size; /* The length (and consequently, how many
                          distinct headers are in here.) */
 
+  int32_t *name_index; /* An index of the header names, built along with
+                          `heads' so that looking a header up doesn't have
+                          to go through all of them.  This is a hash table
+                          of name_index_size slots, followed by two arrays
+                          of heads_size entries: for each header, the
+                          next header with the same name and the length of
+                          its name.  See mimehdrs.cpp.
+                        */
+  int32_t name_index_size;
+
   char *obuffer; /* This buffer is used for output. */
   int32_t obuffer_size;
   int32_t obuffer_fp;
@@ -383,6 +393,20 @@ class MimeDisplayOptions {
    *  the moment, only the JS mime emitter uses this.
    */
   bool metadata_only;
+
+  /**
+   * Limits for MimePartBufferData (see mimepbuf.h).  A single buffered part
+   *  is moved to a temp file once it grows past part_buffer_limit bytes, and
+   *  all parts buffered for this message together never hold more than
+   *  part_buffer_budget bytes of memory.  part_buffer_bytes and
+   *  part_buffer_peak track how much memory the buffers currently hold and
+   *  the most they held at once; the peak is reported to telemetry when the
+   *  options are destroyed.
+   */
+  int32_t part_buffer_limit;
+  int32_t part_buffer_budget;
+  int32_t part_buffer_bytes;
+  int32_t part_buffer_peak;
 };
 
 #endif /* _MODLMIME_H_ */
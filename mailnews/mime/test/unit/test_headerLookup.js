@@ -0,0 +1,101 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Displays a message whose part headers are looked up by name: in any case,
+ * repeated, after lines without a colon and after the "From " line of an
+ * attached message. Each part is created with a copy of its headers, and
+ * multipart/alternative keeps another copy of them while it waits for the
+ * last alternative, so the lookups are made on copies too. Checks that the
+ * parts are displayed and the attachment reported as their first header of
+ * each name says.
+ */
+
+const { localAccountUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/localAccountUtils.js"
+);
+
+var kMessage = [
+  "From ",
+  "From: alice@t1.example.com",
+  "To: bob@t2.example.net",
+  "Subject: header lookups",
+  "MIME-Version: 1.0",
+  'content-TYPE: multipart/mixed; boundary="outer"',
+  "",
+  "--outer",
+  'CONTENT-TYPE: multipart/alternative; boundary="alt"',
+  "",
+  "--alt",
+  "Content-Type: text/plain",
+  "",
+  "plain alternative",
+  "--alt",
+  "Content-Type text/plain",
+  "cOnTeNt-TyPe: text/html",
+  "Content-Type: text/plain",
+  "",
+  "<html><body><b>html alternative</b></body></html>",
+  "--alt--",
+  "--outer",
+  "Content-Type application/zip",
+  'Content-Type: application/pdf; name="first.pdf"',
+  "X-Folded: a",
+  ' Content-Type: image/png; name="folded.png"',
+  'CONTENT-TYPE: image/png; name="second.png"',
+  "content-disposition: attachment",
+  "Content-Transfer-Encoding: base64",
+  "",
+  "JVBERi0=",
+  "--outer",
+  "Content-Type: message/rfc822",
+  "Content-Disposition: inline",
+  "",
+  "From alice@t1.example.com Sat Oct 17 00:00:00 2026",
+  "From: alice@t1.example.com",
+  "Subject: attached",
+  'Content-Type: multipart/mixed; boundary="inner"',
+  "",
+  "--inner",
+  "Content-Type: text/plain",
+  "",
+  "inner body",
+  "--inner--",
+  "--outer--",
+  "",
+].join("\r\n");
+
+add_task(async function testHeaderLookup() {
+  // A mailbox would take the "From " line of the attached message for the
+  // start of another message.
+  localAccountUtils.loadLocalMailAccount(
+    "@mozilla.org/msgstore/maildirstore;1"
+  );
+  let inbox = localAccountUtils.inboxFolder.QueryInterface(
+    Ci.nsIMsgLocalMailFolder
+  );
+  let msgHdr = inbox.addMessage(kMessage);
+
+  let attachments = [];
+  let conversion = apply_mime_conversion(inbox.getUriForMsg(msgHdr), {
+    handleAttachment(aContentType, aUrl, aDisplayName, aUri, aNotDownloaded) {
+      attachments.push({ contentType: aContentType, name: aDisplayName });
+    },
+  });
+  await conversion.promise;
+  let contents = conversion._data;
+
+  // The html alternative was displayed as html, from the copy of its headers.
+  Assert.ok(contents.includes("html alternative"));
+  Assert.ok(!contents.includes("&lt;b&gt;"));
+  Assert.ok(!contents.includes("plain alternative"));
+  Assert.ok(!contents.includes("--alt"));
+
+  // The attached message was parsed past its "From " line.
+  Assert.ok(contents.includes("inner body"));
+  Assert.ok(!contents.includes("--inner"));
+
+  let pdf = attachments.find(a => a.name == "first.pdf");
+  Assert.ok(pdf, JSON.stringify(attachments));
+  Assert.equal(pdf.contentType, "application/pdf");
+});
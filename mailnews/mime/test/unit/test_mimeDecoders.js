@@ -0,0 +1,171 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Fetches quoted-printable and base64 encoded parts of a message and checks
+ * that they are decoded byte for byte. The encoded lines are wrapped at
+ * varying widths, down to a single token a line, so that escapes, soft line
+ * breaks and base64 groups are split across the calls the decoders get, and
+ * the decoders have to hold on to the tokens left over from one call for the
+ * next. The text before each hard line break leaves the quoted-printable
+ * decoder with literal characters it has to write out ahead of the buffer.
+ */
+
+const { localAccountUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/localAccountUtils.js"
+);
+
+// The lines of a part are handed to the decoders without their line break,
+// which follows in a call of its own, converted to the platform's.
+// Note: Services.appinfo.OS returns "XPCShell" in the test, so we use this
+// hacky condition to separate Windows from the others.
+var kNewline = "@mozilla.org/windows-registry-key;1" in Cc ? "\r\n" : "\n";
+
+var kBoundary = "decoders";
+
+var kQPWidths = [1, 2, 3, 4, 5, 7, 11, 16, 75, 76];
+var kBase64Widths = [1, 2, 3, 5, 6, 7, 9, 76, 77];
+
+// Hard line breaks, escapes and literal whitespace; no NUL, which the stream
+// listener can't read.
+var kQPText = "";
+for (let i = 0; i < 40; i++) {
+  kQPText +=
+    "Line " +
+    i +
+    ": a=b " +
+    String.fromCharCode(0xa0 + i) +
+    "\t" +
+    "x".repeat(i) +
+    " =" +
+    String.fromCharCode(1 + i) +
+    "\r\n";
+}
+kQPText += "no line break at the end \xe9";
+
+var kBinaryData = "";
+for (let i = 0; i < 2000; i++) {
+  kBinaryData += String.fromCharCode(1 + (i % 255));
+}
+
+function hex(aChar) {
+  return (
+    "=" +
+    aChar
+      .charCodeAt(0)
+      .toString(16)
+      .toUpperCase()
+      .padStart(2, "0")
+  );
+}
+
+// Encodes aText, keeping its CRLFs as hard line breaks, with soft line breaks
+// after about as many characters as the next of aWidths.
+function encodeQP(aText, aWidths) {
+  let lines = [];
+  let w = 0;
+  for (let hardLine of aText.split("\r\n")) {
+    let line = "";
+    for (let c of hardLine) {
+      let literal = c == " " || c == "\t" || (c > " " && c < "\x7f");
+      let token = literal && c != "=" ? c : hex(c);
+      if (line && line.length + token.length > aWidths[w % aWidths.length]) {
+        lines.push(line + "=");
+        line = "";
+        w++;
+      }
+      line += token;
+    }
+    lines.push(line);
+    w++;
+  }
+  return lines.join("\r\n");
+}
+
+function encodeBase64(aData, aWidths) {
+  let encoded = btoa(aData);
+  let lines = [];
+  for (let w = 0; encoded; w++) {
+    let width = aWidths[w % aWidths.length];
+    lines.push(encoded.slice(0, width));
+    encoded = encoded.slice(width);
+  }
+  return lines.join("\r\n");
+}
+
+function makePart(aEncoding, aBody) {
+  return (
+    "--" +
+    kBoundary +
+    "\r\n" +
+    "Content-Type: application/octet-stream\r\n" +
+    "Content-Transfer-Encoding: " +
+    aEncoding +
+    "\r\n\r\n" +
+    aBody +
+    "\r\n"
+  );
+}
+
+// [part, expected content]
+var gParts = [
+  ["1.2", kQPText.replace(/\r\n/g, kNewline)],
+  ["1.3", kBinaryData],
+  ["1.4", kBinaryData.slice(1)],
+  ["1.5", kBinaryData.slice(2)],
+];
+
+function fetchPart(aMsgHdr, aPart) {
+  let msgURI = aMsgHdr.folder.getUriForMsg(aMsgHdr);
+  let messageService = Cc["@mozilla.org/messenger;1"]
+    .createInstance(Ci.nsIMessenger)
+    .messageServiceFromURI(msgURI);
+  let neckoURL = {};
+  messageService.GetUrlForUri(msgURI, neckoURL, null);
+  let channel = Services.io.newChannelFromURI(
+    Services.io.newURI(neckoURL.value.spec + "&part=" + aPart),
+    null,
+    Services.scriptSecurityManager.getSystemPrincipal(),
+    null,
+    Ci.nsILoadInfo.SEC_ALLOW_CROSS_ORIGIN_DATA_IS_NULL,
+    Ci.nsIContentPolicy.TYPE_OTHER
+  );
+  let listener = new PromiseTestUtils.PromiseStreamListener();
+  channel.asyncOpen(listener);
+  return listener.promise;
+}
+
+add_task(async function testDecodeSplitTokens() {
+  localAccountUtils.loadLocalMailAccount();
+  let inbox = localAccountUtils.inboxFolder.QueryInterface(
+    Ci.nsIMsgLocalMailFolder
+  );
+  let msgHdr = inbox.addMessage(
+    "From \r\n" +
+      "From: alice@t1.example.com\r\n" +
+      "To: bob@t2.example.net\r\n" +
+      "Subject: split tokens\r\n" +
+      "MIME-Version: 1.0\r\n" +
+      'Content-Type: multipart/mixed; boundary="' +
+      kBoundary +
+      '"\r\n\r\n' +
+      "--" +
+      kBoundary +
+      "\r\n" +
+      "Content-Type: text/plain\r\n\r\n" +
+      "Encoded parts follow.\r\n" +
+      makePart("quoted-printable", encodeQP(kQPText, kQPWidths)) +
+      makePart("base64", encodeBase64(gParts[1][1], kBase64Widths)) +
+      makePart("base64", encodeBase64(gParts[2][1], kBase64Widths)) +
+      makePart("base64", encodeBase64(gParts[3][1], kBase64Widths)) +
+      "--" +
+      kBoundary +
+      "--\r\n"
+  );
+
+  for (let [part, expected] of gParts) {
+    let data = await fetchPart(msgHdr, part);
+    Assert.equal(data.length, expected.length, "part " + part);
+    Assert.ok(data == expected, "part " + part);
+  }
+});
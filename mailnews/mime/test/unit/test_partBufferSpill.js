@@ -0,0 +1,119 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Displays a multipart/related and a multipart/alternative message, whose
+ * parts are buffered until the whole container has been read, with the part
+ * buffers kept in memory and again with limits low enough that they are
+ * spilled to temp files. Checks that the output is the same both ways.
+ */
+
+const { localAccountUtils } = ChromeUtils.import(
+  "resource://testing-common/mailnews/localAccountUtils.js"
+);
+
+// Well past the lowered limit of a part, and together past the lowered
+// budget of a message.
+var kFiller = "";
+for (let i = 0; i < 400; i++) {
+  kFiller += "Line " + i + " of the filler, to make the part large.\r\n";
+}
+
+function makeMessage(aSubject, aContentType, aParts) {
+  let message =
+    "From \r\n" +
+    "From: alice@t1.example.com\r\n" +
+    "To: bob@t2.example.net\r\n" +
+    "Subject: " +
+    aSubject +
+    "\r\n" +
+    "MIME-Version: 1.0\r\n" +
+    "Content-Type: " +
+    aContentType +
+    '; boundary="part"\r\n\r\n';
+  for (let [headers, body] of aParts) {
+    message += "--part\r\n" + headers.join("\r\n") + "\r\n\r\n" + body;
+  }
+  return message + "--part--\r\n";
+}
+
+var kImage = btoa("GIF89a" + "\x01".repeat(3000)).replace(
+  /(.{76})/g,
+  "$1\r\n"
+);
+
+var gMessages = [
+  makeMessage("related", 'multipart/related; type="text/html"', [
+    [
+      ["Content-Type: text/html; charset=UTF-8"],
+      '<html><body><img src="cid:image@t1.example.com">\r\n<pre>\r\n' +
+        kFiller +
+        "</pre></body></html>\r\n",
+    ],
+    [
+      [
+        "Content-Type: image/gif",
+        "Content-ID: <image@t1.example.com>",
+        "Content-Transfer-Encoding: base64",
+      ],
+      kImage + "\r\n",
+    ],
+  ]),
+  makeMessage("alternative", "multipart/alternative", [
+    [
+      ["Content-Type: text/plain; charset=UTF-8"],
+      "plain alternative\r\n" + kFiller,
+    ],
+    [
+      ["Content-Type: text/html; charset=UTF-8"],
+      "<html><body><pre>\r\nhtml alternative\r\n" +
+        kFiller +
+        "</pre></body></html>\r\n",
+    ],
+    [
+      ["Content-Type: text/plain; charset=UTF-8"],
+      "last alternative\r\n" + kFiller,
+    ],
+  ]),
+];
+
+async function display(aMsgHdr) {
+  let conversion = apply_mime_conversion(
+    aMsgHdr.folder.getUriForMsg(aMsgHdr)
+  );
+  await conversion.promise;
+  return conversion._data;
+}
+
+add_task(async function testSpilledParts() {
+  localAccountUtils.loadLocalMailAccount();
+  let inbox = localAccountUtils.inboxFolder.QueryInterface(
+    Ci.nsIMsgLocalMailFolder
+  );
+  let msgHdrs = gMessages.map(message => inbox.addMessage(message));
+
+  let inMemory = [];
+  for (let msgHdr of msgHdrs) {
+    inMemory.push(await display(msgHdr));
+  }
+  Assert.ok(inMemory[0].includes("Line 399 of the filler"));
+  Assert.ok(inMemory[1].includes("html alternative"));
+  Assert.ok(!inMemory[1].includes("last alternative"));
+
+  Services.prefs.setIntPref("mailnews.display.part_buffer_limit_kb", 4);
+  Services.prefs.setIntPref("mailnews.display.part_buffer_budget_kb", 8);
+  for (let i = 0; i < msgHdrs.length; i++) {
+    let spilled = await display(msgHdrs[i]);
+    Assert.equal(spilled.length, inMemory[i].length, msgHdrs[i].subject);
+    Assert.ok(spilled == inMemory[i], msgHdrs[i].subject);
+  }
+
+  // Without any memory for a part, every part is spilled as soon as it starts.
+  Services.prefs.setIntPref("mailnews.display.part_buffer_limit_kb", 0);
+  for (let i = 0; i < msgHdrs.length; i++) {
+    Assert.ok((await display(msgHdrs[i])) == inMemory[i], msgHdrs[i].subject);
+  }
+
+  Services.prefs.clearUserPref("mailnews.display.part_buffer_limit_kb");
+  Services.prefs.clearUserPref("mailnews.display.part_buffer_budget_kb");
+});
@@ -13,6 +13,8 @@
 // protocol.
 #define NNTP_CMD_LIST_EXTENSIONS "LIST EXTENSIONS" CRLF
 #define NNTP_CMD_MODE_READER "MODE READER" CRLF
+#define NNTP_CMD_CAPABILITIES "CAPABILITIES" CRLF
+#define NNTP_CMD_COMPRESS_DEFLATE "COMPRESS DEFLATE" CRLF
 #define NNTP_CMD_LIST_SEARCHES "LIST SEARCHES" CRLF
 #define NNTP_CMD_LIST_SEARCH_FIELDS "LIST SRCHFIELDS" CRLF
 #define NNTP_CMD_GET_PROPERTIES "GET" CRLF
@@ -23,10 +25,13 @@
 // end of protocol strings
 
 #define MK_NNTP_RESPONSE_HELP 100
+#define MK_NNTP_RESPONSE_CAPABILITIES_OK 101
 
 #define MK_NNTP_RESPONSE_POSTING_ALLOWED 200
 #define MK_NNTP_RESPONSE_POSTING_DENIED 201
 
+#define MK_NNTP_RESPONSE_COMPRESS_OK 206
+
 #define MK_NNTP_RESPONSE_DISCONTINUED 400
 
 #define MK_NNTP_RESPONSE_COMMAND_UNKNOWN 500
@@ -717,8 +717,7 @@ NS_IMETHODIMP nsNNTPNewsgroupList::ApplyFilterHit(nsIMsgFilter *aFilter,
   return finalResult;
 }
 
-nsresult nsNNTPNewsgroupList::ProcessXOVERLINE(const char *line,
-                                               uint32_t *status) {
+nsresult nsNNTPNewsgroupList::ProcessXOVERLINE(char *line, uint32_t *status) {
   uint32_t message_number = 0;
   //  int32_t lines;
   nsresult rv = NS_OK;
@@ -727,11 +726,7 @@ nsresult nsNNTPNewsgroupList::ProcessXOVERLINE(const char *line,
   if (!line) return NS_ERROR_NULL_POINTER;
 
   if (m_newsDB) {
-    char *xoverline = PL_strdup(line);
-    if (!xoverline) return NS_ERROR_OUT_OF_MEMORY;
-    rv = ParseLine(xoverline, &message_number);
-    PL_strfree(xoverline);
-    xoverline = nullptr;
+    rv = ParseLine(line, &message_number);
     if (NS_FAILED(rv)) return rv;
   } else
     return NS_ERROR_NOT_INITIALIZED;
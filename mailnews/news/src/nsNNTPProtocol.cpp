@@ -14,6 +14,8 @@
 #include "nsIPipe.h"
 #include "nsCOMPtr.h"
 #include "nsMsgI18N.h"
+#include "nsMsgCompressIStream.h"
+#include "nsMsgCompressOStream.h"
 #include "nsINNTPNewsgroupPost.h"
 #include "nsMsgBaseCID.h"
 #include "nsMsgNewsCID.h"
@@ -23,6 +25,7 @@
 #include "prtime.h"
 #include "prerror.h"
 #include "nsString.h"
+#include "nsCRTGlue.h"
 #include "mozilla/Attributes.h"
 #include "mozilla/Logging.h"
 #include "mozilla/Services.h"
@@ -132,6 +135,10 @@ const char *const stateLabels[] = {
   "NNTP_LOGIN_RESPONSE",
   "NNTP_SEND_MODE_READER",
   "NNTP_SEND_MODE_READER_RESPONSE",
+  "NNTP_SEND_CAPABILITIES",
+  "NNTP_SEND_CAPABILITIES_RESPONSE",
+  "NNTP_SEND_COMPRESS",
+  "NNTP_SEND_COMPRESS_RESPONSE",
   "SEND_LIST_EXTENSIONS",
   "SEND_LIST_EXTENSIONS_RESPONSE",
   "SEND_LIST_SEARCHES",
@@ -225,6 +232,12 @@ const char *const stateLabels[] = {
  */
 #define NEWGROUPS_TIME_OFFSET 60L * 60L * 12L /* 12 hours */
 
+// When the server advertises OVER, each chunk of headers is requested in
+// ranges of this many articles, with up to MAX_PIPELINED_OVER commands in
+// flight so the server never waits for us to ask for the next range.
+#define OVER_RANGE_SIZE 5000
+#define MAX_PIPELINED_OVER 4
+
 ////////////////////////////////////////////////////////////////////////////////////////////
 // TEMPORARY HARD CODED FUNCTIONS
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -407,6 +420,9 @@ NS_IMETHODIMP nsNNTPProtocol::Initialize(nsIURI *aURL,
   m_lastPossibleArticle = 0;
   m_numArticlesLoaded = 0;
   m_numArticlesWanted = 0;
+  m_overSentLast = 0;
+  m_overCommandsInFlight = 0;
+  m_overFailedCode = 0;
 
   m_key = nsMsgKey_None;
 
@@ -1297,10 +1313,12 @@ nsresult nsNNTPProtocol::NewsResponse(nsIInputStream *inputStream,
   else
     NS_MsgSACopy(&m_responseText, line);
 
-  /* authentication required can come at any time
+  /* authentication required can come at any time, but ReadXoverResponse
+   * first reads the responses to the other pipelined OVER commands
    */
-  if (MK_NNTP_RESPONSE_AUTHINFO_REQUIRE == m_responseCode ||
-      MK_NNTP_RESPONSE_AUTHINFO_SIMPLE_REQUIRE == m_responseCode) {
+  if ((MK_NNTP_RESPONSE_AUTHINFO_REQUIRE == m_responseCode ||
+       MK_NNTP_RESPONSE_AUTHINFO_SIMPLE_REQUIRE == m_responseCode) &&
+      m_nextStateAfterResponse != NNTP_XOVER_RESPONSE) {
     m_nextState = NNTP_BEGIN_AUTHORIZE;
   } else {
     m_nextState = m_nextStateAfterResponse;
@@ -1363,13 +1381,143 @@ nsresult nsNNTPProtocol::SendModeReaderResponse() {
 #ifdef HAVE_NNTP_EXTENSIONS
     m_nextState = SEND_LIST_EXTENSIONS;
 #else
-    m_nextState = SEND_FIRST_NNTP_COMMAND;
+    m_nextState = NNTP_SEND_CAPABILITIES;
 #endif /* HAVE_NNTP_EXTENSIONS */
   }
 
   return NS_OK;
 }
 
+nsresult nsNNTPProtocol::SendCapabilities() {
+  SetFlag(NNTP_CAPABILITIES_PERFORMED);
+  nsresult rv = SendData(NNTP_CMD_CAPABILITIES);
+
+  m_nextState = NNTP_RESPONSE;
+  m_nextStateAfterResponse = NNTP_SEND_CAPABILITIES_RESPONSE;
+  SetFlag(NNTP_PAUSE_FOR_READ);
+  return rv;
+}
+
+nsresult nsNNTPProtocol::SendCapabilitiesResponse(nsIInputStream *inputStream,
+                                                  uint32_t length) {
+  if (m_responseCode != MK_NNTP_RESPONSE_CAPABILITIES_OK) {
+    /* CAPABILITIES is new in RFC 3977, so older servers don't know it.
+     * Carry on without any of the extensions it would have told us about. */
+    m_nextState = SEND_FIRST_NNTP_COMMAND;
+    return NS_OK;
+  }
+
+  nsresult rv = NS_OK;
+  uint32_t status = 0;
+  bool pauseForMoreData = false;
+  char *line = m_lineStreamBuffer->ReadNextLine(inputStream, status,
+                                                pauseForMoreData, &rv);
+
+  if (pauseForMoreData) {
+    SetFlag(NNTP_PAUSE_FOR_READ);
+    return NS_OK;
+  }
+  if (!line) return rv; /* no line yet */
+
+  NNTP_LOG_READ(line);
+
+  if ('.' == line[0] && '\0' == line[1]) {
+    bool useCompress = false;
+    if (TestFlag(NNTP_SERVER_HAS_COMPRESS) &&
+        !TestFlag(NNTP_USING_COMPRESS)) {
+      nsCOMPtr<nsIMsgIncomingServer> server = do_QueryInterface(m_nntpServer);
+      if (server) server->GetBoolValue("use_compress_deflate", &useCompress);
+    }
+    m_nextState = useCompress ? NNTP_SEND_COMPRESS : SEND_FIRST_NNTP_COMMAND;
+    ClearFlag(NNTP_PAUSE_FOR_READ);
+  } else {
+    /* Each line is a capability label, possibly followed by arguments. */
+    char *rest = line;
+    char *label = NS_strtok(" \t", &rest);
+    if (label && !PL_strcasecmp(label, "OVER")) {
+      SetFlag(NNTP_SERVER_HAS_OVER);
+    } else if (label && !PL_strcasecmp(label, "COMPRESS")) {
+      while (char *algorithm = NS_strtok(" \t", &rest)) {
+        if (!PL_strcasecmp(algorithm, "DEFLATE"))
+          SetFlag(NNTP_SERVER_HAS_COMPRESS);
+      }
+    }
+  }
+
+  PR_Free(line);
+  return NS_OK;
+}
+
+nsresult nsNNTPProtocol::SendCompress() {
+  nsresult rv = SendData(NNTP_CMD_COMPRESS_DEFLATE);
+
+  m_nextState = NNTP_RESPONSE;
+  m_nextStateAfterResponse = NNTP_SEND_COMPRESS_RESPONSE;
+  SetFlag(NNTP_PAUSE_FOR_READ);
+  return rv;
+}
+
+nsresult nsNNTPProtocol::SendCompressResponse(nsIInputStream *inputStream) {
+  m_nextState = SEND_FIRST_NNTP_COMMAND;
+
+  /* If the server won't compress after all, just carry on without it. */
+  if (m_responseCode != MK_NNTP_RESPONSE_COMPRESS_OK) return NS_OK;
+
+  /* Both directions are compressed from here on, and we can't talk to the
+   * server any other way, so failing to set that up is fatal. */
+  nsresult rv = BeginCompressing();
+  if (NS_FAILED(rv)) {
+    NNTP_LOG_NOTE("failed to enable compression");
+    m_nextState = NNTP_ERROR;
+    return rv;
+  }
+
+  SetFlag(NNTP_USING_COMPRESS);
+  return NS_OK;
+}
+
+nsresult nsNNTPProtocol::BeginCompressing() {
+  // The socket's data comes to us a piece at a time from the pump, so it is
+  // put into a pipe for the inflater to read. Neither end may block, as
+  // both are used on the main thread.
+  nsCOMPtr<nsIPipe> pipe = do_CreateInstance("@mozilla.org/pipe;1");
+  nsresult rv = pipe->Init(true, true, 4096, PR_UINT32_MAX);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIAsyncInputStream> compressedIn;
+  MOZ_ALWAYS_SUCCEEDS(pipe->GetInputStream(getter_AddRefs(compressedIn)));
+  nsCOMPtr<nsIAsyncOutputStream> compressedOut;
+  MOZ_ALWAYS_SUCCEEDS(pipe->GetOutputStream(getter_AddRefs(compressedOut)));
+
+  // wrap the streams in compression layers that compress or decompress
+  // all traffic.
+  RefPtr<nsMsgCompressIStream> new_in = new nsMsgCompressIStream();
+  rv = new_in->InitInputStream(compressedIn);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  RefPtr<nsMsgCompressOStream> new_out = new nsMsgCompressOStream();
+  rv = new_out->InitOutputStream(m_outputStream);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  m_compressedOutputStream = compressedOut;
+  m_inflateStream = new_in;
+  m_outputStream = new_out;
+  return NS_OK;
+}
+
+nsresult nsNNTPProtocol::PassToInflater(nsIInputStream *inputStream,
+                                        uint32_t length) {
+  while (length > 0) {
+    uint32_t written = 0;
+    nsresult rv =
+        m_compressedOutputStream->WriteFrom(inputStream, length, &written);
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (!written) return NS_BASE_STREAM_CLOSED;
+    length -= written;
+  }
+  return NS_OK;
+}
+
 nsresult nsNNTPProtocol::SendListExtensions() {
   nsresult rv = SendData(NNTP_CMD_LIST_EXTENSIONS);
 
@@ -2271,6 +2419,8 @@ nsresult nsNNTPProtocol::AuthorizationResponse() {
 #else
     if (!TestFlag(NNTP_READER_PERFORMED))
       m_nextState = NNTP_SEND_MODE_READER;
+    else if (!TestFlag(NNTP_CAPABILITIES_PERFORMED))
+      m_nextState = NNTP_SEND_CAPABILITIES;
     else
       m_nextState = SEND_FIRST_NNTP_COMMAND;
 #endif /* HAVE_NNTP_EXTENSIONS */
@@ -2332,6 +2482,8 @@ nsresult nsNNTPProtocol::PasswordResponse() {
 #else
     if (!TestFlag(NNTP_READER_PERFORMED))
       m_nextState = NNTP_SEND_MODE_READER;
+    else if (!TestFlag(NNTP_CAPABILITIES_PERFORMED))
+      m_nextState = NNTP_SEND_CAPABILITIES;
     else
       m_nextState = SEND_FIRST_NNTP_COMMAND;
 #endif /* HAVE_NNTP_EXTENSIONS */
@@ -2870,6 +3022,9 @@ nsresult nsNNTPProtocol::FigureNextChunk() {
           ("(%p) Chunk will be (%d-%d)", this, m_firstArticle, m_lastArticle));
 
   m_articleNumber = m_firstArticle;
+  m_overSentLast = m_firstArticle - 1;
+  m_overCommandsInFlight = 0;
+  m_overFailedCode = 0;
 
   /* was MSG_InitXOVER() */
   if (m_newsgroupList) {
@@ -2888,16 +3043,54 @@ nsresult nsNNTPProtocol::FigureNextChunk() {
 }
 
 nsresult nsNNTPProtocol::XoverSend() {
-  char outputBuffer[OUTPUT_BUFFER_SIZE];
-
-  PR_snprintf(outputBuffer, OUTPUT_BUFFER_SIZE, "XOVER %d-%d" CRLF,
-              m_firstArticle, m_lastArticle);
-
   m_nextState = NNTP_RESPONSE;
   m_nextStateAfterResponse = NNTP_XOVER_RESPONSE;
   SetFlag(NNTP_PAUSE_FOR_READ);
 
-  return SendData(outputBuffer);
+  return SendOverCommands();
+}
+
+nsresult nsNNTPProtocol::SendOverCommands() {
+  /* Servers that only know XOVER get the whole chunk in one command. */
+  bool pipeline = TestFlag(NNTP_SERVER_HAS_OVER);
+  int32_t maxInFlight = pipeline ? MAX_PIPELINED_OVER : 1;
+
+  nsAutoCString commands;
+  while (m_overSentLast < m_lastArticle &&
+         m_overCommandsInFlight < maxInFlight) {
+    int32_t first = m_overSentLast + 1;
+    int32_t last = m_lastArticle;
+    if (pipeline && last - first >= OVER_RANGE_SIZE)
+      last = first + OVER_RANGE_SIZE - 1;
+
+    commands.AppendPrintf("%s %d-%d" CRLF, pipeline ? "OVER" : "XOVER", first,
+                          last);
+    m_overSentLast = last;
+    m_overCommandsInFlight++;
+  }
+
+  if (commands.IsEmpty()) return NS_OK;
+  return SendData(commands.get());
+}
+
+nsresult nsNNTPProtocol::FinishOverResponse() {
+  if (m_overCommandsInFlight > 0) m_overCommandsInFlight--;
+
+  /* Once a command has failed, only the responses already owed are read. */
+  nsresult rv = m_overFailedCode ? NS_OK : SendOverCommands();
+  if (m_overCommandsInFlight > 0) {
+    /* The next response may already be buffered, so don't pause for it. */
+    m_nextState = NNTP_RESPONSE;
+    m_nextStateAfterResponse = NNTP_XOVER_RESPONSE;
+  } else if (m_overFailedCode) {
+    m_responseCode = m_overFailedCode;
+    m_overFailedCode = 0;
+    XoverFailed();
+  } else {
+    m_nextState = NNTP_XHDR_SEND;
+  }
+  ClearFlag(NNTP_PAUSE_FOR_READ);
+  return rv;
 }
 
 /* see if the xover response is going to return us data
@@ -2912,24 +3105,47 @@ nsresult nsNNTPProtocol::ReadXoverResponse() {
       MK_NNTP_RESPONSE_CHECK_ERROR; /* pretend XOVER generated an error */
 #endif
 
-  if (m_responseCode != MK_NNTP_RESPONSE_XOVER_OK) {
-    /* If we didn't get back "224 data follows" from the XOVER request,
-   then that must mean that this server doesn't support XOVER.  Or
-   maybe the server's XOVER support is busted or something.  So,
-   in that case, fall back to the very slow HEAD method.
-
-   But, while debugging here at HQ, getting into this state means
-   something went very wrong, since our servers do XOVER.  Thus
-   the assert.
-     */
-    /*NS_ASSERTION (0,"something went very wrong");*/
-    m_nextState = NNTP_READ_GROUP;
-    SetFlag(NNTP_NO_XOVER_SUPPORT);
-  } else {
+  if (m_responseCode == MK_NNTP_RESPONSE_XOVER_OK) {
+    /* After a failure, ReadXover throws the data away. */
     m_nextState = NNTP_XOVER;
+    return NS_OK;
+  }
+
+  if (m_overFailedCode ||
+      (m_responseCode == MK_NNTP_RESPONSE_ARTICLE_NONEXIST &&
+       TestFlag(NNTP_SERVER_HAS_OVER))) {
+    /* RFC 3977 servers answer 423 for a range without any articles in it.
+     * Skip it, like any error after the first, and go on to the responses
+     * to the other ranges. */
+    return FinishOverResponse();
   }
 
-  return NS_OK; /* continue */
+  /* Anything else is handled once the responses to the OVER commands still
+   * in the pipeline have been read, so they aren't taken for the responses
+   * to whatever we send next. */
+  m_overFailedCode = m_responseCode;
+  return FinishOverResponse();
+}
+
+void nsNNTPProtocol::XoverFailed() {
+  if (MK_NNTP_RESPONSE_AUTHINFO_REQUIRE == m_responseCode ||
+      MK_NNTP_RESPONSE_AUTHINFO_SIMPLE_REQUIRE == m_responseCode) {
+    m_nextState = NNTP_BEGIN_AUTHORIZE;
+    return;
+  }
+
+  /* If we didn't get back "224 data follows" from the XOVER request,
+ then that must mean that this server doesn't support XOVER.  Or
+ maybe the server's XOVER support is busted or something.  So,
+ in that case, fall back to the very slow HEAD method.
+
+ But, while debugging here at HQ, getting into this state means
+ something went very wrong, since our servers do XOVER.  Thus
+ the assert.
+   */
+  /*NS_ASSERTION (0,"something went very wrong");*/
+  m_nextState = NNTP_READ_GROUP;
+  SetFlag(NNTP_NO_XOVER_SUPPORT);
 }
 
 /* process the xover list as it comes from the server
@@ -2954,10 +3170,8 @@ nsresult nsNNTPProtocol::ReadXover(nsIInputStream *inputStream,
   if (!line) return rv; /* no line yet or TCP error */
 
   if (line[0] == '.' && line[1] == '\0') {
-    m_nextState = NNTP_XHDR_SEND;
-    ClearFlag(NNTP_PAUSE_FOR_READ);
     PR_Free(lineToFree);
-    return NS_OK;
+    return FinishOverResponse();
   } else if (line[0] == '.' && line[1] == '.')
     /* The NNTP server quotes all lines beginning with "." by doubling it. */
     line++;
@@ -2969,6 +3183,12 @@ nsresult nsNNTPProtocol::ReadXover(nsIInputStream *inputStream,
     mBytesReceivedSinceLastStatusUpdate += status;
   }
 
+  /* The headers will be fetched again after an earlier range failed. */
+  if (m_overFailedCode) {
+    PR_Free(lineToFree);
+    return NS_OK;
+  }
+
   rv = m_newsgroupList->ProcessXOVERLINE(line, &status);
   NS_ASSERTION(NS_SUCCEEDED(rv), "failed to process the XOVERLINE");
 
@@ -3966,6 +4186,21 @@ nsresult nsNNTPProtocol::ProcessProtocolState(nsIURI *url,
     return inputStream ? inputStream->Close() : NS_OK;
   }
 
+  // Once COMPRESS DEFLATE is active, take what the pump has for us, and read
+  // the server's data inflated. The inflated stream itself comes back here
+  // when a suspended read is resumed.
+  if (inputStream && m_inflateStream) {
+    if (inputStream != m_inflateStream) {
+      status = PassToInflater(inputStream, length);
+      if (NS_FAILED(status)) {
+        NNTP_LOG_NOTE("failed to read compressed data");
+        m_nextState = NNTP_ERROR;
+      }
+    }
+    inputStream = m_inflateStream;
+  }
+  uint64_t inflatedLeft = 0;
+
   ClearFlag(NNTP_PAUSE_FOR_READ);
 
   while (!TestFlag(NNTP_PAUSE_FOR_READ)) {
@@ -4002,6 +4237,31 @@ nsresult nsNNTPProtocol::ProcessProtocolState(nsIURI *url,
           status = SendModeReaderResponse();
         break;
 
+      case NNTP_SEND_CAPABILITIES:
+        status = SendCapabilities();
+        break;
+
+      case NNTP_SEND_CAPABILITIES_RESPONSE:
+        if (inputStream == nullptr)
+          SetFlag(NNTP_PAUSE_FOR_READ);
+        else
+          status = SendCapabilitiesResponse(inputStream, length);
+        break;
+
+      case NNTP_SEND_COMPRESS:
+        status = SendCompress();
+        break;
+
+      case NNTP_SEND_COMPRESS_RESPONSE:
+        if (inputStream == nullptr) {
+          SetFlag(NNTP_PAUSE_FOR_READ);
+        } else {
+          status = SendCompressResponse(inputStream);
+          // Whatever comes next is compressed, even if it has arrived already.
+          if (m_inflateStream) inputStream = m_inflateStream;
+        }
+        break;
+
       case SEND_LIST_EXTENSIONS:
         status = SendListExtensions();
         break;
@@ -4297,6 +4557,18 @@ nsresult nsNNTPProtocol::ProcessProtocolState(nsIURI *url,
       ClearFlag(NNTP_PAUSE_FOR_READ);
     }
 
+    // The pump only calls us again when more compressed data arrives on the
+    // socket, so don't pause while the inflater still holds data for us.
+    // Stop if reading made no progress, though.
+    if (TestFlag(NNTP_PAUSE_FOR_READ) && inputStream &&
+        inputStream == m_inflateStream) {
+      uint64_t available = 0;
+      if (NS_SUCCEEDED(inputStream->Available(&available)) && available &&
+          available != inflatedLeft) {
+        inflatedLeft = available;
+        ClearFlag(NNTP_PAUSE_FOR_READ);
+      }
+    }
   } /* end big while */
 
   return NS_OK; /* keep going */
@@ -4397,6 +4669,8 @@ nsresult nsNNTPProtocol::CloseSocket() {
   }
 
   CleanupAfterRunningUrl();  // is this needed?
+  m_inflateStream = nullptr;
+  m_compressedOutputStream = nullptr;
   return nsMsgProtocol::CloseSocket();
 }
 
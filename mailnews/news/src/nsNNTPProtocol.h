@@ -46,6 +46,12 @@
   0x0000080 /* some protocol has succeeded so don't kill the connection */
 #define NNTP_NO_XOVER_SUPPORT \
   0x00000100 /* xover command is not supported here */
+#define NNTP_CAPABILITIES_PERFORMED \
+  0x00000200 /* have we asked the server for its CAPABILITIES? */
+#define NNTP_SERVER_HAS_OVER 0x00000400 /* RFC 3977 OVER is advertised */
+#define NNTP_SERVER_HAS_COMPRESS \
+  0x00000800 /* RFC 8054 COMPRESS DEFLATE is advertised */
+#define NNTP_USING_COMPRESS 0x00001000 /* the connection is compressed */
 
 /* states of the machine
  */
@@ -60,6 +66,10 @@ typedef enum _StatesEnum {
   NNTP_LOGIN_RESPONSE,
   NNTP_SEND_MODE_READER,
   NNTP_SEND_MODE_READER_RESPONSE,
+  NNTP_SEND_CAPABILITIES,
+  NNTP_SEND_CAPABILITIES_RESPONSE,
+  NNTP_SEND_COMPRESS,
+  NNTP_SEND_COMPRESS_RESPONSE,
   SEND_LIST_EXTENSIONS,
   SEND_LIST_EXTENSIONS_RESPONSE,
   SEND_LIST_SEARCHES,
@@ -245,6 +255,14 @@ class nsNNTPProtocol : public nsMsgProtocol,
                                   for. */
   int32_t m_maxArticles;       /* max articles to get during an XOVER */
 
+  // Pipelined OVER state for the current chunk: the last article requested
+  // and the number of commands whose responses haven't been fully read.
+  // m_overFailedCode is the first error response, acted on once the rest of
+  // the responses have been read.
+  int32_t m_overSentLast;
+  int32_t m_overCommandsInFlight;
+  int32_t m_overFailedCode;
+
   // Cancelation specific state. In particular, the headers that should be
   // used for the cancelation message.
   nsCString m_cancelFromHdr;
@@ -296,6 +314,15 @@ class nsNNTPProtocol : public nsMsgProtocol,
   nsresult SendModeReader();
   nsresult SendModeReaderResponse();
 
+  nsresult SendCapabilities();
+  nsresult SendCapabilitiesResponse(nsIInputStream *inputStream,
+                                    uint32_t length);
+  nsresult SendCompress();
+  nsresult SendCompressResponse(nsIInputStream *inputStream);
+  nsresult BeginCompressing();
+  // Hands the compressed data the pump has for us to the inflater.
+  nsresult PassToInflater(nsIInputStream *inputStream, uint32_t length);
+
   nsresult SendListExtensions();
   nsresult SendListExtensionsResponse(nsIInputStream *inputStream,
                                       uint32_t length);
@@ -401,15 +428,37 @@ class nsNNTPProtocol : public nsMsgProtocol,
   // The XOVER process core
   /**
    * The state NNTP_XOVER_SEND, which actually sends the message.
+   * If the server advertised OVER, the chunk is split into several ranges
+   * and up to MAX_PIPELINED_OVER of them are requested at once.
    * Followed by: NNTP_XOVER_RESPONSE
    */
   nsresult XoverSend();
+  /**
+   * Sends OVER commands for the rest of the chunk, keeping the pipeline full.
+   */
+  nsresult SendOverCommands();
+  /**
+   * Called when the response to one OVER command has been read.
+   * Followed by: NNTP_XOVER_RESPONSE      if more OVER commands are pending
+   *              NNTP_XHDR_SEND           if the chunk is finished
+   *              see XoverFailed          if one of the commands failed
+   */
+  nsresult FinishOverResponse();
   /**
    * This state, NNTP_XOVER_RESPONSE, actually checks the XOVER capabiliity.
+   * Only 423 (no articles in an OVER range) is skipped; other errors are
+   * handled by XoverFailed once the pipeline has been read.
    * Followed by: NNTP_XOVER               if XOVER is supported
-   *              NNTP_READ_GROUP          if it isn't
+   *              NNTP_XOVER_RESPONSE      if more OVER commands are pending
+   *              see XoverFailed          if it isn't
    */
   nsresult ReadXoverResponse();
+  /**
+   * Handles the error response to XOVER or OVER.
+   * Followed by: NNTP_BEGIN_AUTHORIZE     if authentication is required
+   *              NNTP_READ_GROUP          otherwise
+   */
+  void XoverFailed();
   /**
    * This state, NNTP_XOVER, processes the results from the XOVER command.
    * It asks nsNNTPNewsgroupList to process the line using ProcessXOVERLINE.
@@ -470,6 +519,11 @@ class nsNNTPProtocol : public nsMsgProtocol,
    */
   nsresult ProcessXover();
 
+  // Decompresses the server's data once COMPRESS DEFLATE is active, reading
+  // it from a pipe that m_compressedOutputStream writes it into.
+  nsCOMPtr<nsIInputStream> m_inflateStream;
+  nsCOMPtr<nsIOutputStream> m_compressedOutputStream;
+
   // Canceling
   nsresult StartCancel();
   nsresult DoCancel();
@@ -24,7 +24,6 @@
 #include "nsMsgFolderFlags.h"
 #include "nsMsgI18N.h"
 #include "nsUnicharUtils.h"
-#include "nsILineInputStream.h"
 #include "nsNetUtil.h"
 #include "nsISimpleEnumerator.h"
 #include "nsMsgUtils.h"
@@ -63,19 +62,31 @@
 #include "nsMsgUtils.h"
 
 /**
- * A comparator class to do cases insensitive comparisons for nsTArray.Sort()
+ * A comparator class for nsTArray.Sort() to order indices into a list of
+ * lower-cased group names by name.
  */
-class nsCStringLowerCaseComparator {
+class nsGroupIndexComparator {
  public:
-  bool Equals(const nsCString &a, const nsCString &b) const {
-    return a.Equals(b, nsCaseInsensitiveCStringComparator());
-  }
+  explicit nsGroupIndexComparator(const nsTArray<nsCString> &aNames)
+      : mNames(aNames) {}
+
+  bool Equals(uint32_t a, uint32_t b) const { return a == b; }
 
-  bool LessThan(const nsCString &a, const nsCString &b) const {
-    return Compare(a, b, nsCaseInsensitiveCStringComparator()) < 0;
+  bool LessThan(uint32_t a, uint32_t b) const {
+    int32_t result = Compare(mNames[a], mNames[b]);
+    return result < 0 || (result == 0 && a < b);
   }
+
+ private:
+  const nsTArray<nsCString> &mNames;
 };
 
+// Packs the three bytes at aChars into a trigram index key.
+static inline uint32_t GroupTrigram(const char *aChars) {
+  return (uint8_t(aChars[0]) << 16) | (uint8_t(aChars[1]) << 8) |
+         uint8_t(aChars[2]);
+}
+
 static NS_DEFINE_CID(kSubscribableServerCID, NS_SUBSCRIBABLESERVER_CID);
 
 NS_IMPL_ADDREF_INHERITED(nsNntpIncomingServer, nsMsgIncomingServer)
@@ -102,6 +113,7 @@ nsNntpIncomingServer::nsNntpIncomingServer() {
   mHasSeenBeginGroups = false;
   mPostingAllowed = false;
   mLastUpdatedTime = 0;
+  mSearchGroupCount = 0;
 
   // we have server wide and per group filters
   m_canHaveFilters = true;
@@ -820,20 +832,26 @@ nsresult nsNntpIncomingServer::LoadHostInfoFile() {
   rv = NS_NewLocalFileInputStream(getter_AddRefs(fileStream), mHostInfoFile);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsCOMPtr<nsILineInputStream> lineInputStream(
-      do_QueryInterface(fileStream, &rv));
+  // Read the file in one go and hand out its lines in place, rather than
+  // copying each of what can be hundreds of thousands of group names into
+  // a line buffer of its own.
+  nsCString contents;
+  rv = NS_ReadInputStreamToString(fileStream, contents, -1);
+  fileStream->Close();
   NS_ENSURE_SUCCESS(rv, rv);
 
-  bool more = true;
-  nsCString line;
-
-  while (more && NS_SUCCEEDED(rv)) {
-    rv = lineInputStream->ReadLine(line, &more);
-    if (line.IsEmpty()) continue;
-    HandleLine(line.get(), line.Length());
+  char *line = contents.BeginWriting();
+  char *end = line + contents.Length();
+  while (line < end) {
+    char *eol = static_cast<char *>(memchr(line, '\n', end - line));
+    if (!eol) eol = end;
+    char *lineEnd = eol;
+    if (lineEnd > line && lineEnd[-1] == '\r') lineEnd--;
+    *lineEnd = '\0';
+    if (lineEnd > line) HandleLine(line, lineEnd - line);
+    line = eol + 1;
   }
   mHasSeenBeginGroups = false;
-  fileStream->Close();
 
   return UpdateSubscribed();
 }
@@ -862,6 +880,7 @@ nsNntpIncomingServer::SubscribeCleanup() {
   nsresult rv = NS_OK;
   rv = ClearInner();
   NS_ENSURE_SUCCESS(rv, rv);
+  ClearSearchIndex();
   return NS_OK;
 }
 
@@ -888,7 +907,7 @@ nsNntpIncomingServer::StartPopulating(nsIMsgWindow *aMsgWindow,
 
   mHostInfoLoaded = false;
   mVersion = INVALID_VERSION;
-  mGroupsOnServer.Clear();
+  ClearGroupsOnServer();
   mGetOnlyNew = aGetOnlyNew;
 
   if (!aForceToServer) {
@@ -903,7 +922,7 @@ nsNntpIncomingServer::StartPopulating(nsIMsgWindow *aMsgWindow,
     mHostInfoHasChanged = true;
     mVersion = VALID_VERSION;
 
-    mGroupsOnServer.Clear();
+    ClearGroupsOnServer();
     rv = nntpService->GetListOfGroupsOnServer(this, aMsgWindow, aGetOnlyNew);
     if (NS_FAILED(rv)) return rv;
   } else {
@@ -1004,7 +1023,7 @@ nsNntpIncomingServer::SetDelimiter(char aDelimiter) {
 NS_IMETHODIMP
 nsNntpIncomingServer::SetAsSubscribed(const nsACString &path) {
   mTempSubscribed.AppendElement(path);
-  if (mGetOnlyNew && (!mGroupsOnServer.Contains(path))) return NS_OK;
+  if (mGetOnlyNew && !IsGroupOnServer(path)) return NS_OK;
 
   nsresult rv = EnsureInner();
   NS_ENSURE_SUCCESS(rv, rv);
@@ -1157,6 +1176,88 @@ nsresult nsNntpIncomingServer::AddGroupOnServer(const nsACString &aName) {
   return NS_OK;
 }
 
+bool nsNntpIncomingServer::IsGroupOnServer(const nsACString &aName) {
+  EnsureSearchIndex();
+
+  nsAutoCString lowerName(aName);
+  ToLowerCase(lowerName);
+
+  // Find the first group whose lower-cased name is not less than aName, then
+  // look for an exact match among the groups differing from it only in case.
+  size_t low = 0, high = mSortedGroups.Length();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (Compare(mGroupsOnServerLower[mSortedGroups[mid]], lowerName) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  for (; low < mSortedGroups.Length(); low++) {
+    uint32_t index = mSortedGroups[low];
+    if (!mGroupsOnServerLower[index].Equals(lowerName)) break;
+    if (mGroupsOnServer[index].Equals(aName)) return true;
+  }
+  return false;
+}
+
+void nsNntpIncomingServer::ClearGroupsOnServer() {
+  if (mTree && !mSubscribeSearchResult.IsEmpty()) {
+    mTree->RowCountChanged(
+        0, -static_cast<int32_t>(mSubscribeSearchResult.Length()));
+  }
+  mGroupsOnServer.Clear();
+  ClearSearchIndex();
+}
+
+/**
+ * Builds the search index if groups were added since it was last built.
+ * Groups are only ever appended to mGroupsOnServer, or all removed at once
+ * in ClearGroupsOnServer(), so comparing the lengths is enough.
+ */
+void nsNntpIncomingServer::EnsureSearchIndex() {
+  uint32_t length = mGroupsOnServer.Length();
+  if (mSortedGroups.Length() == length) return;
+
+  // Searches made against the old index may be missing the new groups, so
+  // don't narrow them down any further.
+  mSearchTerms.Clear();
+  mSearchGroupCount = 0;
+
+  uint32_t i = mGroupsOnServerLower.Length();
+  mGroupsOnServerLower.SetCapacity(length);
+  for (; i < length; i++) {
+    nsCString *lowerName =
+        mGroupsOnServerLower.AppendElement(mGroupsOnServer[i]);
+    ToLowerCase(*lowerName);
+  }
+
+  mSortedGroups.SetLength(length);
+  for (i = 0; i < length; i++) mSortedGroups[i] = i;
+  mSortedGroups.Sort(nsGroupIndexComparator(mGroupsOnServerLower));
+
+  // Posting lists hold positions in mSortedGroups, so a search going through
+  // one finds its groups already sorted.
+  mGroupTrigrams.Clear();
+  for (uint32_t rank = 0; rank < length; rank++) {
+    const nsCString &name = mGroupsOnServerLower[mSortedGroups[rank]];
+    for (uint32_t j = 0; j + 2 < name.Length(); j++) {
+      nsTArray<uint32_t> *postings =
+          mGroupTrigrams.LookupOrAdd(GroupTrigram(name.get() + j));
+      if (postings->IsEmpty() || postings->LastElement() != rank)
+        postings->AppendElement(rank);
+    }
+  }
+}
+
+void nsNntpIncomingServer::ClearSearchIndex() {
+  mSubscribeSearchResult.Clear();
+  mSearchTerms.Clear();
+  mSearchGroupCount = 0;
+  mGroupsOnServerLower.Clear();
+  mSortedGroups.Clear();
+  mGroupTrigrams.Clear();
+}
+
 NS_IMETHODIMP
 nsNntpIncomingServer::AddNewsgroup(const nsAString &aName) {
   // handle duplicates?
@@ -1509,6 +1610,7 @@ NS_IMETHODIMP
 nsNntpIncomingServer::SetSearchValue(const nsAString &aSearchValue) {
   nsCString searchValue = NS_ConvertUTF16toUTF8(aSearchValue);
   MsgCompressWhitespace(searchValue);
+  ToLowerCase(searchValue);
 
   if (mTree) {
     mTree->BeginUpdateBatch();
@@ -1519,24 +1621,70 @@ nsNntpIncomingServer::SetSearchValue(const nsAString &aSearchValue) {
   nsTArray<nsCString> searchStringParts;
   if (!searchValue.IsEmpty()) ParseString(searchValue, ' ', searchStringParts);
 
+  EnsureSearchIndex();
+
+  // If each part of the previous search is contained in a part of this one,
+  // everything this search finds was found by the previous one, so only its
+  // result needs checking. That's the usual case of typing into the box.
+  bool narrowing = mSearchGroupCount == mGroupsOnServer.Length();
+  for (uint32_t i = 0; narrowing && i < mSearchTerms.Length(); i++) {
+    narrowing = false;
+    for (uint32_t j = 0; j < searchStringParts.Length(); j++) {
+      if (MsgFind(searchStringParts[j], mSearchTerms[i], false, 0) !=
+          kNotFound) {
+        narrowing = true;
+        break;
+      }
+    }
+  }
+
+  nsTArray<uint32_t> candidates;
+  if (narrowing) {
+    candidates.SwapElements(mSubscribeSearchResult);
+  } else {
+    // Otherwise start from the shortest posting list of any trigram in the
+    // search, or from all groups if no part is long enough to have one.
+    const nsTArray<uint32_t> *postings = nullptr;
+    bool noMatch = false;
+    for (uint32_t i = 0; !noMatch && i < searchStringParts.Length(); i++) {
+      const nsCString &part = searchStringParts[i];
+      for (uint32_t j = 0; j + 2 < part.Length(); j++) {
+        nsTArray<uint32_t> *trigramPostings =
+            mGroupTrigrams.Get(GroupTrigram(part.get() + j));
+        if (!trigramPostings) {
+          noMatch = true;
+          break;
+        }
+        if (!postings || trigramPostings->Length() < postings->Length())
+          postings = trigramPostings;
+      }
+    }
+    if (postings && !noMatch) {
+      candidates.SetCapacity(postings->Length());
+      for (uint32_t rank : *postings)
+        candidates.AppendElement(mSortedGroups[rank]);
+    } else if (!noMatch) {
+      candidates = mSortedGroups;
+    }
+  }
+
+  // check that all parts of the search string occur
   mSubscribeSearchResult.Clear();
-  uint32_t length = mGroupsOnServer.Length();
-  for (uint32_t i = 0; i < length; i++) {
-    // check that all parts of the search string occur
+  for (uint32_t index : candidates) {
+    const nsCString &name = mGroupsOnServerLower[index];
     bool found = true;
     for (uint32_t j = 0; j < searchStringParts.Length(); ++j) {
-      if (MsgFind(mGroupsOnServer[i], searchStringParts[j], true, 0) ==
-          kNotFound) {
+      if (MsgFind(name, searchStringParts[j], false, 0) == kNotFound) {
         found = false;
         break;
       }
     }
 
-    if (found) mSubscribeSearchResult.AppendElement(mGroupsOnServer[i]);
+    if (found) mSubscribeSearchResult.AppendElement(index);
   }
 
-  nsCStringLowerCaseComparator comparator;
-  mSubscribeSearchResult.Sort(comparator);
+  mSearchTerms.SwapElements(searchStringParts);
+  mSearchGroupCount = mGroupsOnServer.Length();
 
   if (mTree) {
     mTree->RowCountChanged(0, mSubscribeSearchResult.Length());
@@ -1598,7 +1746,8 @@ nsNntpIncomingServer::GetCellProperties(int32_t row, nsTreeColumn *col,
     // in the "subscribedColumn2"
     if (mSearchResultSortDescending)
       row = mSubscribeSearchResult.Length() - 1 - row;
-    if (mTempSubscribed.Contains(mSubscribeSearchResult.ElementAt(row))) {
+    if (mTempSubscribed.Contains(
+            mGroupsOnServer[mSubscribeSearchResult.ElementAt(row)])) {
       properties.AssignLiteral("subscribed-true");
     }
   } else if (colID.First() == 'n') {
@@ -1696,7 +1845,8 @@ nsNntpIncomingServer::GetCellValue(int32_t row, nsTreeColumn *col,
     if (mSearchResultSortDescending)
       row = mSubscribeSearchResult.Length() - 1 - row;
     _retval.Assign(
-        NS_ConvertASCIItoUTF16(mSubscribeSearchResult.ElementAt(row)));
+        NS_ConvertASCIItoUTF16(
+            mGroupsOnServer[mSubscribeSearchResult.ElementAt(row)]));
   }
   return rv;
 }
@@ -1716,8 +1866,8 @@ nsNntpIncomingServer::GetCellText(int32_t row, nsTreeColumn *col,
       row = mSubscribeSearchResult.Length() - 1 - row;
     // some servers have newsgroup names that are non ASCII.  we store
     // those as escaped. unescape here so the UI is consistent
-    rv = NS_MsgDecodeUnescapeURLPath(mSubscribeSearchResult.ElementAt(row),
-                                     _retval);
+    rv = NS_MsgDecodeUnescapeURLPath(
+        mGroupsOnServer[mSubscribeSearchResult.ElementAt(row)], _retval);
   }
   return rv;
 }
@@ -24,6 +24,8 @@
 #include "nsITreeSelection.h"
 #include "nsCOMArray.h"
 #include "nsTArray.h"
+#include "nsClassHashtable.h"
+#include "nsHashKeys.h"
 
 #include "nsNntpMockChannel.h"
 #include "nsAutoPtr.h"
@@ -102,7 +104,18 @@ class nsNntpIncomingServer : public nsMsgIncomingServer,
  private:
   nsTArray<nsCString> mSubscribedNewsgroups;
   nsTArray<nsCString> mGroupsOnServer;
-  nsTArray<nsCString> mSubscribeSearchResult;
+  // Indices into mGroupsOnServer of the groups matching the search.
+  nsTArray<uint32_t> mSubscribeSearchResult;
+  // The lower-cased terms of that search, and how many groups there were, so
+  // that typing more only has to filter the previous result.
+  nsTArray<nsCString> mSearchTerms;
+  uint32_t mSearchGroupCount;
+  // The search index, built on the first search: lower-cased group names,
+  // the groups' indices in case-insensitive order, and for each trigram of
+  // the names the positions in that order of the groups containing it.
+  nsTArray<nsCString> mGroupsOnServerLower;
+  nsTArray<uint32_t> mSortedGroups;
+  nsClassHashtable<nsUint32HashKey, nsTArray<uint32_t>> mGroupTrigrams;
   bool mSearchResultSortDescending;
   // the list of of subscribed newsgroups within a given
   // subscribed dialog session.
@@ -118,6 +131,10 @@ class nsNntpIncomingServer : public nsMsgIncomingServer,
   nsresult WriteHostInfoFile();
   nsresult LoadHostInfoFile();
   nsresult AddGroupOnServer(const nsACString &name);
+  bool IsGroupOnServer(const nsACString &name);
+  void ClearGroupsOnServer();
+  void EnsureSearchIndex();
+  void ClearSearchIndex();
 
   bool mNewsrcHasChanged;
   bool mHostInfoLoaded;
@@ -29,8 +29,11 @@ var { fsDebugAll, gThreadManager, nsMailServer } = ChromeUtils.import(
 var {
   newsArticle,
   NNTP_Giganews_handler,
+  NNTP_OverError_handler,
   NNTP_RFC2980_handler,
+  NNTP_RFC3977_handler,
   NNTP_RFC4643_extension,
+  NNTP_RFC8054_handler,
   NNTP_RFC977_handler,
   nntpDaemon,
 } = ChromeUtils.import("resource://testing-common/mailnews/nntpd.js");
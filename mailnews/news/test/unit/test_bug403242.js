@@ -49,6 +49,7 @@ function run_test() {
   let transaction = server.playTransaction();
   do_check_transaction(transaction[transaction.length - 1], [
     "MODE READER",
+    "CAPABILITIES",
     "GROUP test1",
     "ARTICLE 1",
   ]);
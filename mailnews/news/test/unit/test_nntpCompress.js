@@ -0,0 +1,83 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that COMPRESS DEFLATE is used with a server that advertises it, by
+ * downloading more headers than fit in one read of the inflated data, and
+ * that it isn't used once the server's use_compress_deflate pref is off.
+ */
+
+var kArticles = 3000;
+
+function makeArticle(key) {
+  return (
+    "From: Tester <tester@example.com>\n" +
+    "Date: Sat, 24 Mar 1990 10:59:24 -0500\n" +
+    "Newsgroups: test.compress\n" +
+    "Subject: Article " +
+    key +
+    "\n" +
+    "Message-ID: <compress" +
+    key +
+    "@nntp.invalid>\n" +
+    "\n" +
+    "This is article " +
+    key +
+    ".\n"
+  );
+}
+
+function addArticles(daemon, first, last) {
+  for (let key = first; key <= last; key++) {
+    daemon.addArticleToGroup(
+      new newsArticle(makeArticle(key)),
+      "test.compress",
+      key
+    );
+  }
+}
+
+function getNewMessages(server, localserver, folder) {
+  folder.getNewMessages(null, {
+    OnStopRunningUrl() {
+      localserver.closeCachedConnections();
+    },
+  });
+  server.performTest();
+  return server.playTransaction().them;
+}
+
+function run_test() {
+  // Get all of the new headers without asking.
+  Services.prefs.setBoolPref("mail.server.default.notify.on", false);
+
+  let daemon = setupNNTPDaemon();
+  daemon.addGroup("test.compress");
+  addArticles(daemon, 1, kArticles);
+
+  let server = makeServer(NNTP_RFC8054_handler, daemon);
+  server.start();
+  let localserver = setupLocalServer(server.port);
+  localserver.QueryInterface(Ci.nsINntpIncomingServer);
+  localserver.subscribeToNewsgroup("test.compress");
+  let folder = localserver.rootFolder.getChildNamed("test.compress");
+
+  // The server only understood the commands after COMPRESS if they were
+  // deflated, and we only got the headers if we inflated its responses.
+  let commands = getNewMessages(server, localserver, folder);
+  let compressAt = commands.indexOf("COMPRESS DEFLATE");
+  Assert.notEqual(compressAt, -1);
+  Assert.ok(
+    commands.slice(compressAt + 1).some(command => command.startsWith("OVER "))
+  );
+  Assert.equal(folder.getTotalMessages(false), kArticles);
+
+  localserver.setBoolValue("use_compress_deflate", false);
+  addArticles(daemon, kArticles + 1, kArticles + 10);
+  server.resetTest();
+  commands = getNewMessages(server, localserver, folder);
+  Assert.ok(!commands.includes("COMPRESS DEFLATE"));
+  Assert.equal(folder.getTotalMessages(false), kArticles + 10);
+
+  server.stop();
+}
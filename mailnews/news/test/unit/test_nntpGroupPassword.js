@@ -61,6 +61,7 @@ add_task(async function() {
     transaction = server.playTransaction();
     do_check_transaction(transaction, [
       "MODE READER",
+      "CAPABILITIES",
       "GROUP test.subscribe.empty",
       "AUTHINFO user group1",
       "AUTHINFO pass pass1",
@@ -74,6 +75,7 @@ add_task(async function() {
     transaction = server.playTransaction();
     do_check_transaction(transaction, [
       "MODE READER",
+      "CAPABILITIES",
       "GROUP test.filter",
       "AUTHINFO user group2",
       "AUTHINFO pass pass2",
@@ -0,0 +1,149 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks that headers are downloaded from a server that advertises OVER in
+ * several pipelined ranges, and that a range without any articles in it is
+ * skipped rather than making us fall back to HEAD. Other errors in answer to
+ * OVER make us authenticate (480) or fall back to HEAD (503), but only after
+ * the responses to the rest of the pipeline have been read.
+ */
+
+var daemon = setupNNTPDaemon();
+var server = makeServer(NNTP_OverError_handler, daemon);
+server.start();
+var localserver = setupLocalServer(server.port);
+localserver.QueryInterface(Ci.nsINntpIncomingServer);
+
+function makeArticle(group, key) {
+  return (
+    "From: Tester <tester@example.com>\n" +
+    "Date: Sat, 24 Mar 1990 10:59:24 -0500\n" +
+    "Newsgroups: " +
+    group +
+    "\n" +
+    "Subject: Article " +
+    key +
+    "\n" +
+    "Message-ID: <" +
+    group +
+    key +
+    "@nntp.invalid>\n" +
+    "\n" +
+    "This is article " +
+    key +
+    ".\n"
+  );
+}
+
+// Adds a group with the articles in the given ranges and subscribes to it.
+function addGroup(group, ranges) {
+  daemon.addGroup(group);
+  let count = 0;
+  for (let [first, last] of ranges) {
+    for (let key = first; key <= last; key++) {
+      daemon.addArticleToGroup(
+        new newsArticle(makeArticle(group, key)),
+        group,
+        key
+      );
+      count++;
+    }
+  }
+  localserver.subscribeToNewsgroup(group);
+  return count;
+}
+
+// Gets the new headers of the group and returns the commands we sent.
+function getNewMessages(group) {
+  let folder = localserver.rootFolder.getChildNamed(group);
+  folder.getNewMessages(null, {
+    OnStopRunningUrl() {
+      localserver.closeCachedConnections();
+    },
+  });
+  server.performTest();
+  let commands = server.playTransaction().them;
+  server.resetTest();
+  return commands;
+}
+
+function overCommands(commands) {
+  return commands.filter(command => command.startsWith("OVER ")).join(",");
+}
+
+add_task(async function setup() {
+  // Get all of the new headers without asking.
+  Services.prefs.setBoolPref("mail.server.default.notify.on", false);
+
+  await Services.logins.initializationPromise;
+  let loginInfo = Cc["@mozilla.org/login-manager/loginInfo;1"].createInstance(
+    Ci.nsILoginInfo
+  );
+  loginInfo.init(
+    "news://localhost",
+    null,
+    "news://localhost",
+    "testnews",
+    "newstest",
+    "",
+    ""
+  );
+  Services.logins.addLogin(loginInfo);
+});
+
+add_task(function emptyRange() {
+  // The articles from 5001 to 10000 are missing, so the second range is empty.
+  let expected = addGroup("test.big", [
+    [1, 5000],
+    [10001, 11000],
+  ]);
+
+  let commands = getNewMessages("test.big");
+  Assert.equal(
+    overCommands(commands),
+    "OVER 1-5000,OVER 5001-10000,OVER 10001-11000"
+  );
+  Assert.ok(!commands.some(command => command.startsWith("HEAD ")));
+  let folder = localserver.rootFolder.getChildNamed("test.big");
+  Assert.equal(folder.getTotalMessages(false), expected);
+});
+
+add_task(function authenticationRequired() {
+  let expected = addGroup("test.auth", [
+    [1, 3],
+    [10001, 10003],
+  ]);
+  daemon.overError = "480 Authentication required";
+
+  // All three ranges were asked for before the first 480 came back, and we
+  // only authenticated after their responses had been read. Then the
+  // headers were asked for again.
+  let commands = getNewMessages("test.auth");
+  let ranges = "OVER 1-5000,OVER 5001-10000,OVER 10001-10003";
+  Assert.equal(overCommands(commands), ranges + "," + ranges);
+  let auth = commands.indexOf("AUTHINFO user testnews");
+  Assert.notEqual(auth, -1);
+  Assert.equal(commands[auth + 1], "AUTHINFO pass newstest");
+  Assert.equal(overCommands(commands.slice(auth)), ranges);
+  Assert.ok(!commands.some(command => command.startsWith("HEAD ")));
+  let folder = localserver.rootFolder.getChildNamed("test.auth");
+  Assert.equal(folder.getTotalMessages(false), expected);
+});
+
+add_task(function serviceUnavailable() {
+  let expected = addGroup("test.unavailable", [[1, 10]]);
+  daemon.overError = "503 Overview not available";
+
+  // We fell back to HEAD for each article and didn't send OVER again.
+  let commands = getNewMessages("test.unavailable");
+  Assert.equal(overCommands(commands), "OVER 1-10");
+  let heads = commands.filter(command => command.startsWith("HEAD "));
+  Assert.equal(heads.length, expected);
+  Assert.ok(commands.indexOf("OVER 1-10") < commands.indexOf(heads[0]));
+  let folder = localserver.rootFolder.getChildNamed("test.unavailable");
+  Assert.equal(folder.getTotalMessages(false), expected);
+
+  delete daemon.overError;
+  server.stop();
+});
@@ -30,6 +30,7 @@ add_task(async function() {
     transaction = server.playTransaction();
     do_check_transaction(transaction, [
       "MODE READER",
+      "CAPABILITIES",
       "LIST",
       "AUTHINFO user testnews",
       "AUTHINFO pass newstest",
@@ -81,6 +81,7 @@ add_task(async function() {
     var transaction = server.playTransaction();
     do_check_transaction(transaction, [
       "MODE READER",
+      "CAPABILITIES",
       "LIST",
       "AUTHINFO user testnews",
       "AUTHINFO pass newstest",
@@ -32,7 +32,7 @@ function testRFC977() {
     setupProtocolTest(NNTP_PORT, prefix + "*");
     server.performTest();
     transaction = server.playTransaction();
-    do_check_transaction(transaction, ["MODE READER", "LIST"]);
+    do_check_transaction(transaction, ["MODE READER", "CAPABILITIES", "LIST"]);
 
     // Test - getting group headers
     test = "news:test.subscribe.empty";
@@ -42,6 +42,7 @@ function testRFC977() {
     transaction = server.playTransaction();
     do_check_transaction(transaction, [
       "MODE READER",
+      "CAPABILITIES",
       "GROUP test.subscribe.empty",
     ]);
 
@@ -53,6 +54,7 @@ function testRFC977() {
     transaction = server.playTransaction();
     do_check_transaction(transaction, [
       "MODE READER",
+      "CAPABILITIES",
       "ARTICLE <TSS1@nntp.invalid>",
     ]);
 
@@ -62,7 +64,11 @@ function testRFC977() {
     setupProtocolTest(NNTP_PORT, prefix + "test.filter?list-ids");
     server.performTest();
     transaction = server.playTransaction();
-    do_check_transaction(transaction, ["MODE READER", "listgroup test.filter"]);
+    do_check_transaction(transaction, [
+      "MODE READER",
+      "CAPABILITIES",
+      "listgroup test.filter",
+    ]);
 
     // Test - posting
     test = "news with post";
@@ -71,7 +77,7 @@ function testRFC977() {
     setupProtocolTest(NNTP_PORT, url);
     server.performTest();
     transaction = server.playTransaction();
-    do_check_transaction(transaction, ["MODE READER", "POST"]);
+    do_check_transaction(transaction, ["MODE READER", "CAPABILITIES", "POST"]);
   } catch (e) {
     dump("NNTP Protocol test " + test + " failed for type RFC 977:\n");
     try {
@@ -0,0 +1,48 @@
+/* Any copyright is dedicated to the Public Domain.
+ * http://creativecommons.org/publicdomain/zero/1.0/ */
+
+/*
+ * Checks the subscribe dialog's search over the groups listed by the server,
+ * both when starting a new search and when narrowing down the previous one.
+ */
+
+// Pairs of search strings and the number of groups they should find, in the
+// order they are typed.
+var kSearches = [
+  ["", 5],
+  ["t", 5],
+  ["test", 5],
+  ["test.", 4],
+  ["test.sub", 2],
+  ["test.subscribe.s", 1],
+  ["test.sub", 2],
+  ["sub", 2],
+  ["EMPTY", 2],
+  ["empty sub", 1],
+  ["zzz", 0],
+  ["test", 5],
+];
+
+function run_test() {
+  let daemon = setupNNTPDaemon();
+  let server = makeServer(NNTP_RFC2980_handler, daemon);
+  server.start();
+  let localserver = setupLocalServer(server.port);
+
+  setupProtocolTest(
+    server.port,
+    "news://localhost:" + server.port + "/*",
+    localserver
+  );
+  server.performTest();
+
+  localserver.QueryInterface(Ci.nsISubscribableServer);
+  let view = localserver.QueryInterface(Ci.nsITreeView);
+  for (let [search, count] of kSearches) {
+    localserver.setSearchValue(search);
+    Assert.equal(view.rowCount, count, "searching for '" + search + "'");
+  }
+
+  localserver.subscribeCleanup();
+  server.stop();
+}
@@ -18,6 +18,8 @@ var EXPORTED_SYMBOLS = [
   "IMAP_RFC3348_extension",
   "IMAP_RFC4315_extension",
   "IMAP_RFC5258_extension",
+  "IMAP_RFC7162_extension",
+  "IMAP_RFC3516_extension",
   "IMAP_RFC2195_extension",
 ];
 
@@ -82,6 +84,11 @@ function imapDaemon(flags, syncFunc) {
   this.commandToFail = "";
   // This can be used to simulate timeouts on large copies
   this.copySleep = 0;
+  // The part numbers the BINARY extension refuses to decode (UNKNOWN-CTE).
+  this.undecodableParts = [];
+  // The part numbers it gives the decoded size of, but then refuses to
+  // decode anyway.
+  this.undecodableContent = [];
 }
 imapDaemon.prototype = {
   synchronize(mailbox, update) {
@@ -2374,6 +2381,217 @@ var IMAP_RFC5258_extension = {
   kCapabilities: ["LIST-EXTENDED"],
 };
 
+// RFC 7162: CONDSTORE and QRESYNC
+// A message's modseq is message.modseq, 1 if unset, and the mailbox's highest
+// is box.highestmodseq. box.vanished lists the { uid, modseq } of the
+// messages expunged. STORE and EXPUNGE keep these up to date; tests that
+// change a mailbox directly need to do so themselves.
+var IMAP_RFC7162_extension = {
+  preload(toBeThis) {
+    toBeThis._preRFC7162SELECT = toBeThis.SELECT;
+    toBeThis._preRFC7162FETCH = toBeThis.FETCH;
+    toBeThis._preRFC7162STORE = toBeThis.STORE;
+    toBeThis._preRFC7162EXPUNGE = toBeThis.EXPUNGE;
+    toBeThis._qresyncEnabled = false;
+  },
+  ENABLE(args) {
+    let enabled = [];
+    for (let extension of args) {
+      extension = extension.toUpperCase();
+      if (extension == "QRESYNC") {
+        this._qresyncEnabled = true;
+      }
+      if (extension == "QRESYNC" || extension == "CONDSTORE") {
+        enabled.push(extension);
+      }
+    }
+    return "* ENABLED " + enabled.join(" ") + "\0OK ENABLE completed";
+  },
+  SELECT(args) {
+    // SELECT "box" (CONDSTORE) or SELECT "box" (QRESYNC (uidvalidity modseq
+    // [known-uids]))
+    let params = args[1] || [];
+    let qresync = params.length > 1 && params[0].toUpperCase() == "QRESYNC";
+    if (qresync && !this._qresyncEnabled) {
+      return "BAD QRESYNC isn't enabled";
+    }
+    let response = this._preRFC7162SELECT([args[0]]);
+    if (response.startsWith("NO")) {
+      return response;
+    }
+    let box = this._selectedMailbox;
+    let lines = "* OK [HIGHESTMODSEQ " + (box.highestmodseq || 1) + "]\0";
+    if (qresync && params[1][0] == box.uidvalidity) {
+      let modseq = parseInt(params[1][1]);
+      let ranges = (params[1][2] || "1:*").split(",").map(range =>
+        range.split(":").map(n => (n == "*" ? Infinity : parseInt(n)))
+      );
+      let known = uid =>
+        ranges.some(([first, last = first]) => uid >= first && uid <= last);
+      let vanished = (box.vanished || [])
+        .filter(v => v.modseq > modseq && known(v.uid))
+        .map(v => v.uid);
+      if (vanished.length) {
+        lines += "* VANISHED (EARLIER) " + vanished.join(",") + "\0";
+      }
+      box._messages.forEach((message, i) => {
+        if ((message.modseq || 1) > modseq) {
+          lines +=
+            "* " +
+            (i + 1) +
+            " FETCH (" +
+            this._FETCH_UID(message) +
+            " " +
+            this._FETCH_FLAGS(message) +
+            " " +
+            this._FETCH_MODSEQ(message) +
+            ")\0";
+        }
+      });
+    }
+    let end = response.lastIndexOf("\0") + 1;
+    return response.substring(0, end) + lines + response.substring(end);
+  },
+  FETCH(args, uid) {
+    // FETCH set items (CHANGEDSINCE modseq)
+    let modifiers = args[2];
+    args = args.slice(0, 2);
+    if (modifiers && modifiers[0].toUpperCase() == "CHANGEDSINCE") {
+      let since = parseInt(modifiers[1]);
+      let ids = [];
+      let messages = this._parseSequenceSet(args[0], uid, ids);
+      let changed = [];
+      for (let i = 0; i < messages.length; i++) {
+        if ((messages[i].modseq || 1) > since) {
+          changed.push(uid ? messages[i].uid : ids[i]);
+        }
+      }
+      if (!changed.length) {
+        return "OK FETCH completed";
+      }
+      args[0] = changed.join(",");
+      if (typeof args[1] == "string") {
+        args[1] = [args[1]];
+      }
+      args[1].push("MODSEQ");
+    }
+    return this._preRFC7162FETCH(args, uid);
+  },
+  STORE(args, uid) {
+    let ids = [];
+    let messages = this._parseSequenceSet(args[0], uid, ids);
+    let response = this._preRFC7162STORE(args, uid);
+    let box = this._selectedMailbox;
+    for (let i = 0; i < messages.length; i++) {
+      box.highestmodseq = (box.highestmodseq || 1) + 1;
+      messages[i].modseq = box.highestmodseq;
+      // With QRESYNC, the flag updates carry the uid and modseq.
+      if (this._qresyncEnabled) {
+        response = response.replace(
+          "* " + ids[i] + " FETCH (FLAGS",
+          "* " +
+            ids[i] +
+            " FETCH (" +
+            this._FETCH_UID(messages[i]) +
+            " " +
+            this._FETCH_MODSEQ(messages[i]) +
+            " FLAGS"
+        );
+      }
+    }
+    return response;
+  },
+  EXPUNGE(args) {
+    let box = this._selectedMailbox;
+    let doomed = box._messages
+      .filter(message => message.flags.includes("\\Deleted"))
+      .map(message => message.uid);
+    let response = this._preRFC7162EXPUNGE(args);
+    if (doomed.length) {
+      box.highestmodseq = (box.highestmodseq || 1) + 1;
+      box.vanished = (box.vanished || []).concat(
+        doomed.map(uid => ({ uid, modseq: box.highestmodseq }))
+      );
+      // With QRESYNC, expunges are reported by uid.
+      if (this._qresyncEnabled) {
+        response =
+          "* VANISHED " +
+          doomed.join(",") +
+          "\0" +
+          response.replace(/\* \d+ EXPUNGE\0/g, "");
+      }
+    }
+    return response;
+  },
+  _FETCH_MODSEQ(message) {
+    return "MODSEQ (" + (message.modseq || 1) + ")";
+  },
+  kCapabilities: ["ENABLE", "CONDSTORE", "QRESYNC"],
+  _argFormat: { SELECT: ["..."], FETCH: ["..."], ENABLE: ["..."] },
+  _enabledCommands: { 1: ["ENABLE"], 2: ["ENABLE"] },
+};
+
+// RFC 3516: Binary content extension (BINARY)
+var IMAP_RFC3516_extension = {
+  preload(toBeThis) {
+    toBeThis._preRFC3516FETCH = toBeThis.FETCH;
+  },
+  FETCH(args, uid) {
+    let items = [].concat(args[1]).join(" ");
+    for (let [, item, partNum] of items.matchAll(
+      /(BINARY[^[\s]*)\[([^\]]*)\]/gi
+    )) {
+      if (
+        this._daemon.undecodableParts.includes(partNum) ||
+        (this._daemon.undecodableContent.includes(partNum) &&
+          item.toUpperCase() != "BINARY.SIZE")
+      ) {
+        return "NO [UNKNOWN-CTE] can't decode part " + partNum;
+      }
+    }
+    return this._preRFC3516FETCH(args, uid);
+  },
+  _FETCH_BINARY(message, query) {
+    // parts = [ name, section, empty, {, partial, empty } ]
+    var parts = query.split(/[[\]<>]/);
+    var partNum = parts[1];
+    var data = message.getPartBody(partNum);
+    var headers = message.getPartHeaders(partNum);
+    var encoding = headers.has("content-transfer-encoding")
+      ? headers.get("content-transfer-encoding").toLowerCase()
+      : "";
+    if (encoding == "base64") {
+      data = atob(data.replace(/\s/g, ""));
+    } else if (encoding == "quoted-printable") {
+      data = data
+        .replace(/=\r?\n/g, "")
+        .replace(/=([0-9A-Fa-f]{2})/g, (match, hex) =>
+          String.fromCharCode(parseInt(hex, 16))
+        );
+    }
+
+    if (parts[0] == "BINARY.SIZE") {
+      return "BINARY.SIZE[" + partNum + "] " + data.length;
+    }
+
+    if (parts[0] != "BINARY.PEEK" && !this._readOnly) {
+      message.setFlag("\\Seen");
+    }
+
+    let response = "BINARY[" + partNum + "]";
+    if (parts[3]) {
+      let [start, length] = parts[3].split(/\./).map(e => parseInt(e));
+      response += "<" + start + ">";
+      data = data.substr(start, length);
+    }
+    this.sendingLiteral = true;
+    response += " {" + data.length + "}\r\n";
+    response += data;
+    return response;
+  },
+  kCapabilities: ["BINARY"],
+};
+
 /**
  * This implements AUTH schemes. Could be moved into RFC3501 actually.
  * The test can en-/disable auth schemes by modifying kAuthSchemes.
@@ -120,6 +120,18 @@ function nsMailServer(handlerCreator, daemon) {
   this._test = false;
   this._watchWord = undefined;
 
+  /**
+   * How long, in milliseconds, each line from the client takes to reach the
+   * handler, to test clients as if the server were far away.
+   */
+  this.latency = 0;
+
+  /**
+   * The most lines from a client that have arrived but weren't handled yet,
+   * e.g. commands the client pipelined.
+   */
+  this.maxLinesInFlight = 0;
+
   /**
    * An array to hold refs to all the input streams below, so that they don't
    * get GCed
@@ -302,6 +314,27 @@ function readTo(input, count, arr) {
   Array.prototype.push.apply(arr, old);
 }
 
+/**
+ * Wraps data in DEFLATE (RFC 1951) blocks that store it uncompressed. Like
+ * the output of a sync flush, none of them is final, so more can follow.
+ */
+function deflateStored(data) {
+  let blocks = "";
+  for (let start = 0; start < data.length; start += 0xffff) {
+    let chunk = data.substring(start, start + 0xffff);
+    let len = chunk.length;
+    let header = String.fromCharCode(
+      0,
+      len & 0xff,
+      len >> 8,
+      ~len & 0xff,
+      (~len >> 8) & 0xff
+    );
+    blocks += header + chunk;
+  }
+  return blocks;
+}
+
 /**
  * The nsMailReader service, which reads and handles the lines.
  * All specific handling is passed off to the handler, which is responsible
@@ -322,11 +355,14 @@ function readTo(input, count, arr) {
  *
  * The return of postCommand is ignored. The return of onMultiline is a bit
  * complicated: it may or may not return a response string (returning one is
- * necessary to trigger the postCommand handler).
+ * necessary to trigger the postCommand handler). A [command] may also return
+ * undefined, for commands which only respond once more data has arrived; the
+ * postCommand handler is still called for those.
  *
  * This object has the following supplemental functions for use by handlers:
  * closeSocket  Performs a server-side socket closing
  * setMultiline Sets the multiline mode based on the argument
+ * startDeflate Compresses the connection once the response is sent
  */
 function nsMailReader(server, handler, transport, debug, logTransaction) {
   this._debug = debug;
@@ -345,7 +381,9 @@ function nsMailReader(server, handler, transport, debug, logTransaction) {
   );
   this._output = output;
   if (logTransaction) {
-    this.transaction = { us: [], them: [] };
+    // For each command in them, sentBefore holds how many of the responses in
+    // us had been sent when the command arrived.
+    this.transaction = { us: [], them: [], sentBefore: [] };
   } else {
     this.transaction = null;
   }
@@ -366,6 +404,11 @@ function nsMailReader(server, handler, transport, debug, logTransaction) {
 
   this._isRunning = true;
 
+  // Lines held back to simulate the server's latency, and the timer that
+  // handles them when they're due.
+  this._delayedLines = [];
+  this._delayTimer = null;
+
   this.observer = {
     server,
     forced: false,
@@ -422,120 +465,209 @@ nsMailReader.prototype = {
       this._realCloseSocket();
       return;
     }
-    readTo(stream, bytes, this._buffer);
+    if (this._inflater) {
+      this._inflater.onDataAvailable(null, stream, 0, bytes);
+    } else {
+      readTo(stream, bytes, this._buffer);
+    }
     this._findLines();
 
-    while (this._lines.length > 0) {
-      var line = this._lines.shift();
-
-      if (this._debug != fsDebugNone) {
-        dump("RECV: " + line + "\n");
+    if (this._server.latency > 0) {
+      let dueAt = Date.now() + this._server.latency;
+      let sentBefore = this.transaction ? this.transaction.us.length : 0;
+      for (let line of this._lines) {
+        this._delayedLines.push({ line, dueAt, sentBefore });
       }
+      this._lines = [];
+      this._noteLinesInFlight(this._delayedLines.length);
+      if (!this._delayTimer) {
+        this._scheduleDelayedLines();
+      }
+    } else {
+      this._noteLinesInFlight(this._lines.length);
+      let sentBefore = this.transaction ? this.transaction.us.length : 0;
+      while (this._lines.length > 0) {
+        this._processLine(this._lines.shift(), sentBefore);
+      }
+    }
+
+    if (this._isRunning) {
+      stream.asyncWait(this, 0, 0, Services.tm.currentThread);
+      this.timer.initWithCallback(
+        this.observer,
+        TIMEOUT,
+        Ci.nsITimer.TYPE_ONE_SHOT
+      );
+    }
+  },
+
+  _noteLinesInFlight(count) {
+    this._server.maxLinesInFlight = Math.max(
+      this._server.maxLinesInFlight,
+      count
+    );
+  },
 
-      var response;
-      try {
-        let command;
-        if (this._multiline) {
-          response = this._handler.onMultiline(line);
+  /**
+   * Handles the delayed lines that are due, and sets a timer for the next.
+   */
+  _scheduleDelayedLines() {
+    let now = Date.now();
+    while (
+      this._isRunning &&
+      this._delayedLines.length > 0 &&
+      this._delayedLines[0].dueAt <= now
+    ) {
+      let { line, sentBefore } = this._delayedLines.shift();
+      this._processLine(line, sentBefore);
+    }
+    this._delayTimer = null;
+    if (!this._isRunning || this._delayedLines.length == 0) {
+      return;
+    }
+    this._delayTimer = Cc["@mozilla.org/timer;1"].createInstance(Ci.nsITimer);
+    this._delayTimer.initWithCallback(
+      () => this._scheduleDelayedLines(),
+      this._delayedLines[0].dueAt - now,
+      Ci.nsITimer.TYPE_ONE_SHOT
+    );
+  },
 
-          if (response === undefined) {
-            continue;
-          }
-        } else {
-          // Record the transaction
-          if (this.transaction) {
-            this.transaction.them.push(line);
-          }
-
-          // Find the command and splice it out...
-          var splitter = line.indexOf(" ");
-          command = splitter == -1 ? line : line.substring(0, splitter);
-          let args = splitter == -1 ? "" : line.substring(splitter + 1);
-
-          // By convention, commands are uppercase
-          command = command.toUpperCase();
-
-          if (this._debug == fsDebugAll) {
-            dump("Received command " + command + "\n");
-          }
-
-          if (command in this._handler) {
-            response = this._handler[command](args);
-          } else {
-            response = this._handler.onError(command, args);
-          }
+  _processLine(line, sentBefore) {
+    if (this._debug != fsDebugNone) {
+      dump("RECV: " + line + "\n");
+    }
+
+    var response;
+    try {
+      let command;
+      if (this._multiline) {
+        response = this._handler.onMultiline(line);
+
+        if (response === undefined) {
+          return;
         }
+      } else {
+        // Record the transaction
+        if (this.transaction) {
+          this.transaction.them.push(line);
+          this.transaction.sentBefore.push(sentBefore);
+        }
+
+        // Find the command and splice it out...
+        var splitter = line.indexOf(" ");
+        command = splitter == -1 ? line : line.substring(0, splitter);
+        let args = splitter == -1 ? "" : line.substring(splitter + 1);
 
-        this._preventLFMunge = false;
-        this._handler.postCommand(this);
+        // By convention, commands are uppercase
+        command = command.toUpperCase();
 
-        if (this.watchWord && command == this.watchWord) {
-          this.stopTest();
+        if (this._debug == fsDebugAll) {
+          dump("Received command " + command + "\n");
         }
-      } catch (e) {
-        response = this._handler.onServerFault(e);
-        if (e instanceof Error) {
-          dump(e.name + ": " + e.message + "\n");
-          dump("File: " + e.fileName + " Line: " + e.lineNumber + "\n");
-          dump("Stack trace:\n" + e.stack);
+
+        if (command in this._handler) {
+          response = this._handler[command](args);
         } else {
-          dump("Exception caught: " + e + "\n");
+          response = this._handler.onError(command, args);
         }
       }
 
-      if (!this._preventLFMunge) {
-        response = response.replace(/([^\r])\n/g, "$1\r\n");
-      }
+      this._preventLFMunge = false;
+      this._handler.postCommand(this);
 
-      if (!response.endsWith("\n")) {
-        response = response + "\r\n";
+      if (this.watchWord && command == this.watchWord) {
+        this.stopTest();
       }
-
-      if (this._debug == fsDebugRecvSend) {
-        dump("SEND: " + response.split(" ", 1)[0] + "\n");
-      } else if (this._debug == fsDebugAll) {
-        var responses = response.split("\n");
-        responses.forEach(function(line) {
-          dump("SEND: " + line + "\n");
-        });
+    } catch (e) {
+      response = this._handler.onServerFault(e);
+      if (e instanceof Error) {
+        dump(e.name + ": " + e.message + "\n");
+        dump("File: " + e.fileName + " Line: " + e.lineNumber + "\n");
+        dump("Stack trace:\n" + e.stack);
+      } else {
+        dump("Exception caught: " + e + "\n");
       }
+    }
 
-      if (this.transaction) {
-        this.transaction.us.push(response);
-      }
+    if (response === undefined) {
+      return;
+    }
 
-      try {
-        this._output.write(response, response.length);
-        this._output.flush();
-      } catch (ex) {
-        if (ex.result == Cr.NS_BASE_STREAM_CLOSED) {
-          dump("Stream closed whilst sending, this may be expected\n");
-          this._realCloseSocket();
-        } else {
-          // Some other issue, let the test see it.
-          throw ex;
-        }
-      }
+    if (!this._preventLFMunge) {
+      response = response.replace(/([^\r])\n/g, "$1\r\n");
+    }
 
-      if (this._signalStop) {
+    if (!response.endsWith("\n")) {
+      response = response + "\r\n";
+    }
+
+    if (this._debug == fsDebugRecvSend) {
+      dump("SEND: " + response.split(" ", 1)[0] + "\n");
+    } else if (this._debug == fsDebugAll) {
+      var responses = response.split("\n");
+      responses.forEach(function(line) {
+        dump("SEND: " + line + "\n");
+      });
+    }
+
+    if (this.transaction) {
+      this.transaction.us.push(response);
+    }
+
+    try {
+      let data = this._inflater ? deflateStored(response) : response;
+      this._output.write(data, data.length);
+      this._output.flush();
+    } catch (ex) {
+      if (ex.result == Cr.NS_BASE_STREAM_CLOSED) {
+        dump("Stream closed whilst sending, this may be expected\n");
         this._realCloseSocket();
-        this._signalStop = false;
+      } else {
+        // Some other issue, let the test see it.
+        throw ex;
       }
     }
 
-    if (this._isRunning) {
-      stream.asyncWait(this, 0, 0, Services.tm.currentThread);
-      this.timer.initWithCallback(
-        this.observer,
-        TIMEOUT,
-        Ci.nsITimer.TYPE_ONE_SHOT
-      );
+    if (this._signalStop) {
+      this._realCloseSocket();
+      this._signalStop = false;
+    }
+
+    if (this._signalDeflate) {
+      this._beginDeflate();
+      this._signalDeflate = false;
     }
   },
 
   closeSocket() {
     this._signalStop = true;
   },
+  startDeflate() {
+    this._signalDeflate = true;
+  },
+  _beginDeflate() {
+    // What the client sends is inflated by the converter for HTTP's deflate
+    // encoding, which also takes a stream without a zlib header.
+    let reader = this;
+    this._inflater = Cc[
+      "@mozilla.org/streamconv;1?from=deflate&to=uncompressed"
+    ].createInstance(Ci.nsIStreamConverter);
+    this._inflater.asyncConvertData(
+      "deflate",
+      "uncompressed",
+      {
+        onStartRequest(request) {},
+        onDataAvailable(request, stream, offset, count) {
+          readTo(stream, count, reader._buffer);
+        },
+        onStopRequest(request, status) {},
+        QueryInterface: ChromeUtils.generateQI(["nsIStreamListener"]),
+      },
+      null
+    );
+    this._inflater.onStartRequest(null);
+  },
   _realCloseSocket() {
     this._isRunning = false;
     this._output.close();
@@ -11,8 +11,10 @@ var EXPORTED_SYMBOLS = [
   "NNTP_RFC977_handler",
   "NNTP_RFC2980_handler",
   "NNTP_RFC3977_handler",
+  "NNTP_RFC8054_handler",
   "NNTP_Giganews_handler",
   "NNTP_RFC4643_extension",
+  "NNTP_OverError_handler",
 ];
 
 function nntpDaemon(flags) {
@@ -575,6 +577,59 @@ subclass(NNTP_Giganews_handler, NNTP_RFC2980_handler, {
   },
 });
 
+// This handler adds the RFC 3977 CAPABILITIES and OVER commands. Unlike XOVER
+// here, OVER answers 423 for a range without any articles in it.
+function NNTP_RFC3977_handler(daemon) {
+  subconstructor(this, NNTP_RFC2980_handler, daemon);
+}
+subclass(NNTP_RFC3977_handler, NNTP_RFC2980_handler, {
+  kCapabilities: ["VERSION 2", "READER", "OVER", "LIST ACTIVE NEWSGROUPS"],
+  CAPABILITIES(args) {
+    return "101 Capability list:\n" + this.kCapabilities.join("\n") + "\n.";
+  },
+  OVER(args) {
+    if (!this.group) {
+      return "412 No group selected";
+    }
+
+    let range = args.split(/ +/, 1)[0];
+    if (this._filterRange(range, this.group.keys).length == 0) {
+      return "423 No articles in that range";
+    }
+    return this.XOVER(args);
+  },
+});
+
+// This handler adds COMPRESS DEFLATE (RFC 8054). The server's responses are
+// sent in stored DEFLATE blocks, which the client inflates like any others.
+function NNTP_RFC8054_handler(daemon) {
+  subconstructor(this, NNTP_RFC3977_handler, daemon);
+}
+subclass(NNTP_RFC8054_handler, NNTP_RFC3977_handler, {
+  kCapabilities: NNTP_RFC3977_handler.prototype.kCapabilities.concat([
+    "COMPRESS DEFLATE",
+  ]),
+  compressing: false,
+  COMPRESS(args) {
+    if (this.compressing) {
+      return "502 Command unavailable";
+    }
+    if (args.toUpperCase() != "DEFLATE") {
+      return "503 Compression algorithm not supported";
+    }
+    this.startCompressing = true;
+    return "206 Compression active";
+  },
+  postCommand(reader) {
+    this.parent.postCommand(reader);
+    if (this.startCompressing) {
+      reader.startDeflate();
+      this.compressing = true;
+      this.startCompressing = false;
+    }
+  },
+});
+
 function NNTP_RFC4643_extension(daemon) {
   subconstructor(this, NNTP_RFC2980_handler, daemon);
 
@@ -654,3 +709,25 @@ subclass(NNTP_RFC4643_extension, NNTP_RFC2980_handler, {
     return "480 Authentication required";
   },
 });
+
+// This handler answers OVER with the daemon's overError instead of the
+// headers. A "480" error lasts until the client has authenticated.
+function NNTP_OverError_handler(daemon) {
+  subconstructor(this, NNTP_RFC3977_handler, daemon);
+}
+subclass(NNTP_OverError_handler, NNTP_RFC3977_handler, {
+  expectedUsername: "testnews",
+  expectedPassword: "newstest",
+  requireBoth: true,
+  authenticated: false,
+  usernameReceived: false,
+
+  AUTHINFO: NNTP_RFC4643_extension.prototype.AUTHINFO,
+  OVER(args) {
+    let error = this._daemon.overError;
+    if (error && !(error.startsWith("480") && this.authenticated)) {
+      return error;
+    }
+    return this.parent.OVER(args);
+  },
+});
@@ -51,6 +51,8 @@ SMTP_RFC2821_handler.prototype = {
     this._nextAuthFunction = undefined;
     this._multiline = false;
     this.expectingData = false;
+    this._chunkBytesLeft = 0;
+    this._chunkedPost = false;
   },
   EHLO(args) {
     var capa = "250-fakeserver greets you";
@@ -106,6 +108,34 @@ SMTP_RFC2821_handler.prototype = {
     this._daemon.post = "";
     return "354 ok\n";
   },
+  /**
+   * CHUNKING (RFC 3030). Only handles chunks which end with a complete line,
+   * as ours do: the data is read line by line, and the CRLF counts towards
+   * the chunk size. Advertise "CHUNKING" in kCapabilities to use it.
+   */
+  BDAT(args) {
+    if (this._state == kStateAuthNeeded) {
+      return "530 5.7.0 Authentication required";
+    }
+    let [size, last] = args.split(" ");
+    if (!this._chunkedPost) {
+      this._daemon.post = "";
+      this._chunkedPost = true;
+    }
+    this._chunkBytesLeft = parseInt(size);
+    this._chunkLast = last == "LAST";
+    if (this._chunkBytesLeft > 0) {
+      return undefined;
+    }
+    return this._endChunk();
+  },
+  _endChunk() {
+    if (this._chunkLast) {
+      this._chunkedPost = false;
+      return "250 Wonderful article, your style is gorgeous!";
+    }
+    return "250 " + this._daemon.post.length + " octets received";
+  },
   RSET(args) {
     return "250 ok\n";
   },
@@ -225,6 +255,11 @@ SMTP_RFC2821_handler.prototype = {
     return "451 Internal server error: " + e;
   },
   onMultiline(line) {
+    if (this._chunkBytesLeft > 0) {
+      this._daemon.post += line + "\r\n";
+      this._chunkBytesLeft -= line.length + 2;
+      return this._chunkBytesLeft > 0 ? undefined : this._endChunk();
+    }
     if (this._nextAuthFunction) {
       var func = this._nextAuthFunction;
       this._multiline = false;
@@ -263,6 +298,8 @@ SMTP_RFC2821_handler.prototype = {
     if (this.closing) {
       reader.closeSocket();
     }
-    reader.setMultiline(this._multiline || this.expectingData);
+    reader.setMultiline(
+      this._multiline || this.expectingData || this._chunkBytesLeft > 0
+    );
   },
 };